@@ -0,0 +1,594 @@
+#include "AsyncLog.h"
+
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace AsyncLog {
+	bool enabled;
+
+	// Each message in a ring buffer is a header followed by the text,
+	// which may wrap around the end of the buffer:
+	struct Header {
+		uint64_t seq;
+		uint64_t len;
+	};
+
+	enum class BufferState {
+		IN_USE,
+		RETIRED, // Owning thread has exited
+		FREE,    // Retired and drained, ready for the next new thread
+	};
+
+	// Single producer, single consumer ring buffer of messages. Only the
+	// owning thread may push(), and only the thread holding drain_lock
+	// may read messages and advance the tail.
+	class ThreadBuffer {
+	public:
+		ThreadBuffer(size_t capacity, unsigned index);
+		~ThreadBuffer();
+
+		static size_t round_capacity(size_t capacity);
+
+		bool push(const char *text, size_t len);
+		void copy_out(uint64_t pos, void *dst, size_t len) const;
+		size_t capacity() const { return (size_t)mask + 1; }
+
+		const unsigned index;
+		std::atomic<uint64_t> head;
+		std::atomic<uint64_t> tail;
+
+		// Only moves from FREE to IN_USE with buffers_lock held, and
+		// from RETIRED to FREE with both locks held:
+		std::atomic<BufferState> state;
+
+		// Written by the owning thread, read by stats():
+		std::atomic<uint64_t> messages;
+		std::atomic<uint64_t> bytes;
+		std::atomic<uint64_t> dropped_messages;
+		std::atomic<uint64_t> dropped_bytes;
+
+		// Only accessed with drain_lock held:
+		uint64_t reported_dropped_messages;
+		uint64_t reported_dropped_bytes;
+
+	private:
+		char *data;
+		uint64_t mask;
+
+		void copy_in(uint64_t pos, const void *src, size_t len);
+
+		ThreadBuffer(const ThreadBuffer&) = delete;
+		ThreadBuffer& operator=(const ThreadBuffer&) = delete;
+	};
+
+	struct Pending {
+		uint64_t seq;
+		const ThreadBuffer *buffer;
+		uint64_t pos;
+		size_t len;
+
+		bool operator<(const Pending &other) const { return seq < other.seq; }
+	};
+
+	// Every buffer currently allocated, in use or not. A thread that has
+	// exited may still have messages queued in its buffer, so it is only
+	// reused once those have been written out. Free buffers that are the
+	// wrong size after async_buffer_size was changed are deleted, with
+	// their statistics kept in freed_stats. The rest live until the
+	// process exits, as does this list of them, since other threads may
+	// still be logging while static destructors are running:
+	static std::mutex buffers_lock;
+	static std::vector<ThreadBuffer*> &buffers = *new std::vector<ThreadBuffer*>;
+	static Stats freed_stats;
+	static size_t threads_seen;
+	static std::atomic<size_t> buffer_capacity(256 * 1024);
+	static thread_local ThreadBuffer *thread_buffer;
+
+	// Orders messages between threads, as far as it can - see AsyncLog.h:
+	static std::atomic<uint64_t> next_seq;
+
+	// Whoever holds this lock drains every buffer and owns the file:
+	static std::mutex drain_lock;
+	static std::atomic<std::thread::id> drain_owner;
+	static FILE *out_fp;
+	static std::vector<Pending> pending;
+	static std::vector<char> out_buf;
+	static std::atomic<uint64_t> writes;
+
+	// Wakes the background thread early. Each restart of the thread bumps
+	// the generation, so a previous thread that has not noticed it should
+	// stop yet will exit without touching anything:
+	static std::mutex wake_lock;
+	static std::condition_variable wake_cv;
+	static bool wake_requested;
+	static unsigned writer_generation;
+	static bool writer_running;
+	static unsigned flush_interval;
+
+	static void request_drain();
+}
+
+AsyncLog::ThreadBuffer::ThreadBuffer(size_t capacity, unsigned index) :
+	index(index),
+	head(0),
+	tail(0),
+	state(BufferState::IN_USE),
+	messages(0),
+	bytes(0),
+	dropped_messages(0),
+	dropped_bytes(0),
+	reported_dropped_messages(0),
+	reported_dropped_bytes(0)
+{
+	size_t n = round_capacity(capacity);
+
+	data = new char[n];
+	mask = n - 1;
+}
+
+size_t AsyncLog::ThreadBuffer::round_capacity(size_t capacity)
+{
+	size_t n = 4096;
+
+	while (n < capacity)
+		n *= 2;
+
+	return n;
+}
+
+AsyncLog::ThreadBuffer::~ThreadBuffer()
+{
+	delete [] data;
+}
+
+void AsyncLog::ThreadBuffer::copy_in(uint64_t pos, const void *src, size_t len)
+{
+	size_t offset = (size_t)(pos & mask);
+	size_t first = std::min<size_t>(len, capacity() - offset);
+
+	memcpy(data + offset, src, first);
+	memcpy(data, (const char*)src + first, len - first);
+}
+
+void AsyncLog::ThreadBuffer::copy_out(uint64_t pos, void *dst, size_t len) const
+{
+	size_t offset = (size_t)(pos & mask);
+	size_t first = std::min<size_t>(len, capacity() - offset);
+
+	memcpy(dst, data + offset, first);
+	memcpy((char*)dst + first, data, len - first);
+}
+
+bool AsyncLog::ThreadBuffer::push(const char *text, size_t len)
+{
+	uint64_t pos = head.load(std::memory_order_relaxed);
+	uint64_t used = pos - tail.load(std::memory_order_acquire);
+	size_t need = sizeof(Header) + len;
+	Header header;
+
+	if (need > capacity() - used) {
+		dropped_messages.store(dropped_messages.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		dropped_bytes.store(dropped_bytes.load(std::memory_order_relaxed) + len, std::memory_order_relaxed);
+		return false;
+	}
+
+	header.seq = next_seq.fetch_add(1, std::memory_order_relaxed);
+	header.len = len;
+	copy_in(pos, &header, sizeof(Header));
+	copy_in(pos + sizeof(Header), text, len);
+	head.store(pos + need, std::memory_order_release);
+
+	messages.store(messages.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	bytes.store(bytes.load(std::memory_order_relaxed) + len, std::memory_order_relaxed);
+
+	// Don't wait for the next interval if this buffer is filling up:
+	if (used < capacity() / 2 && used + need >= capacity() / 2)
+		request_drain();
+
+	return true;
+}
+
+static AsyncLog::ThreadBuffer* get_thread_buffer()
+{
+	using namespace AsyncLog;
+
+	size_t capacity;
+
+	if (thread_buffer)
+		return thread_buffer;
+
+	std::lock_guard<std::mutex> guard(buffers_lock);
+
+	threads_seen++;
+	capacity = ThreadBuffer::round_capacity(buffer_capacity.load());
+
+	for (ThreadBuffer *buffer : buffers) {
+		if (buffer->state.load(std::memory_order_acquire) == BufferState::FREE
+				&& buffer->capacity() == capacity) {
+			buffer->state.store(BufferState::IN_USE, std::memory_order_relaxed);
+			thread_buffer = buffer;
+			return thread_buffer;
+		}
+	}
+
+	thread_buffer = new ThreadBuffer(capacity, (unsigned)threads_seen - 1);
+	buffers.push_back(thread_buffer);
+
+	return thread_buffer;
+}
+
+void AsyncLog::thread_exit()
+{
+	if (!thread_buffer)
+		return;
+
+	// Publishes everything this thread pushed along with the state, so
+	// that once the drain sees it retired it knows the head is final:
+	thread_buffer->state.store(BufferState::RETIRED, std::memory_order_release);
+	thread_buffer = NULL;
+}
+
+static void add_stats(AsyncLog::Stats *stats, const AsyncLog::ThreadBuffer *buffer)
+{
+	stats->messages += buffer->messages.load(std::memory_order_relaxed);
+	stats->bytes += buffer->bytes.load(std::memory_order_relaxed);
+	stats->dropped_messages += buffer->dropped_messages.load(std::memory_order_relaxed);
+	stats->dropped_bytes += buffer->dropped_bytes.load(std::memory_order_relaxed);
+}
+
+// Frees up the buffers of threads that have exited once they have been
+// drained, and deletes any free buffers left the wrong size by a change to
+// the buffer size. Must be called with the drain lock held:
+static void recycle_buffers_locked()
+{
+	using namespace AsyncLog;
+
+	std::lock_guard<std::mutex> guard(buffers_lock);
+	size_t capacity = ThreadBuffer::round_capacity(buffer_capacity.load());
+	ThreadBuffer *buffer;
+	size_t i;
+
+	for (i = 0; i < buffers.size(); ) {
+		buffer = buffers[i];
+
+		if (buffer->state.load(std::memory_order_acquire) == BufferState::RETIRED
+				&& buffer->head.load(std::memory_order_relaxed) == buffer->tail.load(std::memory_order_relaxed))
+			buffer->state.store(BufferState::FREE, std::memory_order_release);
+
+		if (buffer->state.load(std::memory_order_relaxed) == BufferState::FREE
+				&& buffer->capacity() != capacity) {
+			add_stats(&freed_stats, buffer);
+			delete buffer;
+			buffers.erase(buffers.begin() + i);
+			continue;
+		}
+
+		i++;
+	}
+}
+
+static bool lock_drain(unsigned timeout_ms)
+{
+	using namespace AsyncLog;
+
+	unsigned waited = 0;
+
+	if (timeout_ms) {
+		while (!drain_lock.try_lock()) {
+			if (waited++ >= timeout_ms)
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	} else {
+		drain_lock.lock();
+	}
+
+	drain_owner.store(std::this_thread::get_id());
+	return true;
+}
+
+static void unlock_drain()
+{
+	using namespace AsyncLog;
+
+	drain_owner.store(std::thread::id());
+	drain_lock.unlock();
+}
+
+static void append(std::vector<char> *out, const char *str, size_t len)
+{
+	out->insert(out->end(), str, str + len);
+}
+
+// Collects the messages from every buffer, puts them back in the order they
+// were numbered and writes them out in a single write. Must be called with
+// the drain lock held:
+static void drain_locked()
+{
+	using namespace AsyncLog;
+
+	std::vector<ThreadBuffer*> snapshot;
+	std::vector<uint64_t> ends;
+	Header header;
+	uint64_t pos, end, dropped_messages, dropped_bytes;
+	size_t offset, i;
+	char note[160];
+	int len;
+
+	{
+		std::lock_guard<std::mutex> guard(buffers_lock);
+		snapshot = buffers;
+	}
+
+	pending.clear();
+	out_buf.clear();
+
+	for (ThreadBuffer *buffer : snapshot) {
+		end = buffer->head.load(std::memory_order_acquire);
+		for (pos = buffer->tail.load(std::memory_order_relaxed); pos < end; pos += sizeof(Header) + header.len) {
+			buffer->copy_out(pos, &header, sizeof(Header));
+			pending.push_back({header.seq, buffer, pos + sizeof(Header), (size_t)header.len});
+		}
+		ends.push_back(end);
+	}
+
+	// Each buffer is already in order, so this is just interleaving them:
+	std::sort(pending.begin(), pending.end());
+
+	for (Pending &msg : pending) {
+		offset = out_buf.size();
+		out_buf.resize(offset + msg.len);
+		msg.buffer->copy_out(msg.pos, out_buf.data() + offset, msg.len);
+	}
+
+	for (i = 0; i < snapshot.size(); i++) {
+		snapshot[i]->tail.store(ends[i], std::memory_order_release);
+
+		dropped_messages = snapshot[i]->dropped_messages.load(std::memory_order_relaxed);
+		dropped_bytes = snapshot[i]->dropped_bytes.load(std::memory_order_relaxed);
+		if (dropped_messages == snapshot[i]->reported_dropped_messages)
+			continue;
+
+		len = snprintf(note, sizeof(note), "*** Async log: dropped %llu messages (%llu bytes) from thread #%u - consider increasing async_buffer_size ***\n",
+				(unsigned long long)(dropped_messages - snapshot[i]->reported_dropped_messages),
+				(unsigned long long)(dropped_bytes - snapshot[i]->reported_dropped_bytes),
+				snapshot[i]->index);
+		if (len > 0)
+			append(&out_buf, note, std::min<size_t>(len, sizeof(note) - 1));
+		snapshot[i]->reported_dropped_messages = dropped_messages;
+		snapshot[i]->reported_dropped_bytes = dropped_bytes;
+	}
+
+	recycle_buffers_locked();
+
+	if (out_buf.empty() || !out_fp)
+		return;
+
+	fwrite(out_buf.data(), 1, out_buf.size(), out_fp);
+	fflush(out_fp);
+	writes.store(writes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void AsyncLog::request_drain()
+{
+	std::lock_guard<std::mutex> guard(wake_lock);
+
+	wake_requested = true;
+	wake_cv.notify_one();
+}
+
+static void writer_thread(unsigned generation)
+{
+	using namespace AsyncLog;
+
+	std::unique_lock<std::mutex> guard(wake_lock);
+
+	while (writer_generation == generation) {
+		wake_cv.wait_for(guard, std::chrono::milliseconds(flush_interval),
+				[]() { return wake_requested; });
+		wake_requested = false;
+		if (writer_generation != generation)
+			break;
+
+		guard.unlock();
+		lock_drain(0);
+		drain_locked();
+		unlock_drain();
+		guard.lock();
+	}
+}
+
+void AsyncLog::start(FILE *fp, size_t buffer_size, unsigned flush_interval_ms)
+{
+	buffer_capacity.store(buffer_size);
+
+	lock_drain(0);
+	if (out_fp && out_fp != fp)
+		drain_locked();
+	out_fp = fp;
+	unlock_drain();
+
+	std::lock_guard<std::mutex> guard(wake_lock);
+	flush_interval = std::max(flush_interval_ms, 1u);
+	if (!writer_running) {
+		writer_running = true;
+		std::thread(writer_thread, writer_generation).detach();
+	}
+
+	enabled = true;
+}
+
+void AsyncLog::stop()
+{
+	enabled = false;
+
+	{
+		std::lock_guard<std::mutex> guard(wake_lock);
+		writer_generation++;
+		writer_running = false;
+		wake_requested = true;
+		wake_cv.notify_one();
+	}
+
+	// When called from DllMain during process exit the writer thread
+	// has already been terminated, and may have been holding the lock:
+	if (!lock_drain(1000))
+		return;
+	drain_locked();
+	out_fp = NULL;
+	unlock_drain();
+}
+
+void AsyncLog::write(const char *buf, size_t len)
+{
+	ThreadBuffer *buffer = get_thread_buffer();
+
+	// Anything that would take up a large part of the buffer (e.g. a
+	// decompiled shader) is written out directly after everything queued
+	// before it, rather than risk dropping it:
+	if (len > buffer->capacity() / 4) {
+		lock_drain(0);
+		drain_locked();
+		if (out_fp) {
+			fwrite(buf, 1, len, out_fp);
+			fflush(out_fp);
+		}
+		unlock_drain();
+		return;
+	}
+
+	buffer->push(buf, len);
+}
+
+void AsyncLog::vprintf(const char *fmt, va_list ap)
+{
+	char stack_buf[512];
+	std::vector<char> heap_buf;
+	va_list ap_len;
+	int len;
+
+	va_copy(ap_len, ap);
+	len = vsnprintf(stack_buf, sizeof(stack_buf), fmt, ap_len);
+	va_end(ap_len);
+	if (len < 0)
+		return;
+
+	if ((size_t)len < sizeof(stack_buf))
+		return write(stack_buf, len);
+
+	heap_buf.resize(len + 1);
+	vsnprintf(heap_buf.data(), len + 1, fmt, ap);
+	write(heap_buf.data(), len);
+}
+
+void AsyncLog::printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	AsyncLog::vprintf(fmt, ap);
+	va_end(ap);
+}
+
+void AsyncLog::vwprintf(const wchar_t *fmt, va_list ap)
+{
+	wchar_t stack_buf[512];
+	std::vector<wchar_t> heap_buf;
+	wchar_t *wbuf = stack_buf;
+	size_t size = sizeof(stack_buf) / sizeof(stack_buf[0]);
+	std::string narrow;
+	mbstate_t state;
+	char mb[16];
+	va_list ap_len;
+	size_t mb_len;
+	int len;
+
+	// Unlike vsnprintf, vswprintf does not tell us how much space it
+	// needs, so keep doubling the buffer until it fits:
+	while (true) {
+		va_copy(ap_len, ap);
+		len = vswprintf(wbuf, size, fmt, ap_len);
+		va_end(ap_len);
+		if (len >= 0)
+			break;
+		if (size >= 1024 * 1024)
+			return;
+		size *= 2;
+		heap_buf.resize(size);
+		wbuf = heap_buf.data();
+	}
+
+	// Convert to the same multibyte encoding fwprintf would have written
+	// to a narrow stream, substituting anything unrepresentable:
+	memset(&state, 0, sizeof(state));
+	narrow.reserve(len);
+	for (int i = 0; i < len; i++) {
+		if ((unsigned)wbuf[i] < 0x80) {
+			narrow.push_back((char)wbuf[i]);
+			continue;
+		}
+		mb_len = wcrtomb(mb, wbuf[i], &state);
+		if (mb_len == (size_t)-1) {
+			narrow.push_back('?');
+			memset(&state, 0, sizeof(state));
+		} else {
+			narrow.append(mb, mb_len);
+		}
+	}
+
+	write(narrow.data(), narrow.size());
+}
+
+void AsyncLog::wprintf(const wchar_t *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	AsyncLog::vwprintf(fmt, ap);
+	va_end(ap);
+}
+
+void AsyncLog::flush()
+{
+	lock_drain(0);
+	drain_locked();
+	unlock_drain();
+}
+
+void AsyncLog::flush_for_crash()
+{
+	// Anything the crash handler logs from here on should go straight to
+	// the file, in case this thread crashed while writing out the log or
+	// the lock cannot be taken for some other reason:
+	enabled = false;
+
+	if (drain_owner.load() == std::this_thread::get_id())
+		return;
+
+	if (!lock_drain(1000))
+		return;
+	drain_locked();
+	unlock_drain();
+}
+
+AsyncLog::Stats AsyncLog::stats()
+{
+	std::lock_guard<std::mutex> guard(buffers_lock);
+	Stats ret = freed_stats;
+
+	for (ThreadBuffer *buffer : buffers)
+		add_stats(&ret, buffer);
+	ret.writes = writes.load(std::memory_order_relaxed);
+	ret.threads = threads_seen;
+	ret.buffers = buffers.size();
+
+	return ret;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// Asynchronous backend for LogInfo/LogDebug, enabled with async=1 in the
+// [Logging] section.
+//
+// With calls=1 (and especially debug=1) logging can easily dominate the frame
+// time, as every message is formatted and written through the C runtime on
+// the thread that logged it, taking the FILE lock each time and making a
+// system call for every message in unbuffered mode. Instead, each thread now
+// formats its messages into a ring buffer of its own without taking any locks,
+// and a background thread collects them from every buffer, puts them back in
+// order and writes them out in large chunks.
+//
+// Memory use is bounded by the size of each thread's buffer and the number of
+// threads logging at any one time - once a thread has exited and everything it
+// logged has been written out, its buffer is handed to the next new thread
+// that logs. If a thread logs faster than the background thread can keep up
+// its buffer will fill, and further messages from that thread are dropped
+// (rather than stalling the game) until there is room again. Dropped messages
+// are counted, and a note of how many were lost is written to the log in
+// their place.
+//
+// Messages from any one thread are always written in the order it logged
+// them, but the order between threads is only approximate. Messages are
+// numbered as they are queued (after formatting), and one thread's message
+// can be written out ahead of an earlier numbered one from another thread
+// that was still being copied into its buffer at the time. Don't read too
+// much into the interleaving of messages logged at almost the same time from
+// different threads. Code built without MIGOTO_ASYNC_LOG (e.g. the decompiler
+// libraries) still writes to the log file directly, so its output may appear
+// a little ahead of messages that were still queued at the time.
+//
+// This file and AsyncLog.cpp have no Windows dependencies so that they can be
+// built and benchmarked on other platforms.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace AsyncLog {
+	struct Stats {
+		uint64_t messages;
+		uint64_t bytes;
+		uint64_t dropped_messages;
+		uint64_t dropped_bytes;
+		uint64_t writes;
+		size_t threads;
+		size_t buffers;
+	};
+
+	extern bool enabled;
+
+	// Starts (or reconfigures) the background thread writing to fp, which
+	// must stay open until stop(). buffer_size is the size of each
+	// thread's ring buffer in bytes (rounded up to a power of two) and is
+	// only used for buffers allocated after this call. The log is written
+	// out every flush_interval_ms, or sooner if a buffer is half full:
+	void start(FILE *fp, size_t buffer_size, unsigned flush_interval_ms);
+
+	// Writes out everything still queued and stops the background thread.
+	// Safe to call from DllMain, as it never waits for that thread:
+	void stop();
+
+	void vprintf(const char *fmt, va_list ap);
+	void printf(const char *fmt, ...);
+	void vwprintf(const wchar_t *fmt, va_list ap);
+	void wprintf(const wchar_t *fmt, ...);
+	void write(const char *buf, size_t len);
+
+	// Writes out everything logged by any thread before this call and
+	// flushes the file, doing the work on the calling thread:
+	void flush();
+
+	// Variant of flush() for the crash handler, which gives up rather than
+	// waiting forever if the thread that crashed was in the middle of
+	// writing out the log, or was killed while doing so:
+	void flush_for_crash();
+
+	// Called as a thread exits (from DLL_THREAD_DETACH) to return its
+	// buffer for reuse once anything still queued in it has been written
+	// out. A thread that logs again afterwards is given a new buffer:
+	void thread_exit();
+
+	Stats stats();
+}
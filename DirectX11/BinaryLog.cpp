@@ -0,0 +1,442 @@
+#include "BinaryLog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include <wchar.h>
+
+namespace BinaryLog {
+
+// Events that we cannot record in binary form are formatted to text at
+// the time of the call and logged with this instead:
+static const char fallback_format[] = "%s";
+
+static const size_t flush_threshold = 64 * 1024;
+
+static bool is_flag(char c)
+{
+	return c == '-' || c == '+' || c == ' ' || c == '#' || c == '0';
+}
+
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static ArgType int_arg_type(const std::string &length, size_t long_size, size_t pointer_size)
+{
+	if (length == "ll" || length == "I64" || length == "j")
+		return ArgType::INT64;
+	if (length == "l")
+		return long_size == 8 ? ArgType::INT64 : ArgType::INT32;
+	if (length == "z" || length == "t" || length == "I")
+		return pointer_size == 8 ? ArgType::INT64 : ArgType::INT32;
+	return ArgType::INT32;
+}
+
+bool parse_format(const std::string &fmt, bool wide, size_t long_size, size_t pointer_size, std::vector<FormatSpec> *specs)
+{
+	size_t i = 0, n = fmt.size();
+	FormatSpec spec;
+
+	specs->clear();
+
+	while (i < n) {
+		if (fmt[i] != '%') {
+			i++;
+			continue;
+		}
+
+		spec = FormatSpec();
+		spec.start = i++;
+
+		if (i < n && fmt[i] == '%') {
+			spec.end = ++i;
+			spec.conversion = 0;
+			specs->push_back(spec);
+			continue;
+		}
+
+		while (i < n && is_flag(fmt[i]))
+			spec.flags += fmt[i++];
+
+		if (i < n && fmt[i] == '*') {
+			spec.width_arg = true;
+			i++;
+		} else {
+			while (i < n && is_digit(fmt[i]))
+				spec.width += fmt[i++];
+		}
+
+		if (i < n && fmt[i] == '.') {
+			spec.has_precision = true;
+			i++;
+			if (i < n && fmt[i] == '*') {
+				spec.precision_arg = true;
+				i++;
+			} else {
+				while (i < n && is_digit(fmt[i]))
+					spec.precision += fmt[i++];
+			}
+		}
+
+		if (!fmt.compare(i, 3, "I64") || !fmt.compare(i, 3, "I32"))
+			spec.length = fmt.substr(i, 3);
+		else if (!fmt.compare(i, 2, "hh") || !fmt.compare(i, 2, "ll"))
+			spec.length = fmt.substr(i, 2);
+		else if (i < n && strchr("hlLjztIw", fmt[i]))
+			spec.length = fmt.substr(i, 1);
+		i += spec.length.size();
+
+		if (i >= n)
+			return false;
+		spec.conversion = fmt[i++];
+		spec.end = i;
+
+		switch (spec.conversion) {
+			case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+				spec.type = int_arg_type(spec.length, long_size, pointer_size);
+				break;
+			case 'c': case 'C':
+				// Promoted to int (or wint_t) regardless of size
+				spec.type = ArgType::INT32;
+				break;
+			case 'e': case 'E': case 'f': case 'F':
+			case 'g': case 'G': case 'a': case 'A':
+				spec.type = ArgType::DOUBLE;
+				break;
+			case 'p':
+				spec.type = ArgType::POINTER;
+				break;
+			case 's': case 'S':
+				if (spec.length == "h")
+					spec.type = ArgType::STRING;
+				else if (spec.length == "l" || spec.length == "w")
+					spec.type = ArgType::WSTRING;
+				else if ((spec.conversion == 's') == wide)
+					spec.type = ArgType::WSTRING;
+				else
+					spec.type = ArgType::STRING;
+				break;
+			default:
+				// Includes %n, which we never want to see in a log
+				return false;
+		}
+
+		specs->push_back(spec);
+	}
+
+	return true;
+}
+
+void utf8_from_wide(const wchar_t *str, std::string *out)
+{
+	uint32_t c;
+
+	out->clear();
+
+	for (; *str; str++) {
+		c = (uint32_t)*str;
+
+		// Windows wchar_t is UTF-16, so recombine surrogate pairs:
+		if (sizeof(wchar_t) == 2 && c >= 0xd800 && c < 0xdc00 &&
+				(uint32_t)str[1] >= 0xdc00 && (uint32_t)str[1] < 0xe000) {
+			c = 0x10000 + ((c - 0xd800) << 10) + ((uint32_t)str[1] - 0xdc00);
+			str++;
+		}
+
+		if (c < 0x80) {
+			*out += (char)c;
+		} else if (c < 0x800) {
+			*out += (char)(0xc0 | (c >> 6));
+			*out += (char)(0x80 | (c & 0x3f));
+		} else if (c < 0x10000) {
+			*out += (char)(0xe0 | (c >> 12));
+			*out += (char)(0x80 | ((c >> 6) & 0x3f));
+			*out += (char)(0x80 | (c & 0x3f));
+		} else {
+			*out += (char)(0xf0 | (c >> 18));
+			*out += (char)(0x80 | ((c >> 12) & 0x3f));
+			*out += (char)(0x80 | ((c >> 6) & 0x3f));
+			*out += (char)(0x80 | (c & 0x3f));
+		}
+	}
+}
+
+static int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Writer::Writer() :
+	fp(NULL),
+	buf_len(0),
+	start_time(0),
+	args_len(0),
+	next_format_id(0)
+{
+	memset(format_cache, 0, sizeof(format_cache));
+	memset(string_cache, 0, sizeof(string_cache));
+}
+
+Writer::~Writer()
+{
+	close();
+}
+
+void Writer::open(FILE *fp)
+{
+	close();
+
+	formats.clear();
+	memset(format_cache, 0, sizeof(format_cache));
+	strings.clear();
+	memset(string_cache, 0, sizeof(string_cache));
+	next_format_id = 0;
+	buf.resize(flush_threshold * 2);
+	buf_len = 0;
+
+	this->fp = fp;
+	put(magic, sizeof(magic));
+	put<uint32_t>(version);
+	put<uint32_t>((uint32_t)sizeof(void*));
+	put<uint32_t>((uint32_t)sizeof(long));
+
+	start_time = now_ns();
+}
+
+void Writer::close()
+{
+	if (!fp)
+		return;
+
+	if (buf_len)
+		fwrite(buf.data(), 1, buf_len, fp);
+	buf_len = 0;
+	fp = NULL;
+}
+
+void Writer::grow(size_t len)
+{
+	// Only long strings should ever need this, since we flush well
+	// before the buffer fills:
+	buf.resize(std::max(buf.size() * 2, buf_len + len));
+}
+
+Writer::Format* Writer::lookup_format(const void *fmt, bool wide)
+{
+	std::unordered_map<const void*, Format>::iterator i;
+	size_t slot;
+
+	slot = ((uintptr_t)fmt >> 2) % (sizeof(format_cache) / sizeof(format_cache[0]));
+	if (format_cache[slot].fmt == fmt)
+		return format_cache[slot].format;
+
+	i = formats.find(fmt);
+	if (i == formats.end())
+		return add_format(fmt, wide, slot);
+
+	format_cache[slot].fmt = fmt;
+	format_cache[slot].format = &i->second;
+	return &i->second;
+}
+
+Writer::Format* Writer::add_format(const void *fmt, bool wide, size_t slot)
+{
+	std::vector<FormatSpec> specs;
+	std::string text;
+	Format *format;
+
+	if (wide)
+		utf8_from_wide((const wchar_t*)fmt, &text);
+	else
+		text = (const char*)fmt;
+
+	format = &formats[fmt];
+	format_cache[slot].fmt = fmt;
+	format_cache[slot].format = format;
+	format->ok = parse_format(text, wide, sizeof(long), sizeof(void*), &specs);
+	if (!format->ok)
+		return format;
+
+	format->id = next_format_id++;
+	for (const FormatSpec &spec : specs) {
+		if (spec.width_arg)
+			format->args.push_back(ArgType::INT32);
+		if (spec.precision_arg)
+			format->args.push_back(ArgType::INT32);
+		if (spec.conversion)
+			format->args.push_back(spec.type);
+	}
+	if (args.size() < format->args.size() * 8)
+		args.resize(format->args.size() * 8);
+
+	put(RecordType::FORMAT);
+	put<uint32_t>(format->id);
+	put<uint8_t>(wide);
+	put<uint32_t>((uint32_t)text.size());
+	put(text.data(), text.size());
+
+	return format;
+}
+
+Writer::StringMap::iterator Writer::intern_scratch()
+{
+	StringMap::iterator i;
+	uint32_t id;
+
+	i = strings.find(scratch);
+	if (i != strings.end())
+		return i;
+
+	id = (uint32_t)strings.size();
+	i = strings.emplace(scratch, id).first;
+
+	put(RecordType::STRING);
+	put<uint32_t>(id);
+	put<uint32_t>((uint32_t)scratch.size());
+	put(scratch.data(), scratch.size());
+
+	return i;
+}
+
+uint32_t Writer::intern_string(const char *str)
+{
+	StringMap::iterator i;
+	size_t slot;
+
+	if (!str)
+		return NULL_STRING;
+
+	slot = ((uintptr_t)str >> 2) % (sizeof(string_cache) / sizeof(string_cache[0]));
+	if (string_cache[slot].str == str && !strcmp(str, string_cache[slot].interned->c_str()))
+		return string_cache[slot].id;
+
+	// Reuse the same string for the lookup to avoid an allocation:
+	scratch.assign(str);
+	i = intern_scratch();
+
+	string_cache[slot].str = str;
+	string_cache[slot].interned = &i->first;
+	string_cache[slot].id = i->second;
+
+	return i->second;
+}
+
+uint32_t Writer::intern_wstring(const wchar_t *str)
+{
+	if (!str)
+		return NULL_STRING;
+
+	utf8_from_wide(str, &scratch);
+	return intern_scratch()->second;
+}
+
+void Writer::begin_event(uint32_t format_id, uint8_t flags, uint32_t frame, uint32_t draw_call)
+{
+	put(RecordType::EVENT);
+	put<uint32_t>(format_id);
+	put<uint8_t>(flags);
+	if (flags & EVENT_DRAW_CALL) {
+		put<uint64_t>((uint64_t)(now_ns() - start_time));
+		put<uint32_t>(draw_call);
+	}
+	if (flags & EVENT_FRAME)
+		put<uint32_t>(frame);
+}
+
+void Writer::put_event(const Format *format, uint8_t flags, uint32_t frame, uint32_t draw_call, va_list ap)
+{
+	// Strings are interned before the event is started, since the first
+	// use of a string writes out a record of its own:
+	args_len = 0;
+	for (ArgType type : format->args) {
+		switch (type) {
+			case ArgType::INT32:
+				put_arg<int32_t>(va_arg(ap, int));
+				break;
+			case ArgType::INT64:
+				put_arg<int64_t>(va_arg(ap, long long));
+				break;
+			case ArgType::DOUBLE:
+				put_arg<double>(va_arg(ap, double));
+				break;
+			case ArgType::POINTER:
+				put_arg<uint64_t>((uintptr_t)va_arg(ap, void*));
+				break;
+			case ArgType::STRING:
+				put_arg<uint32_t>(intern_string(va_arg(ap, const char*)));
+				break;
+			case ArgType::WSTRING:
+				put_arg<uint32_t>(intern_wstring(va_arg(ap, const wchar_t*)));
+				break;
+		}
+	}
+
+	begin_event(format->id, flags, frame, draw_call);
+	put(args.data(), args_len);
+
+	if (buf_len >= flush_threshold) {
+		fwrite(buf.data(), 1, buf_len, fp);
+		buf_len = 0;
+	}
+}
+
+void Writer::vlog(uint8_t flags, uint32_t frame, uint32_t draw_call, const char *fmt, va_list ap)
+{
+	Format *format;
+	char text[4096];
+
+	if (!fp)
+		return;
+
+	format = lookup_format(fmt, false);
+	if (format->ok) {
+		put_event(format, flags, frame, draw_call, ap);
+		return;
+	}
+
+	vsnprintf(text, sizeof(text), fmt, ap);
+	log(flags, frame, draw_call, fallback_format, text);
+}
+
+void Writer::vlog(uint8_t flags, uint32_t frame, uint32_t draw_call, const wchar_t *fmt, va_list ap)
+{
+	Format *format;
+	wchar_t text[4096];
+
+	if (!fp)
+		return;
+
+	format = lookup_format(fmt, true);
+	if (format->ok) {
+		put_event(format, flags, frame, draw_call, ap);
+		return;
+	}
+
+	text[0] = L'\0';
+	vswprintf(text, sizeof(text) / sizeof(wchar_t), fmt, ap);
+	text[sizeof(text) / sizeof(wchar_t) - 1] = L'\0';
+	log(flags, frame, draw_call, L"%ls", text);
+}
+
+void Writer::log(uint8_t flags, uint32_t frame, uint32_t draw_call, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vlog(flags, frame, draw_call, fmt, ap);
+	va_end(ap);
+}
+
+void Writer::log(uint8_t flags, uint32_t frame, uint32_t draw_call, const wchar_t *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vlog(flags, frame, draw_call, fmt, ap);
+	va_end(ap);
+}
+
+}
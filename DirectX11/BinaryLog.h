@@ -0,0 +1,164 @@
+#pragma once
+
+// Compact binary event log, used for the frame analysis log when log_binary
+// is specified in analyse_options.
+//
+// The frame analysis log records every call the game makes in the frame along
+// with the handles and hashes of everything bound, and with heavy frames
+// formatting all of that as text with vfprintf at the time of the call can
+// take longer than the frame itself. Instead, each call is now recorded as an
+// event holding the id of its format string, a timestamp and the raw values of
+// its arguments. Format strings and string arguments are written out once the
+// first time they are seen, and referred to by id from then on. All the
+// formatting is deferred to cmd_LogFormat, which renders the log back to the
+// usual text format, or to CSV or JSON.
+//
+// Format strings are cached on their address, so must be string literals (or
+// otherwise never change while the log is open). The log is written in the
+// native byte order of the machine that wrote it, which is always little
+// endian on the platforms we support.
+//
+// This file and BinaryLog.cpp have no Windows dependencies, and are shared
+// with cmd_LogFormat.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace BinaryLog {
+	static const char magic[8] = {'3', 'D', 'M', 'B', 'L', 'O', 'G', '\0'};
+	static const uint32_t version = 1;
+
+	// The file starts with the magic, then the version, pointer size and
+	// size of a long as 32bit values, followed by a series of records.
+	// Each record starts with one of these:
+	enum class RecordType : uint8_t {
+		// uint32 id, uint8 wide, uint32 length, UTF-8 text
+		FORMAT = 'F',
+		// uint32 id, uint32 length, UTF-8 text
+		STRING = 'S',
+		// uint32 format id, uint8 flags, then if EVENT_DRAW_CALL a
+		// uint64 of nanoseconds since the log was opened and the
+		// uint32 draw call, then a uint32 frame if EVENT_FRAME, then
+		// the arguments. Events continuing a line in the text log
+		// have neither flag, and so are just the id and arguments
+		EVENT = 'E',
+	};
+
+	// Event flags, indicating which parts of the "<frame>.<draw call> "
+	// prefix were on the line in the text log:
+	static const uint8_t EVENT_DRAW_CALL = 0x1;
+	static const uint8_t EVENT_FRAME = 0x2;
+
+	// String arguments are written as the id of the interned string, or
+	// this for a NULL pointer:
+	static const uint32_t NULL_STRING = 0xffffffff;
+
+	enum class ArgType {
+		INT32,   // 4 bytes
+		INT64,   // 8 bytes
+		DOUBLE,  // 8 bytes
+		POINTER, // 8 bytes, regardless of the pointer size
+		STRING,  // 4 byte string id, narrow string argument
+		WSTRING, // 4 byte string id, wide string argument
+	};
+
+	// A single conversion in a printf style format string. Conversions
+	// that take their width or precision from an argument ('*') consume
+	// an INT32 argument for each before their own:
+	struct FormatSpec {
+		size_t start;         // Offset of the '%'
+		size_t end;           // Offset just past the conversion character
+		std::string flags;
+		bool width_arg;
+		bool precision_arg;
+		std::string width;     // Empty if not specified or width_arg
+		std::string precision; // Empty if not specified or precision_arg
+		bool has_precision;
+		std::string length;    // As written, e.g. "ll", "I64", "h"
+		char conversion;       // Zero for %%
+		ArgType type;
+	};
+
+	// Parses a UTF-8 format string, following the MSVC conventions for
+	// %S, %C, %I64 and so on. wide indicates the format was originally a
+	// wide string, which swaps the meaning of %s/%S and %c/%C. Returns
+	// false for formats we cannot record, such as those using %n.
+	// long_size and pointer_size are those of the process that wrote the
+	// log, which determine the size of %l, %z, %I and friends:
+	bool parse_format(const std::string &fmt, bool wide, size_t long_size, size_t pointer_size, std::vector<FormatSpec> *specs);
+
+	void utf8_from_wide(const wchar_t *str, std::string *out);
+
+	class Writer {
+		struct Format {
+			uint32_t id;
+			bool ok;
+			std::vector<ArgType> args;
+		};
+
+		FILE *fp;
+		std::vector<char> buf;
+		size_t buf_len;
+		int64_t start_time;
+		std::unordered_map<const void*, Format> formats;
+		// Direct mapped cache in front of formats, since looking up
+		// the format is most of the cost of logging an event:
+		struct {
+			const void *fmt;
+			Format *format;
+		} format_cache[256];
+		typedef std::unordered_map<std::string, uint32_t> StringMap;
+		StringMap strings;
+		// Most string arguments are literals, so remember where we
+		// last saw each to skip hashing them, but still compare the
+		// contents in case the memory has been reused:
+		struct {
+			const char *str;
+			const std::string *interned;
+			uint32_t id;
+		} string_cache[256];
+		std::vector<char> args;
+		size_t args_len;
+		std::string scratch;
+		uint32_t next_format_id;
+
+		Format* lookup_format(const void *fmt, bool wide);
+		Format* add_format(const void *fmt, bool wide, size_t slot);
+		StringMap::iterator intern_scratch();
+		uint32_t intern_string(const char *str);
+		uint32_t intern_wstring(const wchar_t *str);
+		void grow(size_t len);
+		void put(const void *data, size_t len)
+		{
+			if (buf_len + len > buf.size())
+				grow(len);
+			memcpy(&buf[buf_len], data, len);
+			buf_len += len;
+		}
+		template <typename T> void put(T val) { put(&val, sizeof(T)); }
+		template <typename T> void put_arg(T val) { memcpy(&args[args_len], &val, sizeof(T)); args_len += sizeof(T); }
+		void begin_event(uint32_t format_id, uint8_t flags, uint32_t frame, uint32_t draw_call);
+		void put_event(const Format *format, uint8_t flags, uint32_t frame, uint32_t draw_call, va_list ap);
+
+	public:
+		Writer();
+		~Writer();
+
+		// Starts a new log in fp, which must have been opened in binary
+		// mode and must stay open until close():
+		void open(FILE *fp);
+		// Writes out anything still buffered. Does not close the file:
+		void close();
+		bool is_open() const { return fp != NULL; }
+
+		void vlog(uint8_t flags, uint32_t frame, uint32_t draw_call, const char *fmt, va_list ap);
+		void vlog(uint8_t flags, uint32_t frame, uint32_t draw_call, const wchar_t *fmt, va_list ap);
+		void log(uint8_t flags, uint32_t frame, uint32_t draw_call, const char *fmt, ...);
+		void log(uint8_t flags, uint32_t frame, uint32_t draw_call, const wchar_t *fmt, ...);
+	};
+}
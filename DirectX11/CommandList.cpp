@@ -14,7 +14,10 @@
 #include "D3D11Wrapper.h"
 #include "IniHandler.h"
 #include "profiling.h"
+#include "tracing.h"
 #include "Hunting.h"
+#include "ShaderCache.h"
+#include "CompileJobs.h"
 #include "cursor.h"
 
 #include <D3DCompiler.h>
@@ -26,8 +29,14 @@ CommandListVariables command_list_globals;
 std::vector<CommandListVariable*> persistent_variables;
 std::vector<CommandList*> registered_command_lists;
 std::unordered_set<CommandList*> command_lists_profiling;
+CRITICAL_SECTION resource_pools_lock;
+ResourcePool *resource_pools;
+size_t resource_pools_count;
+size_t resource_pools_size;
 std::unordered_set<CommandListCommand*> command_lists_cmd_profiling;
 std::vector<std::shared_ptr<CommandList>> dynamically_allocated_command_lists;
+bool cto_pre_optimised_out;
+bool cto_post_optimised_out;
 
 
 // Adds consistent "3DMigoto" prefix to frame analysis log with appropriate
@@ -133,6 +142,8 @@ static void _RunCommandList(CommandList *command_list, CommandListState *state,
 	if (command_list->commands.empty())
 		return;
 
+	Tracing::Scope trace(Tracing::Event::COMMAND_LIST, (uintptr_t)command_list);
+
 	if (recursive) {
 		COMMAND_LIST_LOG(state, "%s {\n", state->post ? "post" : "pre");
 		state->recursion++;
@@ -154,22 +165,67 @@ static void _RunCommandList(CommandList *command_list, CommandListState *state,
 	}
 }
 
-static void CommandListFlushState(CommandListState *state)
+// Uploads any IniParams that have changed since the last update to the GPU.
+// The IniParams resource is a default usage texture, so we can update just
+// the range of texels that was actually modified with UpdateSubresource
+// instead of having to rewrite the entire resource via Map(WRITE_DISCARD).
+//
+// mHackerContext may be NULL when flushing changes made outside of a command
+// list on the immediate context.
+void FlushIniParams(HackerDevice *mHackerDevice, HackerContext *mHackerContext,
+		ID3D11DeviceContext1 *mOrigContext1)
 {
-	D3D11_MAPPED_SUBRESOURCE mappedResource;
-	HRESULT hr;
+	UINT first, last;
+	D3D11_BOX box;
 
-	if (state->update_params && state->mHackerDevice->mIniTexture) {
-		hr = state->mOrigContext1->Map(state->mHackerDevice->mIniTexture, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		if (FAILED(hr)) {
-			LogInfo("CommandListFlushState: Map failed\n");
+	if (!mHackerDevice->mIniTexture)
+		return;
+
+	if (mOrigContext1->GetType() == D3D11_DEVICE_CONTEXT_IMMEDIATE) {
+		if (mHackerContext)
+			mHackerContext->mIniParamsChanged = false;
+		if (!G->iniParamsDirty.take((UINT)G->iniParams.size(), &first, &last))
+			return;
+	} else {
+		// The upload on a deferred context is recorded into a command
+		// list that the game may never execute, so it must leave the
+		// shared range for the immediate context to upload. Instead it
+		// uploads everything if its own command lists changed any
+		// IniParams, as they did before the dirty range was tracked.
+		// This also avoids drivers without native command list support
+		// that mishandle the destination box on deferred contexts:
+		if (!mHackerContext || !mHackerContext->mIniParamsChanged)
+			return;
+		mHackerContext->mIniParamsChanged = false;
+		first = 0;
+		last = (UINT)G->iniParams.size();
+		if (!last)
 			return;
-		}
-		memcpy(mappedResource.pData, G->iniParams.data(), sizeof(DirectX::XMFLOAT4) * G->iniParams.size());
-		state->mOrigContext1->Unmap(state->mHackerDevice->mIniTexture, 0);
-		state->update_params = false;
-		Profiling::iniparams_updates++;
 	}
+
+	box.left = first;
+	box.right = last;
+	box.top = 0;
+	box.bottom = 1;
+	box.front = 0;
+	box.back = 1;
+
+	mOrigContext1->UpdateSubresource(mHackerDevice->mIniTexture, 0,
+			&box, &G->iniParams[first], 0, 0);
+
+	Profiling::iniparams_updates++;
+	Profiling::iniparams_bytes_uploaded += (last - first) * sizeof(DirectX::XMFLOAT4);
+}
+
+static void CommandListFlushState(CommandListState *state)
+{
+	// While processing the command lists for a draw call the
+	// IniParams are only flushed once at the end rather than after
+	// every individual command list:
+	if (state->mHackerContext && state->mHackerContext->mBatchIniParamsFlush)
+		return;
+
+	FlushIniParams(state->mHackerDevice, state->mHackerContext, state->mOrigContext1);
 }
 
 static void RunCommandListComplete(HackerDevice *mHackerDevice,
@@ -237,6 +293,135 @@ void RunViewCommandList(HackerDevice *mHackerDevice,
 		res->Release();
 }
 
+// Lets CommandListFlattener.h see through the command classes:
+struct CommandListFlattenTraits {
+	typedef CommandList List;
+	typedef CommandListCommand Command;
+	typedef CommandListState State;
+
+	static const CommandList::Commands& commands(CommandList *command_list)
+	{
+		return command_list->commands;
+	}
+
+	static bool explicit_call(CommandListCommand *command, CommandList **pre,
+			CommandList **post, bool *pre_and_post_together)
+	{
+		RunExplicitCommandList *explicit_command = dynamic_cast<RunExplicitCommandList*>(command);
+
+		if (!explicit_command)
+			return false;
+
+		*pre = &explicit_command->command_list_section->command_list;
+		*post = &explicit_command->command_list_section->post_command_list;
+		*pre_and_post_together = explicit_command->run_pre_and_post_together;
+		return true;
+	}
+
+	static CommandList* linked_call(CommandListCommand *command)
+	{
+		RunLinkedCommandList *linked_command = dynamic_cast<RunLinkedCommandList*>(command);
+
+		return linked_command ? linked_command->link : NULL;
+	}
+
+	// The optimiser has already folded anything that can be statically
+	// evaluated down to a single value, so this only picks up assignments
+	// of constants:
+	static FlatCommandType constant_assignment(CommandListCommand *command, float *val)
+	{
+		ParamOverride *param_override = dynamic_cast<ParamOverride*>(command);
+		VariableAssignment *variable_assignment = dynamic_cast<VariableAssignment*>(command);
+
+		if (param_override && param_override->expression.static_evaluate(val))
+			return FlatCommandType::SET_INI_PARAM;
+		if (variable_assignment && variable_assignment->expression.static_evaluate(val))
+			return FlatCommandType::SET_VARIABLE;
+		return FlatCommandType::RUN;
+	}
+
+	static void run(CommandListCommand *command, CommandListState *state)
+	{
+		command->run(state);
+	}
+
+	// These must match ParamOverride::run() and VariableAssignment::run()
+	static void set_ini_param(CommandListCommand *command, float val, CommandListState *state)
+	{
+		ParamOverride *param_override = static_cast<ParamOverride*>(command);
+		float *dest = &(G->iniParams[param_override->param_idx].*param_override->param_component);
+
+		if (*dest != val) {
+			*dest = val;
+			G->iniParamsDirty.mark((UINT)param_override->param_idx);
+			state->mHackerContext->mIniParamsChanged = true;
+		}
+	}
+
+	static void set_variable(CommandListCommand *command, float val, CommandListState *state)
+	{
+		CommandListVariable *var = static_cast<VariableAssignment*>(command)->var;
+
+		if (var->fval != val) {
+			var->fval = val;
+			if (var->flags & VariableFlags::PERSIST)
+				G->user_config_dirty |= 1;
+		}
+	}
+};
+
+// The [Present] command lists run every frame, and with a lot of mods
+// installed they are mostly "run = CommandList..." lines calling into the
+// mods' own sections, each adding a level of nesting, logging and profiling
+// on the way. These are flattened in advance into a plain list of the
+// commands they would end up running, so a frame just walks that list. If
+// the frame is being analysed, profiled or traced we use the command list
+// as is, so that it still shows up exactly as it was written.
+void RunPresentCommandList(HackerDevice *mHackerDevice,
+		HackerContext *mHackerContext,
+		CommandList *command_list,
+		bool post)
+{
+	CommandListState state;
+
+	if (!command_list->flat || G->analyse_frame || Tracing::enabled
+			|| Profiling::mode != Profiling::Mode::NONE) {
+		RunCommandList(mHackerDevice, mHackerContext, command_list, NULL, post);
+		return;
+	}
+
+	state.mHackerDevice = mHackerDevice;
+	state.mHackerContext = mHackerContext;
+	state.mOrigDevice1 = mHackerDevice->GetPassThroughOrigDevice1();
+	state.mOrigContext1 = mHackerContext->GetPassThroughOrigContext1();
+
+	run_flat_command_list<CommandListFlattenTraits>(command_list->flat_commands, &state);
+
+	CommandListFlushState(&state);
+}
+
+static void flatten_present_command_list(CommandList *command_list)
+{
+	std::vector<CommandList*> path;
+
+	command_list->flat_commands.clear();
+	// Circular references are left for _RunCommandList to report, as are
+	// lists nested deeply enough that it may be getting close to the limit:
+	command_list->flat = flatten_command_list<CommandListFlattenTraits>(command_list,
+			command_list->post, 1, MAX_COMMAND_LIST_RECURSION / 2,
+			&path, &command_list->flat_commands);
+	if (!command_list->flat) {
+		command_list->flat_commands.clear();
+		LogInfo("Not flattening %s [Present] command list\n",
+				command_list->post ? "post" : "pre");
+		return;
+	}
+
+	LogInfo("Flattened %s [Present] command list to %Iu commands\n",
+			command_list->post ? "post" : "pre",
+			command_list->flat_commands.size());
+}
+
 void optimise_command_lists(HackerDevice *device)
 {
 	bool making_progress;
@@ -307,6 +492,17 @@ void optimise_command_lists(HackerDevice *device)
 
 	Profiling::update_cto_warning(!ignore_cto_post);
 
+	// Remember if checktextureoverride commands may have been optimised
+	// out, as an incremental config reload cannot put them back if it
+	// gives a TextureOverride section a non-empty command list:
+	cto_pre_optimised_out = ignore_cto_pre;
+	cto_post_optimised_out = ignore_cto_post;
+
+	// Always rebuilt, since these point into other command lists that may
+	// have been replaced or optimised since the last time:
+	flatten_present_command_list(&G->present_command_list);
+	flatten_present_command_list(&G->post_present_command_list);
+
 	LogInfo("Command List Optimiser finished after %ums\n", GetTickCount() - start);
 	registered_command_lists.clear();
 	dynamically_allocated_command_lists.clear();
@@ -1313,8 +1509,8 @@ void DrawCommand::run(CommandListState *state)
 		return;
 	}
 
-	// Ensure IniParams are visible:
-	CommandListFlushState(state);
+	// Ensure IniParams are visible, even if we are batching updates:
+	FlushIniParams(state->mHackerDevice, state->mHackerContext, state->mOrigContext1);
 
 	Profiling::injected_draw_calls++;
 
@@ -1969,69 +2165,184 @@ CustomShader::~CustomShader()
 		sampler_state->Release();
 }
 
-static bool load_cached_shader(FILETIME hlsl_timestamp, wchar_t *cache_path, ID3DBlob **ppBytecode)
+static const D3D_SHADER_MACRO vs_macros[] = { "VERTEX_SHADER", "", NULL, NULL };
+static const D3D_SHADER_MACRO hs_macros[] = { "HULL_SHADER", "", NULL, NULL };
+static const D3D_SHADER_MACRO ds_macros[] = { "DOMAIN_SHADER", "", NULL, NULL };
+static const D3D_SHADER_MACRO gs_macros[] = { "GEOMETRY_SHADER", "", NULL, NULL };
+static const D3D_SHADER_MACRO ps_macros[] = { "PIXEL_SHADER", "", NULL, NULL };
+static const D3D_SHADER_MACRO cs_macros[] = { "COMPUTE_SHADER", "", NULL, NULL };
+
+// Custom shaders compiled during this or previous config loads. A config
+// reload reuses these for any shader whose source, compile options and
+// #included files are all unchanged instead of compiling every custom shader
+// again, regardless of whether the on disk shader cache is enabled:
+struct CompiledCustomShader
 {
-	FILETIME cache_timestamp;
-	HANDLE f_cache;
-	DWORD filesize, readsize;
+	vector<char> code;
+	wstring dependencies_id;
+	bool used;
+};
+static unordered_map<ShaderCacheKey, CompiledCustomShader, ShaderCacheKeyHash> compiled_custom_shaders;
 
-	f_cache = CreateFile(cache_path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (f_cache == INVALID_HANDLE_VALUE)
-		return false;
+class CustomShaderCompileJob;
 
-	if (!GetFileTime(f_cache, NULL, NULL, &cache_timestamp)
-	 || CompareFileTime(&hlsl_timestamp, &cache_timestamp)) {
-		LogInfo("    Discarding stale cached shader: %S\n", cache_path);
-		goto err_close;
+// Shaders queued to be compiled in the current batch, so that sections that
+// use the same shader with the same options only compile it once:
+static unordered_map<ShaderCacheKey, CustomShaderCompileJob*, ShaderCacheKeyHash> queued_custom_shaders;
+
+static void remember_compiled_custom_shader(const ShaderCacheKey &key, const wchar_t *dependencies_id,
+		const void *code, size_t code_size)
+{
+	CompiledCustomShader &compiled = compiled_custom_shaders[key];
+
+	compiled.code.assign((const char*)code, (const char*)code + code_size);
+	compiled.dependencies_id = dependencies_id;
+	compiled.used = true;
+}
+
+// Called once all custom shaders have been compiled to discard any that are no
+// longer used by the current config:
+void expire_compiled_custom_shaders()
+{
+	queued_custom_shaders.clear();
+
+	for (auto i = compiled_custom_shaders.begin(); i != compiled_custom_shaders.end(); ) {
+		if (i->second.used) {
+			i->second.used = false;
+			i++;
+		} else {
+			include_cache.forget_dependencies(include_cache_path(i->second.dependencies_id.c_str()));
+			i = compiled_custom_shaders.erase(i);
+		}
 	}
+}
 
-	filesize = GetFileSize(f_cache, 0);
-	if (FAILED(D3DCreateBlob(filesize, ppBytecode))) {
+static bool create_blob(const void *code, size_t code_size, ID3DBlob **ppBytecode)
+{
+	if (FAILED(D3DCreateBlob(code_size, ppBytecode))) {
 		LogInfo("    D3DCreateBlob failed\n");
-		goto err_close;
+		return false;
 	}
+	memcpy((*ppBytecode)->GetBufferPointer(), code, code_size);
+	return true;
+}
 
-	if (!ReadFile(f_cache, (*ppBytecode)->GetBufferPointer(), (DWORD)(*ppBytecode)->GetBufferSize(), &readsize, 0)
-			|| readsize != filesize) {
-		LogInfo("    Error reading cached shader\n");
-		goto err_free;
+// Compiles one shader of a [CustomShader] section. The D3DCompile call is made
+// from compile() on a worker thread, and the result is handed back to the
+// CustomShader and any errors are logged from complete():
+class CustomShaderCompileJob : public CompileJob
+{
+public:
+	ID3DBlob **ppBytecode;
+	bool *failed;
+	wstring wpath;
+	char apath[MAX_PATH];
+	vector<char> srcData;
+	char shaderModel[7];
+	const D3D_SHADER_MACRO *macros;
+	UINT compile_flags;
+	ShaderCacheKey cache_key;
+	wstring dependencies_id;
+
+	// If set, another section already queued the same shader and this
+	// job takes the result from that one instead of compiling it again:
+	CustomShaderCompileJob *original;
+
+	DeferredLog log;
+	HRESULT hr;
+	ID3DBlob *pBytecode;
+	ShaderCacheIncludes includes;
+
+	CustomShaderCompileJob() :
+		original(NULL),
+		hr(E_FAIL),
+		pBytecode(NULL)
+	{}
+
+	~CustomShaderCompileJob()
+	{
+		if (pBytecode)
+			pBytecode->Release();
 	}
 
-	LogInfo("    Loaded cached shader: %S\n", cache_path);
-	CloseHandle(f_cache);
-	return true;
+	void compile() override
+	{
+		ID3DBlob *pErrorMsgs = NULL;
 
-err_free:
-	(*ppBytecode)->Release();
-	*ppBytecode = NULL;
-err_close:
-	CloseHandle(f_cache);
-	return false;
-}
+		if (original)
+			return;
 
-static const D3D_SHADER_MACRO vs_macros[] = { "VERTEX_SHADER", "", NULL, NULL };
-static const D3D_SHADER_MACRO hs_macros[] = { "HULL_SHADER", "", NULL, NULL };
-static const D3D_SHADER_MACRO ds_macros[] = { "DOMAIN_SHADER", "", NULL, NULL };
-static const D3D_SHADER_MACRO gs_macros[] = { "GEOMETRY_SHADER", "", NULL, NULL };
-static const D3D_SHADER_MACRO ps_macros[] = { "PIXEL_SHADER", "", NULL, NULL };
-static const D3D_SHADER_MACRO cs_macros[] = { "COMPUTE_SHADER", "", NULL, NULL };
+		// Pass the real filename and use our include handler so that
+		// #include will work with a relative path from the shader itself,
+		// and so we know which files to validate the shader cache against:
+		MigotoIncludeHandler include_handler(apath, &log);
+		hr = D3DCompile(srcData.data(), srcData.size(), apath, macros,
+			G->recursive_include == -1 ? D3D_COMPILE_STANDARD_FILE_INCLUDE : &include_handler,
+			"main", shaderModel, compile_flags, 0, &pBytecode, &pErrorMsgs);
+
+		if (SUCCEEDED(hr) && G->recursive_include != -1) {
+			include_handler.record_dependencies(dependencies_id.c_str());
+			includes = include_handler.includes;
+		}
+
+		if (pErrorMsgs) {
+			LPVOID errMsg = pErrorMsgs->GetBufferPointer();
+			SIZE_T errSize = pErrorMsgs->GetBufferSize();
+			log.info("--------------------------------------------- BEGIN ---------------------------------------------\n");
+			log.overlay(LOG_NOTICE, "%*s\n", errSize, errMsg);
+			log.info("---------------------------------------------- END ----------------------------------------------\n");
+			pErrorMsgs->Release();
+		}
+	}
+
+	void complete() override
+	{
+		CustomShaderCompileJob *result = original ? original : this;
+
+		LogInfo("  Compiled %S\n", wpath.c_str());
+		log.flush();
+
+		if (FAILED(result->hr)) {
+			LogOverlayW(LOG_WARNING, L"Error compiling custom shader %ls\n", wpath.c_str());
+			*failed = true;
+			return;
+		}
+
+		*ppBytecode = result->pBytecode;
+		(*ppBytecode)->AddRef();
+
+		if (original || G->recursive_include == -1)
+			return;
+
+		remember_compiled_custom_shader(cache_key, dependencies_id.c_str(),
+				pBytecode->GetBufferPointer(), pBytecode->GetBufferSize());
+		if (G->CACHE_SHADERS)
+			store_shader_cache(cache_key, &includes, pBytecode->GetBufferPointer(), pBytecode->GetBufferSize());
+	}
+};
 
 // This is similar to the other compile routines, but still distinct enough to
 // get it's own function for now - TODO: Refactor out the common code
-bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, const wstring *namespace_path)
+//
+// Shaders that are not already compiled are added to the queue, and *failed
+// will be set if there is a problem either now or when the queue is run.
+void CustomShader::compile(char type, wchar_t *filename, const wstring *wname, const wstring *namespace_path,
+		CompileJobQueue *queue, bool *failed)
 {
-	wchar_t wpath[MAX_PATH], cache_path[MAX_PATH];
+	wchar_t wpath[MAX_PATH];
 	char apath[MAX_PATH];
 	HANDLE f;
 	DWORD srcDataSize, readSize;
 	vector<char> srcData;
-	HRESULT hr;
 	char shaderModel[7];
 	ID3DBlob **ppBytecode = NULL;
-	ID3DBlob *pErrorMsgs = NULL;
 	const D3D_SHADER_MACRO *macros = NULL;
 	bool found = false;
-	FILETIME timestamp;
+	ShaderCacheKey cache_key;
+	vector<char> cached;
+	ShaderCacheIncludes cached_includes;
+	wchar_t dependencies_id[MAX_PATH + 32];
+	CustomShaderCompileJob *job;
 
 	LogInfo("  %cs=%S\n", type, filename);
 
@@ -2074,7 +2385,7 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 
 	// Special value to unbind the shader instead:
 	if (!_wcsicmp(filename, L"null"))
-		return false;
+		return;
 
 	// If this section was not in the main d3dx.ini, look
 	// for a file relative to the config it came from
@@ -2097,6 +2408,10 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 		wcscat(wpath, filename);
 	}
 
+	// Recorded even if it is missing, so that a config reload knows to
+	// pick it up once it has been created:
+	source_files.push_back(wpath);
+
 	f = CreateFile(wpath, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (f == INVALID_HANDLE_VALUE) {
 		LogOverlayW(LOG_WARNING, L"Shader not found: %ls\n", wpath);
@@ -2107,21 +2422,6 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 	// overridden in the future:
 	_snprintf_s(shaderModel, 7, 7, "%cs_5_0", type);
 
-	// XXX: If we allow the compilation to be customised further (e.g. with
-	// addition preprocessor defines), make the cache filename unique for
-	// each possible combination
-	wchar_t *ext = wcsrchr(wpath, L'.');
-	if (ext > wcsrchr(wpath, L'\\'))
-		swprintf_s(cache_path, MAX_PATH, L"%.*s.%S.%x.bin", (int)(ext - wpath), wpath, shaderModel, (UINT)compile_flags);
-	else
-		swprintf_s(cache_path, MAX_PATH, L"%s.%S.%x.bin", wpath, shaderModel, (UINT)compile_flags);
-
-	GetFileTime(f, NULL, NULL, &timestamp);
-	if (load_cached_shader(timestamp, cache_path, ppBytecode)) {
-		CloseHandle(f);
-		return false;
-	}
-
 	srcDataSize = GetFileSize(f, 0);
 	srcData.resize(srcDataSize);
 
@@ -2136,51 +2436,67 @@ bool CustomShader::compile(char type, wchar_t *filename, const wstring *wname, c
 	// for the type of shader, and maybe allow more defines to be specified
 	// in the ini
 
-	// Pass the real filename and use the standard include handler so that
-	// #include will work with a relative path from the shader itself.
-	// Later we could add a custom include handler to track dependencies so
-	// that we can make reloading work better when using includes:
 	wcstombs(apath, wpath, MAX_PATH);
-	{
-		MigotoIncludeHandler include_handler(apath);
-		hr = D3DCompile(srcData.data(), srcDataSize, apath, macros,
-			G->recursive_include == -1 ? D3D_COMPILE_STANDARD_FILE_INCLUDE : &include_handler,
-			"main", shaderModel, (UINT)compile_flags, 0, ppBytecode, &pErrorMsgs);
-	}
 
-	if (pErrorMsgs) {
-		LPVOID errMsg = pErrorMsgs->GetBufferPointer();
-		SIZE_T errSize = pErrorMsgs->GetBufferSize();
-		LogInfo("--------------------------------------------- BEGIN ---------------------------------------------\n");
-		LogOverlay(LOG_NOTICE, "%*s\n", errSize, errMsg);
-		LogInfo("---------------------------------------------- END ----------------------------------------------\n");
-		pErrorMsgs->Release();
+	// Any additional options that affect the compilation must be
+	// included in the cache key:
+	cache_key = shader_cache_hlsl_key(srcData.data(), srcDataSize, apath,
+			shaderModel, (UINT)compile_flags, macros);
+
+	// The same file may be compiled with different macros or flags, so
+	// the included files are tracked per key rather than per file:
+	swprintf_s(dependencies_id, ARRAYSIZE(dependencies_id), L"%s|%016llx%08x",
+			wpath, cache_key.fnv, cache_key.crc);
+	dependencies_ids.push_back(dependencies_id);
+
+	// We can't tell if files included via the standard include handler
+	// have changed, so always compile those:
+	if (G->recursive_include != -1) {
+		auto compiled = compiled_custom_shaders.find(cache_key);
+		if (compiled != compiled_custom_shaders.end()
+				&& !include_cache.dependencies_changed(include_cache_path(dependencies_id), NULL)) {
+			if (!create_blob(compiled->second.code.data(), compiled->second.code.size(), ppBytecode))
+				goto err;
+			compiled->second.used = true;
+			LogInfo("    Unchanged since last load, not recompiling %S\n", wpath);
+			return;
+		}
 	}
 
-	if (FAILED(hr)) {
-		LogOverlayW(LOG_WARNING, L"Error compiling custom shader %ls\n", wpath);
-		goto err;
+	if (G->CACHE_SHADERS && lookup_shader_cache(cache_key, &cached, &cached_includes)) {
+		if (!create_blob(cached.data(), cached.size(), ppBytecode))
+			goto err;
+		record_shader_dependencies(dependencies_id, &cached_includes);
+		remember_compiled_custom_shader(cache_key, dependencies_id, cached.data(), cached.size());
+		LogInfo("    Loaded %S from shader cache\n", wpath);
+		return;
 	}
 
-	if (G->CACHE_SHADERS) {
-		FILE *fw;
-
-		wfopen_ensuring_access(&fw, cache_path, L"wb");
-		if (fw) {
-			LogInfo("    Storing compiled shader to %S\n", cache_path);
-			fwrite((*ppBytecode)->GetBufferPointer(), 1, (*ppBytecode)->GetBufferSize(), fw);
-			fclose(fw);
+	job = new CustomShaderCompileJob();
+	job->ppBytecode = ppBytecode;
+	job->failed = failed;
+	job->wpath = wpath;
+	memcpy(job->apath, apath, MAX_PATH);
+	job->srcData = std::move(srcData);
+	memcpy(job->shaderModel, shaderModel, sizeof(shaderModel));
+	job->macros = macros;
+	job->compile_flags = (UINT)compile_flags;
+	job->cache_key = cache_key;
+	job->dependencies_id = dependencies_id;
+
+	auto queued = queued_custom_shaders.find(cache_key);
+	if (queued != queued_custom_shaders.end())
+		job->original = queued->second;
+	else
+		queued_custom_shaders[cache_key] = job;
 
-			set_file_last_write_time(cache_path, &timestamp);
-		} else
-			LogInfo("    Error writing compiled shader to %S\n", cache_path);
-	}
+	queue->add(job);
+	return;
 
-	return false;
 err_close:
 	CloseHandle(f);
 err:
-	return true;
+	*failed = true;
 }
 
 void CustomShader::substantiate(ID3D11Device *mOrigDevice1)
@@ -2759,6 +3075,8 @@ void CommandList::clear()
 {
 	commands.clear();
 	static_vars.clear();
+	flat_commands.clear();
+	flat = false;
 }
 
 CommandListState::CommandListState() :
@@ -2773,7 +3091,6 @@ CommandListState::CommandListState() :
 	resource(NULL),
 	view(NULL),
 	post(false),
-	update_params(false),
 	cursor_mask_tex(NULL),
 	cursor_mask_view(NULL),
 	cursor_color_tex(NULL),
@@ -4061,7 +4378,10 @@ void ParamOverride::run(CommandListState *state)
 
 	COMMAND_LIST_LOG(state, "  ini param override = %f\n", *dest);
 
-	state->update_params |= (*dest != orig);
+	if (*dest != orig) {
+		G->iniParamsDirty.mark((UINT)param_idx);
+		state->mHackerContext->mIniParamsChanged = true;
+	}
 }
 
 void VariableAssignment::run(CommandListState *state)
@@ -4306,22 +4626,220 @@ bail:
 	return false;
 }
 
+void ResourcePool::link()
+{
+	EnterCriticalSectionPretty(&resource_pools_lock);
+	prev = NULL;
+	next = resource_pools;
+	if (next)
+		next->prev = this;
+	resource_pools = this;
+	resource_pools_count++;
+	LeaveCriticalSection(&resource_pools_lock);
+}
+
+void ResourcePool::unlink()
+{
+	if (prev)
+		prev->next = next;
+	else
+		resource_pools = next;
+	if (next)
+		next->prev = prev;
+	resource_pools_count--;
+}
+
+ResourcePool::ResourcePool() :
+	size(0)
+{
+	link();
+}
+
+// Copying a pool does not copy the cached resources - the copy starts out
+// empty, since each pool holds its own references to its resources:
+ResourcePool::ResourcePool(const ResourcePool&) :
+	size(0)
+{
+	link();
+}
+
 ResourcePool::~ResourcePool()
 {
 	ResourcePoolCache::iterator i;
 
+	EnterCriticalSectionPretty(&resource_pools_lock);
+
 	for (i = cache.begin(); i != cache.end(); i++) {
-		if (i->second.first)
-			i->second.first->Release();
+		if (i->second.resource)
+			i->second.resource->Release();
 	}
 	cache.clear();
+
+	resource_pools_size -= size;
+	unlink();
+
+	LeaveCriticalSection(&resource_pools_lock);
 }
 
-void ResourcePool::emplace(uint32_t hash, ID3D11Resource *resource, ID3D11Device *device)
+void ResourcePool::emplace(uint32_t hash, ID3D11Resource *resource, ID3D11Device *device, size_t size)
 {
 	if (resource)
 		resource->AddRef();
-	cache.emplace(hash, pair<ID3D11Resource*, ID3D11Device*>{resource, device});
+	cache.emplace(hash, ResourcePoolEntry{resource, device, size, G->frame_no});
+	this->size += size;
+	resource_pools_size += size;
+
+	// Enforce the per-pool budget, but never evict the resource we are
+	// just adding, even if it alone exceeds the budget:
+	if (G->resource_pool_budget) {
+		while (this->size > G->resource_pool_budget && evict_lru(hash))
+			;
+	}
+}
+
+void ResourcePool::erase(ResourcePoolCache::iterator i)
+{
+	if (i->second.resource)
+		i->second.resource->Release();
+	size -= i->second.size;
+	resource_pools_size -= i->second.size;
+	cache.erase(i);
+}
+
+static ResourcePoolCache::iterator find_lru_pool_entry(ResourcePool *pool, uint32_t keep_hash)
+{
+	ResourcePoolCache::iterator i, lru = pool->cache.end();
+
+	for (i = pool->cache.begin(); i != pool->cache.end(); i++) {
+		// Entries with no resource record a failed creation and are
+		// kept to prevent further attempts. Anything used this frame
+		// may still be bound, so leave that alone as well:
+		if (i->first == keep_hash || !i->second.resource)
+			continue;
+		if (i->second.last_used_frame == G->frame_no)
+			continue;
+		if (lru == pool->cache.end() || i->second.last_used_frame < lru->second.last_used_frame)
+			lru = i;
+	}
+
+	return lru;
+}
+
+// Evicts the least recently used resource from the pool other than keep_hash.
+// Returns false if nothing was eligible for eviction.
+bool ResourcePool::evict_lru(uint32_t keep_hash)
+{
+	ResourcePoolCache::iterator lru = find_lru_pool_entry(this, keep_hash);
+
+	if (lru == cache.end())
+		return false;
+
+	LogDebug("Evicting %Iu byte resource from resource pool\n", lru->second.size);
+	Profiling::resource_pool_evictions++;
+	erase(lru);
+	return true;
+}
+
+void ResourcePool::expire(unsigned max_idle_frames)
+{
+	ResourcePoolCache::iterator i, next;
+
+	for (i = cache.begin(); i != cache.end(); i = next) {
+		next = std::next(i);
+		if (i->second.resource && G->frame_no - i->second.last_used_frame > max_idle_frames) {
+			LogDebug("Expiring %Iu byte resource from resource pool\n", i->second.size);
+			Profiling::resource_pool_evictions++;
+			erase(i);
+		}
+	}
+}
+
+// Called once per frame from the present path to expire unused resources and
+// enforce the global resource pool budget:
+void ExpireResourcePools()
+{
+	static unsigned last_expired_frame = 0;
+	ResourcePoolCache::iterator i, lru;
+	ResourcePool *pool, *lru_pool;
+
+	EnterCriticalSectionPretty(&resource_pools_lock);
+
+	// Expiry does not need to be frame accurate, and walking every pool
+	// is not free with large mod packs, so only check periodically. This
+	// is run as deferrable housekeeping and may skip frames, so this
+	// counts from the last check rather than waiting for a multiple of 64:
+	if (G->resource_pool_expire_frames && G->frame_no - last_expired_frame >= 64) {
+		last_expired_frame = G->frame_no;
+		for (pool = resource_pools; pool; pool = pool->next)
+			pool->expire(G->resource_pool_expire_frames);
+	}
+
+	while (G->resource_pool_global_budget && resource_pools_size > G->resource_pool_global_budget) {
+		lru_pool = NULL;
+		for (pool = resource_pools; pool; pool = pool->next) {
+			i = find_lru_pool_entry(pool, 0);
+			if (i == pool->cache.end())
+				continue;
+			if (!lru_pool || i->second.last_used_frame < lru->second.last_used_frame) {
+				lru_pool = pool;
+				lru = i;
+			}
+		}
+		if (!lru_pool)
+			break;
+
+		LogDebug("Evicting %Iu byte resource from resource pool (global budget)\n", lru->second.size);
+		Profiling::resource_pool_evictions++;
+		lru_pool->erase(lru);
+	}
+
+	LeaveCriticalSection(&resource_pools_lock);
+}
+
+static size_t ResourcePoolDescSize(const D3D11_BUFFER_DESC *desc)
+{
+	return desc->ByteWidth;
+}
+
+// Estimates the size of a texture including all mip-maps and array slices.
+// This is only used for the resource pool budgets, so doesn't need to be exact
+// - block compressed formats (for which dxgi_format_size returns 0) are
+// treated as 1 byte per pixel, which is correct for BC2/3/5/6/7 and an
+// overestimate for BC1/4.
+static size_t ResourcePoolTextureSize(DXGI_FORMAT format, UINT width, UINT height,
+		UINT depth, UINT mip_levels, UINT array_size)
+{
+	size_t bpp = dxgi_format_size(format);
+	size_t size = 0;
+	UINT mip;
+
+	if (!bpp)
+		bpp = 1;
+
+	for (mip = 0; !mip_levels || mip < mip_levels; mip++) {
+		size += bpp * max(width >> mip, 1u) * max(height >> mip, 1u) * max(depth >> mip, 1u);
+		// MipLevels = 0 indicates a full mip chain:
+		if ((width >> mip) <= 1 && (height >> mip) <= 1 && (depth >> mip) <= 1)
+			break;
+	}
+
+	return size * array_size;
+}
+
+static size_t ResourcePoolDescSize(const D3D11_TEXTURE1D_DESC *desc)
+{
+	return ResourcePoolTextureSize(desc->Format, desc->Width, 1, 1, desc->MipLevels, desc->ArraySize);
+}
+
+static size_t ResourcePoolDescSize(const D3D11_TEXTURE2D_DESC *desc)
+{
+	return ResourcePoolTextureSize(desc->Format, desc->Width, desc->Height, 1, desc->MipLevels, desc->ArraySize)
+		* max(desc->SampleDesc.Count, 1u);
+}
+
+static size_t ResourcePoolDescSize(const D3D11_TEXTURE3D_DESC *desc)
+{
+	return ResourcePoolTextureSize(desc->Format, desc->Width, desc->Height, desc->Depth, desc->MipLevels, 1);
 }
 
 template <typename ResourceType,
@@ -4342,7 +4860,7 @@ static ResourceType* GetResourceFromPool(
 	ResourceType *resource = NULL;
 	DescType old_desc;
 	uint32_t hash;
-	size_t size;
+	size_t size, pool_size;
 	HRESULT hr;
 	ResourcePoolCache::iterator pool_i;
 	ID3D11Device *old_device = NULL;
@@ -4353,30 +4871,45 @@ static ResourceType* GetResourceFromPool(
 	// doesn't matter what we use - just has to be fast.
 	hash = crc32c_hw(0, desc, sizeof(DescType));
 
+	// Only the lookup and bookkeeping are done with the lock held. Creating
+	// the resource and logging can be slow, and would hold up the present
+	// thread and every other context using any resource pool:
+	EnterCriticalSectionPretty(&resource_pools_lock);
+
 	pool_i = Profiling::lookup_map(resource_pool->cache, hash, &Profiling::resource_pool_lookup_overhead);
 	if (pool_i != resource_pool->cache.end()) {
-		resource = (ResourceType*)pool_i->second.first;
-		old_device = pool_i->second.second;
-		if (!resource)
+		resource = (ResourceType*)pool_i->second.resource;
+		old_device = pool_i->second.device;
+		if (!resource) {
+			LeaveCriticalSection(&resource_pools_lock);
 			return NULL;
+		}
+
+		pool_i->second.last_used_frame = G->frame_no;
 
 		if (old_device == state->mOrigDevice1) {
-			if (resource == dst_resource)
+			if (resource == dst_resource) {
+				LeaveCriticalSection(&resource_pools_lock);
 				return NULL;
+			}
 
-			LogDebug("Switching cached resource %S\n", ini_line->c_str());
 			Profiling::resource_pool_swaps++;
 			resource->AddRef();
+			LeaveCriticalSection(&resource_pools_lock);
+
+			LogDebug("Switching cached resource %S\n", ini_line->c_str());
 			return resource;
 		}
 
-		LogInfo("Device mismatch, discarding %S from resource pool\n", ini_line->c_str());
-		resource_pool->cache.erase(pool_i);
-		resource->Release();
+		resource_pool->erase(pool_i);
+		resource = NULL;
 	}
 
+	LeaveCriticalSection(&resource_pools_lock);
+
+	if (old_device)
+		LogInfo("Device mismatch, discarding %S from resource pool\n", ini_line->c_str());
 	LogInfo("Creating cached resource %S\n", ini_line->c_str());
-	Profiling::resources_created++;
 
 	hr = (state->mOrigDevice1->*CreateResource)(desc, NULL, &resource);
 	if (FAILED(hr)) {
@@ -4385,18 +4918,37 @@ static ResourceType* GetResourceFromPool(
 		src_resource->GetDesc(&old_desc);
 		LogInfo("Original resource was:\n");
 		LogResourceDesc(&old_desc);
+		resource = NULL;
+	}
 
-		// Prevent further attempts:
-		resource_pool->emplace(hash, NULL, NULL);
+	EnterCriticalSectionPretty(&resource_pools_lock);
+	Profiling::resources_created++;
 
-		return NULL;
+	// Another thread may have added the same description while we were
+	// creating it. Ours replaces it, which is rare enough that it isn't
+	// worth waiting for the other thread instead. A failed creation is
+	// recorded to prevent further attempts, unless the other thread
+	// succeeded:
+	pool_i = resource_pool->cache.find(hash);
+	if (resource) {
+		if (pool_i != resource_pool->cache.end())
+			resource_pool->erase(pool_i);
+		resource_pool->emplace(hash, resource, state->mOrigDevice1, ResourcePoolDescSize(desc));
+	} else if (pool_i == resource_pool->cache.end()) {
+		resource_pool->emplace(hash, NULL, NULL, 0);
 	}
-	resource_pool->emplace(hash, resource, state->mOrigDevice1);
 	size = resource_pool->cache.size();
-	if (size > 1)
-		LogInfo("  NOTICE: cache now contains %Ii resources\n", size);
+	pool_size = resource_pool->size;
 
+	LeaveCriticalSection(&resource_pools_lock);
+
+	if (!resource)
+		return NULL;
+
+	if (size > 1)
+		LogInfo("  NOTICE: cache now contains %Ii resources (%Iu bytes)\n", size, pool_size);
 	LogDebugResourceDesc(desc);
+
 	return resource;
 }
 
@@ -4540,48 +5092,98 @@ void CustomResource::Substantiate(ID3D11Device *mOrigDevice1, StereoHandle mSter
 	UnlockResourceCreationMode();
 }
 
-void CustomResource::LoadBufferFromFile(ID3D11Device *mOrigDevice1)
+// Called on the resource loader's worker threads, so no logging in here:
+static void read_resource_file(const wstring &path, ResourceFile *file)
 {
 	DWORD size, read_size;
-	void *buf = NULL;
 	HANDLE f;
 
-	f = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	f = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
 	if (f == INVALID_HANDLE_VALUE) {
-		LogOverlayW(LOG_WARNING, L"Failed to load custom buffer resource %ls: %d\n", filename.c_str(), GetLastError());
+		file->status = ResourceFileStatus::OPEN_FAILED;
+		file->error = GetLastError();
 		return;
 	}
 
 	size = GetFileSize(f, 0);
-	buf = malloc(size); // malloc to allow realloc to resize it if the user overrode the size
-	if (!buf) {
-		LogOverlayW(LOG_DIRE, L"Out of memory loading %ls\n", filename.c_str());
+	file->buf = malloc(size); // malloc to allow realloc to resize it if the user overrode the size
+	if (!file->buf) {
+		file->status = ResourceFileStatus::OUT_OF_MEMORY;
 		goto out_close;
 	}
 
-	if (!ReadFile(f, buf, size, &read_size, 0) || size != read_size) {
-		LogOverlayW(LOG_WARNING, L"Error reading custom buffer from file %ls\n", filename.c_str());
-		goto out_delete;
+	if (!ReadFile(f, file->buf, size, &read_size, 0) || size != read_size) {
+		file->status = ResourceFileStatus::READ_FAILED;
+		file->error = GetLastError();
+		free(file->buf);
+		file->buf = NULL;
+		goto out_close;
 	}
 
-	SubstantiateBuffer(mOrigDevice1, &buf, size);
-
-out_delete:
-	free(buf);
+	file->size = size;
 out_close:
 	CloseHandle(f);
 }
 
+static ResourceFileLoader resource_file_loader(read_resource_file);
+
+// A negative number of threads picks one to suit the CPU, while 0 disables
+// prefetching and reads every file when its resource is first used:
+void ConfigureCustomResourceLoader(int threads, int memory_budget_mb)
+{
+	if (threads < 0)
+		threads = ResourceFileLoader::default_threads();
+
+	resource_file_loader.configure((unsigned)threads, (size_t)max(memory_budget_mb, 1) << 20);
+}
+
+// Called once the resource sections have been parsed to start reading the
+// files in the background, so that substantiating them later only has to
+// create the resources from memory instead of stalling the render thread:
+void PrefetchCustomResourceFiles()
+{
+	CustomResources::iterator i;
+
+	// Anything left over from before a config reload is no longer needed:
+	resource_file_loader.clear();
+
+	for (i = customResources.begin(); i != customResources.end(); i++) {
+		if (!i->second.filename.empty())
+			resource_file_loader.prefetch(i->second.filename);
+	}
+}
+
+void CustomResource::LoadBufferFromFile(ID3D11Device *mOrigDevice1, ResourceFile *file)
+{
+	switch (file->status) {
+		case ResourceFileStatus::OPEN_FAILED:
+			LogOverlayW(LOG_WARNING, L"Failed to load custom buffer resource %ls: %d\n", filename.c_str(), file->error);
+			return;
+		case ResourceFileStatus::OUT_OF_MEMORY:
+			LogOverlayW(LOG_DIRE, L"Out of memory loading %ls\n", filename.c_str());
+			return;
+		case ResourceFileStatus::READ_FAILED:
+			LogOverlayW(LOG_WARNING, L"Error reading custom buffer from file %ls\n", filename.c_str());
+			return;
+	}
+
+	SubstantiateBuffer(mOrigDevice1, &file->buf, (DWORD)file->size);
+}
+
 void CustomResource::LoadFromFile(ID3D11Device *mOrigDevice1)
 {
+	ResourceFile file;
 	wstring ext;
 	HRESULT hr;
 
+	resource_file_loader.take(filename, &file);
+
 	switch (override_type) {
 		case CustomResourceType::BUFFER:
 		case CustomResourceType::STRUCTURED_BUFFER:
 		case CustomResourceType::RAW_BUFFER:
-			return LoadBufferFromFile(mOrigDevice1);
+			LoadBufferFromFile(mOrigDevice1, &file);
+			goto out_free;
 	}
 
 	// This code path doesn't get a chance to override the resource
@@ -4607,17 +5209,30 @@ void CustomResource::LoadFromFile(ID3D11Device *mOrigDevice1)
 	// could do something smart here, like only using it if the
 	// bind_flags indicate it will be used as a shader resource.
 
+	// The file has already been read by the resource loader, so DirectXTK
+	// only has to parse it from memory. The errors are reported the same
+	// way DirectXTK would have if it had tried to read the file itself:
+	switch (file.status) {
+		case ResourceFileStatus::OPEN_FAILED:
+		case ResourceFileStatus::READ_FAILED:
+			hr = HRESULT_FROM_WIN32(file.error);
+			goto out_fail;
+		case ResourceFileStatus::OUT_OF_MEMORY:
+			hr = E_OUTOFMEMORY;
+			goto out_fail;
+	}
+
 	ext = filename.substr(filename.rfind(L"."));
 	if (!_wcsicmp(ext.c_str(), L".dds")) {
 		LogInfoW(L"Loading custom resource %s as DDS, bind_flags=0x%03x\n", filename.c_str(), bind_flags);
-		hr = DirectX::CreateDDSTextureFromFileEx(mOrigDevice1,
-				filename.c_str(), 0,
+		hr = DirectX::CreateDDSTextureFromMemoryEx(mOrigDevice1,
+				(const uint8_t*)file.buf, file.size, 0,
 				D3D11_USAGE_DEFAULT, bind_flags, 0, misc_flags,
 				false, &resource, NULL, NULL);
 	} else {
 		LogInfoW(L"Loading custom resource %s as WIC, bind_flags=0x%03x\n", filename.c_str(), bind_flags);
-		hr = DirectX::CreateWICTextureFromFileEx(mOrigDevice1,
-				filename.c_str(), 0,
+		hr = DirectX::CreateWICTextureFromMemoryEx(mOrigDevice1,
+				(const uint8_t*)file.buf, file.size, 0,
 				D3D11_USAGE_DEFAULT, bind_flags, 0, misc_flags,
 				false, &resource, NULL);
 	}
@@ -4626,8 +5241,13 @@ void CustomResource::LoadFromFile(ID3D11Device *mOrigDevice1)
 		is_null = false;
 		// TODO:
 		// format = ...
-	} else
-		LogOverlayW(LOG_WARNING, L"Failed to load custom texture resource %ls: 0x%x\n", filename.c_str(), hr);
+		goto out_free;
+	}
+
+out_fail:
+	LogOverlayW(LOG_WARNING, L"Failed to load custom texture resource %ls: 0x%x\n", filename.c_str(), hr);
+out_free:
+	free(file.buf);
 }
 
 void CustomResource::SubstantiateBuffer(ID3D11Device *mOrigDevice1, void **buf, DWORD size)
@@ -4698,10 +5318,77 @@ void CustomResource::SubstantiateBuffer(ID3D11Device *mOrigDevice1, void **buf,
 		LogResourceDesc(&desc);
 	}
 }
+// Lays out the initial data as the tightly packed rows of each mip-map of each
+// array slice in turn, which is the order of the subresource indices. As with
+// buffers, anything the data doesn't cover is initialised to zero. Returns
+// false to create the texture uninitialised:
+bool CustomResource::TextureInitialData(DXGI_FORMAT format, UINT width, UINT height,
+		UINT depth, UINT mip_levels, UINT array_size, UINT samples,
+		std::vector<D3D11_SUBRESOURCE_DATA> *subresources)
+{
+	size_t bpp = dxgi_format_size(format);
+	size_t size = 0, offset = 0;
+	UINT mip, slice, w, h, d;
+	void *new_buf;
+
+	if (!initial_data)
+		return false;
+
+	// dxgi_format_size() returns the size of the 2x1 block for the packed
+	// R8G8_B8G8 / G8R8_G8B8 formats, which would need the rows padded to
+	// whole blocks like the block compressed formats, so these are treated
+	// the same way:
+	if (format == DXGI_FORMAT_R8G8_B8G8_UNORM || format == DXGI_FORMAT_G8R8_G8B8_UNORM)
+		bpp = 0;
+
+	if (!bpp || samples > 1) {
+		LogOverlayW(LOG_NOTICE, L"Initial data is not supported with the format or MSAA of custom resource [%ls]\n", name.c_str());
+		return false;
+	}
+
+	// MipLevels = 0 indicates a full mip chain:
+	if (!mip_levels) {
+		for (mip_levels = 1; (width >> mip_levels) || (height >> mip_levels) || (depth >> mip_levels); mip_levels++) {}
+	}
+
+	for (mip = 0; mip < mip_levels; mip++)
+		size += bpp * max(width >> mip, 1u) * max(height >> mip, 1u) * max(depth >> mip, 1u);
+	size *= array_size;
+
+	if (size > initial_data_size) {
+		new_buf = realloc(initial_data, size);
+		if (!new_buf) {
+			LogInfo("Out of memory enlarging initial data: [%S]\n", name.c_str());
+			return false;
+		}
+		memset((char*)new_buf + initial_data_size, 0, size - initial_data_size);
+		initial_data = new_buf;
+		initial_data_size = size;
+	}
+
+	subresources->resize(mip_levels * array_size);
+	for (slice = 0; slice < array_size; slice++) {
+		for (mip = 0; mip < mip_levels; mip++) {
+			w = max(width >> mip, 1u);
+			h = max(height >> mip, 1u);
+			d = max(depth >> mip, 1u);
+			D3D11_SUBRESOURCE_DATA &data = (*subresources)[slice * mip_levels + mip];
+			data.pSysMem = (char*)initial_data + offset;
+			data.SysMemPitch = (UINT)(bpp * w);
+			data.SysMemSlicePitch = (UINT)(bpp * w * h);
+			offset += bpp * w * h * d;
+		}
+	}
+
+	return true;
+}
+
 void CustomResource::SubstantiateTexture1D(ID3D11Device *mOrigDevice1)
 {
 	ID3D11Texture1D *tex1d;
 	D3D11_TEXTURE1D_DESC desc;
+	std::vector<D3D11_SUBRESOURCE_DATA> subresources;
+	D3D11_SUBRESOURCE_DATA *pInitialData = NULL;
 	HRESULT hr;
 
 	memset(&desc, 0, sizeof(desc));
@@ -4710,7 +5397,10 @@ void CustomResource::SubstantiateTexture1D(ID3D11Device *mOrigDevice1)
 	desc.MiscFlags = misc_flags;
 	OverrideTexDesc(&desc);
 
-	hr = mOrigDevice1->CreateTexture1D(&desc, NULL, &tex1d);
+	if (TextureInitialData(desc.Format, desc.Width, 1, 1, desc.MipLevels, desc.ArraySize, 1, &subresources))
+		pInitialData = subresources.data();
+
+	hr = mOrigDevice1->CreateTexture1D(&desc, pInitialData, &tex1d);
 	if (SUCCEEDED(hr)) {
 		LogInfo("Substantiated custom %S [%S], bind_flags=0x%03x\n",
 				lookup_enum_name(CustomResourceTypeNames, override_type), name.c_str(), desc.BindFlags);
@@ -4728,6 +5418,8 @@ void CustomResource::SubstantiateTexture2D(ID3D11Device *mOrigDevice1)
 {
 	ID3D11Texture2D *tex2d;
 	D3D11_TEXTURE2D_DESC desc;
+	std::vector<D3D11_SUBRESOURCE_DATA> subresources;
+	D3D11_SUBRESOURCE_DATA *pInitialData = NULL;
 	HRESULT hr;
 
 	memset(&desc, 0, sizeof(desc));
@@ -4736,7 +5428,10 @@ void CustomResource::SubstantiateTexture2D(ID3D11Device *mOrigDevice1)
 	desc.MiscFlags = misc_flags;
 	OverrideTexDesc(&desc);
 
-	hr = mOrigDevice1->CreateTexture2D(&desc, NULL, &tex2d);
+	if (TextureInitialData(desc.Format, desc.Width, desc.Height, 1, desc.MipLevels, desc.ArraySize, desc.SampleDesc.Count, &subresources))
+		pInitialData = subresources.data();
+
+	hr = mOrigDevice1->CreateTexture2D(&desc, pInitialData, &tex2d);
 	if (SUCCEEDED(hr)) {
 		LogInfo("Substantiated custom %S [%S], bind_flags=0x%03x\n",
 				lookup_enum_name(CustomResourceTypeNames, override_type), name.c_str(), desc.BindFlags);
@@ -4754,6 +5449,8 @@ void CustomResource::SubstantiateTexture3D(ID3D11Device *mOrigDevice1)
 {
 	ID3D11Texture3D *tex3d;
 	D3D11_TEXTURE3D_DESC desc;
+	std::vector<D3D11_SUBRESOURCE_DATA> subresources;
+	D3D11_SUBRESOURCE_DATA *pInitialData = NULL;
 	HRESULT hr;
 
 	memset(&desc, 0, sizeof(desc));
@@ -4762,7 +5459,10 @@ void CustomResource::SubstantiateTexture3D(ID3D11Device *mOrigDevice1)
 	desc.MiscFlags = misc_flags;
 	OverrideTexDesc(&desc);
 
-	hr = mOrigDevice1->CreateTexture3D(&desc, NULL, &tex3d);
+	if (TextureInitialData(desc.Format, desc.Width, desc.Height, desc.Depth, desc.MipLevels, 1, 1, &subresources))
+		pInitialData = subresources.data();
+
+	hr = mOrigDevice1->CreateTexture3D(&desc, pInitialData, &tex3d);
 	if (SUCCEEDED(hr)) {
 		LogInfo("Substantiated custom %S [%S], bind_flags=0x%03x\n",
 				lookup_enum_name(CustomResourceTypeNames, override_type), name.c_str(), desc.BindFlags);
@@ -5996,6 +6696,8 @@ ID3D11Resource *ResourceCopyTarget::GetResource(
 		return mHackerDevice->mStereoTexture;
 
 	case ResourceCopyTargetType::INI_PARAMS:
+		// Make sure any pending IniParams changes are visible:
+		FlushIniParams(mHackerDevice, state->mHackerContext, state->mOrigContext1);
 		if (mHackerDevice->mIniResourceView)
 			mHackerDevice->mIniResourceView->AddRef();
 		*view = mHackerDevice->mIniResourceView;
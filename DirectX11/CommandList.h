@@ -9,8 +9,10 @@
 #include <util.h>
 #include <nvapi.h>
 
+#include "CommandListFlattener.h"
 #include "DrawCallInfo.h"
 #include "ResourceHash.h"
+#include "ResourceLoader.h"
 
 // Used to prevent typos leading to infinite recursion (or at least overflowing
 // the real stack) due to a section running itself or a circular reference. 64
@@ -68,9 +70,6 @@ public:
 	int extra_indent;
 	LARGE_INTEGER profiling_time_recursive;
 
-	// Anything that needs to be updated at the end of the command list:
-	bool update_params;
-
 	CommandListState();
 	~CommandListState();
 };
@@ -133,6 +132,10 @@ extern std::vector<CommandListVariable*> persistent_variables;
 // remove it from the CommandList class altogether).
 typedef std::forward_list<std::unordered_map<std::wstring, CommandListVariable*>> CommandListScope;
 
+// A command from a command list that has been flattened, see
+// CommandListFlattener.h:
+typedef FlatCommandT<CommandListCommand> FlatCommand;
+
 class CommandList {
 public:
 	// Using vector of pointers to allow mixed types, and shared_ptr to handle
@@ -140,6 +143,13 @@ public:
 	typedef std::vector<std::shared_ptr<CommandListCommand>> Commands;
 	Commands commands;
 
+	// Only built for the [Present] command lists, with any explicit and
+	// linked command lists they run unconditionally spliced in. Points to
+	// commands owned by this and other command lists, so it is rebuilt
+	// every time the command lists are optimised:
+	std::vector<FlatCommand> flat_commands;
+	bool flat;
+
 	// For local/static variables. These are only used in the main pre
 	// command list as the post command list and any sub command lists (if
 	// blocks, etc) shares the same local variables and scope object as the
@@ -161,13 +171,16 @@ public:
 
 	CommandList() :
 		post(false),
-		scope(NULL)
+		scope(NULL),
+		flat(false)
 	{}
 };
 
 extern std::vector<CommandList*> registered_command_lists;
 extern std::unordered_set<CommandList*> command_lists_profiling;
 extern std::unordered_set<CommandListCommand*> command_lists_cmd_profiling;
+extern bool cto_pre_optimised_out;
+extern bool cto_post_optimised_out;
 
 // Forward declaration to avoid circular reference since Override.h includes
 // HackerDevice.h includes HackerContext.h includes CommandList.h
@@ -328,10 +341,17 @@ public:
 	unsigned frame_no;
 	int executions_this_frame;
 
+	// The files this section's shaders were compiled from, and the ids
+	// the include_cache knows their includes by, so that a config reload
+	// can tell if any of them have been edited:
+	std::vector<wstring> source_files;
+	std::vector<wstring> dependencies_ids;
+
 	CustomShader();
 	~CustomShader();
 
-	bool compile(char type, wchar_t *filename, const wstring *wname, const wstring *mod_namespace);
+	void compile(char type, wchar_t *filename, const wstring *wname, const wstring *mod_namespace,
+			class CompileJobQueue *queue, bool *failed);
 	void substantiate(ID3D11Device *mOrigDevice);
 
 	void merge_blend_states(ID3D11BlendState *state, FLOAT blend_factor[4], UINT sample_mask, ID3D11Device *mOrigDevice);
@@ -474,17 +494,56 @@ static EnumName_t<const wchar_t *, CustomResourceBindFlags> CustomResourceBindFl
 // the description size of each resource type is unique - and it would be
 // highly unusual (though not forbidden) to mix different resource types in a
 // single pool anyway.
-typedef unordered_map<uint32_t, pair<ID3D11Resource*, ID3D11Device*>> ResourcePoolCache;
+//
+// Left unchecked a pool can grow without bound (e.g. a game using dynamic
+// resolution will produce a new description every time the resolution
+// changes), so each entry tracks an estimate of its size and the frame it was
+// last used. Entries can be expired once they have not been used for a
+// configurable number of frames, and the least recently used entries are
+// evicted if a pool or all pools combined exceed the configured budgets. An
+// evicted resource may still be alive if it is the one currently held by the
+// copy operation or custom resource - the pool only drops its own reference.
+//
+// Pools are used from deferred contexts on other threads while the present
+// thread expires them, so every pool and the global accounting is protected
+// by resource_pools_lock. The pools are kept in an intrusive list rather
+// than a container so that there is nothing for static destructors to tear
+// down before the last pool (e.g. in a CustomResource) has unregistered.
+struct ResourcePoolEntry
+{
+	ID3D11Resource *resource;
+	ID3D11Device *device;
+	size_t size;
+	unsigned last_used_frame;
+};
+typedef unordered_map<uint32_t, ResourcePoolEntry> ResourcePoolCache;
 class ResourcePool
 {
+	void link();
+	void unlink();
+
 public:
 	ResourcePoolCache cache;
+	size_t size;
+	ResourcePool *prev, *next;
 
+	ResourcePool();
+	ResourcePool(const ResourcePool&);
 	~ResourcePool();
 
-	void emplace(uint32_t hash, ID3D11Resource *resource, ID3D11Device *device);
+	// These must be called with resource_pools_lock held:
+	void emplace(uint32_t hash, ID3D11Resource *resource, ID3D11Device *device, size_t size);
+	void erase(ResourcePoolCache::iterator i);
+	bool evict_lru(uint32_t keep_hash);
+	void expire(unsigned max_idle_frames);
 };
 
+extern CRITICAL_SECTION resource_pools_lock;
+extern ResourcePool *resource_pools;
+extern size_t resource_pools_count;
+extern size_t resource_pools_size;
+void ExpireResourcePools();
+
 class CustomResource
 {
 public:
@@ -548,15 +607,20 @@ public:
 
 private:
 	void LoadFromFile(ID3D11Device *mOrigDevice);
-	void LoadBufferFromFile(ID3D11Device *mOrigDevice);
+	void LoadBufferFromFile(ID3D11Device *mOrigDevice, ResourceFile *file);
 	void SubstantiateBuffer(ID3D11Device *mOrigDevice, void **buf, DWORD size);
 	void SubstantiateTexture1D(ID3D11Device *mOrigDevice);
 	void SubstantiateTexture2D(ID3D11Device *mOrigDevice);
 	void SubstantiateTexture3D(ID3D11Device *mOrigDevice);
+	bool TextureInitialData(DXGI_FORMAT format, UINT width, UINT height,
+			UINT depth, UINT mip_levels, UINT array_size, UINT samples,
+			std::vector<D3D11_SUBRESOURCE_DATA> *subresources);
 };
 
 typedef std::unordered_map<std::wstring, class CustomResource> CustomResources;
 extern CustomResources customResources;
+void ConfigureCustomResourceLoader(int threads, int memory_budget_mb);
+void PrefetchCustomResourceFiles();
 
 // Forward declaration since TextureOverride also contains a command list
 struct TextureOverride;
@@ -1279,6 +1343,9 @@ public:
 	void run(CommandListState*) override;
 };
 
+void expire_compiled_custom_shaders();
+void FlushIniParams(HackerDevice *mHackerDevice, HackerContext *mHackerContext,
+		ID3D11DeviceContext1 *mOrigContext1);
 void RunCommandList(HackerDevice *mHackerDevice,
 		HackerContext *mHackerContext,
 		CommandList *command_list, DrawCallInfo *call_info,
@@ -1291,6 +1358,10 @@ void RunViewCommandList(HackerDevice *mHackerDevice,
 		HackerContext *mHackerContext,
 		CommandList *command_list, ID3D11View *view,
 		bool post);
+void RunPresentCommandList(HackerDevice *mHackerDevice,
+		HackerContext *mHackerContext,
+		CommandList *command_list,
+		bool post);
 
 bool ParseRunExplicitCommandList(const wchar_t *section,
 		const wchar_t *key, wstring *val,
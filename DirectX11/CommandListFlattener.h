@@ -0,0 +1,130 @@
+#pragma once
+
+// Flattening of the [Present] command lists into a plain list of the commands
+// they would end up running, and the loop that runs that list each frame.
+//
+// Every unconditional "run = CommandList..." and linked command list is
+// spliced in, along with the pre/post direction and nesting depth each
+// command would have run with, so that it behaves exactly as it would have
+// from its original command list. Assignments whose value was folded to a
+// constant by the optimiser are stored as that constant, so running them is
+// just a store and a comparison rather than evaluating the expression.
+//
+// This has no Windows or DirectX dependencies - the command list classes are
+// supplied through a Traits class (CommandListFlattenTraits in
+// CommandList.cpp), so that the flattened lists can be checked against a
+// recursive runner with mock command lists on any platform.
+//
+// Traits must provide:
+//
+//   typedef ... List;
+//   typedef ... Command;
+//   typedef ... State;          // With post, recursion and aborted members
+//   static const std::vector<std::shared_ptr<Command>>& commands(List*);
+//   static bool explicit_call(Command*, List **pre, List **post, bool *pre_and_post_together);
+//   static List* linked_call(Command*);
+//   static FlatCommandType constant_assignment(Command*, float *val);
+//   static void run(Command*, State*);
+//   static void set_ini_param(Command*, float val, State*);
+//   static void set_variable(Command*, float val, State*);
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+enum class FlatCommandType {
+	RUN,            // Run the command as is
+	SET_INI_PARAM,  // Constant IniParam assignment, stores val
+	SET_VARIABLE,   // Constant variable assignment, stores val
+};
+
+template <class Command>
+struct FlatCommandT {
+	Command *command;
+	FlatCommandType type;
+	bool post;
+	int recursion;
+	float val;
+};
+
+// Returns false if the command list contains a circular reference or is
+// nested deeper than max_recursion, which are left for the recursive runner
+// to report:
+template <class Traits>
+bool flatten_command_list(typename Traits::List *command_list, bool post,
+		int recursion, int max_recursion,
+		std::vector<typename Traits::List*> *path,
+		std::vector<FlatCommandT<typename Traits::Command>> *flat)
+{
+	typename Traits::List *pre_list, *post_list, *link;
+	typename Traits::Command *command;
+	FlatCommandT<typename Traits::Command> entry;
+	bool together, ret = true;
+	size_t i;
+
+	if (recursion > max_recursion)
+		return false;
+	if (std::find(path->begin(), path->end(), command_list) != path->end())
+		return false;
+
+	path->push_back(command_list);
+
+	const auto &commands = Traits::commands(command_list);
+	for (i = 0; i < commands.size() && ret; i++) {
+		command = commands[i].get();
+
+		if (Traits::explicit_call(command, &pre_list, &post_list, &together)) {
+			if (together) {
+				ret = flatten_command_list<Traits>(pre_list, false, recursion + 1, max_recursion, path, flat)
+				   && flatten_command_list<Traits>(post_list, true, recursion + 1, max_recursion, path, flat);
+			} else if (post) {
+				ret = flatten_command_list<Traits>(post_list, post, recursion + 1, max_recursion, path, flat);
+			} else {
+				ret = flatten_command_list<Traits>(pre_list, post, recursion + 1, max_recursion, path, flat);
+			}
+			continue;
+		}
+
+		// Linked command lists run at the same level of nesting:
+		link = Traits::linked_call(command);
+		if (link) {
+			ret = flatten_command_list<Traits>(link, post, recursion, max_recursion, path, flat);
+			continue;
+		}
+
+		entry.command = command;
+		entry.post = post;
+		entry.recursion = recursion;
+		entry.val = 0;
+		entry.type = Traits::constant_assignment(command, &entry.val);
+		flat->push_back(entry);
+	}
+
+	path->pop_back();
+	return ret;
+}
+
+template <class Traits>
+void run_flat_command_list(const std::vector<FlatCommandT<typename Traits::Command>> &flat,
+		typename Traits::State *state)
+{
+	size_t i;
+
+	for (i = 0; i < flat.size() && !state->aborted; i++) {
+		const FlatCommandT<typename Traits::Command> &entry = flat[i];
+
+		state->post = entry.post;
+		state->recursion = entry.recursion;
+		switch (entry.type) {
+			case FlatCommandType::RUN:
+				Traits::run(entry.command, state);
+				break;
+			case FlatCommandType::SET_INI_PARAM:
+				Traits::set_ini_param(entry.command, entry.val, state);
+				break;
+			case FlatCommandType::SET_VARIABLE:
+				Traits::set_variable(entry.command, entry.val, state);
+				break;
+		}
+	}
+}
@@ -0,0 +1,86 @@
+#include "CompileJobs.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+size_t CompileJobQueue::add(CompileJob *job)
+{
+	Slot slot;
+
+	slot.job.reset(job);
+	slot.pending_dependencies = 0;
+	slots.push_back(std::move(slot));
+
+	return slots.size() - 1;
+}
+
+void CompileJobQueue::add_dependency(size_t job, size_t dependency)
+{
+	if (dependency >= job || job >= slots.size())
+		return;
+
+	slots[dependency].dependents.push_back(job);
+	slots[job].pending_dependencies++;
+}
+
+unsigned CompileJobQueue::default_threads()
+{
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void CompileJobQueue::run(unsigned max_threads)
+{
+	std::mutex lock;
+	std::condition_variable cv;
+	std::deque<size_t> ready;
+	std::vector<std::thread> threads;
+	size_t finished = 0;
+	size_t i;
+
+	// Ready jobs are taken in the order they were added, so with a single
+	// thread the jobs are compiled in order:
+	for (i = 0; i < slots.size(); i++) {
+		if (!slots[i].pending_dependencies)
+			ready.push_back(i);
+	}
+
+	auto worker = [&]() {
+		std::unique_lock<std::mutex> guard(lock);
+		size_t idx;
+
+		while (true) {
+			cv.wait(guard, [&]() { return !ready.empty() || finished == slots.size(); });
+			if (ready.empty())
+				return;
+
+			idx = ready.front();
+			ready.pop_front();
+
+			guard.unlock();
+			slots[idx].job->compile();
+			guard.lock();
+
+			for (size_t dependent : slots[idx].dependents) {
+				if (!--slots[dependent].pending_dependencies)
+					ready.push_back(dependent);
+			}
+			finished++;
+			cv.notify_all();
+		}
+	};
+
+	max_threads = (unsigned)std::min<size_t>(std::max(max_threads, 1u), slots.size());
+	for (i = 1; i < max_threads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (std::thread &thread : threads)
+		thread.join();
+
+	for (Slot &slot : slots)
+		slot.job->complete();
+
+	slots.clear();
+}
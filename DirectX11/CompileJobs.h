@@ -0,0 +1,72 @@
+#pragma once
+
+// Runs a batch of shader compiles on a pool of worker threads.
+//
+// Compiling the custom shaders of a large mod or reloading a big ShaderFixes
+// folder used to compile one shader after another on the render thread. Jobs
+// are now split into a compile() step that runs concurrently on the workers,
+// and a complete() step that runs afterwards on the thread that started the
+// batch. The compile step must not touch any device objects or shared 3DMigoto
+// state, and must buffer anything it wants to log. The complete step creates
+// the device objects, updates our data structures and writes out the buffered
+// logs and overlay messages.
+//
+// complete() is always called in the order the jobs were added, regardless of
+// the order the compiles finished in, so the log file, overlay and the final
+// state (e.g. which of two files for the same shader wins) come out the same
+// on every run no matter how many threads were used.
+//
+// A job may also depend on earlier jobs, in which case its compile() will not
+// start until theirs have finished.
+//
+// This has no Windows or DirectX dependencies, so the scheduling can be
+// exercised with stub jobs on any platform.
+
+#include <stddef.h>
+#include <memory>
+#include <vector>
+
+class CompileJob
+{
+public:
+	virtual ~CompileJob() {}
+
+	// Called on a worker thread (or the calling thread). Must not throw.
+	virtual void compile() = 0;
+
+	// Called on the thread that called CompileJobQueue::run() once every
+	// job in the batch has been compiled, in the order they were added:
+	virtual void complete() = 0;
+};
+
+class CompileJobQueue
+{
+	struct Slot
+	{
+		std::unique_ptr<CompileJob> job;
+		std::vector<size_t> dependents;
+		size_t pending_dependencies;
+	};
+
+	std::vector<Slot> slots;
+
+public:
+	// Takes ownership of the job. Returns an ID for add_dependency():
+	size_t add(CompileJob *job);
+
+	// The dependency must have been added before the job, which rules
+	// out cycles:
+	void add_dependency(size_t job, size_t dependency);
+
+	// Compiles every job using up to max_threads threads, including the
+	// calling thread, then completes them in order and empties the queue.
+	// With max_threads <= 1 no threads are created and jobs are compiled
+	// in the order they were added:
+	void run(unsigned max_threads);
+
+	bool empty() const { return slots.empty(); }
+	size_t size() const { return slots.size(); }
+
+	// Number of threads to use by default, based on the number of cores:
+	static unsigned default_threads();
+};
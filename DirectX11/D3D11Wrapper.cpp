@@ -4,6 +4,7 @@
 #include "Globals.h"
 #include "IniHandler.h"
 #include "HookedDXGI.h"
+#include "ShaderCache.h"
 
 #include "nvprofile.h"
 #include <locale>
@@ -185,7 +186,13 @@ void DestroyDLL()
 	if (LogFile)
 	{
 		LogInfo("Destroying DLL...\n");
-		SavePersistentSettings();
+		SavePersistentSettings(true);
+		if (AsyncLog::enabled) {
+			AsyncLog::Stats stats = AsyncLog::stats();
+			LogInfo("Async log: %llu messages, %llu dropped, %llu writes from %Iu threads (%Iu buffers)\n",
+					stats.messages, stats.dropped_messages, stats.writes, stats.threads, stats.buffers);
+			AsyncLog::stop();
+		}
 		fclose(LogFile);
 	}
 }
@@ -442,6 +449,9 @@ void InitD311()
 	InitializeCriticalSectionPretty(&G->mCriticalSection);
 	InitializeCriticalSectionPretty(&G->mResourcesLock);
 	InitializeCriticalSectionPretty(&resource_creation_mode_lock);
+	InitializeCriticalSectionPretty(&shader_cache_lock);
+	InitializeCriticalSectionPretty(&resource_pools_lock);
+	InitializeCriticalSectionPretty(&G->iniParamsDirty.lock);
 
 	InitializeDLL();
 	
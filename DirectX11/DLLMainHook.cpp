@@ -393,6 +393,7 @@ BOOL WINAPI DllMain(
 		case DLL_THREAD_DETACH:
 			// Do thread-specific cleanup.
 			delete TlsGetValue(tls_idx);
+			AsyncLog::thread_exit();
 			break;
 	}
 
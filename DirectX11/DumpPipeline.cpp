@@ -0,0 +1,222 @@
+#include "DumpPipeline.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+DumpPipeline::DumpPipeline() :
+	running(0),
+	memory_budget(256 * 1024 * 1024),
+	memory_in_use(0),
+	memory_cached(0),
+	max_threads(default_threads()),
+	stopping(false)
+{}
+
+DumpPipeline::~DumpPipeline()
+{
+	size_t i;
+
+	// This may be running from DllMain with the loader lock held, where
+	// joining a thread would deadlock. The workers are normally stopped
+	// by flush() at the end of every frame analysis, so there will only
+	// be any left if we are unloaded mid-analysis:
+	if (!threads.empty()) {
+		for (i = 0; i < threads.size(); i++)
+			threads[i].detach();
+		return;
+	}
+
+	for (i = 0; i < free_blocks.size(); i++)
+		free(free_blocks[i].data);
+}
+
+unsigned DumpPipeline::default_threads()
+{
+	// Leave a core for the game's render thread, which is still busy
+	// copying resources back from the GPU while we write them out:
+	return std::max(std::thread::hardware_concurrency(), 2u) - 1;
+}
+
+void DumpPipeline::configure(unsigned max_threads, size_t memory_budget)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	this->max_threads = max_threads;
+	this->memory_budget = memory_budget;
+}
+
+uint8_t* DumpPipeline::alloc(DumpJob *job, size_t size)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	size_t i, best;
+	uint8_t *data;
+
+	// Back-pressure: wait for the workers to catch up:
+	while (memory_in_use && memory_in_use + size > memory_budget)
+		memory_cv.wait(guard);
+
+	// Blocks may have been given back while we waited:
+	best = free_blocks.size();
+	for (i = 0; i < free_blocks.size(); i++) {
+		if (free_blocks[i].capacity < size)
+			continue;
+		if (best == free_blocks.size() || free_blocks[i].capacity < free_blocks[best].capacity)
+			best = i;
+	}
+
+	if (best != free_blocks.size()) {
+		job->buf = free_blocks[best].data;
+		job->buf_capacity = free_blocks[best].capacity;
+		job->buf_size = size;
+		memory_cached -= job->buf_capacity;
+		memory_in_use += job->buf_capacity;
+		free_blocks.erase(free_blocks.begin() + best);
+		return job->buf;
+	}
+
+	memory_in_use += size;
+	guard.unlock();
+	data = (uint8_t*)malloc(std::max(size, (size_t)1));
+	guard.lock();
+
+	if (!data) {
+		memory_in_use -= size;
+		memory_cv.notify_all();
+		return NULL;
+	}
+
+	job->buf = data;
+	job->buf_capacity = size;
+	job->buf_size = size;
+	return data;
+}
+
+// Must be called with the lock held:
+void DumpPipeline::release(DumpJob *job)
+{
+	Block block;
+
+	if (!job->buf)
+		return;
+
+	memory_in_use -= job->buf_capacity;
+
+	// Keep some blocks around to reuse for the next copies, since a lot
+	// of the buffers in a frame tend to be the same few sizes:
+	if (memory_cached + job->buf_capacity <= memory_budget / 2) {
+		block.data = job->buf;
+		block.capacity = job->buf_capacity;
+		free_blocks.push_back(block);
+		memory_cached += block.capacity;
+	} else {
+		free(job->buf);
+	}
+
+	job->buf = NULL;
+	job->buf_size = job->buf_capacity = 0;
+	memory_cv.notify_all();
+}
+
+// Must be called with the lock held:
+void DumpPipeline::finish(DumpJob *job)
+{
+	release(job);
+	delete job;
+}
+
+void DumpPipeline::submit(DumpJob *job)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	if (!max_threads) {
+		guard.unlock();
+		job->run();
+		guard.lock();
+		finish(job);
+		return;
+	}
+
+	queue.push_back(job);
+
+	// Workers are started on demand, so a frame analysis that only
+	// dumps a handful of buffers doesn't spin up a thread per core:
+	if (threads.size() < max_threads && running + queue.size() > threads.size())
+		threads.emplace_back(&DumpPipeline::worker, this);
+
+	work_cv.notify_one();
+}
+
+void DumpPipeline::worker()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	DumpJob *job;
+
+	while (true) {
+		work_cv.wait(guard, [&]() { return !queue.empty() || stopping; });
+		if (queue.empty())
+			return;
+
+		job = queue.front();
+		queue.pop_front();
+		running++;
+
+		guard.unlock();
+		job->run();
+		guard.lock();
+
+		finish(job);
+		running--;
+
+		if (queue.empty() && !running)
+			done_cv.notify_all();
+	}
+}
+
+void DumpPipeline::flush()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	std::vector<std::thread> stopped;
+	size_t i;
+
+	done_cv.wait(guard, [&]() { return queue.empty() && !running; });
+
+	stopping = true;
+	stopped.swap(threads);
+	work_cv.notify_all();
+	guard.unlock();
+
+	for (i = 0; i < stopped.size(); i++)
+		stopped[i].join();
+
+	guard.lock();
+	stopping = false;
+
+	// Give the memory back between frame analysis sessions:
+	for (i = 0; i < free_blocks.size(); i++)
+		free(free_blocks[i].data);
+	free_blocks.clear();
+	memory_cached = 0;
+}
+
+void DumpPipeline::cancel(DumpJob *job)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	finish(job);
+}
+
+void DumpPipeline::lock_file(const std::wstring &path)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	file_cv.wait(guard, [&]() { return !busy_files.count(path); });
+	busy_files.insert(path);
+}
+
+void DumpPipeline::unlock_file(const std::wstring &path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	busy_files.erase(path);
+	file_cv.notify_all();
+}
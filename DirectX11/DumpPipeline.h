@@ -0,0 +1,138 @@
+#pragma once
+
+// Background writer for frame analysis dumps.
+//
+// Dumping a buffer used to map the staging copy, then format it as text and
+// write out each file on the render thread before the game could issue its
+// next call, which is why a full frame analysis of a modern game could take
+// minutes. Now the render thread only copies the mapped data into memory
+// from a pool and queues a job. A set of worker threads check for existing
+// deduplicated files, encode the text, write the files and link them.
+//
+// The pool has a fixed budget. Once that is used up, alloc() blocks the render
+// thread until the workers have finished enough jobs to make room for the next
+// copy, so a frame with a lot of large buffers can't exhaust the address space
+// of a 32bit game.
+//
+// Jobs that could write the same deduplicated file must hold the file lock for
+// it while checking whether it already exists and writing it.
+//
+// Worker threads only run while there are jobs to do and are stopped by
+// flush(), which is called at the end of each frame analysis so the files
+// are all on disk when we report that it has been saved.
+//
+// This has no Windows or DirectX dependencies, so the pipeline can be
+// exercised with synthetic buffers on any platform.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class DumpJob
+{
+	friend class DumpPipeline;
+
+	uint8_t *buf;
+	size_t buf_size;
+	size_t buf_capacity;
+
+public:
+	DumpJob() : buf(NULL), buf_size(0), buf_capacity(0) {}
+	virtual ~DumpJob() {}
+
+	// Called on a worker thread, or on the thread that submitted the job
+	// if the pipeline has no workers. Must not throw. The data is returned
+	// to the pool as soon as this returns:
+	virtual void run() = 0;
+
+	const uint8_t* data() const { return buf; }
+	size_t size() const { return buf_size; }
+};
+
+class DumpPipeline
+{
+	struct Block
+	{
+		uint8_t *data;
+		size_t capacity;
+	};
+
+	std::mutex lock;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	std::condition_variable memory_cv;
+	std::condition_variable file_cv;
+
+	std::deque<DumpJob*> queue;
+	std::vector<std::thread> threads;
+	size_t running;
+
+	std::vector<Block> free_blocks;
+	size_t memory_budget;
+	size_t memory_in_use;
+	size_t memory_cached;
+
+	std::set<std::wstring> busy_files;
+
+	unsigned max_threads;
+	bool stopping;
+
+	void worker();
+	void finish(DumpJob *job);
+	void release(DumpJob *job);
+
+public:
+	DumpPipeline();
+	~DumpPipeline();
+
+	// Sets the number of worker threads (0 runs every job synchronously
+	// in submit()) and the memory budget. Takes effect the next time the
+	// workers are started:
+	void configure(unsigned max_threads, size_t memory_budget);
+
+	// Gets a buffer of size bytes from the pool for the job to hold its
+	// copy of the resource, blocking while the pool is exhausted. A
+	// single job larger than the whole budget is still allowed through
+	// once everything else has finished:
+	uint8_t* alloc(DumpJob *job, size_t size);
+
+	// Queues the job to run on a worker. Takes ownership of the job:
+	void submit(DumpJob *job);
+
+	// Returns the memory of a job that will not be submitted after all,
+	// and deletes it:
+	void cancel(DumpJob *job);
+
+	// Waits for every job to finish and stops the workers:
+	void flush();
+
+	void lock_file(const std::wstring &path);
+	void unlock_file(const std::wstring &path);
+
+	static unsigned default_threads();
+};
+
+class DumpFileLock
+{
+	DumpPipeline *pipeline;
+	std::wstring path;
+
+public:
+	DumpFileLock(DumpPipeline *pipeline, const std::wstring &path) :
+		pipeline(pipeline),
+		path(path)
+	{
+		pipeline->lock_file(path);
+	}
+
+	~DumpFileLock()
+	{
+		pipeline->unlock_file(path);
+	}
+};
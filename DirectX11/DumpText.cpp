@@ -0,0 +1,273 @@
+#include "DumpText.h"
+
+#include <string.h>
+
+static const size_t DUMP_TEXT_BUFFER_SIZE = 256 * 1024;
+static const unsigned DUMP_TEXT_FLOAT_CACHE_BITS = 12;
+
+static const char dump_text_digits[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const char dump_text_hex_digits[] = "0123456789abcdef";
+
+float dump_float16(uint16_t f16)
+{
+	// Shift sign and mantissa to new positions:
+	uint32_t f32 = ((f16 & 0x8000) << 16) | ((f16 & 0x3ff) << 13);
+	// Need to check special cases of the biased exponent:
+	int biased_exponent = (f16 & 0x7c00) >> 10;
+	float ret;
+
+	if (biased_exponent == 0) {
+		// Zero / subnormal: New biased exponent remains zero
+	} else if (biased_exponent == 0x1f) {
+		// Infinity / NaN: New biased exponent is filled with 1s
+		f32 |= 0x7f800000;
+	} else {
+		// Normal number: Adjust the exponent bias:
+		biased_exponent = biased_exponent - 15 + 127;
+		f32 |= biased_exponent << 23;
+	}
+
+	memcpy(&ret, &f32, sizeof(ret));
+	return ret;
+}
+
+float dump_unorm24(uint32_t val)
+{
+	return (float)val / (float)0xffffff;
+}
+
+float dump_unorm16(uint16_t val)
+{
+	return (float)val / (float)0xffff;
+}
+
+float dump_snorm16(int16_t val)
+{
+	return (float)val / (float)0x7fff;
+}
+
+float dump_unorm8(uint8_t val)
+{
+	return (float)val / (float)0xff;
+}
+
+float dump_snorm8(int8_t val)
+{
+	return (float)val / (float)0x7f;
+}
+
+DumpTextWriter::DumpTextWriter(FILE *fd) :
+	fd(fd),
+	buf(DUMP_TEXT_BUFFER_SIZE),
+	len(0),
+	float_cache(1 << DUMP_TEXT_FLOAT_CACHE_BITS)
+{}
+
+DumpTextWriter::~DumpTextWriter()
+{
+	flush();
+}
+
+void DumpTextWriter::flush()
+{
+	if (len)
+		fwrite(buf.data(), 1, len, fd);
+	len = 0;
+}
+
+void DumpTextWriter::str(const char *s, size_t n)
+{
+	if (n > buf.size()) {
+		flush();
+		fwrite(s, 1, n, fd);
+		return;
+	}
+
+	reserve(n);
+	memcpy(buf.data() + len, s, n);
+	len += n;
+}
+
+void DumpTextWriter::str(const char *s)
+{
+	str(s, strlen(s));
+}
+
+void DumpTextWriter::u32(uint32_t val)
+{
+	u32(val, 1);
+}
+
+void DumpTextWriter::u32(uint32_t val, unsigned width)
+{
+	char tmp[16];
+	char *pos = tmp + sizeof(tmp);
+	unsigned n;
+
+	while (val >= 100) {
+		pos -= 2;
+		memcpy(pos, dump_text_digits + (val % 100) * 2, 2);
+		val /= 100;
+	}
+	if (val >= 10) {
+		pos -= 2;
+		memcpy(pos, dump_text_digits + val * 2, 2);
+	} else {
+		*--pos = (char)('0' + val);
+	}
+
+	n = (unsigned)(tmp + sizeof(tmp) - pos);
+	while (n < width && n < sizeof(tmp)) {
+		*--pos = '0';
+		n++;
+	}
+
+	str(pos, n);
+}
+
+void DumpTextWriter::s32(int32_t val)
+{
+	if (val < 0) {
+		chr('-');
+		u32(0u - (uint32_t)val);
+		return;
+	}
+	u32((uint32_t)val);
+}
+
+void DumpTextWriter::hex(uint32_t val, unsigned width)
+{
+	char tmp[8];
+	unsigned n = 0, i;
+
+	do {
+		tmp[n++] = dump_text_hex_digits[val & 0xf];
+		val >>= 4;
+	} while (val && n < 8);
+	while (n < width && n < 8)
+		tmp[n++] = '0';
+
+	reserve(n);
+	for (i = 0; i < n; i++)
+		buf[len++] = tmp[n - 1 - i];
+}
+
+void DumpTextWriter::g9(float val)
+{
+	CachedFloat *entry;
+	uint32_t bits;
+	char tmp[64];
+	int n;
+
+	memcpy(&bits, &val, sizeof(bits));
+	entry = &float_cache[(bits * 2654435761u) >> (32 - DUMP_TEXT_FLOAT_CACHE_BITS)];
+
+	if (!entry->len || entry->bits != bits) {
+		// The float is promoted to double for the varargs call, the
+		// same as it was when we passed it to fprintf:
+		n = snprintf(tmp, sizeof(tmp), "%.9g", val);
+		if (n <= 0 || n >= (int)sizeof(entry->text)) {
+			if (n > 0)
+				str(tmp, strlen(tmp));
+			return;
+		}
+		memcpy(entry->text, tmp, n);
+		entry->bits = bits;
+		entry->len = (uint8_t)n;
+	}
+
+	str(entry->text, entry->len);
+}
+
+void DumpTextWriter::element(const DumpElementFormat &format, const uint8_t *data)
+{
+	const uint8_t *p;
+	uint16_t u16;
+	uint32_t u32val;
+	int16_t s16;
+	int32_t s32val;
+	float f;
+	unsigned i;
+
+	for (i = 0; i < format.components; i++) {
+		if (i)
+			str(format.separator);
+
+		p = data + format.offset[i];
+
+		// Vertex buffers are not necessarily aligned to the size of
+		// their components, so go via memcpy:
+		switch (format.type[i]) {
+			case DumpComponent::HEX8:
+				hex(p[0], 2);
+				break;
+			case DumpComponent::HEX16:
+				memcpy(&u16, p, 2);
+				hex(u16, 4);
+				break;
+			case DumpComponent::HEX32:
+				memcpy(&u32val, p, 4);
+				hex(u32val, 8);
+				break;
+			case DumpComponent::UINT8:
+				u32(p[0]);
+				break;
+			case DumpComponent::UINT16:
+				memcpy(&u16, p, 2);
+				u32(u16);
+				break;
+			case DumpComponent::UINT32:
+				memcpy(&u32val, p, 4);
+				u32(u32val);
+				break;
+			case DumpComponent::SINT8:
+				s32((int8_t)p[0]);
+				break;
+			case DumpComponent::SINT16:
+				memcpy(&s16, p, 2);
+				s32(s16);
+				break;
+			case DumpComponent::SINT32:
+				memcpy(&s32val, p, 4);
+				s32(s32val);
+				break;
+			case DumpComponent::FLOAT32:
+				memcpy(&f, p, 4);
+				g9(f);
+				break;
+			case DumpComponent::FLOAT16:
+				memcpy(&u16, p, 2);
+				g9(dump_float16(u16));
+				break;
+			case DumpComponent::UNORM24:
+				memcpy(&u32val, p, 4);
+				g9(dump_unorm24(u32val & 0xffffff));
+				break;
+			case DumpComponent::UNORM16:
+				memcpy(&u16, p, 2);
+				g9(dump_unorm16(u16));
+				break;
+			case DumpComponent::SNORM16:
+				memcpy(&s16, p, 2);
+				g9(dump_snorm16(s16));
+				break;
+			case DumpComponent::UNORM8:
+				g9(dump_unorm8(p[0]));
+				break;
+			case DumpComponent::SNORM8:
+				g9(dump_snorm8((int8_t)p[0]));
+				break;
+		}
+	}
+}
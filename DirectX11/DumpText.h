@@ -0,0 +1,125 @@
+#pragma once
+
+// Text encoding for frame analysis buffer dumps.
+//
+// The .txt dumps of vertex, index and constant buffers used to be written with
+// an fprintf() per value (and several per vertex element), each of which
+// locks the stream and parses its format string again, and with a switch on
+// the DXGI_FORMAT of each element repeated for every vertex. Dumping a mesh
+// with a million vertices took several seconds that way.
+//
+// DumpTextWriter appends to a large buffer that is written out with a single
+// fwrite() whenever it fills up. Integers and hex are converted by hand. The
+// output has to stay byte-identical to what we produced before, including
+// the CRT's own spelling of %.9g for denormals, infinities and NaNs, so
+// floats are still converted by the CRT, but only once per distinct bit
+// pattern: the results are kept in a small direct mapped cache. That covers
+// every value of the 8-bit UNORM / SNORM formats, and in practice most of
+// the values in a buffer of normals, tangents, blend weights, colours and
+// half floats, where the same few values repeat over and over.
+//
+// DumpElementFormat describes how to decode one vertex element: which
+// component types are at which byte offsets and how they are separated. It
+// is worked out once per element of the input layout (see
+// dxgi_dump_element_format() in FrameAnalysis.cpp) rather than once per
+// vertex.
+//
+// This has no Windows or DirectX dependencies.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+enum class DumpComponent {
+	HEX8,      // %02x
+	HEX16,     // %04x
+	HEX32,     // %08x
+	UINT8,     // %u
+	UINT16,
+	UINT32,
+	SINT8,     // %d
+	SINT16,
+	SINT32,
+	FLOAT32,   // %.9g
+	FLOAT16,
+	UNORM24,   // Low 24 bits of a 32bit word
+	UNORM16,
+	SNORM16,
+	UNORM8,
+	SNORM8,
+};
+
+struct DumpElementFormat
+{
+	static const unsigned MAX_COMPONENTS = 16;
+
+	unsigned components;
+	DumpComponent type[MAX_COMPONENTS];
+	uint8_t offset[MAX_COMPONENTS];
+	const char *separator;
+
+	DumpElementFormat() : components(0), separator(", ") {}
+
+	void add(DumpComponent t, unsigned off)
+	{
+		if (components < MAX_COMPONENTS) {
+			type[components] = t;
+			offset[components] = (uint8_t)off;
+			components++;
+		}
+	}
+};
+
+float dump_float16(uint16_t f16);
+float dump_unorm24(uint32_t val);
+float dump_unorm16(uint16_t val);
+float dump_snorm16(int16_t val);
+float dump_unorm8(uint8_t val);
+float dump_snorm8(int8_t val);
+
+class DumpTextWriter
+{
+	struct CachedFloat
+	{
+		uint32_t bits;
+		uint8_t len;
+		char text[23];
+	};
+
+	FILE *fd;
+	std::vector<char> buf;
+	size_t len;
+	std::vector<CachedFloat> float_cache;
+
+	void reserve(size_t n)
+	{
+		if (len + n > buf.size())
+			flush();
+	}
+
+public:
+	DumpTextWriter(FILE *fd);
+	~DumpTextWriter();
+
+	// Writes everything buffered so far. Must be called before anything
+	// else writes to the same FILE directly:
+	void flush();
+
+	void chr(char c)
+	{
+		reserve(1);
+		buf[len++] = c;
+	}
+
+	void str(const char *s, size_t n);
+	void str(const char *s);
+
+	void u32(uint32_t val);                // %u
+	void u32(uint32_t val, unsigned width); // %0<width>u
+	void s32(int32_t val);                 // %d
+	void hex(uint32_t val, unsigned width); // %0<width>x
+	void g9(float val);                    // %.9g
+
+	void element(const DumpElementFormat &format, const uint8_t *data);
+};
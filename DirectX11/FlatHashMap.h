@@ -0,0 +1,397 @@
+#pragma once
+
+// A small open addressing hash map used for the tables we look up on every
+// draw call (shader handle -> hash, hash -> ShaderOverride, hash ->
+// TextureOverride, resource handle -> ResourceHandleInfo).
+//
+// The layout follows the SwissTable design: a separate array of one byte
+// control words holds 7 bits of each key's hash (or an empty / deleted
+// marker), and slots are probed in groups of 16 using a single SSE2 compare
+// to find candidate matches. A lookup usually touches one cache line of
+// control bytes and one slot, which is a big improvement over chasing the
+// bucket lists in std::unordered_map.
+//
+// Values are allocated as separate nodes and the slots only hold pointers to
+// them. This is deliberate - various parts of 3DMigoto take pointers to
+// ShaderOverrides, TextureOverrideLists and ResourceHandleInfos and expect
+// them to remain valid after unrelated insertions (e.g. ShaderRegex adding a
+// ShaderOverride for a newly created shader), which std::unordered_map
+// guarantees and we must continue to guarantee. The nodes are only touched
+// once the 7 bit hash has matched, so this costs very little in the lookup.
+//
+// This implements just enough of the std::unordered_map interface for how we
+// use these tables. Iteration order is unspecified, same as unordered_map.
+
+#include <emmintrin.h>
+#include <intrin.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <utility>
+#include <tuple>
+#include <iterator>
+#include <type_traits>
+
+// Keys are handles (pointers) and shader/texture hashes, which may only
+// differ in a handful of bits (handles are aligned and often allocated
+// sequentially), so run them through a fast 64bit finaliser (from
+// MurmurHash3) to ensure both the bits used to select a group and the 7 bits
+// stored in the control word are well distributed:
+static inline uint64_t flat_hash_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+template <class Key>
+struct FlatHash
+{
+	uint64_t operator()(const Key &key) const
+	{
+		return flat_hash_mix((uint64_t)key);
+	}
+};
+
+template <class T>
+struct FlatHash<T*>
+{
+	uint64_t operator()(T *key) const
+	{
+		return flat_hash_mix((uint64_t)(uintptr_t)key);
+	}
+};
+
+template <class Key, class T, class Hash = FlatHash<Key>>
+class FlatHashMap
+{
+public:
+	typedef Key key_type;
+	typedef T mapped_type;
+	typedef std::pair<const Key, T> value_type;
+	typedef size_t size_type;
+
+private:
+	// Control word values. Full slots hold the top 7 bits of the hash
+	// (0-127), so the sign bit distinguishes free slots from full ones:
+	static const int8_t CTRL_EMPTY = -128;
+	static const int8_t CTRL_DELETED = -2;
+	static const size_t GROUP_WIDTH = 16;
+
+	int8_t *ctrl;
+	value_type **slots;
+	size_t num_slots;    // Always zero or a power of two >= GROUP_WIDTH
+	size_t num_elements;
+	size_t growth_left;  // Inserts allowed into empty slots before a rehash
+	Hash hasher;
+
+	static inline unsigned group_match(const int8_t *group, int8_t h2)
+	{
+		__m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+		return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+	}
+
+	static inline unsigned group_match_free(const int8_t *group)
+	{
+		// Empty and deleted both have the sign bit set:
+		return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+	}
+
+	static inline unsigned lowest_bit(unsigned mask)
+	{
+		unsigned long idx;
+		_BitScanForward(&idx, mask);
+		return idx;
+	}
+
+	static inline int8_t hash_h2(uint64_t hash)
+	{
+		return (int8_t)(hash >> 57);
+	}
+
+	static inline size_t max_load(size_t slots)
+	{
+		// 7/8 maximum load factor:
+		return slots - slots / 8;
+	}
+
+	size_t num_groups_mask() const
+	{
+		return num_slots / GROUP_WIDTH - 1;
+	}
+
+	size_t find_index(const Key &key) const
+	{
+		uint64_t hash;
+		size_t group, probe;
+		const int8_t *g;
+		unsigned match;
+		int8_t h2;
+
+		if (!num_elements)
+			return num_slots;
+
+		hash = hasher(key);
+		h2 = hash_h2(hash);
+		group = (size_t)hash & num_groups_mask();
+
+		// Triangular probing visits every group when the number of
+		// groups is a power of two, and we always keep at least one
+		// empty slot so this is guaranteed to terminate:
+		for (probe = 1; ; probe++) {
+			g = ctrl + group * GROUP_WIDTH;
+			for (match = group_match(g, h2); match; match &= match - 1) {
+				size_t idx = group * GROUP_WIDTH + lowest_bit(match);
+				if (slots[idx]->first == key)
+					return idx;
+			}
+			if (group_match(g, CTRL_EMPTY))
+				return num_slots;
+			group = (group + probe) & num_groups_mask();
+		}
+	}
+
+	size_t find_free_slot(uint64_t hash) const
+	{
+		size_t group, probe;
+		unsigned match;
+
+		group = (size_t)hash & num_groups_mask();
+		for (probe = 1; ; probe++) {
+			match = group_match_free(ctrl + group * GROUP_WIDTH);
+			if (match)
+				return group * GROUP_WIDTH + lowest_bit(match);
+			group = (group + probe) & num_groups_mask();
+		}
+	}
+
+	void rehash_to(size_t new_num_slots)
+	{
+		int8_t *old_ctrl = ctrl;
+		value_type **old_slots = slots;
+		size_t old_num_slots = num_slots;
+		size_t i, idx;
+		uint64_t hash;
+
+		if (new_num_slots) {
+			ctrl = new int8_t[new_num_slots];
+			slots = new value_type*[new_num_slots];
+			memset(ctrl, CTRL_EMPTY, new_num_slots);
+		} else {
+			ctrl = NULL;
+			slots = NULL;
+		}
+		num_slots = new_num_slots;
+		growth_left = max_load(new_num_slots) - num_elements;
+
+		for (i = 0; i < old_num_slots; i++) {
+			if (old_ctrl[i] < 0)
+				continue;
+			hash = hasher(old_slots[i]->first);
+			idx = find_free_slot(hash);
+			ctrl[idx] = hash_h2(hash);
+			slots[idx] = old_slots[i];
+		}
+
+		delete [] old_ctrl;
+		delete [] old_slots;
+	}
+
+	static size_t slots_for(size_t elements)
+	{
+		size_t n = GROUP_WIDTH;
+
+		while (max_load(n) < elements + 1)
+			n *= 2;
+		return n;
+	}
+
+	// Returns the index of the key, inserting a default constructed value
+	// if it was not already present:
+	size_t find_or_insert(const Key &key)
+	{
+		size_t idx = find_index(key);
+		uint64_t hash;
+
+		if (idx != num_slots)
+			return idx;
+
+		hash = hasher(key);
+		if (!num_slots) {
+			rehash_to(slots_for(1));
+		} else {
+			idx = find_free_slot(hash);
+			if (ctrl[idx] == CTRL_EMPTY && !growth_left) {
+				// Out of room. If a large part of the table
+				// is tombstones just clean them out, otherwise
+				// grow the table:
+				rehash_to(slots_for(num_elements + 1 + num_elements / 2));
+			}
+		}
+
+		idx = find_free_slot(hash);
+		if (ctrl[idx] == CTRL_EMPTY)
+			growth_left--;
+		slots[idx] = new value_type(std::piecewise_construct,
+				std::forward_as_tuple(key), std::forward_as_tuple());
+		ctrl[idx] = hash_h2(hash);
+		num_elements++;
+		return idx;
+	}
+
+	void erase_index(size_t idx)
+	{
+		size_t group = idx & ~(GROUP_WIDTH - 1);
+
+		delete slots[idx];
+		num_elements--;
+
+		// Since lookups stop at the first group with an empty slot,
+		// we can only free this slot outright if the group already
+		// has an empty slot - in that case no lookup can ever have
+		// probed past this group. Otherwise leave a tombstone.
+		if (group_match(ctrl + group, CTRL_EMPTY)) {
+			ctrl[idx] = CTRL_EMPTY;
+			growth_left++;
+		} else {
+			ctrl[idx] = CTRL_DELETED;
+		}
+	}
+
+	size_t next_full(size_t idx) const
+	{
+		while (idx < num_slots && ctrl[idx] < 0)
+			idx++;
+		return idx;
+	}
+
+public:
+	template <bool Const>
+	class iterator_base
+	{
+		friend class FlatHashMap;
+		template <bool> friend class iterator_base;
+		typedef typename std::conditional<Const, const FlatHashMap, FlatHashMap>::type map_type;
+
+		map_type *map;
+		size_t idx;
+
+		iterator_base(map_type *map, size_t idx) : map(map), idx(idx) {}
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef typename FlatHashMap::value_type value_type;
+		typedef ptrdiff_t difference_type;
+		typedef typename std::conditional<Const, const value_type*, value_type*>::type pointer;
+		typedef typename std::conditional<Const, const value_type&, value_type&>::type reference;
+
+		iterator_base() : map(NULL), idx(0) {}
+		// Allow iterator -> const_iterator conversion:
+		iterator_base(const iterator_base<false> &other) : map(other.map), idx(other.idx) {}
+		iterator_base& operator=(const iterator_base&) = default;
+
+		reference operator*() const { return *map->slots[idx]; }
+		pointer operator->() const { return map->slots[idx]; }
+		iterator_base& operator++() { idx = map->next_full(idx + 1); return *this; }
+		iterator_base operator++(int) { iterator_base tmp = *this; ++*this; return tmp; }
+		bool operator==(const iterator_base &other) const { return idx == other.idx; }
+		bool operator!=(const iterator_base &other) const { return idx != other.idx; }
+	};
+	typedef iterator_base<false> iterator;
+	typedef iterator_base<true> const_iterator;
+
+	FlatHashMap() :
+		ctrl(NULL),
+		slots(NULL),
+		num_slots(0),
+		num_elements(0),
+		growth_left(0)
+	{}
+
+	~FlatHashMap()
+	{
+		clear();
+	}
+
+	// Not needed for any of our use cases, so don't accidentally copy:
+	FlatHashMap(const FlatHashMap&) = delete;
+	FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+	iterator begin() { return iterator(this, next_full(0)); }
+	iterator end() { return iterator(this, num_slots); }
+	const_iterator begin() const { return const_iterator(this, next_full(0)); }
+	const_iterator end() const { return const_iterator(this, num_slots); }
+
+	bool empty() const { return !num_elements; }
+	size_t size() const { return num_elements; }
+
+	iterator find(const Key &key) { return iterator(this, find_index(key)); }
+	const_iterator find(const Key &key) const { return const_iterator(this, find_index(key)); }
+	size_t count(const Key &key) const { return find_index(key) != num_slots; }
+
+	T& operator[](const Key &key)
+	{
+		// Careful - find_or_insert may reallocate slots:
+		size_t idx = find_or_insert(key);
+		return slots[idx]->second;
+	}
+
+	T& at(const Key &key)
+	{
+		size_t idx = find_index(key);
+		if (idx == num_slots)
+			throw std::out_of_range("FlatHashMap::at");
+		return slots[idx]->second;
+	}
+
+	void erase(iterator i)
+	{
+		erase_index(i.idx);
+	}
+
+	size_t erase(const Key &key)
+	{
+		size_t idx = find_index(key);
+		if (idx == num_slots)
+			return 0;
+		erase_index(idx);
+		return 1;
+	}
+
+	void clear()
+	{
+		size_t i;
+
+		for (i = 0; i < num_slots; i++) {
+			if (ctrl[i] >= 0)
+				delete slots[i];
+		}
+		delete [] ctrl;
+		delete [] slots;
+		ctrl = NULL;
+		slots = NULL;
+		num_slots = 0;
+		num_elements = 0;
+		growth_left = 0;
+	}
+
+	// Ensures we can hold this many elements without rehashing
+	void reserve(size_t elements)
+	{
+		if (elements > num_elements && max_load(num_slots) < elements + 1)
+			rehash_to(slots_for(elements));
+	}
+
+	// Rebuilds the table sized for the current contents plus some
+	// headroom, discarding any tombstones. Called once a table has been
+	// populated from the ini file so the per-draw lookups are done on a
+	// compact table, and so that the handful of inserts that can still
+	// happen later (ShaderRegex matching newly created shaders) are
+	// unlikely to trigger a rehash mid-frame:
+	void compact(size_t headroom)
+	{
+		rehash_to(num_elements ? slots_for(num_elements + headroom) : 0);
+	}
+};
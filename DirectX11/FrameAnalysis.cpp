@@ -7,6 +7,8 @@
 #include "FrameAnalysis.h"
 #include "Globals.h"
 #include "input.h"
+#include "DumpPipeline.h"
+#include "DumpText.h"
 
 #include <ScreenGrab.h>
 #include <wincodec.h>
@@ -42,22 +44,25 @@ FrameAnalysisContext::FrameAnalysisContext(ID3D11Device1 *pDevice, ID3D11DeviceC
 
 FrameAnalysisContext::~FrameAnalysisContext()
 {
-	if (frame_analysis_log)
+	if (frame_analysis_log) {
+		frame_analysis_binlog.close();
 		fclose(frame_analysis_log);
+	}
 }
 
-void FrameAnalysisContext::vFrameAnalysisLog(char *fmt, va_list ap)
+bool FrameAnalysisContext::FrameAnalysisLogOpen()
 {
 	wchar_t filename[MAX_PATH];
-
-	LogDebugNoNL("FrameAnalysisContext(%s@%p)::", type_name(this), this);
-	vLogDebug(fmt, ap);
+	wchar_t *ext;
+	bool binary;
 
 	if (!G->analyse_frame) {
-		if (frame_analysis_log)
+		if (frame_analysis_log) {
+			frame_analysis_binlog.close();
 			fclose(frame_analysis_log);
+		}
 		frame_analysis_log = NULL;
-		return;
+		return false;
 	}
 
 	// DSS note: the below comment was originally referring to the
@@ -72,27 +77,63 @@ void FrameAnalysisContext::vFrameAnalysisLog(char *fmt, va_list ap)
 	// it so that this is called from FrameAnalysisAfterDraw, but we want
 	// to log calls for deferred contexts here as well.
 
-	if (!frame_analysis_log) {
-		// Use the original context to check the type, otherwise we
-		// will recursively call ourselves:
-		if (GetPassThroughOrigContext1()->GetType() == D3D11_DEVICE_CONTEXT_IMMEDIATE)
-			swprintf_s(filename, MAX_PATH, L"%ls\\log.txt", G->ANALYSIS_PATH);
-		else
-			swprintf_s(filename, MAX_PATH, L"%ls\\log-0x%p.txt", G->ANALYSIS_PATH, this);
+	if (frame_analysis_log)
+		return true;
 
-		frame_analysis_log = _wfsopen(filename, L"w", _SH_DENYNO);
-		if (!frame_analysis_log) {
-			LogInfoW(L"Error opening %s\n", filename);
-			return;
-		}
-		draw_call = 1;
+	// The whole frame has to go to the same log, so like hold this uses
+	// def_analyse_options:
+	binary = !!(G->def_analyse_options & FrameAnalysisOptions::LOG_BINARY);
+	ext = binary ? L"bin" : L"txt";
+
+	// Use the original context to check the type, otherwise we
+	// will recursively call ourselves:
+	if (GetPassThroughOrigContext1()->GetType() == D3D11_DEVICE_CONTEXT_IMMEDIATE)
+		swprintf_s(filename, MAX_PATH, L"%ls\\log.%ls", G->ANALYSIS_PATH, ext);
+	else
+		swprintf_s(filename, MAX_PATH, L"%ls\\log-0x%p.%ls", G->ANALYSIS_PATH, this, ext);
 
-		fprintf(frame_analysis_log, "analyse_options: %08x\n", G->cur_analyse_options);
+	frame_analysis_log = _wfsopen(filename, binary ? L"wb" : L"w", _SH_DENYNO);
+	if (!frame_analysis_log) {
+		LogInfoW(L"Error opening %s\n", filename);
+		return false;
 	}
+	draw_call = 1;
+
+	if (binary)
+		frame_analysis_binlog.open(frame_analysis_log);
+
+	FrameAnalysisLogAppend("analyse_options: %08x\n", G->cur_analyse_options);
+
+	return true;
+}
 
+uint8_t FrameAnalysisContext::FrameAnalysisLogPrefix()
+{
 	// We don't allow hold to be changed mid-frame due to potential
 	// for filename conflicts, so use def_analyse_options:
 	if (G->def_analyse_options & FrameAnalysisOptions::HOLD)
+		return BinaryLog::EVENT_FRAME | BinaryLog::EVENT_DRAW_CALL;
+	return BinaryLog::EVENT_DRAW_CALL;
+}
+
+void FrameAnalysisContext::vFrameAnalysisLog(char *fmt, va_list ap)
+{
+	uint8_t prefix;
+
+	LogDebugNoNL("FrameAnalysisContext(%s@%p)::", type_name(this), this);
+	vLogDebug(fmt, ap);
+
+	if (!FrameAnalysisLogOpen())
+		return;
+
+	prefix = FrameAnalysisLogPrefix();
+
+	if (frame_analysis_binlog.is_open()) {
+		frame_analysis_binlog.vlog(prefix, G->analyse_frame_no, draw_call, fmt, ap);
+		return;
+	}
+
+	if (prefix & BinaryLog::EVENT_FRAME)
 		fprintf(frame_analysis_log, "%u.", G->analyse_frame_no);
 	fprintf(frame_analysis_log, "%06u ", draw_call);
 
@@ -101,57 +142,42 @@ void FrameAnalysisContext::vFrameAnalysisLog(char *fmt, va_list ap)
 
 void FrameAnalysisContext::vFrameAnalysisLogW(wchar_t* fmt, va_list ap)
 {
-	wchar_t filename[MAX_PATH];
+	uint8_t prefix;
 
 	LogDebugNoNL("FrameAnalysisContext(%s@%p)::", type_name(this), this);
 	vLogDebugW(fmt, ap);
 
-	if (!G->analyse_frame) {
-		if (frame_analysis_log)
-			fclose(frame_analysis_log);
-		frame_analysis_log = NULL;
+	if (!FrameAnalysisLogOpen())
 		return;
-	}
 
-	// DSS note: the below comment was originally referring to the
-	// C->cur_analyse_options & FrameAnalysisOptions::LOG test we used to
-	// have here, but even though we removed that test this is still a good
-	// reminder for other settings as well.
-	//
-	// Using the global analyse options here as the local copy in the
-	// context is only updated after draw calls. We could potentially
-	// process the triggers here, but this function is intended to log
-	// other calls as well where that wouldn't make sense. We could change
-	// it so that this is called from FrameAnalysisAfterDraw, but we want
-	// to log calls for deferred contexts here as well.
-
-	if (!frame_analysis_log) {
-		// Use the original context to check the type, otherwise we
-		// will recursively call ourselves:
-		if (GetPassThroughOrigContext1()->GetType() == D3D11_DEVICE_CONTEXT_IMMEDIATE)
-			swprintf_s(filename, MAX_PATH, L"%ls\\log.txt", G->ANALYSIS_PATH);
-		else
-			swprintf_s(filename, MAX_PATH, L"%ls\\log-0x%p.txt", G->ANALYSIS_PATH, this);
-
-		frame_analysis_log = _wfsopen(filename, L"w", _SH_DENYNO);
-		if (!frame_analysis_log) {
-			LogInfoW(L"Error opening %s\n", filename);
-			return;
-		}
-		draw_call = 1;
+	prefix = FrameAnalysisLogPrefix();
 
-		fprintf(frame_analysis_log, "analyse_options: %08x\n", G->cur_analyse_options);
+	if (frame_analysis_binlog.is_open()) {
+		frame_analysis_binlog.vlog(prefix, G->analyse_frame_no, draw_call, fmt, ap);
+		return;
 	}
 
-	// We don't allow hold to be changed mid-frame due to potential
-	// for filename conflicts, so use def_analyse_options:
-	if (G->def_analyse_options & FrameAnalysisOptions::HOLD)
+	if (prefix & BinaryLog::EVENT_FRAME)
 		fprintf(frame_analysis_log, "%u.", G->analyse_frame_no);
 	fprintf(frame_analysis_log, "%06u ", draw_call);
 
 	vfwprintf(frame_analysis_log, fmt, ap);
 }
 
+// Continues the current line of the frame analysis log, without the draw call
+// prefix. Callers must have already checked the log is open.
+void FrameAnalysisContext::FrameAnalysisLogAppend(char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (frame_analysis_binlog.is_open())
+		frame_analysis_binlog.vlog(0, 0, 0, fmt, ap);
+	else
+		vfprintf(frame_analysis_log, fmt, ap);
+	va_end(ap);
+}
+
 void FrameAnalysisContext::FrameAnalysisLog(char *fmt, ...)
 {
 	va_list ap;
@@ -179,13 +205,23 @@ void FrameAnalysisContext::FrameAnalysisLogW(wchar_t* fmt, ...)
 	FrameAnalysisLogW("3DMigoto " fmt, __VA_ARGS__); \
 } while (0)
 
+// For code that may run on the dump workers, which must not touch the frame
+// analysis log of any context, so these only go to the main log:
+#define FALogWorker(fmt, ...) { \
+	LogInfoW("Frame Analysis: " fmt, __VA_ARGS__); \
+} while (0)
+
+static void link_deduplicated_files(const wchar_t *filename, const wchar_t *dedupe_filename, bool symlink);
+template <typename DescType>
+static void dump_desc(DescType *desc, const wchar_t *filename);
+
 
-static void FrameAnalysisLogSlot(FILE *frame_analysis_log, int slot, char *slot_name)
+void FrameAnalysisContext::FrameAnalysisLogSlot(int slot, char *slot_name)
 {
 	if (slot_name)
-		fprintf(frame_analysis_log, "       %s:", slot_name);
+		FrameAnalysisLogAppend("       %s:", slot_name);
 	else if (slot != -1)
-		fprintf(frame_analysis_log, "       %u:", slot);
+		FrameAnalysisLogAppend("       %u:", slot);
 }
 
 template <class ID3D11Shader>
@@ -200,7 +236,7 @@ void FrameAnalysisContext::FrameAnalysisLogShaderHash(ID3D11Shader *shader)
 		return;
 
 	if (!shader) {
-		fprintf(frame_analysis_log, "\n");
+		FrameAnalysisLogAppend("\n");
 		return;
 	}
 
@@ -208,11 +244,11 @@ void FrameAnalysisContext::FrameAnalysisLogShaderHash(ID3D11Shader *shader)
 
 	hash = lookup_shader_hash(shader);
 	if (hash != end(G->mShaders))
-		fprintf(frame_analysis_log, " hash=%016llx", hash->second);
+		FrameAnalysisLogAppend(" hash=%016llx", hash->second);
 
 	LeaveCriticalSection(&G->mCriticalSection);
 
-	fprintf(frame_analysis_log, "\n");
+	FrameAnalysisLogAppend("\n");
 }
 
 void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource)
@@ -227,10 +263,12 @@ void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource
 		return;
 
 	if (!resource) {
-		fprintf(frame_analysis_log, "\n");
+		FrameAnalysisLogAppend("\n");
 		return;
 	}
 
+	MergeResourceHashContamination();
+
 	EnterCriticalSectionPretty(&G->mCriticalSection);
 	EnterCriticalSectionPretty(&G->mResourcesLock);
 
@@ -238,21 +276,21 @@ void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource
 		hash = G->mResources.at(resource).hash;
 		orig_hash = G->mResources.at(resource).orig_hash;
 		if (hash)
-			fprintf(frame_analysis_log, " hash=%08x", hash);
+			FrameAnalysisLogAppend(" hash=%08x", hash);
 		if (orig_hash != hash)
-			fprintf(frame_analysis_log, " orig_hash=%08x", orig_hash);
+			FrameAnalysisLogAppend(" orig_hash=%08x", orig_hash);
 
 		info = &G->mResourceInfo.at(orig_hash);
 		if (info->hash_contaminated) {
-			fprintf(frame_analysis_log, " hash_contamination=");
+			FrameAnalysisLogAppend(" hash_contamination=");
 			if (!info->map_contamination.empty())
-				fprintf(frame_analysis_log, "Map,");
+				FrameAnalysisLogAppend("Map,");
 			if (!info->update_contamination.empty())
-				fprintf(frame_analysis_log, "UpdateSubresource,");
+				FrameAnalysisLogAppend("UpdateSubresource,");
 			if (!info->copy_contamination.empty())
-				fprintf(frame_analysis_log, "CopyResource,");
+				FrameAnalysisLogAppend("CopyResource,");
 			if (!info->region_contamination.empty())
-				fprintf(frame_analysis_log, "UpdateSubresourceRegion,");
+				FrameAnalysisLogAppend("UpdateSubresourceRegion,");
 		}
 	} catch (std::out_of_range) {
 	}
@@ -260,7 +298,7 @@ void FrameAnalysisContext::FrameAnalysisLogResourceHash(ID3D11Resource *resource
 	LeaveCriticalSection(&G->mResourcesLock);
 	LeaveCriticalSection(&G->mCriticalSection);
 
-	fprintf(frame_analysis_log, "\n");
+	FrameAnalysisLogAppend("\n");
 }
 
 void FrameAnalysisContext::FrameAnalysisLogResource(int slot, char *slot_name, ID3D11Resource *resource)
@@ -268,8 +306,8 @@ void FrameAnalysisContext::FrameAnalysisLogResource(int slot, char *slot_name, I
 	if (!resource || !G->analyse_frame || !frame_analysis_log)
 		return;
 
-	FrameAnalysisLogSlot(frame_analysis_log, slot, slot_name);
-	fprintf(frame_analysis_log, " resource=0x%p", resource);
+	FrameAnalysisLogSlot(slot, slot_name);
+	FrameAnalysisLogAppend(" resource=0x%p", resource);
 
 	FrameAnalysisLogResourceHash(resource);
 }
@@ -281,8 +319,8 @@ void FrameAnalysisContext::FrameAnalysisLogView(int slot, char *slot_name, ID3D1
 	if (!view || !G->analyse_frame || !frame_analysis_log)
 		return;
 
-	FrameAnalysisLogSlot(frame_analysis_log, slot, slot_name);
-	fprintf(frame_analysis_log, " view=0x%p", view);
+	FrameAnalysisLogSlot(slot, slot_name);
+	FrameAnalysisLogAppend(" view=0x%p", view);
 
 	view->GetResource(&resource);
 	if (!resource)
@@ -326,8 +364,8 @@ void FrameAnalysisContext::FrameAnalysisLogMiscArray(UINT start, UINT len, void
 	for (i = 0; i < len; i++) {
 		item = array[i];
 		if (item) {
-			FrameAnalysisLogSlot(frame_analysis_log, start + i, NULL);
-			fprintf(frame_analysis_log, " handle=0x%p\n", item);
+			FrameAnalysisLogSlot(start + i, NULL);
+			FrameAnalysisLogAppend(" handle=0x%p\n", item);
 		}
 	}
 }
@@ -353,7 +391,7 @@ void FrameAnalysisContext::FrameAnalysisLogAsyncQuery(ID3D11Asynchronous *async)
 		return;
 
 	if (!async) {
-		fprintf(frame_analysis_log, "\n");
+		FrameAnalysisLogAppend("\n");
 		return;
 	}
 
@@ -365,17 +403,17 @@ void FrameAnalysisContext::FrameAnalysisLogAsyncQuery(ID3D11Asynchronous *async)
 
 	switch (type) {
 		case AsyncQueryType::QUERY:
-			fprintf(frame_analysis_log, " type=query query=");
+			FrameAnalysisLogAppend(" type=query query=");
 			query = (ID3D11Query*)async;
 			query->GetDesc(&desc);
 			break;
 		case AsyncQueryType::PREDICATE:
-			fprintf(frame_analysis_log, " type=predicate query=");
+			FrameAnalysisLogAppend(" type=predicate query=");
 			predicate = (ID3D11Predicate*)async;
 			predicate->GetDesc(&desc);
 			break;
 		case AsyncQueryType::COUNTER:
-			fprintf(frame_analysis_log, " type=performance\n");
+			FrameAnalysisLogAppend(" type=performance\n");
 			// Don't care about this, and it's a different DESC
 			return;
 		default:
@@ -385,58 +423,58 @@ void FrameAnalysisContext::FrameAnalysisLogAsyncQuery(ID3D11Asynchronous *async)
 
 	switch (desc.Query) {
 		case D3D11_QUERY_EVENT:
-			fprintf(frame_analysis_log, "event");
+			FrameAnalysisLogAppend("event");
 			break;
 		case D3D11_QUERY_OCCLUSION:
-			fprintf(frame_analysis_log, "occlusion");
+			FrameAnalysisLogAppend("occlusion");
 			break;
 		case D3D11_QUERY_TIMESTAMP:
-			fprintf(frame_analysis_log, "timestamp");
+			FrameAnalysisLogAppend("timestamp");
 			break;
 		case D3D11_QUERY_TIMESTAMP_DISJOINT:
-			fprintf(frame_analysis_log, "timestamp_disjoint");
+			FrameAnalysisLogAppend("timestamp_disjoint");
 			break;
 		case D3D11_QUERY_PIPELINE_STATISTICS:
-			fprintf(frame_analysis_log, "pipeline_statistics");
+			FrameAnalysisLogAppend("pipeline_statistics");
 			break;
 		case D3D11_QUERY_OCCLUSION_PREDICATE:
-			fprintf(frame_analysis_log, "occlusion_predicate");
+			FrameAnalysisLogAppend("occlusion_predicate");
 			break;
 		case D3D11_QUERY_SO_STATISTICS:
-			fprintf(frame_analysis_log, "so_statistics");
+			FrameAnalysisLogAppend("so_statistics");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE:
-			fprintf(frame_analysis_log, "so_overflow_predicate");
+			FrameAnalysisLogAppend("so_overflow_predicate");
 			break;
 		case D3D11_QUERY_SO_STATISTICS_STREAM0:
-			fprintf(frame_analysis_log, "so_statistics_stream0");
+			FrameAnalysisLogAppend("so_statistics_stream0");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE_STREAM0:
-			fprintf(frame_analysis_log, "so_overflow_predicate_stream0");
+			FrameAnalysisLogAppend("so_overflow_predicate_stream0");
 			break;
 		case D3D11_QUERY_SO_STATISTICS_STREAM1:
-			fprintf(frame_analysis_log, "so_statistics_stream1");
+			FrameAnalysisLogAppend("so_statistics_stream1");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE_STREAM1:
-			fprintf(frame_analysis_log, "so_overflow_predicate_stream1");
+			FrameAnalysisLogAppend("so_overflow_predicate_stream1");
 			break;
 		case D3D11_QUERY_SO_STATISTICS_STREAM2:
-			fprintf(frame_analysis_log, "so_statistics_stream2");
+			FrameAnalysisLogAppend("so_statistics_stream2");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE_STREAM2:
-			fprintf(frame_analysis_log, "so_overflow_predicate_stream2");
+			FrameAnalysisLogAppend("so_overflow_predicate_stream2");
 			break;
 		case D3D11_QUERY_SO_STATISTICS_STREAM3:
-			fprintf(frame_analysis_log, "so_statistics_stream3");
+			FrameAnalysisLogAppend("so_statistics_stream3");
 			break;
 		case D3D11_QUERY_SO_OVERFLOW_PREDICATE_STREAM3:
-			fprintf(frame_analysis_log, "so_overflow_predicate_stream3");
+			FrameAnalysisLogAppend("so_overflow_predicate_stream3");
 			break;
 		default:
-			fprintf(frame_analysis_log, "?");
+			FrameAnalysisLogAppend("?");
 			break;
 	}
-	fprintf(frame_analysis_log, " MiscFlags=0x%x\n", desc.MiscFlags);
+	FrameAnalysisLogAppend(" MiscFlags=0x%x\n", desc.MiscFlags);
 }
 
 void FrameAnalysisContext::FrameAnalysisLogData(void *buf, UINT size)
@@ -447,10 +485,10 @@ void FrameAnalysisContext::FrameAnalysisLogData(void *buf, UINT size)
 	if (!buf || !size || !G->analyse_frame || !frame_analysis_log)
 		return;
 
-	fprintf(frame_analysis_log, "    data: ");
+	FrameAnalysisLogAppend("    data: ");
 	for (i = 0; i < size; i++, ptr++)
-		fprintf(frame_analysis_log, "%02x", *ptr);
-	fprintf(frame_analysis_log, "\n");
+		FrameAnalysisLogAppend("%02x", *ptr);
+	FrameAnalysisLogAppend("\n");
 }
 
 ID3D11DeviceContext* FrameAnalysisContext::GetDumpingContext()
@@ -509,7 +547,7 @@ void FrameAnalysisContext::Dump2DResourceImmediateCtx(ID3D11Texture2D *staging,
 		hr = S_OK;
 		if (GetFileAttributes(save_filename.c_str()) == INVALID_FILE_ATTRIBUTES)
 			hr = DirectX::SaveWICTextureToFile(GetDumpingContext(), staging, GUID_ContainerFormatJpeg, save_filename.c_str());
-		link_deduplicated_files(filename.c_str(), save_filename.c_str());
+		link_deduplicated_files(filename.c_str(), save_filename.c_str(), !!(analyse_options & FrameAnalysisOptions::SYMLINK));
 	}
 
 
@@ -522,7 +560,7 @@ void FrameAnalysisContext::Dump2DResourceImmediateCtx(ID3D11Texture2D *staging,
 		hr = S_OK;
 		if (GetFileAttributes(save_filename.c_str()) == INVALID_FILE_ATTRIBUTES)
 			hr = DirectX::SaveDDSTextureToFile(GetDumpingContext(), staging, save_filename.c_str());
-		link_deduplicated_files(filename.c_str(), save_filename.c_str());
+		link_deduplicated_files(filename.c_str(), save_filename.c_str(), !!(analyse_options & FrameAnalysisOptions::SYMLINK));
 	}
 
 	if (FAILED(hr))
@@ -534,8 +572,8 @@ void FrameAnalysisContext::Dump2DResourceImmediateCtx(ID3D11Texture2D *staging,
 		FALogInfo(L"Dumping Texture2D %ls -> %ls\n", filename.c_str(), save_filename.c_str());
 
 		if (GetFileAttributes(save_filename.c_str()) == INVALID_FILE_ATTRIBUTES)
-			DumpDesc(orig_desc, save_filename.c_str());
-		link_deduplicated_files(filename.c_str(), save_filename.c_str());
+			dump_desc(orig_desc, save_filename.c_str());
+		link_deduplicated_files(filename.c_str(), save_filename.c_str(), !!(analyse_options & FrameAnalysisOptions::SYMLINK));
 	}
 
 	CoUninitialize();
@@ -820,7 +858,7 @@ void FrameAnalysisContext::dedupe_buf_filename_txt(const wchar_t *bin_filename,
  * try to use the reflection information in the shaders to add names and
  * correct types.
  */
-void FrameAnalysisContext::DumpBufferTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
+static void dump_buffer_txt(const wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
 		UINT size, char type, int idx, UINT stride, UINT offset)
 {
 	FILE *fd = NULL;
@@ -828,10 +866,11 @@ void FrameAnalysisContext::DumpBufferTxt(wchar_t *filename, D3D11_MAPPED_SUBRESO
 	float *buf = (float*)map->pData;
 	UINT i, c;
 	errno_t err;
+	char prefix[32];
 
 	err = wfopen_ensuring_access(&fd, filename, L"w");
 	if (!fd) {
-		FALogErr(L"Unable to create %ls: %u\n", filename, err);
+		FALogWorker(L"Unable to create %ls: %u\n", filename, err);
 		return;
 	}
 
@@ -840,12 +879,24 @@ void FrameAnalysisContext::DumpBufferTxt(wchar_t *filename, D3D11_MAPPED_SUBRESO
 	if (stride)
 		fprintf(fd, "stride: %u\n", stride);
 
-	for (i = offset / 16; i < size / 16; i++) {
-		for (c = offset % 4; c < 4; c++) {
-			if (idx == -1)
-				fprintf(fd, "buf[%d].%c: %.9g\n", i, components[c], buf[i*4+c]);
-			else
-				fprintf(fd, "%cb%i[%d].%c: %.9g\n", type, idx, i, components[c], buf[i*4+c]);
+	if (idx == -1)
+		sprintf_s(prefix, ARRAYSIZE(prefix), "buf[");
+	else
+		sprintf_s(prefix, ARRAYSIZE(prefix), "%cb%i[", type, idx);
+
+	{
+		DumpTextWriter out(fd);
+
+		for (i = offset / 16; i < size / 16; i++) {
+			for (c = offset % 4; c < 4; c++) {
+				out.str(prefix);
+				out.s32(i);
+				out.str("].");
+				out.chr(components[c]);
+				out.str(": ");
+				out.g9(buf[i*4+c]);
+				out.chr('\n');
+			}
 		}
 	}
 
@@ -984,24 +1035,42 @@ static void dump_vb_unknown_layout(FILE *fd, D3D11_MAPPED_SUBRESOURCE *map,
 	uint32_t *buf32 = (uint32_t*)map->pData;
 	uint8_t *buf8 = (uint8_t*)map->pData;
 	UINT vertex, j, start, end, buf_idx;
+	DumpTextWriter out(fd);
+	char prefix[16];
 
 	start = offset / stride + first;
 	end = size / stride;
 	if (count)
 		end = min(end, start + count);
 
+	sprintf_s(prefix, ARRAYSIZE(prefix), "vb%i[", slot);
+
 	for (vertex = start; vertex < end; vertex++) {
-		fprintf(fd, "\n");
+		out.chr('\n');
 
 		for (j = 0; j < stride / 4; j++) {
 			buf_idx = vertex * stride / 4 + j;
-			fprintf(fd, "vb%i[%u]+%03u: 0x%08x %.9g\n", slot, vertex - start, j*4, buf32[buf_idx], buff[buf_idx]);
+			out.str(prefix);
+			out.u32(vertex - start);
+			out.str("]+");
+			out.u32(j*4, 3);
+			out.str(": 0x");
+			out.hex(buf32[buf_idx], 8);
+			out.chr(' ');
+			out.g9(buff[buf_idx]);
+			out.chr('\n');
 		}
 
 		// In case we find one that is not a 32bit multiple finish off one byte at a time:
 		for (j = j * 4; j < stride; j++) {
 			buf_idx = vertex * stride + j;
-			fprintf(fd, "vb%i[%u]+%03u: 0x%02x\n", slot, vertex - start, j, buf8[buf_idx]);
+			out.str(prefix);
+			out.u32(vertex - start);
+			out.str("]+");
+			out.u32(j, 3);
+			out.str(": 0x");
+			out.hex(buf8[buf_idx], 2);
+			out.chr('\n');
 		}
 	}
 }
@@ -1081,163 +1150,120 @@ static UINT dxgi_format_alignment(DXGI_FORMAT format)
 	return 0;
 }
 
-static float float16(uint16_t f16)
-{
-	// Shift sign and mantissa to new positions:
-	uint32_t f32 = ((f16 & 0x8000) << 16) | ((f16 & 0x3ff) << 13);
-	// Need to check special cases of the biased exponent:
-	int biased_exponent = (f16 & 0x7c00) >> 10;
-
-	if (biased_exponent == 0) {
-		// Zero / subnormal: New biased exponent remains zero
-	} else if (biased_exponent == 0x1f) {
-		// Infinity / NaN: New biased exponent is filled with 1s
-		f32 |= 0x7f800000;
-	} else {
-		// Normal number: Adjust the exponent bias:
-		biased_exponent = biased_exponent - 15 + 127;
-		f32 |= biased_exponent << 23;
-	}
-
-	return *(float*)&f32;
-}
-
-static float unorm24(uint32_t val)
-{
-	return (float)val / (float)0xffffff;
-}
-
-static float unorm16(uint16_t val)
-{
-	return (float)val / (float)0xffff;
-}
-
-static float snorm16(int16_t val)
+static void add_components(DumpElementFormat *fmt, DumpComponent type, unsigned n, unsigned size)
 {
-	return (float)val / (float)0x7fff;
-}
-
-static float unorm8(uint8_t val)
-{
-	return (float)val / (float)0xff;
-}
+	unsigned i;
 
-static float snorm8(int8_t val)
-{
-	return (float)val / (float)0x7f;
+	for (i = 0; i < n; i++)
+		fmt->add(type, i * size);
 }
 
-static int fprint_dxgi_format(FILE *fd, DXGI_FORMAT format, uint8_t *buf)
+// Works out how to print an element of the given format. This is done once per
+// element of the input layout, not once per vertex:
+static void dxgi_dump_element_format(DXGI_FORMAT format, DumpElementFormat *fmt)
 {
-	float *f = (float*)buf;
-	uint32_t *u32 = (uint32_t*)buf;
-	int32_t *s32 = (int32_t*)buf;
-	uint16_t *u16 = (uint16_t*)buf;
-	int16_t *s16 = (int16_t*)buf;
-	uint8_t *u8 = (uint8_t*)buf;
-	int8_t *s8 = (int8_t*)buf;
 	unsigned i;
 
 	switch (format) {
 		// --- 32-bit ---
 		case DXGI_FORMAT_R32G32B32A32_TYPELESS:
-			return fprintf(fd, "%08x, %08x, %08x, %08x", u32[0], u32[1], u32[2], u32[3]);
+			return add_components(fmt, DumpComponent::HEX32, 4, 4);
 		case DXGI_FORMAT_R32G32B32_TYPELESS:
-			return fprintf(fd, "%08x, %08x, %08x", u32[0], u32[1], u32[2]);
+			return add_components(fmt, DumpComponent::HEX32, 3, 4);
 		case DXGI_FORMAT_R32G32_TYPELESS:
-			return fprintf(fd, "%08x, %08x", u32[0], u32[1]);
+			return add_components(fmt, DumpComponent::HEX32, 2, 4);
 		case DXGI_FORMAT_R32_TYPELESS:
-			return fprintf(fd, "%08x", u32[0]);
+			return add_components(fmt, DumpComponent::HEX32, 1, 4);
 
 		case DXGI_FORMAT_R32G32B32A32_FLOAT:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", f[0], f[1], f[2], f[3]);
+			return add_components(fmt, DumpComponent::FLOAT32, 4, 4);
 		case DXGI_FORMAT_R32G32B32_FLOAT:
-			return fprintf(fd, "%.9g, %.9g, %.9g", f[0], f[1], f[2]);
+			return add_components(fmt, DumpComponent::FLOAT32, 3, 4);
 		case DXGI_FORMAT_R32G32_FLOAT:
-			return fprintf(fd, "%.9g, %.9g", f[0], f[1]);
+			return add_components(fmt, DumpComponent::FLOAT32, 2, 4);
 		case DXGI_FORMAT_D32_FLOAT:
 		case DXGI_FORMAT_R32_FLOAT:
-			return fprintf(fd, "%.9g", f[0]);
+			return add_components(fmt, DumpComponent::FLOAT32, 1, 4);
 
 		case DXGI_FORMAT_R32G32B32A32_UINT:
-			return fprintf(fd, "%u, %u, %u, %u", u32[0], u32[1], u32[2], u32[3]);
+			return add_components(fmt, DumpComponent::UINT32, 4, 4);
 		case DXGI_FORMAT_R32G32B32_UINT:
-			return fprintf(fd, "%u, %u, %u", u32[0], u32[1], u32[2]);
+			return add_components(fmt, DumpComponent::UINT32, 3, 4);
 		case DXGI_FORMAT_R32G32_UINT:
-			return fprintf(fd, "%u, %u", u32[0], u32[1]);
+			return add_components(fmt, DumpComponent::UINT32, 2, 4);
 		case DXGI_FORMAT_R32_UINT:
-			return fprintf(fd, "%u", u32[0]);
+			return add_components(fmt, DumpComponent::UINT32, 1, 4);
 
 		case DXGI_FORMAT_R32G32B32A32_SINT:
-			return fprintf(fd, "%d, %d, %d, %d", s32[0], s32[1], s32[2], s32[3]);
+			return add_components(fmt, DumpComponent::SINT32, 4, 4);
 		case DXGI_FORMAT_R32G32B32_SINT:
-			return fprintf(fd, "%d, %d, %d", s32[0], s32[1], s32[2]);
+			return add_components(fmt, DumpComponent::SINT32, 3, 4);
 		case DXGI_FORMAT_R32G32_SINT:
-			return fprintf(fd, "%d, %d", s32[0], s32[1]);
+			return add_components(fmt, DumpComponent::SINT32, 2, 4);
 		case DXGI_FORMAT_R32_SINT:
-			return fprintf(fd, "%d", s32[0]);
+			return add_components(fmt, DumpComponent::SINT32, 1, 4);
 
 		// --- 16-bit ---
 		case DXGI_FORMAT_R16G16B16A16_TYPELESS:
-			return fprintf(fd, "%04x, %04x, %04x, %04x", u16[0], u16[1], u16[2], u16[3]);
+			return add_components(fmt, DumpComponent::HEX16, 4, 2);
 		case DXGI_FORMAT_R16G16_TYPELESS:
-			return fprintf(fd, "%04x, %04x", u16[0], u16[1]);
+			return add_components(fmt, DumpComponent::HEX16, 2, 2);
 		case DXGI_FORMAT_R16_TYPELESS:
-			return fprintf(fd, "%04x", u16[0]);
+			return add_components(fmt, DumpComponent::HEX16, 1, 2);
 
 		// %.9g is probably excessive, but I haven't calculated or
 		// verified the actual decimal precision needed to ensure
 		// 16-bit floats can be reproduced exactly, and I know that
 		// %.9g is enough for 32-bit floats so it is safer for now:
 		case DXGI_FORMAT_R16G16B16A16_FLOAT:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", float16(u16[0]), float16(u16[1]), float16(u16[2]), float16(u16[3]));
+			return add_components(fmt, DumpComponent::FLOAT16, 4, 2);
 		case DXGI_FORMAT_R16G16_FLOAT:
-			return fprintf(fd, "%.9g, %.9g", float16(u16[0]), float16(u16[1]));
+			return add_components(fmt, DumpComponent::FLOAT16, 2, 2);
 		case DXGI_FORMAT_R16_FLOAT:
-			return fprintf(fd, "%.9g", float16(u16[0]));
+			return add_components(fmt, DumpComponent::FLOAT16, 1, 2);
 
 		// And of course, if we were to work out a better decimal
 		// precision value, remember that a 16-bit UNORM has 16 bits of
 		// precision, while a 16-bit FLOAT only has 11.
 		case DXGI_FORMAT_R16G16B16A16_UNORM:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", unorm16(u16[0]), unorm16(u16[1]), unorm16(u16[2]), unorm16(u16[3]));
+			return add_components(fmt, DumpComponent::UNORM16, 4, 2);
 		case DXGI_FORMAT_R16G16_UNORM:
-			return fprintf(fd, "%.9g, %.9g", unorm16(u16[0]), unorm16(u16[1]));
+			return add_components(fmt, DumpComponent::UNORM16, 2, 2);
 		case DXGI_FORMAT_D16_UNORM:
 		case DXGI_FORMAT_R16_UNORM:
-			return fprintf(fd, "%.9g", unorm16(u16[0]));
+			return add_components(fmt, DumpComponent::UNORM16, 1, 2);
 
 		case DXGI_FORMAT_R16G16B16A16_SNORM:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", snorm16(s16[0]), snorm16(s16[1]), snorm16(s16[2]), snorm16(s16[3]));
+			return add_components(fmt, DumpComponent::SNORM16, 4, 2);
 		case DXGI_FORMAT_R16G16_SNORM:
-			return fprintf(fd, "%.9g, %.9g", snorm16(s16[0]), snorm16(s16[1]));
+			return add_components(fmt, DumpComponent::SNORM16, 2, 2);
 		case DXGI_FORMAT_R16_SNORM:
-			return fprintf(fd, "%.9g", snorm16(s16[0]));
+			return add_components(fmt, DumpComponent::SNORM16, 1, 2);
 
 		case DXGI_FORMAT_R16G16B16A16_UINT:
-			return fprintf(fd, "%u, %u, %u, %u", u16[0], u16[1], u16[2], u16[3]);
+			return add_components(fmt, DumpComponent::UINT16, 4, 2);
 		case DXGI_FORMAT_R16G16_UINT:
-			return fprintf(fd, "%u, %u", u16[0], u16[1]);
+			return add_components(fmt, DumpComponent::UINT16, 2, 2);
 		case DXGI_FORMAT_R16_UINT:
-			return fprintf(fd, "%u", u16[0]);
+			return add_components(fmt, DumpComponent::UINT16, 1, 2);
 
 		case DXGI_FORMAT_R16G16B16A16_SINT:
-			return fprintf(fd, "%d, %d, %d, %d", s16[0], s16[1], s16[2], s16[3]);
+			return add_components(fmt, DumpComponent::SINT16, 4, 2);
 		case DXGI_FORMAT_R16G16_SINT:
-			return fprintf(fd, "%d, %d", s16[0], s16[1]);
+			return add_components(fmt, DumpComponent::SINT16, 2, 2);
 		case DXGI_FORMAT_R16_SINT:
-			return fprintf(fd, "%d", s16[0]);
+			return add_components(fmt, DumpComponent::SINT16, 1, 2);
 
 		// --- 8-bit ---
 		case DXGI_FORMAT_R8G8B8A8_TYPELESS:
 		case DXGI_FORMAT_B8G8R8A8_TYPELESS:
-			return fprintf(fd, "%02x, %02x, %02x, %02x", u8[0], u8[1], u8[2], u8[3]);
+			return add_components(fmt, DumpComponent::HEX8, 4, 1);
 		case DXGI_FORMAT_B8G8R8X8_TYPELESS:
-			return fprintf(fd, "%02x, %02x, %02x", u8[0], u8[1], u8[2]);
+			return add_components(fmt, DumpComponent::HEX8, 3, 1);
 		case DXGI_FORMAT_R8G8_TYPELESS:
-			return fprintf(fd, "%02x, %02x", u8[0], u8[1]);
+			return add_components(fmt, DumpComponent::HEX8, 2, 1);
 		case DXGI_FORMAT_R8_TYPELESS:
-			return fprintf(fd, "%02x", u8[0]);
+			return add_components(fmt, DumpComponent::HEX8, 1, 1);
 
 		case DXGI_FORMAT_R8G8B8A8_UNORM:
 		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: // XXX: Should we apply the SRGB formula?
@@ -1247,45 +1273,49 @@ static int fprint_dxgi_format(FILE *fd, DXGI_FORMAT format, uint8_t *buf)
 		case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB: // XXX: Should we apply the SRGB formula?
 		case DXGI_FORMAT_R8G8_B8G8_UNORM:
 		case DXGI_FORMAT_G8R8_G8B8_UNORM:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", unorm8(u8[0]), unorm8(u8[1]), unorm8(u8[2]), unorm8(u8[3]));
+			return add_components(fmt, DumpComponent::UNORM8, 4, 1);
 		case DXGI_FORMAT_R8G8_UNORM:
-			return fprintf(fd, "%.9g, %.9g", unorm8(u8[0]), unorm8(u8[1]));
+			return add_components(fmt, DumpComponent::UNORM8, 2, 1);
 		case DXGI_FORMAT_R8_UNORM:
-			return fprintf(fd, "%.9g", unorm8(u8[0]));
+			return add_components(fmt, DumpComponent::UNORM8, 1, 1);
 
 		case DXGI_FORMAT_R8G8B8A8_SNORM:
-			return fprintf(fd, "%.9g, %.9g, %.9g, %.9g", snorm8(s8[0]), snorm8(s8[1]), snorm8(s8[2]), snorm8(s8[3]));
+			return add_components(fmt, DumpComponent::SNORM8, 4, 1);
 		case DXGI_FORMAT_R8G8_SNORM:
-			return fprintf(fd, "%.9g, %.9g", snorm8(s8[0]), snorm8(s8[1]));
+			return add_components(fmt, DumpComponent::SNORM8, 2, 1);
 		case DXGI_FORMAT_R8_SNORM:
 		case DXGI_FORMAT_A8_UNORM:
-			return fprintf(fd, "%.9g", snorm8(s8[0]));
+			return add_components(fmt, DumpComponent::SNORM8, 1, 1);
 
 		case DXGI_FORMAT_R8G8B8A8_UINT:
-			return fprintf(fd, "%u, %u, %u, %u", u8[0], u8[1], u8[2], u8[3]);
+			return add_components(fmt, DumpComponent::UINT8, 4, 1);
 		case DXGI_FORMAT_R8G8_UINT:
-			return fprintf(fd, "%u, %u", u8[0], u8[1]);
+			return add_components(fmt, DumpComponent::UINT8, 2, 1);
 		case DXGI_FORMAT_R8_UINT:
-			return fprintf(fd, "%u", u8[0]);
+			return add_components(fmt, DumpComponent::UINT8, 1, 1);
 
 		case DXGI_FORMAT_R8G8B8A8_SINT:
-			return fprintf(fd, "%d, %d, %d, %d", s8[0], s8[1], s8[2], s8[3]);
+			return add_components(fmt, DumpComponent::SINT8, 4, 1);
 		case DXGI_FORMAT_R8G8_SINT:
-			return fprintf(fd, "%d, %d", s8[0], s8[1]);
+			return add_components(fmt, DumpComponent::SINT8, 2, 1);
 		case DXGI_FORMAT_R8_SINT:
-			return fprintf(fd, "%d", s8[0]);
+			return add_components(fmt, DumpComponent::SINT8, 1, 1);
 
 		case DXGI_FORMAT_R32G8X24_TYPELESS:
 		case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
 		case DXGI_FORMAT_R32_FLOAT_X8X24_TYPELESS:
 		case DXGI_FORMAT_X32_TYPELESS_G8X24_UINT:
-			return fprintf(fd, "%.9g, %d", f[0], u8[4]);
+			fmt->add(DumpComponent::FLOAT32, 0);
+			fmt->add(DumpComponent::UINT8, 4);
+			return;
 
 		case DXGI_FORMAT_R24G8_TYPELESS:
 		case DXGI_FORMAT_D24_UNORM_S8_UINT:
 		case DXGI_FORMAT_R24_UNORM_X8_TYPELESS:
 		case DXGI_FORMAT_X24_TYPELESS_G8_UINT:
-			return fprintf(fd, "%.9g, %d", unorm24(u32[0] & 0xffffff), u8[3]);
+			fmt->add(DumpComponent::UNORM24, 0);
+			fmt->add(DumpComponent::UINT8, 3);
+			return;
 
 		// TODO: Unusual field sizes:
 		// case DXGI_FORMAT_R10G10B10A2_TYPELESS:
@@ -1299,70 +1329,115 @@ static int fprint_dxgi_format(FILE *fd, DXGI_FORMAT format, uint8_t *buf)
 		// case DXGI_FORMAT_R10G10B10_XR_BIAS_A2_UNORM:
 	}
 
+	// Anything else is dumped as raw hex bytes:
+	fmt->separator = "";
 	for (i = 0; i < dxgi_format_size(format); i++)
-		fprintf(fd, "%02x", buf[i]);
-	return i * 2;
+		fmt->add(DumpComponent::HEX8, i);
 }
 
+// Everything about how to dump an element of the input layout that is the
+// same for every vertex, worked out once per buffer:
+struct VBElemDumpPlan
+{
+	UINT elem;
+	UINT offset;
+	DumpElementFormat format;
+	std::string head; // Any warnings, then "vb0["
+	std::string label; // "]+000 POSITION: "
+	std::string tail; // "\n", then any warnings
+};
 
-static void dump_vb_elem(FILE *fd, uint8_t *buf,
+static void plan_vb_elems(std::vector<VBElemDumpPlan> *plans,
 		D3D11_INPUT_ELEMENT_DESC *layout_desc, size_t layout_elements,
-		int slot, UINT vb_idx, UINT elem, UINT stride)
+		int slot, D3D11_INPUT_CLASSIFICATION slot_class, UINT stride)
 {
-	UINT offset = 0, alignment, size;
+	VBElemDumpPlan plan;
+	UINT elem, offset, alignment, size;
+	char buf[64];
 
-	if (layout_desc[elem].InputSlot != slot)
-		return;
+	for (elem = 0; elem < layout_elements; elem++) {
+		if (layout_desc[elem].InputSlotClass != slot_class)
+			continue;
 
-	if (layout_desc[elem].AlignedByteOffset != D3D11_APPEND_ALIGNED_ELEMENT) {
-		offset = layout_desc[elem].AlignedByteOffset;
-	} else {
-		alignment = dxgi_format_alignment(layout_desc[elem].Format);
-		if (!alignment) {
-			fprintf(fd, "# WARNING: Unknown format alignment, vertex buffer may be decoded incorrectly\n");
-		} else if (offset % alignment) {
-			fprintf(fd, "# WARNING: Untested alignment code in use, please report incorrectly decoded vertex buffers\n");
-			// XXX: Also, what if the entire vertex is misaligned in the buffer?
-			offset += alignment - (offset % alignment);
+		if (layout_desc[elem].InputSlot != slot)
+			continue;
+
+		plan = VBElemDumpPlan();
+		plan.elem = elem;
+		offset = 0;
+
+		if (layout_desc[elem].AlignedByteOffset != D3D11_APPEND_ALIGNED_ELEMENT) {
+			offset = layout_desc[elem].AlignedByteOffset;
+		} else {
+			alignment = dxgi_format_alignment(layout_desc[elem].Format);
+			if (!alignment) {
+				plan.head += "# WARNING: Unknown format alignment, vertex buffer may be decoded incorrectly\n";
+			} else if (offset % alignment) {
+				plan.head += "# WARNING: Untested alignment code in use, please report incorrectly decoded vertex buffers\n";
+				// XXX: Also, what if the entire vertex is misaligned in the buffer?
+				offset += alignment - (offset % alignment);
+			}
 		}
-	}
+		plan.offset = offset;
 
-	fprintf(fd, "vb%i[%u]+%03u %s", slot, vb_idx, offset, layout_desc[elem].SemanticName);
-	if (layout_desc[elem].SemanticIndex)
-		fprintf(fd, "%u", layout_desc[elem].SemanticIndex);
-	fprintf(fd, ": ");
+		sprintf_s(buf, ARRAYSIZE(buf), "vb%i[", slot);
+		plan.head += buf;
 
-	fprint_dxgi_format(fd, layout_desc[elem].Format, buf + offset);
-	fprintf(fd, "\n");
+		sprintf_s(buf, ARRAYSIZE(buf), "]+%03u ", offset);
+		plan.label = buf;
+		plan.label += layout_desc[elem].SemanticName ? layout_desc[elem].SemanticName : "(null)";
+		if (layout_desc[elem].SemanticIndex) {
+			sprintf_s(buf, ARRAYSIZE(buf), "%u", layout_desc[elem].SemanticIndex);
+			plan.label += buf;
+		}
+		plan.label += ": ";
+
+		dxgi_dump_element_format(layout_desc[elem].Format, &plan.format);
+
+		plan.tail = "\n";
+		size = dxgi_format_size(layout_desc[elem].Format);
+		if (!size)
+			plan.tail += "# WARNING: Unknown format size, vertex buffer may be decoded incorrectly\n";
+		offset += size;
+		if (offset > stride)
+			plan.tail += "# WARNING: Offset exceeded stride, vertex buffer may be decoded incorrectly\n";
+
+		plans->push_back(plan);
+	}
+}
 
-	size = dxgi_format_size(layout_desc[elem].Format);
-	if (!size)
-		fprintf(fd, "# WARNING: Unknown format size, vertex buffer may be decoded incorrectly\n");
-	offset += size;
-	if (offset > stride)
-		fprintf(fd, "# WARNING: Offset exceeded stride, vertex buffer may be decoded incorrectly\n");
+static void dump_vb_elem(DumpTextWriter *out, uint8_t *buf,
+		VBElemDumpPlan *plan, UINT vb_idx)
+{
+	out->str(plan->head.c_str(), plan->head.size());
+	out->u32(vb_idx);
+	out->str(plan->label.c_str(), plan->label.size());
+	out->element(plan->format, buf + plan->offset);
+	out->str(plan->tail.c_str(), plan->tail.size());
 }
 
 static void dump_vb_known_layout(FILE *fd, D3D11_MAPPED_SUBRESOURCE *map,
 		D3D11_INPUT_ELEMENT_DESC *layout_desc, size_t layout_elements,
 		UINT size, int slot, UINT offset, UINT first, UINT count, UINT stride)
 {
-	UINT vertex, elem, start, end;
+	std::vector<VBElemDumpPlan> plans;
+	DumpTextWriter out(fd);
+	UINT vertex, start, end;
+	size_t i;
 
 	start = offset / stride + first;
 	end = size / stride;
 	if (count)
 		end = min(end, start + count);
 
+	plan_vb_elems(&plans, layout_desc, layout_elements, slot,
+			D3D11_INPUT_PER_VERTEX_DATA, stride);
+
 	for (vertex = start; vertex < end; vertex++) {
-		fprintf(fd, "\n");
-		for (elem = 0; elem < layout_elements; elem++) {
-			if (layout_desc[elem].InputSlotClass != D3D11_INPUT_PER_VERTEX_DATA)
-				continue;
-
-			dump_vb_elem(fd, (uint8_t*)map->pData + stride*vertex,
-					layout_desc, layout_elements, slot,
-					vertex - start, elem, stride);
+		out.chr('\n');
+		for (i = 0; i < plans.size(); i++) {
+			dump_vb_elem(&out, (uint8_t*)map->pData + stride*vertex,
+					&plans[i], vertex - start);
 		}
 	}
 }
@@ -1371,27 +1446,30 @@ static void dump_vb_instance_data(FILE *fd, D3D11_MAPPED_SUBRESOURCE *map,
 		D3D11_INPUT_ELEMENT_DESC *layout_desc, size_t layout_elements,
 		UINT size, int slot, UINT offset, UINT first, UINT count, UINT stride)
 {
-	UINT instance, idx, elem, start, end;
+	std::vector<VBElemDumpPlan> plans;
+	DumpTextWriter out(fd);
+	UINT instance, idx, start, end, step_rate;
+	size_t i;
 
 	start = offset / stride + first;
 	end = size / stride;
 	if (count)
 		end = min(end, start + count);
 
-	for (instance = start; instance < end; instance++) {
-		fprintf(fd, "\n");
-		for (elem = 0; elem < layout_elements; elem++) {
-			if (layout_desc[elem].InputSlotClass != D3D11_INPUT_PER_INSTANCE_DATA)
-				continue;
+	plan_vb_elems(&plans, layout_desc, layout_elements, slot,
+			D3D11_INPUT_PER_INSTANCE_DATA, stride);
 
-			if (layout_desc[elem].InstanceDataStepRate)
-				idx = (instance-start) / layout_desc[elem].InstanceDataStepRate + start;
+	for (instance = start; instance < end; instance++) {
+		out.chr('\n');
+		for (i = 0; i < plans.size(); i++) {
+			step_rate = layout_desc[plans[i].elem].InstanceDataStepRate;
+			if (step_rate)
+				idx = (instance-start) / step_rate + start;
 			else
 				idx = instance;
 
-			dump_vb_elem(fd, (uint8_t*)map->pData + stride*idx,
-					layout_desc, layout_elements, slot,
-					idx - start, elem, stride);
+			dump_vb_elem(&out, (uint8_t*)map->pData + stride*idx,
+					&plans[i], idx - start);
 		}
 	}
 }
@@ -1401,7 +1479,7 @@ static void dump_vb_instance_data(FILE *fd, D3D11_MAPPED_SUBRESOURCE *map,
  * FIXME: We should wrap the input layout object to get the correct format (and
  * other info like the semantic).
  */
-void FrameAnalysisContext::DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
+static void dump_vb_txt(const wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
 		UINT size, int slot, UINT stride, UINT offset, UINT first, UINT count, ID3DBlob *layout,
 		D3D11_PRIMITIVE_TOPOLOGY topology, DrawCallInfo *call_info)
 {
@@ -1413,7 +1491,7 @@ void FrameAnalysisContext::DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 
 	err = wfopen_ensuring_access(&fd, filename, L"w");
 	if (!fd) {
-		FALogErr(L"Unable to create %ls: %u\n", filename, err);
+		FALogWorker(L"Unable to create %ls: %u\n", filename, err);
 		return;
 	}
 
@@ -1436,7 +1514,7 @@ void FrameAnalysisContext::DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 		dump_ia_layout(fd, layout_desc, layout_elements, slot, &per_vert, &per_inst);
 	}
 	if (!stride) {
-		FALogErr(L"Cannot dump vertex buffer with stride=0\n");
+		FALogWorker(L"Cannot dump vertex buffer with stride=0\n");
 		goto out_close;
 	}
 
@@ -1492,20 +1570,36 @@ void FrameAnalysisContext::dedupe_buf_filename_ib_txt(const wchar_t *bin_filenam
 		FALogErr(L"Failed to create index buffer filename\n");
 }
 
-void FrameAnalysisContext::DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
+template <typename T>
+static void dump_ib_indices(FILE *fd, T *buf, UINT start, UINT end, int grouping)
+{
+	DumpTextWriter out(fd);
+	UINT i;
+
+	for (i = start; i < end; i++) {
+		if ((i-start) % grouping == 0)
+			out.chr('\n');
+		else
+			out.chr(' ');
+		out.u32(buf[i]);
+	}
+	out.chr('\n');
+}
+
+static void dump_ib_txt(const wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
 		UINT size, DXGI_FORMAT format, UINT offset, UINT first, UINT count,
 		D3D11_PRIMITIVE_TOPOLOGY topology)
 {
 	FILE *fd = NULL;
 	uint16_t *buf16 = (uint16_t*)map->pData;
 	uint32_t *buf32 = (uint32_t*)map->pData;
-	UINT start, end, i;
+	UINT start, end;
 	errno_t err;
 	int grouping = 1;
 
 	err = wfopen_ensuring_access(&fd, filename, L"w");
 	if (!fd) {
-		FALogErr(L"Unable to create %ls: %u\n", filename, err);
+		FALogWorker(L"Unable to create %ls: %u\n", filename, err);
 		return;
 	}
 
@@ -1536,14 +1630,7 @@ void FrameAnalysisContext::DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 		if (count)
 			end = min(end, start + count);
 
-		for (i = start; i < end; i++) {
-			if ((i-start) % grouping == 0)
-				fprintf(fd, "\n");
-			else
-				fprintf(fd, " ");
-			fprintf(fd, "%u", buf16[i]);
-		}
-		fprintf(fd, "\n");
+		dump_ib_indices(fd, buf16, start, end, grouping);
 		break;
 	case DXGI_FORMAT_R32_UINT:
 		fprintf(fd, "format: DXGI_FORMAT_R32_UINT\n");
@@ -1553,14 +1640,7 @@ void FrameAnalysisContext::DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 		if (count)
 			end = min(end, start + count);
 
-		for (i = start; i < end; i++) {
-			if ((i-start) % grouping == 0)
-				fprintf(fd, "\n");
-			else
-				fprintf(fd, " ");
-			fprintf(fd, "%u", buf32[i]);
-		}
-		fprintf(fd, "\n");
+		dump_ib_indices(fd, buf32, start, end, grouping);
 		break;
 	default:
 		// Illegal format for an index buffer
@@ -1572,7 +1652,7 @@ void FrameAnalysisContext::DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE
 }
 
 template <typename DescType>
-void FrameAnalysisContext::DumpDesc(DescType *desc, const wchar_t *filename)
+static void dump_desc(DescType *desc, const wchar_t *filename)
 {
 	FILE *fd = NULL;
 	char buf[256];
@@ -1582,7 +1662,7 @@ void FrameAnalysisContext::DumpDesc(DescType *desc, const wchar_t *filename)
 
 	err = wfopen_ensuring_access(&fd, filename, L"w");
 	if (!fd) {
-		FALogErr(L"Unable to create %ls: %u\n", filename, err);
+		FALogWorker(L"Unable to create %ls: %u\n", filename, err);
 		return;
 	}
 	fwrite(buf, 1, strlen(buf), fd);
@@ -1769,6 +1849,109 @@ void FrameAnalysisContext::determine_vb_count(UINT *count, ID3D11Buffer *staged_
 	GetDumpingContext()->Unmap(staged_ib_for_vb, 0);
 }
 
+// Writes out a buffer from the copy taken on the render thread. Everything in
+// here is captured when the job is created, since the context's state will
+// have moved on by the time this runs:
+class FrameAnalysisBufferDumpJob : public DumpJob
+{
+public:
+	FrameAnalysisOptions analyse_options;
+	FrameAnalysisOptions buf_type_mask;
+	D3D11_BUFFER_DESC orig_desc;
+	int idx;
+	DXGI_FORMAT ib_fmt;
+	UINT stride, offset, first, count;
+	Microsoft::WRL::ComPtr<ID3DBlob> layout;
+	D3D11_PRIMITIVE_TOPOLOGY topology;
+	DrawCallInfo call_info;
+	bool has_call_info;
+
+	// The traditional filenames and the deduplicated files they link to:
+	wstring bin_filename, bin_dedupe_filename;
+	wstring txt_filename, txt_dedupe_filename;
+	wstring dsc_filename, dsc_dedupe_filename;
+
+	void run() override;
+};
+
+static DumpPipeline dump_pipeline;
+
+// A negative number of threads picks one to suit the CPU, while 0 writes every
+// dump on the render thread:
+void FrameAnalysisConfigureDumps(int threads, int memory_budget_mb)
+{
+	if (threads < 0)
+		threads = DumpPipeline::default_threads();
+
+	dump_pipeline.configure((unsigned)threads, (size_t)max(memory_budget_mb, 1) << 20);
+}
+
+void FrameAnalysisFlushDumps()
+{
+	dump_pipeline.flush();
+}
+
+void FrameAnalysisBufferDumpJob::run()
+{
+	bool symlink = !!(analyse_options & FrameAnalysisOptions::SYMLINK);
+	D3D11_MAPPED_SUBRESOURCE map = {};
+	FILE *fd = NULL;
+	errno_t err;
+
+	map.pData = (void*)data();
+	map.RowPitch = map.DepthPitch = orig_desc.ByteWidth;
+
+	if (!bin_filename.empty()) {
+		DumpFileLock file_lock(&dump_pipeline, bin_dedupe_filename);
+
+		if (GetFileAttributes(bin_dedupe_filename.c_str()) == INVALID_FILE_ATTRIBUTES) {
+			err = wfopen_ensuring_access(&fd, bin_dedupe_filename.c_str(), L"wb");
+			if (!fd) {
+				FALogWorker(L"Unable to create %ls: %u\n", bin_dedupe_filename.c_str(), err);
+				return;
+			}
+			fwrite(data(), 1, orig_desc.ByteWidth, fd);
+			fclose(fd);
+		}
+		link_deduplicated_files(bin_filename.c_str(), bin_dedupe_filename.c_str(), symlink);
+	}
+
+	if (!txt_filename.empty()) {
+		DumpFileLock file_lock(&dump_pipeline, txt_dedupe_filename);
+
+		if (GetFileAttributes(txt_dedupe_filename.c_str()) == INVALID_FILE_ATTRIBUTES) {
+			if (buf_type_mask & FrameAnalysisOptions::DUMP_CB) {
+				dump_buffer_txt(txt_dedupe_filename.c_str(), &map, orig_desc.ByteWidth, 'c', idx, stride, offset);
+			} else if (buf_type_mask & FrameAnalysisOptions::DUMP_VB) {
+				dump_vb_txt(txt_dedupe_filename.c_str(), &map, orig_desc.ByteWidth, idx, stride, offset,
+						first, count, layout.Get(), topology, has_call_info ? &call_info : NULL);
+			} else if (buf_type_mask & FrameAnalysisOptions::DUMP_IB) {
+				dump_ib_txt(txt_dedupe_filename.c_str(), &map, orig_desc.ByteWidth, ib_fmt, offset, first, count, topology);
+			} else {
+				// We don't know what kind of buffer this is, so just
+				// use the generic dump routine:
+				dump_buffer_txt(txt_dedupe_filename.c_str(), &map, orig_desc.ByteWidth, '?', idx, stride, offset);
+			}
+		}
+		link_deduplicated_files(txt_filename.c_str(), txt_dedupe_filename.c_str(), symlink);
+	}
+
+	if (!dsc_filename.empty()) {
+		DumpFileLock file_lock(&dump_pipeline, dsc_dedupe_filename);
+
+		if (GetFileAttributes(dsc_dedupe_filename.c_str()) == INVALID_FILE_ATTRIBUTES)
+			dump_desc(&orig_desc, dsc_dedupe_filename.c_str());
+		link_deduplicated_files(dsc_filename.c_str(), dsc_dedupe_filename.c_str(), symlink);
+	}
+}
+
+// Only the copy out of the staging buffer, hashing it and working out the
+// filenames happen here. The hash is needed for the deduplicated filenames,
+// which we log in order with everything else in this frame. crc32c_hw runs
+// at close to memory bandwidth on the copy while it is still in the cache, so
+// it is not worth moving to the workers. The rest of the work (checking for
+// existing files, encoding the text, writing and linking) is queued up on the
+// dump workers.
 void FrameAnalysisContext::DumpBufferImmediateCtx(ID3D11Buffer *staging, D3D11_BUFFER_DESC *orig_desc,
 		wstring filename, FrameAnalysisOptions buf_type_mask, int idx,
 		DXGI_FORMAT ib_fmt, UINT stride, UINT offset, UINT first, UINT count, ID3DBlob *layout,
@@ -1776,12 +1959,11 @@ void FrameAnalysisContext::DumpBufferImmediateCtx(ID3D11Buffer *staging, D3D11_B
 		ID3D11Buffer *staged_ib_for_vb, UINT ib_off_for_vb)
 {
 	wchar_t bin_filename[MAX_PATH], txt_filename[MAX_PATH];
-	D3D11_MAPPED_SUBRESOURCE map;
+	D3D11_MAPPED_SUBRESOURCE map, copy;
+	FrameAnalysisBufferDumpJob *job;
 	HRESULT hr;
-	FILE *fd = NULL;
 	wchar_t *bin_ext;
 	size_t ext;
-	errno_t err;
 
 	hr = GetDumpingContext()->Map(staging, 0, D3D11_MAP_READ, 0, &map);
 	if (FAILED(hr)) {
@@ -1789,30 +1971,53 @@ void FrameAnalysisContext::DumpBufferImmediateCtx(ID3D11Buffer *staging, D3D11_B
 		return;
 	}
 
-	dedupe_buf_filename(staging, orig_desc, &map, bin_filename, MAX_PATH);
+	job = new FrameAnalysisBufferDumpJob();
+
+	// May block here if the workers have fallen too far behind:
+	copy = map;
+	copy.pData = dump_pipeline.alloc(job, orig_desc->ByteWidth);
+	if (copy.pData)
+		memcpy(copy.pData, map.pData, orig_desc->ByteWidth);
+
+	GetDumpingContext()->Unmap(staging, 0);
+
+	if (!copy.pData) {
+		FALogErr(L"DumpBuffer failed to allocate %u bytes\n", orig_desc->ByteWidth);
+		dump_pipeline.cancel(job);
+		return;
+	}
+
+	dedupe_buf_filename(staging, orig_desc, &copy, bin_filename, MAX_PATH);
 
 	ext = filename.find_last_of(L'.');
 	bin_ext = wcsrchr(bin_filename, L'.');
 	if (ext == wstring::npos || !bin_ext) {
 		FALogErr(L"DumpBuffer: Filename missing extension\n");
-		goto out_unmap;
+		dump_pipeline.cancel(job);
+		return;
 	}
 
+	job->analyse_options = analyse_options;
+	job->buf_type_mask = buf_type_mask;
+	job->orig_desc = *orig_desc;
+	job->idx = idx;
+	job->ib_fmt = ib_fmt;
+	job->stride = stride;
+	job->offset = offset;
+	job->first = first;
+	job->layout = layout;
+	job->topology = topology;
+	job->has_call_info = !!call_info;
+	if (call_info)
+		job->call_info = *call_info;
+
 	if (analyse_options & FrameAnalysisOptions::FMT_BUF_BIN) {
 		filename.replace(ext, wstring::npos, L".buf");
 		wcscpy_s(bin_ext, MAX_PATH + bin_filename - bin_ext, L".buf");
 		FALogInfo(L"Dumping Buffer %ls -> %ls\n", filename.c_str(), bin_filename);
 
-		if (GetFileAttributes(bin_filename) == INVALID_FILE_ATTRIBUTES) {
-			err = wfopen_ensuring_access(&fd, bin_filename, L"wb");
-			if (!fd) {
-				FALogErr(L"Unable to create %ls: %u\n", bin_filename, err);
-				goto out_unmap;
-			}
-			fwrite(map.pData, 1, orig_desc->ByteWidth, fd);
-			fclose(fd);
-		}
-		link_deduplicated_files(filename.c_str(), bin_filename);
+		job->bin_filename = filename;
+		job->bin_dedupe_filename = bin_filename;
 	}
 
 	if (analyse_options & FrameAnalysisOptions::FMT_BUF_TXT) {
@@ -1820,34 +2025,18 @@ void FrameAnalysisContext::DumpBufferImmediateCtx(ID3D11Buffer *staging, D3D11_B
 
 		if (buf_type_mask & FrameAnalysisOptions::DUMP_CB) {
 			dedupe_buf_filename_txt(bin_filename, txt_filename, MAX_PATH, 'c', idx, stride, offset);
-			FALogInfo(L"Dumping Buffer %ls -> %ls\n", filename.c_str(), txt_filename);
-			if (GetFileAttributes(txt_filename) == INVALID_FILE_ATTRIBUTES) {
-				DumpBufferTxt(txt_filename, &map, orig_desc->ByteWidth, 'c', idx, stride, offset);
-			}
 		} else if (buf_type_mask & FrameAnalysisOptions::DUMP_VB) {
 			determine_vb_count(&count, staged_ib_for_vb, call_info, ib_off_for_vb, ib_fmt);
 			dedupe_buf_filename_vb_txt(bin_filename, txt_filename, MAX_PATH, idx, stride, offset, first, count, layout, topology, call_info);
-			FALogInfo(L"Dumping Buffer %ls -> %ls\n", filename.c_str(), txt_filename);
-			if (GetFileAttributes(txt_filename) == INVALID_FILE_ATTRIBUTES) {
-				DumpVBTxt(txt_filename, &map, orig_desc->ByteWidth, idx, stride, offset, first, count, layout, topology, call_info);
-			}
 		} else if (buf_type_mask & FrameAnalysisOptions::DUMP_IB) {
 			dedupe_buf_filename_ib_txt(bin_filename, txt_filename, MAX_PATH, ib_fmt, offset, first, count, topology);
-			FALogInfo(L"Dumping Buffer %ls -> %ls\n", filename.c_str(), txt_filename);
-			if (GetFileAttributes(txt_filename) == INVALID_FILE_ATTRIBUTES) {
-				DumpIBTxt(txt_filename, &map, orig_desc->ByteWidth, ib_fmt, offset, first, count, topology);
-			}
 		} else {
-			// We don't know what kind of buffer this is, so just
-			// use the generic dump routine:
-
 			dedupe_buf_filename_txt(bin_filename, txt_filename, MAX_PATH, '?', idx, stride, offset);
-			FALogInfo(L"Dumping Buffer %ls -> %ls\n", filename.c_str(), txt_filename);
-			if (GetFileAttributes(txt_filename) == INVALID_FILE_ATTRIBUTES) {
-				DumpBufferTxt(txt_filename, &map, orig_desc->ByteWidth, '?', idx, stride, offset);
-			}
 		}
-		link_deduplicated_files(filename.c_str(), txt_filename);
+		FALogInfo(L"Dumping Buffer %ls -> %ls\n", filename.c_str(), txt_filename);
+
+		job->txt_filename = filename;
+		job->txt_dedupe_filename = txt_filename;
 	}
 	// TODO: Dump UAV, RT and SRV buffers as text taking their format,
 	// offset, size, first entry and num entries into account.
@@ -1857,13 +2046,14 @@ void FrameAnalysisContext::DumpBufferImmediateCtx(ID3D11Buffer *staging, D3D11_B
 		wcscpy_s(bin_ext, MAX_PATH + bin_filename - bin_ext, L".dsc");
 		FALogInfo(L"Dumping Buffer %ls -> %ls\n", filename.c_str(), bin_filename);
 
-		if (GetFileAttributes(bin_filename) == INVALID_FILE_ATTRIBUTES)
-			DumpDesc(orig_desc, bin_filename);
-		link_deduplicated_files(filename.c_str(), bin_filename);
+		job->dsc_filename = filename;
+		job->dsc_dedupe_filename = bin_filename;
 	}
 
-out_unmap:
-	GetDumpingContext()->Unmap(staging, 0);
+	// determine_vb_count() may have updated the count:
+	job->count = count;
+
+	dump_pipeline.submit(job);
 }
 
 void FrameAnalysisContext::DumpBuffer(ID3D11Buffer *buffer, wchar_t *filename,
@@ -2038,6 +2228,7 @@ HRESULT FrameAnalysisContext::FrameAnalysisFilename(wchar_t *filename, size_t si
 	LeaveCriticalSection(&G->mResourcesLock);
 
 	if (hash) {
+		MergeResourceHashContamination();
 		try {
 			info = &G->mResourceInfo.at(orig_hash);
 			if (info->hash_contaminated) {
@@ -2120,6 +2311,7 @@ HRESULT FrameAnalysisContext::FrameAnalysisFilenameResource(wchar_t *filename, s
 	LeaveCriticalSection(&G->mResourcesLock);
 
 	if (hash) {
+		MergeResourceHashContamination();
 		try {
 			info = &G->mResourceInfo.at(orig_hash);
 			if (info->hash_contaminated) {
@@ -2247,7 +2439,7 @@ void FrameAnalysisContext::dedupe_buf_filename(ID3D11Buffer *resource,
 	_snwprintf_s(dedupe_filename, size, size, L"%ls\\%08x.XXX", dedupe_dir, hash);
 }
 
-void FrameAnalysisContext::rotate_deduped_file(const wchar_t *dedupe_filename)
+static void rotate_deduped_file(const wchar_t *dedupe_filename)
 {
 	wchar_t rotated_filename[MAX_PATH];
 	unsigned rotate;
@@ -2276,7 +2468,7 @@ void FrameAnalysisContext::rotate_deduped_file(const wchar_t *dedupe_filename)
 			// xxxxxxx.1.xxx - max 1023 hard links
 			// xxxxxxx.2.xxx - max 1023 hard links
 			// etc.
-			FALogInfo(L"Max hard links exceeded, rotating deduped file: %ls\n", rotated_filename);
+			FALogWorker(L"Max hard links exceeded, rotating deduped file: %ls\n", rotated_filename);
 			MoveFile(dedupe_filename, rotated_filename);
 			CopyFile(rotated_filename, dedupe_filename, TRUE);
 			return;
@@ -2284,7 +2476,7 @@ void FrameAnalysisContext::rotate_deduped_file(const wchar_t *dedupe_filename)
 	}
 }
 
-void FrameAnalysisContext::rotate_when_nearing_hard_link_limit(const wchar_t *dedupe_filename)
+static void rotate_when_nearing_hard_link_limit(const wchar_t *dedupe_filename)
 {
 	HANDLE f;
 	BY_HANDLE_FILE_INFORMATION info;
@@ -2340,7 +2532,7 @@ static bool create_shortcut(const wchar_t *filename, const wchar_t *dedupe_filen
 	return SUCCEEDED(hr);
 }
 
-void FrameAnalysisContext::link_deduplicated_files(const wchar_t *filename, const wchar_t *dedupe_filename)
+static void link_deduplicated_files(const wchar_t *filename, const wchar_t *dedupe_filename, bool symlink)
 {
 	wchar_t relative_path[MAX_PATH] = {0};
 
@@ -2352,14 +2544,14 @@ void FrameAnalysisContext::link_deduplicated_files(const wchar_t *filename, cons
 	if (GetFileAttributes(filename) != INVALID_FILE_ATTRIBUTES)
 		return;
 
-	if (analyse_options & FrameAnalysisOptions::SYMLINK) {
+	if (symlink) {
 		if (PathRelativePathTo(relative_path, filename, 0, dedupe_filename, 0)) {
 			if (CreateSymbolicLink(filename, relative_path, SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE))
 				return;
 		}
 
 		// May fail if developer mode is not enabled on Windows 10:
-		FALogErr(L"Symlinking %ls -> %ls failed (0x%u), trying hard link\n",
+		FALogWorker(L"Symlinking %ls -> %ls failed (0x%u), trying hard link\n",
 				filename, relative_path, GetLastError());
 	}
 
@@ -2385,7 +2577,7 @@ void FrameAnalysisContext::link_deduplicated_files(const wchar_t *filename, cons
 	if (MoveFile(dedupe_filename, filename))
 		return;
 
-	FALogErr(L"All attempts to link deduplicated file failed, giving up: %ls -> %ls\n",
+	FALogWorker(L"All attempts to link deduplicated file failed, giving up: %ls -> %ls\n",
 			filename, dedupe_filename);
 }
 
@@ -2,6 +2,7 @@
 
 #include <d3d11_1.h>
 #include "HackerContext.h"
+#include "BinaryLog.h"
 
 // {2AEE5B3A-68ED-44E9-AA4D-9EAA6315D72B}
 DEFINE_GUID(IID_FrameAnalysisContext,
@@ -89,6 +90,10 @@ typedef std::unique_ptr<FrameAnalysisDeferredTex2D> FrameAnalysisDeferredTex2DPt
 class FrameAnalysisContext : public HackerContext
 {
 private:
+	bool FrameAnalysisLogOpen();
+	uint8_t FrameAnalysisLogPrefix();
+	void FrameAnalysisLogAppend(char *fmt, ...);
+	void FrameAnalysisLogSlot(int slot, char *slot_name);
 	template <class ID3D11Shader>
 	void FrameAnalysisLogShaderHash(ID3D11Shader *shader);
 	void FrameAnalysisLogResourceHash(ID3D11Resource *resource);
@@ -100,6 +105,7 @@ private:
 	void FrameAnalysisLogAsyncQuery(ID3D11Asynchronous *async);
 	void FrameAnalysisLogData(void *buf, UINT size);
 	FILE *frame_analysis_log;
+	BinaryLog::Writer frame_analysis_binlog;
 	unsigned draw_call;
 	unsigned non_draw_call_dump_counter;
 
@@ -123,15 +129,6 @@ private:
 		D3D11_TEXTURE2D_DESC desc, bool stereo, bool msaa, DXGI_FORMAT format);
 
 	void DumpStereoResource(ID3D11Texture2D *resource, wchar_t *filename, DXGI_FORMAT format);
-	void DumpBufferTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
-			UINT size, char type, int idx, UINT stride, UINT offset);
-	void DumpVBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
-			UINT size, int idx, UINT stride, UINT offset,
-			UINT first, UINT count, ID3DBlob *layout,
-			D3D11_PRIMITIVE_TOPOLOGY topology, DrawCallInfo *call_info);
-	void DumpIBTxt(wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map,
-			UINT size, DXGI_FORMAT ib_fmt, UINT offset,
-			UINT first, UINT count, D3D11_PRIMITIVE_TOPOLOGY topology);
 
 	void DumpBuffer(ID3D11Buffer *buffer, wchar_t *filename,
 			FrameAnalysisOptions buf_type_mask, int idx, DXGI_FORMAT ib_fmt,
@@ -166,8 +163,6 @@ private:
 	void DumpRenderTargets();
 	void DumpDepthStencilTargets();
 	void DumpUAVs(bool compute);
-	template <typename DescType>
-	void DumpDesc(DescType *desc, const wchar_t *filename);
 
 	void dump_deferred_resources(ID3D11CommandList *command_list);
 	void finish_deferred_resources(ID3D11CommandList *command_list);
@@ -193,9 +188,6 @@ private:
 	void dedupe_buf_filename_ib_txt(const wchar_t *bin_filename,
 			wchar_t *txt_filename, size_t size, DXGI_FORMAT ib_fmt,
 			UINT offset, UINT first, UINT count, D3D11_PRIMITIVE_TOPOLOGY topology);
-	void link_deduplicated_files(const wchar_t *filename, const wchar_t *dedupe_filename);
-	void rotate_when_nearing_hard_link_limit(const wchar_t *dedupe_filename);
-	void rotate_deduped_file(const wchar_t *dedupe_filename);
 	void get_deduped_dir(wchar_t *path, size_t size);
 
 	void determine_vb_count(UINT *count, ID3D11Buffer *staged_ib_for_vb,
@@ -1288,3 +1280,8 @@ public:
 		_In_reads_opt_(NumRects)  const D3D11_RECT *pRects,
 		UINT NumRects);
 };
+
+// Waits for any buffers still being written out by the dump workers. Called
+// at the end of a frame analysis before reporting it has been saved:
+void FrameAnalysisConfigureDumps(int threads, int memory_budget_mb);
+void FrameAnalysisFlushDumps();
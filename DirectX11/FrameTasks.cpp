@@ -0,0 +1,119 @@
+#include "FrameTasks.h"
+
+#include <algorithm>
+
+FrameTaskScheduler::FrameTaskScheduler(FrameTaskClock clock) :
+	clock(clock),
+	frame(0),
+	last_frame_time(0),
+	frame_time_us(0),
+	budget_percent(5),
+	min_budget_us(100),
+	max_budget_us(2000)
+{}
+
+size_t FrameTaskScheduler::add(const char *name, std::function<void()> fn, unsigned max_delay_frames)
+{
+	Task task;
+
+	task.name = name;
+	task.fn = fn;
+	task.max_delay_frames = max_delay_frames;
+	task.requested = false;
+	task.requested_frame = 0;
+	task.average_us = 0;
+	task.measured = false;
+	task.runs = task.deferrals = task.forced = 0;
+	tasks.push_back(task);
+
+	return tasks.size() - 1;
+}
+
+void FrameTaskScheduler::request(size_t task)
+{
+	if (task >= tasks.size() || tasks[task].requested)
+		return;
+
+	tasks[task].requested = true;
+	tasks[task].requested_frame = frame;
+}
+
+void FrameTaskScheduler::set_budget(unsigned percent, uint64_t min_us, uint64_t max_us)
+{
+	budget_percent = percent;
+	min_budget_us = min_us;
+	max_budget_us = std::max(min_us, max_us);
+}
+
+uint64_t FrameTaskScheduler::budget_us() const
+{
+	return std::min(std::max(frame_time_us * budget_percent / 100, min_budget_us), max_budget_us);
+}
+
+void FrameTaskScheduler::run_frame()
+{
+	uint64_t start, now, elapsed, budget, took;
+	bool overdue, over_budget = false;
+	Task *task;
+
+	start = clock();
+
+	// Smoothed over the last few frames so that one long frame (e.g. a
+	// config reload) doesn't hand the next frame a huge budget:
+	if (frame && start > last_frame_time) {
+		if (frame_time_us)
+			frame_time_us = (frame_time_us * 7 + (start - last_frame_time)) / 8;
+		else
+			frame_time_us = start - last_frame_time;
+	}
+	last_frame_time = start;
+	budget = budget_us();
+
+	// Oldest request first, then in the order the tasks were added:
+	order.clear();
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if (tasks[i].requested)
+			order.push_back(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [this](size_t x, size_t y) {
+		return tasks[x].requested_frame < tasks[y].requested_frame;
+	});
+
+	for (size_t i : order) {
+		task = &tasks[i];
+		overdue = frame - task->requested_frame >= task->max_delay_frames;
+
+		// Once one task doesn't fit, the rest wait as well rather than
+		// letting cheaper tasks keep jumping ahead of it, unless they
+		// are overdue:
+		now = clock();
+		elapsed = now - start;
+		if (!overdue && (over_budget || (task->measured && elapsed + task->average_us > budget))) {
+			over_budget = true;
+			task->deferrals++;
+			continue;
+		}
+
+		if (overdue && (over_budget || elapsed + task->average_us > budget))
+			task->forced++;
+
+		task->requested = false;
+		task->fn();
+
+		took = clock() - now;
+		if (task->measured)
+			task->average_us = (task->average_us * 3 + took) / 4;
+		else
+			task->average_us = took;
+		task->measured = true;
+		task->runs++;
+	}
+
+	frame++;
+}
+
+void FrameTaskScheduler::stats(std::vector<FrameTaskStats> *stats) const
+{
+	for (const Task &task : tasks)
+		stats->push_back({task.name, task.runs, task.deferrals, task.forced, task.average_us});
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+// Scheduling of the housekeeping done on the present call.
+//
+// RunFrameActions used to do all of its work inline on every present, so a
+// frame that happened to flush the log, apply a large batch of hash
+// contamination, evict resources from the pools and autosave the user config
+// all at once took all of that time out of that one frame.
+//
+// The work that has to happen on a particular frame (the present command
+// list, input, transitions, config reloads, the overlay, etc) is still done
+// inline in the same order as before. The rest is added here as deferrable
+// tasks that RunFrameActions merely requests. Each frame the requested tasks
+// are run oldest request first for as long as they fit in a time budget, and
+// whatever doesn't fit waits for a later frame. A task that has been put off
+// for its maximum number of frames runs regardless, so nothing starves behind
+// a task that never fits. Requesting a task that is already waiting does not
+// reset how long it has waited.
+//
+// Whether a task fits is judged by a running average of how long it took the
+// last few times. The budget is a fraction of the measured time between
+// frames, clamped to a range, so a game running at a low frame rate gives the
+// housekeeping a little more room and a high frame rate a little less.
+//
+// This has no Windows dependencies and the clock is passed in, so the budget
+// and fairness can be tested with a fake clock on any platform.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+// Returns the current time in microseconds:
+typedef uint64_t (*FrameTaskClock)();
+
+struct FrameTaskStats
+{
+	const char *name;
+	uint64_t runs;
+	uint64_t deferrals;     // Frames it was requested but did not fit
+	uint64_t forced;        // Runs that went over the budget because it was overdue
+	uint64_t average_us;
+};
+
+class FrameTaskScheduler
+{
+	struct Task
+	{
+		const char *name;
+		std::function<void()> fn;
+		unsigned max_delay_frames;
+
+		bool requested;
+		uint64_t requested_frame;
+		uint64_t average_us;
+		bool measured;
+
+		uint64_t runs;
+		uint64_t deferrals;
+		uint64_t forced;
+	};
+
+	FrameTaskClock clock;
+	std::vector<Task> tasks;
+	std::vector<size_t> order;
+
+	uint64_t frame;
+	uint64_t last_frame_time;
+	uint64_t frame_time_us;
+
+	unsigned budget_percent;
+	uint64_t min_budget_us;
+	uint64_t max_budget_us;
+
+public:
+	FrameTaskScheduler(FrameTaskClock clock);
+
+	// Adds a task, which can be put off for up to max_delay_frames frames
+	// after it was requested. Returns an ID for request():
+	size_t add(const char *name, std::function<void()> fn, unsigned max_delay_frames);
+
+	// Asks for the task to be run at the next opportunity:
+	void request(size_t task);
+
+	// Called once per frame. Measures the time since the last frame and
+	// runs as many of the requested tasks as the budget allows:
+	void run_frame();
+
+	// The budget is percent of the time between frames, but no less than
+	// min_us and no more than max_us:
+	void set_budget(unsigned percent, uint64_t min_us, uint64_t max_us);
+
+	uint64_t budget_us() const;
+
+	void stats(std::vector<FrameTaskStats> *stats) const;
+};
@@ -0,0 +1,63 @@
+#include "GlobMatcher.h"
+
+GlobMatcher::GlobMatcher(bool jit) :
+	match_data(NULL),
+	jit(jit)
+{}
+
+GlobMatcher::~GlobMatcher()
+{
+	size_t i;
+
+	for (i = 0; i < regexes.size(); i++)
+		pcre2_code_free(regexes[i]);
+	pcre2_match_data_free(match_data);
+}
+
+GlobError GlobMatcher::add(const std::string &glob)
+{
+	PCRE2_UCHAR *converted = NULL;
+	PCRE2_SIZE blength = 0;
+	PCRE2_SIZE err_off;
+	pcre2_code *regex;
+	int err;
+
+	if (pcre2_pattern_convert((PCRE2_SPTR)glob.c_str(), glob.length(),
+				PCRE2_CONVERT_GLOB, &converted, &blength, NULL))
+		return GlobError::BAD_PATTERN;
+
+	regex = pcre2_compile(converted, blength, PCRE2_CASELESS, &err, &err_off, NULL);
+	pcre2_converted_pattern_free(converted);
+	if (!regex)
+		return GlobError::COMPILE_FAILED;
+
+	// Falls back to the interpreter if JIT is not supported:
+	if (jit)
+		pcre2_jit_compile(regex, PCRE2_JIT_COMPLETE);
+
+	// We only care whether or not it matched, not where, so the match
+	// data doesn't need room for any more than the whole match for any
+	// of the regexes:
+	if (!match_data)
+		match_data = pcre2_match_data_create(1, NULL);
+
+	regexes.push_back(regex);
+	return GlobError::NONE;
+}
+
+bool GlobMatcher::match(const char *filename, size_t len)
+{
+	size_t i;
+
+	if (!match_data)
+		return false;
+
+	// A return of 0 would mean the match data was too small to hold the
+	// captured substrings, which is still a match:
+	for (i = 0; i < regexes.size(); i++) {
+		if (pcre2_match(regexes[i], (PCRE2_SPTR)filename, len, 0, 0, match_data, NULL) >= 0)
+			return true;
+	}
+
+	return false;
+}
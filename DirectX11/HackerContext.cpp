@@ -24,6 +24,7 @@
 #include "ShaderRegex.h"
 #include "FrameAnalysis.h"
 #include "profiling.h"
+#include "tracing.h"
 
 // -----------------------------------------------------------------------------------------------
 
@@ -63,7 +64,8 @@ HackerContext* HackerContextFactory(ID3D11Device1 *pDevice1, ID3D11DeviceContext
 	return new HackerContext(pDevice1, pContext1);
 }
 
-HackerContext::HackerContext(ID3D11Device1 *pDevice1, ID3D11DeviceContext1 *pContext1)
+HackerContext::HackerContext(ID3D11Device1 *pDevice1, ID3D11DeviceContext1 *pContext1) :
+	mShaderUsage(&G->mShaderUsageInbox)
 {
 	mOrigDevice1 = pDevice1;
 	mOrigContext1 = pContext1;
@@ -84,6 +86,15 @@ HackerContext::HackerContext(ID3D11Device1 *pDevice1, ID3D11DeviceContext1 *pCon
 	mCurrentDomainShaderHandle = NULL;
 	mCurrentHullShader = 0;
 	mCurrentHullShaderHandle = NULL;
+	mCurrentVertexShaderOverride = NULL;
+	mCurrentHullShaderOverride = NULL;
+	mCurrentDomainShaderOverride = NULL;
+	mCurrentGeometryShaderOverride = NULL;
+	mCurrentPixelShaderOverride = NULL;
+	mCurrentComputeShaderOverride = NULL;
+	mShaderOverrideGeneration = G->shader_override_generation;
+	mBatchIniParamsFlush = false;
+	mIniParamsChanged = false;
 	mCurrentDepthTarget = NULL;
 	mCurrentPSUAVStartSlot = 0;
 	mCurrentPSNumUAVs = 0;
@@ -136,37 +147,6 @@ void HackerContext::HookContext()
 // -----------------------------------------------------------------------------
 
 
-// Records the hash of this shader resource view for later lookup. Returns the
-// handle to the resource, but be aware that it no longer has a reference and
-// should only be used for map lookups.
-ID3D11Resource* HackerContext::RecordResourceViewStats(ID3D11View *view, std::set<uint32_t> *resource_info)
-{
-	ID3D11Resource *resource = NULL;
-	uint32_t orig_hash = 0;
-
-	if (!view)
-		return NULL;
-
-	view->GetResource(&resource);
-	if (!resource)
-		return NULL;
-
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-
-		// We are using the original resource hash for stat collection - things
-		// get tricky otherwise
-		orig_hash = GetOrigResourceHash(resource);
-
-		resource->Release();
-
-		if (orig_hash)
-			resource_info->insert(orig_hash);
-
-	LeaveCriticalSection(&G->mCriticalSection);
-
-	return resource;
-}
-
 static ResourceSnapshot SnapshotResource(ID3D11Resource *handle)
 {
 	uint32_t hash = 0, orig_hash = 0;
@@ -180,37 +160,48 @@ static ResourceSnapshot SnapshotResource(ID3D11Resource *handle)
 	return ResourceSnapshot(handle, hash, orig_hash);
 }
 
-void HackerContext::_RecordShaderResourceUsage(ShaderInfoData *shader_info, ID3D11ShaderResourceView *views[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT])
+// Records a snapshot of the resource handle and hash for ShaderUsage.txt. The
+// handle no longer has a reference and is only used as an identifier.
+void HackerContext::RecordResourceUsage(ShaderUsageStage stage, UINT64 shader,
+		ShaderUsageKind kind, int slot, ID3D11Resource *resource)
 {
-	ID3D11Resource *resource;
-	int i;
+	ResourceSnapshot snapshot = SnapshotResource(resource);
 
-	for (i = 0; i < D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT; i++) {
-		if (views[i]) {
-			resource = RecordResourceViewStats(views[i], &G->mShaderResourceInfo);
-			if (resource)
-				shader_info->ResourceRegisters[i].insert(SnapshotResource(resource));
-			views[i]->Release();
-		}
-	}
+	mShaderUsage.record(ShaderUsageRecord(stage, kind, shader, slot,
+			(uintptr_t)snapshot.handle, snapshot.hash, snapshot.orig_hash));
 }
 
-void HackerContext::RecordPeerShaders(std::set<UINT64> *PeerShaders, UINT64 this_shader_hash)
+void HackerContext::RecordViewUsage(ShaderUsageStage stage, UINT64 shader,
+		ShaderUsageKind kind, int slot, ID3D11View *view)
 {
-	if (mCurrentVertexShader && mCurrentVertexShader != this_shader_hash)
-		PeerShaders->insert(mCurrentVertexShader);
+	ID3D11Resource *resource = NULL;
 
-	if (mCurrentHullShader && mCurrentHullShader != this_shader_hash)
-		PeerShaders->insert(mCurrentHullShader);
+	view->GetResource(&resource);
+	if (!resource)
+		return;
 
-	if (mCurrentDomainShader && mCurrentDomainShader != this_shader_hash)
-		PeerShaders->insert(mCurrentDomainShader);
+	RecordResourceUsage(stage, shader, kind, slot, resource);
 
-	if (mCurrentGeometryShader && mCurrentGeometryShader != this_shader_hash)
-		PeerShaders->insert(mCurrentGeometryShader);
+	resource->Release();
+}
 
-	if (mCurrentPixelShader && mCurrentPixelShader != this_shader_hash)
-		PeerShaders->insert(mCurrentPixelShader);
+void HackerContext::RecordPeerShaders(ShaderUsageStage stage, UINT64 this_shader_hash)
+{
+	UINT64 peers[] = {
+		mCurrentVertexShader,
+		mCurrentHullShader,
+		mCurrentDomainShader,
+		mCurrentGeometryShader,
+		mCurrentPixelShader,
+	};
+	int i;
+
+	for (i = 0; i < ARRAYSIZE(peers); i++) {
+		if (peers[i] && peers[i] != this_shader_hash) {
+			mShaderUsage.record(ShaderUsageRecord(stage, ShaderUsageKind::PEER,
+					this_shader_hash, -1, peers[i], 0, 0));
+		}
+	}
 }
 
 
@@ -218,28 +209,34 @@ template <void (__stdcall ID3D11DeviceContext::*GetShaderResources)(THIS_
 		UINT StartSlot,
 		UINT NumViews,
 		ID3D11ShaderResourceView **ppShaderResourceViews)>
-void HackerContext::RecordShaderResourceUsage(std::map<UINT64, ShaderInfoData> &ShaderInfo, UINT64 currentShader)
+void HackerContext::RecordShaderResourceUsage(ShaderUsageStage stage, UINT64 currentShader)
 {
 	ID3D11ShaderResourceView *views[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
-	ShaderInfoData *info;
+	int i;
 
 	(mOrigContext1->*GetShaderResources)(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, views);
 
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	mShaderUsage.record(ShaderUsageRecord(stage, ShaderUsageKind::SHADER,
+			currentShader, -1, 0, 0, 0));
 
-		info = &ShaderInfo[currentShader];
-		_RecordShaderResourceUsage(info, views);
-		RecordPeerShaders(&info->PeerShaders, currentShader);
+	for (i = 0; i < D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT; i++) {
+		if (views[i]) {
+			RecordViewUsage(stage, currentShader, ShaderUsageKind::REGISTER, i, views[i]);
+			views[i]->Release();
+		}
+	}
 
-	LeaveCriticalSection(&G->mCriticalSection);
+	if (stage != ShaderUsageStage::CS)
+		RecordPeerShaders(stage, currentShader);
 }
 
+// Statistics are recorded in this context's ShaderUsageRecorder without
+// taking the critical section, and merged into the ShaderInfoData maps by
+// MergeShaderUsage() at the end of the frame or when writing ShaderUsage.txt
 void HackerContext::RecordGraphicsShaderStats()
 {
 	ID3D11UnorderedAccessView *uavs[D3D11_1_UAV_SLOT_COUNT]; // DX11: 8, DX11.1: 64
 	UINT selectedRenderTargetPos;
-	ShaderInfoData *info;
-	ID3D11Resource *resource;
 	UINT i;
 	Profiling::State profiling_state;
 
@@ -248,22 +245,22 @@ void HackerContext::RecordGraphicsShaderStats()
 
 	if (mCurrentVertexShader) {
 		RecordShaderResourceUsage<&ID3D11DeviceContext::VSGetShaderResources>
-			(G->mVertexShaderInfo, mCurrentVertexShader);
+			(ShaderUsageStage::VS, mCurrentVertexShader);
 	}
 
 	if (mCurrentHullShader) {
 		RecordShaderResourceUsage<&ID3D11DeviceContext::HSGetShaderResources>
-			(G->mHullShaderInfo, mCurrentHullShader);
+			(ShaderUsageStage::HS, mCurrentHullShader);
 	}
 
 	if (mCurrentDomainShader) {
 		RecordShaderResourceUsage<&ID3D11DeviceContext::DSGetShaderResources>
-			(G->mDomainShaderInfo, mCurrentDomainShader);
+			(ShaderUsageStage::DS, mCurrentDomainShader);
 	}
 
 	if (mCurrentGeometryShader) {
 		RecordShaderResourceUsage<&ID3D11DeviceContext::GSGetShaderResources>
-			(G->mGeometryShaderInfo, mCurrentGeometryShader);
+			(ShaderUsageStage::GS, mCurrentGeometryShader);
 	}
 
 	if (mCurrentPixelShader) {
@@ -272,33 +269,28 @@ void HackerContext::RecordGraphicsShaderStats()
 		OMGetRenderTargetsAndUnorderedAccessViews(0, NULL, NULL, mCurrentPSUAVStartSlot, mCurrentPSNumUAVs, uavs);
 
 		RecordShaderResourceUsage<&ID3D11DeviceContext::PSGetShaderResources>
-			(G->mPixelShaderInfo, mCurrentPixelShader);
+			(ShaderUsageStage::PS, mCurrentPixelShader);
 
-		EnterCriticalSectionPretty(&G->mCriticalSection);
-			info = &G->mPixelShaderInfo[mCurrentPixelShader];
-
-			for (selectedRenderTargetPos = 0; selectedRenderTargetPos < mCurrentRenderTargets.size(); ++selectedRenderTargetPos) {
-				if (selectedRenderTargetPos >= info->RenderTargets.size())
-					info->RenderTargets.push_back(std::set<ResourceSnapshot>());
-
-				info->RenderTargets[selectedRenderTargetPos].insert(SnapshotResource(mCurrentRenderTargets[selectedRenderTargetPos]));
-			}
-
-			if (mCurrentDepthTarget)
-				info->DepthTargets.insert(SnapshotResource(mCurrentDepthTarget));
+		for (selectedRenderTargetPos = 0; selectedRenderTargetPos < mCurrentRenderTargets.size(); ++selectedRenderTargetPos) {
+			RecordResourceUsage(ShaderUsageStage::PS, mCurrentPixelShader,
+					ShaderUsageKind::RENDER_TARGET, selectedRenderTargetPos,
+					mCurrentRenderTargets[selectedRenderTargetPos]);
+		}
 
-			if (mCurrentPSNumUAVs) {
-				for (i = 0; i < mCurrentPSNumUAVs; i++) {
-					if (uavs[i]) {
-						resource = RecordResourceViewStats(uavs[i], &G->mUnorderedAccessInfo);
-						if (resource)
-							info->UAVs[i + mCurrentPSUAVStartSlot].insert(SnapshotResource(resource));
+		if (mCurrentDepthTarget) {
+			RecordResourceUsage(ShaderUsageStage::PS, mCurrentPixelShader,
+					ShaderUsageKind::DEPTH_TARGET, -1, mCurrentDepthTarget);
+		}
 
-						uavs[i]->Release();
-					}
+		if (mCurrentPSNumUAVs) {
+			for (i = 0; i < mCurrentPSNumUAVs; i++) {
+				if (uavs[i]) {
+					RecordViewUsage(ShaderUsageStage::PS, mCurrentPixelShader,
+							ShaderUsageKind::UAV, i + mCurrentPSUAVStartSlot, uavs[i]);
+					uavs[i]->Release();
 				}
 			}
-		LeaveCriticalSection(&G->mCriticalSection);
+		}
 	}
 
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
@@ -307,40 +299,35 @@ void HackerContext::RecordGraphicsShaderStats()
 
 void HackerContext::RecordComputeShaderStats()
 {
-	ID3D11ShaderResourceView *srvs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
 	ID3D11UnorderedAccessView *uavs[D3D11_1_UAV_SLOT_COUNT]; // DX11: 8, DX11.1: 64
-	ShaderInfoData *info;
 	D3D_FEATURE_LEVEL level = mOrigDevice1->GetFeatureLevel();
 	UINT num_uavs = (level >= D3D_FEATURE_LEVEL_11_1 ? D3D11_1_UAV_SLOT_COUNT : D3D11_PS_CS_UAV_REGISTER_COUNT);
-	ID3D11Resource *resource;
 	UINT i;
 	Profiling::State profiling_state;
 
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
 		Profiling::start(&profiling_state);
 
-	mOrigContext1->CSGetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, srvs);
-	mOrigContext1->CSGetUnorderedAccessViews(0, num_uavs, uavs);
-
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-
-		info = &G->mComputeShaderInfo[mCurrentComputeShader];
-		_RecordShaderResourceUsage(info, srvs);
+	RecordShaderResourceUsage<&ID3D11DeviceContext::CSGetShaderResources>
+		(ShaderUsageStage::CS, mCurrentComputeShader);
 
-		for (i = 0; i < num_uavs; i++) {
-			if (uavs[i]) {
-				resource = RecordResourceViewStats(uavs[i], &G->mUnorderedAccessInfo);
-				if (resource)
-					info->UAVs[i].insert(SnapshotResource(resource));
+	mOrigContext1->CSGetUnorderedAccessViews(0, num_uavs, uavs);
 
-				uavs[i]->Release();
-			}
+	for (i = 0; i < num_uavs; i++) {
+		if (uavs[i]) {
+			RecordViewUsage(ShaderUsageStage::CS, mCurrentComputeShader,
+					ShaderUsageKind::UAV, i, uavs[i]);
+			uavs[i]->Release();
 		}
+	}
 
-		if (Profiling::mode == Profiling::Mode::SUMMARY)
-			Profiling::end(&profiling_state, &Profiling::stat_overhead);
+	if (Profiling::mode == Profiling::Mode::SUMMARY)
+		Profiling::end(&profiling_state, &Profiling::stat_overhead);
+}
 
-	LeaveCriticalSection(&G->mCriticalSection);
+void HackerContext::PublishShaderUsage()
+{
+	mShaderUsage.publish();
 }
 
 void HackerContext::RecordRenderTargetInfo(ID3D11RenderTargetView *target, UINT view_num)
@@ -725,8 +712,37 @@ void HackerContext::DeferredShaderReplacementBeforeDispatch()
 }
 
 
+static ShaderOverride* find_shader_override(UINT64 hash)
+{
+	ShaderOverrideMap::iterator i;
+
+	if (G->mShaderOverrideMap.empty())
+		return NULL;
+
+	i = lookup_shaderoverride(hash);
+	if (i == G->mShaderOverrideMap.end())
+		return NULL;
+
+	return &i->second;
+}
+
+// The ShaderOverrides for the bound shaders are normally resolved in
+// SetShader, but if the ShaderOverrides have been reparsed, or a ShaderRegex
+// has added one since then we need to look them all up again:
+void HackerContext::UpdateShaderOverrideCache()
+{
+	mCurrentVertexShaderOverride = find_shader_override(mCurrentVertexShader);
+	mCurrentHullShaderOverride = find_shader_override(mCurrentHullShader);
+	mCurrentDomainShaderOverride = find_shader_override(mCurrentDomainShader);
+	mCurrentGeometryShaderOverride = find_shader_override(mCurrentGeometryShader);
+	mCurrentPixelShaderOverride = find_shader_override(mCurrentPixelShader);
+	mCurrentComputeShaderOverride = find_shader_override(mCurrentComputeShader);
+	mShaderOverrideGeneration = G->shader_override_generation;
+}
+
 void HackerContext::BeforeDraw(DrawContext &data)
 {
+	Tracing::Scope trace(Tracing::Event::DRAW, mCurrentVertexShader);
 	Profiling::State profiling_state;
 
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
@@ -840,45 +856,46 @@ void HackerContext::BeforeDraw(DrawContext &data)
 
 	DeferredShaderReplacementBeforeDraw();
 
-	// Override settings?
+	// Override settings? The ShaderOverrides were looked up when the
+	// shaders were bound, so unless they have been invalidated since this
+	// only needs to check the cached pointers:
 	if (!G->mShaderOverrideMap.empty()) {
-		ShaderOverrideMap::iterator i;
-
-		i = lookup_shaderoverride(mCurrentVertexShader);
-		if (i != G->mShaderOverrideMap.end()) {
-			data.post_commands[0] = &i->second.post_command_list;
-			ProcessShaderOverride(&i->second, false, &data);
+		if (mShaderOverrideGeneration != G->shader_override_generation)
+			UpdateShaderOverrideCache();
+		else if (Profiling::mode == Profiling::Mode::SUMMARY)
+			Profiling::shaderoverride_lookups_avoided += 2 + !!mCurrentHullShader + !!mCurrentDomainShader + !!mCurrentGeometryShader;
+
+		// Up to five command lists may run for this draw call, so
+		// only upload changed IniParams once they have all finished:
+		mBatchIniParamsFlush = true;
+
+		if (mCurrentVertexShaderOverride) {
+			data.post_commands[0] = &mCurrentVertexShaderOverride->post_command_list;
+			ProcessShaderOverride(mCurrentVertexShaderOverride, false, &data);
 		}
 
-		if (mCurrentHullShader) {
-			i = lookup_shaderoverride(mCurrentHullShader);
-			if (i != G->mShaderOverrideMap.end()) {
-				data.post_commands[1] = &i->second.post_command_list;
-				ProcessShaderOverride(&i->second, false, &data);
-			}
+		if (mCurrentHullShader && mCurrentHullShaderOverride) {
+			data.post_commands[1] = &mCurrentHullShaderOverride->post_command_list;
+			ProcessShaderOverride(mCurrentHullShaderOverride, false, &data);
 		}
 
-		if (mCurrentDomainShader) {
-			i = lookup_shaderoverride(mCurrentDomainShader);
-			if (i != G->mShaderOverrideMap.end()) {
-				data.post_commands[2] = &i->second.post_command_list;
-				ProcessShaderOverride(&i->second, false, &data);
-			}
+		if (mCurrentDomainShader && mCurrentDomainShaderOverride) {
+			data.post_commands[2] = &mCurrentDomainShaderOverride->post_command_list;
+			ProcessShaderOverride(mCurrentDomainShaderOverride, false, &data);
 		}
 
-		if (mCurrentGeometryShader) {
-			i = lookup_shaderoverride(mCurrentGeometryShader);
-			if (i != G->mShaderOverrideMap.end()) {
-				data.post_commands[3] = &i->second.post_command_list;
-				ProcessShaderOverride(&i->second, false, &data);
-			}
+		if (mCurrentGeometryShader && mCurrentGeometryShaderOverride) {
+			data.post_commands[3] = &mCurrentGeometryShaderOverride->post_command_list;
+			ProcessShaderOverride(mCurrentGeometryShaderOverride, false, &data);
 		}
 
-		i = lookup_shaderoverride(mCurrentPixelShader);
-		if (i != G->mShaderOverrideMap.end()) {
-			data.post_commands[4] = &i->second.post_command_list;
-			ProcessShaderOverride(&i->second, true, &data);
+		if (mCurrentPixelShaderOverride) {
+			data.post_commands[4] = &mCurrentPixelShaderOverride->post_command_list;
+			ProcessShaderOverride(mCurrentPixelShaderOverride, true, &data);
 		}
+
+		mBatchIniParamsFlush = false;
+		FlushIniParams(mHackerDevice, this, mOrigContext1);
 	}
 
 out_profile:
@@ -897,11 +914,14 @@ void HackerContext::AfterDraw(DrawContext &data)
 	if (data.call_info.skip)
 		Profiling::skipped_draw_calls++;
 
+	mBatchIniParamsFlush = true;
 	for (i = 0; i < 5; i++) {
 		if (data.post_commands[i]) {
 			RunCommandList(mHackerDevice, this, data.post_commands[i], &data.call_info, true);
 		}
 	}
+	mBatchIniParamsFlush = false;
+	FlushIniParams(mHackerDevice, this, mOrigContext1);
 
 	if (mHackerDevice->mStereoHandle && data.oldSeparation != FLT_MAX) {
 		NvAPIOverride();
@@ -1160,6 +1180,7 @@ void HackerContext::TrackAndDivertMap(HRESULT map_hr, ID3D11Resource *pResource,
 	void *replace = NULL;
 	bool divertable = false, divert = false, track = false;
 	bool write = false, read = false, deny = false;
+	Tracing::Scope trace(Tracing::Event::MAP, (uintptr_t)pResource);
 	Profiling::State profiling_state;
 
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
@@ -1388,7 +1409,8 @@ STDMETHODIMP_(void) HackerContext::GSSetShader(THIS_
 		 &G->mVisitedGeometryShaders,
 		 G->mSelectedGeometryShader,
 		 &mCurrentGeometryShader,
-		 &mCurrentGeometryShaderHandle);
+		 &mCurrentGeometryShaderHandle,
+		 &mCurrentGeometryShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::IASetPrimitiveTopology(THIS_
@@ -1528,16 +1550,18 @@ bool HackerContext::BeforeDispatch(DispatchContext *context)
 
 	// Override settings?
 	if (!G->mShaderOverrideMap.empty()) {
-		ShaderOverrideMap::iterator i;
+		if (mShaderOverrideGeneration != G->shader_override_generation)
+			UpdateShaderOverrideCache();
+		else if (Profiling::mode == Profiling::Mode::SUMMARY)
+			Profiling::shaderoverride_lookups_avoided++;
 
-		i = lookup_shaderoverride(mCurrentComputeShader);
-		if (i != G->mShaderOverrideMap.end()) {
-			context->post_commands = &i->second.post_command_list;
+		if (mCurrentComputeShaderOverride) {
+			context->post_commands = &mCurrentComputeShaderOverride->post_command_list;
 			// XXX: Not using ProcessShaderOverride() as a
 			// lot of it's logic doesn't really apply to
 			// compute shaders. The main thing we care
 			// about is the command list, so just run that:
-			RunCommandList(mHackerDevice, this, &i->second.command_list, &context->call_info, false);
+			RunCommandList(mHackerDevice, this, &mCurrentComputeShaderOverride->command_list, &context->call_info, false);
 			return !context->call_info.skip;
 		}
 	}
@@ -1875,7 +1899,8 @@ STDMETHODIMP_(void) HackerContext::HSSetShader(THIS_
 		 &G->mVisitedHullShaders,
 		 G->mSelectedHullShader,
 		 &mCurrentHullShader,
-		 &mCurrentHullShaderHandle);
+		 &mCurrentHullShaderHandle,
+		 &mCurrentHullShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::HSSetSamplers(THIS_
@@ -1923,7 +1948,8 @@ STDMETHODIMP_(void) HackerContext::DSSetShader(THIS_
 		 &G->mVisitedDomainShaders,
 		 G->mSelectedDomainShader,
 		 &mCurrentDomainShader,
-		 &mCurrentDomainShaderHandle);
+		 &mCurrentDomainShaderHandle,
+		 &mCurrentDomainShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::DSSetSamplers(THIS_
@@ -1998,7 +2024,8 @@ STDMETHODIMP_(void) HackerContext::SetShader(THIS_
 	std::set<UINT64> *visitedShaders,
 	UINT64 selectedShader,
 	UINT64 *currentShaderHash,
-	ID3D11Shader **currentShaderHandle)
+	ID3D11Shader **currentShaderHandle,
+	ShaderOverride **currentShaderOverride)
 {
 	ID3D11Shader *repl_shader = pShader;
 
@@ -2068,6 +2095,10 @@ STDMETHODIMP_(void) HackerContext::SetShader(THIS_
 		*currentShaderHash = 0;
 	}
 
+	// Resolve the ShaderOverride now, since shaders are bound far less
+	// often than draw calls are issued:
+	*currentShaderOverride = find_shader_override(*currentShaderHash);
+
 	// Call through to original XXSetShader, but pShader may have been replaced.
 	(mOrigContext1->*OrigSetShader)(repl_shader, ppClassInstances, NumClassInstances);
 }
@@ -2084,7 +2115,8 @@ STDMETHODIMP_(void) HackerContext::CSSetShader(THIS_
 		 &G->mVisitedComputeShaders,
 		 G->mSelectedComputeShader,
 		 &mCurrentComputeShader,
-		 &mCurrentComputeShaderHandle);
+		 &mCurrentComputeShaderHandle,
+		 &mCurrentComputeShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::CSSetSamplers(THIS_
@@ -2549,6 +2581,11 @@ STDMETHODIMP HackerContext::FinishCommandList(THIS_
 {
 	BOOL ret = mOrigContext1->FinishCommandList(RestoreDeferredContextState, ppCommandList);
 
+	// Hand anything recorded for ShaderUsage.txt over to be merged at the
+	// end of the frame:
+	if (G->DumpUsage)
+		mShaderUsage.publish();
+
 	if (!RestoreDeferredContextState) {
 		// This is equivalent to calling ClearState() afterwards, so we
 		// need to rebind the 3DMigoto resources now. See also
@@ -2611,9 +2648,6 @@ void HackerContext::Bind3DMigotoResources()
 
 void HackerContext::InitIniParams()
 {
-	D3D11_MAPPED_SUBRESOURCE mappedResource;
-	HRESULT hr;
-
 	// Only the immediate context is allowed to perform [Constants]
 	// initialisation, as otherwise creating a deferred context could
 	// clobber any changes since then. The only exception I can think of is
@@ -2639,21 +2673,13 @@ void HackerContext::InitIniParams()
 	// (to non-zero), and we do this first in case [Constants] runs any
 	// custom shaders that may check IniParams. This is a bit wasteful
 	// since in most cases we will update the resource twice in a row, and
-	// the alternative is setting a flag to force update_params in the
-	// [Constants] command list, but this is a cold path so a little extra
-	// overhead won't matter and I don't want to forget about this if
-	// further command list optimisations cause [Constants] to bail out
-	// early and not consider update_params at all.
-	if (mHackerDevice->mIniTexture) {
-		hr = mOrigContext1->Map(mHackerDevice->mIniTexture, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		if (SUCCEEDED(hr)) {
-			memcpy(mappedResource.pData, G->iniParams.data(), sizeof(DirectX::XMFLOAT4) * G->iniParams.size());
-			mOrigContext1->Unmap(mHackerDevice->mIniTexture, 0);
-			Profiling::iniparams_updates++;
-		} else {
-			LogInfo("InitIniParams: Map failed\n");
-		}
-	}
+	// the alternative is leaving the whole range marked dirty for the
+	// [Constants] command list to flush, but this is a cold path so a
+	// little extra overhead won't matter and I don't want to forget about
+	// this if further command list optimisations cause [Constants] to bail
+	// out early and not flush the IniParams at all.
+	G->iniParamsDirty.mark_all((UINT)G->iniParams.size());
+	FlushIniParams(mHackerDevice, this, mOrigContext1);
 
 	// The command list will take care of initialising any non-zero values:
 	RunCommandList(mHackerDevice, this, &G->constants_command_list, NULL, false);
@@ -2742,7 +2768,8 @@ STDMETHODIMP_(void) HackerContext::VSSetShader(THIS_
 		 &G->mVisitedVertexShaders,
 		 G->mSelectedVertexShader,
 		 &mCurrentVertexShader,
-		 &mCurrentVertexShaderHandle);
+		 &mCurrentVertexShaderHandle,
+		 &mCurrentVertexShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::PSSetShaderResources(THIS_
@@ -2768,7 +2795,8 @@ STDMETHODIMP_(void) HackerContext::PSSetShader(THIS_
 		 &G->mVisitedPixelShaders,
 		 G->mSelectedPixelShader,
 		 &mCurrentPixelShader,
-		 &mCurrentPixelShaderHandle);
+		 &mCurrentPixelShaderHandle,
+		 &mCurrentPixelShaderOverride);
 
 	if (pPixelShader) {
 		// Set custom depth texture.
@@ -128,6 +128,10 @@ private:
 	typedef std::unordered_map<ID3D11Resource*, MappedResourceInfo> MappedResources;
 	MappedResources mMappedResources;
 
+	// Statistics for ShaderUsage.txt, recorded without taking the critical
+	// section and merged by MergeShaderUsage():
+	ShaderUsageRecorder mShaderUsage;
+
 	// These private methods are utility routines for HackerContext.
 	void BeforeDraw(DrawContext &data);
 	void AfterDraw(DrawContext &data);
@@ -159,14 +163,15 @@ private:
 		UINT StartSlot,
 		UINT NumViews,
 		ID3D11ShaderResourceView **ppShaderResourceViews)>
-	void RecordShaderResourceUsage(std::map<UINT64, ShaderInfoData> &ShaderInfo, UINT64 currentShader);
-	void _RecordShaderResourceUsage(ShaderInfoData *shader_info,
-			ID3D11ShaderResourceView *views[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT]);
+	void RecordShaderResourceUsage(ShaderUsageStage stage, UINT64 currentShader);
+	void RecordResourceUsage(ShaderUsageStage stage, UINT64 shader,
+			ShaderUsageKind kind, int slot, ID3D11Resource *resource);
+	void RecordViewUsage(ShaderUsageStage stage, UINT64 shader,
+			ShaderUsageKind kind, int slot, ID3D11View *view);
 	void RecordGraphicsShaderStats();
 	void RecordComputeShaderStats();
-	void RecordPeerShaders(std::set<UINT64> *PeerShaders, UINT64 this_shader_hash);
+	void RecordPeerShaders(ShaderUsageStage stage, UINT64 this_shader_hash);
 	void RecordRenderTargetInfo(ID3D11RenderTargetView *target, UINT view_num);
-	ID3D11Resource* RecordResourceViewStats(ID3D11View *view, std::set<uint32_t> *resource_info);
 
 	// Templates to reduce duplicated code:
 	template <class ID3D11Shader,
@@ -184,7 +189,8 @@ private:
 		std::set<UINT64> *visitedShaders,
 		UINT64 selectedShader,
 		UINT64 *currentShaderHash,
-		ID3D11Shader **currentShaderHandle);
+		ID3D11Shader **currentShaderHandle,
+		ShaderOverride **currentShaderOverride);
 	template <void (__stdcall ID3D11DeviceContext::*OrigSetShaderResources)(THIS_
 			UINT StartSlot,
 			UINT NumViews,
@@ -208,12 +214,26 @@ protected:
 	UINT64 mCurrentPixelShader;
 	UINT64 mCurrentComputeShader;
 
+	// The ShaderOverrides matching the above hashes (or NULL), resolved
+	// when the shaders are bound so that the draw and dispatch calls don't
+	// have to look them up every time. Only valid while
+	// mShaderOverrideGeneration matches G->shader_override_generation:
+	ShaderOverride *mCurrentVertexShaderOverride;
+	ShaderOverride *mCurrentHullShaderOverride;
+	ShaderOverride *mCurrentDomainShaderOverride;
+	ShaderOverride *mCurrentGeometryShaderOverride;
+	ShaderOverride *mCurrentPixelShaderOverride;
+	ShaderOverride *mCurrentComputeShaderOverride;
+	unsigned mShaderOverrideGeneration;
+	void UpdateShaderOverrideCache();
+
 public:
 	HackerContext(ID3D11Device1 *pDevice1, ID3D11DeviceContext1 *pContext1);
 
 	void SetHackerDevice(HackerDevice *pDevice);
 	HackerDevice* GetHackerDevice();
 	void Bind3DMigotoResources();
+	void PublishShaderUsage();
 	void InitIniParams();
 	ID3D11DeviceContext1* GetPossiblyHookedOrigContext1();
 	ID3D11DeviceContext1* GetPassThroughOrigContext1();
@@ -234,6 +254,15 @@ public:
 	ID3D11DomainShader *mCurrentDomainShaderHandle;
 	ID3D11HullShader *mCurrentHullShaderHandle;
 
+	// Set while running the command lists for a single draw/dispatch call
+	// so that any IniParams changes are uploaded once at the end instead
+	// of after every command list:
+	bool mBatchIniParamsFlush;
+
+	// Set when a command list running on this context changes an
+	// IniParam, so a deferred context knows to upload them:
+	bool mIniParamsChanged;
+
 	/*** IUnknown methods ***/
 
 	HRESULT STDMETHODCALLTYPE QueryInterface(
@@ -69,7 +69,10 @@
 #include "Override.h"
 #include "IniHandler.h"
 #include "CommandList.h"
+#include "FrameAnalysis.h"
 #include "profiling.h"
+#include "tracing.h"
+#include "FrameTasks.h"
 #include "cursor.h" // For InstallHookLate
 
 
@@ -221,6 +224,48 @@ void HackerSwapChain::UpdateStereoParams()
 	}
 }
 
+static uint64_t housekeeping_clock()
+{
+	static uint64_t freq = Tracing::frequency();
+	uint64_t now = Tracing::timestamp();
+
+	// Split up to avoid overflowing after a few weeks of uptime:
+	return now / freq * 1000000 + now % freq * 1000000 / freq;
+}
+
+// Housekeeping that doesn't need to happen on any particular frame, which
+// RunFrameActions requests and which runs as the frame time budget allows:
+static FrameTaskScheduler housekeeping(housekeeping_clock);
+
+static void flush_log_file()
+{
+	if (LogFile && !AsyncLog::enabled)
+		fflush(LogFile);
+}
+
+// This may run several frames after it was requested, by which time the user
+// may have pressed a key or turned hunting off, so check again that we are
+// still idle rather than clearing the buffers out from under them:
+static void timeout_hunting_buffers()
+{
+	if (G->hunting != HUNTING_MODE_ENABLED)
+		return;
+	if (difftime(time(NULL), G->huntTime) <= 60)
+		return;
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+	TimeoutHuntingBuffers();
+	LeaveCriticalSection(&G->mCriticalSection);
+}
+
+// The maximum delays are in frames. The log flush is kept short so that no
+// more than a few frames of log can be lost in a crash:
+static size_t housekeeping_flush_log = housekeeping.add("flush log", flush_log_file, 4);
+static size_t housekeeping_hash_contamination = housekeeping.add("hash contamination", MergeResourceHashContamination, 8);
+static size_t housekeeping_resource_pools = housekeeping.add("resource pools", ExpireResourcePools, 16);
+static size_t housekeeping_hunting_buffers = housekeeping.add("hunting buffers", timeout_hunting_buffers, 30);
+static size_t housekeeping_autosave = housekeeping.add("autosave", []() { SavePersistentSettings(); }, 60);
+
 // Called at each DXGI::Present() to give us reliable time to execute user
 // input and hunting commands.
 
@@ -229,18 +274,32 @@ void HackerSwapChain::RunFrameActions()
 	LogDebug("Running frame actions.  Device: %p\n", mHackerDevice);
 
 	// Regardless of log settings, since this runs every frame, let's flush the log
-	// so that the most lost will be one frame worth.  Tradeoff of performance to accuracy
-	if (LogFile) fflush(LogFile);
+	// so that the most lost will be a few frames worth.  Tradeoff of performance to accuracy
+	// The async log writes itself out in the background instead.
+	housekeeping.request(housekeeping_flush_log);
 
 	G->gTime = (GetTickCount() - G->ticks_at_launch) / 1000.0f;
 
+	// Fold the statistics for ShaderUsage.txt recorded on every context
+	// this frame into the shader info used for marking and dumping:
+	if (G->DumpUsage) {
+		if (mHackerContext)
+			mHackerContext->PublishShaderUsage();
+		MergeShaderUsage();
+	}
+
+	// Likewise apply the hash contamination recorded by copies, updates
+	// and maps, so the log never grows without bound. Anything that reads
+	// the contamination applies it first, so this can wait:
+	housekeeping.request(housekeeping_hash_contamination);
+
 	// Run the command list here, before drawing the overlay so that a
 	// custom shader on the present call won't remove the overlay. Also,
 	// run this before most frame actions so that this can be considered as
 	// a pre-present command list. We have a separate post-present command
 	// list after the present call in case we need to restore state or
 	// affect something at the start of the frame.
-	RunCommandList(mHackerDevice, mHackerContext, &G->present_command_list, NULL, false);
+	RunPresentCommandList(mHackerDevice, mHackerContext, &G->present_command_list, false);
 
 	if (G->analyse_frame) {
 		// We don't allow hold to be changed mid-frame due to potential
@@ -253,6 +312,7 @@ void HackerSwapChain::RunFrameActions()
 			G->analyse_frame_no++;
 		} else {
 			G->analyse_frame = false;
+			FrameAnalysisFlushDumps();
 			if (G->DumpUsage)
 				DumpUsage(G->ANALYSIS_PATH);
 			LogOverlayW(LOG_INFO, L"Frame analysis saved to %ls\n", G->ANALYSIS_PATH);
@@ -271,6 +331,8 @@ void HackerSwapChain::RunFrameActions()
 	CurrentTransition.UpdatePresets(mHackerDevice);
 	CurrentTransition.UpdateTransitions(mHackerDevice);
 
+	housekeeping.request(housekeeping_resource_pools);
+
 	// The config file is not safe to reload from within the input handler
 	// since it needs to change the key bindings, so it sets this flag
 	// instead and we handle it now.
@@ -283,7 +345,7 @@ void HackerSwapChain::RunFrameActions()
 	if (G->gConfigInitialized) {
 		// Autosave persistent variables every gSettingsAutoSaveInterval seconds
 		if (G->gTime - G->gSettingsSaveTime > G->gSettingsAutoSaveInterval) {
-			SavePersistentSettings();
+			housekeeping.request(housekeeping_autosave);
 			//LogOverlay(LOG_INFO, "Saved Persistent Variables\n");
 		}
 	}
@@ -309,6 +371,14 @@ void HackerSwapChain::RunFrameActions()
 	// incremented when we call the original present call:
 	G->frame_no++;
 
+	// Check any files included by shaders the game creates from here on
+	// for modifications again, but only once per frame:
+	include_cache.begin_pass();
+
+	// Now that everything that has to happen this frame is done, run as
+	// much of the requested housekeeping as fits in this frame's budget:
+	housekeeping.run_frame();
+
 	// When not hunting most keybindings won't have been registered, but
 	// still skip the below logic that only applies while hunting.
 	if (G->hunting != HUNTING_MODE_ENABLED)
@@ -328,11 +398,8 @@ void HackerSwapChain::RunFrameActions()
 	// The arrays will be continually filled by the SetShader sections, but should 
 	// rapidly converge upon all active shaders.
 
-	if (difftime(time(NULL), G->huntTime) > 60) {
-		EnterCriticalSectionPretty(&G->mCriticalSection);
-		TimeoutHuntingBuffers();
-		LeaveCriticalSection(&G->mCriticalSection);
-	}
+	if (difftime(time(NULL), G->huntTime) > 60)
+		housekeeping.request(housekeeping_hunting_buffers);
 }
 
 
@@ -563,6 +630,7 @@ STDMETHODIMP HackerSwapChain::Present(THIS_
 	/* [in] */ UINT SyncInterval,
 	/* [in] */ UINT Flags)
 {
+	Tracing::Scope trace(Tracing::Event::PRESENT, G->frame_no);
 	Profiling::State profiling_state = {0};
 	bool profiling = false;
 
@@ -601,7 +669,7 @@ STDMETHODIMP HackerSwapChain::Present(THIS_
 		// Run the post present command list now, which can be used to restore
 		// state changed in the pre-present command list, or to perform some
 		// action at the start of a frame:
-		RunCommandList(mHackerDevice, mHackerContext, &G->post_present_command_list, NULL, true);
+		RunPresentCommandList(mHackerDevice, mHackerContext, &G->post_present_command_list, true);
 
 		if (profiling)
 			Profiling::end(&profiling_state, &Profiling::present_overhead);
@@ -869,6 +937,7 @@ STDMETHODIMP HackerSwapChain::Present1(THIS_
 	/* [annotation][in] */
 	_In_  const DXGI_PRESENT_PARAMETERS *pPresentParameters)
 {
+	Tracing::Scope trace(Tracing::Event::PRESENT, G->frame_no);
 	Profiling::State profiling_state = {0};
 	gLogDebug = true;
 	bool profiling = false;
@@ -908,7 +977,7 @@ STDMETHODIMP HackerSwapChain::Present1(THIS_
 		// Run the post present command list now, which can be used to restore
 		// state changed in the pre-present command list, or to perform some
 		// action at the start of a frame:
-		RunCommandList(mHackerDevice, mHackerContext, &G->post_present_command_list, NULL, true);
+		RunPresentCommandList(mHackerDevice, mHackerContext, &G->post_present_command_list, true);
 
 		if (profiling)
 			Profiling::end(&profiling_state, &Profiling::present_overhead);
@@ -34,6 +34,8 @@
 #include "ShaderRegex.h"
 #include "CommandList.h"
 #include "Hunting.h"
+#include "ShaderCache.h"
+#include "tracing.h"
 
 // A map to look up the HackerDevice from an IUnknown. The reason for using an
 // IUnknown as the key is that an ID3D11Device and IDXGIDevice are actually two
@@ -362,9 +364,9 @@ HRESULT HackerDevice::CreateIniParamResources()
 	desc.MipLevels = 1;
 	desc.ArraySize = 1;
 	desc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;				// float4
-	desc.Usage = D3D11_USAGE_DYNAMIC;							// Read/Write access from GPU and CPU
+	desc.Usage = D3D11_USAGE_DEFAULT;							// Updated via UpdateSubresource for hotkeys
 	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;				// As resource view, access via t120
-	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;				// allow CPU access for hotkeys
+	desc.CPUAccessFlags = 0;									// Only the changed range is uploaded, see FlushIniParams()
 	desc.MiscFlags = 0;
 	ret = mOrigDevice1->CreateTexture1D(&desc, &initialData, &mIniTexture);
 	if (FAILED(ret))
@@ -373,6 +375,8 @@ HRESULT HackerDevice::CreateIniParamResources()
 		return ret;
 	}
 	LogInfo("    IniParam texture created, handle = %p\n", mIniTexture);
+	// The new texture was initialised with the current values:
+	G->iniParamsDirty.clear();
 
 	// Since we need to bind the texture to a shader input, we also need a resource view.
 	// The pDesc is set to NULL so that it will simply use the desc format above.
@@ -738,7 +742,8 @@ bail_close_handle:
 }
 
 // Load .bin shaders from the ShaderFixes folder as cached shaders.
-// This will load either *_replace.bin, or *.bin variants.
+// This will load either *_replace.bin, or *.bin variants. We no longer write
+// these ourselves (see ShaderCache.h), but fixes may still ship them.
 
 static bool LoadBinaryShaders(__in UINT64 hash, const wchar_t *pShaderType,
 	__out char* &pCode, SIZE_T &pCodeSize, string &pShaderModel, FILETIME &pTimeStamp)
@@ -756,7 +761,8 @@ static bool LoadBinaryShaders(__in UINT64 hash, const wchar_t *pShaderType,
 
 
 // Load an HLSL text file as the replacement shader.  Recompile it using D3DCompile.
-// If caching is enabled, save a .bin replacement for this new shader.
+// If caching is enabled, the compiled shader is looked up in / saved to the
+// shader cache.
 
 static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 	__in const void *pShaderBytecode, SIZE_T pBytecodeLength, const char *pOverrideShaderModel,
@@ -811,6 +817,28 @@ static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 			else
 				tmpShaderModel = shaderModel.c_str();
 
+			wcstombs(apath, path, MAX_PATH);
+
+			// The cache is keyed on the contents of the source and
+			// everything else that affects the compiler output, and
+			// also validates any #included files:
+			ShaderCacheKey cache_key = shader_cache_hlsl_key(srcData, srcDataSize,
+					apath, tmpShaderModel, D3DCOMPILE_OPTIMIZATION_LEVEL3, NULL);
+			vector<char> cached;
+			ShaderCacheIncludes cached_includes;
+			if (G->CACHE_SHADERS && lookup_shader_cache(cache_key, &cached, &cached_includes))
+			{
+				LogInfo("    compiled shader loaded from shader cache\n");
+				// Track the includes so ReloadFixes will notice if
+				// they are edited:
+				record_shader_dependencies(path, &cached_includes);
+				delete[] srcData; srcData = 0;
+				pCodeSize = cached.size();
+				pCode = new char[pCodeSize];
+				memcpy(pCode, cached.data(), pCodeSize);
+				return true;
+			}
+
 			// Compile replacement.
 			LogInfo("    compiling replacement HLSL code with shader model %s\n", tmpShaderModel);
 
@@ -818,16 +846,16 @@ static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 
 			ID3DBlob *errorMsgs; // FIXME: This can leak
 			ID3DBlob *compiledOutput = 0;
-			// Pass the real filename and use the standard include handler so that
-			// #include will work with a relative path from the shader itself.
-			// Later we could add a custom include handler to track dependencies so
-			// that we can make reloading work better when using includes:
-			wcstombs(apath, path, MAX_PATH);
+			// Pass the real filename and use our include handler so that
+			// #include will work with a relative path from the shader
+			// itself, and so we know which files to validate the cache
+			// against:
 			MigotoIncludeHandler include_handler(apath);
 			HRESULT ret = D3DCompile(srcData, srcDataSize, apath, 0,
 				G->recursive_include == -1 ? D3D_COMPILE_STANDARD_FILE_INCLUDE : &include_handler,
 				"main", tmpShaderModel, D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &compiledOutput, &errorMsgs);
 			delete[] srcData; srcData = 0;
+			include_handler.record_dependencies(path);
 			if (compiledOutput)
 			{
 				pCodeSize = compiledOutput->GetBufferSize();
@@ -843,29 +871,16 @@ static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 				LPVOID errMsg = errorMsgs->GetBufferPointer();
 				SIZE_T errSize = errorMsgs->GetBufferSize();
 				LogInfo("--------------------------------------------- BEGIN ---------------------------------------------\n");
-				fwrite(errMsg, 1, errSize - 1, LogFile);
+				LogWrite((const char*)errMsg, errSize - 1);
 				LogInfo("---------------------------------------------- END ----------------------------------------------\n");
 				errorMsgs->Release();
 			}
 
-			// Cache binary replacement.
-			if (G->CACHE_SHADERS && pCode)
-			{
-				swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_replace.bin", G->SHADER_PATH, hash, pShaderType);
-				FILE *fw;
-				wfopen_ensuring_access(&fw, path, L"wb");
-				if (fw)
-				{
-					LogInfo("    storing compiled shader to %S\n", path);
-					fwrite(pCode, 1, pCodeSize, fw);
-					fclose(fw);
-
-					// Set the last modified timestamp on the cached shader to match the
-					// .txt file it is created from, so we can later check its validity:
-					set_file_last_write_time(path, &ftWrite);
-				} else
-					LogInfo("    error writing compiled shader to %S\n", path);
-			}
+			// Cache binary replacement. We can't track which files
+			// the standard include handler opened, so we can't
+			// safely cache shaders compiled with it:
+			if (G->CACHE_SHADERS && pCode && G->recursive_include != -1)
+				store_shader_cache(cache_key, &include_handler.includes, pCode, pCodeSize);
 		}
 	}
 	return !!pCode;
@@ -880,13 +895,13 @@ static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 // files as redundant.
 // Files are like: 
 //  cc79d4a79b16b59c-vs.txt  as ASM text
-//  cc79d4a79b16b59c-vs.bin  as reassembled binary shader code
+//  cc79d4a79b16b59c-vs.bin  as reassembled binary shader code (legacy cache, or shipped with fixes)
 //
 // Using this naming convention because we already have multiple fixes that use the *-vs.txt format
 // to mean ASM text files, and changing all of those seems unnecessary.  This will parallel the use
 // of HLSL files like:
 //  cc79d4a79b16b59c-vs_replace.txt   as HLSL text
-//  cc79d4a79b16b59c-vs_replace.bin   as recompiled binary shader code
+//  cc79d4a79b16b59c-vs_replace.bin   as recompiled binary shader code (legacy cache, or shipped with fixes)
 //
 // So it should be clear by name, what type of file they are.  
 
@@ -929,6 +944,18 @@ static bool ReplaceASMShader(__in UINT64 hash, const wchar_t *pShaderType, const
 			std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utf8_to_utf16;
 			pHeaderLine = utf8_to_utf16.from_bytes(asmTextBytes.data(), strchr(asmTextBytes.data(), '\n'));
 
+			ShaderCacheKey cache_key = shader_cache_asm_key(asmTextBytes.data(), asmTextBytes.size(),
+					pShaderBytecode, pBytecodeLength);
+			vector<char> cached;
+			if (G->CACHE_SHADERS && lookup_shader_cache(cache_key, &cached, NULL))
+			{
+				LogInfo("    reassembled shader loaded from shader cache\n");
+				pCodeSize = cached.size();
+				pCode = new char[pCodeSize];
+				memcpy(pCode, cached.data(), pCodeSize);
+				return true;
+			}
+
 			vector<byte> byteCode(pBytecodeLength);
 			memcpy(byteCode.data(), pShaderBytecode, pBytecodeLength);
 
@@ -945,27 +972,8 @@ static bool ReplaceASMShader(__in UINT64 hash, const wchar_t *pShaderType, const
 
 				// Cache binary replacement.
 				if (parse_errors.empty()) {
-					if (G->CACHE_SHADERS && pCode && parse_errors.empty())
-					{
-						// Write reassembled binary output as a cached shader.
-						FILE *fw;
-						swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls.bin", G->SHADER_PATH, hash, pShaderType);
-						wfopen_ensuring_access(&fw, path, L"wb");
-						if (fw)
-						{
-							LogInfoW(L"    storing reassembled binary to %s\n", path);
-							fwrite(byteCode.data(), 1, byteCode.size(), fw);
-							fclose(fw);
-
-							// Set the last modified timestamp on the cached shader to match the
-							// .txt file it is created from, so we can later check its validity:
-							set_file_last_write_time(path, &ftWrite);
-						}
-						else
-						{
-							LogInfoW(L"    error storing reassembled binary to %s\n", path);
-						}
-					}
+					if (G->CACHE_SHADERS && pCode)
+						store_shader_cache(cache_key, NULL, byteCode.data(), byteCode.size());
 				} else {
 					// Parse errors are currently being treated as non-fatal on
 					// creation time replacement and ShaderRegex for backwards
@@ -1110,9 +1118,9 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 		LPVOID errMsg = pErrorMsgs->GetBufferPointer();
 		SIZE_T errSize = pErrorMsgs->GetBufferSize();
 		LogInfo("--------------------------------------------- BEGIN ---------------------------------------------\n");
-		fwrite(errMsg, 1, errSize - 1, LogFile);
+		LogWrite((const char*)errMsg, errSize - 1);
 		LogInfo("------------------------------------------- HLSL code -------------------------------------------\n");
-		fwrite(decompiledCode.c_str(), 1, decompiledCode.size(), LogFile);
+		LogWrite(decompiledCode.c_str(), decompiledCode.size());
 		LogInfo("\n---------------------------------------------- END ----------------------------------------------\n");
 
 		// And write the errors to the HLSL file as comments too, as a more convenient spot to see them.
@@ -2181,6 +2189,7 @@ STDMETHODIMP HackerDevice::CreateBuffer(THIS_
 		EnterCriticalSectionPretty(&G->mCriticalSection);
 			// For stat collection and hash contamination tracking:
 			if (G->hunting && pDesc) {
+				MergeResourceHashContamination();
 				G->mResourceInfo[hash] = *pDesc;
 				G->mResourceInfo[hash].initial_data_used_in_hash = !!data_hash;
 			}
@@ -2236,6 +2245,7 @@ STDMETHODIMP HackerDevice::CreateTexture1D(THIS_
 
 			// For stat collection and hash contamination tracking:
 			if (G->hunting && pDesc) {
+				MergeResourceHashContamination();
 				G->mResourceInfo[hash] = *pDesc;
 				G->mResourceInfo[hash].initial_data_used_in_hash = !!data_hash;
 			}
@@ -2347,6 +2357,7 @@ STDMETHODIMP HackerDevice::CreateTexture2D(THIS_
 		LeaveCriticalSection(&G->mResourcesLock);
 		EnterCriticalSectionPretty(&G->mCriticalSection);
 			if (G->hunting && pDesc) {
+				MergeResourceHashContamination();
 				G->mResourceInfo[hash] = *pDesc;
 				G->mResourceInfo[hash].initial_data_used_in_hash = !!data_hash;
 			}
@@ -2417,6 +2428,7 @@ STDMETHODIMP HackerDevice::CreateTexture3D(THIS_
 		LeaveCriticalSection(&G->mResourcesLock);
 		EnterCriticalSectionPretty(&G->mCriticalSection);
 			if (G->hunting && pDesc) {
+				MergeResourceHashContamination();
 				G->mResourceInfo[hash] = *pDesc;
 				G->mResourceInfo[hash].initial_data_used_in_hash = !!data_hash;
 			}
@@ -2444,7 +2456,7 @@ STDMETHODIMP HackerDevice::CreateShaderResourceView(THIS_
 	if (hr == S_OK && G->ZBufferHashToInject && ppSRView)
 	{
 		EnterCriticalSectionPretty(&G->mResourcesLock);
-		unordered_map<ID3D11Resource *, ResourceHandleInfo>::iterator i = lookup_resource_handle_info(pResource);
+		ResourceMap::iterator i = lookup_resource_handle_info(pResource);
 		if (i != G->mResources.end() && i->second.hash == G->ZBufferHashToInject)
 		{
 			LogInfo("  resource view of z buffer found: handle = %p, hash = %08lx\n", *ppSRView, i->second.hash);
@@ -2570,6 +2582,7 @@ STDMETHODIMP HackerDevice::CreateShader(THIS_
 	__out_opt  ID3D11Shader **ppShader,
 	wchar_t *shaderType)
 {
+	Tracing::Scope trace(Tracing::Event::CREATE_SHADER, 0);
 	HRESULT hr;
 	UINT64 hash;
 
@@ -2580,6 +2593,7 @@ STDMETHODIMP HackerDevice::CreateShader(THIS_
 
 	// Calculate hash
 	hash = hash_shader(pShaderBytecode, BytecodeLength);
+	trace.set_arg(hash);
 
 	hr = ReplaceShaderFromShaderFixes<ID3D11Shader, OrigCreateShader>
 		(hash, pShaderBytecode, BytecodeLength, pClassLinkage,
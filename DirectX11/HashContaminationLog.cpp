@@ -0,0 +1,51 @@
+#include "HashContaminationLog.h"
+
+#include <algorithm>
+
+HashContaminationLog::HashContaminationLog() :
+	sequence(0),
+	pending(0)
+{}
+
+void HashContaminationLog::add(HashContaminationEvent *event)
+{
+	Shard *shard = &shards[event->dst_hash % SHARDS];
+	std::lock_guard<std::mutex> guard(shard->lock);
+
+	// Numbered with the shard lock held, so each shard is always in order
+	// and only needs merging with the others:
+	event->sequence = sequence.fetch_add(1, std::memory_order_relaxed);
+	shard->events.push_back(*event);
+	pending.fetch_add(1, std::memory_order_release);
+}
+
+void HashContaminationLog::drain(std::vector<HashContaminationEvent> *events)
+{
+	size_t start = events->size();
+	unsigned i;
+
+	if (empty())
+		return;
+
+	// Every shard is locked at once, so that if one event made it in then
+	// so did everything the same thread recorded before it. Draining the
+	// shards one at a time could take a thread's later event from one
+	// shard while missing an earlier one that landed in a shard that had
+	// already been drained:
+	for (i = 0; i < SHARDS; i++)
+		shards[i].lock.lock();
+
+	for (i = 0; i < SHARDS; i++) {
+		events->insert(events->end(), shards[i].events.begin(), shards[i].events.end());
+		shards[i].events.clear();
+	}
+	pending.fetch_sub(events->size() - start, std::memory_order_relaxed);
+
+	for (i = 0; i < SHARDS; i++)
+		shards[i].lock.unlock();
+
+	std::sort(events->begin() + start, events->end(),
+		[](const HashContaminationEvent &x, const HashContaminationEvent &y) {
+			return x.sequence < y.sequence;
+		});
+}
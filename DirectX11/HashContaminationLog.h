@@ -0,0 +1,72 @@
+#pragma once
+
+// Deferred recording of hash contamination for hunting.
+//
+// While hunting, every CopyResource, CopySubresourceRegion, UpdateSubresource
+// and Map used to take the global critical section to look up the resource
+// info of the destination and source and add to its contamination records.
+// Games that stream a lot of textures through copies on several threads were
+// serialised behind this bookkeeping that only matters for ShaderUsage.txt,
+// frame analysis and the overlay.
+//
+// Now those calls only note down what happened in one of several shards,
+// chosen by the hash of the destination, each with its own lock. Whoever next
+// needs the contamination records drains all of the shards and applies the
+// events under the critical section, in the same order they were recorded, so
+// the records come out the same as if each call had updated them itself.
+// Anything else that touches the resource info drains the log first for the
+// same reason, and it is drained every frame so that it can't grow without
+// bound.
+//
+// This has no Windows or DirectX dependencies, so the log can be stress
+// tested from many threads on any platform.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+struct HashContaminationEvent
+{
+	uint64_t sequence;              // Filled in by the log
+	char type;                      // 'U'pdate, 'M'ap, 'C'opy or 'S'ubresource region copy
+	bool has_src;
+	bool has_src_box;
+	bool track_texture_updates_off; // track_texture_updates was 0 at the time
+	uint32_t dst_hash;
+	uint32_t src_hash;
+	uint32_t dst_subresource;
+	uint32_t src_subresource;
+	uint32_t dst_x, dst_y, dst_z;
+	uint32_t src_box[6];            // left, top, front, right, bottom, back
+};
+
+class HashContaminationLog
+{
+	static const unsigned SHARDS = 16;
+
+	struct Shard
+	{
+		std::mutex lock;
+		std::vector<HashContaminationEvent> events;
+	};
+
+	Shard shards[SHARDS];
+	std::atomic<uint64_t> sequence;
+	std::atomic<size_t> pending;
+
+public:
+	HashContaminationLog();
+
+	// Records an event. May be called from any number of threads at once:
+	void add(HashContaminationEvent *event);
+
+	// Appends every event recorded so far to the vector in the order they
+	// were recorded and empties the log. Events being added by other
+	// threads at the same time may be left for the next call:
+	void drain(std::vector<HashContaminationEvent> *events);
+
+	// Cheap check for whether there is anything to drain:
+	bool empty() const { return !pending.load(std::memory_order_acquire); }
+};
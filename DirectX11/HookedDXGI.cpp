@@ -188,7 +188,7 @@ static HackerDevice* sort_out_swap_chain_device_mess(IUnknown **device)
 		// we didn't wrap the swap chain that will probably never
 		// happen. Flush it now to ensure the above message shows up so
 		// we know why:
-		fflush(LogFile);
+		LogFlush();
 
 		// The swap chain is being created with a device that does NOT
 		// support the DX11 API. 3DMigoto is probably doomed to fail at
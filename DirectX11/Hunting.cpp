@@ -18,19 +18,12 @@
 #include "D3D_Shaders\stdafx.h"
 #include "CommandList.h"
 #include "profiling.h"
+#include "tracing.h"
+#include "CompileJobs.h"
 #include "FrameAnalysis.h"
 #include "ShaderRegex.h"
 
-// bo3b: For this routine, we have a lot of warnings in x64, from converting a size_t result into the needed
-//  DWORD type for the Write calls.  These are writing 256 byte strings, so there is never a chance that it 
-//  will lose data, so rather than do anything heroic here, I'm just doing type casts on the strlen function.
-
-DWORD castStrLen(const char* string)
-{
-	return (DWORD)strlen(string);
-}
-
-static void DumpUsageResourceInfo(HANDLE f, std::set<uint32_t> *hashes, char *tag)
+static void DumpUsageResourceInfo(std::string *out, std::set<uint32_t> *hashes, char *tag)
 {
 	std::set<uint32_t>::iterator orig_hash;
 	std::set<uint32_t>::iterator iCopy;
@@ -43,7 +36,6 @@ static void DumpUsageResourceInfo(HANDLE f, std::set<uint32_t> *hashes, char *ta
 	UINT SrcIdx, SrcMip, DstIdx, DstMip;
 	struct ResourceHashInfo *info;
 	char buf[256];
-	DWORD written; // Really? A >required< "optional" paramter that we don't care about?
 	bool nl;
 
 	for (orig_hash = hashes->begin(); orig_hash != hashes->end(); orig_hash++) {
@@ -53,31 +45,31 @@ static void DumpUsageResourceInfo(HANDLE f, std::set<uint32_t> *hashes, char *ta
 			continue;
 		}
 		_snprintf_s(buf, 256, 256, "<%s orig_hash=%08lx ", tag, *orig_hash);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
+		out->append(buf);
 		StrResourceDesc(buf, 256, *info);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
+		out->append(buf);
 
 		if (info->hash_contaminated) {
 			_snprintf_s(buf, 256, 256, " hash_contaminated=true");
-			WriteFile(f, buf, castStrLen(buf), &written, 0);
+			out->append(buf);
 		}
 
-		WriteFile(f, ">", 1, &written, 0);
+		out->push_back('>');
 		nl = false;
 
 		for (iMU = info->update_contamination.begin(); iMU != info->update_contamination.end(); iMU++) {
 			_snprintf_s(buf, 256, 256, "\n  <UpdateSubresource subresource=%u></UpdateSubresource>", *iMU);
-			WriteFile(f, buf, castStrLen(buf), &written, 0);
+			out->append(buf);
 			nl = true;
 		}
 		for (iMU = info->map_contamination.begin(); iMU != info->map_contamination.end(); iMU++) {
 			_snprintf_s(buf, 256, 256, "\n  <CPUWrite subresource=%u></CPUWrite>", *iMU);
-			WriteFile(f, buf, castStrLen(buf), &written, 0);
+			out->append(buf);
 			nl = true;
 		}
 		for (iCopy = info->copy_contamination.begin(); iCopy != info->copy_contamination.end(); iCopy++) {
 			_snprintf_s(buf, 256, 256, "\n  <CopiedFrom>%08lx</CopiedFrom>", *iCopy);
-			WriteFile(f, buf, castStrLen(buf), &written, 0);
+			out->append(buf);
 			nl = true;
 		}
 		for (iRegion = info->region_contamination.begin(); iRegion != info->region_contamination.end(); iRegion++) {
@@ -91,98 +83,97 @@ static void DumpUsageResourceInfo(HANDLE f, std::set<uint32_t> *hashes, char *ta
 			SrcMip = std::get<4>(kRegion);
 
 			_snprintf_s(buf, 256, 256, "\n  <SubresourceCopiedFrom partial=");
-			WriteFile(f, buf, castStrLen(buf), &written, 0);
+			out->append(buf);
 
 			if (region->partial) {
 				_snprintf_s(buf, 256, 256, "true");
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
+				out->append(buf);
 			} else {
 				_snprintf_s(buf, 256, 256, "false");
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
+				out->append(buf);
 			}
 
 			if (DstIdx || SrcIdx) {
 				_snprintf_s(buf, 256, 256, " DstIdx=%u SrcIdx=%u",
 						DstIdx, SrcIdx);
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
+				out->append(buf);
 			}
 
 			if (DstMip || SrcMip) {
 				_snprintf_s(buf, 256, 256, " DstMip=%u SrcMip=%u",
 						DstMip, SrcMip);
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
+				out->append(buf);
 			}
 
 			if (region->DstX || region->DstY || region->DstZ) {
 				_snprintf_s(buf, 256, 256, " DstX=%u DstY=%u DstZ=%u",
 						region->DstX, region->DstY, region->DstZ);
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
+				out->append(buf);
 			}
 
 			if (region->SrcBox.left || region->SrcBox.right != UINT_MAX) {
 				_snprintf_s(buf, 256, 256, " SrcLeft=%u SrcRight=%u",
 					region->SrcBox.left, region->SrcBox.right);
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
+				out->append(buf);
 			}
 			if (region->SrcBox.top || region->SrcBox.bottom != UINT_MAX) {
 				_snprintf_s(buf, 256, 256, " SrcTop=%u SrcBottom=%u",
 					region->SrcBox.top, region->SrcBox.bottom);
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
+				out->append(buf);
 			}
 			if (region->SrcBox.front || region->SrcBox.back != UINT_MAX) {
 				_snprintf_s(buf, 256, 256, " SrcFront=%u SrcBack=%u",
 					region->SrcBox.front, region->SrcBox.back);
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
+				out->append(buf);
 			}
 
 			_snprintf_s(buf, 256, 256, ">%08lx</SubresourceCopiedFrom>", srcHash);
-			WriteFile(f, buf, castStrLen(buf), &written, 0);
+			out->append(buf);
 
 			nl = true;
 		}
 
 		if (nl)
-			WriteFile(f, "\n", castStrLen("\n"), &written, 0);
+			out->push_back('\n');
 
 		_snprintf_s(buf, 256, 256, "</%s>\n", tag);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
+		out->append(buf);
 	}
 }
 
-static void DumpUsageRegister(HANDLE f, char *tag, int id, const ResourceSnapshot &info)
+static void DumpUsageRegister(std::string *out, char *tag, int id, const ResourceSnapshot &info)
 {
 	char buf[256];
-	DWORD written;
 
 	sprintf(buf, "  <%s", tag);
-	WriteFile(f, buf, castStrLen(buf), &written, 0);
+	out->append(buf);
 
 	if (id != -1) {
 		sprintf(buf, " id=%d", id);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
+		out->append(buf);
 	}
 
 	sprintf(buf, " handle=%p", info.handle);
-	WriteFile(f, buf, castStrLen(buf), &written, 0);
+	out->append(buf);
 
 	if (info.orig_hash != info.hash) {
 		sprintf(buf, " orig_hash=%08lx", info.orig_hash);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
+		out->append(buf);
 	}
 
 	try {
 		if (G->mResourceInfo.at(info.orig_hash).hash_contaminated) {
 			sprintf(buf, " hash_contaminated=true");
-			WriteFile(f, buf, castStrLen(buf), &written, 0);
+			out->append(buf);
 		}
 	} catch (std::out_of_range) {
 	}
 
 	sprintf(buf, ">%08lx</%s>\n", info.hash, tag);
-	WriteFile(f, buf, castStrLen(buf), &written, 0);
+	out->append(buf);
 }
 
-static void DumpShaderUsageInfo(HANDLE f, std::map<UINT64, ShaderInfoData> *info_map, char *tag)
+static void DumpShaderUsageInfo(std::string *out, std::map<UINT64, ShaderInfoData> *info_map, char *tag)
 {
 	std::map<UINT64, ShaderInfoData>::iterator i;
 	std::set<UINT64>::iterator j;
@@ -191,57 +182,104 @@ static void DumpShaderUsageInfo(HANDLE f, std::map<UINT64, ShaderInfoData> *info
 	std::vector<std::set<ResourceSnapshot>>::iterator m;
 	std::set<ResourceSnapshot>::iterator n;
 	char buf[256];
-	DWORD written;
 	int pos;
 
 	for (i = info_map->begin(); i != info_map->end(); ++i) {
 		sprintf(buf, "<%s hash=\"%016llx\">\n", tag, i->first);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
+		out->append(buf);
 
 		// Does not apply to compute shaders:
 		if (!i->second.PeerShaders.empty()) {
 			const char *PEER_HEADER = "  <PeerShaders>";
-			WriteFile(f, PEER_HEADER, castStrLen(PEER_HEADER), &written, 0);
+			out->append(PEER_HEADER);
 
 			for (j = i->second.PeerShaders.begin(); j != i->second.PeerShaders.end(); ++j) {
 				sprintf(buf, "%016llx ", *j);
-				WriteFile(f, buf, castStrLen(buf), &written, 0);
+				out->append(buf);
 			}
 			const char *REG_HEADER = "</PeerShaders>\n";
-			WriteFile(f, REG_HEADER, castStrLen(REG_HEADER), &written, 0);
+			out->append(REG_HEADER);
 		}
 
 		for (k = i->second.ResourceRegisters.begin(); k != i->second.ResourceRegisters.end(); ++k) {
 			for (o = k->second.begin(); o != k->second.end(); o++)
-				DumpUsageRegister(f, "Register", k->first, *o);
+				DumpUsageRegister(out, "Register", k->first, *o);
 		}
 
 		// Only applies to pixel shaders:
 		for (m = i->second.RenderTargets.begin(), pos = 0; m != i->second.RenderTargets.end(); m++, pos++) {
 			for (o = (*m).begin(); o != (*m).end(); o++)
-				DumpUsageRegister(f, "RenderTarget", pos, *o);
+				DumpUsageRegister(out, "RenderTarget", pos, *o);
 		}
 
 		// Only applies to pixel shaders:
 		for (n = i->second.DepthTargets.begin(); n != i->second.DepthTargets.end(); n++) {
-			DumpUsageRegister(f, "DepthTarget", -1, *n);
+			DumpUsageRegister(out, "DepthTarget", -1, *n);
 		}
 
 		// Applies to pixel and compute shaders:
 		for (k = i->second.UAVs.begin(); k != i->second.UAVs.end(); ++k) {
 			for (o = k->second.begin(); o != k->second.end(); o++)
-				DumpUsageRegister(f, "UAV", k->first, *o);
+				DumpUsageRegister(out, "UAV", k->first, *o);
 		}
 
 		sprintf(buf, "</%s>\n", tag);
-		WriteFile(f, buf, castStrLen(buf), &written, 0);
+		out->append(buf);
+	}
+}
+
+static std::map<UINT64, ShaderInfoData>* shader_usage_info_map(ShaderUsageStage stage)
+{
+	switch (stage) {
+		case ShaderUsageStage::VS: return &G->mVertexShaderInfo;
+		case ShaderUsageStage::HS: return &G->mHullShaderInfo;
+		case ShaderUsageStage::DS: return &G->mDomainShaderInfo;
+		case ShaderUsageStage::GS: return &G->mGeometryShaderInfo;
+		case ShaderUsageStage::PS: return &G->mPixelShaderInfo;
+	}
+	return &G->mComputeShaderInfo;
+}
+
+// Folds the statistics each context has published since the last call into
+// the ShaderInfoData maps. Called at the end of every frame, and before
+// writing ShaderUsage.txt
+void MergeShaderUsage()
+{
+	ShaderUsageChunk *chunks, *chunk;
+	ShaderUsageRecord *record;
+	size_t i;
+
+	chunks = G->mShaderUsageInbox.take_all();
+	if (!chunks)
+		return;
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+
+	for (chunk = chunks; chunk; chunk = chunk->next) {
+		for (i = 0; i < chunk->count; i++) {
+			record = &chunk->records[i];
+			merge_shader_usage_record(&(*shader_usage_info_map(record->stage))[record->shader],
+					&G->mShaderResourceInfo, &G->mUnorderedAccessInfo, *record);
+		}
 	}
+
+	LeaveCriticalSection(&G->mCriticalSection);
+
+	ShaderUsageInbox::free_chunks(chunks);
 }
 
+static size_t usage_report_size_hint = 0;
+
 // Expects the caller to have entered the critical section.
 void DumpUsage(wchar_t *dir)
 {
 	wchar_t path[MAX_PATH];
+	DWORD written;
+	size_t pos;
+
+	MergeShaderUsage();
+	MergeResourceHashContamination();
+
 	if (dir) {
 		wcscpy(path, dir);
 		wcscat(path, L"\\");
@@ -257,18 +295,37 @@ void DumpUsage(wchar_t *dir)
 		return;
 	}
 
-	DumpShaderUsageInfo(f, &G->mVertexShaderInfo, "VertexShader");
-	DumpShaderUsageInfo(f, &G->mHullShaderInfo, "HullShader");
-	DumpShaderUsageInfo(f, &G->mDomainShaderInfo, "DomainShader");
-	DumpShaderUsageInfo(f, &G->mGeometryShaderInfo, "GeometryShader");
-	DumpShaderUsageInfo(f, &G->mPixelShaderInfo, "PixelShader");
-	DumpShaderUsageInfo(f, &G->mComputeShaderInfo, "ComputeShader");
+	// The whole report is formatted in memory and written out in one go.
+	// This used to issue a WriteFile for every fragment of every line,
+	// which for a large capture was hundreds of thousands of syscalls
+	// stalling the present call that triggered it:
+	std::string report;
+	report.reserve(usage_report_size_hint);
+
+	DumpShaderUsageInfo(&report, &G->mVertexShaderInfo, "VertexShader");
+	DumpShaderUsageInfo(&report, &G->mHullShaderInfo, "HullShader");
+	DumpShaderUsageInfo(&report, &G->mDomainShaderInfo, "DomainShader");
+	DumpShaderUsageInfo(&report, &G->mGeometryShaderInfo, "GeometryShader");
+	DumpShaderUsageInfo(&report, &G->mPixelShaderInfo, "PixelShader");
+	DumpShaderUsageInfo(&report, &G->mComputeShaderInfo, "ComputeShader");
+
+	DumpUsageResourceInfo(&report, &G->mRenderTargetInfo, "RenderTarget");
+	DumpUsageResourceInfo(&report, &G->mDepthTargetInfo, "DepthTarget");
+	DumpUsageResourceInfo(&report, &G->mUnorderedAccessInfo, "UAV");
+	DumpUsageResourceInfo(&report, &G->mShaderResourceInfo, "Register");
+	DumpUsageResourceInfo(&report, &G->mCopiedResourceInfo, "CopySource");
+
+	// The statistics only ever grow, so the next report will be at least
+	// this big:
+	usage_report_size_hint = max(usage_report_size_hint, report.size());
+
+	for (pos = 0; pos < report.size(); pos += written) {
+		if (!WriteFile(f, report.data() + pos, (DWORD)min(report.size() - pos, (size_t)(64 * 1024 * 1024)), &written, 0) || !written) {
+			LogInfo("Error writing ShaderUsage.txt\n");
+			break;
+		}
+	}
 
-	DumpUsageResourceInfo(f, &G->mRenderTargetInfo, "RenderTarget");
-	DumpUsageResourceInfo(f, &G->mDepthTargetInfo, "DepthTarget");
-	DumpUsageResourceInfo(f, &G->mUnorderedAccessInfo, "UAV");
-	DumpUsageResourceInfo(f, &G->mShaderResourceInfo, "Register");
-	DumpUsageResourceInfo(f, &G->mCopiedResourceInfo, "CopySource");
 	CloseHandle(f);
 }
 
@@ -454,12 +511,97 @@ static string Decompile(ID3DBlob *pShaderByteCode, string *asmText)
 //   https://docs.microsoft.com/en-us/windows/desktop/direct3d11/d3d11-graphics-programming-guide-effects-compile#searching-for-include-files
 //   https://docs.microsoft.com/en-us/windows/desktop/api/d3dcompiler/nf-d3dcompiler-d3dcompile
 
-MigotoIncludeHandler::MigotoIncludeHandler(const char *path)
+class Win32IncludeFileSystem : public IncludeFileSystem
+{
+public:
+	bool stat(const std::wstring &path, IncludeFileStat *stat) override
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attrs;
+
+		if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attrs))
+			return false;
+
+		stat->last_write_time = ((UINT64)attrs.ftLastWriteTime.dwHighDateTime << 32) | attrs.ftLastWriteTime.dwLowDateTime;
+		stat->size = ((UINT64)attrs.nFileSizeHigh << 32) | attrs.nFileSizeLow;
+		return true;
+	}
+
+	bool read(const std::wstring &path, std::vector<char> *data, IncludeFileStat *stat) override
+	{
+		BY_HANDLE_FILE_INFORMATION info;
+		DWORD read;
+		HANDLE f;
+
+		f = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (f == INVALID_HANDLE_VALUE)
+			return false;
+
+		if (!GetFileInformationByHandle(f, &info) || info.nFileSizeHigh)
+			goto err_close;
+
+		data->resize(info.nFileSizeLow);
+		if (!ReadFile(f, data->data(), info.nFileSizeLow, &read, 0) || read != info.nFileSizeLow)
+			goto err_close;
+		CloseHandle(f);
+
+		stat->last_write_time = ((UINT64)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+		stat->size = info.nFileSizeLow;
+		return true;
+err_close:
+		CloseHandle(f);
+		return false;
+	}
+};
+
+static Win32IncludeFileSystem win32_include_fs;
+IncludeCache include_cache(&win32_include_fs);
+
+// Paths are case insensitive on Windows, and the same file may be reached via
+// forward or back slashes, so normalise them before using them as keys in the
+// include_cache:
+wstring include_cache_path(const wchar_t *path)
+{
+	wstring ret(path);
+
+	for (wchar_t &c : ret) {
+		if (c == L'/')
+			c = L'\\';
+		else
+			c = towlower(c);
+	}
+
+	return ret;
+}
+
+void record_shader_dependencies(const wchar_t *shader, const ShaderCacheIncludes *includes)
+{
+	vector<wstring> paths;
+
+	for (const ShaderCacheInclude &include : *includes)
+		paths.push_back(include_cache_path(include.path.c_str()));
+
+	include_cache.record_dependencies(include_cache_path(shader), paths);
+}
+
+MigotoIncludeHandler::MigotoIncludeHandler(const char *path, DeferredLog *deferred_log) :
+	deferred_log(deferred_log)
 {
 	LogDebug("      MigotoIncludeHandler %p for \"%s\"\n", this, path);
 	push_dir(path);
 }
 
+void MigotoIncludeHandler::log_info(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (deferred_log)
+		deferred_log->vinfo(fmt, ap);
+	else
+		vLogInfo(fmt, ap);
+	va_end(ap);
+}
+
 // This tracks any directories mentioned when including files, so that files in
 // those directories can include other files relative to themselves rather than
 // having to specify the include path relative to the initial source file.
@@ -487,12 +629,12 @@ void MigotoIncludeHandler::push_dir(const char *path)
 
 STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID *ppData, UINT *pBytes)
 {
+	static const char empty_file = '\0';
 	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> codec;
-	char *buf = NULL;
-	DWORD size, read;
+	ShaderCacheHasher hasher;
+	IncludeFilePtr file;
 	string apath;
 	wstring wpath;
-	HANDLE f;
 
 	LogDebug("      MigotoIncludeHandler::Open(%p, %u, %s, %p)\n", this, IncludeType, pFileName, pParentData);
 
@@ -517,8 +659,10 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 		apath = dir_stack.front() + pFileName;
 	wpath = codec.from_bytes(apath);
 
-	f = CreateFile(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (f == INVALID_HANDLE_VALUE && !G->recursive_include) {
+	// Included files are shared between every shader that includes them
+	// and only read from disk again if they have been modified:
+	file = include_cache.open(include_cache_path(wpath.c_str()));
+	if (!file && !G->recursive_include) {
 		// If the included file is not found relative to the includer
 		// D3D_COMPILE_STANDARD_FILE_INCLUDE falls back to trying to
 		// open the file from the current working directory, so we do
@@ -531,10 +675,10 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 		// enabled as that already disables backwards compatibility.
 		apath = pFileName;
 		wpath = codec.from_bytes(apath);
-		f = CreateFile(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		file = include_cache.open(include_cache_path(wpath.c_str()));
 	}
-	if (f == INVALID_HANDLE_VALUE) {
-		LogInfo("      Error opening included file: %s\n", apath.c_str());
+	if (!file) {
+		log_info("      Error opening included file: %s\n", apath.c_str());
 		return E_FAIL;
 	}
 
@@ -544,139 +688,308 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 	// #include <3dmigoto.h>
 	switch (IncludeType) {
 		case D3D_INCLUDE_LOCAL:
-			LogInfo("      #include \"%s\"\n", apath.c_str());
+			log_info("      #include \"%s\"\n", apath.c_str());
 			break;
 		case D3D_INCLUDE_SYSTEM:
 		default:
-			LogInfo("      #include <%s>\n", apath.c_str());
+			log_info("      #include <%s>\n", apath.c_str());
 			break;
 	}
 
-	size = GetFileSize(f, 0);
-	buf = new char[size];
+	hasher.update(file->data.data(), file->data.size());
+	includes.push_back({wpath, hasher.get()});
 
-	if (!ReadFile(f, buf, size, &read, 0) || size != read) {
-		LogInfo("      Error reading included file.\n");
-		goto err_free;
-	}
-	CloseHandle(f);
+	// Keep the contents alive until the compile has finished, even if
+	// another thread notices the file has changed and re-reads it:
+	open_files.push_back(file);
 
-	*pBytes = size;
-	*ppData = buf;
+	*pBytes = (UINT)file->data.size();
+	*ppData = file->data.empty() ? &empty_file : file->data.data();
 	push_dir(apath.c_str());
-	LogDebug("       -> %p\n", buf);
+	LogDebug("       -> %p\n", *ppData);
 
 	return S_OK;
-
-err_free:
-	delete [] buf;
-	CloseHandle(f);
-	return E_FAIL;
 }
 
 STDMETHODIMP MigotoIncludeHandler::Close(LPCVOID pData)
 {
 	LogDebug("      MigotoIncludeHandler::Close(%p, %p)\n", this, pData);
-	delete [] pData;
 	dir_stack.pop_back();
 	return S_OK;
 }
 
-// Compile a new shader from  HLSL text input, and report on errors if any.
-// Return the binary blob of pCode to be activated with CreateVertexShader or CreatePixelShader.
-// If the timeStamp has not changed from when it was loaded, skip the recompile, and return false as not an 
-// error, but skipped.  On actual errors, return true so that we bail out.
+void MigotoIncludeHandler::record_dependencies(const wchar_t *shader)
+{
+	record_shader_dependencies(shader, &includes);
+}
+
+// Reloads one file from ShaderFixes, replacing every copy of the shader with
+// that hash in mReloadedShaders. The file is read and compiled or assembled in
+// compile(), which may run on a worker thread in parallel with other reloads,
+// while anything that touches the device or our shared state is done either
+// when the job is created or in complete() on the thread that requested the
+// reload.
 
 // Compile example taken from: http://msdn.microsoft.com/en-us/library/windows/desktop/hh968107(v=vs.85).aspx
 
-static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const char *shaderModel, 
-	UINT64 hash, wstring shaderType, ID3DBlob *origByteCode,
-	__out FILETIME* timeStamp, __out wstring &headerLine, _Outptr_ ID3DBlob** pCode, string *errText)
+class ReloadShaderJob : public CompileJob
 {
-	*pCode = nullptr;
+	// A copy of the shader in mReloadedShaders that we may replace:
+	struct Target
+	{
+		ID3D11DeviceChild *oldShader;
+		ID3D11ClassLinkage *classLinkage;
+		FILETIME timeStamp;
+	};
+
+	HackerDevice *device;
 	wchar_t fullName[MAX_PATH];
-	char apath[MAX_PATH];
-	swprintf_s(fullName, MAX_PATH, L"%s\\%s", shaderFixPath, fileName);
+	wstring fileName;
+	string shaderModel;
+	wstring shaderType;		// "vs", "ps", "cs" maybe "gs"
+	ID3DBlob *origByteCode;
+	bool includes_changed;
+	vector<Target> targets;
+	string *errText;
+	bool *success;
+
+	// Results of compile():
+	DeferredLog log;
+	bool reloaded;
+	bool failed;
+	FILETIME curFileTime;
+	wstring headerLine;		// First line of the HLSL file.
+	ID3DBlob *pByteCode;
+	string errors;
+	bool cache;
+	ShaderCacheKey cache_key;
+	ShaderCacheIncludes cache_includes;
+
+	ReloadShaderJob() :
+		origByteCode(NULL),
+		reloaded(false),
+		failed(false),
+		pByteCode(NULL),
+		cache(false),
+		previous(NULL)
+	{}
+
+	bool reload_target(const Target &target);
+
+public:
+	UINT64 hash;
 
-	WarnIfConflictingShaderExists(fullName);
+	// An earlier job in the same batch for another file with the same
+	// hash (i.e. both HLSL and assembly versions of the same shader). This
+	// job must depend on it:
+	ReloadShaderJob *previous;
 
-	HANDLE f = CreateFile(fullName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (f == INVALID_HANDLE_VALUE)
+	~ReloadShaderJob()
 	{
-		LogInfo("    ReloadShader shader not found: %ls\n", fullName);
+		if (origByteCode)
+			origByteCode->Release();
+		if (pByteCode)
+			pByteCode->Release();
+	}
 
-		return true;
+	static ReloadShaderJob* prepare(wchar_t *shaderPath, wchar_t *fileName, HackerDevice *device, string *errText, bool *success);
+
+	void compile() override;
+	void complete() override;
+};
+
+// Finds every copy of the shader in mReloadedShaders and gathers everything
+// compile() will need. Returns NULL if there is nothing to reload, or on
+// error, in which case *success will be cleared.
+ReloadShaderJob* ReloadShaderJob::prepare(wchar_t *shaderPath, wchar_t *fileName, HackerDevice *device, string *errText, bool *success)
+{
+	ReloadShaderJob *job = new ReloadShaderJob();
+	wstring changed_include;
+	string shaderModel;
+	Target target;
+
+	job->device = device;
+	job->fileName = fileName;
+	job->errText = errText;
+	job->success = success;
+
+	// Extract hash from first 16 characters of file name so we can look up details by hash
+	job->hash = stoull(job->fileName.substr(0, 16), NULL, 16);
+
+	swprintf_s(job->fullName, MAX_PATH, L"%s\\%s", shaderPath, fileName);
+	WarnIfConflictingShaderExists(job->fullName);
+
+	// Check this once up front, since compiling the shader will record
+	// the new state of its includes:
+	job->includes_changed = include_cache.dependencies_changed(include_cache_path(job->fullName), &changed_include);
+	if (job->includes_changed)
+		LogInfo("> %S has changed, recompiling %S\n", changed_include.c_str(), fileName);
+
+	// This is probably unnecessary, because we modify already existing map entries, but
+	// for consistency, we'll wrap this.
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+
+	// Find the original shader bytecode in the mReloadedShaders Map. This map contains entries for all
+	// shaders from the ShaderFixes and ShaderCache folder, and can also include .bin files that were loaded directly.
+	// We include ShaderCache because that allows moving files into ShaderFixes as they are identified.
+	// This needs to use the value to find the key, so a linear search.
+	// It's notable that the map can contain multiple copies of the same hash, used for different visual
+	// items, but with same original code.  We need to update all copies, which all share the same
+	// original byte code, and therefore the same compiled replacement.
+	for (auto &iter : G->mReloadedShaders)
+	{
+		if (iter.second.hash != job->hash)
+			continue;
+
+		// If we didn't find an original shader, that is OK, because it might not have been loaded yet.
+		// Just skip it in that case, because the new version will be loaded when it is used.
+		if (iter.first == NULL)
+		{
+			LogInfo("> failed to find original shader in mReloadedShaders: %ls\n", fileName);
+			continue;
+		}
+
+		iter.second.found = true;
+
+		if (job->targets.empty())
+		{
+			shaderModel = iter.second.shaderModel;
+
+			// Check if the user has overridden the shader model:
+			ShaderOverrideMap::iterator override = lookup_shaderoverride(job->hash);
+			if (override != G->mShaderOverrideMap.end()) {
+				if (override->second.model[0])
+					shaderModel = override->second.model;
+			}
+
+			// If shaderModel is "bin", that means the original was loaded as a binary object, and thus shaderModel is unknown.
+			// Disassemble the binary to get that string.
+			if (shaderModel.compare("bin") == 0)
+			{
+				shaderModel = GetShaderModel(iter.second.byteCode->GetBufferPointer(), iter.second.byteCode->GetBufferSize());
+				if (shaderModel.empty())
+					goto err;
+				iter.second.shaderModel = shaderModel;
+			}
+
+			job->shaderModel = shaderModel;
+			job->shaderType = iter.second.shaderType;
+			// Hold a reference in case the game releases the
+			// shader while we are compiling:
+			job->origByteCode = iter.second.byteCode;
+			job->origByteCode->AddRef();
+		}
+
+		target.oldShader = iter.first;
+		target.classLinkage = iter.second.linkage;
+		target.timeStamp = iter.second.timeStamp;
+		job->targets.push_back(target);
 	}
 
+	LeaveCriticalSection(&G->mCriticalSection);
+
+	if (job->targets.empty()) {
+		delete job;
+		return NULL;
+	}
+	return job;
+
+err:
+	LeaveCriticalSection(&G->mCriticalSection);
+	delete job;
+	*success = false;
+	return NULL;
+}
+
+// Compile a new shader from HLSL or assembly text input, and report on errors if any.
+// If the timeStamp of every copy of the shader matches the file and none of its #includes
+// have changed, skip the recompile. This dramatically improves the F10 reload speed.
+// Runs on a worker thread, so must not touch the device or log directly.
+void ReloadShaderJob::compile()
+{
+	char apath[MAX_PATH];
+	bool force;
+
+	HANDLE f = CreateFile(fullName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+	{
+		log.info("    ReloadShader shader not found: %ls\n", fullName);
+		return;
+	}
 
 	DWORD srcDataSize = GetFileSize(f, 0);
 	vector<char> srcData(srcDataSize);
 	DWORD readSize;
-	FILETIME curFileTime;
 
 	if (!ReadFile(f, srcData.data(), srcDataSize, &readSize, 0)
 		|| !GetFileTime(f, NULL, NULL, &curFileTime)
 		|| srcDataSize != readSize)
 	{
-		LogInfo("    Error reading txt file.\n");
+		log.info("    Error reading txt file.\n");
 		CloseHandle(f);
-
-		return true;
+		return;
 	}
 	CloseHandle(f);
 
-	// Check file time stamp, and only recompile shaders that have been edited since they were loaded.
-	// This dramatically improves the F10 reload speed.
-	if (!CompareFileTime(timeStamp, &curFileTime))
+	// Only recompile shaders that have been edited since they were loaded,
+	// or that #include a file that has been edited since. If the other
+	// version of this shader was just reloaded we must also be reloaded,
+	// so that the same version wins as if they were reloaded one at a time:
+	force = includes_changed || (previous && previous->reloaded);
+	if (!force)
 	{
-		return false;
+		for (Target &target : targets)
+			force = force || CompareFileTime(&target.timeStamp, &curFileTime);
+		if (!force)
+			return;
 	}
-	*timeStamp = curFileTime;
+	reloaded = true;
 
 	// Now that we are sure to be reloading, let's see if it's an ASM file and assemble instead.
-	ID3DBlob* pByteCode = nullptr;
-	
-	if (wcsstr(fileName, L"_replace"))
+	if (fileName.find(L"_replace") != wstring::npos)
 	{
-		LogInfo("   >Replacement shader found. Re-Loading replacement HLSL code from %ls\n", fileName);
-		LogInfo("    Reload source code loaded. Size = %d\n", srcDataSize);
-		LogInfo("    compiling replacement HLSL code with shader model %s\n", shaderModel);
+		log.info("   >Replacement shader found. Re-Loading replacement HLSL code from %ls\n", fileName.c_str());
+		log.info("    Reload source code loaded. Size = %d\n", srcDataSize);
+		log.info("    compiling replacement HLSL code with shader model %s\n", shaderModel.c_str());
 
 		// TODO: Add #defines for StereoParams and IniParams
 
 		ID3DBlob* pErrorMsgs = nullptr;
-		// Pass the real filename and use the standard include handler so that
-		// #include will work with a relative path from the shader itself.
-		// Later we could add a custom include handler to track dependencies so
-		// that we can make reloading work better when using includes:
+		// Pass the real filename and use our include handler so that
+		// #include will work with a relative path from the shader itself,
+		// and so that we know to reload this shader if an included file is
+		// edited:
 		wcstombs(apath, fullName, MAX_PATH);
-		MigotoIncludeHandler include_handler(apath);
+		MigotoIncludeHandler include_handler(apath, &log);
 		HRESULT ret = D3DCompile(srcData.data(), srcDataSize, apath, 0,
 				G->recursive_include == -1 ? D3D_COMPILE_STANDARD_FILE_INCLUDE : &include_handler,
-			"main", shaderModel, D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &pByteCode, &pErrorMsgs);
+			"main", shaderModel.c_str(), D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &pByteCode, &pErrorMsgs);
 
-		LogInfo("    compile result for replacement HLSL shader: %x\n", ret);
+		log.info("    compile result for replacement HLSL shader: %x\n", ret);
+
+		// Even if it failed, so that fixing an error in an included file
+		// will be noticed:
+		include_handler.record_dependencies(fullName);
 
 		if (pErrorMsgs)
 		{
 			LPVOID errMsg = pErrorMsgs->GetBufferPointer();
 			SIZE_T errSize = pErrorMsgs->GetBufferSize();
-			LogInfo("--------------------------------------------- BEGIN ---------------------------------------------\n");
+			log.info("--------------------------------------------- BEGIN ---------------------------------------------\n");
 			if (FAILED(ret))
 			{
 				// If there are errors they go to the overlay
-				LogOverlay(LOG_NOTICE, "%*s\n", errSize, errMsg);
+				log.overlay(LOG_NOTICE, "%*s\n", errSize, errMsg);
 			}
-			else if (LogFile)
+			else
 			{
 				// If there are only warnings they go to the
 				// log file, because it's too noisy to send all
 				// these to the overlay.
-				fwrite(errMsg, 1, errSize - 1, LogFile);
+				log.info("%.*s", (int)(errSize - 1), (char*)errMsg);
 			}
-			LogInfo("---------------------------------------------- END ----------------------------------------------\n");
-			if (errText)
-				*errText = string((char*)pErrorMsgs->GetBufferPointer(), pErrorMsgs->GetBufferSize() - 1);
+			log.info("---------------------------------------------- END ----------------------------------------------\n");
+			errors = string((char*)pErrorMsgs->GetBufferPointer(), pErrorMsgs->GetBufferSize() - 1);
 			pErrorMsgs->Release();
 		}
 
@@ -687,14 +1000,24 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 				pByteCode->Release();
 				pByteCode = 0;
 			}
-			return true;
+			failed = true;
+			return;
+		}
+
+		// Update the shader cache so the next launch doesn't need to
+		// recompile this shader. Done in complete() since it logs:
+		if (G->CACHE_SHADERS && G->recursive_include != -1) {
+			cache = true;
+			cache_key = shader_cache_hlsl_key(srcData.data(), srcDataSize, apath,
+					shaderModel.c_str(), D3DCOMPILE_OPTIMIZATION_LEVEL3, NULL);
+			cache_includes = include_handler.includes;
 		}
 	}
 	else
 	{
-		LogInfo("   >Replacement shader found. Re-Loading replacement ASM code from %ls\n", fileName);
-		LogInfo("    Reload source code loaded. Size = %d\n", srcDataSize);
-		LogInfo("    assembling replacement ASM code with shader model %s\n", shaderModel);
+		log.info("   >Replacement shader found. Re-Loading replacement ASM code from %ls\n", fileName.c_str());
+		log.info("    Reload source code loaded. Size = %d\n", srcDataSize);
+		log.info("    assembling replacement ASM code with shader model %s\n", shaderModel.c_str());
 
 		// We need original byte code unchanged, so make a copy.
 		vector<byte> byteCode(origByteCode->GetBufferSize());
@@ -708,9 +1031,10 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 		}
 		catch (const exception &e)
 		{
-			LogOverlay(LOG_NOTICE, "Error assembling %S: %s\n",
-					fileName, e.what());
-			return true;
+			log.overlay(LOG_NOTICE, "Error assembling %S: %s\n",
+					fileName.c_str(), e.what());
+			failed = true;
+			return;
 		}
 
 		// Since the re-assembly worked, let's make it the active shader code.
@@ -719,8 +1043,9 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 			memcpy(pByteCode->GetBufferPointer(), byteCode.data(), byteCode.size());
 		}
 		else {
-			LogInfo("    *** failed to allocate new Blob for assemble.\n");
-			return true;
+			log.info("    *** failed to allocate new Blob for assemble.\n");
+			failed = true;
+			return;
 		}
 	}
 
@@ -733,13 +1058,121 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 	// so the ShaderHacker can edit the line and reload and have it live.
 	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utf8_to_utf16;
 	headerLine = utf8_to_utf16.from_bytes(srcData.data(), strchr(srcData.data(), '\n'));
+}
+
+// Must be called with G->mCriticalSection held
+bool ReloadShaderJob::reload_target(const Target &target)
+{
+	ID3D11DeviceChild* replacement = NULL;
+	HRESULT hr = E_FAIL;
+
+	// The game may have released the shader while we were compiling:
+	auto iter = G->mReloadedShaders.find(target.oldShader);
+	if (iter == G->mReloadedShaders.end())
+		return true;
+	OriginalShaderInfo &info = iter->second;
+
+	// Update timestamp, since we have an edited file.
+	info.timeStamp = curFileTime;
+	info.infoText = headerLine;
+
+	// This needs to call the real CreateVertexShader, not our wrapped version
+	if (shaderType.compare(L"vs") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateVertexShader(pByteCode->GetBufferPointer(), pByteCode->GetBufferSize(), target.classLinkage,
+			(ID3D11VertexShader**)&replacement);
+		CleanupShaderMaps(replacement);
+	}
+	else if (shaderType.compare(L"ps") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreatePixelShader(pByteCode->GetBufferPointer(), pByteCode->GetBufferSize(), target.classLinkage,
+			(ID3D11PixelShader**)&replacement);
+		CleanupShaderMaps(replacement);
+	}
+	else if (shaderType.compare(L"cs") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateComputeShader(pByteCode->GetBufferPointer(),
+			pByteCode->GetBufferSize(), target.classLinkage, (ID3D11ComputeShader**)&replacement);
+		CleanupShaderMaps(replacement);
+	}
+	else if (shaderType.compare(L"gs") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateGeometryShader(pByteCode->GetBufferPointer(),
+			pByteCode->GetBufferSize(), target.classLinkage, (ID3D11GeometryShader**)&replacement);
+		CleanupShaderMaps(replacement);
+	}
+	else if (shaderType.compare(L"hs") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateHullShader(pByteCode->GetBufferPointer(),
+			pByteCode->GetBufferSize(), target.classLinkage, (ID3D11HullShader**)&replacement);
+		CleanupShaderMaps(replacement);
+	}
+	else if (shaderType.compare(L"ds") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateDomainShader(pByteCode->GetBufferPointer(),
+			pByteCode->GetBufferSize(), target.classLinkage, (ID3D11DomainShader**)&replacement);
+		CleanupShaderMaps(replacement);
+	}
+	if (FAILED(hr))
+		return false;
+
+
+	// If we have an older reloaded shader, let's release it to avoid a memory leak.  This only happens after 1st reload.
+	// New shader is loaded on GPU and ready to be used as override in VSSetShader or PSSetShader
+	if (info.replacement != NULL)
+		info.replacement->Release();
+	info.replacement = replacement;
 
-	// pCode on return == NULL for error cases, valid if made it this far.
-	*pCode = pByteCode;
+	// We do *not* replace the byteCode in the ReloadedShaders map,
+	// since that is used in future CopyToFixes and ShaderRegex which
+	// needs the original bytecode - this was the cause of our duplicate
+	// StereoParams bug.
 
+	// Any shaders that we load from disk are no longer
+	// candidates for auto patching:
+	info.deferred_replacement_candidate = false;
+
+	LogInfo("> successfully reloaded shader: %ls\n", fileName.c_str());
 	return true;
 }
 
+void ReloadShaderJob::complete()
+{
+	log.flush();
+
+	if (errText)
+		*errText = errors;
+
+	if (!reloaded)
+		return;
+
+	// If we compiled but got nothing, that's a fatal error we need to report.
+	if (failed || !pByteCode) {
+		*success = false;
+		return;
+	}
+
+	if (cache)
+		store_shader_cache(cache_key, &cache_includes, pByteCode->GetBufferPointer(), pByteCode->GetBufferSize());
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+
+	for (Target &target : targets) {
+		// Skip copies that are already up to date, unless an included
+		// file or the other version of the shader was changed:
+		if (!CompareFileTime(&target.timeStamp, &curFileTime) && !includes_changed
+				&& !(previous && previous->reloaded))
+			continue;
+
+		if (!reload_target(target)) {
+			*success = false;
+			break;
+		}
+	}
+
+	LeaveCriticalSection(&G->mCriticalSection);
+}
+
 
 // Strategy: When the user hits F10 as the reload key, we want to reload all of the hand-patched shaders in
 //	the ShaderFixes folder, and make them live in game.  That will allow the user to test out fixes on the 
@@ -772,158 +1205,17 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 
 static bool ReloadShader(wchar_t *shaderPath, wchar_t *fileName, HackerDevice *device, string *errText)
 {
-	UINT64 hash;
-	ShaderOverrideMap::iterator override;
-	ID3D11DeviceChild* oldShader = NULL;
-	ID3D11DeviceChild* replacement = NULL;
-	ID3D11ClassLinkage* classLinkage;
-	ID3DBlob* shaderCode;
-	string shaderModel;
-	wstring shaderType;		// "vs", "ps", "cs" maybe "gs"
-	wstring headerLine;		// First line of the HLSL file.
-	FILETIME timeStamp;
-	HRESULT hr = E_FAIL;
-	bool rc = true;
-
-	// Extract hash from first 16 characters of file name so we can look up details by hash
-	wstring ws = fileName;
-	hash = stoull(ws.substr(0, 16), NULL, 16);
-
-	// This is probably unnecessary, because we modify already existing map entries, but
-	// for consistency, we'll wrap this.
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-
-	// Find the original shader bytecode in the mReloadedShaders Map. This map contains entries for all
-	// shaders from the ShaderFixes and ShaderCache folder, and can also include .bin files that were loaded directly.
-	// We include ShaderCache because that allows moving files into ShaderFixes as they are identified.
-	// This needs to use the value to find the key, so a linear search.
-	// It's notable that the map can contain multiple copies of the same hash, used for different visual
-	// items, but with same original code.  We need to update all copies.
-	for each (pair<ID3D11DeviceChild *, OriginalShaderInfo> iter in G->mReloadedShaders)
-	{
-		if (iter.second.hash == hash)
-		{
-			oldShader = iter.first;
-			classLinkage = iter.second.linkage;
-			shaderModel = iter.second.shaderModel;
-			shaderType = iter.second.shaderType;
-			timeStamp = iter.second.timeStamp;
-			shaderCode = iter.second.byteCode;
-
-			// If we didn't find an original shader, that is OK, because it might not have been loaded yet.
-			// Just skip it in that case, because the new version will be loaded when it is used.
-			if (oldShader == NULL)
-			{
-				LogInfo("> failed to find original shader in mReloadedShaders: %ls\n", fileName);
-				continue;
-			}
-
-			// Is there a good reason we are operating on a copy of the map and not the original?
-			// Took me a while to work out why this wasn't working: iter.second.found = true;
-			//   -DarkStarSword
-			// Not a _good_ reason, but I was worried about breaking something I didn't understand, 
-			// if I were to modify the original. Too many moving parts for me, no good way to test regressions.
-			//   -bo3b
-			G->mReloadedShaders[oldShader].found = true;
-
-			// Check if the user has overridden the shader model:
-			ShaderOverrideMap::iterator override = lookup_shaderoverride(hash);
-			if (override != G->mShaderOverrideMap.end()) {
-				if (override->second.model[0])
-					shaderModel = override->second.model;
-			}
-
-			// If shaderModel is "bin", that means the original was loaded as a binary object, and thus shaderModel is unknown.
-			// Disassemble the binary to get that string.
-			if (shaderModel.compare("bin") == 0)
-			{
-				shaderModel = GetShaderModel(shaderCode->GetBufferPointer(), shaderCode->GetBufferSize());
-				if (shaderModel.empty())
-					goto err;
-				G->mReloadedShaders[oldShader].shaderModel = shaderModel;
-			}
-
-			// Compile anew. If timestamp is unchanged, the code is unchanged, continue to next shader.
-			ID3DBlob *pShaderBytecode = NULL;
-			if (!RegenerateShader(shaderPath, fileName, shaderModel.c_str(), hash, shaderType, shaderCode, &timeStamp, headerLine, &pShaderBytecode, errText))
-				continue;
-
-			// If we compiled but got nothing, that's a fatal error we need to report.
-			if (pShaderBytecode == NULL)
-				goto err;
-
-			// Update timestamp, since we have an edited file.
-			G->mReloadedShaders[oldShader].timeStamp = timeStamp;
-			G->mReloadedShaders[oldShader].infoText = headerLine;
-
-			replacement = NULL;
-			// This needs to call the real CreateVertexShader, not our wrapped version
-			if (shaderType.compare(L"vs") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateVertexShader(pShaderBytecode->GetBufferPointer(), pShaderBytecode->GetBufferSize(), classLinkage,
-					(ID3D11VertexShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"ps") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreatePixelShader(pShaderBytecode->GetBufferPointer(), pShaderBytecode->GetBufferSize(), classLinkage,
-					(ID3D11PixelShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"cs") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateComputeShader(pShaderBytecode->GetBufferPointer(),
-					pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11ComputeShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"gs") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateGeometryShader(pShaderBytecode->GetBufferPointer(),
-					pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11GeometryShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"hs") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateHullShader(pShaderBytecode->GetBufferPointer(),
-					pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11HullShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"ds") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateDomainShader(pShaderBytecode->GetBufferPointer(),
-					pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11DomainShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			if (FAILED(hr))
-				goto err;
-
-
-			// If we have an older reloaded shader, let's release it to avoid a memory leak.  This only happens after 1st reload.
-			// New shader is loaded on GPU and ready to be used as override in VSSetShader or PSSetShader
-			if (G->mReloadedShaders[oldShader].replacement != NULL)
-				G->mReloadedShaders[oldShader].replacement->Release();
-			G->mReloadedShaders[oldShader].replacement = replacement;
-
-			// We do *not* replace the byteCode in the ReloadedShaders map,
-			// since that is used in future CopyToFixes and ShaderRegex which
-			// needs the original bytecode - this was the cause of our duplicate
-			// StereoParams bug.
+	CompileJobQueue queue;
+	ReloadShaderJob *job;
+	bool success = true;
 
-			// Any shaders that we load from disk are no longer
-			// candidates for auto patching:
-			G->mReloadedShaders[oldShader].deferred_replacement_candidate = false;
-
-			LogInfo("> successfully reloaded shader: %ls\n", fileName);
-		}
-	}	// for every registered shader in mReloadedShaders 
-
-out:
-	LeaveCriticalSection(&G->mCriticalSection);
+	job = ReloadShaderJob::prepare(shaderPath, fileName, device, errText, &success);
+	if (job) {
+		queue.add(job);
+		queue.run(1);
+	}
 
-	return rc;
-err:
-	rc = false;
-	goto out;
+	return success;
 }
 
 static bool WriteASM(string *asmText, string *hlslText, string *errText,
@@ -1255,6 +1547,10 @@ static void ReloadFixes(HackerDevice *device, void *private_data)
 		bool success = true;
 		WIN32_FIND_DATA findFileData;
 		wchar_t fileName[MAX_PATH];
+		CompileJobQueue queue;
+		ReloadShaderJob *job;
+		size_t id;
+		unordered_map<UINT64, pair<size_t, ReloadShaderJob*>> last_job_for_hash;
 
 		// Clears any notices currently displayed on the overlay. This ensures
 		// that any notices that haven't timed out yet (e.g. from a previous
@@ -1266,6 +1562,9 @@ static void ReloadFixes(HackerDevice *device, void *private_data)
 		// of these actually takes effect in the current frame.
 		ClearNotices();
 
+		// Make sure every included file is checked for changes:
+		include_cache.begin_pass();
+
 		for (ShaderReloadMap::iterator iter = G->mReloadedShaders.begin(); iter != G->mReloadedShaders.end(); iter++)
 			iter->second.found = false;
 
@@ -1277,16 +1576,38 @@ static void ReloadFixes(HackerDevice *device, void *private_data)
 		if (hFind != INVALID_HANDLE_VALUE)
 		{
 			do {
-				success = ReloadShader(G->SHADER_PATH, findFileData.cFileName, device, NULL) && success;
+				job = ReloadShaderJob::prepare(G->SHADER_PATH, findFileData.cFileName, device, NULL, &success);
+				if (!job)
+					continue;
+
+				// If there is both a HLSL and assembly version of
+				// a shader they are reloaded in file name order
+				// and the last one wins, same as before we
+				// compiled them in parallel:
+				id = queue.add(job);
+				auto previous = last_job_for_hash.find(job->hash);
+				if (previous != last_job_for_hash.end()) {
+					job->previous = previous->second.second;
+					queue.add_dependency(id, previous->second.first);
+				}
+				last_job_for_hash[job->hash] = make_pair(id, job);
 			} while (FindNextFile(hFind, &findFileData));
 			FindClose(hFind);
 		}
 
+		// Compile everything in parallel, then create the shaders and
+		// log any errors in the same order as above:
+		queue.run(CompileJobQueue::default_threads());
+
 		// Any shaders in the map not visited, we want to revert back
 		// to original. We do this even if a shader failed, because we
 		// should still revert other shaders.
 		RevertMissingShaders();
 
+		// Make sure contexts don't hang onto ShaderOverrides resolved
+		// for the shaders as they were prior to the reload:
+		G->shader_override_generation++;
+
 		if (success)
 		{
 			LogOverlay(LOG_INFO, "> successfully reloaded shaders from ShaderFixes\n");
@@ -1320,6 +1641,7 @@ static void EnableFix(HackerDevice *device, void *private_data)
 static void _AnalyseFrameStop()
 {
 	G->analyse_frame = false;
+	FrameAnalysisFlushDumps();
 	if (G->DumpUsage) {
 		EnterCriticalSectionPretty(&G->mCriticalSection);
 			DumpUsage(G->ANALYSIS_PATH);
@@ -1422,6 +1744,35 @@ static void FreezePerf(HackerDevice *device, void *private_data)
 		LogInfoW(L"%s", Profiling::text.c_str());
 }
 
+static void DumpTrace(HackerDevice *device, void *private_data)
+{
+	wchar_t path[MAX_PATH], name[64];
+	SYSTEMTIME time;
+	size_t events;
+	FILE *f;
+
+	if (!Tracing::enabled)
+		return;
+
+	if (!GetModuleFileName(migoto_handle, path, MAX_PATH))
+		return;
+	wcsrchr(path, L'\\')[1] = 0;
+
+	GetLocalTime(&time);
+	_snwprintf_s(name, ARRAYSIZE(name), _TRUNCATE, L"3DMigoto-trace-%04d%02d%02d-%02d%02d%02d.json",
+			time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond);
+	wcscat_s(path, MAX_PATH, name);
+
+	if (_wfopen_s(&f, path, L"w")) {
+		LogOverlay(LOG_WARNING, "Error saving trace to %S\n", path);
+		return;
+	}
+	events = Tracing::export_chrome_trace(f);
+	fclose(f);
+
+	LogOverlay(LOG_INFO, "Saved %Iu trace events to %S\n", events, path);
+}
+
 static void DisableDeferred(HackerDevice *device, void *private_data)
 {
 	if (G->hunting != HUNTING_MODE_ENABLED)
@@ -1853,6 +2204,7 @@ static uint32_t LogRenderTarget(ID3D11Resource *target, char *log_prefix)
 	uint32_t hash = G->mResources[target].hash;
 	uint32_t orig_hash = G->mResources[target].orig_hash;
 	LeaveCriticalSection(&G->mResourcesLock);
+	MergeResourceHashContamination();
 	struct ResourceHashInfo &info = G->mResourceInfo[orig_hash];
 	StrResourceDesc(buf, 256, info);
 	LogInfo("%srender target handle = %p, hash = %08lx, orig_hash = %08lx, %s\n",
@@ -2003,6 +2355,8 @@ void ParseHuntingSection()
 	RegisterIniKeyBinding(L"Hunting", L"monitor_performance", AnalysePerf, NULL, noRepeat, NULL);
 	RegisterIniKeyBinding(L"Hunting", L"freeze_performance_monitor", FreezePerf, NULL, noRepeat, NULL);
 	Profiling::interval = (INT64)(GetIniFloat(L"Hunting", L"monitor_performance_interval", 1.0f, NULL) * 1000000);
+	Tracing::configure((size_t)max(GetIniInt(L"Hunting", L"trace_buffer_size", 0, NULL), 0));
+	RegisterIniKeyBinding(L"Hunting", L"dump_trace", DumpTrace, NULL, noRepeat, NULL);
 
 	// Taking a screenshot does not really belong in the hunting section,
 	// so we no longer make it depend on Hunting, but it still falls under
@@ -2094,6 +2448,8 @@ void ParseHuntingSection()
 			(FrameAnalysisOptionNames, buf, NULL);
 	} else
 		G->def_analyse_options = FrameAnalysisOptions::INVALID;
+	FrameAnalysisConfigureDumps(GetIniInt(L"Hunting", L"analyse_dump_threads", -1, NULL),
+			GetIniInt(L"Hunting", L"analyse_dump_memory_mb", 256, NULL));
 
 	// Quick hacks to see if DX11 features that we only have limited support for are responsible for anything important:
 	RegisterIniKeyBinding(L"Hunting", L"kill_deferred", DisableDeferred, EnableDeferred, noRepeat, NULL);
@@ -3,20 +3,41 @@
 //  It implements all the shader management based on user input via key presses from Input.
 
 #include "HackerDevice.h"
+#include "ShaderCache.h"
+#include "IncludeCache.h"
+
+class DeferredLog;
 
 // Custom #include handler used to track which shaders need to be reloaded after an included file is modified
 class MigotoIncludeHandler : public ID3DInclude
 {
 	std::vector<std::string> dir_stack;
+	std::vector<IncludeFilePtr> open_files;
+	DeferredLog *deferred_log;
 
 	void push_dir(const char *path);
+	void log_info(const char *fmt, ...);
 public:
-	MigotoIncludeHandler(const char *path);
+	// If deferred_log is set any messages will be written there instead
+	// of the log file, for use from CompileJob::compile():
+	MigotoIncludeHandler(const char *path, DeferredLog *deferred_log = NULL);
+
+	// Every file that was included, used to validate the shader cache:
+	ShaderCacheIncludes includes;
+
+	// Records every file that was included in the include_cache so that
+	// reloads can tell if the shader needs to be recompiled:
+	void record_dependencies(const wchar_t *shader);
 
 	STDMETHOD(Open)(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID *ppData, UINT *pBytes);
 	STDMETHOD(Close)(LPCVOID pData);
 };
 
+extern IncludeCache include_cache;
+std::wstring include_cache_path(const wchar_t *path);
+void record_shader_dependencies(const wchar_t *shader, const ShaderCacheIncludes *includes);
+
 void TimeoutHuntingBuffers();
 void ParseHuntingSection();
 void DumpUsage(wchar_t *dir);
+void MergeShaderUsage();
@@ -0,0 +1,138 @@
+#include "IncludeCache.h"
+
+#include <unordered_set>
+
+IncludeCache::IncludeCache(IncludeFileSystem *fs) :
+	fs(fs),
+	pass(1)
+{
+}
+
+void IncludeCache::begin_pass()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	pass++;
+}
+
+// Checks the file against the filesystem if that has not already been done in
+// this pass, discarding the cached contents if it has changed. Must be called
+// with the lock held.
+IncludeCache::Entry* IncludeCache::validate(const std::wstring &path)
+{
+	Entry *entry = &files[path];
+	IncludeFileStat stat;
+
+	if (entry->pass == pass)
+		return entry;
+	entry->pass = pass;
+
+	if (!fs->stat(path, &stat)) {
+		entry->exists = false;
+		entry->file.reset();
+		return entry;
+	}
+
+	if (!entry->exists || entry->stat != stat)
+		entry->file.reset();
+	entry->exists = true;
+	entry->stat = stat;
+
+	return entry;
+}
+
+IncludeFilePtr IncludeCache::open(const std::wstring &path)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	std::shared_ptr<IncludeFile> file;
+	Entry *entry;
+
+	entry = validate(path);
+	if (entry->file)
+		return entry->file;
+	if (!entry->exists)
+		return NULL;
+
+	// Don't hold the lock while reading so that compiles on other threads
+	// aren't held up by this one. If two threads read the same file at the
+	// same time the second to finish wins, which is harmless:
+	guard.unlock();
+	file = std::make_shared<IncludeFile>();
+	if (!fs->read(path, &file->data, &file->stat))
+		return NULL;
+	guard.lock();
+
+	// The map may have been rehashed while we were unlocked:
+	entry = &files[path];
+	entry->file = file;
+	entry->stat = file->stat;
+	entry->exists = true;
+
+	return file;
+}
+
+void IncludeCache::record_dependencies(const std::wstring &shader, const std::vector<std::wstring> &includes)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	std::unordered_set<std::wstring> seen;
+	std::vector<Dependency> deps;
+	Dependency dep;
+	Entry *entry;
+
+	for (const std::wstring &path : includes) {
+		// Headers without include guards can be opened many times:
+		if (!seen.insert(path).second)
+			continue;
+
+		entry = validate(path);
+		dep.path = path;
+		dep.stat = entry->stat;
+		dep.exists = entry->exists;
+		deps.push_back(dep);
+	}
+
+	dependencies[shader] = std::move(deps);
+}
+
+void IncludeCache::forget_dependencies(const std::wstring &shader)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	dependencies.erase(shader);
+}
+
+bool IncludeCache::dependencies_changed(const std::wstring &shader, std::wstring *changed)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	Entry *entry;
+
+	auto i = dependencies.find(shader);
+	if (i == dependencies.end())
+		return false;
+
+	for (const Dependency &dep : i->second) {
+		entry = validate(dep.path);
+		if (entry->exists != dep.exists || (dep.exists && entry->stat != dep.stat)) {
+			if (changed)
+				*changed = dep.path;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+size_t IncludeCache::num_files()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return files.size();
+}
+
+void IncludeCache::clear()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	files.clear();
+	dependencies.clear();
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// Process wide cache of the files opened by MigotoIncludeHandler, and a record
+// of which files each shader included the last time it was compiled.
+//
+// Mods built on a shared library of .hlsl headers can have hundreds of custom
+// shaders including the same handful of files, and previously every
+// D3DCompile call went back to the disk for every one of them. Files are now
+// read once and shared between compiles until their size or last write time
+// changes. The filesystem is only consulted once per "pass" (a frame, a
+// config reload or a shader reload), so a file that is included many times
+// during a reload only costs a single stat.
+//
+// The dependency record is what allows ReloadFixes to recompile a shader that
+// has not been edited itself but includes a file that has been, and lets it
+// skip shaders whose source and includes are all unchanged.
+//
+// Filesystem access goes through the IncludeFileSystem interface, and nothing
+// in here depends on Windows, so the cache and dependency tracking can be
+// exercised against an in-memory filesystem on any platform.
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct IncludeFileStat
+{
+	uint64_t last_write_time;
+	uint64_t size;
+
+	bool operator==(const IncludeFileStat &other) const
+	{
+		return last_write_time == other.last_write_time && size == other.size;
+	}
+	bool operator!=(const IncludeFileStat &other) const
+	{
+		return !(*this == other);
+	}
+};
+
+class IncludeFileSystem
+{
+public:
+	virtual ~IncludeFileSystem() {}
+
+	// Both return false if the file does not exist or cannot be read:
+	virtual bool stat(const std::wstring &path, IncludeFileStat *stat) = 0;
+	virtual bool read(const std::wstring &path, std::vector<char> *data, IncludeFileStat *stat) = 0;
+};
+
+struct IncludeFile
+{
+	std::vector<char> data;
+	IncludeFileStat stat;
+};
+
+// Holders keep the contents alive even if the file is changed and re-read
+// while a compile that opened the old version is still in progress:
+typedef std::shared_ptr<const IncludeFile> IncludeFilePtr;
+
+class IncludeCache
+{
+	struct Entry
+	{
+		IncludeFilePtr file;
+		IncludeFileStat stat;
+		bool exists;
+		unsigned pass;
+
+		Entry() : exists(false), pass(0) {}
+	};
+
+	struct Dependency
+	{
+		std::wstring path;
+		IncludeFileStat stat;
+		bool exists;
+	};
+
+	IncludeFileSystem *fs;
+	std::mutex lock;
+	unsigned pass;
+	std::unordered_map<std::wstring, Entry> files;
+	std::unordered_map<std::wstring, std::vector<Dependency>> dependencies;
+
+	Entry* validate(const std::wstring &path);
+
+public:
+	IncludeCache(IncludeFileSystem *fs);
+
+	// Anything that was checked against the filesystem in a previous pass
+	// will be checked again the next time it is used:
+	void begin_pass();
+
+	// Returns NULL if the file could not be read:
+	IncludeFilePtr open(const std::wstring &path);
+
+	// Replaces the list of files a shader included the last time it was
+	// compiled. The shader is identified by any string the caller likes,
+	// usually the path to its source. Must be called after the includes
+	// were opened, since the state of each file at that time is recorded:
+	void record_dependencies(const std::wstring &shader, const std::vector<std::wstring> &includes);
+	void forget_dependencies(const std::wstring &shader);
+
+	// Returns true if any file the shader included has been modified or
+	// removed since its dependencies were recorded, optionally returning
+	// the first such file. A shader with no recorded dependencies is
+	// treated as unchanged, as is any shader whose includes we could not
+	// track (e.g. those compiled with the standard include handler):
+	bool dependencies_changed(const std::wstring &shader, std::wstring *changed);
+
+	size_t num_files();
+	void clear();
+};
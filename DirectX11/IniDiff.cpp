@@ -0,0 +1,48 @@
+#include "IniDiff.h"
+
+#include <cwctype>
+
+static std::wstring lower_section_name(const std::wstring &section)
+{
+	std::wstring ret(section);
+
+	for (wchar_t &c : ret)
+		c = (wchar_t)std::towlower(c);
+
+	return ret;
+}
+
+void IniSectionHashes::clear()
+{
+	hashes.clear();
+}
+
+void IniSectionHashes::add(const std::wstring &section, uint32_t hash)
+{
+	hashes[lower_section_name(section)] = std::make_pair(section, hash);
+}
+
+IniSectionDiff IniSectionHashes::diff(const IniSectionHashes &newer) const
+{
+	HashMap::const_iterator old_i = hashes.begin();
+	HashMap::const_iterator new_i = newer.hashes.begin();
+	IniSectionDiff ret;
+
+	// Both maps are sorted on the same key, so walk them side by side:
+	while (old_i != hashes.end() || new_i != newer.hashes.end()) {
+		if (new_i == newer.hashes.end() || (old_i != hashes.end() && old_i->first < new_i->first)) {
+			ret.removed.push_back(old_i->second.first);
+			old_i++;
+		} else if (old_i == hashes.end() || new_i->first < old_i->first) {
+			ret.added.push_back(new_i->second.first);
+			new_i++;
+		} else {
+			if (old_i->second.second != new_i->second.second)
+				ret.changed.push_back(new_i->second.first);
+			old_i++;
+			new_i++;
+		}
+	}
+
+	return ret;
+}
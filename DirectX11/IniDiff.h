@@ -0,0 +1,56 @@
+#pragma once
+
+// Section level diff of the ini files, used to make config reloads incremental.
+//
+// Every reload used to tear down and rebuild everything that came from the ini
+// files, which with a few hundred mod inis can take several seconds to tweak a
+// single value. Instead we now keep a hash of the contents of every section
+// from the last time the config was loaded, and on reload compare them against
+// the freshly parsed files to find which sections were added, removed or
+// changed. The caller decides whether it can rebuild just those sections, or
+// whether something changed that needs a full reload.
+//
+// Section names are case insensitive, matching the ini parser. This has no
+// Windows dependencies, so the diffing can be exercised on any platform.
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct IniSectionDiff
+{
+	std::vector<std::wstring> added;
+	std::vector<std::wstring> removed;
+	std::vector<std::wstring> changed;
+
+	bool empty() const
+	{
+		return added.empty() && removed.empty() && changed.empty();
+	}
+
+	size_t size() const
+	{
+		return added.size() + removed.size() + changed.size();
+	}
+};
+
+class IniSectionHashes
+{
+	// Keyed on the lower case section name, storing the name as it was
+	// originally written for logging and lookups:
+	typedef std::map<std::wstring, std::pair<std::wstring, uint32_t>> HashMap;
+
+	HashMap hashes;
+
+public:
+	void clear();
+	void add(const std::wstring &section, uint32_t hash);
+	size_t size() const { return hashes.size(); }
+	void swap(IniSectionHashes &other) { hashes.swap(other.hashes); }
+
+	// Returns the sections that were added, removed or changed in newer
+	// compared to this snapshot, each sorted by their lower case name:
+	IniSectionDiff diff(const IniSectionHashes &newer) const;
+};
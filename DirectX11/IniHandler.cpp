@@ -9,6 +9,7 @@
 #include <memory>
 #include <pcre2.h>
 #include <codecvt>
+#include <io.h>
 
 #include "log.h"
 #include "Globals.h"
@@ -16,6 +17,13 @@
 #include "Hunting.h"
 #include "nvprofile.h"
 #include "ShaderRegex.h"
+#include "ShaderCache.h"
+#include "CompileJobs.h"
+#include "IniDiff.h"
+#include "GlobMatcher.h"
+#include "IniScanner.h"
+#include "SettingsWriter.h"
+#include "InitialDataParser.h"
 #include "cursor.h"
 #include <chrono>
 
@@ -216,6 +224,26 @@ typedef std::map<wstring, IniSection, WStringInsensitiveLess> IniSections;
 
 IniSections ini_sections;
 
+// Hashes of every section as of the last time the config was loaded, compared
+// against on the next reload to find which sections have changed:
+static IniSectionHashes ini_section_hashes;
+
+// Files outside of the ini files that the last full load read (custom shader
+// sources and resource files) are recorded in the include_cache under this id,
+// along with the ids the custom shaders' includes were recorded under. An
+// incremental reload only re-reads the ini files, so it has to fall back to a
+// full reload if any of these have changed:
+#define CONFIG_DEPENDENCIES_ID L"|config"
+static vector<wstring> config_dependency_files;
+static vector<wstring> config_shader_dependencies_ids;
+
+// The Hash= each ShaderOverride and non-fuzzy TextureOverride section was
+// parsed with, so an incremental reload can find the other sections that were
+// merged into the same entry as a changed section:
+typedef std::unordered_map<wstring, UINT64, WStringInsensitiveHash, WStringInsensitiveEquality> IniSectionHashMap;
+static IniSectionHashMap shader_override_section_hashes;
+static IniSectionHashMap texture_override_section_hashes;
+
 // Returns an iterator to the first element in a set that does not begin with
 // prefix in a case insensitive way. Combined with set::lower_bound, this can
 // be used to iterate over all elements in the sections set that begin with a
@@ -236,16 +264,25 @@ static IniSections::iterator prefix_upper_bound(IniSections &sections, wstring &
 // the shaderhackers attention if something needs to be addressed, since their
 // eyes may be focussed elsewhere and may miss the notification message[s].
 static bool ini_warned = false;
+// Set while an incremental reload holds back its warnings until it knows it
+// will not fall back to a full reload, which would show them a second time:
+static DeferredLog *ini_deferred_log = NULL;
 #define IniWarning(fmt, ...) do { \
 	if (G->gShowWarnings) { \
 		ini_warned = true; \
-		LogOverlay(LOG_WARNING, fmt, __VA_ARGS__); \
+		if (ini_deferred_log) \
+			ini_deferred_log->overlay(LOG_WARNING, fmt, __VA_ARGS__); \
+		else \
+			LogOverlay(LOG_WARNING, fmt, __VA_ARGS__); \
 	} \
 } while (0)
 #define IniWarningW(fmt, ...) do { \
 	if (G->gShowWarnings) { \
 		ini_warned = true; \
-		LogOverlayW(LOG_WARNING, fmt, __VA_ARGS__); \
+		if (ini_deferred_log) \
+			ini_deferred_log->overlayw(LOG_WARNING, fmt, __VA_ARGS__); \
+		else \
+			LogOverlayW(LOG_WARNING, fmt, __VA_ARGS__); \
 	} \
 } while (0)
 #define IniWarningBeep() do { \
@@ -696,47 +733,18 @@ static void InsertBuiltInIniSections()
 	ParseIniExcerpt(text);
 }
 
-static pcre2_code* glob_to_regex(wstring &pattern)
+static void globbing_vector_to_matcher(vector<wstring> &globbing_patterns, GlobMatcher *matcher)
 {
-	PCRE2_UCHAR *converted = NULL;
-	PCRE2_SIZE blength = 0;
-	pcre2_code *regex = NULL;
-	string apattern(pattern.begin(), pattern.end());
-	PCRE2_SIZE err_off;
-	int err;
-
-	if (pcre2_pattern_convert((PCRE2_SPTR)apattern.c_str(),
-				apattern.length(), PCRE2_CONVERT_GLOB,
-				&converted, &blength, NULL)) {
-		LogInfo("Bad pattern: exclude_recursive=%S\n", pattern.c_str());
-		return NULL;
-	}
-
-	regex = pcre2_compile(converted, blength, PCRE2_CASELESS, &err, &err_off, NULL);
-	if (!regex)
-		LogInfo("WARNING: exclude_recursive PCRE2 regex compilation failed");
-
-	pcre2_converted_pattern_free(converted);
-	return regex;
-}
-
-static vector<pcre2_code*> globbing_vector_to_regex(vector<wstring> &globbing_patterns)
-{
-	vector<pcre2_code*> ret;
-	pcre2_code *regex;
-
 	for (wstring pattern : globbing_patterns) {
-		regex = glob_to_regex(pattern);
-		if (regex)
-			ret.push_back(regex);
+		switch (matcher->add(string(pattern.begin(), pattern.end()))) {
+			case GlobError::BAD_PATTERN:
+				LogInfo("Bad pattern: exclude_recursive=%S\n", pattern.c_str());
+				break;
+			case GlobError::COMPILE_FAILED:
+				LogInfo("WARNING: exclude_recursive PCRE2 regex compilation failed");
+				break;
+		}
 	}
-
-	return ret;
-}
-
-static void free_globbing_vector(vector<pcre2_code*> &patterns) {
-	for (pcre2_code *regex : patterns)
-		pcre2_code_free(regex);
 }
 
 static string to_utf8(const wstring& wstr) {
@@ -750,10 +758,11 @@ static string to_utf8(const wstring& wstr) {
 	return utf8_str;
 }
 
-static bool matches_globbing_vector(wchar_t *filename, vector<pcre2_code*> &patterns) {
+static bool matches_globbing_vector(const wchar_t *filename, GlobMatcher *exclude) {
 	string afilename;
-	pcre2_match_data *md;
-	int rc;
+
+	if (exclude->empty())
+		return false;
 
 	// In a lot of cases we just use fake conversion to/from wstring,
 	// because we assume the d3dx.ini is ASCII (at some point we should
@@ -762,66 +771,68 @@ static bool matches_globbing_vector(wchar_t *filename, vector<pcre2_code*> &patt
 	// convert it properly to UTF8:
 	afilename = to_utf8(filename); // Replaced deprecated wstring_convert with custom optimized function
 
-	for (pcre2_code *regex : patterns) {
-		md = pcre2_match_data_create_from_pattern(regex, NULL);
-		rc = pcre2_match(regex, (PCRE2_SPTR)afilename.c_str(), PCRE2_ZERO_TERMINATED, 0, 0, md, NULL);
-		pcre2_match_data_free(md);
-		if (rc > 0)
-			return true;
-	}
-
-	return false;
+	return exclude->match(afilename.c_str(), strlen(afilename.c_str()));
 }
 
-static void ParseIniFilesRecursive(wchar_t *migoto_path, const wstring &rel_path, vector<pcre2_code*> &exclude)
+static bool list_ini_directory(const wstring &path, vector<IniScanEntry> *entries)
 {
-	std::set<wstring, WStringInsensitiveLess> ini_files, directories;
 	WIN32_FIND_DATA find_data;
 	HANDLE hFind;
-	wstring search_path, ini_path, ini_namespace;
 
-	search_path = wstring(migoto_path) + rel_path + L"\\*";
-	LogInfo("    Searching \"%S\"\n", search_path.c_str());
+	hFind = FindFirstFile((path + L"\\*").c_str(), &find_data);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return false;
 
-	// We want to make sure the order will be consistent in case of any
-	// interactions between mods, so we read the entire directory, sort it
-	// in a case insensitive manner, then process the matching files &
-	// directories in the same order every time
+	do {
+		entries->push_back({find_data.cFileName,
+			!!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)});
+	} while (FindNextFile(hFind, &find_data));
 
-	hFind = FindFirstFile(search_path.c_str(), &find_data);
-	if (hFind == INVALID_HANDLE_VALUE) {
-		LogInfo("    Recursive include path \"%S\" not found\n", search_path.c_str());
-		return;
-	}
+	FindClose(hFind);
+	return true;
+}
 
-	do {
-		if (matches_globbing_vector(find_data.cFileName, exclude)) {
-			LogInfo("    Excluding \"%S\"\n", find_data.cFileName);
+static bool ini_name_less(const wstring &x, const wstring &y)
+{
+	return WStringInsensitiveLess()(x, y);
+}
+
+static void ParseIniFilesRecursive(wchar_t *migoto_path, const wstring &rel_path, GlobMatcher *exclude)
+{
+	IniDirectoryScanner scanner(list_ini_directory, ini_name_less);
+	vector<IniScanDirectory> directories;
+	wstring search_path, ini_path, ini_namespace;
+
+	// We want to make sure the order will be consistent in case of any
+	// interactions between mods, so the scanner reads every directory,
+	// sorts each in a case insensitive manner, then hands them back in
+	// the same order every time for us to process the matching files:
+	scanner.scan(migoto_path, rel_path,
+		[exclude](const wstring &name) { return matches_globbing_vector(name.c_str(), exclude); },
+		IniDirectoryScanner::default_threads(), &directories);
+
+	for (IniScanDirectory &dir : directories) {
+		search_path = wstring(migoto_path) + dir.rel_path + L"\\*";
+		LogInfo("    Searching \"%S\"\n", search_path.c_str());
+
+		if (!dir.found) {
+			LogInfo("    Recursive include path \"%S\" not found\n", search_path.c_str());
 			continue;
 		}
 
-		if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-			if (wcscmp(find_data.cFileName, L".") && wcscmp(find_data.cFileName, L".."))
-				directories.insert(wstring(find_data.cFileName));
-		} else if (!wcscmp(find_data.cFileName + wcslen(find_data.cFileName) - 4, L".ini")) {
-			ini_files.insert(wstring(find_data.cFileName));
-		} else {
-			LogDebug("    Not a directory or ini file: \"%S\"\n", find_data.cFileName);
+		for (IniScanSkipped &skipped : dir.skipped) {
+			if (skipped.excluded)
+				LogInfo("    Excluding \"%S\"\n", skipped.name.c_str());
+			else
+				LogDebug("    Not a directory or ini file: \"%S\"\n", skipped.name.c_str());
 		}
-	} while (FindNextFile(hFind, &find_data));
-
-	FindClose(hFind);
 
-	for (wstring i: ini_files) {
-		ini_namespace = rel_path + wstring(L"\\") + i;
-		ini_path = wstring(migoto_path) + ini_namespace;
-		LogInfo("    Processing \"%S\"\n", ini_path.c_str());
-		ParseNamespacedIniFile(ini_path.c_str(), &ini_namespace);
-	}
-
-	for (wstring i: directories) {
-		ini_namespace = rel_path + wstring(L"\\") + i;
-		ParseIniFilesRecursive(migoto_path, ini_namespace, exclude);
+		for (wstring &i : dir.ini_files) {
+			ini_namespace = dir.rel_path + wstring(L"\\") + i;
+			ini_path = wstring(migoto_path) + ini_namespace;
+			LogInfo("    Processing \"%S\"\n", ini_path.c_str());
+			ParseNamespacedIniFile(ini_path.c_str(), &ini_namespace);
+		}
 	}
 }
 
@@ -1304,7 +1315,7 @@ static void ParseIncludedIniFiles()
 	std::unordered_set<wstring> seen;
 	wstring namespace_path, rel_path, ini_path;
 	wchar_t migoto_path[MAX_PATH];
-	vector<pcre2_code*> exclude;
+	GlobMatcher exclude;
 	DWORD attrib;
 
 	GetModuleFileName(migoto_handle, migoto_path, MAX_PATH);
@@ -1316,7 +1327,7 @@ static void ParseIncludedIniFiles()
 
 	// Do this before removing [Include] from ini_sections. TODO: Allow
 	// recursively included files to modify the exclude mid-recursion:
-	exclude = globbing_vector_to_regex(GetIniStringMultipleKeys(L"Include", L"exclude_recursive"));
+	globbing_vector_to_matcher(GetIniStringMultipleKeys(L"Include", L"exclude_recursive"), &exclude);
 
 	do {
 		// To safely allow included files to include more files, we
@@ -1358,7 +1369,7 @@ static void ParseIncludedIniFiles()
 					ini_path = wstring(migoto_path) + rel_path;
 					ParseNamespacedIniFile(ini_path.c_str(), &rel_path);
 				} else if (!wcscmp(key->c_str(), L"include_recursive")) {
-					ParseIniFilesRecursive(migoto_path, rel_path, exclude);
+					ParseIniFilesRecursive(migoto_path, rel_path, &exclude);
 				} else if (!wcscmp(key->c_str(), L"exclude_recursive")) {
 					// Handled above
 				} else if (!wcscmp(key->c_str(), L"user_config")) {
@@ -1370,7 +1381,6 @@ static void ParseIncludedIniFiles()
 		}
 	} while (!include_sections.empty());
 
-	free_globbing_vector(exclude);
 
 	// User config is loaded very last to allow it to override all other
 	// ini files.
@@ -1464,125 +1474,57 @@ static void ParsePresetOverrideSections()
 	}
 }
 
-static char* type_to_format(float type)
-{
-	return "%f%n";
-}
-
-static char* type_to_format(unsigned int type)
-{
-	return "%u%n";
-}
-
-static char* type_to_format(signed int type)
-{
-	return "%i%n";
-}
-
-static char* type_to_format(unsigned short type)
-{
-	return "%hu%n";
-}
-
-static char* type_to_format(signed short type)
-{
-	return "%hi%n";
-}
-
-static char* type_to_format(unsigned char type)
-{
-	return "%hhu%n";
-}
-
-static char* type_to_format(signed char type)
-{
-	return "%hhi%n";
-}
-
-template <typename T>
-static std::vector<T> string_to_typed_array(std::istringstream *tokens)
+static void report_initial_data_parse_error(const char *token, const char *end)
 {
-	std::string token;
-	std::vector<T> list;
-	T val = 0;
-	int ret, len;
-	unsigned uval;
-
-	while (std::getline(*tokens, token, ' ')) {
-		if (token.empty())
-			continue;
-
-		ret = sscanf_s(token.c_str(), "0x%x%n", &uval, &len);
-		if (ret != 0 && ret != EOF && len == token.length()) {
-			// Reinterpret the 32bit unsigned integer as whatever
-			// type we are supposed to be returning.
-			// Classic endian bug: This conversion only works in
-			// little-endian when converting to a smaller type
-			list.push_back(*(T*)&uval);
-			continue;
-		}
-
-		ret = sscanf_s(token.c_str(), type_to_format(val), &val, &len);
-		if (ret != 0 && ret != EOF && len == token.length()) {
-			list.push_back(val);
-			continue;
-		}
-
-		IniWarningW(L"String-to-typed-array parse error: %S\n", token.c_str());
-	}
-
-	return list;
+	IniWarningW(L"String-to-typed-array parse error: %S\n", std::string(token, end).c_str());
 }
 
+// The values are parsed straight into the buffer that will hold the initial
+// data, which is sized from the number of tokens up front. This used to go
+// through an istringstream and a vector that was then copied, which was
+// painfully slow for mods embedding large tables in their d3dx.ini.
 template <typename T>
-static void ConstructInitialData(CustomResource *custom_resource, std::istringstream *tokens)
+static void ConstructInitialData(CustomResource *custom_resource, const std::string &data, size_t pos)
 {
-	std::vector<T> vals;
+	size_t count;
+	T *buf;
 
-	vals = string_to_typed_array<T>(tokens);
+	count = count_initial_data_tokens(data, pos);
 
 	// We use malloc() here because the custom resource may realloc() the
 	// buffer to the correct size when substantiating:
-	custom_resource->initial_data_size = sizeof(T) * vals.size();
-	custom_resource->initial_data = malloc(custom_resource->initial_data_size);
+	custom_resource->initial_data = malloc(sizeof(T) * count);
 	if (!custom_resource->initial_data) {
 		IniWarning("ERROR allocating initial data\n");
 		return;
 	}
 
-	memcpy(custom_resource->initial_data, vals.data(), custom_resource->initial_data_size);
+	buf = (T*)custom_resource->initial_data;
+	count = parse_initial_data<T>(data, pos, [&](size_t i, T val) {
+		buf[i] = val;
+	}, report_initial_data_parse_error);
+	custom_resource->initial_data_size = sizeof(T) * count;
 }
 
 
-static void ConstructInitialDataNorm(CustomResource *custom_resource, std::istringstream *tokens, int bytes, bool snorm)
+static void ConstructInitialDataNorm(CustomResource *custom_resource, const std::string &data, size_t pos, int bytes, bool snorm)
 {
-	std::vector<float> vals;
-	union {
-		void *union_buf;
-		unsigned short *unorm16_buf;
-		signed short *snorm16_buf;
-		unsigned char *unorm8_buf;
-		signed char *snorm8_buf;
-	};
-	unsigned i;
-	float val;
+	void *buf;
+	size_t count;
 
-	vals = string_to_typed_array<float>(tokens);
+	count = count_initial_data_tokens(data, pos);
 
 	// We use malloc() here because the custom resource may realloc() the
 	// buffer to the correct size when substantiating:
-	custom_resource->initial_data_size = bytes * vals.size();
-	custom_resource->initial_data = malloc(custom_resource->initial_data_size);
+	custom_resource->initial_data = malloc(bytes * count);
 	if (!custom_resource->initial_data) {
 		IniWarning("ERROR allocating initial data\n");
 		return;
 	}
 
-	union_buf = custom_resource->initial_data;
-
-	for (i = 0; i < vals.size(); i++) {
-		val = vals[i];
+	buf = custom_resource->initial_data;
 
+	count = parse_initial_data<float>(data, pos, [&](size_t i, float val) {
 		if (isnan(val)) {
 			IniWarning("Special value unsupported as normalized integer: %f\n", val);
 			val = 0;
@@ -1598,16 +1540,17 @@ static void ConstructInitialDataNorm(CustomResource *custom_resource, std::istri
 
 		if (bytes == 2) {
 			if (snorm)
-				snorm16_buf[i] = (signed short)(val * 0x7fff);
+				((signed short*)buf)[i] = (signed short)(val * 0x7fff);
 			else
-				unorm16_buf[i] = (unsigned short)(val * 0xffff);
+				((unsigned short*)buf)[i] = (unsigned short)(val * 0xffff);
 		} else {
 			if (snorm)
-				snorm8_buf[i] = (signed char)(val * 0x7f);
+				((signed char*)buf)[i] = (signed char)(val * 0x7f);
 			else
-				unorm8_buf[i] = (unsigned char)(val * 0xff);
+				((unsigned char*)buf)[i] = (unsigned char)(val * 0xff);
 		}
-	}
+	}, report_initial_data_parse_error);
+	custom_resource->initial_data_size = bytes * count;
 }
 
 static void ConstructInitialDataString(CustomResource *custom_resource, std::string *data)
@@ -1640,23 +1583,23 @@ static void ConstructInitialDataString(CustomResource *custom_resource, std::str
 static void ParseResourceInitialData(CustomResource *custom_resource, const wchar_t *section)
 {
 	std::string setting, token;
-	int format_size = 0;
-	int format_type = 0;
 	DXGI_FORMAT format;
+	size_t pos;
 
 	if (!GetIniStringAndLog(section, L"data", NULL, &setting))
 		return;
 
-	std::istringstream tokens(setting);
-
 	switch (custom_resource->override_type) {
 		case CustomResourceType::BUFFER:
 		case CustomResourceType::STRUCTURED_BUFFER:
 		case CustomResourceType::RAW_BUFFER:
+		case CustomResourceType::TEXTURE1D:
+		case CustomResourceType::TEXTURE2D:
+		case CustomResourceType::TEXTURE3D:
+		case CustomResourceType::CUBE:
 			break;
 		default:
-			IniWarningW(L"Initial data currently only supported on buffers\n - [%ls]\n", section);
-			// TODO: Support Textures as well (remember to fill out row/depth pitch)
+			IniWarningW(L"Initial data requires the resource type to be specified\n - [%ls]\n", section);
 			return;
 	}
 
@@ -1677,11 +1620,16 @@ static void ParseResourceInitialData(CustomResource *custom_resource, const wcha
 	// allow formats to be specified elsewhere in the data line to switch
 	// parsing formats on the fly for more complex structured buffers.
 	// e.g. data = R32_FLOAT 1 2 3 4
-	std::getline(tokens, token, ' ');
+	pos = setting.find(' ');
+	token = setting.substr(0, pos);
 	format = ParseFormatString(token.c_str(), false);
 	if (format == (DXGI_FORMAT)-1) {
 		format = custom_resource->override_format;
-		tokens.seekg(0);
+		pos = 0;
+	} else if (pos == std::string::npos) {
+		pos = setting.size();
+	} else {
+		pos++;
 	}
 
 	switch (format) {
@@ -1690,21 +1638,21 @@ static void ParseResourceInitialData(CustomResource *custom_resource, const wcha
 	case DXGI_FORMAT_R32G32_FLOAT:
 	case DXGI_FORMAT_D32_FLOAT:
 	case DXGI_FORMAT_R32_FLOAT:
-		ConstructInitialData<float>(custom_resource, &tokens);
+		ConstructInitialData<float>(custom_resource, setting, pos);
 		break;
 
 	case DXGI_FORMAT_R32G32B32A32_UINT:
 	case DXGI_FORMAT_R32G32B32_UINT:
 	case DXGI_FORMAT_R32G32_UINT:
 	case DXGI_FORMAT_R32_UINT:
-		ConstructInitialData<unsigned int>(custom_resource, &tokens);
+		ConstructInitialData<unsigned int>(custom_resource, setting, pos);
 		break;
 
 	case DXGI_FORMAT_R32G32B32A32_SINT:
 	case DXGI_FORMAT_R32G32B32_SINT:
 	case DXGI_FORMAT_R32G32_SINT:
 	case DXGI_FORMAT_R32_SINT:
-		ConstructInitialData<signed int>(custom_resource, &tokens);
+		ConstructInitialData<signed int>(custom_resource, setting, pos);
 		break;
 
 	// TODO: 16-bit floats:
@@ -1717,25 +1665,25 @@ static void ParseResourceInitialData(CustomResource *custom_resource, const wcha
 	case DXGI_FORMAT_R16G16_UNORM:
 	case DXGI_FORMAT_D16_UNORM:
 	case DXGI_FORMAT_R16_UNORM:
-		ConstructInitialDataNorm(custom_resource, &tokens, 2, false);
+		ConstructInitialDataNorm(custom_resource, setting, pos, 2, false);
 		break;
 
 	case DXGI_FORMAT_R16G16B16A16_SNORM:
 	case DXGI_FORMAT_R16G16_SNORM:
 	case DXGI_FORMAT_R16_SNORM:
-		ConstructInitialDataNorm(custom_resource, &tokens, 2, true);
+		ConstructInitialDataNorm(custom_resource, setting, pos, 2, true);
 		break;
 
 	case DXGI_FORMAT_R16G16B16A16_UINT:
 	case DXGI_FORMAT_R16G16_UINT:
 	case DXGI_FORMAT_R16_UINT:
-		ConstructInitialData<unsigned short>(custom_resource, &tokens);
+		ConstructInitialData<unsigned short>(custom_resource, setting, pos);
 		break;
 
 	case DXGI_FORMAT_R16G16B16A16_SINT:
 	case DXGI_FORMAT_R16G16_SINT:
 	case DXGI_FORMAT_R16_SINT:
-		ConstructInitialData<signed short>(custom_resource, &tokens);
+		ConstructInitialData<signed short>(custom_resource, setting, pos);
 		break;
 
 	case DXGI_FORMAT_R8G8B8A8_UNORM:
@@ -1751,25 +1699,25 @@ static void ParseResourceInitialData(CustomResource *custom_resource, const wcha
 	// or parse it like the A8 versions. Putting off the decision:
 	//	case DXGI_FORMAT_B8G8R8X8_UNORM:
 	//	case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
-		ConstructInitialDataNorm(custom_resource, &tokens, 1, false);
+		ConstructInitialDataNorm(custom_resource, setting, pos, 1, false);
 		break;
 
 	case DXGI_FORMAT_R8G8B8A8_SNORM:
 	case DXGI_FORMAT_R8G8_SNORM:
 	case DXGI_FORMAT_R8_SNORM:
-		ConstructInitialDataNorm(custom_resource, &tokens, 1, true);
+		ConstructInitialDataNorm(custom_resource, setting, pos, 1, true);
 		break;
 
 	case DXGI_FORMAT_R8G8B8A8_UINT:
 	case DXGI_FORMAT_R8G8_UINT:
 	case DXGI_FORMAT_R8_UINT:
-		ConstructInitialData<unsigned char>(custom_resource, &tokens);
+		ConstructInitialData<unsigned char>(custom_resource, setting, pos);
 		break;
 
 	case DXGI_FORMAT_R8G8B8A8_SINT:
 	case DXGI_FORMAT_R8G8_SINT:
 	case DXGI_FORMAT_R8_SINT:
-		ConstructInitialData<signed char>(custom_resource, &tokens);
+		ConstructInitialData<signed char>(custom_resource, setting, pos);
 		break;
 
 	// TODO: case DXGI_FORMAT_R1_UNORM:
@@ -1869,7 +1817,12 @@ static void ParseResourceSections()
 		}
 
 		ParseResourceInitialData(custom_resource, i->first.c_str());
+
+		if (!custom_resource->filename.empty())
+			config_dependency_files.push_back(include_cache_path(custom_resource->filename.c_str()));
 	}
+
+	PrefetchCustomResourceFiles();
 }
 
 static bool ParseCommandListLine(const wchar_t *ini_section,
@@ -2284,77 +2237,89 @@ wchar_t *ShaderOverrideIniKeys[] = {
 	L"filter_index",
 	NULL
 };
-static void ParseShaderOverrideSections()
+static void ParseShaderOverrideSection(const wchar_t *id)
 {
-	IniSections::iterator lower, upper, i;
 	wchar_t setting[MAX_PATH];
-	const wchar_t *id;
 	ShaderOverride *override;
 	UINT64 hash;
 	bool duplicate, found;
 	bool disable_scissor;
 
-	// Lock entire routine. This can be re-inited live.  These shaderoverrides
-	// are unlikely to be changing much, but for consistency.
-	//  We actually already lock the entire config reload, so this is redundant -DSS
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+	LogInfo("[%S]\n", id);
 
-	G->mShaderOverrideMap.clear();
+	hash = GetIniHash(id, L"Hash", 0, &found);
+	if (!found) {
+		IniWarningW(L"Section missing Hash=\n - [%ls]\n", id);
+		return;
+	}
+	shader_override_section_hashes[id] = hash;
 
-	lower = ini_sections.lower_bound(wstring(L"ShaderOverride"));
-	upper = prefix_upper_bound(ini_sections, wstring(L"ShaderOverride"));
-	for (i = lower; i != upper; i++) {
-		id = i->first.c_str();
+	duplicate = !!G->mShaderOverrideMap.count(hash);
+	override = &G->mShaderOverrideMap[hash];
+	if (!duplicate)
+		override->first_ini_section = id;
 
-		LogInfo("[%S]\n", id);
+	check_shaderoverride_duplicates(duplicate, id, override, hash);
 
-		hash = GetIniHash(id, L"Hash", 0, &found);
-		if (!found) {
-			IniWarningW(L"Section missing Hash=\n - [%ls]\n", id);
-			continue;
-		}
+	override->depth_filter = GetIniEnumClass(id, L"depth_filter", DepthBufferFilter::NONE, NULL, DepthBufferFilterNames);
+
+	// Simple partner shader filtering. Deprecated - more advanced
+	// filtering can be achieved by setting an ini param in the
+	// partner's [ShaderOverride] section, or the below filter_index
+	override->partner_hash = GetIniHash(id, L"partner", 0, NULL);
 
-		duplicate = !!G->mShaderOverrideMap.count(hash);
-		override = &G->mShaderOverrideMap[hash];
-		if (!duplicate)
-			override->first_ini_section = id;
+	// Superior partner shader filtering that also supports a bound/unbound case
+	override->filter_index = GetIniFloat(id, L"filter_index", FLT_MAX, NULL);
+	// Backup version not affected by ShaderRegex:
+	override->backup_filter_index = override->filter_index;
 
-		check_shaderoverride_duplicates(duplicate, id, override, hash);
+	if (GetIniStringAndLog(id, L"model", 0, setting, MAX_PATH)) {
+		wcstombs(override->model, setting, ARRAYSIZE(override->model));
+		override->model[ARRAYSIZE(override->model) - 1] = '\0';
+	}
 
-		override->depth_filter = GetIniEnumClass(id, L"depth_filter", DepthBufferFilter::NONE, NULL, DepthBufferFilterNames);
+	ParseCommandList(id, &override->command_list, &override->post_command_list, ShaderOverrideIniKeys);
 
-		// Simple partner shader filtering. Deprecated - more advanced
-		// filtering can be achieved by setting an ini param in the
-		// partner's [ShaderOverride] section, or the below filter_index
-		override->partner_hash = GetIniHash(id, L"partner", 0, NULL);
+	// For backwards compatibility with Nier Automata fix,
+	// translate disable_scissor into an equivalent command list:
+	disable_scissor = GetIniBool(id, L"disable_scissor", false, &found);
+	if (found) {
+		wstring ini_namespace;
+		get_section_namespace(id, &ini_namespace);
 
-		// Superior partner shader filtering that also supports a bound/unbound case
-		override->filter_index = GetIniFloat(id, L"filter_index", FLT_MAX, NULL);
-		// Backup version not affected by ShaderRegex:
-		override->backup_filter_index = override->filter_index;
+		if (disable_scissor)
+			ParseCommandListLine(id, L"run", L"builtincustomshaderdisablescissorclipping", NULL, &override->command_list, &ini_namespace);
+		else
+			ParseCommandListLine(id, L"run", L"builtincustomshaderenablescissorclipping", NULL, &override->command_list, &ini_namespace);
+	}
 
-		if (GetIniStringAndLog(id, L"model", 0, setting, MAX_PATH)) {
-			wcstombs(override->model, setting, ARRAYSIZE(override->model));
-			override->model[ARRAYSIZE(override->model) - 1] = '\0';
-		}
+	warn_deprecated_shaderoverride_options(id, override);
+}
 
-		ParseCommandList(id, &override->command_list, &override->post_command_list, ShaderOverrideIniKeys);
+static void ParseShaderOverrideSections()
+{
+	IniSections::iterator lower, upper, i;
 
-		// For backwards compatibility with Nier Automata fix,
-		// translate disable_scissor into an equivalent command list:
-		disable_scissor = GetIniBool(id, L"disable_scissor", false, &found);
-		if (found) {
-			wstring ini_namespace;
-			get_section_namespace(id, &ini_namespace);
+	// Lock entire routine. This can be re-inited live.  These shaderoverrides
+	// are unlikely to be changing much, but for consistency.
+	//  We actually already lock the entire config reload, so this is redundant -DSS
+	EnterCriticalSectionPretty(&G->mCriticalSection);
 
-			if (disable_scissor)
-				ParseCommandListLine(id, L"run", L"builtincustomshaderdisablescissorclipping", NULL, &override->command_list, &ini_namespace);
-			else
-				ParseCommandListLine(id, L"run", L"builtincustomshaderenablescissorclipping", NULL, &override->command_list, &ini_namespace);
-		}
+	G->mShaderOverrideMap.clear();
+	G->shader_override_generation++;
+	shader_override_section_hashes.clear();
+
+	lower = ini_sections.lower_bound(wstring(L"ShaderOverride"));
+	upper = prefix_upper_bound(ini_sections, wstring(L"ShaderOverride"));
+	for (i = lower; i != upper; i++)
+		ParseShaderOverrideSection(i->first.c_str());
+
+	// Rebuild the table compactly now that it has been populated, since
+	// it is looked up several times in every draw call. Leave a little
+	// headroom for ShaderRegex, which adds ShaderOverrides at runtime as
+	// matching shaders are created, to avoid rehashing mid-frame:
+	G->mShaderOverrideMap.compact(64);
 
-		warn_deprecated_shaderoverride_options(id, override);
-	}
 	LeaveCriticalSection(&G->mCriticalSection);
 }
 
@@ -3175,14 +3140,73 @@ static void warn_if_duplicate_texture_hash(TextureOverride *override, uint32_t h
 	}
 }
 
-static void ParseTextureOverrideSections()
+static void ParseTextureOverrideSection(const wchar_t *id)
 {
-	IniSections::iterator lower, upper, i;
-	const wchar_t *id;
 	TextureOverride *override;
 	uint32_t hash;
 	bool found;
 
+	LogInfo("[%S]\n", id);
+
+	hash = (uint32_t)GetIniHash(id, L"Hash", 0, &found);
+	if (!found) {
+		if (texture_override_section_has_fuzzy_match_keys(id)) {
+			parse_texture_override_fuzzy_match(id);
+			return;
+		}
+
+		IniWarningW(L"Section missing Hash= or valid match options\n - [%ls]\n", id);
+		return;
+	}
+	texture_override_section_hashes[id] = hash;
+
+	if (texture_override_section_has_fuzzy_match_keys(id))
+		IniWarningW(L"Cannot use hash= and match options together!\n - [%ls]\n", id);
+
+	G->mTextureOverrideMap[hash].emplace_back(); // C++ gotcha: invalidates pointers into the vector
+	override = &G->mTextureOverrideMap[hash].back();
+	override->ini_section = id;
+
+	// Important that we do *not* register the command lists yet:
+	parse_texture_override_common(id, override, false);
+
+	// Warn if same hash is used two or more times in sections that
+	// do not have a draw context match or match_priority:
+	warn_if_duplicate_texture_hash(override, hash);
+}
+
+static void FinaliseTextureOverrideList(TextureOverrideList *list)
+{
+	// Sort the TextureOverride sections sharing the same hash to ensure we
+	// get consistent results when processing them. TextureOverrideLess
+	// will sort by priority first and ini section name second. We can't
+	// use a std::set to keep this sorted, because std::set makes it const,
+	// but the TextureOverride will be mutated later and that just becomes
+	// a horrible mess. We could do a more efficient insertion sort, but
+	// given this cost is only paid on launch and config reload I'd rather
+	// keep the sorting down here at the end:
+	std::sort(list->begin(), list->end(), TextureOverrideLess);
+
+	// We cannot register the non-fuzzy TextureOverride command lists
+	// automatically when parsing them like we do for other command lists,
+	// because the command lists will move around in memory as more
+	// TextureOverride sections are added to the vector, and again when the
+	// vector is sorted... Thanks C++
+	//
+	// Might be worthwhile considering changing the data structure to hold
+	// pointers so it can rearrange the pointers however it likes without
+	// changing the TextureOverrides they point to, similar to how the
+	// CommandList data structures work.
+	for (TextureOverride &to : *list) {
+		registered_command_lists.push_back(&to.command_list);
+		registered_command_lists.push_back(&to.post_command_list);
+	}
+}
+
+static void ParseTextureOverrideSections()
+{
+	IniSections::iterator lower, upper, i;
+
 	// Lock entire routine, this can be re-inited.  These shaderoverrides
 	// are unlikely to be changing much, but for consistency.
 	//  We actually already lock the entire config reload, so this is redundant -DSS
@@ -3190,68 +3214,19 @@ static void ParseTextureOverrideSections()
 
 	G->mTextureOverrideMap.clear();
 	G->mFuzzyTextureOverrides.clear();
+	texture_override_section_hashes.clear();
 
 	lower = ini_sections.lower_bound(wstring(L"TextureOverride"));
 	upper = prefix_upper_bound(ini_sections, wstring(L"TextureOverride"));
 
-	for (i = lower; i != upper; i++) {
-		id = i->first.c_str();
+	for (i = lower; i != upper; i++)
+		ParseTextureOverrideSection(i->first.c_str());
 
-		LogInfo("[%S]\n", id);
+	for (auto &tolkv : G->mTextureOverrideMap)
+		FinaliseTextureOverrideList(&tolkv.second);
 
-		hash = (uint32_t)GetIniHash(id, L"Hash", 0, &found);
-		if (!found) {
-			if (texture_override_section_has_fuzzy_match_keys(id)) {
-				parse_texture_override_fuzzy_match(id);
-				continue;
-			}
-
-			IniWarningW(L"Section missing Hash= or valid match options\n - [%ls]\n", id);
-			continue;
-		}
-
-		if (texture_override_section_has_fuzzy_match_keys(id))
-			IniWarningW(L"Cannot use hash= and match options together!\n - [%ls]\n", id);
-
-		G->mTextureOverrideMap[hash].emplace_back(); // C++ gotcha: invalidates pointers into the vector
-		override = &G->mTextureOverrideMap[hash].back();
-		override->ini_section = id;
-
-		// Important that we do *not* register the command lists yet:
-		parse_texture_override_common(id, override, false);
-
-		// Warn if same hash is used two or more times in sections that
-		// do not have a draw context match or match_priority:
-		warn_if_duplicate_texture_hash(override, hash);
-	}
-
-	for (auto &tolkv : G->mTextureOverrideMap) {
-		// Sort the TextureOverride sections sharing the same hash to
-		// ensure we get consistent results when processing them.
-		// TextureOverrideLess will sort by priority first and ini
-		// section name second. We can't use a std::set to keep this
-		// sorted, because std::set makes it const, but the
-		// TextureOverride will be mutated later and that just becomes
-		// a horrible mess. We could do a more efficient insertion
-		// sort, but given this cost is only paid on launch and config
-		// reload I'd rather keep the sorting down here at the end:
-		std::sort(tolkv.second.begin(), tolkv.second.end(), TextureOverrideLess);
-
-		// We cannot register the non-fuzzy TextureOverride command
-		// lists automatically when parsing them like we do for other
-		// command lists, because the command lists will move around in
-		// memory as more TextureOverride sections are added to the
-		// vector, and again when the vector is sorted... Thanks C++
-		//
-		// Might be worthwhile considering changing the data structure
-		// to hold pointers so it can rearrange the pointers however it
-		// likes without changing the TextureOverrides they point to,
-		// similar to how the CommandList data structures work.
-		for (TextureOverride &to : tolkv.second) {
-			registered_command_lists.push_back(&to.command_list);
-			registered_command_lists.push_back(&to.post_command_list);
-		}
-	}
+	// Nothing else adds to this table after the ini has been parsed:
+	G->mTextureOverrideMap.compact(0);
 
 	LeaveCriticalSection(&G->mCriticalSection);
 }
@@ -3909,9 +3884,12 @@ static void ParseCustomShaderSections()
 	const wstring *shader_id;
 	CustomShader *custom_shader;
 	wchar_t setting[MAX_PATH];
-	bool failed;
+	bool *failed;
 	wstring namespace_path;
+	CompileJobQueue queue;
+	unordered_map<CustomShader*, bool> failed_sections;
 
+	// Queue up all the shaders first so they can be compiled in parallel:
 	for (i = customShaders.begin(); i != customShaders.end(); i++) {
 		shader_id = &i->first;
 		custom_shader = &i->second;
@@ -3920,7 +3898,7 @@ static void ParseCustomShaderSections()
 		// to use the original case, but not a big deal:
 		LogInfoW(L"[%s]\n", shader_id->c_str());
 
-		failed = false;
+		failed = &failed_sections[custom_shader];
 
 		// Flags is currently just applied to every shader in the chain
 		// because it's so rarely needed and it doesn't really matter.
@@ -3933,19 +3911,42 @@ static void ParseCustomShaderSections()
 		get_namespaced_section_path(i->first.c_str(), &namespace_path);
 
 		if (GetIniString(shader_id->c_str(), L"vs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('v', setting, shader_id, &namespace_path);
+			custom_shader->compile('v', setting, shader_id, &namespace_path, &queue, failed);
 		if (GetIniString(shader_id->c_str(), L"hs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('h', setting, shader_id, &namespace_path);
+			custom_shader->compile('h', setting, shader_id, &namespace_path, &queue, failed);
 		if (GetIniString(shader_id->c_str(), L"ds", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('d', setting, shader_id, &namespace_path);
+			custom_shader->compile('d', setting, shader_id, &namespace_path, &queue, failed);
 		if (GetIniString(shader_id->c_str(), L"gs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('g', setting, shader_id, &namespace_path);
+			custom_shader->compile('g', setting, shader_id, &namespace_path, &queue, failed);
 		if (GetIniString(shader_id->c_str(), L"ps", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('p', setting, shader_id, &namespace_path);
+			custom_shader->compile('p', setting, shader_id, &namespace_path, &queue, failed);
 		if (GetIniString(shader_id->c_str(), L"cs", 0, setting, MAX_PATH))
-			failed |= custom_shader->compile('c', setting, shader_id, &namespace_path);
+			custom_shader->compile('c', setting, shader_id, &namespace_path, &queue, failed);
+	}
+
+	// Any compilation errors are logged in the same order the shaders
+	// were queued, regardless of which finished compiling first:
+	if (!queue.empty()) {
+		LogInfo("Compiling %Iu custom shaders...\n", queue.size());
+		queue.run(CompileJobQueue::default_threads());
+	}
 
-		if (failed) {
+	// Forget compiled shaders that were not needed this time so they don't
+	// accumulate as shaders are edited and the config is reloaded:
+	expire_compiled_custom_shaders();
+
+	for (i = customShaders.begin(); i != customShaders.end(); i++) {
+		for (wstring &path : i->second.source_files)
+			config_dependency_files.push_back(include_cache_path(path.c_str()));
+		for (wstring &id : i->second.dependencies_ids)
+			config_shader_dependencies_ids.push_back(include_cache_path(id.c_str()));
+	}
+
+	for (i = customShaders.begin(); i != customShaders.end(); i++) {
+		shader_id = &i->first;
+		custom_shader = &i->second;
+
+		if (failed_sections[custom_shader]) {
 			// Don't want to allow a shader to be run if it had an
 			// error since we are likely to call Draw or Dispatch.
 			// We used to erase this from the customShaders map, but
@@ -3958,6 +3959,8 @@ static void ParseCustomShaderSections()
 			continue;
 		}
 
+		LogInfoW(L"[%s]\n", shader_id->c_str());
+
 		ParseBlendState(custom_shader, shader_id->c_str());
 		ParseDepthStencilState(custom_shader, shader_id->c_str());
 		ParseRSState(custom_shader, shader_id->c_str());
@@ -4127,6 +4130,40 @@ static void warn_of_conflicting_d3dx(wchar_t *dll_ini_path)
 			"Using this configuration: %S\n", dll_ini_path);
 }
 
+// Only allow an incremental reload once the config has been loaded in full
+// with all the included files, since the reload forced after a delayed
+// initialisation must always be a full one:
+static bool incremental_reload_possible = false;
+
+static void HashIniSections(IniSectionHashes *hashes)
+{
+	IniSections::iterator i;
+	IniSectionVector::iterator entry;
+	uint32_t hash;
+
+	hashes->clear();
+	for (i = ini_sections.begin(); i != ini_sections.end(); i++) {
+		// Not hash_ini_section(), which only covers the first half of
+		// each line since it passes the length in characters as bytes.
+		// That can't be changed without invalidating the ShaderRegex
+		// cache, but here a change anywhere in a line must be seen:
+		hash = crc32c_hw(0, i->first.c_str(), i->first.size() * sizeof(wchar_t));
+		for (entry = i->second.kv_vec.begin(); entry < i->second.kv_vec.end(); entry++)
+			hash = crc32c_hw(hash, entry->raw_line.c_str(), (entry->raw_line.size() + 1) * sizeof(wchar_t));
+
+		// References are resolved relative to the namespace of the
+		// section, or of each line in global sections like [Present],
+		// so moving an unchanged section to another file counts as a
+		// change:
+		hash = crc32c_hw(hash, i->second.ini_namespace.c_str(), i->second.ini_namespace.size() * sizeof(wchar_t));
+		hash = crc32c_hw(hash, i->second.ini_path.c_str(), i->second.ini_path.size() * sizeof(wchar_t));
+		for (entry = i->second.kv_vec.begin(); entry < i->second.kv_vec.end(); entry++)
+			hash = crc32c_hw(hash, entry->ini_namespace.c_str(), entry->ini_namespace.size() * sizeof(wchar_t));
+
+		hashes->add(i->first, hash);
+	}
+}
+
 void LoadConfigFile()
 {
 	wchar_t iniFile[MAX_PATH], logFilename[MAX_PATH];
@@ -4179,6 +4216,13 @@ void LoadConfigFile()
 		LogInfo("    unbuffered return: %d\n", unbuffered);
 	}
 
+	// Format log messages into per-thread buffers and write them out from a
+	// background thread, so logging doesn't stall the render thread:
+	if (LogFile && GetIniBool(L"Logging", L"async", false, NULL))
+		AsyncLog::start(LogFile, GetIniInt(L"Logging", L"async_buffer_size", 256 * 1024, NULL), 100);
+	else if (AsyncLog::enabled)
+		AsyncLog::stop();
+
 	// Set the CPU affinity based upon d3dx.ini setting.  Useful for debugging and shader hunting in AC3.
 	if (GetIniBool(L"Logging", L"force_cpu_affinity", false, NULL))
 	{
@@ -4224,6 +4268,9 @@ void LoadConfigFile()
 		ParseIncludedIniFiles();
 	}
 
+	HashIniSections(&ini_section_hashes);
+	incremental_reload_possible = G->gConfigInitialized;
+
 	// [System]
 	LogInfo("[System]\n");
 	GetIniStringAndLog(L"System", L"proxy_d3d11", 0, G->CHAIN_DLL_PATH, MAX_PATH);	
@@ -4320,6 +4367,9 @@ void LoadConfigFile()
 	}
 
 	G->CACHE_SHADERS = GetIniBool(L"Rendering", L"cache_shaders", false, NULL);
+	load_shader_cache();
+	// Any included files will be checked for changes when first used:
+	include_cache.begin_pass();
 	G->SCISSOR_DISABLE = GetIniBool(L"Rendering", L"rasterizer_disable_scissor", false, NULL);
 	G->track_texture_updates = GetIniBoolOrInt(L"Rendering", L"track_texture_updates", 0, NULL);
 	G->assemble_signature_comments = GetIniBool(L"Rendering", L"assemble_signature_comments", false, NULL);
@@ -4333,6 +4383,13 @@ void LoadConfigFile()
 	G->EXPORT_BINARY = GetIniBool(L"Rendering", L"export_binary", false, NULL);
 	G->DumpUsage = GetIniBool(L"Rendering", L"dump_usage", false, NULL);
 
+	G->resource_pool_expire_frames = GetIniInt(L"Rendering", L"resource_pool_expire_frames", 0, NULL);
+	G->resource_pool_budget = (size_t)GetIniInt(L"Rendering", L"resource_pool_budget_mb", 0, NULL) << 20;
+	G->resource_pool_global_budget = (size_t)GetIniInt(L"Rendering", L"resource_pool_global_budget_mb", 0, NULL) << 20;
+
+	ConfigureCustomResourceLoader(GetIniInt(L"Rendering", L"resource_load_threads", -1, NULL),
+			GetIniInt(L"Rendering", L"resource_load_memory_mb", 256, NULL));
+
 	G->StereoParamsReg = GetIniInt(L"Rendering", L"stereo_params", 125, NULL);
 	G->IniParamsReg = GetIniInt(L"Rendering", L"ini_params", 120, NULL);
 	G->decompiler_settings.StereoParamsReg = G->StereoParamsReg;
@@ -4462,6 +4519,9 @@ void LoadConfigFile()
 	// [Preset]s may refer to:
 	EnumeratePresetOverrideSections();
 
+	config_dependency_files.clear();
+	config_shader_dependencies_ids.clear();
+
 	// Must be done before any command lists that may refer to them:
 	ParseResourceSections();
 
@@ -4477,6 +4537,9 @@ void LoadConfigFile()
 	// Used to have to do CustomShaders before other command lists in case
 	// any failed and had their sections erased, but no longer matters.
 	ParseCustomShaderSections();
+
+	// Remembers the state of every external file as of now:
+	include_cache.record_dependencies(CONFIG_DEPENDENCIES_ID, config_dependency_files);
 	ParseExplicitCommandListSections();
 
 	ParseShaderOverrideSections();
@@ -4566,40 +4629,88 @@ void LoadProfileManagerConfig(const wchar_t *config_dir)
 	LogInfo("\n");
 }
 
-void SavePersistentSettings()
+static bool write_settings_file(const wstring &path, const string &data)
 {
 	FILE *f;
+	bool ok;
+
+	wfopen_ensuring_access(&f, path.c_str(), L"w");
+	if (!f)
+		return false;
+
+	ok = fwrite(data.c_str(), 1, data.size(), f) == data.size();
+	ok = !fflush(f) && ok;
+	// Make sure the data is on disk before the rename can be:
+	ok = !_commit(_fileno(f)) && ok;
+	ok = !fclose(f) && ok;
+
+	if (!ok)
+		DeleteFile(path.c_str());
+	return ok;
+}
+
+static bool replace_settings_file(const wstring &src, const wstring &dest)
+{
+	if (MoveFileEx(src.c_str(), dest.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		return true;
+
+	DeleteFile(src.c_str());
+	return false;
+}
+
+static PersistentSettingsWriter settings_writer(write_settings_file, replace_settings_file);
+
+static void log_settings_write_results()
+{
+	vector<SettingsWriteResult> results;
+
+	settings_writer.take_results(&results);
+	for (SettingsWriteResult &result : results) {
+		switch (result.status) {
+			case SettingsWriteStatus::WRITE_FAILED:
+				LogInfo("Unable to save settings in %S\n", result.path.c_str());
+				break;
+			case SettingsWriteStatus::REPLACE_FAILED:
+				LogInfo("Unable to replace %S with the new settings\n", result.path.c_str());
+				break;
+		}
+	}
+}
+
+// Called periodically from the present thread, where the file is written in
+// the background, and before reloading the config or unloading, where wait
+// is set to make sure it has been written before returning:
+void SavePersistentSettings(bool wait)
+{
+	vector<PersistentSetting> settings;
+	bool force, saved;
 
 	G->gSettingsSaveTime = G->gTime;
 
+	log_settings_write_results();
+
 	if (!G->user_config_dirty)
 		return;
-	G->user_config_dirty = 0;
 
-	// TODO: Ability to update existing file rather than overwriting:
-	//wfopen_ensuring_access(&f, G->user_config.c_str(), L"r+");
-	//if (!f)
-	wfopen_ensuring_access(&f, G->user_config.c_str(), L"w");
-	if (!f) {
-		LogInfo("Unable to save settings in %S\n", G->user_config.c_str());
-		return;
-	}
+	// The second bit is set to remove unknown entries from the file even
+	// if none of the variables have changed:
+	force = !!(G->user_config_dirty & 2);
+	G->user_config_dirty = 0;
 
-	LogInfo("Saving user settings to %S\n", G->user_config.c_str());
+	settings.reserve(persistent_variables.size());
+	for (auto global : persistent_variables)
+		settings.push_back({global->name, global->fval});
 
-	fputs("; AUTOMATICALLY GENERATED FILE - DO NOT EDIT\n"
-	      ";\n"
-	      "; 3DMigoto will overwrite this file whenever any persistent settings are\n"
-	      "; altered by hot key or command list. Tag global variables with the \"persist\"\n"
-	      "; keyword to save them in this file. Use the post keyword in the [Constants]\n"
-	      "; command list if you need to do any intialisation after this file is loaded.\n"
-	      ";\n"
-	      "[Constants]\n", f);
+	if (wait)
+		saved = settings_writer.save_now(G->user_config, std::move(settings), force);
+	else
+		saved = settings_writer.save(G->user_config, std::move(settings), force);
 
-	for (auto global : persistent_variables)
-		fprintf_s(f, "%ls = %.9g\n", global->name.c_str(), global->fval);
+	if (saved)
+		LogInfo("Saving user settings to %S\n", G->user_config.c_str());
 
-	fclose(f);
+	if (wait)
+		log_settings_write_results();
 }
 
 static void WipeUserConfig()
@@ -4607,6 +4718,10 @@ static void WipeUserConfig()
 	G->gWipeUserConfig = false;
 	G->user_config_dirty = 0;
 
+	// Don't let a save still in flight put the file back:
+	settings_writer.discard();
+	log_settings_write_results();
+
 	DeleteFile(G->user_config.c_str());
 }
 
@@ -4629,21 +4744,301 @@ static void MarkAllShadersDeferredUnprocessed()
 	// and just update the ShaderOverrides & filter_index
 }
 
+static bool section_has_prefix(const wstring &section, const wchar_t *prefix)
+{
+	return !_wcsnicmp(section.c_str(), prefix, wcslen(prefix));
+}
+
+// Reads the Hash= of a section without logging or warning about it, for
+// working out which entries an incremental reload needs to rebuild before
+// the sections are parsed for real:
+static bool PeekIniHash(const wstring &section, UINT64 *hash)
+{
+	std::string val;
+	int len;
+
+	if (!GetIniString(section.c_str(), L"Hash", NULL, &val))
+		return false;
+
+	return sscanf_s(val.c_str(), "%16llx%n", hash, &len) == 1 && len == val.length();
+}
+
+// Checks that every section that has been added, removed or changed is one we
+// know how to rebuild on its own. Anything else (global settings, resources,
+// custom shaders, command lists, presets, keys, etc) can be referred to from
+// or influence any number of other sections, so needs a full reload:
+static bool CanReloadIncrementally(const IniSectionDiff &diff)
+{
+	UINT64 hash;
+
+	// ShaderRegex adds ShaderOverrides of its own as matching shaders are
+	// created, which we could not tell apart from those in the ini files:
+	if (!shader_regex_groups.empty()) {
+		LogInfo("  ShaderRegex in use, performing full reload\n");
+		return false;
+	}
+
+	for (const wstring &section : diff.removed) {
+		if (section_has_prefix(section, L"ShaderOverride"))
+			continue;
+		if (section_has_prefix(section, L"TextureOverride") && texture_override_section_hashes.count(section))
+			continue;
+		LogInfo("  [%S] removed, performing full reload\n", section.c_str());
+		return false;
+	}
+
+	for (const wstring &section : diff.added) {
+		if (section_has_prefix(section, L"ShaderOverride"))
+			continue;
+		if (section_has_prefix(section, L"TextureOverride") && PeekIniHash(section, &hash))
+			continue;
+		LogInfo("  [%S] added, performing full reload\n", section.c_str());
+		return false;
+	}
+
+	// Fuzzy matched TextureOverrides are not keyed on a hash, so we
+	// cannot find the entry to rebuild for them:
+	for (const wstring &section : diff.changed) {
+		if (section_has_prefix(section, L"ShaderOverride"))
+			continue;
+		if (section_has_prefix(section, L"TextureOverride")
+				&& texture_override_section_hashes.count(section)
+				&& PeekIniHash(section, &hash))
+			continue;
+		LogInfo("  [%S] changed, performing full reload\n", section.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Works out which hashes the added, removed and changed sections with the
+// given prefix contributed to before and after the reload, and which sections
+// need to be parsed again to rebuild those entries. That includes unchanged
+// sections that share a hash with a changed one, so that duplicates are merged
+// in the same order as in a full reload:
+static void FindOverridesToRebuild(const wchar_t *prefix, const IniSectionDiff &diff,
+		IniSectionHashMap *section_hashes, std::unordered_set<UINT64> *hashes,
+		vector<wstring> *sections)
+{
+	IniSections::iterator lower, upper, i;
+	IniSectionHashMap::iterator old_hash;
+	IniSectionSet modified;
+	UINT64 hash;
+
+	for (const wstring &section : diff.removed) {
+		if (section_has_prefix(section, prefix))
+			modified.insert(section);
+	}
+	for (const wstring &section : diff.added) {
+		if (section_has_prefix(section, prefix))
+			modified.insert(section);
+	}
+	for (const wstring &section : diff.changed) {
+		if (section_has_prefix(section, prefix))
+			modified.insert(section);
+	}
+
+	for (const wstring &section : modified) {
+		old_hash = section_hashes->find(section);
+		if (old_hash != section_hashes->end()) {
+			hashes->insert(old_hash->second);
+			section_hashes->erase(old_hash);
+		}
+		if (PeekIniHash(section, &hash))
+			hashes->insert(hash);
+	}
+
+	lower = ini_sections.lower_bound(wstring(prefix));
+	upper = prefix_upper_bound(ini_sections, wstring(prefix));
+	for (i = lower; i != upper; i++) {
+		if (modified.count(i->first)) {
+			sections->push_back(i->first);
+			continue;
+		}
+		old_hash = section_hashes->find(i->first);
+		if (old_hash != section_hashes->end() && hashes->count(old_hash->second))
+			sections->push_back(i->first);
+	}
+}
+
+static void ReloadShaderOverrideSections(const IniSectionDiff &diff)
+{
+	std::unordered_set<UINT64> hashes;
+	vector<wstring> sections;
+
+	FindOverridesToRebuild(L"ShaderOverride", diff, &shader_override_section_hashes, &hashes, &sections);
+	if (hashes.empty() && sections.empty())
+		return;
+
+	for (UINT64 hash : hashes)
+		G->mShaderOverrideMap.erase(hash);
+	G->shader_override_generation++;
+
+	for (wstring &section : sections)
+		ParseShaderOverrideSection(section.c_str());
+
+	G->mShaderOverrideMap.compact(64);
+}
+
+static void ReloadTextureOverrideSections(const IniSectionDiff &diff)
+{
+	std::unordered_set<UINT64> hashes;
+	vector<wstring> sections;
+	TextureOverrideMap::iterator list;
+
+	FindOverridesToRebuild(L"TextureOverride", diff, &texture_override_section_hashes, &hashes, &sections);
+	if (hashes.empty() && sections.empty())
+		return;
+
+	for (UINT64 hash : hashes)
+		G->mTextureOverrideMap.erase((uint32_t)hash);
+
+	for (wstring &section : sections)
+		ParseTextureOverrideSection(section.c_str());
+
+	for (UINT64 hash : hashes) {
+		list = G->mTextureOverrideMap.find((uint32_t)hash);
+		if (list != G->mTextureOverrideMap.end())
+			FinaliseTextureOverrideList(&list->second);
+	}
+
+	G->mTextureOverrideMap.compact(0);
+}
+
+// Checks if any file the last full load read from outside of the ini files has
+// been modified, created or removed since:
+static bool ConfigDependenciesChanged()
+{
+	wstring changed;
+
+	// Check everything against the filesystem again, even if it has
+	// already been looked at this frame:
+	include_cache.begin_pass();
+
+	if (include_cache.dependencies_changed(CONFIG_DEPENDENCIES_ID, &changed)) {
+		LogInfo("  %S changed, performing full reload\n", changed.c_str());
+		return true;
+	}
+
+	if (config_shader_dependencies_ids.empty())
+		return false;
+
+	// We can't tell if files included via the standard include handler
+	// have changed:
+	if (G->recursive_include == -1) {
+		LogInfo("  Custom shader includes are not tracked, performing full reload\n");
+		return true;
+	}
+
+	for (wstring &id : config_shader_dependencies_ids) {
+		if (include_cache.dependencies_changed(id, &changed)) {
+			LogInfo("  %S changed, performing full reload\n", changed.c_str());
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Re-reads the ini files and compares every section against the last time the
+// config was loaded. If only ShaderOverride and hash based TextureOverride
+// sections have changed, just the entries those sections contribute to are
+// rebuilt and only their command lists are optimised, which is much faster
+// than a full reload with a large number of mods installed. Returns false if
+// a full reload is required instead:
+static bool ReloadChangedIniSections(HackerDevice *device)
+{
+	wchar_t iniFile[MAX_PATH];
+	IniSectionHashes new_hashes;
+	IniSectionDiff diff;
+	DeferredLog deferred_log;
+	bool cto_pre, cto_post;
+	bool ret = false;
+
+	if (!incremental_reload_possible)
+		return false;
+
+	if (!GetModuleFileName(migoto_handle, iniFile, MAX_PATH))
+		return false;
+	wcsrchr(iniFile, L'\\')[1] = 0;
+	wcscat(iniFile, INI_FILENAME);
+
+	// Hold back any warnings until we know we will not be falling back
+	// to a full reload, which would repeat them:
+	ini_deferred_log = &deferred_log;
+
+	ParseIniFile(iniFile);
+	InsertBuiltInIniSections();
+	ParseIncludedIniFiles();
+
+	HashIniSections(&new_hashes);
+	diff = ini_section_hashes.diff(new_hashes);
+
+	// Reloading with nothing changed in the ini files is how the user
+	// asks for files they have edited elsewhere to be picked up, so
+	// always do that in full:
+	if (diff.empty()) {
+		LogInfo("  No sections changed, performing full reload\n");
+		goto out;
+	}
+
+	if (!CanReloadIncrementally(diff))
+		goto out;
+
+	if (ConfigDependenciesChanged())
+		goto out;
+
+	LogInfo("Incremental reload: %Iu sections added, %Iu removed, %Iu changed\n",
+			diff.added.size(), diff.removed.size(), diff.changed.size());
+
+	// Must be done prior to parsing any command list sections, as every
+	// section registered in this set will be optimised:
+	registered_command_lists.clear();
+
+	ReloadShaderOverrideSections(diff);
+	ReloadTextureOverrideSections(diff);
+
+	// The optimiser removes checktextureoverride commands from every
+	// command list if every TextureOverride has an empty command list.
+	// If that has changed either way, the command lists we haven't
+	// touched are missing ones they now need or still have ones a full
+	// reload would have removed:
+	cto_pre = cto_pre_optimised_out;
+	cto_post = cto_post_optimised_out;
+	optimise_command_lists(device);
+	if (cto_pre != cto_pre_optimised_out || cto_post != cto_post_optimised_out) {
+		LogInfo("  checktextureoverride optimisation changed, performing full reload\n");
+		goto out;
+	}
+
+	ini_section_hashes.swap(new_hashes);
+	ret = true;
+out:
+	ini_deferred_log = NULL;
+	if (ret) {
+		deferred_log.flush();
+		emit_ini_warning_tone();
+	}
+	return ret;
+}
+
 void ReloadConfig(HackerDevice *device)
 {
 	auto start = std::chrono::high_resolution_clock::now();
+	bool incremental;
 
 	HackerContext *mHackerContext = device->GetHackerContext();
+	bool wiped = G->gWipeUserConfig;
 
-	if (G->gWipeUserConfig)
+	if (wiped)
 		WipeUserConfig();
 
-	SavePersistentSettings();
+	SavePersistentSettings(true);
 
 	LogInfoW(L"Reloading " INI_FILENAME L" (EXPERIMENTAL)...\n");
 
 	G->gReloadConfigPending = false;
-	G->iniParamsReserved = 0;
 
 	// Lock the entire config reload as it touches many global structures
 	// that could potentially be accessed from other threads (e.g. deferred
@@ -4660,37 +5055,49 @@ void ReloadConfig(HackerDevice *device)
 	// of these actually takes effect in the current frame.
 	ClearNotices();
 
-	// Clear the key bindings. There may be other things that need to be
-	// cleared as well, but for the sake of clarity I'd rather clear as
-	// many as possible inside LoadConfigFile() where they are set.
-	ClearKeyBindings();
-
 	// Clear active command lists set, as the pointers in this set will
 	// become invalid as the config is reloaded:
 	command_lists_profiling.clear();
 	command_lists_cmd_profiling.clear();
 
-	// Reset the counters on the global parameter save area:
-	OverrideSave.Reset(device);
+	// Wiping the user config resets every persistent variable, which
+	// only a full reload and InitIniParams will do:
+	incremental = !wiped && ReloadChangedIniSections(device);
+	if (!incremental) {
+		G->iniParamsReserved = 0;
 
-	LoadConfigFile();
-	optimise_command_lists(device);
+		// Clear the key bindings. There may be other things that need
+		// to be cleared as well, but for the sake of clarity I'd rather
+		// clear as many as possible inside LoadConfigFile() where they
+		// are set.
+		ClearKeyBindings();
+
+		// Reset the counters on the global parameter save area:
+		OverrideSave.Reset(device);
 
-	MarkAllShadersDeferredUnprocessed();
+		LoadConfigFile();
+		optimise_command_lists(device);
+
+		MarkAllShadersDeferredUnprocessed();
+	}
 
 	LeaveCriticalSection(&G->mCriticalSection);
 
 	// Execute the [Constants] command list in the immediate context to
 	// initialise iniParams and perform any other custom initialisation the
-	// user may have defined:
+	// user may have defined. An incremental reload leaves [Constants] and
+	// the current values alone, unless a changed section used an IniParam
+	// beyond the end of the buffer:
 	if (mHackerContext) {
 		if (G->iniParams.size() != G->iniParamsReserved) {
 			LogInfo("  Resizing IniParams from %Ii to %d\n", G->iniParams.size(), G->iniParamsReserved);
 			device->CreateIniParamResources();
 			mHackerContext->Bind3DMigotoResources();
+			incremental = false;
 		}
 
-		mHackerContext->InitIniParams();
+		if (!incremental)
+			mHackerContext->InitIniParams();
 	} else {
 		// We used to use GetImmediateContext here, which would ensure
 		// that the HackerContext had been created if it didn't exist
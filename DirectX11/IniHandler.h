@@ -5,7 +5,7 @@ void FlagConfigReload(HackerDevice *device, void *private_data);
 void LoadConfigFile();
 void ReloadConfig(HackerDevice *device);
 void LoadProfileManagerConfig(const wchar_t *config_dir);
-void SavePersistentSettings();
+void SavePersistentSettings(bool wait=false);
 
 struct IniLine {
 	// Same syntax as std::pair, whitespace stripped around each:
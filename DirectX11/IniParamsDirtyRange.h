@@ -0,0 +1,85 @@
+#pragma once
+
+// Tracks which IniParams have been modified since the IniParams resource was
+// last updated on the GPU by the immediate context. Changes are coalesced into
+// a single range of texels [first, last), so that typically only a handful of
+// texels need to be uploaded instead of the entire resource.
+//
+// Params may be changed from command lists running on any context, so this
+// has its own lock, initialised in InitD311() with the other global locks.
+// take() is called after every command list on the immediate context, so it
+// checks the dirty flag before taking the lock. That read is unlocked, which
+// relies on MSVC giving volatile accesses acquire/release semantics on x86
+// and x64, and a stale value only means a change that is still being marked
+// is picked up by the next flush.
+//
+// This expects lock.h to have been included first (globals.h does), so that
+// it can be tested with a stand in for the Windows critical sections.
+
+struct IniParamsDirtyRange
+{
+	CRITICAL_SECTION lock;
+	volatile bool dirty;
+	UINT first, last;
+
+	IniParamsDirtyRange() :
+		dirty(false),
+		first(UINT_MAX),
+		last(0)
+	{}
+
+	void mark(UINT idx)
+	{
+		EnterCriticalSectionPretty(&lock);
+
+		if (idx < first)
+			first = idx;
+		if (idx + 1 > last)
+			last = idx + 1;
+		dirty = true;
+
+		LeaveCriticalSection(&lock);
+	}
+
+	void mark_all(UINT size)
+	{
+		EnterCriticalSectionPretty(&lock);
+
+		first = 0;
+		last = size;
+		dirty = true;
+
+		LeaveCriticalSection(&lock);
+	}
+
+	void clear()
+	{
+		EnterCriticalSectionPretty(&lock);
+
+		first = UINT_MAX;
+		last = 0;
+		dirty = false;
+
+		LeaveCriticalSection(&lock);
+	}
+
+	// Returns and clears the range, clamped in case IniParams were
+	// resized since it was marked. Returns false if it was empty:
+	bool take(UINT size, UINT *first, UINT *last)
+	{
+		if (!dirty)
+			return false;
+
+		EnterCriticalSectionPretty(&lock);
+
+		*first = this->first;
+		*last = this->last < size ? this->last : size;
+		this->first = UINT_MAX;
+		this->last = 0;
+		dirty = false;
+
+		LeaveCriticalSection(&lock);
+
+		return *first < *last;
+	}
+};
@@ -0,0 +1,152 @@
+#include "IniScanner.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+struct IniScanNode
+{
+	IniScanDirectory dir;
+	std::vector<size_t> children;
+};
+
+IniDirectoryScanner::IniDirectoryScanner(IniDirectoryLister lister, IniNameLess less) :
+	lister(lister),
+	less(less)
+{}
+
+unsigned IniDirectoryScanner::default_threads()
+{
+	// This is almost entirely waiting on the file system, so a handful of
+	// threads is enough to keep it busy without competing with the game:
+	return std::min(std::max(std::thread::hardware_concurrency(), 1u), 8u);
+}
+
+static bool is_ini_file(const std::wstring &name)
+{
+	return name.size() >= 4 && !name.compare(name.size() - 4, 4, L".ini");
+}
+
+// Sorts the same way inserting into a std::set with the same comparison did,
+// including keeping the first of any names that compare equal:
+static void sort_names(std::vector<std::wstring> *names, IniNameLess less)
+{
+	std::stable_sort(names->begin(), names->end(), less);
+	names->erase(std::unique(names->begin(), names->end(),
+		[less](const std::wstring &x, const std::wstring &y) {
+			return !less(x, y) && !less(y, x);
+		}), names->end());
+}
+
+void IniDirectoryScanner::scan(const std::wstring &base, const std::wstring &rel_path,
+		const IniScanExclude &exclude, unsigned max_threads,
+		std::vector<IniScanDirectory> *directories)
+{
+	std::mutex lock, exclude_lock;
+	std::condition_variable cv;
+	std::deque<IniScanNode> nodes;
+	std::deque<size_t> queue;
+	std::vector<std::thread> threads;
+	std::vector<size_t> stack;
+	size_t pending = 1;
+	size_t i, idx;
+
+	nodes.emplace_back();
+	nodes.back().dir.rel_path = rel_path;
+	queue.push_back(0);
+
+	max_threads = std::max(max_threads, 1u);
+
+	std::function<void()> worker = [&]() {
+		std::unique_lock<std::mutex> guard(lock);
+		std::vector<IniScanEntry> entries;
+		std::vector<std::wstring> subdirs;
+		IniScanNode *node;
+		size_t idx;
+
+		while (true) {
+			cv.wait(guard, [&]() { return !queue.empty() || !pending; });
+			if (queue.empty())
+				return;
+
+			idx = queue.front();
+			queue.pop_front();
+			// std::deque never moves its elements when it grows:
+			node = &nodes[idx];
+			guard.unlock();
+
+			entries.clear();
+			subdirs.clear();
+			node->dir.found = lister(base + node->dir.rel_path, &entries);
+
+			{
+				std::lock_guard<std::mutex> exclude_guard(exclude_lock);
+
+				for (IniScanEntry &entry : entries) {
+					if (exclude(entry.name)) {
+						node->dir.skipped.push_back({entry.name, true});
+						continue;
+					}
+
+					if (entry.directory) {
+						if (entry.name != L"." && entry.name != L"..")
+							subdirs.push_back(entry.name);
+					} else if (is_ini_file(entry.name)) {
+						node->dir.ini_files.push_back(entry.name);
+					} else {
+						node->dir.skipped.push_back({entry.name, false});
+					}
+				}
+			}
+
+			sort_names(&node->dir.ini_files, less);
+			sort_names(&subdirs, less);
+
+			guard.lock();
+
+			for (std::wstring &subdir : subdirs) {
+				node->children.push_back(nodes.size());
+				queue.push_back(nodes.size());
+				nodes.emplace_back();
+				nodes.back().dir.rel_path = node->dir.rel_path + L"\\" + subdir;
+				pending++;
+			}
+			pending--;
+
+			// Threads are only started once there is more work queued
+			// than there are threads to do it, so scanning a folder
+			// with no subdirectories never starts any:
+			try {
+				while (threads.size() + 1 < max_threads && queue.size() > threads.size())
+					threads.emplace_back(worker);
+			} catch (const std::system_error&) {
+				max_threads = (unsigned)threads.size() + 1;
+			}
+
+			cv.notify_all();
+		}
+	};
+
+	worker();
+
+	// Nothing is left to start new threads once the calling thread has
+	// run out of work:
+	for (std::thread &thread : threads)
+		thread.join();
+
+	// Put the directories back in the order the depth first walk visited
+	// them - each directory followed by each of its subdirectories in turn:
+	directories->clear();
+	directories->reserve(nodes.size());
+	stack.push_back(0);
+	while (!stack.empty()) {
+		idx = stack.back();
+		stack.pop_back();
+		directories->push_back(std::move(nodes[idx].dir));
+		for (i = nodes[idx].children.size(); i > 0; i--)
+			stack.push_back(nodes[idx].children[i - 1]);
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// Discovery of the ini files under an include_recursive directory.
+//
+// The directory tree used to be walked depth first on the calling thread,
+// listing each directory, sorting it, parsing its ini files and only then
+// moving on to list its subdirectories, so the time spent waiting on the file
+// system added up across every directory of a large mod collection.
+//
+// Now the whole tree is listed up front by a few threads sharing a queue of
+// directories, each of which queues the subdirectories it finds as soon as it
+// has listed them. Once everything has been listed the directories are put
+// back in the order the old depth first walk visited them, with the ini files
+// and subdirectories of each sorted by the same case insensitive comparison,
+// so the caller can log and parse them exactly as it did before and mods that
+// interact with each other still load in the same order on every run.
+//
+// Nothing that is listed is acted on until the scan has finished, and the
+// exclude filter is applied during the scan so that excluded directories are
+// never listed at all. Parsing an ini file cannot change the exclusions, so
+// the result is the same as interleaving the two.
+//
+// This has no Windows dependencies - the directory listing and the name
+// comparison are passed in as functions, so the scan can be checked against
+// an in-memory directory tree on any platform.
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct IniScanEntry
+{
+	std::wstring name;
+	bool directory;
+};
+
+// Lists every entry in a directory, in whatever order the file system
+// returns them, including "." and ".." if it returns those. Returns false if
+// the directory could not be opened. Called on several threads at once:
+typedef bool (*IniDirectoryLister)(const std::wstring &path, std::vector<IniScanEntry> *entries);
+
+// Case insensitive ordering used to sort each directory:
+typedef bool (*IniNameLess)(const std::wstring &x, const std::wstring &y);
+
+// Returns true if the file or directory should be skipped. Only called from
+// one thread at a time, so it does not need to be thread safe:
+typedef std::function<bool(const std::wstring &name)> IniScanExclude;
+
+struct IniScanSkipped
+{
+	std::wstring name;
+	bool excluded;          // Otherwise it was not a directory or ini file
+};
+
+struct IniScanDirectory
+{
+	std::wstring rel_path;
+	bool found;
+
+	// Entries that were left out, in the order they were listed so that
+	// they can be logged in the same order as before:
+	std::vector<IniScanSkipped> skipped;
+
+	// Sorted, with names that only differ by case listed once:
+	std::vector<std::wstring> ini_files;
+};
+
+class IniDirectoryScanner
+{
+	IniDirectoryLister lister;
+	IniNameLess less;
+
+public:
+	IniDirectoryScanner(IniDirectoryLister lister, IniNameLess less);
+
+	// Lists base + rel_path and everything below it using up to
+	// max_threads threads, including the calling thread. The directories
+	// are returned in the order a depth first walk visits them, with each
+	// rel_path built by appending "\" and the subdirectory name:
+	void scan(const std::wstring &base, const std::wstring &rel_path,
+			const IniScanExclude &exclude, unsigned max_threads,
+			std::vector<IniScanDirectory> *directories);
+
+	static unsigned default_threads();
+};
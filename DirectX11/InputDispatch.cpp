@@ -0,0 +1,131 @@
+#include "InputDispatch.h"
+
+#include <algorithm>
+
+InputDispatcher::InputDispatcher() :
+	watched_gamepads(0),
+	frame(0),
+	dispatch_all(false)
+{}
+
+void InputDispatcher::Add(InputActionBase *action)
+{
+	uint32_t idx = (uint32_t)actions.size();
+	InputWatch watch;
+	int vkey, i;
+
+	action->GetWatchedInputs(&watch);
+
+	for (i = 0; i < (int)watch.keys.size(); i++) {
+		vkey = watch.keys[i] & (INPUT_NUM_KEYS - 1);
+
+		// A key can appear more than once in the same binding
+		// (e.g. "no_modifiers ctrl"), only listen to it once:
+		if (!key_listeners[vkey].empty() && key_listeners[vkey].back() == idx)
+			continue;
+		if (key_listeners[vkey].empty())
+			watched_keys.push_back(vkey);
+		key_listeners[vkey].push_back(idx);
+	}
+
+	for (i = 0; i < INPUT_NUM_GAMEPADS; i++) {
+		if (watch.gamepads & (1 << i))
+			gamepad_listeners[i].push_back(idx);
+	}
+	watched_gamepads |= watch.gamepads;
+
+	actions.push_back(action);
+	queued_frame.push_back(0);
+
+	// Newly added actions have never seen the current state of their
+	// inputs, so they all get evaluated on the next dispatch:
+	dispatch_all = true;
+}
+
+void InputDispatcher::Clear()
+{
+	int i;
+
+	actions.clear();
+	for (i = 0; i < INPUT_NUM_KEYS; i++)
+		key_listeners[i].clear();
+	for (i = 0; i < INPUT_NUM_GAMEPADS; i++)
+		gamepad_listeners[i].clear();
+	watched_keys.clear();
+	watched_gamepads = 0;
+	polling.clear();
+	queue.clear();
+	queued_frame.clear();
+	dispatch_all = false;
+}
+
+void InputDispatcher::Queue(uint32_t idx)
+{
+	if (queued_frame[idx] == frame)
+		return;
+	queued_frame[idx] = frame;
+	queue.push_back(idx);
+}
+
+bool InputDispatcher::Dispatch(HackerDevice *device, InputSource *source)
+{
+	InputSnapshot previous = current;
+	bool input_processed = false;
+	std::vector<uint32_t>::iterator i;
+	uint64_t now;
+	int vkey, j;
+
+	if (actions.empty())
+		return false;
+
+	source->Poll(&current, watched_keys, watched_gamepads);
+	now = source->GetTickCount();
+
+	// The generation stamp avoids clearing queued_frame every frame. On
+	// the off chance it wraps, reset it so no stale stamp can match:
+	if (++frame == 0) {
+		std::fill(queued_frame.begin(), queued_frame.end(), 0);
+		frame = 1;
+	}
+	queue.clear();
+
+	if (dispatch_all) {
+		for (j = 0; j < (int)actions.size(); j++)
+			Queue(j);
+		dispatch_all = false;
+	} else {
+		for (j = 0; j < (int)watched_keys.size(); j++) {
+			vkey = watched_keys[j];
+			if (current.keys[vkey] == previous.keys[vkey])
+				continue;
+			for (i = key_listeners[vkey].begin(); i != key_listeners[vkey].end(); i++)
+				Queue(*i);
+		}
+
+		for (j = 0; j < INPUT_NUM_GAMEPADS; j++) {
+			if (!(watched_gamepads & (1 << j)))
+				continue;
+			if (!(current.gamepads[j] != previous.gamepads[j]))
+				continue;
+			for (i = gamepad_listeners[j].begin(); i != gamepad_listeners[j].end(); i++)
+				Queue(*i);
+		}
+
+		for (i = polling.begin(); i != polling.end(); i++)
+			Queue(*i);
+
+		// Bindings can share listeners (e.g. several keys cycling the
+		// same [KeyOverride] presets), so preserve the order they
+		// would have been dispatched in before:
+		std::sort(queue.begin(), queue.end());
+	}
+
+	polling.clear();
+	for (i = queue.begin(); i != queue.end(); i++) {
+		input_processed |= actions[*i]->Dispatch(device, current, now);
+		if (actions[*i]->NeedsPolling(current))
+			polling.push_back(*i);
+	}
+
+	return input_processed;
+}
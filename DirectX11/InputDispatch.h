@@ -0,0 +1,120 @@
+#pragma once
+
+// Snapshot based dispatch of input events to key bindings.
+//
+// Mods can register hundreds of key bindings (more again with [KeyOverride]
+// presets cycling through many values), and we used to evaluate every one of
+// them every frame, with each binding querying the state of each of its keys
+// individually. Instead, we now take a snapshot of the state of every key any
+// binding is watching once per frame, and keep an index from each key (and
+// each controller) to the actions watching it, so that only actions whose
+// inputs changed since the last frame need to be evaluated. Actions whose
+// state depends on time as well (auto-repeat and delays) ask to be evaluated
+// every frame while they have something pending.
+//
+// Where the snapshot comes from is abstracted behind InputSource, so this has
+// no Windows dependencies and can be exercised with scripted key sequences on
+// any platform.
+
+#include <stdint.h>
+#include <bitset>
+#include <vector>
+
+class HackerDevice;
+
+struct InputGamepadState {
+	bool connected;
+	uint16_t buttons;
+	uint8_t left_trigger;
+	uint8_t right_trigger;
+
+	bool operator!=(const InputGamepadState &other) const
+	{
+		return connected != other.connected
+			|| buttons != other.buttons
+			|| left_trigger != other.left_trigger
+			|| right_trigger != other.right_trigger;
+	}
+};
+
+static const int INPUT_NUM_KEYS = 256;
+static const int INPUT_NUM_GAMEPADS = 4;
+
+// The state of all watched inputs at the start of a frame:
+struct InputSnapshot {
+	std::bitset<INPUT_NUM_KEYS> keys;
+	InputGamepadState gamepads[INPUT_NUM_GAMEPADS];
+
+	InputSnapshot() : gamepads() {}
+
+	bool KeyDown(int vkey) const
+	{
+		return keys[vkey & (INPUT_NUM_KEYS - 1)];
+	}
+};
+
+// The set of inputs an action depends on:
+struct InputWatch {
+	std::vector<int> keys;
+	unsigned gamepads; // Bit mask of controllers
+
+	InputWatch() : gamepads(0) {}
+};
+
+class InputSource {
+public:
+	virtual ~InputSource() {}
+
+	// Updates the snapshot with the current state of the given keys and
+	// controllers. Inputs that are not updated keep their previous state:
+	virtual void Poll(InputSnapshot *snapshot, const std::vector<int> &keys, unsigned gamepads) = 0;
+
+	// Milliseconds from an arbitrary starting point:
+	virtual uint64_t GetTickCount() = 0;
+};
+
+class InputActionBase {
+public:
+	virtual ~InputActionBase() {}
+
+	virtual void GetWatchedInputs(InputWatch *watch) = 0;
+
+	// Returns true if an event was dispatched:
+	virtual bool Dispatch(HackerDevice *device, const InputSnapshot &input, uint64_t now) = 0;
+
+	// Returns true if this action needs to be evaluated again on the next
+	// frame even if none of its inputs change, e.g. to auto-repeat:
+	virtual bool NeedsPolling(const InputSnapshot&) { return false; }
+};
+
+class InputDispatcher {
+	std::vector<InputActionBase*> actions;
+	std::vector<uint32_t> key_listeners[INPUT_NUM_KEYS];
+	std::vector<uint32_t> gamepad_listeners[INPUT_NUM_GAMEPADS];
+	std::vector<int> watched_keys;
+	unsigned watched_gamepads;
+
+	InputSnapshot current;
+	std::vector<uint32_t> polling;
+	std::vector<uint32_t> queue;
+	std::vector<uint32_t> queued_frame;
+	uint32_t frame;
+	bool dispatch_all;
+
+	void Queue(uint32_t idx);
+
+public:
+	InputDispatcher();
+
+	// Does not take ownership of the action, which must stay alive until
+	// Clear() is called:
+	void Add(InputActionBase *action);
+	void Clear();
+
+	// Polls the input source and dispatches events to any actions whose
+	// state may have changed, in the order they were added. Returns true
+	// if any events were dispatched:
+	bool Dispatch(HackerDevice *device, InputSource *source);
+
+	size_t size() const { return actions.size(); }
+};
@@ -926,3 +926,80 @@ void LogOverlay(LogLevel level, char *fmt, ...)
 
 	va_end(ap);
 }
+
+void DeferredLog::add(int level, const char *fmt, va_list ap)
+{
+	Message msg;
+	va_list ap_len;
+	int len;
+
+	va_copy(ap_len, ap);
+	len = _vscprintf(fmt, ap_len);
+	va_end(ap_len);
+	if (len < 0)
+		return;
+
+	msg.level = level;
+	msg.text.resize(len + 1);
+	_vsnprintf_s(&msg.text[0], len + 1, _TRUNCATE, fmt, ap);
+	msg.text.resize(len);
+	messages.push_back(std::move(msg));
+}
+
+void DeferredLog::vinfo(const char *fmt, va_list ap)
+{
+	// Don't bother formatting messages nobody will see:
+	if (LogFile)
+		add(-1, fmt, ap);
+}
+
+void DeferredLog::info(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vinfo(fmt, ap);
+	va_end(ap);
+}
+
+void DeferredLog::overlay(LogLevel level, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	add(level, fmt, ap);
+	va_end(ap);
+}
+
+void DeferredLog::overlayw(LogLevel level, const wchar_t *fmt, ...)
+{
+	Message msg;
+	va_list ap, ap_len;
+	int len;
+
+	va_start(ap, fmt);
+	va_copy(ap_len, ap);
+	len = _vscwprintf(fmt, ap_len);
+	va_end(ap_len);
+	if (len >= 0) {
+		msg.level = level;
+		msg.wtext.resize(len + 1);
+		_vsnwprintf_s(&msg.wtext[0], len + 1, _TRUNCATE, fmt, ap);
+		msg.wtext.resize(len);
+		messages.push_back(std::move(msg));
+	}
+	va_end(ap);
+}
+
+void DeferredLog::flush()
+{
+	for (Message &msg : messages) {
+		if (msg.level < 0)
+			LogInfo("%s", msg.text.c_str());
+		else if (!msg.wtext.empty())
+			LogOverlayW((LogLevel)msg.level, L"%ls", msg.wtext.c_str());
+		else
+			LogOverlay((LogLevel)msg.level, "%s", msg.text.c_str());
+	}
+	messages.clear();
+}
@@ -120,3 +120,28 @@ public:
 void ClearNotices();
 void LogOverlayW(LogLevel level, wchar_t *fmt, ...);
 void LogOverlay(LogLevel level, char *fmt, ...);
+
+// Collects messages for the log file and overlay from code running on a
+// worker thread, so that they can be written out later from the main thread
+// in a consistent order. Also used to hold back messages that should only be
+// shown if the work that produced them is kept:
+class DeferredLog
+{
+	struct Message
+	{
+		int level; // LogLevel, or -1 for the log file only
+		std::string text;
+		std::wstring wtext; // Used instead of text for wide messages
+	};
+	std::vector<Message> messages;
+
+	void add(int level, const char *fmt, va_list ap);
+public:
+	void info(const char *fmt, ...);
+	void vinfo(const char *fmt, va_list ap);
+	void overlay(LogLevel level, const char *fmt, ...);
+	void overlayw(LogLevel level, const wchar_t *fmt, ...);
+
+	// Writes out and discards everything collected so far:
+	void flush();
+};
@@ -362,10 +362,7 @@ bool Override::MatchesCurrent(HackerDevice *device)
 	float val;
 
 	for (i = begin(mOverrideParams); i != end(mOverrideParams); i++) {
-		std::map<OverrideParam, OverrideTransitionParam>::iterator transition = CurrentTransition.params.find(i->first);
-		if (transition != CurrentTransition.params.end() && transition->second.time != -1)
-			val = transition->second.target;
-		else
+		if (!CurrentTransition.params.GetTarget(i->first, &val))
 			val = G->iniParams[i->first.idx].*i->first.component;
 
 		if (i->second != val)
@@ -373,10 +370,7 @@ bool Override::MatchesCurrent(HackerDevice *device)
 	}
 
 	for (j = begin(mOverrideVars); j != end(mOverrideVars); j++) {
-		std::map<CommandListVariable*, OverrideTransitionParam>::iterator transition = CurrentTransition.vars.find(j->first);
-		if (transition != CurrentTransition.vars.end() && transition->second.time != -1)
-			val = transition->second.target;
-		else
+		if (!CurrentTransition.vars.GetTarget(j->first, &val))
 			val = j->first->fval;
 
 		if (j->second != val)
@@ -490,24 +484,6 @@ void KeyOverrideCycleBack::DownEvent(HackerDevice *device)
 	return cycle->BackEvent(device);
 }
 
-// In order to change the iniParams, we need to map them back to system memory so that the CPU
-// can change the values, then remap them back to the GPU where they can be accessed by shader code.
-// This map/unmap code also requires that the texture be created with the D3D11_USAGE_DYNAMIC flag set.
-// This map operation can also cause the GPU to stall, so this should be done as rarely as possible.
-
-static void UpdateIniParams(HackerDevice* wrapper)
-{
-	ID3D11DeviceContext1* realContext = wrapper->GetPassThroughOrigContext1();
-	D3D11_MAPPED_SUBRESOURCE mappedResource;
-
-	if (wrapper->mIniTexture) {
-		realContext->Map(wrapper->mIniTexture, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		memcpy(mappedResource.pData, G->iniParams.data(), sizeof(DirectX::XMFLOAT4) * G->iniParams.size());
-		realContext->Unmap(wrapper->mIniTexture, 0);
-		Profiling::iniparams_updates++;
-	}
-}
-
 std::vector<CommandList*> pending_post_command_lists;
 
 void Override::Activate(HackerDevice *device, bool override_has_deactivate_condition)
@@ -635,18 +611,6 @@ static void _ScheduleTransition(struct OverrideTransitionParam *transition,
 	transition->time = time;
 	transition->transition_type = transition_type;
 }
-// FIXME: Clean up the wide vs sensible string mess and remove this duplicate function:
-static void _ScheduleTransition(struct OverrideTransitionParam *transition,
-		const wchar_t *name, float current, float val, ULONGLONG now, int time,
-		TransitionType transition_type)
-{
-	LogInfoNoNL(" %S: %#.2g -> %#.2g", name, current, val);
-	transition->start = current;
-	transition->target = val;
-	transition->activation_time = now;
-	transition->time = time;
-	transition->transition_type = transition_type;
-}
 
 void OverrideTransition::ScheduleTransition(HackerDevice *wrapper,
 		float target_separation, float target_convergence,
@@ -657,7 +621,6 @@ void OverrideTransition::ScheduleTransition(HackerDevice *wrapper,
 	ULONGLONG now = GetTickCount64();
 	NvAPI_Status err;
 	float current;
-	char buf[8];
 	OverrideParams::iterator i;
 	OverrideVars::iterator j;
 
@@ -681,13 +644,13 @@ void OverrideTransition::ScheduleTransition(HackerDevice *wrapper,
 		_ScheduleTransition(&convergence, "convergence", current, target_convergence, now, time, transition_type);
 	}
 	for (i = targets->begin(); i != targets->end(); i++) {
-		StringCchPrintfA(buf, 8, "%c%.0i", i->first.chr(), i->first.idx);
-		_ScheduleTransition(&params[i->first], buf, G->iniParams[i->first.idx].*i->first.component,
-				i->second, now, time, transition_type);
+		current = G->iniParams[i->first.idx].*i->first.component;
+		LogInfoNoNL(" %c%.0i: %#.2g -> %#.2g", i->first.chr(), i->first.idx, current, i->second);
+		params.Schedule(i->first, current, i->second, now, time, transition_type);
 	}
 	for (j = var_targets->begin(); j != var_targets->end(); j++) {
-		_ScheduleTransition(&vars[j->first], j->first->name.c_str(), j->first->fval,
-				j->second, now, time, transition_type);
+		LogInfoNoNL(" %S: %#.2g -> %#.2g", j->first->name.c_str(), j->first->fval, j->second);
+		vars.Schedule(j->first, j->first->fval, j->second, now, time, transition_type);
 	}
 	LogInfo("\n");
 }
@@ -701,44 +664,13 @@ void OverrideTransition::UpdatePresets(HackerDevice *wrapper)
 		i->second.Update(wrapper);
 }
 
-static float _UpdateTransition(struct OverrideTransitionParam *transition, ULONGLONG now)
-{
-	ULONGLONG time;
-	float percent;
-
-	if (transition->time == -1)
-		return FLT_MAX;
-
-	if (transition->time == 0) {
-		transition->time = -1;
-		return transition->target;
-	}
-
-	time = now - transition->activation_time;
-	percent = (float)time / transition->time;
-
-	if (percent >= 1.0f) {
-		transition->time = -1;
-		return transition->target;
-	}
-
-	if (transition->transition_type == TransitionType::COSINE)
-		percent = (float)((1.0 - cos(percent * M_PI)) / 2.0);
-
-	percent = transition->target * percent + transition->start * (1.0f - percent);
-
-	return percent;
-}
-
 void OverrideTransition::UpdateTransitions(HackerDevice *wrapper)
 {
-	std::map<OverrideParam, OverrideTransitionParam>::iterator i;
-	std::map<CommandListVariable*, OverrideTransitionParam>::iterator j;
 	ULONGLONG now = GetTickCount64();
 	NvAPI_Status err;
 	float val;
 
-	val = _UpdateTransition(&separation, now);
+	val = EvaluateTransition(&separation, now);
 	if (val != FLT_MAX) {
 		LogInfo(" Transitioning separation to %#.2f\n", val);
 
@@ -748,7 +680,7 @@ void OverrideTransition::UpdateTransitions(HackerDevice *wrapper)
 			LogDebug("    Stereo_SetSeparation failed: %i\n", err);
 	}
 
-	val = _UpdateTransition(&convergence, now);
+	val = EvaluateTransition(&convergence, now);
 	if (val != FLT_MAX) {
 		LogInfo(" Transitioning convergence to %#.2f\n", val);
 
@@ -760,35 +692,26 @@ void OverrideTransition::UpdateTransitions(HackerDevice *wrapper)
 
 	if (!params.empty()) {
 		LogDebugNoNL(" IniParams remapped to ");
-		for (i = params.begin(); i != params.end();) {
-			float val = _UpdateTransition(&i->second, now);
-			G->iniParams[i->first.idx].*i->first.component = val;
-			LogDebugNoNL("%c%.0i=%#.2g, ", i->first.chr(), i->first.idx, val);
-			if (i->second.time == -1)
-				i = params.erase(i);
-			else
-				i++;
-		}
+		params.Update(now, [](const OverrideParam &param, float val) {
+			G->iniParams[param.idx].*param.component = val;
+			G->iniParamsDirty.mark((UINT)param.idx);
+			LogDebugNoNL("%c%.0i=%#.2g, ", param.chr(), param.idx, val);
+		});
 		LogDebug("\n");
 
-		UpdateIniParams(wrapper);
+		FlushIniParams(wrapper, NULL, wrapper->GetPassThroughOrigContext1());
 	}
 
 	if (!vars.empty()) {
 		LogDebugNoNL(" Variables remapped to ");
-		for (j = vars.begin(); j != vars.end();) {
-			float val = _UpdateTransition(&j->second, now);
-			if (j->first->fval != val) {
-				j->first->fval = val;
-				if (j->first->flags & VariableFlags::PERSIST)
+		vars.Update(now, [](CommandListVariable *var, float val) {
+			if (var->fval != val) {
+				var->fval = val;
+				if (var->flags & VariableFlags::PERSIST)
 					G->user_config_dirty |= 1;
 			}
-			LogDebugNoNL("%S=%#.2g, ", j->first->name.c_str(), val);
-			if (j->second.time == -1)
-				j = vars.erase(j);
-			else
-				j++;
-		}
+			LogDebugNoNL("%S=%#.2g, ", var->name.c_str(), val);
+		});
 		LogDebug("\n");
 	}
 
@@ -918,10 +841,7 @@ void OverrideGlobalSave::Save(HackerDevice *wrapper, Override *preset)
 	}
 
 	for (i = preset->mOverrideParams.begin(); i != preset->mOverrideParams.end(); i++) {
-		std::map<OverrideParam, OverrideTransitionParam>::iterator transition = CurrentTransition.params.find(i->first);
-		if (transition != CurrentTransition.params.end() && transition->second.time != -1)
-			val = transition->second.target;
-		else
+		if (!CurrentTransition.params.GetTarget(i->first, &val))
 			val = G->iniParams[i->first.idx].*i->first.component;
 
 		preset->mSavedParams[i->first] = val;
@@ -929,10 +849,7 @@ void OverrideGlobalSave::Save(HackerDevice *wrapper, Override *preset)
 	}
 
 	for (j = preset->mOverrideVars.begin(); j != preset->mOverrideVars.end(); j++) {
-		std::map<CommandListVariable*, OverrideTransitionParam>::iterator transition = CurrentTransition.vars.find(j->first);
-		if (transition != CurrentTransition.vars.end() && transition->second.time != -1)
-			val = transition->second.target;
-		else
+		if (!CurrentTransition.vars.GetTarget(j->first, &val))
 			val = j->first->fval;
 
 		preset->mSavedVars[j->first] = val;
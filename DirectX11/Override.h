@@ -7,6 +7,8 @@
 #include "util.h"
 #include "Input.h"
 #include "HackerDevice.h"
+#include "SortedVectorMap.h"
+#include "OverrideTransitionSet.h"
 
 enum class KeyOverrideType {
 	INVALID = -1,
@@ -23,11 +25,6 @@ static EnumName_t<const wchar_t *, KeyOverrideType> KeyOverrideTypeNames[] = {
 	{NULL, KeyOverrideType::INVALID} // End of list marker
 };
 
-enum class TransitionType {
-	INVALID = -1,
-	LINEAR,
-	COSINE,
-};
 static EnumName_t<const char *, TransitionType> TransitionTypeNames[] = {
 	{"linear", TransitionType::LINEAR},
 	{"cosine", TransitionType::COSINE},
@@ -65,8 +62,8 @@ static inline bool operator<(const OverrideParam &lhs, const OverrideParam &rhs)
 	return ((uintptr_t)&((DirectX::XMFLOAT4*)(NULL)->*(lhs.component)) <
 	        (uintptr_t)&((DirectX::XMFLOAT4*)(NULL)->*(rhs.component)));
 }
-typedef std::map<OverrideParam, float> OverrideParams;
-typedef std::map<CommandListVariable*, float> OverrideVars;
+typedef SortedVectorMap<OverrideParam, float> OverrideParams;
+typedef SortedVectorMap<CommandListVariable*, float> OverrideVars;
 
 class OverrideBase
 {
@@ -222,28 +219,11 @@ public:
 typedef std::map<std::wstring, class PresetOverride> PresetOverrideMap;
 extern PresetOverrideMap presetOverrides;
 
-struct OverrideTransitionParam
-{
-	float start;
-	float target;
-	ULONGLONG activation_time;
-	int time;
-	TransitionType transition_type;
-
-	OverrideTransitionParam() :
-		start(FLT_MAX),
-		target(FLT_MAX),
-		activation_time(0),
-		time(-1),
-		transition_type(TransitionType::LINEAR)
-	{}
-};
-
 class OverrideTransition
 {
 public:
-	std::map<OverrideParam, OverrideTransitionParam> params;
-	std::map<CommandListVariable*, OverrideTransitionParam> vars;
+	OverrideTransitionSet<OverrideParam> params;
+	OverrideTransitionSet<CommandListVariable*> vars;
 	OverrideTransitionParam separation, convergence;
 
 	void ScheduleTransition(HackerDevice *wrapper,
@@ -276,8 +256,8 @@ public:
 class OverrideGlobalSave
 {
 public:
-	std::map<OverrideParam, OverrideGlobalSaveParam> params;
-	std::map<CommandListVariable*, OverrideGlobalSaveParam> vars;
+	SortedVectorMap<OverrideParam, OverrideGlobalSaveParam> params;
+	SortedVectorMap<CommandListVariable*, OverrideGlobalSaveParam> vars;
 	OverrideGlobalSaveParam separation, convergence;
 
 	void Reset(HackerDevice* wrapper);
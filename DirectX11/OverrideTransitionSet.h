@@ -0,0 +1,189 @@
+#pragma once
+
+// Transitions of override parameters and variables towards their targets.
+//
+// UpdateTransitions() evaluates every transition in progress every frame, and
+// presets with hundreds of parameters can have that many in flight at once.
+// OverrideTransitionSet keeps them as a structure of arrays (start, target,
+// activation time, duration and curve in separate contiguous arrays, sorted
+// by key) so the per-frame update is a single linear pass over a few dense
+// arrays, removing finished transitions as it goes, instead of walking and
+// erasing from the nodes of a std::map.
+//
+// This file has no Windows dependencies.
+
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+enum class TransitionType {
+	INVALID = -1,
+	LINEAR,
+	COSINE,
+};
+
+// A single transition, used for separation and convergence:
+struct OverrideTransitionParam
+{
+	float start;
+	float target;
+	uint64_t activation_time;
+	int time;
+	TransitionType transition_type;
+
+	OverrideTransitionParam() :
+		start(FLT_MAX),
+		target(FLT_MAX),
+		activation_time(0),
+		time(-1),
+		transition_type(TransitionType::LINEAR)
+	{}
+};
+
+// M_PI, which we can't rely on here since whether math.h defines it depends on
+// whether _USE_MATH_DEFINES was set before anything else included it:
+static const double OVERRIDE_TRANSITION_PI = 3.14159265358979323846;
+
+// Returns the value of a transition at time now, or FLT_MAX if it is not in
+// progress. Sets *time to -1 once the transition has reached its target:
+static inline float EvaluateTransition(float start, float target,
+		uint64_t activation_time, int *time,
+		TransitionType transition_type, uint64_t now)
+{
+	float percent;
+
+	if (*time == -1)
+		return FLT_MAX;
+
+	if (*time == 0) {
+		*time = -1;
+		return target;
+	}
+
+	percent = (float)(now - activation_time) / *time;
+
+	if (percent >= 1.0f) {
+		*time = -1;
+		return target;
+	}
+
+	if (transition_type == TransitionType::COSINE)
+		percent = (float)((1.0 - cos(percent * OVERRIDE_TRANSITION_PI)) / 2.0);
+
+	return target * percent + start * (1.0f - percent);
+}
+
+static inline float EvaluateTransition(OverrideTransitionParam *transition, uint64_t now)
+{
+	return EvaluateTransition(transition->start, transition->target,
+			transition->activation_time, &transition->time,
+			transition->transition_type, now);
+}
+
+template <class Key, class Compare = std::less<Key>>
+class OverrideTransitionSet
+{
+	std::vector<Key> keys;
+	std::vector<float> start;
+	std::vector<float> target;
+	std::vector<uint64_t> activation_time;
+	std::vector<int> time;
+	std::vector<TransitionType> transition_type;
+
+	size_t lower_bound(const Key &key) const
+	{
+		return std::lower_bound(keys.begin(), keys.end(), key, Compare()) - keys.begin();
+	}
+
+public:
+	bool empty() const { return keys.empty(); }
+	size_t size() const { return keys.size(); }
+
+	void clear()
+	{
+		keys.clear();
+		start.clear();
+		target.clear();
+		activation_time.clear();
+		time.clear();
+		transition_type.clear();
+	}
+
+	// Starts a new transition for key, replacing any already in progress:
+	void Schedule(const Key &key, float start_val, float target_val,
+			uint64_t now, int duration, TransitionType type)
+	{
+		size_t i = lower_bound(key);
+
+		if (i == keys.size() || Compare()(key, keys[i])) {
+			keys.insert(keys.begin() + i, key);
+			start.insert(start.begin() + i, start_val);
+			target.insert(target.begin() + i, target_val);
+			activation_time.insert(activation_time.begin() + i, now);
+			time.insert(time.begin() + i, duration);
+			transition_type.insert(transition_type.begin() + i, type);
+			return;
+		}
+
+		start[i] = start_val;
+		target[i] = target_val;
+		activation_time[i] = now;
+		time[i] = duration;
+		transition_type[i] = type;
+	}
+
+	// Returns true and the target if key is in the middle of a transition:
+	bool GetTarget(const Key &key, float *val) const
+	{
+		size_t i = lower_bound(key);
+
+		if (i == keys.size() || Compare()(key, keys[i]) || time[i] == -1)
+			return false;
+
+		*val = target[i];
+		return true;
+	}
+
+	// Evaluates every transition at time now in key order, passing each
+	// key and its value to apply(key, val), and drops any that have
+	// finished in the same pass:
+	template <class F>
+	void Update(uint64_t now, F apply)
+	{
+		size_t n = keys.size();
+		size_t i, j;
+		float val;
+
+		for (i = 0, j = 0; i < n; i++) {
+			val = EvaluateTransition(start[i], target[i],
+					activation_time[i], &time[i],
+					transition_type[i], now);
+			apply(keys[i], val);
+
+			if (time[i] == -1)
+				continue;
+
+			if (i != j) {
+				keys[j] = keys[i];
+				start[j] = start[i];
+				target[j] = target[i];
+				activation_time[j] = activation_time[i];
+				time[j] = time[i];
+				transition_type[j] = transition_type[i];
+			}
+			j++;
+		}
+
+		if (j != n) {
+			keys.erase(keys.begin() + j, keys.end());
+			start.erase(start.begin() + j, start.end());
+			target.erase(target.begin() + j, target.end());
+			activation_time.erase(activation_time.begin() + j, activation_time.end());
+			time.erase(time.begin() + j, time.end());
+			transition_type.erase(transition_type.begin() + j, transition_type.end());
+		}
+	}
+};
@@ -6,6 +6,7 @@
 #include "globals.h"
 #include "profiling.h"
 #include "overlay.h"
+#include "HashContaminationLog.h"
 
 // DirectXTK headers fail to include their own pre-requisits. We just want
 // GetSurfaceInfo from LoaderHelpers
@@ -814,7 +815,7 @@ uint32_t CalcTexture2DDataHashAccurate(
 // lockdep to statically prove this is called with the lock held?
 ResourceHandleInfo* GetResourceHandleInfo(ID3D11Resource *resource)
 {
-	std::unordered_map<ID3D11Resource *, ResourceHandleInfo>::iterator j;
+	ResourceMap::iterator j;
 	ResourceHandleInfo* ret = NULL;
 
 	EnterCriticalSectionPretty(&G->mResourcesLock);
@@ -970,45 +971,24 @@ static bool GetResourceInfoFields(struct ResourceHashInfo *info, UINT subresourc
 	return false;
 }
 
-void MarkResourceHashContaminated(ID3D11Resource *dest, UINT DstSubresource,
-		ID3D11Resource *src, UINT srcSubresource, char type,
-		UINT DstX, UINT DstY, UINT DstZ, const D3D11_BOX *SrcBox)
+static HashContaminationLog hash_contamination_log;
+
+static void ApplyResourceHashContamination(HashContaminationEvent *event)
 {
-	ResourceHandleInfo *dst_handle_info;
 	struct ResourceHashInfo *dstInfo, *srcInfo = NULL;
-	uint32_t srcHash = 0, dstHash = 0;
 	UINT srcWidth = 1, srcHeight = 1, srcDepth = 1, srcMip = 0, srcIdx = 0, srcArraySize = 1;
 	UINT dstWidth = 1, dstHeight = 1, dstDepth = 1, dstMip = 0, dstIdx = 0, dstArraySize = 1;
+	D3D11_BOX src_box, *SrcBox = NULL;
 	bool partial = false;
 	ResourceInfoMap::iterator info_i;
-	Profiling::State profiling_state;
-
-	if (!dest)
-		return;
-
-	if (Profiling::mode == Profiling::Mode::SUMMARY)
-		Profiling::start(&profiling_state);
-
-	EnterCriticalSectionPretty(&G->mCriticalSection);
-
-	dst_handle_info = GetResourceHandleInfo(dest);
-	if (!dst_handle_info)
-		goto out_unlock;
-
-	if (!supports_hash_tracking(dst_handle_info))
-		goto out_unlock;
-
-	dstHash = dst_handle_info->orig_hash;
-	if (!dstHash)
-		goto out_unlock;
 
 	// Faster than catching an out_of_range exception from .at():
-	info_i = G->mResourceInfo.find(dstHash);
+	info_i = G->mResourceInfo.find(event->dst_hash);
 	if (info_i == G->mResourceInfo.end())
-		goto out_unlock;
+		return;
 	dstInfo = &info_i->second;
 
-	GetResourceInfoFields(dstInfo, DstSubresource,
+	GetResourceInfoFields(dstInfo, event->dst_subresource,
 			&dstWidth, &dstHeight, &dstDepth,
 			&dstIdx, &dstMip, &dstArraySize);
 
@@ -1016,45 +996,48 @@ void MarkResourceHashContaminated(ID3D11Resource *dest, UINT DstSubresource,
 	// We could collect info about the copy anyway (below code will work to
 	// do so), but it adds a lot of irrelevant noise to the ShaderUsage.txt
 	if (dstMip)
-		goto out_unlock;
+		return;
 
-	if (src) {
-		srcHash = GetOrigResourceHash(src);
-		G->mCopiedResourceInfo.insert(srcHash);
+	if (event->has_src) {
+		G->mCopiedResourceInfo.insert(event->src_hash);
 
 		// Faster than catching an out_of_range exception from .at():
-		info_i = G->mResourceInfo.find(srcHash);
+		info_i = G->mResourceInfo.find(event->src_hash);
 		if (info_i != G->mResourceInfo.end()) {
 			srcInfo = &info_i->second;
-			GetResourceInfoFields(srcInfo, srcSubresource,
+			GetResourceInfoFields(srcInfo, event->src_subresource,
 					&srcWidth, &srcHeight, &srcDepth,
 					&srcIdx, &srcMip, &srcArraySize);
 
-			if (dstHash != srcHash && srcInfo->initial_data_used_in_hash) {
+			if (event->dst_hash != event->src_hash && srcInfo->initial_data_used_in_hash) {
 				dstInfo->initial_data_used_in_hash = true;
-				if (G->track_texture_updates == 0)
+				if (event->track_texture_updates_off)
 					dstInfo->hash_contaminated = true;
 			}
 		}
 	}
 
-	switch (type) {
+	switch (event->type) {
 		case 'U':
-			dstInfo->update_contamination.insert(DstSubresource);
+			dstInfo->update_contamination.insert(event->dst_subresource);
 			dstInfo->initial_data_used_in_hash = true;
-			if (G->track_texture_updates == 0)
+			if (event->track_texture_updates_off)
 				dstInfo->hash_contaminated = true;
 			break;
 		case 'M':
-			dstInfo->map_contamination.insert(DstSubresource);
+			dstInfo->map_contamination.insert(event->dst_subresource);
 			dstInfo->initial_data_used_in_hash = true;
-			if (G->track_texture_updates == 0)
+			if (event->track_texture_updates_off)
 				dstInfo->hash_contaminated = true;
 			break;
 		case 'C':
-			dstInfo->copy_contamination.insert(srcHash);
+			dstInfo->copy_contamination.insert(event->src_hash);
 			break;
 		case 'S':
+			if (event->has_src_box) {
+				memcpy(&src_box, event->src_box, sizeof(D3D11_BOX));
+				SrcBox = &src_box;
+			}
 
 			// We especially want to know if a region copy copied
 			// the entire texture, or only part of it. This may be
@@ -1067,7 +1050,7 @@ void MarkResourceHashContaminated(ID3D11Resource *dest, UINT DstSubresource,
 			partial = partial || dstHeight != srcHeight;
 			partial = partial || dstDepth != srcDepth;
 
-			partial = partial || DstX || DstY || DstZ;
+			partial = partial || event->dst_x || event->dst_y || event->dst_z;
 			if (SrcBox) {
 				partial = partial ||
 					(SrcBox->right - SrcBox->left != dstWidth) ||
@@ -1084,13 +1067,77 @@ void MarkResourceHashContaminated(ID3D11Resource *dest, UINT DstSubresource,
 			partial = partial || dstArraySize > 1 || srcArraySize > 1;
 
 			dstInfo->region_contamination[
-					std::make_tuple(srcHash, dstIdx, dstMip, srcIdx, srcMip)
-				].Update(partial, DstX, DstY, DstZ, SrcBox);
+					std::make_tuple(event->src_hash, dstIdx, dstMip, srcIdx, srcMip)
+				].Update(partial, event->dst_x, event->dst_y, event->dst_z, SrcBox);
 	}
+}
+
+// Applies the contamination recorded so far to G->mResourceInfo. Must be
+// called before anything reads the contamination records, and before
+// anything else modifies G->mResourceInfo so that the events are applied in
+// the same order relative to those modifications as they happened in:
+void MergeResourceHashContamination()
+{
+	std::vector<HashContaminationEvent> events;
+
+	if (hash_contamination_log.empty())
+		return;
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+
+	hash_contamination_log.drain(&events);
+	for (HashContaminationEvent &event : events)
+		ApplyResourceHashContamination(&event);
 
-out_unlock:
 	LeaveCriticalSection(&G->mCriticalSection);
+}
+
+// Called from the copy, update and map calls on any context. This only
+// records what happened without taking the global critical section - the
+// resource info is updated later by MergeResourceHashContamination():
+void MarkResourceHashContaminated(ID3D11Resource *dest, UINT DstSubresource,
+		ID3D11Resource *src, UINT srcSubresource, char type,
+		UINT DstX, UINT DstY, UINT DstZ, const D3D11_BOX *SrcBox)
+{
+	ResourceHandleInfo *dst_handle_info;
+	HashContaminationEvent event;
+	Profiling::State profiling_state;
+
+	if (!dest)
+		return;
+
+	if (Profiling::mode == Profiling::Mode::SUMMARY)
+		Profiling::start(&profiling_state);
+
+	dst_handle_info = GetResourceHandleInfo(dest);
+	if (!dst_handle_info)
+		goto out;
+
+	if (!supports_hash_tracking(dst_handle_info))
+		goto out;
+
+	event.dst_hash = dst_handle_info->orig_hash;
+	if (!event.dst_hash)
+		goto out;
+
+	event.type = type;
+	event.track_texture_updates_off = (G->track_texture_updates == 0);
+	event.dst_subresource = DstSubresource;
+	event.dst_x = DstX;
+	event.dst_y = DstY;
+	event.dst_z = DstZ;
+
+	event.has_src = !!src;
+	event.src_hash = src ? GetOrigResourceHash(src) : 0;
+	event.src_subresource = srcSubresource;
+
+	event.has_src_box = !!SrcBox;
+	if (SrcBox)
+		memcpy(event.src_box, SrcBox, sizeof(event.src_box));
+
+	hash_contamination_log.add(&event);
 
+out:
 	if (Profiling::mode == Profiling::Mode::SUMMARY)
 		Profiling::end(&profiling_state, &Profiling::hash_tracking_overhead);
 }
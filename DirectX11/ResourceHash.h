@@ -196,6 +196,7 @@ uint32_t GetResourceHash(ID3D11Resource *resource);
 void MarkResourceHashContaminated(ID3D11Resource *dest, UINT DstSubresource,
 		ID3D11Resource *src, UINT srcSubresource, char type,
 		UINT DstX, UINT DstY, UINT DstZ, const D3D11_BOX *SrcBox);
+void MergeResourceHashContamination();
 
 void UpdateResourceHashFromCPU(ID3D11Resource *resource,
 	const void *data, UINT rowPitch, UINT depthPitch);
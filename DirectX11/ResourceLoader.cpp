@@ -0,0 +1,215 @@
+#include "ResourceLoader.h"
+
+#include <string.h>
+#include <algorithm>
+
+ResourceFileLoader::State::State(ResourceFileReader reader) :
+	reader(reader),
+	active(0),
+	stopping(false),
+	max_threads(default_threads()),
+	memory_budget(256 * 1024 * 1024),
+	memory_loaded(0)
+{}
+
+ResourceFileLoader::ResourceFileLoader(ResourceFileReader reader) :
+	state(std::make_shared<State>(reader))
+{}
+
+ResourceFileLoader::~ResourceFileLoader()
+{
+	std::lock_guard<std::mutex> guard(state->lock);
+	size_t i;
+
+	// Nothing can take() the files any more, so drop everything still
+	// queued and tell the workers to stop after their current read:
+	state->stopping = true;
+	state->queue.clear();
+	state->entries.clear();
+
+	// This may be running from DllMain with the loader lock held, where
+	// joining a thread would deadlock. Any workers still running hold
+	// their own references to the state, which is freed by whichever of
+	// us lets go of it last:
+	for (i = 0; i < state->threads.size(); i++)
+		state->threads[i].detach();
+	state->threads.clear();
+	state->exited.clear();
+}
+
+unsigned ResourceFileLoader::default_threads()
+{
+	// This is mostly waiting on the disk, and the game is likely loading
+	// its own assets at the same time, so a few threads is plenty:
+	return std::min(std::max(std::thread::hardware_concurrency(), 2u) - 1, 4u);
+}
+
+void ResourceFileLoader::configure(unsigned max_threads, size_t memory_budget)
+{
+	std::lock_guard<std::mutex> guard(state->lock);
+
+	state->max_threads = max_threads;
+	state->memory_budget = memory_budget;
+}
+
+// Must be called with the lock held:
+void ResourceFileLoader::start_workers()
+{
+	std::vector<std::thread>::iterator i;
+
+	// Reap the workers that have run out of work. They have already
+	// released the lock for the last time, so joining them here is safe:
+	for (i = state->threads.begin(); i != state->threads.end(); ) {
+		if (std::find(state->exited.begin(), state->exited.end(), i->get_id()) != state->exited.end()) {
+			i->join();
+			i = state->threads.erase(i);
+		} else {
+			i++;
+		}
+	}
+	state->exited.clear();
+
+	// Workers are started on demand and exit once the queue is empty,
+	// so no threads are left hanging around once the mod has loaded:
+	while (state->active < state->max_threads && state->active < state->queue.size()
+			&& state->memory_loaded < state->memory_budget) {
+		state->threads.emplace_back(&ResourceFileLoader::worker, state);
+		state->active++;
+	}
+}
+
+void ResourceFileLoader::worker(std::shared_ptr<State> state)
+{
+	std::unique_lock<std::mutex> guard(state->lock);
+	std::shared_ptr<Entry> entry;
+	ResourceFile file;
+
+	while (!state->stopping && !state->queue.empty() && state->memory_loaded < state->memory_budget) {
+		entry = state->queue.front();
+		state->queue.pop_front();
+		entry->state = EntryState::READING;
+
+		guard.unlock();
+		file = ResourceFile();
+		state->reader(entry->path, &file);
+		guard.lock();
+
+		entry->file = file;
+		entry->state = EntryState::DONE;
+		if (!entry->cancelled)
+			state->memory_loaded += file.size;
+		entry.reset();
+
+		state->done_cv.notify_all();
+	}
+
+	state->active--;
+	if (!state->stopping)
+		state->exited.push_back(std::this_thread::get_id());
+}
+
+void ResourceFileLoader::prefetch(const std::wstring &path)
+{
+	std::lock_guard<std::mutex> guard(state->lock);
+	std::shared_ptr<Entry> *entry;
+
+	if (!state->max_threads)
+		return;
+
+	entry = &state->entries[path];
+	if (!*entry) {
+		*entry = std::make_shared<Entry>(path);
+		state->queue.push_back(*entry);
+	}
+	(*entry)->users++;
+
+	start_workers();
+}
+
+void ResourceFileLoader::take(const std::wstring &path, ResourceFile *file)
+{
+	std::unique_lock<std::mutex> guard(state->lock);
+	std::map<std::wstring, std::shared_ptr<Entry>>::iterator i;
+	std::shared_ptr<Entry> entry;
+
+	i = state->entries.find(path);
+	if (i == state->entries.end()) {
+		guard.unlock();
+		*file = ResourceFile();
+		state->reader(path, file);
+		return;
+	}
+	entry = i->second;
+
+	if (entry->state == EntryState::QUEUED) {
+		// Jump the queue - the caller needs this one now:
+		state->queue.erase(std::find(state->queue.begin(), state->queue.end(), entry));
+		entry->state = EntryState::READING;
+
+		guard.unlock();
+		state->reader(path, &entry->file);
+		guard.lock();
+
+		entry->state = EntryState::DONE;
+		if (!entry->cancelled)
+			state->memory_loaded += entry->file.size;
+		state->done_cv.notify_all();
+	}
+
+	state->done_cv.wait(guard, [&]() { return entry->state == EntryState::DONE; });
+
+	// If clear() was called while we were waiting the entry is no longer
+	// in the map or accounted for, but we still hold a reference to it
+	// and may as well use what was read:
+	if (entry->cancelled) {
+		*file = entry->file;
+		entry->file.buf = NULL;
+		return;
+	}
+
+	if (--entry->users) {
+		// Another resource uses the same file, so it gets a copy and
+		// the original stays here for the next one:
+		*file = entry->file;
+		if (entry->file.buf) {
+			file->buf = malloc(std::max(entry->file.size, (size_t)1));
+			if (file->buf) {
+				memcpy(file->buf, entry->file.buf, entry->file.size);
+			} else {
+				file->status = ResourceFileStatus::OUT_OF_MEMORY;
+				file->size = 0;
+			}
+		}
+		return;
+	}
+
+	*file = entry->file;
+	entry->file.buf = NULL;
+	state->memory_loaded -= file->size;
+	state->entries.erase(path);
+
+	start_workers();
+}
+
+void ResourceFileLoader::clear()
+{
+	std::lock_guard<std::mutex> guard(state->lock);
+	std::map<std::wstring, std::shared_ptr<Entry>>::iterator i;
+
+	state->queue.clear();
+
+	// Entries still being read are freed by whoever finishes with them
+	// last, either the worker or a take() waiting on them:
+	for (i = state->entries.begin(); i != state->entries.end(); i++)
+		i->second->cancelled = true;
+	state->entries.clear();
+
+	state->memory_loaded = 0;
+}
+
+size_t ResourceFileLoader::memory_in_use()
+{
+	std::lock_guard<std::mutex> guard(state->lock);
+
+	return state->memory_loaded;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+// Background loading of the files behind custom resources.
+//
+// A [Resource] section with a filename used to open and read the file (or
+// have DirectXTK do so) on the render thread the first time the resource was
+// substantiated, so a mod with hundreds of buffers and textures would hitch
+// each time one of them was first used, and again for every one of them after
+// each config reload.
+//
+// Now the filename of every custom resource is handed to prefetch() as soon
+// as the ini has been parsed, and a few worker threads read the files into
+// memory in the order they were listed. Substantiating the resource take()s
+// that memory and only has to create the device resource from it. If the
+// file has not been read yet, take() reads it straight away on the calling
+// thread rather than waiting behind the rest of the queue, or waits for the
+// worker if it is part way through reading it.
+//
+// Files that have been read but not yet taken count against a memory budget.
+// Once that is reached the workers stop, leaving the rest of the files to be
+// read by take() as before, so a mod that never uses most of its resources
+// can't exhaust the address space of a 32bit game. They resume as memory is
+// taken.
+//
+// The reader only reports how it failed, the caller does the logging, so
+// that the warnings still come out on the render thread when the resource is
+// first used, the same as they always have.
+//
+// This has no Windows or DirectX dependencies - the file access is passed in
+// as a function, so the loader can be exercised with a mock file system on
+// any platform.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class ResourceFileStatus {
+	OK,
+	OPEN_FAILED,
+	OUT_OF_MEMORY,
+	READ_FAILED,
+};
+
+struct ResourceFile
+{
+	ResourceFileStatus status;
+	unsigned long error;    // Error code from the reader if it failed
+	void *buf;              // malloc()ed to allow realloc(). Caller frees
+	size_t size;
+
+	ResourceFile() :
+		status(ResourceFileStatus::OK),
+		error(0),
+		buf(NULL),
+		size(0)
+	{}
+};
+
+// Reads the whole file into a malloc()ed buffer. Called on worker threads,
+// so it must not log or touch any shared state:
+typedef void (*ResourceFileReader)(const std::wstring &path, ResourceFile *file);
+
+class ResourceFileLoader
+{
+	enum class EntryState {
+		QUEUED,
+		READING,
+		DONE,
+	};
+
+	struct Entry
+	{
+		std::wstring path;
+		ResourceFile file;
+		EntryState state;
+		unsigned users;         // prefetch() calls not yet taken
+		bool cancelled;         // clear() was called while it was read
+
+		Entry(const std::wstring &path) :
+			path(path),
+			state(EntryState::QUEUED),
+			users(0),
+			cancelled(false)
+		{}
+
+		~Entry()
+		{
+			free(file.buf);
+		}
+	};
+
+	// Everything the workers touch lives here rather than in the loader,
+	// and each worker holds a reference to it. The loader is a static
+	// object that may be destroyed from DllMain, where the workers can't
+	// be joined, so they may still be finishing a read after it is gone:
+	struct State
+	{
+		ResourceFileReader reader;
+
+		std::mutex lock;
+		std::condition_variable done_cv;
+
+		std::map<std::wstring, std::shared_ptr<Entry>> entries;
+		std::deque<std::shared_ptr<Entry>> queue;
+
+		std::vector<std::thread> threads;
+		std::vector<std::thread::id> exited;
+		unsigned active;
+		bool stopping;          // The loader has been destroyed
+
+		unsigned max_threads;
+		size_t memory_budget;
+		size_t memory_loaded;
+
+		State(ResourceFileReader reader);
+	};
+
+	std::shared_ptr<State> state;
+
+	static void worker(std::shared_ptr<State> state);
+	void start_workers();
+
+public:
+	ResourceFileLoader(ResourceFileReader reader);
+	~ResourceFileLoader();
+
+	// Sets the number of worker threads (0 disables prefetching, leaving
+	// every file to be read by take()) and the memory budget:
+	void configure(unsigned max_threads, size_t memory_budget);
+
+	// Queues a file to be read in the background. A file may be
+	// prefetched more than once if several resources use it, in which
+	// case it is read once and each take() gets a copy:
+	void prefetch(const std::wstring &path);
+
+	// Gets the contents of the file, reading it now if it was never
+	// prefetched or has not been started yet. The caller owns file->buf:
+	void take(const std::wstring &path, ResourceFile *file);
+
+	// Throws away everything prefetched so far, e.g. on config reload.
+	// Reads that are in progress finish in the background:
+	void clear();
+
+	// Memory held by files that have been read but not yet taken:
+	size_t memory_in_use();
+
+	static unsigned default_threads();
+};
@@ -0,0 +1,210 @@
+#include "SettingsWriter.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <system_error>
+
+PersistentSettingsWriter::PersistentSettingsWriter(SettingsFileWriter writer, SettingsFileReplacer replacer) :
+	writer(writer),
+	replacer(replacer),
+	last_valid(false),
+	writing(false),
+	thread_running(false)
+{}
+
+PersistentSettingsWriter::~PersistentSettingsWriter()
+{
+	// This may be running from DllMain with the loader lock held, where
+	// joining a thread would deadlock:
+	if (thread.joinable())
+		thread.detach();
+}
+
+std::string PersistentSettingsWriter::format(const std::vector<PersistentSetting> &settings)
+{
+	std::string text;
+	char line[512];
+	int len;
+
+	text =  "; AUTOMATICALLY GENERATED FILE - DO NOT EDIT\n"
+		";\n"
+		"; 3DMigoto will overwrite this file whenever any persistent settings are\n"
+		"; altered by hot key or command list. Tag global variables with the \"persist\"\n"
+		"; keyword to save them in this file. Use the post keyword in the [Constants]\n"
+		"; command list if you need to do any intialisation after this file is loaded.\n"
+		";\n"
+		"[Constants]\n";
+
+	for (const PersistentSetting &setting : settings) {
+		len = snprintf(line, sizeof(line), "%ls = %.9g\n", setting.name.c_str(), setting.value);
+		if (len < 0)
+			continue;
+		if ((size_t)len < sizeof(line)) {
+			text.append(line, len);
+		} else {
+			// Only a ridiculously long variable name gets here:
+			std::string long_line(len + 1, '\0');
+			snprintf(&long_line[0], len + 1, "%ls = %.9g\n", setting.name.c_str(), setting.value);
+			text.append(long_line.c_str(), len);
+		}
+	}
+
+	return text;
+}
+
+// Must be called with the lock held:
+bool PersistentSettingsWriter::unchanged(const std::wstring &path, const std::vector<PersistentSetting> &settings)
+{
+	size_t i;
+
+	if (!last_valid || path != last_path || settings.size() != last.size())
+		return false;
+
+	// Compared bit for bit so that a NaN doesn't count as a change, and
+	// -0 vs 0 does, the same as it would in the file:
+	for (i = 0; i < settings.size(); i++) {
+		if (settings[i].name != last[i].name)
+			return false;
+		if (memcmp(&settings[i].value, &last[i].value, sizeof(float)))
+			return false;
+	}
+
+	return true;
+}
+
+SettingsWriteStatus PersistentSettingsWriter::write(const Save &save)
+{
+	std::wstring tmp_path = save.path + L".tmp";
+
+	if (!writer(tmp_path, format(save.settings)))
+		return SettingsWriteStatus::WRITE_FAILED;
+
+	if (!replacer(tmp_path, save.path))
+		return SettingsWriteStatus::REPLACE_FAILED;
+
+	return SettingsWriteStatus::OK;
+}
+
+void PersistentSettingsWriter::worker()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	std::unique_ptr<Save> save;
+	SettingsWriteStatus status;
+
+	while (pending) {
+		save = std::move(pending);
+		writing = true;
+
+		guard.unlock();
+		status = write(*save);
+		guard.lock();
+
+		writing = false;
+		results.push_back({save->path, status, save->settings.size()});
+
+		// Make sure the next save tries again, unless a newer one is
+		// already queued:
+		if (status != SettingsWriteStatus::OK && !pending)
+			last_valid = false;
+
+		idle_cv.notify_all();
+	}
+
+	thread_running = false;
+}
+
+// Must be called with the lock held:
+void PersistentSettingsWriter::wait_for_write(std::unique_lock<std::mutex> &guard)
+{
+	// Bounded, since during process exit the background thread will have
+	// been killed part way through and will never finish:
+	idle_cv.wait_for(guard, std::chrono::seconds(2), [this]() { return !writing; });
+}
+
+bool PersistentSettingsWriter::save(const std::wstring &path, std::vector<PersistentSetting> settings, bool force)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (!force && unchanged(path, settings))
+		return false;
+
+	last_path = path;
+	last = settings;
+	last_valid = true;
+
+	pending.reset(new Save{path, std::move(settings)});
+
+	if (thread_running)
+		return true;
+
+	// The previous thread has already released the lock for the last
+	// time, so joining it here is safe:
+	if (thread.joinable())
+		thread.join();
+
+	try {
+		thread = std::thread(&PersistentSettingsWriter::worker, this);
+		thread_running = true;
+	} catch (const std::system_error&) {
+		SettingsWriteStatus status = write(*pending);
+		results.push_back({path, status, pending->settings.size()});
+		if (status != SettingsWriteStatus::OK)
+			last_valid = false;
+		pending.reset();
+	}
+
+	return true;
+}
+
+bool PersistentSettingsWriter::save_now(const std::wstring &path, std::vector<PersistentSetting> settings, bool force)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	SettingsWriteStatus status;
+	Save save;
+
+	// A dropped save was never written, so whatever it held can't count
+	// as the last settings saved:
+	if (pending) {
+		pending.reset();
+		last_valid = false;
+	}
+	wait_for_write(guard);
+
+	if (!force && unchanged(path, settings))
+		return false;
+
+	last_path = path;
+	last = settings;
+	last_valid = true;
+
+	save.path = path;
+	save.settings = std::move(settings);
+
+	guard.unlock();
+	status = write(save);
+	guard.lock();
+
+	results.push_back({path, status, save.settings.size()});
+	if (status != SettingsWriteStatus::OK)
+		last_valid = false;
+
+	return true;
+}
+
+void PersistentSettingsWriter::discard()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	pending.reset();
+	wait_for_write(guard);
+	last_valid = false;
+}
+
+void PersistentSettingsWriter::take_results(std::vector<SettingsWriteResult> *results)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	results->insert(results->end(), this->results.begin(), this->results.end());
+	this->results.clear();
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+// Saving of the persistent variables to d3dx_user.ini.
+//
+// The user config used to be rewritten on the present thread, formatting one
+// line at a time straight into the file, whenever anything had marked it
+// dirty - even if every variable had since been toggled back to the value
+// that was already saved. A mod with a lot of persistent variables would get
+// a frame spike each autosave, and a crash or power loss part way through
+// would leave a truncated file behind, losing every setting.
+//
+// The present thread now only takes a snapshot of the variables and compares
+// it with the last one saved, which is cheap. If nothing actually changed
+// nothing is written. Otherwise the snapshot is handed to a background thread
+// that formats it and writes it to a temporary file next to the user config,
+// then replaces the user config with it in one step, so the file on disk is
+// always either the old or the new settings. If more snapshots are saved
+// while a write is in progress only the newest is written once it finishes.
+//
+// The file is still regenerated in full rather than updated in place, since
+// an in place update could not be atomic and the file is small.
+//
+// save_now() writes on the calling thread and is used where the file must be
+// on disk before returning, such as before the config is reloaded and when
+// the DLL is unloaded - during process exit the background thread has already
+// been killed, so this never waits for it indefinitely.
+//
+// The results of each write are collected for the caller to log on its own
+// thread, rather than the background thread logging them itself.
+//
+// This has no Windows dependencies - the file access is passed in as
+// functions, so the writer can be exercised with a fake file system on any
+// platform.
+
+#include <stddef.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct PersistentSetting
+{
+	std::wstring name;
+	float value;
+};
+
+enum class SettingsWriteStatus {
+	OK,
+	WRITE_FAILED,
+	REPLACE_FAILED,
+};
+
+struct SettingsWriteResult
+{
+	std::wstring path;
+	SettingsWriteStatus status;
+	size_t settings;
+};
+
+// Creates or truncates the file and writes all of the data to it, making
+// sure it has reached the disk. Called on the background thread:
+typedef bool (*SettingsFileWriter)(const std::wstring &path, const std::string &data);
+
+// Replaces dest with src in a single step, removing src if that fails:
+typedef bool (*SettingsFileReplacer)(const std::wstring &src, const std::wstring &dest);
+
+class PersistentSettingsWriter
+{
+	struct Save
+	{
+		std::wstring path;
+		std::vector<PersistentSetting> settings;
+	};
+
+	SettingsFileWriter writer;
+	SettingsFileReplacer replacer;
+
+	std::mutex lock;
+	std::condition_variable idle_cv;
+
+	// The settings last written or queued to be written, to skip saving
+	// the same settings again:
+	std::wstring last_path;
+	std::vector<PersistentSetting> last;
+	bool last_valid;
+
+	std::unique_ptr<Save> pending;
+	bool writing;
+
+	std::thread thread;
+	bool thread_running;
+
+	std::vector<SettingsWriteResult> results;
+
+	void worker();
+	SettingsWriteStatus write(const Save &save);
+	bool unchanged(const std::wstring &path, const std::vector<PersistentSetting> &settings);
+	void wait_for_write(std::unique_lock<std::mutex> &guard);
+
+public:
+	PersistentSettingsWriter(SettingsFileWriter writer, SettingsFileReplacer replacer);
+	~PersistentSettingsWriter();
+
+	// Queues the settings to be written in the background, replacing any
+	// save that has not started yet. Returns false without queueing
+	// anything if they are the same as the last settings saved, unless
+	// forced:
+	bool save(const std::wstring &path, std::vector<PersistentSetting> settings, bool force);
+
+	// As save(), but writes the settings on the calling thread, after
+	// dropping any queued save and waiting for one in progress:
+	bool save_now(const std::wstring &path, std::vector<PersistentSetting> settings, bool force);
+
+	// Drops any queued save, waits for one in progress and forgets what
+	// was last saved, e.g. when the user config is about to be deleted:
+	void discard();
+
+	// Moves the results of the writes finished since the last call into
+	// the vector:
+	void take_results(std::vector<SettingsWriteResult> *results);
+
+	// The contents of the user config for these settings:
+	static std::string format(const std::vector<PersistentSetting> &settings);
+};
@@ -0,0 +1,362 @@
+#include "ShaderCache.h"
+
+#include <unordered_map>
+#include <forward_list>
+
+#include "globals.h"
+#include "log.h"
+#include "util.h"
+#include "Hunting.h"
+
+// Used to avoid rehashing included files for every shader that includes them,
+// while still noticing if they are edited while the game is running:
+struct ShaderCacheIncludeInfo
+{
+	FILETIME last_write_time;
+	UINT64 size;
+	ShaderCacheKey key;
+};
+
+CRITICAL_SECTION shader_cache_lock;
+
+static wchar_t pack_path[MAX_PATH];
+static HANDLE pack_mapping = NULL;
+static const char *pack_view = NULL;
+static UINT64 pack_size;
+
+// Maps keys to records, either in the mapped pack file or in new_records for
+// shaders that have been added since the pack was mapped. If a key is stored
+// more than once the newest record wins:
+static ShaderCachePackIndex pack_index;
+static std::forward_list<std::vector<char>> new_records;
+static std::unordered_map<std::wstring, ShaderCacheIncludeInfo> include_info;
+
+ShaderCacheHasher::ShaderCacheHasher()
+{
+	// FNV-1a offset basis:
+	key.fnv = 0xcbf29ce484222325ULL;
+	key.crc = 0;
+	key.length = 0;
+}
+
+void ShaderCacheHasher::update(const void *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char*)buf;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		key.fnv ^= p[i];
+		key.fnv *= FNV_64_PRIME;
+	}
+	key.crc = crc32c_hw(key.crc, buf, len);
+	key.length += (UINT32)len;
+}
+
+void ShaderCacheHasher::update(const char *str)
+{
+	// Include the NULL terminator so that adjacent strings can't run
+	// together and produce the same key:
+	update(str, strlen(str) + 1);
+}
+
+void ShaderCacheHasher::update(UINT32 val)
+{
+	update(&val, sizeof(val));
+}
+
+ShaderCacheKey shader_cache_hlsl_key(const void *src, size_t src_size, const char *path,
+		const char *shader_model, UINT flags, const D3D_SHADER_MACRO *macros)
+{
+	ShaderCacheHasher hasher;
+
+	hasher.update("hlsl");
+	hasher.update(src, src_size);
+	// #includes are resolved relative to the path and the include mode:
+	hasher.update(path);
+	hasher.update((UINT32)G->recursive_include);
+	hasher.update(shader_model);
+	hasher.update(flags);
+	for (; macros && macros->Name; macros++) {
+		hasher.update(macros->Name);
+		hasher.update(macros->Definition ? macros->Definition : "");
+	}
+
+	return hasher.get();
+}
+
+ShaderCacheKey shader_cache_asm_key(const void *src, size_t src_size,
+		const void *orig_bytecode, size_t orig_size)
+{
+	ShaderCacheHasher hasher;
+
+	hasher.update("asm");
+	hasher.update(src, src_size);
+	// The assembler takes the signatures from the original shader:
+	hasher.update(orig_bytecode, orig_size);
+	hasher.update((UINT32)G->assemble_signature_comments);
+
+	return hasher.get();
+}
+
+static void unmap_pack()
+{
+	if (pack_view)
+		UnmapViewOfFile(pack_view);
+	if (pack_mapping)
+		CloseHandle(pack_mapping);
+	pack_view = NULL;
+	pack_mapping = NULL;
+	pack_size = 0;
+	pack_index.clear();
+}
+
+static bool map_pack()
+{
+	LARGE_INTEGER size;
+	HANDLE f;
+
+	// Allow the file to be appended to while it is mapped:
+	f = CreateFile(pack_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+
+	if (!GetFileSizeEx(f, &size) || !size.QuadPart) {
+		CloseHandle(f);
+		return false;
+	}
+
+	pack_mapping = CreateFileMapping(f, NULL, PAGE_READONLY, 0, 0, NULL);
+	// The mapping holds its own reference to the file:
+	CloseHandle(f);
+	if (!pack_mapping) {
+		LogInfo("  Error mapping shader cache %S: %u\n", pack_path, GetLastError());
+		return false;
+	}
+
+	pack_view = (const char*)MapViewOfFile(pack_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!pack_view) {
+		LogInfo("  Error mapping shader cache %S: %u\n", pack_path, GetLastError());
+		unmap_pack();
+		return false;
+	}
+
+	pack_size = size.QuadPart;
+	return true;
+}
+
+// Builds the index from the mapped pack file. See shader_cache_index_pack()
+static bool index_pack(UINT64 *valid_size, UINT64 *wasted)
+{
+	return shader_cache_index_pack(pack_view, pack_size, &pack_index, valid_size, wasted);
+}
+
+// Records in the mapped pack are bounded by the end of the view, and those
+// we have added since by their own buffer, which is always exactly the size
+// of the record:
+static UINT64 record_available(const char *record)
+{
+	if (pack_view && record >= pack_view && record < pack_view + pack_size)
+		return pack_size - (record - pack_view);
+	return shader_cache_record_size(record);
+}
+
+// Rewrites the pack file with only the current record for each key, dropping
+// superseded and corrupt records:
+static void compact_pack()
+{
+	ShaderCachePackHeader header;
+	wchar_t tmp_path[MAX_PATH];
+	UINT64 valid_size, wasted;
+	UINT32 size;
+	bool ok;
+	FILE *f;
+
+	LogInfo("  Compacting shader cache %S\n", pack_path);
+
+	swprintf_s(tmp_path, MAX_PATH, L"%ls.tmp", pack_path);
+	wfopen_ensuring_access(&f, tmp_path, L"wb");
+	if (!f) {
+		LogInfo("  Error writing %S\n", tmp_path);
+		return;
+	}
+
+	shader_cache_init_pack_header(&header);
+	ok = fwrite(&header, sizeof(ShaderCachePackHeader), 1, f) == 1;
+	for (auto &i : pack_index) {
+		// Already checked when it was indexed, but this is going
+		// straight back into the file, so make sure:
+		if (!shader_cache_record_valid(i.second, record_available(i.second)))
+			continue;
+		size = shader_cache_record_size(i.second);
+		ok = ok && fwrite(i.second, 1, size, f) == size;
+	}
+	ok = !fclose(f) && ok;
+
+	unmap_pack();
+
+	if (!ok || !MoveFileEx(tmp_path, pack_path, MOVEFILE_REPLACE_EXISTING)) {
+		LogInfo("  Error replacing shader cache, discarding it\n");
+		DeleteFile(tmp_path);
+		DeleteFile(pack_path);
+		return;
+	}
+
+	if (map_pack())
+		index_pack(&valid_size, &wasted);
+}
+
+// Called when the config is (re)loaded, since the cache settings and
+// location may have changed:
+void load_shader_cache()
+{
+	const wchar_t *dir;
+	UINT64 valid_size, wasted;
+
+	EnterCriticalSectionPretty(&shader_cache_lock);
+
+	unmap_pack();
+	new_records.clear();
+	include_info.clear();
+	pack_path[0] = 0;
+
+	if (!G->CACHE_SHADERS)
+		goto out_unlock;
+
+	dir = G->SHADER_CACHE_PATH[0] ? G->SHADER_CACHE_PATH : G->SHADER_PATH;
+	if (!dir[0])
+		goto out_unlock;
+	swprintf_s(pack_path, MAX_PATH, L"%ls\\ShaderCache.pack", dir);
+
+	if (!map_pack())
+		goto out_unlock;
+
+	if (!index_pack(&valid_size, &wasted)) {
+		LogInfo("  Discarding incompatible shader cache %S\n", pack_path);
+		unmap_pack();
+		DeleteFile(pack_path);
+		goto out_unlock;
+	}
+
+	// Any corrupt tail has to be removed before we can append to the
+	// pack, and it's worth dropping stale records once they make up a
+	// significant part of the file:
+	if (valid_size < pack_size || wasted > valid_size / 2)
+		compact_pack();
+
+	LogInfo("  Loaded %Iu shaders from shader cache %S\n", pack_index.size(), pack_path);
+
+out_unlock:
+	LeaveCriticalSection(&shader_cache_lock);
+}
+
+static bool hash_file(const wchar_t *path, ShaderCacheKey *key)
+{
+	ShaderCacheHasher hasher;
+	IncludeFilePtr file;
+
+	// Go through the include cache, since if the shader turns out to be
+	// stale we are about to compile it and will need this file anyway:
+	file = include_cache.open(include_cache_path(path));
+	if (!file)
+		return false;
+
+	hasher.update(file->data.data(), file->data.size());
+	*key = hasher.get();
+	return true;
+}
+
+static bool include_unchanged(const wchar_t *path, const ShaderCacheKey &key)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attrs;
+	ShaderCacheIncludeInfo info;
+	UINT64 size;
+
+	if (!GetFileAttributesEx(path, GetFileExInfoStandard, &attrs))
+		return false;
+	size = ((UINT64)attrs.nFileSizeHigh << 32) | attrs.nFileSizeLow;
+
+	auto i = include_info.find(path);
+	if (i == include_info.end()
+			|| CompareFileTime(&i->second.last_write_time, &attrs.ftLastWriteTime)
+			|| i->second.size != size) {
+		if (!hash_file(path, &info.key))
+			return false;
+		info.last_write_time = attrs.ftLastWriteTime;
+		info.size = size;
+		include_info[path] = info;
+		return info.key == key;
+	}
+
+	return i->second.key == key;
+}
+
+bool lookup_shader_cache(const ShaderCacheKey &key, std::vector<char> *code,
+		ShaderCacheIncludes *includes)
+{
+	ShaderCacheIncludes record_includes;
+	bool ret = false;
+
+	EnterCriticalSectionPretty(&shader_cache_lock);
+
+	auto entry = pack_index.find(key);
+	if (entry == pack_index.end())
+		goto out_unlock;
+
+	shader_cache_record_includes(entry->second, &record_includes);
+	for (ShaderCacheInclude &include : record_includes) {
+		if (!include_unchanged(include.path.c_str(), include.key)) {
+			LogInfo("    Cached shader is stale: %S has changed\n", include.path.c_str());
+			goto out_unlock;
+		}
+	}
+
+	shader_cache_record_code(entry->second, code);
+	if (includes)
+		*includes = std::move(record_includes);
+	ret = true;
+
+out_unlock:
+	LeaveCriticalSection(&shader_cache_lock);
+	return ret;
+}
+
+void store_shader_cache(const ShaderCacheKey &key, const ShaderCacheIncludes *includes,
+		const void *code, size_t code_size)
+{
+	ShaderCachePackHeader header;
+	std::vector<char> buf;
+	LARGE_INTEGER size;
+	DWORD written;
+	HANDLE f;
+
+	shader_cache_build_record(key, includes, code, code_size, &buf);
+
+	EnterCriticalSectionPretty(&shader_cache_lock);
+
+	if (!pack_path[0])
+		goto out_unlock;
+
+	f = CreateFile(pack_path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_HANDLE_VALUE) {
+		LogInfo("    Error opening shader cache %S: %u\n", pack_path, GetLastError());
+		goto out_unlock;
+	}
+
+	if (GetFileSizeEx(f, &size) && !size.QuadPart) {
+		shader_cache_init_pack_header(&header);
+		WriteFile(f, &header, sizeof(ShaderCachePackHeader), &written, 0);
+	}
+
+	if (!WriteFile(f, buf.data(), (DWORD)buf.size(), &written, 0) || written != buf.size())
+		LogInfo("    Error writing shader cache %S\n", pack_path);
+	else
+		LogInfo("    Stored compiled shader in shader cache\n");
+	CloseHandle(f);
+
+	// Keep our own copy since the mapped view does not grow with the file:
+	new_records.push_front(std::move(buf));
+	pack_index[key] = new_records.front().data();
+
+out_unlock:
+	LeaveCriticalSection(&shader_cache_lock);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+// Content addressed cache of compiled and assembled shaders.
+//
+// Entries are keyed on a hash of everything that can affect the output of
+// the compiler or assembler - the source, the shader model, compile flags,
+// preprocessor defines, etc - and additionally record every file that was
+// #included during the compilation along with a hash of its contents. An
+// entry is only used if all of those included files are still unchanged, so
+// editing a shared header correctly invalidates every shader that uses it,
+// which the old timestamp matched .bin files next to each .txt file could
+// not do.
+//
+// All entries are stored in a single pack file in the ShaderCache directory
+// which is memory mapped once when the config is loaded, so looking up a
+// cached shader no longer needs to open several files per shader.
+
+#include <windows.h>
+#include <d3dcommon.h>
+#include <string>
+#include <vector>
+
+#include "lock.h"
+#include "ShaderCachePack.h"
+
+// Incrementally hashes the inputs for a ShaderCacheKey
+class ShaderCacheHasher
+{
+	ShaderCacheKey key;
+public:
+	ShaderCacheHasher();
+
+	void update(const void *buf, size_t len);
+	void update(const char *str);
+	void update(UINT32 val);
+
+	ShaderCacheKey get() const { return key; }
+};
+
+ShaderCacheKey shader_cache_hlsl_key(const void *src, size_t src_size, const char *path,
+		const char *shader_model, UINT flags, const D3D_SHADER_MACRO *macros);
+ShaderCacheKey shader_cache_asm_key(const void *src, size_t src_size,
+		const void *orig_bytecode, size_t orig_size);
+
+void load_shader_cache();
+// If includes is not NULL it will be filled out with the files the cached
+// shader included, so the caller can track them for reloads:
+bool lookup_shader_cache(const ShaderCacheKey &key, std::vector<char> *code,
+		ShaderCacheIncludes *includes);
+void store_shader_cache(const ShaderCacheKey &key, const ShaderCacheIncludes *includes,
+		const void *code, size_t code_size);
+
+extern CRITICAL_SECTION shader_cache_lock;
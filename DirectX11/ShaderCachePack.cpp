@@ -0,0 +1,147 @@
+#include "ShaderCachePack.h"
+
+#include <string.h>
+
+static const char shader_cache_magic[4] = {'3', 'D', 'S', 'C'};
+
+void shader_cache_init_pack_header(ShaderCachePackHeader *header)
+{
+	memcpy(header->magic, shader_cache_magic, sizeof(shader_cache_magic));
+	header->version = SHADER_CACHE_VERSION;
+}
+
+bool shader_cache_record_valid(const char *buf, uint64_t size)
+{
+	ShaderCachePackRecord record;
+	ShaderCachePackInclude include;
+	uint64_t pos;
+	uint32_t i;
+
+	if (size < sizeof(ShaderCachePackRecord))
+		return false;
+	memcpy(&record, buf, sizeof(ShaderCachePackRecord));
+	if (record.record_size < sizeof(ShaderCachePackRecord) || record.record_size > size)
+		return false;
+
+	// Everything from here on is bounded by the record_size, which has
+	// already been checked against the size of the pack. Sums are done in
+	// 64 bits, which can't overflow from 32 bit lengths:
+	pos = sizeof(ShaderCachePackRecord);
+	for (i = 0; i < record.num_includes; i++) {
+		if (pos + sizeof(ShaderCachePackInclude) > record.record_size)
+			return false;
+		memcpy(&include, buf + pos, sizeof(ShaderCachePackInclude));
+		pos += sizeof(ShaderCachePackInclude);
+
+		if (pos + (uint64_t)include.path_len * sizeof(wchar_t) > record.record_size)
+			return false;
+		pos += (uint64_t)include.path_len * sizeof(wchar_t);
+	}
+
+	return pos + record.code_size == record.record_size;
+}
+
+bool shader_cache_index_pack(const char *pack, uint64_t pack_size,
+		ShaderCachePackIndex *index, uint64_t *valid_size, uint64_t *wasted)
+{
+	ShaderCachePackHeader header;
+	ShaderCachePackRecord record;
+	uint64_t pos;
+
+	if (pack_size < sizeof(ShaderCachePackHeader))
+		return false;
+	memcpy(&header, pack, sizeof(ShaderCachePackHeader));
+	if (memcmp(header.magic, shader_cache_magic, sizeof(shader_cache_magic)) || header.version != SHADER_CACHE_VERSION)
+		return false;
+
+	// A corrupt record means we can't trust its record_size to find the
+	// next one, so it and everything after it are dropped:
+	*wasted = 0;
+	for (pos = sizeof(ShaderCachePackHeader); pos < pack_size; pos += record.record_size) {
+		if (!shader_cache_record_valid(pack + pos, pack_size - pos))
+			break;
+		memcpy(&record, pack + pos, sizeof(ShaderCachePackRecord));
+
+		auto i = index->find(record.key);
+		if (i != index->end()) {
+			*wasted += shader_cache_record_size(i->second);
+			i->second = pack + pos;
+		} else {
+			(*index)[record.key] = pack + pos;
+		}
+	}
+
+	*valid_size = pos;
+	return true;
+}
+
+uint32_t shader_cache_record_size(const char *record)
+{
+	ShaderCachePackRecord header;
+
+	memcpy(&header, record, sizeof(ShaderCachePackRecord));
+	return header.record_size;
+}
+
+void shader_cache_record_includes(const char *record, ShaderCacheIncludes *includes)
+{
+	ShaderCachePackRecord header;
+	ShaderCachePackInclude include;
+	std::wstring path;
+	const char *pos;
+	uint32_t i;
+
+	memcpy(&header, record, sizeof(ShaderCachePackRecord));
+	pos = record + sizeof(ShaderCachePackRecord);
+
+	includes->clear();
+	for (i = 0; i < header.num_includes; i++) {
+		memcpy(&include, pos, sizeof(ShaderCachePackInclude));
+		pos += sizeof(ShaderCachePackInclude);
+		// The paths are not necessarily aligned:
+		path.resize(include.path_len);
+		memcpy(&path[0], pos, include.path_len * sizeof(wchar_t));
+		pos += include.path_len * sizeof(wchar_t);
+		includes->push_back({path, include.key});
+	}
+}
+
+void shader_cache_record_code(const char *record, std::vector<char> *code)
+{
+	ShaderCachePackRecord header;
+	const char *end;
+
+	memcpy(&header, record, sizeof(ShaderCachePackRecord));
+	end = record + header.record_size;
+	code->assign(end - header.code_size, end);
+}
+
+void shader_cache_build_record(const ShaderCacheKey &key, const ShaderCacheIncludes *includes,
+		const void *code, size_t code_size, std::vector<char> *buf)
+{
+	ShaderCachePackRecord record;
+	ShaderCachePackInclude include;
+	uint32_t i;
+
+	// Zero any padding so the pack contents are deterministic:
+	memset(&record, 0, sizeof(ShaderCachePackRecord));
+	memset(&include, 0, sizeof(ShaderCachePackInclude));
+
+	record.key = key;
+	record.num_includes = includes ? (uint32_t)includes->size() : 0;
+	record.code_size = (uint32_t)code_size;
+
+	buf->clear();
+	buf->insert(buf->end(), (char*)&record, (char*)(&record + 1));
+	for (i = 0; i < record.num_includes; i++) {
+		const ShaderCacheInclude &inc = (*includes)[i];
+		include.key = inc.key;
+		include.path_len = (uint32_t)inc.path.size();
+		buf->insert(buf->end(), (char*)&include, (char*)(&include + 1));
+		buf->insert(buf->end(), (char*)inc.path.data(), (char*)(inc.path.data() + inc.path.size()));
+	}
+	buf->insert(buf->end(), (char*)code, (char*)code + code_size);
+
+	record.record_size = (uint32_t)buf->size();
+	memcpy(buf->data(), &record, sizeof(ShaderCachePackRecord));
+}
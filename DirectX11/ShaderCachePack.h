@@ -0,0 +1,101 @@
+#pragma once
+
+// On disk format of the shader cache pack (ShaderCache.pack), and the code to
+// index, read and build its records.
+//
+// The pack is a header followed by a series of records, each of which is a
+// ShaderCachePackRecord followed by num_includes ShaderCachePackIncludes
+// (each followed by its path), followed by the code. Records are only ever
+// appended, so if the game crashed while writing one the tail of the pack may
+// be truncated, and since the pack is memory mapped every length in a record
+// has to be checked against the size of the file before it is used.
+//
+// This has no Windows or DirectX dependencies, so corrupt packs can be fed to
+// it in tests on any platform. The file access lives in ShaderCache.cpp.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bump this if the pack format or anything that goes into the keys changes:
+#define SHADER_CACHE_VERSION 1
+
+struct ShaderCacheKey
+{
+	uint64_t fnv;
+	uint32_t crc;
+	uint32_t length;
+
+	bool operator==(const ShaderCacheKey &other) const
+	{
+		return fnv == other.fnv && crc == other.crc && length == other.length;
+	}
+	bool operator!=(const ShaderCacheKey &other) const
+	{
+		return !(*this == other);
+	}
+};
+
+struct ShaderCacheKeyHash
+{
+	size_t operator()(const ShaderCacheKey &key) const
+	{
+		return (size_t)(key.fnv ^ key.crc);
+	}
+};
+
+struct ShaderCacheInclude
+{
+	std::wstring path;
+	ShaderCacheKey key;
+};
+typedef std::vector<ShaderCacheInclude> ShaderCacheIncludes;
+
+struct ShaderCachePackHeader
+{
+	char magic[4];
+	uint32_t version;
+};
+
+struct ShaderCachePackRecord
+{
+	ShaderCacheKey key;
+	uint32_t num_includes;
+	uint32_t code_size;
+	uint32_t record_size; // Including this header, the includes and the code
+};
+
+struct ShaderCachePackInclude
+{
+	ShaderCacheKey key;
+	uint32_t path_len; // In wchar_t, not NULL terminated
+};
+
+// Maps keys to records, which must have been checked with
+// shader_cache_record_valid():
+typedef std::unordered_map<ShaderCacheKey, const char*, ShaderCacheKeyHash> ShaderCachePackIndex;
+
+void shader_cache_init_pack_header(ShaderCachePackHeader *header);
+
+// Checks that the record at the start of buf, including every include path
+// and the code, lies within its record_size and that the record_size lies
+// within the size bytes available:
+bool shader_cache_record_valid(const char *buf, uint64_t size);
+
+// Adds every record in the pack to the index. Returns false if the pack is
+// not compatible with this version of 3DMigoto, otherwise sets valid_size to
+// the size of the pack up to the first truncated or corrupt record and
+// wasted to the size of any records that have been superseded by a later
+// record with the same key:
+bool shader_cache_index_pack(const char *pack, uint64_t pack_size,
+		ShaderCachePackIndex *index, uint64_t *valid_size, uint64_t *wasted);
+
+// Reading a record that has already been checked:
+uint32_t shader_cache_record_size(const char *record);
+void shader_cache_record_includes(const char *record, ShaderCacheIncludes *includes);
+void shader_cache_record_code(const char *record, std::vector<char> *code);
+
+void shader_cache_build_record(const ShaderCacheKey &key, const ShaderCacheIncludes *includes,
+		const void *code, size_t code_size, std::vector<char> *buf);
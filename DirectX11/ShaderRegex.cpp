@@ -2,6 +2,7 @@
 #include "CommandList.h"
 #include "globals.h" // For ShaderOverride FIXME: This should be in a separate header
 #include "log.h"
+#include "tracing.h"
 
 #include <algorithm>
 #include <iterator>
@@ -377,6 +378,7 @@ void ShaderRegexGroup::link_command_lists_and_filter_index(UINT64 shader_hash)
 		return;
 
 	shader_override = &G->mShaderOverrideMap[shader_hash];
+	G->shader_override_generation++;
 
 	// Initialise the ShaderOverride's command lists if they aren't already:
 	if (shader_override->command_list.ini_section.empty()) {
@@ -645,6 +647,7 @@ void save_shader_regex_cache_bin(UINT64 hash, const wchar_t *shader_type, vector
 
 bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type, std::string *shader_model, UINT64 hash, std::wstring *tagline)
 {
+	Tracing::Scope trace(Tracing::Event::SHADER_REGEX, hash);
 	ShaderRegexGroups::iterator i;
 	ShaderRegexGroup *group;
 	bool patched = false;
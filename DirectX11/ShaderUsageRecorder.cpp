@@ -0,0 +1,122 @@
+#include "ShaderUsageRecorder.h"
+
+static const size_t SHADER_USAGE_SEEN_INITIAL = 4096;
+
+ShaderUsageInbox::~ShaderUsageInbox()
+{
+	free_chunks(take_all());
+}
+
+void ShaderUsageInbox::push(ShaderUsageChunk *chunk)
+{
+	ShaderUsageChunk *old_head = head.load(std::memory_order_relaxed);
+
+	do {
+		chunk->next = old_head;
+	} while (!head.compare_exchange_weak(old_head, chunk,
+			std::memory_order_release, std::memory_order_relaxed));
+}
+
+ShaderUsageChunk* ShaderUsageInbox::take_all()
+{
+	ShaderUsageChunk *chunks = head.exchange(NULL, std::memory_order_acquire);
+	ShaderUsageChunk *reversed = NULL, *next;
+
+	// Since we only ever take the whole stack at once there is no ABA
+	// problem here. It comes out newest first, so flip it:
+	while (chunks) {
+		next = chunks->next;
+		chunks->next = reversed;
+		reversed = chunks;
+		chunks = next;
+	}
+
+	return reversed;
+}
+
+void ShaderUsageInbox::free_chunks(ShaderUsageChunk *chunks)
+{
+	ShaderUsageChunk *next;
+
+	for (; chunks; chunks = next) {
+		next = chunks->next;
+		delete chunks;
+	}
+}
+
+ShaderUsageRecorder::ShaderUsageRecorder(ShaderUsageInbox *inbox) :
+	inbox(inbox),
+	current(NULL),
+	seen_count(0)
+{}
+
+ShaderUsageRecorder::~ShaderUsageRecorder()
+{
+	publish();
+}
+
+uint64_t ShaderUsageRecorder::hash_record(const ShaderUsageRecord &record)
+{
+	uint64_t h;
+
+	h = record.shader * 0x9e3779b97f4a7c15ull;
+	h ^= record.handle + 0x7f4a7c159e3779b9ull + (h << 6) + (h >> 2);
+	h ^= ((uint64_t)record.hash << 32 | record.orig_hash) + (h << 6) + (h >> 2);
+	h ^= ((uint64_t)(uint32_t)record.slot << 16 | (uint64_t)record.stage << 8 | (uint64_t)record.kind) + (h << 6) + (h >> 2);
+
+	return h * 0x9e3779b97f4a7c15ull;
+}
+
+// Returns false if the record was already in the set
+bool ShaderUsageRecorder::insert_seen(const ShaderUsageRecord &record)
+{
+	std::vector<ShaderUsageRecord> old;
+	size_t mask, i, j;
+
+	if ((seen_count + 1) * 2 > seen.size()) {
+		old.swap(seen);
+		seen.resize(old.empty() ? SHADER_USAGE_SEEN_INITIAL : old.size() * 2);
+		seen_count = 0;
+		for (j = 0; j < old.size(); j++) {
+			if (old[j].kind != ShaderUsageKind::NONE)
+				insert_seen(old[j]);
+		}
+	}
+
+	mask = seen.size() - 1;
+	for (i = (size_t)(hash_record(record) >> 32) & mask; ; i = (i + 1) & mask) {
+		if (seen[i].kind == ShaderUsageKind::NONE) {
+			seen[i] = record;
+			seen_count++;
+			return true;
+		}
+		if (seen[i] == record)
+			return false;
+	}
+}
+
+void ShaderUsageRecorder::record(const ShaderUsageRecord &record)
+{
+	// Nothing is ever removed from the statistics, so a record that has
+	// been made before (and is either still in our current chunk or has
+	// already been published) need not be made again:
+	if (!insert_seen(record))
+		return;
+
+	if (!current)
+		current = new ShaderUsageChunk();
+
+	current->records[current->count++] = record;
+
+	if (current->count == ShaderUsageChunk::CAPACITY)
+		publish();
+}
+
+void ShaderUsageRecorder::publish()
+{
+	if (!current)
+		return;
+
+	inbox->push(current);
+	current = NULL;
+}
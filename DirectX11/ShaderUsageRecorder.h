@@ -0,0 +1,190 @@
+#pragma once
+
+// Collection of the statistics for ShaderUsage.txt while hunting.
+//
+// With dump_usage enabled, every draw call used to take the global critical
+// section for each active shader stage to look up the ShaderInfoData of the
+// shader in a std::map and insert snapshots of every bound resource into the
+// sets for each register, plus each peer shader. With a busy scene that
+// serialised every thread issuing draw calls on that one lock.
+//
+// Instead, each context now appends compact (stage, shader, slot, resource)
+// records to its own ShaderUsageRecorder without any global lock. A recorder
+// belongs to a single context, and a context may only be used by one thread
+// at a time, so recording needs no synchronisation at all. Records the
+// context has made before are filtered out with a hash set, since most draw
+// calls bind the same resources frame after frame and nothing is ever removed
+// from the statistics, so once a scene has been seen each draw call only
+// costs a few hash lookups.
+//
+// Full chunks of records are published to a ShaderUsageInbox, which is a
+// lock free stack that any number of contexts can push to. The immediate
+// context publishes its records at the end of each frame, and deferred
+// contexts when they finish a command list. MergeShaderUsage() then takes
+// everything published so far in one go and folds it into the ShaderInfoData
+// maps under the critical section - that happens once per frame and whenever
+// ShaderUsage.txt is written.
+//
+// This has no Windows or DirectX dependencies, so it can be exercised with
+// synthetic draw streams on any platform.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+// Not VERTEX, DOMAIN, etc. since the CRT's math.h defines DOMAIN as a macro:
+enum class ShaderUsageStage : uint8_t {
+	VS,
+	HS,
+	DS,
+	GS,
+	PS,
+	CS,
+};
+
+enum class ShaderUsageKind : uint8_t {
+	SHADER,         // The shader was used, even if nothing was bound
+	REGISTER,       // Shader resource view
+	RENDER_TARGET,
+	DEPTH_TARGET,
+	UAV,
+	PEER,           // Another shader used in the same draw call
+
+	NONE = 0xff,    // Unused entry in the set of records already made
+};
+
+struct ShaderUsageRecord
+{
+	uint64_t shader;
+	uint64_t handle;        // Resource handle, or hash of a peer shader
+	uint32_t hash;
+	uint32_t orig_hash;
+	int32_t slot;
+	ShaderUsageStage stage;
+	ShaderUsageKind kind;
+
+	ShaderUsageRecord() :
+		shader(0),
+		handle(0),
+		hash(0),
+		orig_hash(0),
+		slot(-1),
+		stage(ShaderUsageStage::VS),
+		kind(ShaderUsageKind::NONE)
+	{}
+
+	ShaderUsageRecord(ShaderUsageStage stage, ShaderUsageKind kind,
+			uint64_t shader, int32_t slot, uint64_t handle,
+			uint32_t hash, uint32_t orig_hash) :
+		shader(shader),
+		handle(handle),
+		hash(hash),
+		orig_hash(orig_hash),
+		slot(slot),
+		stage(stage),
+		kind(kind)
+	{}
+
+	bool operator==(const ShaderUsageRecord &other) const
+	{
+		return shader == other.shader && handle == other.handle &&
+			hash == other.hash && orig_hash == other.orig_hash &&
+			slot == other.slot && stage == other.stage &&
+			kind == other.kind;
+	}
+};
+
+struct ShaderUsageChunk
+{
+	static const size_t CAPACITY = 1024;
+
+	ShaderUsageChunk *next;
+	size_t count;
+	ShaderUsageRecord records[CAPACITY];
+
+	ShaderUsageChunk() : next(NULL), count(0) {}
+};
+
+class ShaderUsageInbox
+{
+	std::atomic<ShaderUsageChunk*> head;
+
+public:
+	ShaderUsageInbox() : head(NULL) {}
+	~ShaderUsageInbox();
+
+	// Safe to call from any thread:
+	void push(ShaderUsageChunk *chunk);
+
+	// Takes every chunk published so far, oldest first, to be freed
+	// with free_chunks() once the caller is done with them:
+	ShaderUsageChunk* take_all();
+
+	static void free_chunks(ShaderUsageChunk *chunks);
+};
+
+class ShaderUsageRecorder
+{
+	ShaderUsageInbox *inbox;
+	ShaderUsageChunk *current;
+
+	// Open addressed hash set of every record made so far:
+	std::vector<ShaderUsageRecord> seen;
+	size_t seen_count;
+
+	static uint64_t hash_record(const ShaderUsageRecord &record);
+	bool insert_seen(const ShaderUsageRecord &record);
+
+public:
+	ShaderUsageRecorder(ShaderUsageInbox *inbox);
+	~ShaderUsageRecorder();
+
+	// Only to be called from the thread currently using the context:
+	void record(const ShaderUsageRecord &record);
+
+	// Publishes anything recorded so far to the inbox. Must not be
+	// called at the same time as record():
+	void publish();
+};
+
+// Folds a single record into the ShaderInfoData of its shader, and the
+// original hash of any shader resource or UAV into the sets used to dump them.
+// A template so that ShaderInfoData and ResourceSnapshot, which refer to D3D
+// types, don't need to be visible here and tests can supply their own:
+template <typename ShaderInfo, typename HashSet>
+void merge_shader_usage_record(ShaderInfo *info, HashSet *resource_hashes,
+		HashSet *uav_hashes, const ShaderUsageRecord &record)
+{
+	typedef typename decltype(info->DepthTargets)::value_type Snapshot;
+	Snapshot snapshot((decltype(Snapshot::handle))(uintptr_t)record.handle,
+			record.hash, record.orig_hash);
+
+	switch (record.kind) {
+		case ShaderUsageKind::REGISTER:
+			if (record.orig_hash)
+				resource_hashes->insert(record.orig_hash);
+			info->ResourceRegisters[record.slot].insert(snapshot);
+			break;
+		case ShaderUsageKind::RENDER_TARGET:
+			if ((size_t)record.slot >= info->RenderTargets.size())
+				info->RenderTargets.resize(record.slot + 1);
+			info->RenderTargets[record.slot].insert(snapshot);
+			break;
+		case ShaderUsageKind::DEPTH_TARGET:
+			info->DepthTargets.insert(snapshot);
+			break;
+		case ShaderUsageKind::UAV:
+			if (record.orig_hash)
+				uav_hashes->insert(record.orig_hash);
+			info->UAVs[record.slot].insert(snapshot);
+			break;
+		case ShaderUsageKind::PEER:
+			info->PeerShaders.insert(record.handle);
+			break;
+		case ShaderUsageKind::SHADER:
+		case ShaderUsageKind::NONE:
+			// Looking up the ShaderInfoData was enough
+			break;
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+// A map stored as a sorted vector of key/value pairs, used in place of
+// std::map for the small tables of parameters and variables in each
+// [KeyOverride] / [Preset] and their save areas.
+//
+// These are mostly built once when the config is loaded and then walked and
+// searched while the game is running, where a contiguous array that can be
+// binary searched beats chasing the nodes of a red-black tree. Insertions
+// and erasures are O(n), which is fine for tables of this size (typically a
+// handful, occasionally a few hundred entries).
+//
+// Iteration is in key order, same as std::map, so anything logged or applied
+// in a loop over one of these happens in the same order as before. Unlike
+// std::map, insertions and erasures invalidate iterators and pointers to
+// values, and the key in the pair is not const, so don't modify it.
+//
+// This implements just enough of the std::map interface for how we use
+// these tables.
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+template <class Key, class T, class Compare = std::less<Key>>
+class SortedVectorMap
+{
+public:
+	typedef std::pair<Key, T> value_type;
+	typedef typename std::vector<value_type>::iterator iterator;
+	typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+private:
+	std::vector<value_type> entries;
+
+	struct KeyCompare {
+		bool operator()(const value_type &lhs, const Key &rhs) const
+		{
+			return Compare()(lhs.first, rhs);
+		}
+	};
+
+	iterator lower_bound(const Key &key)
+	{
+		return std::lower_bound(entries.begin(), entries.end(), key, KeyCompare());
+	}
+
+	const_iterator lower_bound(const Key &key) const
+	{
+		return std::lower_bound(entries.begin(), entries.end(), key, KeyCompare());
+	}
+
+public:
+	iterator begin() { return entries.begin(); }
+	iterator end() { return entries.end(); }
+	const_iterator begin() const { return entries.begin(); }
+	const_iterator end() const { return entries.end(); }
+	bool empty() const { return entries.empty(); }
+	size_t size() const { return entries.size(); }
+	void clear() { entries.clear(); }
+
+	iterator find(const Key &key)
+	{
+		iterator i = lower_bound(key);
+
+		if (i == entries.end() || Compare()(key, i->first))
+			return entries.end();
+		return i;
+	}
+
+	const_iterator find(const Key &key) const
+	{
+		const_iterator i = lower_bound(key);
+
+		if (i == entries.end() || Compare()(key, i->first))
+			return entries.end();
+		return i;
+	}
+
+	T& operator[](const Key &key)
+	{
+		iterator i = lower_bound(key);
+
+		if (i == entries.end() || Compare()(key, i->first))
+			i = entries.insert(i, value_type(key, T()));
+		return i->second;
+	}
+
+	iterator erase(iterator pos)
+	{
+		return entries.erase(pos);
+	}
+};
@@ -0,0 +1,684 @@
+// cmd_LogFormat.cpp : Renders binary frame analysis logs (log_binary) back to
+// the usual text format, or to CSV or JSON.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "BinaryLog.h"
+#include "version.h"
+
+using namespace std;
+using namespace BinaryLog;
+
+enum class OutputFormat {
+	TEXT,
+	CSV,
+	JSON,
+};
+
+static struct {
+	std::vector<std::string> files;
+	std::string output;
+	OutputFormat format;
+	bool stop;
+} args;
+
+static void PrintHelp(int argc, char *argv[])
+{
+	fprintf(stderr, "usage: %s [OPTION] FILE...\n\n", argv[0]);
+
+	fprintf(stderr, "  -t, --text\n");
+	fprintf(stderr, "\t\t\tRender the log in the same format as the text log (default)\n");
+
+	fprintf(stderr, "  -c, --csv\n");
+	fprintf(stderr, "\t\t\tRender one CSV row per event\n");
+
+	fprintf(stderr, "  -j, --json\n");
+	fprintf(stderr, "\t\t\tRender a JSON array with one object per event, including the raw arguments\n");
+
+	fprintf(stderr, "  -o, --output FILE\n");
+	fprintf(stderr, "\t\t\tWrite to FILE instead of next to the log with a .txt/.csv/.json\n");
+	fprintf(stderr, "\t\t\textension. Use - for stdout. Only valid with a single input file\n");
+
+	fprintf(stderr, "  -S, --stop-on-failure\n");
+	fprintf(stderr, "\t\t\tStop processing files if an error occurs\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void PrintVersion()
+{
+	fprintf(stderr, "3DMigoto cmd_LogFormat version %s\n", VER_FILE_VERSION_STR);
+
+	exit(EXIT_SUCCESS);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	bool terminated = false;
+	char *arg;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!terminated && !strncmp(arg, "-", 1) && strcmp(arg, "-")) {
+			if (!strcmp(arg, "--help") || !strcmp(arg, "--usage")) {
+				PrintHelp(argc, argv); // Does not return
+			}
+			if (!strcmp(arg, "--version")) {
+				PrintVersion(); // Does not return
+			}
+			if (!strcmp(arg, "--")) {
+				terminated = true;
+				continue;
+			}
+			if (!strcmp(arg, "-t") || !strcmp(arg, "--text")) {
+				args.format = OutputFormat::TEXT;
+				continue;
+			}
+			if (!strcmp(arg, "-c") || !strcmp(arg, "--csv")) {
+				args.format = OutputFormat::CSV;
+				continue;
+			}
+			if (!strcmp(arg, "-j") || !strcmp(arg, "--json")) {
+				args.format = OutputFormat::JSON;
+				continue;
+			}
+			if (!strcmp(arg, "-o") || !strcmp(arg, "--output")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.output = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "-S") || !strcmp(arg, "--stop-on-failure")) {
+				args.stop = true;
+				continue;
+			}
+			fprintf(stderr, "Unrecognised argument: %s\n", arg);
+			PrintHelp(argc, argv); // Does not return
+		}
+		args.files.push_back(arg);
+	}
+
+	if (args.files.empty()) {
+		fprintf(stderr, "No input files specified\n");
+		PrintHelp(argc, argv); // Does not return
+	}
+
+	if (!args.output.empty() && args.files.size() > 1) {
+		fprintf(stderr, "--output can only be used with a single input file\n");
+		PrintHelp(argc, argv); // Does not return
+	}
+}
+
+struct Format {
+	std::string text;
+	bool wide;
+	std::vector<FormatSpec> specs;
+	std::vector<ArgType> args;
+};
+
+struct Arg {
+	ArgType type;
+	uint64_t val; // Integers, pointers and string ids
+	double dval;
+};
+
+struct Event {
+	uint32_t format_id;
+	uint8_t flags;
+	uint64_t time;
+	uint32_t frame;
+	uint32_t draw_call;
+	std::vector<Arg> args;
+};
+
+class LogReader {
+	std::vector<char> data;
+	size_t pos;
+	uint64_t time;
+
+	bool get(void *dst, size_t len)
+	{
+		if (data.size() - pos < len)
+			return false;
+		memcpy(dst, data.data() + pos, len);
+		pos += len;
+		return true;
+	}
+
+	template <typename T>
+	bool get(T *val)
+	{
+		return get(val, sizeof(T));
+	}
+
+	bool get_string(std::string *str)
+	{
+		uint32_t len;
+
+		if (!get(&len) || data.size() - pos < len)
+			return false;
+		str->assign(data.data() + pos, len);
+		pos += len;
+		return true;
+	}
+
+public:
+	uint32_t pointer_size;
+	uint32_t long_size;
+	std::unordered_map<uint32_t, Format> formats;
+	std::unordered_map<uint32_t, std::string> strings;
+
+	LogReader() : pos(0), time(0), pointer_size(8), long_size(4) {}
+
+	bool open(const char *filename)
+	{
+		char header[sizeof(magic)];
+		uint32_t ver = 0;
+		FILE *fp;
+		long size;
+
+		fp = fopen(filename, "rb");
+		if (!fp) {
+			fprintf(stderr, "%s: Unable to open\n", filename);
+			return false;
+		}
+
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		data.resize(size > 0 ? size : 0);
+		if (fread(data.data(), 1, data.size(), fp) != data.size()) {
+			fprintf(stderr, "%s: Error reading file\n", filename);
+			fclose(fp);
+			return false;
+		}
+		fclose(fp);
+
+		if (!get(header, sizeof(header)) || memcmp(header, magic, sizeof(magic))) {
+			fprintf(stderr, "%s: Not a binary log\n", filename);
+			return false;
+		}
+		if (!get(&ver) || ver != version) {
+			fprintf(stderr, "%s: Unsupported binary log version %u\n", filename, ver);
+			return false;
+		}
+		if (!get(&pointer_size) || !get(&long_size)) {
+			fprintf(stderr, "%s: Truncated header\n", filename);
+			return false;
+		}
+
+		return true;
+	}
+
+	// Returns 1 if an event was read, 0 at the end of the log, or -1 if
+	// the log is corrupt or was truncated (e.g. the game crashed):
+	int next(Event *event)
+	{
+		RecordType type;
+		uint32_t id;
+		uint8_t wide;
+		Format *format;
+		Arg arg;
+
+		while (pos < data.size()) {
+			if (!get(&type))
+				return -1;
+
+			switch (type) {
+				case RecordType::FORMAT:
+					if (!get(&id) || !get(&wide))
+						return -1;
+					format = &formats[id];
+					format->wide = !!wide;
+					if (!get_string(&format->text))
+						return -1;
+					if (!parse_format(format->text, format->wide, long_size, pointer_size, &format->specs))
+						return -1;
+					format->args.clear();
+					for (const FormatSpec &spec : format->specs) {
+						if (spec.width_arg)
+							format->args.push_back(ArgType::INT32);
+						if (spec.precision_arg)
+							format->args.push_back(ArgType::INT32);
+						if (spec.conversion)
+							format->args.push_back(spec.type);
+					}
+					break;
+				case RecordType::STRING:
+					if (!get(&id) || !get_string(&strings[id]))
+						return -1;
+					break;
+				case RecordType::EVENT:
+					if (!get(&event->format_id) || !get(&event->flags))
+						return -1;
+					if (event->flags & EVENT_DRAW_CALL) {
+						if (!get(&event->time) || !get(&event->draw_call))
+							return -1;
+						time = event->time;
+					}
+					// Continuations of a line inherit its timestamp:
+					event->time = time;
+					if ((event->flags & EVENT_FRAME) && !get(&event->frame))
+						return -1;
+					if (!formats.count(event->format_id))
+						return -1;
+
+					event->args.clear();
+					for (ArgType arg_type : formats[event->format_id].args) {
+						int32_t val32;
+						uint32_t id32;
+
+						arg = Arg();
+						arg.type = arg_type;
+						switch (arg_type) {
+							case ArgType::INT32:
+								if (!get(&val32))
+									return -1;
+								arg.val = (uint64_t)(int64_t)val32;
+								break;
+							case ArgType::INT64:
+							case ArgType::POINTER:
+								if (!get(&arg.val))
+									return -1;
+								break;
+							case ArgType::DOUBLE:
+								if (!get(&arg.dval))
+									return -1;
+								break;
+							case ArgType::STRING:
+							case ArgType::WSTRING:
+								if (!get(&id32))
+									return -1;
+								arg.val = id32;
+								break;
+						}
+						event->args.push_back(arg);
+					}
+					return 1;
+				default:
+					return -1;
+			}
+		}
+
+		return 0;
+	}
+
+	const char* lookup_string(uint64_t id)
+	{
+		std::unordered_map<uint32_t, std::string>::iterator i;
+
+		if (id == NULL_STRING)
+			return NULL;
+
+		i = strings.find((uint32_t)id);
+		if (i == strings.end())
+			return "<missing string>";
+		return i->second.c_str();
+	}
+};
+
+static void append_printf(std::string *out, const char *fmt, ...)
+{
+	va_list ap;
+	char buf[256];
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+
+	if ((size_t)len < sizeof(buf)) {
+		out->append(buf, len);
+		return;
+	}
+
+	std::vector<char> big(len + 1);
+	va_start(ap, fmt);
+	vsnprintf(big.data(), big.size(), fmt, ap);
+	va_end(ap);
+	out->append(big.data(), len);
+}
+
+static bool is_narrow_char(const FormatSpec &spec, bool wide)
+{
+	if (spec.length == "h")
+		return true;
+	if (spec.length == "l" || spec.length == "w")
+		return false;
+	return (spec.conversion == 'c') != wide;
+}
+
+// Renders a single conversion the same way the MSVC runtime would have at the
+// time of the call:
+static void render_spec(LogReader *log, const Format &format, const FormatSpec &spec,
+		const std::vector<Arg> &event_args, size_t *argi, std::string *out)
+{
+	std::string flags(spec.flags), width(spec.width), precision(spec.precision), sub;
+	bool has_precision = spec.has_precision;
+	std::string chr;
+	const char *str;
+	wchar_t wchr[2];
+	int32_t val;
+	Arg arg;
+
+	if (spec.width_arg) {
+		val = (int32_t)event_args[(*argi)++].val;
+		if (val < 0) {
+			flags += '-';
+			val = -val;
+		}
+		width = std::to_string(val);
+	}
+	if (spec.precision_arg) {
+		val = (int32_t)event_args[(*argi)++].val;
+		if (val < 0)
+			has_precision = false;
+		else
+			precision = std::to_string(val);
+	}
+
+	arg = event_args[(*argi)++];
+	sub = "%" + flags + width;
+	if (has_precision)
+		sub += "." + precision;
+
+	switch (spec.conversion) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+			if (arg.type == ArgType::INT64) {
+				sub += "ll";
+				sub += spec.conversion;
+				append_printf(out, sub.c_str(), (long long)arg.val);
+			} else {
+				if (spec.length == "h" || spec.length == "hh")
+					sub += spec.length;
+				sub += spec.conversion;
+				append_printf(out, sub.c_str(), (int)(int32_t)arg.val);
+			}
+			break;
+		case 'c': case 'C':
+			if (is_narrow_char(spec, format.wide)) {
+				chr = std::string(1, (char)arg.val);
+			} else {
+				wchr[0] = (wchar_t)arg.val;
+				wchr[1] = L'\0';
+				utf8_from_wide(wchr, &chr);
+			}
+			append_printf(out, ("%" + flags + width + "s").c_str(), chr.c_str());
+			break;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A':
+			sub += spec.conversion;
+			append_printf(out, sub.c_str(), arg.dval);
+			break;
+		case 'p':
+			// MSVC prints pointers as upper case hex padded to the
+			// pointer size of the process, which may not match ours:
+			append_printf(out, "%0*llX", (int)log->pointer_size * 2, (unsigned long long)arg.val);
+			break;
+		case 's': case 'S':
+			str = log->lookup_string(arg.val);
+			sub += "s";
+			append_printf(out, sub.c_str(), str ? str : "(null)");
+			break;
+	}
+}
+
+static void render_text(LogReader *log, const Event &event, bool prefix, std::string *out)
+{
+	const Format &format = log->formats[event.format_id];
+	size_t pos = 0, argi = 0;
+
+	if (prefix) {
+		if (event.flags & EVENT_FRAME)
+			append_printf(out, "%u.", event.frame);
+		if (event.flags & EVENT_DRAW_CALL)
+			append_printf(out, "%06u ", event.draw_call);
+	}
+
+	for (const FormatSpec &spec : format.specs) {
+		out->append(format.text, pos, spec.start - pos);
+		pos = spec.end;
+
+		if (!spec.conversion)
+			*out += '%';
+		else
+			render_spec(log, format, spec, event.args, &argi, out);
+	}
+	out->append(format.text, pos, std::string::npos);
+}
+
+static void append_csv(std::string *out, const std::string &str)
+{
+	*out += '"';
+	for (char c : str) {
+		if (c == '"')
+			*out += '"';
+		*out += c;
+	}
+	*out += '"';
+}
+
+static void append_json(std::string *out, const char *str)
+{
+	if (!str) {
+		*out += "null";
+		return;
+	}
+
+	*out += '"';
+	for (; *str; str++) {
+		switch (*str) {
+			case '"':  *out += "\\\""; break;
+			case '\\': *out += "\\\\"; break;
+			case '\n': *out += "\\n"; break;
+			case '\r': *out += "\\r"; break;
+			case '\t': *out += "\\t"; break;
+			default:
+				if ((unsigned char)*str < 0x20)
+					append_printf(out, "\\u%04x", (unsigned char)*str);
+				else
+					*out += *str;
+		}
+	}
+	*out += '"';
+}
+
+static void strip_newline(std::string *str)
+{
+	while (!str->empty() && (str->back() == '\n' || str->back() == '\r'))
+		str->pop_back();
+}
+
+static void render_csv(LogReader *log, const Event &event, std::string *out)
+{
+	std::string text;
+
+	append_printf(out, "%llu,", (unsigned long long)event.time);
+	if (event.flags & EVENT_FRAME)
+		append_printf(out, "%u", event.frame);
+	*out += ',';
+	if (event.flags & EVENT_DRAW_CALL)
+		append_printf(out, "%u", event.draw_call);
+	append_printf(out, ",%u,", event.format_id);
+
+	render_text(log, event, false, &text);
+	strip_newline(&text);
+	append_csv(out, text);
+	*out += '\n';
+}
+
+static void render_json(LogReader *log, const Event &event, bool first, std::string *out)
+{
+	const Format &format = log->formats[event.format_id];
+	size_t argi = 0;
+	std::string text;
+	bool first_arg = true;
+	bool is_signed;
+
+	*out += first ? "\n" : ",\n";
+	append_printf(out, "{\"time_ns\":%llu", (unsigned long long)event.time);
+	if (event.flags & EVENT_FRAME)
+		append_printf(out, ",\"frame\":%u", event.frame);
+	if (event.flags & EVENT_DRAW_CALL)
+		append_printf(out, ",\"draw_call\":%u", event.draw_call);
+	append_printf(out, ",\"event\":%u,\"format\":", event.format_id);
+	append_json(out, format.text.c_str());
+
+	*out += ",\"args\":[";
+	for (const FormatSpec &spec : format.specs) {
+		if (!spec.conversion)
+			continue;
+		is_signed = spec.conversion == 'd' || spec.conversion == 'i';
+		for (int i = spec.width_arg + spec.precision_arg; i >= 0; i--, argi++) {
+			const Arg &arg = event.args[argi];
+
+			if (!first_arg)
+				*out += ',';
+			first_arg = false;
+
+			switch (arg.type) {
+				case ArgType::INT32:
+					if (i || is_signed)
+						append_printf(out, "%d", (int32_t)arg.val);
+					else
+						append_printf(out, "%u", (uint32_t)arg.val);
+					break;
+				case ArgType::INT64:
+					if (is_signed)
+						append_printf(out, "%lld", (long long)arg.val);
+					else
+						append_printf(out, "%llu", (unsigned long long)arg.val);
+					break;
+				case ArgType::DOUBLE:
+					if (isfinite(arg.dval))
+						append_printf(out, "%.17g", arg.dval);
+					else
+						*out += "null";
+					break;
+				case ArgType::POINTER:
+					// Too large to be safely represented as a JSON number
+					append_printf(out, "\"0x%0*llX\"", (int)log->pointer_size * 2, (unsigned long long)arg.val);
+					break;
+				case ArgType::STRING:
+				case ArgType::WSTRING:
+					append_json(out, log->lookup_string(arg.val));
+					break;
+			}
+		}
+	}
+	*out += ']';
+
+	render_text(log, event, false, &text);
+	strip_newline(&text);
+	*out += ",\"text\":";
+	append_json(out, text.c_str());
+	*out += '}';
+}
+
+static std::string output_filename(const std::string &filename)
+{
+	static const char *extensions[] = {".txt", ".csv", ".json"};
+	size_t dot, sep;
+
+	dot = filename.rfind('.');
+	sep = filename.find_last_of("/\\");
+	if (dot == std::string::npos || (sep != std::string::npos && dot < sep))
+		dot = filename.size();
+
+	return filename.substr(0, dot) + extensions[(int)args.format];
+}
+
+static int process(const std::string &filename)
+{
+	std::string out_filename, out;
+	LogReader log;
+	Event event;
+	FILE *fp;
+	bool first = true;
+	int rc = EXIT_SUCCESS;
+	int ret;
+
+	if (!log.open(filename.c_str()))
+		return EXIT_FAILURE;
+
+	out_filename = args.output.empty() ? output_filename(filename) : args.output;
+	if (out_filename == "-") {
+		fp = stdout;
+	} else {
+		// Text mode to match the line endings of the text log:
+		fp = fopen(out_filename.c_str(), "w");
+		if (!fp) {
+			fprintf(stderr, "%s: Unable to open for writing\n", out_filename.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (args.format == OutputFormat::CSV)
+		out = "time_ns,frame,draw_call,event,text\n";
+	else if (args.format == OutputFormat::JSON)
+		out = "[";
+
+	while ((ret = log.next(&event)) > 0) {
+		switch (args.format) {
+			case OutputFormat::TEXT:
+				render_text(&log, event, true, &out);
+				break;
+			case OutputFormat::CSV:
+				render_csv(&log, event, &out);
+				break;
+			case OutputFormat::JSON:
+				render_json(&log, event, first, &out);
+				break;
+		}
+		first = false;
+
+		if (out.size() >= 64 * 1024) {
+			fwrite(out.data(), 1, out.size(), fp);
+			out.clear();
+		}
+	}
+
+	if (ret < 0) {
+		fprintf(stderr, "%s: Log is truncated or corrupt, stopping at last complete event\n", filename.c_str());
+		rc = EXIT_FAILURE;
+	}
+
+	if (args.format == OutputFormat::JSON)
+		out += "\n]\n";
+	fwrite(out.data(), 1, out.size(), fp);
+
+	if (fp != stdout)
+		fclose(fp);
+
+	return rc;
+}
+
+//-----------------------------------------------------------------------------
+// Console App Entry-Point.
+//-----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	int rc = EXIT_SUCCESS;
+
+	parse_args(argc, argv);
+
+	for (string const &filename : args.files) {
+		rc = process(filename) || rc;
+
+		if (rc && args.stop)
+			return rc;
+	}
+
+	return rc;
+}
@@ -18,6 +18,9 @@
 #include "CommandList.h"
 #include "profiling.h"
 #include "lock.h"
+#include "IniParamsDirtyRange.h"
+#include "FlatHashMap.h"
+#include "ShaderUsageRecorder.h"
 
 extern HINSTANCE migoto_handle;
 
@@ -131,8 +134,9 @@ typedef std::unordered_map<ID3D11DeviceChild *, OriginalShaderInfo> ShaderReload
 // TODO: We can probably merge this into ShaderReloadMap
 typedef std::unordered_map<ID3D11DeviceChild *, ID3D11DeviceChild *> ShaderReplacementMap;
 
-// Key is shader, value is hash key.
-typedef std::unordered_map<ID3D11DeviceChild *, UINT64> ShaderMap;
+// Key is shader, value is hash key. Looked up on every SetShader call and in
+// various places in the draw call path, so uses the flat hash map.
+typedef FlatHashMap<ID3D11DeviceChild *, UINT64> ShaderMap;
 
 enum class FrameAnalysisOptions {
 	INVALID         = 0,
@@ -185,6 +189,7 @@ enum class FrameAnalysisOptions {
 	DEFRD_CTX_DELAY = 0x00800000,
 	DEFRD_CTX_MASK  = 0x00c00000,
 	SYMLINK         = 0x01000000,
+	LOG_BINARY      = 0x02000000,
 	DEPRECATED      = (signed)0x80000000,
 };
 SENSIBLE_ENUM(FrameAnalysisOptions);
@@ -227,6 +232,7 @@ static EnumName_t<wchar_t *, FrameAnalysisOptions> FrameAnalysisOptionNames[] =
 	{L"deferred_ctx_accurate", FrameAnalysisOptions::DEFRD_CTX_DELAY},
 	{L"share_dupes", FrameAnalysisOptions::SHARE_DEDUPED},
 	{L"symlink", FrameAnalysisOptions::SYMLINK},
+	{L"log_binary", FrameAnalysisOptions::LOG_BINARY},
 
 	// Legacy combo options:
 	{L"dump_rt_jps", FrameAnalysisOptions::DUMP_RT_JPS},
@@ -276,7 +282,7 @@ struct ShaderOverride {
 		model[0] = '\0';
 	}
 };
-typedef std::unordered_map<UINT64, struct ShaderOverride> ShaderOverrideMap;
+typedef FlatHashMap<UINT64, struct ShaderOverride> ShaderOverrideMap;
 
 struct TextureOverride {
 	std::wstring ini_section;
@@ -325,7 +331,7 @@ struct TextureOverride {
 	{}
 };
 
-typedef std::unordered_map<ID3D11Resource *, ResourceHandleInfo> ResourceMap;
+typedef FlatHashMap<ID3D11Resource *, ResourceHandleInfo> ResourceMap;
 
 // The TextureOverrideList will be sorted because we want multiple
 // [TextureOverrides] that share the same hash (differentiated by draw context
@@ -334,7 +340,7 @@ typedef std::unordered_map<ID3D11Resource *, ResourceHandleInfo> ResourceMap;
 // TextureOverrides const, but there are a few places we modify it. Instead, we
 // will sort it in the ini parser when we create the list.
 typedef std::vector<struct TextureOverride> TextureOverrideList;
-typedef std::unordered_map<uint32_t, TextureOverrideList> TextureOverrideMap;
+typedef FlatHashMap<uint32_t, TextureOverrideList> TextureOverrideMap;
 
 // We use this when collecting resource info for ShaderUsage.txt to take a
 // snapshot of the resource handle, hash and original hash. We used to just
@@ -479,10 +485,14 @@ struct Globals
 	uint32_t ZBufferHashToInject;
 	DecompilerSettings decompiler_settings;
 	bool DumpUsage;
+	unsigned resource_pool_expire_frames;
+	size_t resource_pool_budget;
+	size_t resource_pool_global_budget;
 	bool ENABLE_TUNE;
 	float gTuneValue[4], gTuneStep;
 
 	std::vector<DirectX::XMFLOAT4> iniParams;
+	IniParamsDirtyRange iniParamsDirty;
 	int iniParamsReserved;
 	int StereoParamsReg;
 	int IniParamsReg;
@@ -559,6 +569,11 @@ struct Globals
 
 	ShaderOverrideMap mShaderOverrideMap;
 	TextureOverrideMap mTextureOverrideMap;
+
+	// Contexts cache the ShaderOverrides for their bound shaders. Bump
+	// this whenever mShaderOverrideMap is modified or shaders are
+	// reloaded to make them look up the ShaderOverrides again:
+	unsigned shader_override_generation;
 	FuzzyTextureOverrides mFuzzyTextureOverrides;
 
 	// Statistics
@@ -612,6 +627,7 @@ struct Globals
 	std::map<UINT64, ShaderInfoData> mGeometryShaderInfo;		// std::map so that ShaderUsage.txt is sorted - lookup time is O(log N)
 	std::map<UINT64, ShaderInfoData> mPixelShaderInfo;			// std::map so that ShaderUsage.txt is sorted - lookup time is O(log N)
 	std::map<UINT64, ShaderInfoData> mComputeShaderInfo;		// std::map so that ShaderUsage.txt is sorted - lookup time is O(log N)
+	ShaderUsageInbox mShaderUsageInbox;					// Recorded by each context, merged into the above by MergeShaderUsage()
 
 	Globals() :
 
@@ -660,10 +676,14 @@ struct Globals
 		EXPORT_BINARY(false),
 		CACHE_SHADERS(false),
 		DumpUsage(false),
+		resource_pool_expire_frames(0),
+		resource_pool_budget(0),
+		resource_pool_global_budget(0),
 		ENABLE_TUNE(false),
 		gTuneStep(0.001f),
 
 		iniParamsReserved(0),
+		shader_override_generation(0),
 
 		constants_run(false),
 		frame_no(0),
@@ -96,9 +96,14 @@ InputAction::~InputAction()
 	delete button;
 }
 
-bool InputAction::Dispatch(HackerDevice *device)
+void InputAction::GetWatchedInputs(InputWatch *watch)
 {
-	bool state = button->CheckState();
+	button->GetWatchedInputs(watch);
+}
+
+bool InputAction::Dispatch(HackerDevice *device, const InputSnapshot &input, uint64_t now)
+{
+	bool state = button->CheckState(input);
 
 	if (state == last_state)
 		return false;
@@ -129,14 +134,14 @@ VKInputButton::VKInputButton(const wchar_t *keyName) :
 		throw keyParseError;
 }
 
-// The check for < 0 is a little odd.  The reason to use this form is because
-// the call can also set the low bit in different situations that can theoretically
-// result in non-zero, but top bit not set. This form ensures we only test the
-// actual key bit.
+bool VKInputButton::CheckState(const InputSnapshot &input)
+{
+	return (input.KeyDown(vkey) ^ invert);
+}
 
-bool VKInputButton::CheckState()
+void VKInputButton::GetWatchedInputs(InputWatch *watch)
 {
-	return ((GetAsyncKeyState(vkey) < 0) ^ invert);
+	watch->keys.push_back(vkey);
 }
 
 
@@ -149,8 +154,8 @@ bool VKInputButton::CheckState()
 // For Dispatch, we have no need to be called as often as we are, that's just
 // an artifact of where we get processing time, from the Draw() calls made by the game.
 // To trim this down to a sensible human-oriented, keyboard input type time, we'll
-// use the GetTickCount64 to skip processing.  The reason to add this limiter is
-// to make auto-repeat slow enough to be usable, and consistent.
+// use the tick count taken with the input snapshot to skip processing.  The reason
+// to add this limiter is to make auto-repeat slow enough to be usable, and consistent.
 
 // TODO: Determine if an alternate thread can properly provide time. That would make
 // it possible to simply have the OS call us as desired.
@@ -160,13 +165,13 @@ RepeatingInputAction::RepeatingInputAction(InputButton *button, shared_ptr<Input
 	InputAction(button, listener)
 {}
 
-bool RepeatingInputAction::Dispatch(HackerDevice *device)
+bool RepeatingInputAction::Dispatch(HackerDevice *device, const InputSnapshot &input, uint64_t now)
 {
 	int ms = (1000 / repeatRate);
-	if (GetTickCount64() < (lastTick + ms))
+	if (now < (lastTick + ms))
 		return false;
 
-	bool state = button->CheckState();
+	bool state = button->CheckState(input);
 
 	// Only allow auto-repeat for down events.
 	if (state || (state != last_state))
@@ -176,7 +181,7 @@ bool RepeatingInputAction::Dispatch(HackerDevice *device)
 		else
 			listener->UpEvent(device);
 
-		lastTick = GetTickCount64();
+		lastTick = now;
 		last_state = state;
 
 		return true;
@@ -185,6 +190,13 @@ bool RepeatingInputAction::Dispatch(HackerDevice *device)
 	return false;
 }
 
+// Keep checking while the key is held to auto-repeat, and while we are still
+// waiting for the rate limit to pass to send the up event:
+bool RepeatingInputAction::NeedsPolling(const InputSnapshot &input)
+{
+	return last_state || button->CheckState(input);
+}
+
 DelayedInputAction::DelayedInputAction(InputButton *button, shared_ptr<InputListener> listener, int delay_down, int delay_up) :
 	delay_down(delay_down),
 	delay_up(delay_up),
@@ -193,10 +205,9 @@ DelayedInputAction::DelayedInputAction(InputButton *button, shared_ptr<InputList
 	InputAction(button, listener)
 {}
 
-bool DelayedInputAction::Dispatch(HackerDevice *device)
+bool DelayedInputAction::Dispatch(HackerDevice *device, const InputSnapshot &input, uint64_t now)
 {
-	ULONGLONG now = GetTickCount64();
-	bool state = button->CheckState();
+	bool state = button->CheckState(input);
 
 	if (state != last_state)
 		state_change_time = now;
@@ -217,26 +228,24 @@ bool DelayedInputAction::Dispatch(HackerDevice *device)
 	return false;
 }
 
-// -----------------------------------------------------------------------------
+// Keep checking while a delayed event is pending:
+bool DelayedInputAction::NeedsPolling(const InputSnapshot &input)
+{
+	return button->CheckState(input) != effective_state;
+}
 
-struct XInputState_t {
-	XINPUT_STATE state;
-	bool connected;
-};
-static XInputState_t XInputState[4];
+// -----------------------------------------------------------------------------
 
-bool XInputButton::_CheckState(int controller)
+bool XInputButton::_CheckState(const InputGamepadState *gamepad)
 {
-	XINPUT_GAMEPAD *gamepad = &XInputState[controller].state.Gamepad;
-
-	if (!XInputState[controller].connected)
+	if (!gamepad->connected)
 		return false; // Don't invert if it's not connected
 
-	if (button && (gamepad->wButtons & button))
+	if (button && (gamepad->buttons & button))
 		return true ^ invert;
-	if (left_trigger && (gamepad->bLeftTrigger >= left_trigger))
+	if (left_trigger && (gamepad->left_trigger >= left_trigger))
 		return true ^ invert;
-	if (right_trigger && (gamepad->bRightTrigger >= right_trigger))
+	if (right_trigger && (gamepad->right_trigger >= right_trigger))
 		return true ^ invert;
 
 	return false ^ invert;
@@ -333,21 +342,29 @@ XInputButton::XInputButton(const wchar_t *keyName) :
 	*trigger = min(threshold + 1, 255);
 }
 
-bool XInputButton::CheckState()
+bool XInputButton::CheckState(const InputSnapshot &input)
 {
 	int i;
 
 	if (controller != -1)
-		return _CheckState(controller);
+		return _CheckState(&input.gamepads[controller]);
 
 	for (i = 0; i < 4; i++) {
-		if (_CheckState(i))
+		if (_CheckState(&input.gamepads[i]))
 			return true;
 	}
 
 	return false;
 }
 
+void XInputButton::GetWatchedInputs(InputWatch *watch)
+{
+	if (controller != -1)
+		watch->gamepads |= 1 << controller;
+	else
+		watch->gamepads |= 0xf;
+}
+
 InputButtonList::InputButtonList(const wchar_t *keyName)
 {
 	const wchar_t *ptr = keyName, *cur = NULL;
@@ -416,19 +433,28 @@ InputButtonList::~InputButtonList()
 	clear();
 }
 
-bool InputButtonList::CheckState()
+bool InputButtonList::CheckState(const InputSnapshot &input)
 {
 	vector<InputButton*>::iterator i;
 
 	for (i = buttons.begin(); i < buttons.end(); i++) {
-		if (!(*i)->CheckState())
+		if (!(*i)->CheckState(input))
 			return false;
 	}
 
 	return true;
 }
 
+void InputButtonList::GetWatchedInputs(InputWatch *watch)
+{
+	vector<InputButton*>::iterator i;
+
+	for (i = buttons.begin(); i < buttons.end(); i++)
+		(*i)->GetWatchedInputs(watch);
+}
+
 static std::vector<class InputAction *> actions;
+static InputDispatcher dispatcher;
 
 void RegisterKeyBinding(LPCWSTR iniKey, const wchar_t *keyName,
 		shared_ptr<InputListener> listener, int auto_repeat, int down_delay,
@@ -466,6 +492,7 @@ void RegisterKeyBinding(LPCWSTR iniKey, const wchar_t *keyName,
 
 	LogInfoW(L"  %s=%s\n", iniKey, keyName);
 	actions.push_back(action);
+	dispatcher.Add(action);
 }
 
 bool RegisterIniKeyBinding(LPCWSTR app, LPCWSTR iniKey,
@@ -523,6 +550,8 @@ void ClearKeyBindings()
 {
 	std::vector<class InputAction *>::iterator i;
 
+	dispatcher.Clear();
+
 	for (i = actions.begin(); i != actions.end(); i++)
 		delete *i;
 
@@ -541,36 +570,72 @@ static bool CheckForegroundWindow()
 	return (pid == GetCurrentProcessId());
 }
 
-bool DispatchInputEvents(HackerDevice *device)
-{
-	std::vector<class InputAction *>::iterator i;
-	class InputAction *action;
-	bool input_processed = false;
-	static time_t last_time = 0;
-	time_t now = time(NULL);
-	int j;
-
-	if (!CheckForegroundWindow())
-		return false;
+// Takes the input snapshot for the dispatcher from the real keyboard and
+// controllers. Only the keys and controllers used by some key binding are
+// polled, so a config without any xinput bindings never calls into xinput.
+class Win32InputSource : public InputSource {
+	time_t last_time;
 
-	for (j = 0; j < 4; j++) {
-		// Stagger polling controllers that were not connected last
-		// frame over four seconds to minimise performance impact,
-		// which has been observed to be extremely significant.
-		if (!XInputState[j].connected && ((now == last_time) || (now % 4 != j)))
-			continue;
+public:
+	Win32InputSource() : last_time(0) {}
 
-		XInputState[j].connected =
-			(_XInputGetState(j, &XInputState[j].state) == ERROR_SUCCESS);
-	}
+	void Poll(InputSnapshot *snapshot, const std::vector<int> &keys, unsigned gamepads) override
+	{
+		std::vector<int>::const_iterator i;
+		time_t now;
+		XINPUT_STATE state;
+		InputGamepadState *gamepad;
+		int j;
+
+		// The check for < 0 is a little odd.  The reason to use this
+		// form is because the call can also set the low bit in
+		// different situations that can theoretically result in
+		// non-zero, but top bit not set. This form ensures we only
+		// test the actual key bit.
+		for (i = keys.begin(); i != keys.end(); i++)
+			snapshot->keys[*i] = (GetAsyncKeyState(*i) < 0);
+
+		if (!gamepads)
+			return;
 
-	last_time = now;
+		now = time(NULL);
+		for (j = 0; j < 4; j++) {
+			gamepad = &snapshot->gamepads[j];
+
+			if (!(gamepads & (1 << j)))
+				continue;
+
+			// Stagger polling controllers that were not connected last
+			// frame over four seconds to minimise performance impact,
+			// which has been observed to be extremely significant.
+			if (!gamepad->connected && ((now == last_time) || (now % 4 != j)))
+				continue;
+
+			gamepad->connected = (_XInputGetState(j, &state) == ERROR_SUCCESS);
+			if (gamepad->connected) {
+				gamepad->buttons = state.Gamepad.wButtons;
+				gamepad->left_trigger = state.Gamepad.bLeftTrigger;
+				gamepad->right_trigger = state.Gamepad.bRightTrigger;
+			} else {
+				gamepad->buttons = 0;
+				gamepad->left_trigger = 0;
+				gamepad->right_trigger = 0;
+			}
+		}
 
-	for (i = actions.begin(); i != actions.end(); i++) {
-		action = *i;
+		last_time = now;
+	}
 
-		input_processed |= action->Dispatch(device);
+	uint64_t GetTickCount() override
+	{
+		return GetTickCount64();
 	}
+} win32_input_source;
+
+bool DispatchInputEvents(HackerDevice *device)
+{
+	if (!CheckForegroundWindow())
+		return false;
 
-	return input_processed;
+	return dispatcher.Dispatch(device, &win32_input_source);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "HackerDevice.h"
+#include "InputDispatch.h"
 
 // The "input" files are a set of objects to handle user input for both gaming 
 // purposes and for tool purposes, like hunting for shaders.
@@ -56,10 +57,13 @@ public:
 
 
 // -----------------------------------------------------------------------------
-// Abstract base class of all input backend button classes
+// Abstract base class of all input backend button classes. Buttons check
+// their state in the snapshot taken at the start of each frame, and report
+// which inputs they need in that snapshot via GetWatchedInputs().
 class InputButton {
 public:
-	virtual bool CheckState() = 0;
+	virtual bool CheckState(const InputSnapshot &input) = 0;
+	virtual void GetWatchedInputs(InputWatch *watch) = 0;
 };
 
 // -----------------------------------------------------------------------------
@@ -75,7 +79,8 @@ public:
 	bool invert;
 
 	VKInputButton(const wchar_t *keyName);
-	bool CheckState() override;
+	bool CheckState(const InputSnapshot &input) override;
+	void GetWatchedInputs(InputWatch *watch) override;
 };
 
 // -----------------------------------------------------------------------------
@@ -89,10 +94,11 @@ private:
 	BYTE right_trigger;
 	bool invert;
 
-	bool _CheckState(int controller);
+	bool _CheckState(const InputGamepadState *gamepad);
 public:
 	XInputButton(const wchar_t *keyName);
-	bool CheckState() override;
+	bool CheckState(const InputSnapshot &input) override;
+	void GetWatchedInputs(InputWatch *watch) override;
 };
 
 // -----------------------------------------------------------------------------
@@ -104,7 +110,8 @@ class InputButtonList : public InputButton {
 public:
 	InputButtonList(const wchar_t *keyName);
 	~InputButtonList();
-	bool CheckState() override;
+	bool CheckState(const InputSnapshot &input) override;
+	void GetWatchedInputs(InputWatch *watch) override;
 };
 
 
@@ -112,7 +119,7 @@ public:
 // InputAction combines an InputButton and an InputListener together to create
 // an action.
 
-class InputAction {
+class InputAction : public InputActionBase {
 public:
 	bool last_state;
 	InputButton *button;
@@ -121,7 +128,8 @@ public:
 	InputAction(InputButton *button, shared_ptr<InputListener> listener);
 	virtual ~InputAction();
 
-	virtual bool Dispatch(HackerDevice *device);
+	void GetWatchedInputs(InputWatch *watch) override;
+	bool Dispatch(HackerDevice *device, const InputSnapshot &input, uint64_t now) override;
 };
 
 // -----------------------------------------------------------------------------
@@ -135,7 +143,8 @@ private:
 
 public:
 	RepeatingInputAction(InputButton *button, shared_ptr<InputListener> listener, int repeat);
-	bool Dispatch(HackerDevice *device) override;
+	bool Dispatch(HackerDevice *device, const InputSnapshot &input, uint64_t now) override;
+	bool NeedsPolling(const InputSnapshot &input) override;
 };
 
 // -----------------------------------------------------------------------------
@@ -148,7 +157,8 @@ private:
 	ULONGLONG state_change_time;
 public:
 	DelayedInputAction(InputButton *button, shared_ptr<InputListener> listener, int delayDown, int delayUp);
-	bool Dispatch(HackerDevice *device) override;
+	bool Dispatch(HackerDevice *device, const InputSnapshot &input, uint64_t now) override;
+	bool NeedsPolling(const InputSnapshot &input) override;
 };
 
 
@@ -43,11 +43,14 @@ namespace Profiling {
 	unsigned views_cleared;
 	unsigned resources_created;
 	unsigned resource_pool_swaps;
+	unsigned resource_pool_evictions;
 	unsigned max_copies_per_frame_exceeded;
 	unsigned injected_draw_calls;
 	unsigned skipped_draw_calls;
 	unsigned max_executions_per_frame_exceeded;
 	unsigned iniparams_updates;
+	size_t iniparams_bytes_uploaded;
+	unsigned shaderoverride_lookups_avoided;
 }
 
 static LARGE_INTEGER profiling_start_time;
@@ -227,6 +230,7 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 			    L"  Texture hash / info: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
 			    L"      TextureOverride: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
 			    L"       Resource pools: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
+			    L" ShaderOverride cache: %u lookups avoided/frame\n"
 			    ,
 			    (float)shader_hash_lookup_overhead.QuadPart / frames,
 			    60.0 * shader_hash_lookup_overhead.QuadPart / collection_duration.QuadPart,
@@ -261,14 +265,16 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 			    (float)resource_pool_lookup_overhead.QuadPart / frames,
 			    60.0 * resource_pool_lookup_overhead.QuadPart / collection_duration.QuadPart,
 			    Profiling::resource_pool_lookup_overhead.hits / frames,
-			    Profiling::resource_pool_lookup_overhead.count / frames
+			    Profiling::resource_pool_lookup_overhead.count / frames,
+
+			    Profiling::shaderoverride_lookups_avoided / frames
 	);
 	Profiling::text += buf;
 
 	_snwprintf_s(buf, ARRAYSIZE(buf), _TRUNCATE,
 			    L"\n"
 			    L"GPU Performance Impacting Stats (costs are guidelines only):\n"
-			    L"   IniParams GPU resource updates: %4u/frame (%Iu bytes)\n"
+			    L"   IniParams GPU resource updates: %4u/frame (%Iu/%Iu bytes uploaded/frame)\n"
 			    L"             Full resource copies: %4u/frame (High cost)\n"
 			    L"     By-Reference resource copies: %4u/frame (Low cost)\n"
 			    L"     Inter-device resource copies: %4u/frame (Extremely high cost)\n"
@@ -278,12 +284,14 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 			    L"                Resources cleared: %4u/frame (Cost saving in some circumstances, e.g. SLI)\n"
 			    L"            Resources [re]created: %4u       (High cost)\n"
 			    L"              Resource pool swaps: %4u/frame (Low cost)\n"
+			    L"          Resource pool evictions: %4u/frame (%Iu bytes held in %Iu pools)\n"
 			    L"    max_copies_per_frame exceeded: %4u/frame (Cost saving)\n"
 			    L"     Injected draw/dispatch calls: %4u/frame\n"
 			    L"               Skipped draw calls: %4u/frame (Cost saving)\n"
 			    L"max_executions_per_frame exceeded: %4u/frame (Cost saving)\n"
 			    ,
-			    Profiling::iniparams_updates / frames, G->iniParams.size() * sizeof(DirectX::XMFLOAT4),
+			    Profiling::iniparams_updates / frames,
+			    Profiling::iniparams_bytes_uploaded / frames, G->iniParams.size() * sizeof(DirectX::XMFLOAT4),
 			    Profiling::resource_full_copies / frames,
 			    Profiling::resource_reference_copies / frames,
 			    Profiling::inter_device_copies / frames,
@@ -293,6 +301,7 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 			    Profiling::views_cleared / frames,
 			    Profiling::resources_created,
 			    Profiling::resource_pool_swaps / frames,
+			    Profiling::resource_pool_evictions / frames, resource_pools_size, resource_pools_count,
 			    Profiling::max_copies_per_frame_exceeded / frames,
 			    Profiling::injected_draw_calls / frames,
 			    Profiling::skipped_draw_calls / frames,
@@ -472,11 +481,14 @@ void Profiling::clear()
 	views_cleared = 0;
 	resources_created = 0;
 	resource_pool_swaps = 0;
+	resource_pool_evictions = 0;
 	max_copies_per_frame_exceeded = 0;
 	injected_draw_calls = 0;
 	skipped_draw_calls = 0;
 	max_executions_per_frame_exceeded = 0;
 	iniparams_updates = 0;
+	iniparams_bytes_uploaded = 0;
+	shaderoverride_lookups_avoided = 0;
 
 	start_frame_no = G->frame_no;
 	QueryPerformanceCounter(&profiling_start_time);
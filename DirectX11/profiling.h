@@ -52,7 +52,7 @@ namespace Profiling {
 		auto ret = map.find(key);
 		if (Profiling::mode == Profiling::Mode::SUMMARY) {
 			Profiling::end(&state, overhead);
-			if (ret != end(map))
+			if (ret != map.end())
 				overhead->hits++;
 		}
 		return ret;
@@ -94,11 +94,14 @@ namespace Profiling {
 	extern unsigned views_cleared;
 	extern unsigned resources_created;
 	extern unsigned resource_pool_swaps;
+	extern unsigned resource_pool_evictions;
 	extern unsigned max_copies_per_frame_exceeded;
 	extern unsigned injected_draw_calls;
 	extern unsigned skipped_draw_calls;
 	extern unsigned max_executions_per_frame_exceeded;
 	extern unsigned iniparams_updates;
+	extern size_t iniparams_bytes_uploaded;
+	extern unsigned shaderoverride_lookups_avoided;
 
 	// NvAPI profiling:
 
@@ -0,0 +1,230 @@
+#include "tracing.h"
+
+#include <algorithm>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <chrono>
+#include <functional>
+#include <thread>
+#endif
+
+namespace Tracing {
+	bool enabled;
+
+	// Every buffer ever allocated, so the exporter can find them. Buffers
+	// are never freed, as threads that have exited may still have
+	// interesting events in them, and games don't tend to create an
+	// unbounded number of threads that call into DirectX. The list itself
+	// is never destroyed either, so it is still there for any thread
+	// recording an event during exit:
+	static std::mutex buffers_lock;
+	static std::vector<RingBuffer*> &buffers = *new std::vector<RingBuffer*>;
+	static std::atomic<size_t> buffer_capacity;
+
+	static thread_local RingBuffer *thread_buffer;
+}
+
+Tracing::RingBuffer::RingBuffer(size_t capacity, uint64_t thread_id) :
+	thread_id(thread_id),
+	head(0)
+{
+	size_t n = 1;
+
+	while (n < capacity)
+		n *= 2;
+
+	slots = new Slot[n];
+	mask = n - 1;
+}
+
+Tracing::RingBuffer::~RingBuffer()
+{
+	delete [] slots;
+}
+
+size_t Tracing::RingBuffer::snapshot(std::vector<Record> *out) const
+{
+	size_t old_size = out->size();
+	uint64_t begin, end, after, pos, discard, info;
+	const Slot *slot;
+	Record record;
+
+	end = head.load(std::memory_order_acquire);
+	begin = end > capacity() ? end - capacity() : 0;
+
+	for (pos = begin; pos < end; pos++) {
+		slot = &slots[pos & mask];
+		info = slot->info.load(std::memory_order_relaxed);
+		record.start = slot->start.load(std::memory_order_relaxed);
+		record.arg = slot->arg.load(std::memory_order_relaxed);
+		record.duration = (uint32_t)info;
+		record.event = (uint16_t)(info >> 32);
+		record.flags = (uint16_t)(info >> 48);
+		out->push_back(record);
+	}
+
+	// If the owning thread recorded more events while we were copying,
+	// the oldest records we copied may have been overwritten (including
+	// the slot it may be writing to right now), so throw them away:
+	std::atomic_thread_fence(std::memory_order_acquire);
+	after = head.load(std::memory_order_relaxed);
+	if (after + 1 > begin + capacity()) {
+		discard = std::min<uint64_t>(after + 1 - capacity() - begin, end - begin);
+		out->erase(out->begin() + old_size, out->begin() + old_size + (size_t)discard);
+	}
+
+	return out->size() - old_size;
+}
+
+#ifdef _WIN32
+uint64_t Tracing::timestamp()
+{
+	LARGE_INTEGER now;
+
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+uint64_t Tracing::frequency()
+{
+	LARGE_INTEGER freq;
+
+	QueryPerformanceFrequency(&freq);
+	return freq.QuadPart;
+}
+
+static uint64_t current_thread_id()
+{
+	return GetCurrentThreadId();
+}
+#else
+uint64_t Tracing::timestamp()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t Tracing::frequency()
+{
+	return 1000000000;
+}
+
+static uint64_t current_thread_id()
+{
+	return std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+#endif
+
+const char* Tracing::event_name(Event event)
+{
+	switch (event) {
+		case Event::DRAW: return "Draw";
+		case Event::COMMAND_LIST: return "CommandList";
+		case Event::MAP: return "Map";
+		case Event::CREATE_SHADER: return "CreateShader";
+		case Event::SHADER_REGEX: return "ShaderRegex";
+		case Event::PRESENT: return "Present";
+		case Event::INVALID: break;
+	}
+	return "Unknown";
+}
+
+void Tracing::configure(size_t records_per_thread)
+{
+	buffer_capacity = records_per_thread;
+	enabled = !!records_per_thread;
+}
+
+static Tracing::RingBuffer* register_thread()
+{
+	Tracing::RingBuffer *buf;
+	size_t capacity = Tracing::buffer_capacity;
+
+	if (!capacity)
+		return NULL;
+
+	buf = new Tracing::RingBuffer(capacity, current_thread_id());
+
+	std::lock_guard<std::mutex> lock(Tracing::buffers_lock);
+	Tracing::buffers.push_back(buf);
+	return buf;
+}
+
+void Tracing::record(Event event, uint64_t start, uint64_t end, uint64_t arg, uint16_t flags)
+{
+	RingBuffer *buf = thread_buffer;
+	Record record;
+
+	if (!buf) {
+		buf = thread_buffer = register_thread();
+		if (!buf)
+			return;
+	}
+
+	record.start = start;
+	record.arg = arg;
+	record.duration = (uint32_t)std::min<uint64_t>(end - start, UINT32_MAX);
+	record.event = (uint16_t)event;
+	record.flags = flags;
+
+	buf->push(record);
+}
+
+size_t Tracing::export_chrome_trace(FILE *fp)
+{
+	std::vector<std::vector<Record>> snapshots;
+	std::vector<uint64_t> thread_ids;
+	uint64_t base = UINT64_MAX;
+	double us_per_tick = 1000000.0 / frequency();
+	size_t i, written = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(buffers_lock);
+
+		snapshots.resize(buffers.size());
+		for (i = 0; i < buffers.size(); i++) {
+			buffers[i]->snapshot(&snapshots[i]);
+			thread_ids.push_back(buffers[i]->thread_id);
+		}
+	}
+
+	// Records are written when an event ends, so nested events appear
+	// before their parents. Sort them by start time for the benefit of
+	// any viewer that expects that, and find the earliest timestamp so
+	// the exported times start from zero:
+	for (auto &snapshot : snapshots) {
+		std::stable_sort(snapshot.begin(), snapshot.end(),
+			[](const Record &lhs, const Record &rhs) { return lhs.start < rhs.start; });
+		if (!snapshot.empty())
+			base = std::min<uint64_t>(base, snapshot.front().start);
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	for (i = 0; i < snapshots.size(); i++) {
+		for (const Record &record : snapshots[i]) {
+			const char *name = event_name((Event)record.event);
+			double ts = (record.start - base) * us_per_tick;
+
+			if (record.flags & RECORD_INSTANT) {
+				fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+						"\"pid\":1,\"tid\":%llu,\"args\":{\"arg\":\"0x%llx\"}}",
+						written ? "," : "", name, ts,
+						(unsigned long long)thread_ids[i], (unsigned long long)record.arg);
+			} else {
+				fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+						"\"pid\":1,\"tid\":%llu,\"args\":{\"arg\":\"0x%llx\"}}",
+						written ? "," : "", name, ts, record.duration * us_per_tick,
+						(unsigned long long)thread_ids[i], (unsigned long long)record.arg);
+			}
+			written++;
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+
+	return written;
+}
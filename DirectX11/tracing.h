@@ -0,0 +1,148 @@
+#pragma once
+
+// Low overhead event tracing for building a timeline of where 3DMigoto spends
+// its time, complementing the aggregated counters in profiling.h.
+//
+// Each thread that emits an event gets its own ring buffer of fixed size
+// records, so recording an event never takes a lock and never allocates
+// (other than the first event on a new thread). Once a buffer is full the
+// oldest events are overwritten, so it is cheap enough to leave on and dump
+// the last few seconds when something interesting happens. The buffers can
+// be exported to Chrome trace JSON, which can be loaded in chrome://tracing
+// or https://ui.perfetto.dev
+//
+// This file and tracing.cpp deliberately avoid any Windows or DirectX
+// dependencies so that they can be built and exercised on other platforms.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+namespace Tracing {
+	enum class Event : uint16_t {
+		DRAW,
+		COMMAND_LIST,
+		MAP,
+		CREATE_SHADER,
+		SHADER_REGEX,
+		PRESENT,
+
+		INVALID, // Must be last
+	};
+
+	enum RecordFlags : uint16_t {
+		RECORD_INSTANT = 0x1,
+	};
+
+	// 24 bytes per record. Timestamps are in ticks of timestamp(), which
+	// is QueryPerformanceCounter on Windows:
+	struct Record {
+		uint64_t start;
+		uint64_t arg;
+		uint32_t duration;
+		uint16_t event;
+		uint16_t flags;
+	};
+
+	// Single producer ring buffer. Only the owning thread may push(), but
+	// any thread may take a snapshot() at any time. A snapshot taken while
+	// the owner is writing discards any records that may have been
+	// overwritten while they were being copied, so it may be missing the
+	// oldest few events, but will never contain a torn record.
+	class RingBuffer {
+	public:
+		RingBuffer(size_t capacity, uint64_t thread_id);
+		~RingBuffer();
+
+		inline void push(const Record &record)
+		{
+			uint64_t pos = head.load(std::memory_order_relaxed);
+			Slot *slot = &slots[pos & mask];
+
+			// The slots are only accessed with relaxed atomics, which
+			// are plain moves on x86, so that a snapshot copying a
+			// slot while it is overwritten is not a data race. The
+			// fence ensures that a snapshot that sees any part of the
+			// new record also sees the previous head, and so knows
+			// this slot may have been overwritten:
+			std::atomic_thread_fence(std::memory_order_release);
+			slot->start.store(record.start, std::memory_order_relaxed);
+			slot->arg.store(record.arg, std::memory_order_relaxed);
+			slot->info.store(record.duration | (uint64_t)record.event << 32 |
+					(uint64_t)record.flags << 48, std::memory_order_relaxed);
+			head.store(pos + 1, std::memory_order_release);
+		}
+
+		size_t snapshot(std::vector<Record> *out) const;
+		size_t capacity() const { return mask + 1; }
+		uint64_t total_recorded() const { return head.load(std::memory_order_acquire); }
+
+		const uint64_t thread_id;
+
+	private:
+		// A Record, with duration, event and flags packed into info:
+		struct Slot {
+			std::atomic<uint64_t> start;
+			std::atomic<uint64_t> arg;
+			std::atomic<uint64_t> info;
+		};
+
+		Slot *slots;
+		size_t mask;
+		std::atomic<uint64_t> head;
+
+		RingBuffer(const RingBuffer&) = delete;
+		RingBuffer& operator=(const RingBuffer&) = delete;
+	};
+
+	uint64_t timestamp();
+	uint64_t frequency();
+	const char* event_name(Event event);
+
+	// Sets the number of records in each thread's ring buffer (rounded up
+	// to a power of two) and enables tracing, or disables it if zero.
+	// Buffers already allocated keep their original size.
+	void configure(size_t records_per_thread);
+
+	void record(Event event, uint64_t start, uint64_t end, uint64_t arg, uint16_t flags);
+
+	// Writes the contents of every thread's ring buffer as a Chrome trace
+	// JSON object. Returns the number of events written:
+	size_t export_chrome_trace(FILE *fp);
+
+	extern bool enabled;
+
+	static inline void instant(Event event, uint64_t arg)
+	{
+		if (enabled) {
+			uint64_t now = timestamp();
+			record(event, now, now, arg, RECORD_INSTANT);
+		}
+	}
+
+	// Records a complete event covering the lifetime of this object. Only
+	// one record is written when the scope ends, so a ring buffer that has
+	// wrapped can never be left with unbalanced begin/end pairs:
+	class Scope {
+	public:
+		Scope(Event event, uint64_t arg) :
+			event(event),
+			arg(arg),
+			start(enabled ? timestamp() : 0)
+		{}
+
+		~Scope()
+		{
+			if (start)
+				record(event, start, timestamp(), arg, 0);
+		}
+
+		void set_arg(uint64_t val) { arg = val; }
+
+	private:
+		Event event;
+		uint64_t arg;
+		uint64_t start;
+	};
+}
@@ -16,6 +16,24 @@ extern bool gLogDebug;
 // probably not worth doing so unless we were switching to use a central
 // logging framework.
 
+#ifdef MIGOTO_ASYNC_LOG
+// Projects that link in the asynchronous logging backend send messages to it
+// instead of the log file once it has been enabled:
+#include "DirectX11/AsyncLog.h"
+
+#define LogInfo(fmt, ...) \
+	do { if (LogFile) { if (AsyncLog::enabled) AsyncLog::printf(fmt, __VA_ARGS__); else fprintf(LogFile, fmt, __VA_ARGS__); } } while (0)
+#define vLogInfo(fmt, va_args) \
+	do { if (LogFile) { if (AsyncLog::enabled) AsyncLog::vprintf(fmt, va_args); else vfprintf(LogFile, fmt, va_args); } } while (0)
+#define LogInfoW(fmt, ...) \
+	do { if (LogFile) { if (AsyncLog::enabled) AsyncLog::wprintf(fmt, __VA_ARGS__); else fwprintf(LogFile, fmt, __VA_ARGS__); } } while (0)
+#define vLogInfoW(fmt, va_args) \
+	do { if (LogFile) { if (AsyncLog::enabled) AsyncLog::vwprintf(fmt, va_args); else vfwprintf(LogFile, fmt, va_args); } } while (0)
+#define LogWrite(buf, len) \
+	do { if (LogFile) { if (AsyncLog::enabled) AsyncLog::write(buf, len); else fwrite(buf, 1, len, LogFile); } } while (0)
+#define LogFlush() \
+	do { if (LogFile) { if (AsyncLog::enabled) AsyncLog::flush(); else fflush(LogFile); } } while (0)
+#else
 #define LogInfo(fmt, ...) \
 	do { if (LogFile) fprintf(LogFile, fmt, __VA_ARGS__); } while (0)
 #define vLogInfo(fmt, va_args) \
@@ -24,6 +42,11 @@ extern bool gLogDebug;
 	do { if (LogFile) fwprintf(LogFile, fmt, __VA_ARGS__); } while (0)
 #define vLogInfoW(fmt, va_args) \
 	do { if (LogFile) vfwprintf(LogFile, fmt, va_args); } while (0)
+#define LogWrite(buf, len) \
+	do { if (LogFile) fwrite(buf, 1, len, LogFile); } while (0)
+#define LogFlush() \
+	do { if (LogFile) fflush(LogFile); } while (0)
+#endif
 
 #define LogDebug(fmt, ...) \
 	do { if (gLogDebug) LogInfo(fmt, __VA_ARGS__); } while (0)
@@ -0,0 +1,134 @@
+// Times logging the sort of messages calls=1 produces from one and several
+// threads, with fprintf to a buffered log file, fprintf to an unbuffered log
+// file (as unbuffered=1 does) and AsyncLog. It reports the throughput seen by
+// the logging threads, the latency of individual calls, how long until
+// everything was on disk and, for AsyncLog, how many messages were dropped
+// because a thread filled its buffer faster than it could be written out.
+//
+// This is Linux only and not run by ctest. Run it from the build directory:
+//
+//   AsyncLogBench [messages per thread] [directory]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AsyncLog.h"
+
+typedef std::chrono::steady_clock Clock;
+
+enum class Mode {
+	BUFFERED,
+	UNBUFFERED,
+	ASYNC,
+};
+
+static const char *mode_names[] = {"buffered", "unbuffered", "async"};
+
+static double ms_since(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static double percentile_us(std::vector<uint32_t> &ns, double percentile)
+{
+	size_t i = std::min(ns.size() - 1, (size_t)(ns.size() * percentile / 100.0));
+
+	std::nth_element(ns.begin(), ns.begin() + i, ns.end());
+	return ns[i] / 1000.0;
+}
+
+static void log_calls(Mode mode, FILE *fp, int thread, int messages, uint32_t *latencies)
+{
+	Clock::time_point start;
+	int i;
+
+	for (i = 0; i < messages; i++) {
+		start = Clock::now();
+		if (mode == Mode::ASYNC) {
+			AsyncLog::printf("%i:%i HackerContext::DrawIndexed(IndexCount:%i, StartIndexLocation:%i, BaseVertexLocation:%i) vs=%016llx ps=%016llx\n",
+					thread, i, 3 * i, i * 7, -i, 0x1234567890abcdefull + i, 0xfedcba0987654321ull - i);
+		} else {
+			fprintf(fp, "%i:%i HackerContext::DrawIndexed(IndexCount:%i, StartIndexLocation:%i, BaseVertexLocation:%i) vs=%016llx ps=%016llx\n",
+					thread, i, 3 * i, i * 7, -i, 0x1234567890abcdefull + i, 0xfedcba0987654321ull - i);
+		}
+		latencies[i] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+	}
+
+	if (mode == Mode::ASYNC)
+		AsyncLog::thread_exit();
+}
+
+static void bench(Mode mode, int threads, int messages, const std::string &path)
+{
+	std::vector<uint32_t> latencies(threads * messages);
+	std::vector<std::thread> workers;
+	AsyncLog::Stats before = AsyncLog::stats(), after;
+	Clock::time_point start;
+	double logged_ms, total_ms;
+	FILE *fp;
+	int t;
+
+	fp = fopen(path.c_str(), "w");
+	if (!fp) {
+		perror(path.c_str());
+		exit(1);
+	}
+	if (mode == Mode::UNBUFFERED)
+		setvbuf(fp, NULL, _IONBF, 0);
+	if (mode == Mode::ASYNC)
+		AsyncLog::start(fp, 256 * 1024, 100);
+
+	start = Clock::now();
+	for (t = 0; t < threads; t++)
+		workers.emplace_back(log_calls, mode, fp, t, messages, &latencies[t * messages]);
+	for (std::thread &worker : workers)
+		worker.join();
+	logged_ms = ms_since(start);
+
+	if (mode == Mode::ASYNC)
+		AsyncLog::stop();
+	fclose(fp);
+	total_ms = ms_since(start);
+	after = AsyncLog::stats();
+
+	printf("%-10s %i thread(s): %6.2fM msgs/s, latency p50 %6.2fus p99 %6.2fus p99.9 %7.2fus, all written %7.1fms",
+			mode_names[(int)mode], threads, threads * messages / logged_ms / 1000.0,
+			percentile_us(latencies, 50), percentile_us(latencies, 99), percentile_us(latencies, 99.9),
+			total_ms);
+	if (mode == Mode::ASYNC)
+		printf(", %llu dropped", (unsigned long long)(after.dropped_messages - before.dropped_messages));
+	printf("\n");
+
+	unlink(path.c_str());
+}
+
+int main(int argc, char **argv)
+{
+	int messages = argc > 1 ? atoi(argv[1]) : 200000;
+	std::string dir = argc > 2 ? argv[2] : "AsyncLogBench.XXXXXX";
+	std::string path;
+	int threads, mode;
+
+	if (argc <= 2 && !mkdtemp(&dir[0])) {
+		perror("mkdtemp");
+		return 1;
+	}
+	path = dir + "/d3d11_log.txt";
+
+	printf("%d messages per thread, %u hardware threads\n", messages, std::thread::hardware_concurrency());
+
+	for (threads = 1; threads <= 4; threads *= 4) {
+		for (mode = 0; mode < 3; mode++)
+			bench((Mode)mode, threads, messages, path);
+	}
+
+	if (argc <= 2)
+		rmdir(dir.c_str());
+	return 0;
+}
@@ -0,0 +1,267 @@
+// Logs through AsyncLog into a temporary file and checks:
+//
+//   - every message from several threads logging at once is written exactly
+//     once, and each thread's messages are in the order it logged them
+//   - messages from different threads taking turns to log are written in
+//     the order they were logged
+//   - when a thread fills its buffer, the messages that didn't fit are
+//     dropped and counted, and a note of exactly how many is written in
+//     their place
+//   - a message too large for the buffer is written after everything logged
+//     before it, and before anything logged after it
+//   - wide messages are converted the same way as narrow ones
+//   - the buffers of threads that have exited are reused, so a program that
+//     keeps starting new threads doesn't keep allocating new buffers
+//
+// Best also run with -fsanitize=thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AsyncLog.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// Read back through a separate stream, as the background thread may write to
+// log_fp at any time:
+static char log_path[] = "AsyncLogTest.XXXXXX";
+static FILE *log_fp, *read_fp;
+
+// Everything written to the log since the last call:
+static std::vector<std::string> new_lines()
+{
+	std::vector<std::string> lines;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	AsyncLog::flush();
+	clearerr(read_fp);
+	while ((len = getline(&line, &size, read_fp)) != -1)
+		lines.push_back(std::string(line, len));
+	free(line);
+
+	return lines;
+}
+
+static void test_threads()
+{
+	static const int THREADS = 4, MESSAGES = 20000;
+	AsyncLog::Stats before = AsyncLog::stats(), after;
+	std::vector<std::thread> threads;
+	std::vector<std::string> lines;
+	std::vector<int> next(THREADS);
+	int t, i;
+
+	for (t = 0; t < THREADS; t++) {
+		threads.emplace_back([t]() {
+			for (int i = 0; i < MESSAGES; i++)
+				AsyncLog::printf("thread %i message %i\n", t, i);
+			AsyncLog::thread_exit();
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+
+	lines = new_lines();
+	CHECK(lines.size() == THREADS * MESSAGES, "%zu lines", lines.size());
+	for (const std::string &line : lines) {
+		if (sscanf(line.c_str(), "thread %d message %d\n", &t, &i) != 2 || t < 0 || t >= THREADS) {
+			CHECK(false, "unexpected line: %s", line.c_str());
+			break;
+		}
+		if (i != next[t]) {
+			CHECK(false, "thread %i message %i follows %i", t, i, next[t] - 1);
+			break;
+		}
+		next[t]++;
+	}
+
+	after = AsyncLog::stats();
+	CHECK(after.messages - before.messages == THREADS * MESSAGES, "%llu messages counted",
+			(unsigned long long)(after.messages - before.messages));
+	CHECK(after.dropped_messages == before.dropped_messages, "%llu messages dropped",
+			(unsigned long long)(after.dropped_messages - before.dropped_messages));
+}
+
+// Only messages logged at almost the same time from different threads can
+// come out of order:
+static void test_turns()
+{
+	static const int THREADS = 3, TURNS = 2000;
+	std::vector<std::thread> threads;
+	std::vector<std::string> lines;
+	std::condition_variable cv;
+	std::mutex lock;
+	int turn = 0, i, t;
+
+	for (t = 0; t < THREADS; t++) {
+		threads.emplace_back([&, t]() {
+			std::unique_lock<std::mutex> guard(lock);
+
+			while (true) {
+				cv.wait(guard, [&]() { return turn % THREADS == t || turn >= THREADS * TURNS; });
+				if (turn >= THREADS * TURNS)
+					break;
+				AsyncLog::printf("turn %d\n", turn++);
+				cv.notify_all();
+			}
+			AsyncLog::thread_exit();
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+
+	lines = new_lines();
+	CHECK(lines.size() == THREADS * TURNS, "%zu lines", lines.size());
+	for (i = 0; i < (int)lines.size(); i++) {
+		if (sscanf(lines[i].c_str(), "turn %d", &t) != 1 || t != i) {
+			CHECK(false, "line %i is %s", i, lines[i].c_str());
+			break;
+		}
+	}
+}
+
+static void test_drops()
+{
+	static const int MESSAGES = 1000;
+	AsyncLog::Stats before, after;
+	std::vector<std::string> lines;
+	unsigned long long dropped = 0, dropped_bytes = 0;
+	unsigned thread_index;
+	int written = 0, i;
+
+	// With the background thread stopped nothing drains the buffer, so
+	// exactly as many messages fit as there is room for:
+	AsyncLog::start(log_fp, 4096, 100);
+	AsyncLog::stop();
+	before = AsyncLog::stats();
+	std::thread([]() {
+		for (int i = 0; i < MESSAGES; i++)
+			AsyncLog::printf("drop %04i\n", i);
+		AsyncLog::thread_exit();
+	}).join();
+	after = AsyncLog::stats();
+
+	// The same size, so that the buffer is kept for the next thread
+	// rather than being deleted:
+	AsyncLog::start(log_fp, 4096, 100);
+
+	lines = new_lines();
+	for (const std::string &line : lines) {
+		if (sscanf(line.c_str(), "drop %d", &i) == 1) {
+			CHECK(i == written, "drop %i follows %i", i, written - 1);
+			written++;
+		} else if (sscanf(line.c_str(), "*** Async log: dropped %llu messages (%llu bytes) from thread #%u",
+					&dropped, &dropped_bytes, &thread_index) != 3) {
+			CHECK(false, "unexpected line: %s", line.c_str());
+		}
+	}
+
+	CHECK(written > 100 && written < MESSAGES, "%i of %i written", written, MESSAGES);
+	CHECK(dropped == (unsigned long long)(MESSAGES - written), "note says %llu dropped, %i missing",
+			dropped, MESSAGES - written);
+	CHECK(dropped_bytes == dropped * 10, "note says %llu bytes dropped", dropped_bytes);
+	CHECK(after.dropped_messages - before.dropped_messages == dropped, "%llu drops counted",
+			(unsigned long long)(after.dropped_messages - before.dropped_messages));
+	CHECK(!lines.empty() && lines.back().find("*** Async log: dropped") == 0, "no note after the messages");
+
+	// Nothing more to report next time:
+	AsyncLog::printf("after drops\n");
+	lines = new_lines();
+	CHECK(lines.size() == 1 && lines[0] == "after drops\n", "%zu lines", lines.size());
+
+	AsyncLog::start(log_fp, 1 << 20, 100);
+}
+
+static void test_large()
+{
+	std::vector<std::string> lines;
+	std::string large(300000, 'x');
+
+	AsyncLog::printf("before\n");
+	AsyncLog::printf("%s\n", large.c_str());
+	AsyncLog::printf("after\n");
+
+	lines = new_lines();
+	CHECK(lines.size() == 3 && lines[0] == "before\n" && lines[1] == large + "\n" && lines[2] == "after\n",
+			"%zu lines", lines.size());
+}
+
+static void test_wide()
+{
+	std::vector<std::string> lines;
+
+	AsyncLog::wprintf(L"%ls %i %s\n", L"wide", 42, "narrow");
+	AsyncLog::wprintf(L"%ls\n", std::wstring(5000, L'w').c_str());
+
+	lines = new_lines();
+	CHECK(lines.size() == 2 && lines[0] == "wide 42 narrow\n" && lines[1] == std::string(5000, 'w') + "\n",
+			"%zu lines", lines.size());
+}
+
+static void test_recycle()
+{
+	AsyncLog::Stats before = AsyncLog::stats(), after;
+	int i;
+
+	for (i = 0; i < 50; i++) {
+		std::thread([i]() {
+			AsyncLog::printf("short lived thread %i\n", i);
+			AsyncLog::thread_exit();
+		}).join();
+		new_lines();
+	}
+
+	after = AsyncLog::stats();
+	CHECK(after.threads - before.threads == 50, "%zu threads seen", after.threads - before.threads);
+	CHECK(after.buffers <= before.buffers + 1, "%zu buffers for %zu", after.buffers, before.buffers);
+}
+
+int main()
+{
+	int fd = mkstemp(log_path);
+
+	log_fp = fd == -1 ? NULL : fdopen(fd, "w");
+	read_fp = fd == -1 ? NULL : fopen(log_path, "r");
+	if (!log_fp || !read_fp) {
+		perror(log_path);
+		return 1;
+	}
+
+	AsyncLog::start(log_fp, 1 << 20, 100);
+
+	test_threads();
+	test_turns();
+	test_drops();
+	test_large();
+	test_wide();
+	test_recycle();
+
+	AsyncLog::stop();
+	fclose(log_fp);
+	fclose(read_fp);
+	unlink(log_path);
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,571 @@
+// Builds graphs of mock command lists calling each other through explicit
+// ("run = CommandList...") and linked command lists, runs them with a copy of
+// the recursive runner (_RunCommandList, RunExplicitCommandList::run and
+// RunLinkedCommandList::run in CommandList.cpp) and with the flattened list
+// from CommandListFlattener.h, and checks that both run the same commands in
+// the same order with the same post/recursion state, and leave the same
+// IniParams, variables and dirty flags behind.
+
+#include <stdio.h>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "CommandListFlattener.h"
+
+#define MAX_COMMAND_LIST_RECURSION 64
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static const int NUM_PARAMS = 8;
+static const int NUM_VARS = 8;
+
+struct MockList;
+
+enum class MockType {
+	PLAIN,          // Any command that has to run as is
+	EXPLICIT,       // run = CommandList...
+	LINKED,         // Linked command list
+	PARAM,          // x = ..., constant if is_static
+	VARIABLE,       // $var = ..., constant if is_static
+	ABORT,          // Stops the command list, like a failed handling = abort
+};
+
+struct Event {
+	int id;
+	bool post;
+	int recursion;
+
+	bool operator==(const Event &other) const
+	{
+		return id == other.id && post == other.post && recursion == other.recursion;
+	}
+};
+
+struct MockState {
+	bool post;
+	int recursion;
+	bool aborted;
+
+	std::vector<Event> trace;
+	int limit_hits;
+	float params[NUM_PARAMS];
+	unsigned params_dirty;
+	bool params_changed;
+	float vars[NUM_VARS];
+	bool persist[NUM_VARS];
+	int user_config_dirty;
+
+	MockState() :
+		post(false),
+		recursion(0),
+		aborted(false),
+		limit_hits(0),
+		params_dirty(0),
+		params_changed(false),
+		user_config_dirty(0)
+	{
+		int i;
+
+		for (i = 0; i < NUM_PARAMS; i++)
+			params[i] = 0;
+		for (i = 0; i < NUM_VARS; i++) {
+			vars[i] = 0;
+			persist[i] = i & 1;
+		}
+	}
+};
+
+struct MockCommand {
+	int id;
+	MockType type;
+
+	// EXPLICIT and LINKED:
+	MockList *pre, *post;
+	bool pre_and_post_together;
+
+	// PARAM and VARIABLE. Non-static ones get their value from the
+	// state, like an expression reading another IniParam would:
+	int idx;
+	float val;
+	bool is_static;
+
+	void run(MockState *state);
+};
+
+struct MockList {
+	std::vector<std::shared_ptr<MockCommand>> commands;
+};
+
+// _RunCommandList(), minus the logging and profiling:
+static void run_command_list(MockList *command_list, MockState *state, bool recursive = true)
+{
+	size_t i;
+
+	if (state->recursion > MAX_COMMAND_LIST_RECURSION) {
+		state->limit_hits++;
+		return;
+	}
+
+	if (command_list->commands.empty())
+		return;
+
+	if (recursive)
+		state->recursion++;
+
+	for (i = 0; i < command_list->commands.size() && !state->aborted; i++)
+		command_list->commands[i]->run(state);
+
+	if (recursive)
+		state->recursion--;
+}
+
+static void set_param(MockState *state, int idx, float val)
+{
+	if (state->params[idx] != val) {
+		state->params[idx] = val;
+		state->params_dirty |= 1u << idx;
+		state->params_changed = true;
+	}
+}
+
+static void set_variable(MockState *state, int idx, float val)
+{
+	if (state->vars[idx] != val) {
+		state->vars[idx] = val;
+		if (state->persist[idx])
+			state->user_config_dirty |= 1;
+	}
+}
+
+void MockCommand::run(MockState *state)
+{
+	bool saved_post;
+	float v;
+
+	switch (type) {
+		case MockType::EXPLICIT:
+			// RunExplicitCommandList::run()
+			if (pre_and_post_together) {
+				saved_post = state->post;
+				state->post = false;
+				run_command_list(pre, state);
+				state->post = true;
+				run_command_list(post, state);
+				state->post = saved_post;
+			} else if (state->post)
+				run_command_list(post, state);
+			else
+				run_command_list(pre, state);
+			return;
+		case MockType::LINKED:
+			// RunLinkedCommandList::run()
+			run_command_list(pre, state, false);
+			return;
+		default:
+			break;
+	}
+
+	state->trace.push_back({id, state->post, state->recursion});
+
+	switch (type) {
+		case MockType::PARAM:
+			v = is_static ? val : state->params[(idx + 1) % NUM_PARAMS] + val;
+			set_param(state, idx, v);
+			break;
+		case MockType::VARIABLE:
+			v = is_static ? val : state->vars[(idx + 1) % NUM_VARS] + val;
+			set_variable(state, idx, v);
+			break;
+		case MockType::ABORT:
+			state->aborted = true;
+			break;
+		default:
+			break;
+	}
+}
+
+struct MockTraits {
+	typedef MockList List;
+	typedef MockCommand Command;
+	typedef MockState State;
+
+	static const std::vector<std::shared_ptr<MockCommand>>& commands(MockList *command_list)
+	{
+		return command_list->commands;
+	}
+
+	static bool explicit_call(MockCommand *command, MockList **pre, MockList **post, bool *pre_and_post_together)
+	{
+		if (command->type != MockType::EXPLICIT)
+			return false;
+		*pre = command->pre;
+		*post = command->post;
+		*pre_and_post_together = command->pre_and_post_together;
+		return true;
+	}
+
+	static MockList* linked_call(MockCommand *command)
+	{
+		return command->type == MockType::LINKED ? command->pre : NULL;
+	}
+
+	static FlatCommandType constant_assignment(MockCommand *command, float *val)
+	{
+		if (!command->is_static)
+			return FlatCommandType::RUN;
+		*val = command->val;
+		if (command->type == MockType::PARAM)
+			return FlatCommandType::SET_INI_PARAM;
+		if (command->type == MockType::VARIABLE)
+			return FlatCommandType::SET_VARIABLE;
+		return FlatCommandType::RUN;
+	}
+
+	static void run(MockCommand *command, MockState *state)
+	{
+		command->run(state);
+	}
+
+	static void set_ini_param(MockCommand *command, float val, MockState *state)
+	{
+		state->trace.push_back({command->id, state->post, state->recursion});
+		set_param(state, command->idx, val);
+	}
+
+	static void set_variable(MockCommand *command, float val, MockState *state)
+	{
+		state->trace.push_back({command->id, state->post, state->recursion});
+		::set_variable(state, command->idx, val);
+	}
+};
+
+typedef std::vector<FlatCommandT<MockCommand>> FlatList;
+
+class Graph {
+public:
+	std::vector<std::unique_ptr<MockList>> lists;
+	int next_id;
+
+	Graph() : next_id(1) {}
+
+	MockList* add_list()
+	{
+		lists.emplace_back(new MockList);
+		return lists.back().get();
+	}
+
+	MockCommand* add(MockList *list, MockType type)
+	{
+		std::shared_ptr<MockCommand> command = std::make_shared<MockCommand>();
+
+		command->id = next_id++;
+		command->type = type;
+		command->pre = command->post = NULL;
+		command->pre_and_post_together = false;
+		command->idx = 0;
+		command->val = 0;
+		command->is_static = false;
+		list->commands.push_back(command);
+		return command.get();
+	}
+
+	void add_explicit(MockList *list, MockList *pre, MockList *post, bool together)
+	{
+		MockCommand *command = add(list, MockType::EXPLICIT);
+
+		command->pre = pre;
+		command->post = post;
+		command->pre_and_post_together = together;
+	}
+
+	void add_linked(MockList *list, MockList *link)
+	{
+		add(list, MockType::LINKED)->pre = link;
+	}
+};
+
+static bool flatten(MockList *command_list, bool post, FlatList *flat)
+{
+	std::vector<MockList*> path;
+
+	return flatten_command_list<MockTraits>(command_list, post, 1,
+			MAX_COMMAND_LIST_RECURSION / 2, &path, flat);
+}
+
+// Runs the list both ways from the same starting state, as
+// RunPresentCommandList() and RunCommandList() would, and compares them:
+static void compare(const char *what, MockList *command_list, bool post, const MockState &initial)
+{
+	MockState expected = initial, actual = initial;
+	FlatList flat;
+	size_t i;
+	int j;
+
+	if (!flatten(command_list, post, &flat)) {
+		CHECK(false, "%s: not flattened", what);
+		return;
+	}
+
+	expected.post = post;
+	run_command_list(command_list, &expected);
+
+	actual.post = post;
+	run_flat_command_list<MockTraits>(flat, &actual);
+
+	CHECK(expected.limit_hits == 0, "%s: recursion limit reached", what);
+	CHECK(actual.trace.size() == expected.trace.size(), "%s: %zu commands run, expected %zu",
+			what, actual.trace.size(), expected.trace.size());
+	for (i = 0; i < actual.trace.size() && i < expected.trace.size(); i++) {
+		if (actual.trace[i] == expected.trace[i])
+			continue;
+		CHECK(false, "%s: command %zu is %i post=%i recursion=%i, expected %i post=%i recursion=%i",
+				what, i, actual.trace[i].id, actual.trace[i].post, actual.trace[i].recursion,
+				expected.trace[i].id, expected.trace[i].post, expected.trace[i].recursion);
+		break;
+	}
+
+	CHECK(actual.aborted == expected.aborted, "%s: aborted", what);
+	for (j = 0; j < NUM_PARAMS; j++)
+		CHECK(actual.params[j] == expected.params[j], "%s: param %i = %f, expected %f", what, j, actual.params[j], expected.params[j]);
+	for (j = 0; j < NUM_VARS; j++)
+		CHECK(actual.vars[j] == expected.vars[j], "%s: var %i = %f, expected %f", what, j, actual.vars[j], expected.vars[j]);
+	CHECK(actual.params_dirty == expected.params_dirty, "%s: params dirty %x, expected %x",
+			what, actual.params_dirty, expected.params_dirty);
+	CHECK(actual.params_changed == expected.params_changed, "%s: params changed", what);
+	CHECK(actual.user_config_dirty == expected.user_config_dirty, "%s: user config dirty", what);
+}
+
+static void add_random_leaf(Graph *graph, MockList *list, std::mt19937 &rng)
+{
+	MockCommand *command;
+
+	switch (rng() % 8) {
+		case 0:
+		case 1:
+			command = graph->add(list, MockType::PARAM);
+			command->idx = rng() % NUM_PARAMS;
+			command->val = (float)(rng() % 3);
+			command->is_static = rng() % 4 != 0;
+			break;
+		case 2:
+		case 3:
+			command = graph->add(list, MockType::VARIABLE);
+			command->idx = rng() % NUM_VARS;
+			command->val = (float)(rng() % 3);
+			command->is_static = rng() % 4 != 0;
+			break;
+		default:
+			graph->add(list, MockType::PLAIN);
+			break;
+	}
+}
+
+// Lists only call lists with a higher index, so there are no cycles. Some
+// lists are left empty, as the optimiser leaves some empty sections behind:
+static void build_random_graph(Graph *graph, std::mt19937 &rng, int num_lists, bool aborts)
+{
+	MockList *list;
+	int i, j, n, target;
+
+	for (i = 0; i < num_lists * 2; i++)
+		graph->add_list();
+
+	for (i = 0; i < num_lists; i++) {
+		list = graph->lists[i * 2].get();
+		n = rng() % 8;
+		for (j = 0; j < n; j++) {
+			target = i + 1 + rng() % 4;
+			if (rng() % 3 || target >= num_lists) {
+				if (aborts && rng() % 60 == 0)
+					graph->add(list, MockType::ABORT);
+				else
+					add_random_leaf(graph, list, rng);
+			} else if (rng() % 3 == 0) {
+				graph->add_linked(list, graph->lists[target * 2].get());
+			} else {
+				graph->add_explicit(list, graph->lists[target * 2].get(),
+						graph->lists[target * 2 + 1].get(), rng() % 3 == 0);
+			}
+		}
+
+		// Post command lists for the explicit calls:
+		list = graph->lists[i * 2 + 1].get();
+		n = rng() % 3;
+		for (j = 0; j < n; j++)
+			add_random_leaf(graph, list, rng);
+	}
+}
+
+static void test_random(std::mt19937 &rng)
+{
+	MockState initial;
+	int i, j;
+	bool aborts;
+
+	for (i = 0; i < 500; i++) {
+		Graph graph;
+
+		aborts = i % 2;
+		build_random_graph(&graph, rng, 3 + rng() % 20, aborts);
+
+		for (j = 0; j < NUM_PARAMS; j++)
+			initial.params[j] = (float)(rng() % 3);
+		for (j = 0; j < NUM_VARS; j++)
+			initial.vars[j] = (float)(rng() % 3);
+
+		compare(aborts ? "random pre with aborts" : "random pre", graph.lists[0].get(), false, initial);
+		compare(aborts ? "random post with aborts" : "random post", graph.lists[0].get(), true, initial);
+	}
+}
+
+static void test_explicit_restores_post()
+{
+	Graph graph;
+	MockList *present = graph.add_list();
+	MockList *pre = graph.add_list();
+	MockList *post = graph.add_list();
+	MockState initial;
+
+	graph.add(pre, MockType::PLAIN);
+	graph.add(post, MockType::PLAIN);
+
+	// The command after a pre and post together call must see the
+	// original post state, not the true left over from the post list:
+	graph.add(present, MockType::PLAIN);
+	graph.add_explicit(present, pre, post, true);
+	graph.add(present, MockType::PLAIN);
+	graph.add_explicit(present, pre, post, false);
+	graph.add(present, MockType::PLAIN);
+
+	compare("pre and post together", present, false, initial);
+	compare("pre and post together, post", present, true, initial);
+}
+
+static void test_linked_nesting()
+{
+	Graph graph;
+	MockList *present = graph.add_list();
+	MockList *list, *next;
+	MockState initial;
+	int i;
+
+	// Linked lists run at the same level of nesting, so even a long chain
+	// of them doesn't count towards the recursion limit:
+	list = present;
+	for (i = 0; i < MAX_COMMAND_LIST_RECURSION; i++) {
+		graph.add(list, MockType::PLAIN);
+		next = graph.add_list();
+		graph.add_linked(list, next);
+		list = next;
+	}
+	graph.add(list, MockType::PLAIN);
+
+	compare("linked chain", present, false, initial);
+}
+
+static MockList* explicit_chain(Graph *graph, int depth)
+{
+	MockList *present = graph->add_list();
+	MockList *list, *next;
+	int i;
+
+	list = present;
+	for (i = 0; i < depth; i++) {
+		graph->add(list, MockType::PLAIN);
+		next = graph->add_list();
+		graph->add_explicit(list, next, next, false);
+		list = next;
+	}
+	graph->add(list, MockType::PLAIN);
+
+	return present;
+}
+
+static void test_depth_limit()
+{
+	Graph graph;
+	MockState initial;
+	FlatList flat;
+	MockList *list;
+
+	// The [Present] list runs at recursion 1, so this nests down to
+	// MAX_COMMAND_LIST_RECURSION / 2 and is still flattened:
+	list = explicit_chain(&graph, MAX_COMMAND_LIST_RECURSION / 2 - 1);
+	compare("deepest flattened", list, false, initial);
+
+	// One more level is left for the recursive runner:
+	list = explicit_chain(&graph, MAX_COMMAND_LIST_RECURSION / 2);
+	CHECK(!flatten(list, false, &flat), "too deep was flattened");
+}
+
+static void test_cycles()
+{
+	Graph graph;
+	MockList *present = graph.add_list();
+	MockList *a = graph.add_list();
+	MockList *b = graph.add_list();
+	MockList *c = graph.add_list();
+	MockState state;
+	FlatList flat;
+
+	graph.add(a, MockType::PLAIN);
+	graph.add_explicit(a, b, b, false);
+	graph.add(b, MockType::PLAIN);
+	graph.add_explicit(b, a, a, false);
+	graph.add_explicit(present, a, a, false);
+	CHECK(!flatten(present, false, &flat), "explicit cycle was flattened");
+
+	// The recursive runner stops at the limit and keeps going:
+	state.post = false;
+	run_command_list(present, &state);
+	CHECK(state.limit_hits == 1, "explicit cycle hit the limit %i times", state.limit_hits);
+
+	flat.clear();
+	graph.add(c, MockType::PLAIN);
+	graph.add_linked(c, c);
+	CHECK(!flatten(c, false, &flat), "linked cycle was flattened");
+
+}
+
+static void test_same_list_twice()
+{
+	Graph graph;
+	MockList *present = graph.add_list();
+	MockList *leaf = graph.add_list();
+	MockState initial;
+
+	// Calling the same list more than once is not a cycle:
+	graph.add(leaf, MockType::PLAIN);
+	graph.add_explicit(present, leaf, leaf, false);
+	graph.add_linked(present, leaf);
+	graph.add_explicit(present, leaf, leaf, true);
+	compare("same list twice", present, false, initial);
+}
+
+int main()
+{
+	std::mt19937 rng(50);
+
+	test_random(rng);
+	test_explicit_restores_post();
+	test_linked_nesting();
+	test_depth_limit();
+	test_cycles();
+	test_same_list_twice();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
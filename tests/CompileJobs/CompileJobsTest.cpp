@@ -0,0 +1,320 @@
+// Runs batches of stub compile jobs through CompileJobQueue and checks:
+//
+//   - every job is compiled exactly once, and completed exactly once after
+//     every compile in the batch has finished, on the thread that called
+//     run(), in the order the jobs were added
+//   - no job's compile starts until the compiles of everything it depends on
+//     have finished, for random dependency graphs
+//   - up to max_threads compiles run at once, and never more
+//   - with one thread nothing else is started and the jobs are compiled in
+//     the order they were added
+//   - the buffered logs and the final state come out the same whatever the
+//     number of threads, as they do for the shader compiles
+//   - dependencies on later (or missing) jobs are ignored, and the queue is
+//     empty and can be reused after run()
+//
+// The stub compiles take random amounts of time so that they finish in a
+// different order from run to run. Best also run with -fsanitize=thread.
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "CompileJobs.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// What happened to a job. The queue deletes the jobs once it has run them,
+// so this is kept in the batch:
+struct JobRecord
+{
+	std::string shader;
+	int start_time, finish_time;
+	int compiles, completes;
+	std::thread::id compiled_on;
+	std::vector<size_t> dependencies;
+
+	JobRecord(const std::string &shader) :
+		shader(shader), start_time(-1), finish_time(-1), compiles(0), completes(0)
+	{}
+};
+
+// A batch of stub jobs and what happened to them, in the order it happened:
+class Batch
+{
+public:
+	std::atomic<int> clock;        // Ticks on every compile start and finish
+	std::atomic<int> running;
+	std::atomic<int> max_running;
+	std::atomic<int> compiled;
+	std::vector<JobRecord> jobs;
+	std::vector<size_t> completed;
+	std::string log;
+	std::map<std::string, std::string> shaders;
+	std::thread::id caller;
+	CompileJobQueue queue;
+
+	Batch() : clock(0), running(0), max_running(0), compiled(0), caller(std::this_thread::get_id()) {}
+
+	size_t add(const std::string &shader, int work_us, int wait_for_running = 0);
+
+	void add_dependency(size_t job, size_t dependency)
+	{
+		queue.add_dependency(job, dependency);
+		if (dependency < job && job < jobs.size())
+			jobs[job].dependencies.push_back(dependency);
+	}
+};
+
+// Stands in for compiling a shader: takes a while, buffers what it would log
+// and leaves the result for complete() to install:
+class StubJob : public CompileJob
+{
+	Batch *batch;
+	size_t id;
+	int work_us;
+	int wait_for_running;
+
+	std::string deferred_log;
+	std::string result;
+
+public:
+	StubJob(Batch *batch, size_t id, int work_us, int wait_for_running) :
+		batch(batch),
+		id(id),
+		work_us(work_us),
+		wait_for_running(wait_for_running)
+	{}
+
+	void compile() override
+	{
+		JobRecord *record = &batch->jobs[id];
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+		int running, max;
+
+		record->start_time = batch->clock++;
+		record->compiled_on = std::this_thread::get_id();
+		record->compiles++;
+
+		running = ++batch->running;
+		max = batch->max_running;
+		while (running > max && !batch->max_running.compare_exchange_weak(max, running))
+			;
+
+		// Hold on until enough other compiles are running at the same
+		// time to show the queue ran them concurrently:
+		while (batch->running < wait_for_running && std::chrono::steady_clock::now() < deadline)
+			std::this_thread::yield();
+		if (work_us)
+			std::this_thread::sleep_for(std::chrono::microseconds(work_us));
+
+		deferred_log = "compiled " + record->shader + " (job " + std::to_string(id) + ")\n";
+		result = record->shader + " from job " + std::to_string(id);
+
+		batch->running--;
+		record->finish_time = batch->clock++;
+		batch->compiled++;
+	}
+
+	void complete() override
+	{
+		JobRecord *record = &batch->jobs[id];
+
+		CHECK(std::this_thread::get_id() == batch->caller, "job %zu completed on another thread", id);
+		CHECK(batch->compiled == (int)batch->jobs.size(), "job %zu completed before every compile finished", id);
+
+		record->completes++;
+		batch->completed.push_back(id);
+		batch->log += deferred_log;
+		batch->shaders[record->shader] = result;
+	}
+};
+
+size_t Batch::add(const std::string &shader, int work_us, int wait_for_running)
+{
+	size_t id;
+
+	jobs.emplace_back(shader);
+	id = queue.add(new StubJob(this, jobs.size() - 1, work_us, wait_for_running));
+	CHECK(id == jobs.size() - 1, "job %zu given ID %zu", jobs.size() - 1, id);
+
+	return id;
+}
+
+// Fills the batch with jobs, some of which share a shader (like a HLSL and an
+// assembly file for the same hash) and depend on the earlier one, and some
+// with random other dependencies:
+static void random_batch(std::mt19937 &rng, Batch *batch, int n)
+{
+	std::string shader;
+	int i, j, deps;
+
+	for (i = 0; i < n; i++) {
+		shader = "shader" + std::to_string(rng() % (n / 2 + 1));
+		batch->add(shader, rng() % 4 ? rng() % 300 : 0);
+
+		// A second file for the same shader depends on the first, as
+		// ReloadFixes does for a HLSL and an assembly file:
+		for (j = i - 1; j >= 0; j--) {
+			if (batch->jobs[j].shader == shader) {
+				batch->add_dependency(i, j);
+				break;
+			}
+		}
+
+		deps = rng() % 4 == 0 ? 1 + rng() % 3 : 0;
+		for (j = 0; j < deps && i > 0; j++)
+			batch->add_dependency(i, rng() % i);
+	}
+}
+
+static void check_batch(Batch *batch, const char *what)
+{
+	size_t i;
+
+	CHECK(batch->queue.empty(), "%s: queue not emptied", what);
+	CHECK(batch->completed.size() == batch->jobs.size(), "%s: %zu of %zu completed", what,
+			batch->completed.size(), batch->jobs.size());
+	for (i = 0; i < batch->completed.size(); i++) {
+		if (batch->completed[i] != i) {
+			CHECK(false, "%s: job %zu completed %zuth", what, batch->completed[i], i);
+			break;
+		}
+	}
+
+	for (i = 0; i < batch->jobs.size(); i++) {
+		const JobRecord &job = batch->jobs[i];
+
+		CHECK(job.compiles == 1 && job.completes == 1, "%s: job %zu compiled %i times and completed %i times",
+				what, i, job.compiles, job.completes);
+		for (size_t dep : job.dependencies) {
+			CHECK(job.start_time > batch->jobs[dep].finish_time,
+					"%s: job %zu started at %i before job %zu it depends on finished at %i",
+					what, i, job.start_time, dep, batch->jobs[dep].finish_time);
+		}
+	}
+}
+
+static void test_random()
+{
+	std::mt19937 rng(33);
+	std::string expected_log;
+	std::map<std::string, std::string> expected_shaders;
+	unsigned threads;
+	int trial, n;
+	char what[64];
+
+	for (trial = 0; trial < 40 && failures < 10; trial++) {
+		n = 1 + rng() % 60;
+
+		for (threads = 0; threads <= 8; threads++) {
+			// The same batch for every number of threads:
+			std::mt19937 batch_rng(trial);
+			Batch batch;
+
+			random_batch(batch_rng, &batch, n);
+			snprintf(what, sizeof(what), "trial %i, %u threads", trial, threads);
+			CHECK(batch.queue.size() == (size_t)n, "%s: %zu queued", what, batch.queue.size());
+			batch.queue.run(threads);
+			check_batch(&batch, what);
+			CHECK(batch.max_running <= (int)std::max(threads, 1u), "%s: %i compiles at once", what, (int)batch.max_running);
+
+			if (!threads) {
+				expected_log = batch.log;
+				expected_shaders = batch.shaders;
+			}
+			CHECK(batch.log == expected_log, "%s: log differs", what);
+			CHECK(batch.shaders == expected_shaders, "%s: shaders differ", what);
+		}
+	}
+}
+
+// Enough threads really are used at once, but no more than asked for:
+static void test_concurrency()
+{
+	unsigned threads;
+	int i;
+
+	for (threads = 2; threads <= 6; threads += 2) {
+		Batch batch;
+
+		for (i = 0; i < 20; i++)
+			batch.add("s" + std::to_string(i), 100, threads);
+		batch.queue.run(threads);
+		check_batch(&batch, "concurrency");
+		CHECK(batch.max_running == (int)threads, "%u threads: %i compiles at once", threads, (int)batch.max_running);
+	}
+}
+
+static void test_single_thread()
+{
+	Batch batch;
+	int i;
+
+	for (i = 0; i < 10; i++)
+		batch.add("s", 0);
+	batch.queue.run(1);
+	check_batch(&batch, "single thread");
+
+	for (i = 0; i < 10; i++) {
+		CHECK(batch.jobs[i].compiled_on == batch.caller, "job %i compiled on another thread", i);
+		CHECK(batch.jobs[i].start_time == i * 2, "job %i compiled at %i", i, batch.jobs[i].start_time);
+	}
+	CHECK(batch.shaders["s"] == "s from job 9", "%s won", batch.shaders["s"].c_str());
+}
+
+static void test_bad_dependencies()
+{
+	Batch batch;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		batch.add("s" + std::to_string(i), 0);
+
+	// Later, itself and missing jobs:
+	batch.queue.add_dependency(1, 2);
+	batch.queue.add_dependency(2, 2);
+	batch.queue.add_dependency(3, 10);
+	batch.queue.add_dependency(10, 0);
+	batch.queue.run(4);
+	check_batch(&batch, "bad dependencies");
+
+	// Empty, and then reused for another batch:
+	batch.queue.run(4);
+	batch.jobs.clear();
+	batch.completed.clear();
+	batch.compiled = 0;
+	batch.add("s", 100);
+	batch.add("s", 0);
+	batch.add_dependency(1, 0);
+	batch.queue.run(4);
+	check_batch(&batch, "reused");
+}
+
+int main()
+{
+	test_random();
+	test_concurrency();
+	test_single_thread();
+	test_bad_dependencies();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,277 @@
+// Times the buffer dumps of a synthetic frame through DumpPipeline with
+// various numbers of workers and memory budgets. 0 workers writes every
+// dump on the submitting thread, as frame analysis did before.
+//
+// Each dump does what DumpBufferImmediateCtx and FrameAnalysisBufferDumpJob
+// do. The render thread copies the buffer into the pool, hashes the copy for
+// the deduplicated filenames and submits a job. The job checks under the file
+// lock whether the deduplicated .buf and .txt files exist, writes them if
+// not, and hard links the per-draw filenames to them. The frame mixes
+// constant buffers, vertex buffers and index buffers, and many of the
+// constant buffers repeat, as they do in a real game.
+//
+// It reports how long the render thread took to get through the frame, how
+// much of that it spent blocked in alloc() waiting for the workers, and how
+// long until flush() returned with everything on disk. This is Linux only
+// and not run by ctest. Run it from the build directory:
+//
+//   DumpPipelineBench [dumps] [directory]
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "DumpPipeline.h"
+#include "DumpText.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct SyntheticBuffer
+{
+	char type; // 'c', 'v' or 'i'
+	std::vector<uint8_t> data;
+};
+
+// Stands in for crc32c_hw, which also runs on the render thread:
+static uint64_t hash_buffer(const uint8_t *data, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ull, word;
+	size_t i;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 0x100000001b3ull;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ data[i]) * 0x100000001b3ull;
+	return hash;
+}
+
+static std::string path(const char *dir, const char *name)
+{
+	return std::string(dir) + "/" + name;
+}
+
+static std::wstring wpath(const std::string &path)
+{
+	return std::wstring(path.begin(), path.end());
+}
+
+class BenchDumpJob : public DumpJob
+{
+public:
+	DumpPipeline *pipeline;
+	char type;
+	std::string bin_filename, bin_dedupe_filename;
+	std::string txt_filename, txt_dedupe_filename;
+
+	void write_bin()
+	{
+		FILE *fd = fopen(bin_dedupe_filename.c_str(), "wb");
+
+		if (!fd)
+			return;
+		fwrite(data(), 1, size(), fd);
+		fclose(fd);
+	}
+
+	// Roughly dump_buffer_txt and the no layout case of dump_vb_txt / dump_ib_txt:
+	void write_txt()
+	{
+		FILE *fd = fopen(txt_dedupe_filename.c_str(), "w");
+		const char *components = "xyzw";
+		uint32_t i, c;
+		uint16_t index;
+		float val;
+
+		if (!fd)
+			return;
+		{
+			DumpTextWriter out(fd);
+
+			if (type == 'i') {
+				for (i = 0; i + 2 <= size(); i += 2) {
+					memcpy(&index, data() + i, 2);
+					out.u32(index);
+					out.chr(i % 6 == 4 ? '\n' : ' ');
+				}
+			} else {
+				for (i = 0; i < size() / 16; i++) {
+					for (c = 0; c < 4; c++) {
+						memcpy(&val, data() + i * 16 + c * 4, 4);
+						out.str(type == 'c' ? "cb0[" : "vb0[");
+						out.s32(i);
+						out.str("].");
+						out.chr(components[c]);
+						out.str(": ");
+						out.g9(val);
+						out.chr('\n');
+					}
+				}
+			}
+		}
+		fclose(fd);
+	}
+
+	void run() override
+	{
+		struct stat st;
+
+		{
+			DumpFileLock file_lock(pipeline, wpath(bin_dedupe_filename));
+			if (stat(bin_dedupe_filename.c_str(), &st))
+				write_bin();
+			link(bin_dedupe_filename.c_str(), bin_filename.c_str());
+		}
+		{
+			DumpFileLock file_lock(pipeline, wpath(txt_dedupe_filename));
+			if (stat(txt_dedupe_filename.c_str(), &st))
+				write_txt();
+			link(txt_dedupe_filename.c_str(), txt_filename.c_str());
+		}
+	}
+};
+
+static std::vector<SyntheticBuffer> make_frame(int dumps)
+{
+	std::vector<SyntheticBuffer> frame(dumps);
+	std::vector<SyntheticBuffer> constants(64);
+	std::mt19937 rng(39);
+	size_t size, i;
+	float f;
+	int n;
+
+	// A few dozen distinct constant buffers that get bound over and over:
+	for (SyntheticBuffer &cb : constants) {
+		cb.type = 'c';
+		cb.data.resize(256 << (rng() % 5));
+		for (i = 0; i + 4 <= cb.data.size(); i += 4) {
+			f = (float)((int)(rng() % 20001) - 10000) / 97.0f;
+			memcpy(&cb.data[i], &f, 4);
+		}
+	}
+
+	for (n = 0; n < dumps; n++) {
+		switch (rng() % 10) {
+		case 0: case 1: // Vertex buffer, 16KB - 2MB
+			frame[n].type = 'v';
+			size = (16 * 1024) << (rng() % 8);
+			frame[n].data.resize(size);
+			for (i = 0; i + 4 <= size; i += 4) {
+				// Positions and normals with plenty of repeats:
+				f = i % 32 < 12 ? (float)((int)(rng() % 200001) - 100000) / 37.0f
+				                : (float)((int)(rng() % 255) - 127) / 127.0f;
+				memcpy(&frame[n].data[i], &f, 4);
+			}
+			break;
+		case 2: // Index buffer, 8KB - 512KB
+			frame[n].type = 'i';
+			size = (8 * 1024) << (rng() % 7);
+			frame[n].data.resize(size);
+			for (i = 0; i + 2 <= size; i += 2) {
+				uint16_t index = (uint16_t)(i / 6 + rng() % 64);
+				memcpy(&frame[n].data[i], &index, 2);
+			}
+			break;
+		default:
+			frame[n] = constants[rng() % constants.size()];
+		}
+	}
+
+	return frame;
+}
+
+static int remove_entry(const char *path, const struct stat*, int, struct FTW*)
+{
+	return remove(path);
+}
+
+static void bench(const std::vector<SyntheticBuffer> &frame, const char *root,
+		unsigned threads, size_t budget_mb)
+{
+	DumpPipeline pipeline;
+	Clock::time_point start, alloc_start;
+	double render_ms, total_ms, blocked_ms = 0;
+	BenchDumpJob *job;
+	uint8_t *copy;
+	uint64_t hash;
+	char dir[1024], name[64];
+	size_t n;
+
+	snprintf(dir, sizeof(dir), "%s/%u-%zu", root, threads, budget_mb);
+	mkdir(dir, 0777);
+
+	pipeline.configure(threads, budget_mb << 20);
+
+	start = Clock::now();
+	for (n = 0; n < frame.size(); n++) {
+		job = new BenchDumpJob();
+		job->pipeline = &pipeline;
+		job->type = frame[n].type;
+
+		alloc_start = Clock::now();
+		copy = pipeline.alloc(job, frame[n].data.size());
+		blocked_ms += ms_since(alloc_start);
+		memcpy(copy, frame[n].data.data(), frame[n].data.size());
+
+		hash = hash_buffer(copy, frame[n].data.size());
+		snprintf(name, sizeof(name), "%016llx.buf", (unsigned long long)hash);
+		job->bin_dedupe_filename = path(dir, name);
+		snprintf(name, sizeof(name), "%016llx-%cb.txt", (unsigned long long)hash, frame[n].type);
+		job->txt_dedupe_filename = path(dir, name);
+		snprintf(name, sizeof(name), "%06zu-%cb.buf", n, frame[n].type);
+		job->bin_filename = path(dir, name);
+		snprintf(name, sizeof(name), "%06zu-%cb.txt", n, frame[n].type);
+		job->txt_filename = path(dir, name);
+
+		pipeline.submit(job);
+	}
+	render_ms = ms_since(start);
+	pipeline.flush();
+	total_ms = ms_since(start);
+
+	printf("%2u workers %4zuMB budget: render thread %8.1f ms (%8.1f ms blocked), all written %8.1f ms\n",
+			threads, budget_mb, render_ms, blocked_ms, total_ms);
+
+	nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+int main(int argc, char **argv)
+{
+	int dumps = argc > 1 ? atoi(argv[1]) : 1000;
+	std::string root = argc > 2 ? argv[2] : "DumpPipelineBench.XXXXXX";
+	std::vector<SyntheticBuffer> frame = make_frame(dumps);
+	unsigned threads;
+	size_t bytes = 0;
+
+	if (argc <= 2 && !mkdtemp(&root[0])) {
+		perror("mkdtemp");
+		return 1;
+	}
+	mkdir(root.c_str(), 0777);
+
+	for (const SyntheticBuffer &buf : frame)
+		bytes += buf.data.size();
+	printf("%d dumps, %.1f MB, %u hardware threads\n", dumps, bytes / 1048576.0,
+			std::thread::hardware_concurrency());
+
+	bench(frame, root.c_str(), 0, 256);
+	for (threads = 1; threads <= 8; threads *= 2)
+		bench(frame, root.c_str(), threads, 256);
+	bench(frame, root.c_str(), DumpPipeline::default_threads(), 16);
+
+	rmdir(root.c_str());
+	return 0;
+}
@@ -0,0 +1,343 @@
+// Drives DumpPipeline with synthetic jobs and checks:
+//
+//   - with no workers every job runs inside submit(), and a finished job's
+//     block is handed to the next copy that fits in it
+//   - with one worker the jobs run in the order they were submitted
+//   - with several workers every job runs exactly once, its copy is intact
+//     when it runs, and flush() returns only after they have all finished.
+//     The pipeline can be used again after a flush
+//   - jobs holding the same file lock never overlap
+//   - back-pressure: alloc() blocks once the budget is used up and returns
+//     when a job finishes, the copies alive at once never add up to more
+//     than the budget, and a single copy larger than the whole budget goes
+//     through once everything else has finished
+//   - cancel() gives the memory back
+//
+// Best also run with -fsanitize=thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+
+#include "DumpPipeline.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+class TestJob : public DumpJob
+{
+public:
+	std::function<void(TestJob*)> fn;
+	int id;
+
+	TestJob(int id, std::function<void(TestJob*)> fn) : fn(fn), id(id) {}
+	void run() override { fn(this); }
+};
+
+// Lets jobs be held in run() until the test is ready for them to finish:
+class Gate
+{
+	std::mutex lock;
+	std::condition_variable cv;
+	bool open;
+
+public:
+	Gate() : open(false) {}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		cv.wait(guard, [&]() { return open; });
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		open = true;
+		cv.notify_all();
+	}
+};
+
+static bool wait_for(std::atomic<bool> &flag, int ms)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+
+	while (!flag && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return flag;
+}
+
+// A thread is stuck in alloc() or flush() for good, so it can't be joined:
+static void give_up(const char *what)
+{
+	CHECK(false, "%s never returned", what);
+	printf("%d failures\n", failures);
+	fflush(stdout);
+	_Exit(1);
+}
+
+static void fill(TestJob *job)
+{
+	memset((void*)job->data(), job->id & 0xff, job->size());
+}
+
+static bool intact(TestJob *job)
+{
+	size_t i;
+
+	for (i = 0; i < job->size(); i++) {
+		if (job->data()[i] != (job->id & 0xff))
+			return false;
+	}
+	return true;
+}
+
+static void test_synchronous()
+{
+	DumpPipeline pipeline;
+	std::thread::id submitter = std::this_thread::get_id();
+	std::thread::id ran_on;
+	TestJob *job;
+	const uint8_t *first, *second;
+	bool ran = false;
+
+	pipeline.configure(0, 1 << 20);
+
+	job = new TestJob(1, [&](TestJob*) {
+		ran = true;
+		ran_on = std::this_thread::get_id();
+	});
+	first = pipeline.alloc(job, 1000);
+	CHECK(first && job->size() == 1000, "alloc returned %p with size %zu", first, job->size());
+	pipeline.submit(job);
+	CHECK(ran, "job did not run in submit()");
+	CHECK(ran_on == submitter, "job ran on another thread");
+
+	// Best fit from the blocks that have been given back:
+	job = new TestJob(2, [](TestJob*) {});
+	second = pipeline.alloc(job, 800);
+	CHECK(second == first, "finished job's block not reused");
+	CHECK(job->size() == 800, "size %zu", job->size());
+	pipeline.submit(job);
+
+	job = new TestJob(3, [](TestJob*) {});
+	second = pipeline.alloc(job, 2000);
+	CHECK(second && second != first, "block too small for the copy reused");
+	pipeline.submit(job);
+
+	pipeline.flush();
+}
+
+static void test_one_worker_in_order()
+{
+	DumpPipeline pipeline;
+	std::vector<int> order;
+	std::mutex order_lock;
+	TestJob *job;
+	int i;
+
+	pipeline.configure(1, 1 << 20);
+
+	for (i = 0; i < 200; i++) {
+		job = new TestJob(i, [&](TestJob *job) {
+			std::lock_guard<std::mutex> guard(order_lock);
+			order.push_back(job->id);
+		});
+		pipeline.alloc(job, 64 + i);
+		pipeline.submit(job);
+	}
+	pipeline.flush();
+
+	CHECK(order.size() == 200, "%zu jobs ran", order.size());
+	for (i = 0; i < (int)order.size(); i++) {
+		if (order[i] != i) {
+			CHECK(false, "job %i ran at position %i", order[i], i);
+			break;
+		}
+	}
+}
+
+static void test_workers()
+{
+	DumpPipeline pipeline;
+	std::vector<std::atomic<int>> runs(600);
+	std::atomic<int> finished(0), corrupt(0);
+	std::map<std::wstring, int> holders;
+	std::mutex holders_lock;
+	bool overlapped = false;
+	TestJob *job;
+	int round, i, n;
+
+	for (auto &r : runs)
+		r = 0;
+
+	pipeline.configure(4, 256 * 1024);
+
+	// Twice, to check the workers start again after a flush:
+	for (round = 0; round < 2; round++) {
+		for (i = round * 300; i < (round + 1) * 300; i++) {
+			job = new TestJob(i, [&](TestJob *job) {
+				std::wstring path = L"dedupe-" + std::to_wstring(job->id % 5);
+
+				runs[job->id]++;
+				if (!intact(job))
+					corrupt++;
+				{
+					DumpFileLock file_lock(&pipeline, path);
+					{
+						std::lock_guard<std::mutex> guard(holders_lock);
+						if (++holders[path] != 1)
+							overlapped = true;
+					}
+					std::this_thread::yield();
+					{
+						std::lock_guard<std::mutex> guard(holders_lock);
+						holders[path]--;
+					}
+				}
+				finished++;
+			});
+			pipeline.alloc(job, 1 + (i * 7919) % 4096);
+			fill(job);
+			pipeline.submit(job);
+		}
+		pipeline.flush();
+		n = finished;
+		CHECK(n == (round + 1) * 300, "round %i: flush() returned with %i of %i jobs finished", round, n, (round + 1) * 300);
+	}
+
+	for (i = 0; i < (int)runs.size(); i++)
+		CHECK(runs[i] == 1, "job %i ran %i times", i, (int)runs[i]);
+	CHECK(!corrupt, "%i jobs found their copy changed under them", (int)corrupt);
+	CHECK(!overlapped, "two jobs held the same file lock at once");
+}
+
+static void test_back_pressure()
+{
+	static const size_t CHUNK = 64 * 1024;
+	DumpPipeline pipeline;
+	std::atomic<bool> returned(false);
+	std::thread allocator;
+	TestJob *blocked_job;
+	Gate gate;
+	TestJob *job;
+	int i;
+
+	pipeline.configure(2, 4 * CHUNK);
+
+	// Use up the budget with jobs that can't finish yet:
+	for (i = 0; i < 4; i++) {
+		job = new TestJob(i, [&](TestJob*) { gate.wait(); });
+		pipeline.alloc(job, CHUNK);
+		pipeline.submit(job);
+	}
+
+	blocked_job = new TestJob(4, [](TestJob*) {});
+	allocator = std::thread([&]() {
+		pipeline.alloc(blocked_job, CHUNK);
+		returned = true;
+	});
+	CHECK(!wait_for(returned, 100), "alloc() returned with the budget used up");
+
+	gate.release();
+	if (!wait_for(returned, 10000))
+		give_up("alloc() after the jobs finished");
+	allocator.join();
+	pipeline.submit(blocked_job);
+	pipeline.flush();
+}
+
+static void test_budget()
+{
+	static const size_t BUDGET = 1024 * 1024;
+	DumpPipeline pipeline;
+	std::mutex live_lock;
+	size_t live = 0, peak = 0;
+	TestJob *job;
+	size_t size;
+	int i;
+
+	pipeline.configure(3, BUDGET);
+
+	for (i = 0; i < 500; i++) {
+		job = new TestJob(i, [&](TestJob *job) {
+			std::this_thread::yield();
+			std::lock_guard<std::mutex> guard(live_lock);
+			live -= job->size();
+		});
+		size = 1 + (i * 104729) % (BUDGET / 4);
+		pipeline.alloc(job, size);
+		{
+			std::lock_guard<std::mutex> guard(live_lock);
+			live += size;
+			peak = std::max(peak, live);
+		}
+		pipeline.submit(job);
+	}
+	pipeline.flush();
+
+	CHECK(peak <= BUDGET, "%zu bytes of copies alive at once with a budget of %zu", peak, BUDGET);
+	printf("Peak %zu of %zu bytes in use\n", peak, BUDGET);
+
+	// Larger than the whole budget:
+	job = new TestJob(-1, [](TestJob*) {});
+	CHECK(pipeline.alloc(job, BUDGET * 3) != NULL, "oversized alloc failed");
+	pipeline.submit(job);
+	pipeline.flush();
+}
+
+static void test_cancel()
+{
+	DumpPipeline pipeline;
+	std::atomic<bool> returned(false);
+	std::thread allocator;
+	TestJob *job;
+
+	pipeline.configure(1, 64 * 1024);
+
+	// Nothing runs, but the memory has to come back or the next alloc
+	// would wait forever:
+	job = new TestJob(0, [](TestJob*) { CHECK(false, "cancelled job ran"); });
+	pipeline.alloc(job, 64 * 1024);
+	pipeline.cancel(job);
+
+	job = new TestJob(1, [](TestJob*) {});
+	allocator = std::thread([&]() {
+		pipeline.alloc(job, 64 * 1024);
+		returned = true;
+	});
+	if (!wait_for(returned, 10000))
+		give_up("alloc() after cancel()");
+	allocator.join();
+	pipeline.submit(job);
+	pipeline.flush();
+}
+
+int main()
+{
+	test_synchronous();
+	test_one_worker_in_order();
+	test_workers();
+	test_back_pressure();
+	test_budget();
+	test_cancel();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
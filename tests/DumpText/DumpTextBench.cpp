@@ -0,0 +1,105 @@
+// Times the old fprintf based buffer dump writers against the current
+// DumpTextWriter based ones, on a vertex buffer with a typical 48 byte vertex,
+// an index buffer and a constant buffer. The number of vertices can be given
+// on the command line.
+//
+// The vertex data is random, which is the worst case for DumpTextWriter's
+// cache of formatted floats. Real meshes repeat far more of their normals,
+// weights and colours.
+
+#include <chrono>
+#include <functional>
+#include <random>
+
+#include "DumpTextHarness.h"
+
+static const wchar_t *filename = L"DumpTextBench.txt";
+
+static double now_ms()
+{
+	return std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <class F>
+static void bench(const char *what, F old_fn, F new_fn)
+{
+	double old_ms = 0, new_ms = 0, start;
+	int i;
+
+	// Best of three, alternating so neither gets a warmer page cache:
+	for (i = 0; i < 3; i++) {
+		start = now_ms();
+		old_fn();
+		old_ms = i ? std::min(old_ms, now_ms() - start) : now_ms() - start;
+
+		start = now_ms();
+		new_fn();
+		new_ms = i ? std::min(new_ms, now_ms() - start) : now_ms() - start;
+	}
+
+	printf("%-16s old %8.1f ms   new %8.1f ms   %5.2fx\n", what, old_ms, new_ms, old_ms / new_ms);
+}
+
+int main(int argc, char **argv)
+{
+	UINT vertices = argc > 1 ? (UINT)atoi(argv[1]) : 200000;
+	UINT stride = 48;
+	std::vector<uint8_t> data(vertices * stride);
+	D3D11_MAPPED_SUBRESOURCE map = { data.data(), 0, 0 };
+	DrawCallInfo call_info = { 0, 0 };
+	std::mt19937 rng(40);
+	ID3DBlob layout;
+	UINT size = (UINT)data.size();
+	size_t i;
+	float f;
+
+	for (i = 0; i < data.size(); i++)
+		data[i] = (uint8_t)rng();
+	// Finite positions so the float32s aren't mostly NaNs and denormals:
+	for (i = 0; i + 12 <= data.size(); i += stride) {
+		for (int c = 0; c < 3; c++) {
+			f = (float)((int)(rng() % 200000) - 100000) / 37.0f;
+			memcpy(&data[i + c * 4], &f, 4);
+		}
+	}
+
+	layout.elements = {
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R8G8B8A8_SNORM, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R8G8B8A8_SNORM, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 20, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "BLENDINDICES", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, 28, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "BLENDWEIGHT", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 32, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+
+	printf("%u vertices, %u bytes\n", vertices, size);
+
+	bench("vertex buffer", std::function<void()>([&]() {
+		old_dump_text::dump_vb_txt(filename, &map, size, 0, stride, 0, 0, 0, &layout, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, &call_info);
+	}), std::function<void()>([&]() {
+		new_dump_text::dump_vb_txt(filename, &map, size, 0, stride, 0, 0, 0, &layout, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, &call_info);
+	}));
+
+	bench("no layout", std::function<void()>([&]() {
+		old_dump_text::dump_vb_txt(filename, &map, size, 0, stride, 0, 0, 0, NULL, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, &call_info);
+	}), std::function<void()>([&]() {
+		new_dump_text::dump_vb_txt(filename, &map, size, 0, stride, 0, 0, 0, NULL, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, &call_info);
+	}));
+
+	bench("index buffer", std::function<void()>([&]() {
+		old_dump_text::dump_ib_txt(filename, &map, size, DXGI_FORMAT_R16_UINT, 0, 0, 0, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	}), std::function<void()>([&]() {
+		new_dump_text::dump_ib_txt(filename, &map, size, DXGI_FORMAT_R16_UINT, 0, 0, 0, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	}));
+
+	bench("constant buffer", std::function<void()>([&]() {
+		old_dump_text::dump_buffer_txt(filename, &map, size, 'c', 0, 0, 0);
+	}), std::function<void()>([&]() {
+		new_dump_text::dump_buffer_txt(filename, &map, size, 'c', 0, 0, 0);
+	}));
+
+	remove("DumpTextBench.txt");
+	return 0;
+}
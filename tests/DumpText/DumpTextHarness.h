@@ -0,0 +1,143 @@
+#pragma once
+
+// Stand-ins for the D3D types and helpers that the buffer dump writers use,
+// and the entry points of both sets of writers built against them:
+// old_dump_text:: from OldDumpText.inc (OldDumpText.cpp) and new_dump_text::
+// from FrameAnalysis.cpp (NewDumpText.inc generated by CMakeLists.txt, built
+// in NewDumpText.cpp).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "DumpText.h"
+#include "DxgiFormat.h"
+
+typedef unsigned UINT;
+typedef int errno_t;
+using std::min;
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof(a[0]))
+#define sprintf_s snprintf
+#define FALogWorker(...) do {} while (0)
+
+struct D3D11_MAPPED_SUBRESOURCE
+{
+	void *pData;
+	UINT RowPitch;
+	UINT DepthPitch;
+};
+
+enum D3D11_INPUT_CLASSIFICATION {
+	D3D11_INPUT_PER_VERTEX_DATA = 0,
+	D3D11_INPUT_PER_INSTANCE_DATA = 1,
+};
+
+#define D3D11_APPEND_ALIGNED_ELEMENT 0xffffffff
+
+struct D3D11_INPUT_ELEMENT_DESC
+{
+	const char *SemanticName;
+	UINT SemanticIndex;
+	DXGI_FORMAT Format;
+	UINT InputSlot;
+	UINT AlignedByteOffset;
+	D3D11_INPUT_CLASSIFICATION InputSlotClass;
+	UINT InstanceDataStepRate;
+};
+
+enum D3D11_PRIMITIVE_TOPOLOGY {
+	D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED = 0,
+	D3D11_PRIMITIVE_TOPOLOGY_POINTLIST = 1,
+	D3D11_PRIMITIVE_TOPOLOGY_LINELIST = 2,
+	D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP = 3,
+	D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST = 4,
+	D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP = 5,
+};
+
+// The layout blob holds an array of D3D11_INPUT_ELEMENT_DESC:
+struct ID3DBlob
+{
+	std::vector<D3D11_INPUT_ELEMENT_DESC> elements;
+
+	void* GetBufferPointer() { return elements.data(); }
+	size_t GetBufferSize() { return elements.size() * sizeof(D3D11_INPUT_ELEMENT_DESC); }
+};
+
+struct DrawCallInfo
+{
+	UINT FirstInstance;
+	UINT InstanceCount;
+};
+
+static const char* TopologyStr(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+	switch (topology) {
+		case D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED: return "undefined";
+		case D3D11_PRIMITIVE_TOPOLOGY_POINTLIST: return "pointlist";
+		case D3D11_PRIMITIVE_TOPOLOGY_LINELIST: return "linelist";
+		case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP: return "linestrip";
+		case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST: return "trianglelist";
+		case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP: return "trianglestrip";
+	}
+	return "unknown";
+}
+
+static const char* TexFormatStr(DXGI_FORMAT format)
+{
+	static char buf[32];
+
+	snprintf(buf, sizeof(buf), "DXGI_FORMAT_%u", (unsigned)format);
+	return buf;
+}
+
+static errno_t wfopen_ensuring_access(FILE **fd, const wchar_t *filename, const wchar_t *mode)
+{
+	char path[1024], m[8];
+
+	wcstombs(path, filename, sizeof(path));
+	wcstombs(m, mode, sizeof(m));
+	*fd = fopen(path, m);
+	return *fd ? 0 : 1;
+}
+
+#include "FormatSize.inc"
+
+#define DUMP_TEXT_ENTRY_POINTS \
+	void dump_buffer_txt(const wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map, \
+			UINT size, char type, int idx, UINT stride, UINT offset); \
+	void dump_vb_txt(const wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map, \
+			UINT size, int slot, UINT stride, UINT offset, UINT first, UINT count, ID3DBlob *layout, \
+			D3D11_PRIMITIVE_TOPOLOGY topology, DrawCallInfo *call_info); \
+	void dump_ib_txt(const wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map, \
+			UINT size, DXGI_FORMAT format, UINT offset, UINT first, UINT count, \
+			D3D11_PRIMITIVE_TOPOLOGY topology);
+
+namespace old_dump_text { DUMP_TEXT_ENTRY_POINTS }
+namespace new_dump_text { DUMP_TEXT_ENTRY_POINTS }
+
+// The writers are static in FrameAnalysis.cpp, so each set is included into
+// a namespace of its own and called through these:
+#define DUMP_TEXT_WRAP_ENTRY_POINTS(ns, impl) \
+	void ns::dump_buffer_txt(const wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map, \
+			UINT size, char type, int idx, UINT stride, UINT offset) \
+	{ \
+		impl::dump_buffer_txt(filename, map, size, type, idx, stride, offset); \
+	} \
+	void ns::dump_vb_txt(const wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map, \
+			UINT size, int slot, UINT stride, UINT offset, UINT first, UINT count, ID3DBlob *layout, \
+			D3D11_PRIMITIVE_TOPOLOGY topology, DrawCallInfo *call_info) \
+	{ \
+		impl::dump_vb_txt(filename, map, size, slot, stride, offset, first, count, layout, topology, call_info); \
+	} \
+	void ns::dump_ib_txt(const wchar_t *filename, D3D11_MAPPED_SUBRESOURCE *map, \
+			UINT size, DXGI_FORMAT format, UINT offset, UINT first, UINT count, \
+			D3D11_PRIMITIVE_TOPOLOGY topology) \
+	{ \
+		impl::dump_ib_txt(filename, map, size, format, offset, first, count, topology); \
+	}
@@ -0,0 +1,216 @@
+// Dumps the same synthetic buffers with the old fprintf based writers and the
+// current DumpTextWriter based ones from FrameAnalysis.cpp, and checks that
+// the files are byte for byte identical:
+//
+//   - vertex buffers with every DXGI format as a per-vertex and a per-instance
+//     element, at fixed and append aligned offsets, with and without instance
+//     step rates, and with no input layout at all
+//   - index buffers of each index format and topology, with offsets, first
+//     index and count
+//   - constant buffers with and without a slot, offset and stride
+//
+// The data is random, salted with the floats whose %.9g spelling is most
+// likely to trip up a hand rolled conversion: zeroes, denormals, the largest
+// finite value, infinities and NaNs.
+
+#include <math.h>
+
+#include <random>
+
+#include "DumpTextHarness.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static const wchar_t *old_filename = L"DumpTextTest-old.txt";
+static const wchar_t *new_filename = L"DumpTextTest-new.txt";
+
+static std::string slurp(const wchar_t *filename)
+{
+	std::string contents;
+	FILE *fd = NULL;
+	char buf[65536];
+	size_t n;
+
+	wfopen_ensuring_access(&fd, filename, L"rb");
+	if (!fd)
+		return contents;
+	while ((n = fread(buf, 1, sizeof(buf), fd)) > 0)
+		contents.append(buf, n);
+	fclose(fd);
+
+	return contents;
+}
+
+static void compare_files(const char *what)
+{
+	std::string old_txt = slurp(old_filename);
+	std::string new_txt = slurp(new_filename);
+	size_t i, line = 1;
+
+	CHECK(!old_txt.empty(), "%s: nothing dumped", what);
+	if (old_txt == new_txt)
+		return;
+
+	for (i = 0; i < old_txt.size() && i < new_txt.size() && old_txt[i] == new_txt[i]; i++) {
+		if (old_txt[i] == '\n')
+			line++;
+	}
+	CHECK(false, "%s: differs from line %zu (%zu vs %zu bytes)", what, line, new_txt.size(), old_txt.size());
+}
+
+static std::vector<uint8_t> make_data(size_t size, std::mt19937 &rng)
+{
+	static const float specials[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 1e-45f, -1e-45f, 1.17549435e-38f,
+		1.17549421e-38f, 3.40282347e38f, INFINITY, -INFINITY, NAN, -NAN,
+		0.1f, 1e-10f, 123456792.0f, 16777217.0f,
+	};
+	std::vector<uint8_t> data(size);
+	size_t i;
+	float f;
+
+	for (i = 0; i < size; i++)
+		data[i] = (uint8_t)rng();
+	for (i = 0; i + 4 <= size; i += 4 * 7)
+		memcpy(&data[i], &specials[(i / 28) % ARRAYSIZE(specials)], 4);
+	// And some realistic positions:
+	for (i = 16; i + 4 <= size; i += 64) {
+		f = (float)((int)(rng() % 2000) - 1000) / 37.0f;
+		memcpy(&data[i], &f, 4);
+	}
+
+	return data;
+}
+
+static void test_vertex_buffers(std::vector<uint8_t> &data)
+{
+	D3D11_MAPPED_SUBRESOURCE map = { data.data(), 0, 0 };
+	D3D11_PRIMITIVE_TOPOLOGY topology;
+	DrawCallInfo call_info;
+	ID3DBlob layout;
+	UINT size = (UINT)data.size();
+	UINT stride, offset, first, count;
+	char what[64];
+	int fmt, slot;
+
+	for (fmt = 0; fmt <= DXGI_FORMAT_B4G4R4A4_UNORM; fmt++) {
+		layout.elements = {
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "TEXCOORD", (UINT)(fmt & 3), (DXGI_FORMAT)fmt, 0, fmt & 1 ? D3D11_APPEND_ALIGNED_ELEMENT : 13, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 1, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "INSTANCE", 1, (DXGI_FORMAT)fmt, 0, 40, D3D11_INPUT_PER_INSTANCE_DATA, (UINT)(fmt % 3) },
+			{ "PADDING", 0, (DXGI_FORMAT)fmt, 1, 44, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		};
+		stride = fmt % 5 ? 48 : 40;
+		offset = fmt % 7 ? 0 : 96;
+		first = fmt % 3;
+		count = fmt % 4 ? 200 : 0;
+		call_info.FirstInstance = fmt % 2;
+		call_info.InstanceCount = fmt % 6 ? 50 : 0;
+		topology = fmt % 2 ? D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST : D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+
+		for (slot = 0; slot < 2; slot++) {
+			old_dump_text::dump_vb_txt(old_filename, &map, size, slot, stride, offset, first, count, &layout, topology, &call_info);
+			new_dump_text::dump_vb_txt(new_filename, &map, size, slot, stride, offset, first, count, &layout, topology, &call_info);
+			snprintf(what, sizeof(what), "vb%i format %i", slot, fmt);
+			compare_files(what);
+		}
+
+		// No input layout, dumped as raw words and then bytes:
+		stride = 4 + fmt % 9;
+		old_dump_text::dump_vb_txt(old_filename, &map, size, 0, stride, offset, first, 100, NULL, topology, &call_info);
+		new_dump_text::dump_vb_txt(new_filename, &map, size, 0, stride, offset, first, 100, NULL, topology, &call_info);
+		snprintf(what, sizeof(what), "unknown layout stride %u", stride);
+		compare_files(what);
+	}
+
+	// A size that isn't a whole number of vertices, and a stride of 0:
+	old_dump_text::dump_vb_txt(old_filename, &map, 1000, 0, 48, 0, 0, 0, &layout, D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED, &call_info);
+	new_dump_text::dump_vb_txt(new_filename, &map, 1000, 0, 48, 0, 0, 0, &layout, D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED, &call_info);
+	compare_files("partial vertex");
+	old_dump_text::dump_vb_txt(old_filename, &map, size, 0, 0, 0, 0, 0, &layout, D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED, &call_info);
+	new_dump_text::dump_vb_txt(new_filename, &map, size, 0, 0, 0, 0, 0, &layout, D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED, &call_info);
+	compare_files("stride 0");
+}
+
+static void test_index_buffers(std::vector<uint8_t> &data)
+{
+	static const D3D11_PRIMITIVE_TOPOLOGY topologies[] = {
+		D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED,
+		D3D11_PRIMITIVE_TOPOLOGY_POINTLIST,
+		D3D11_PRIMITIVE_TOPOLOGY_LINELIST,
+		D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
+		D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP,
+	};
+	static const DXGI_FORMAT formats[] = {
+		DXGI_FORMAT_R16_UINT,
+		DXGI_FORMAT_R32_UINT,
+		DXGI_FORMAT_R8_UINT, // Not a legal index buffer format
+	};
+	static const UINT ranges[][3] = {
+		// offset, first, count
+		{ 0, 0, 0 },
+		{ 6, 2, 500 },
+		{ 12, 0, 7 },
+		{ 0, 100000, 10 }, // Starts past the end
+	};
+	D3D11_MAPPED_SUBRESOURCE map = { data.data(), 0, 0 };
+	char what[64];
+
+	for (D3D11_PRIMITIVE_TOPOLOGY topology : topologies) {
+		for (DXGI_FORMAT format : formats) {
+			for (auto &range : ranges) {
+				old_dump_text::dump_ib_txt(old_filename, &map, 40000, format, range[0], range[1], range[2], topology);
+				new_dump_text::dump_ib_txt(new_filename, &map, 40000, format, range[0], range[1], range[2], topology);
+				snprintf(what, sizeof(what), "ib %s format %i offset %u first %u count %u",
+						TopologyStr(topology), format, range[0], range[1], range[2]);
+				compare_files(what);
+			}
+		}
+	}
+}
+
+static void test_constant_buffers(std::vector<uint8_t> &data)
+{
+	D3D11_MAPPED_SUBRESOURCE map = { data.data(), 0, 0 };
+	char what[64];
+	UINT offset;
+	int idx;
+
+	for (idx = -1; idx < 14; idx += 7) {
+		for (offset = 0; offset < 48; offset += 4) {
+			old_dump_text::dump_buffer_txt(old_filename, &map, 4096, idx == 6 ? 't' : 'c', idx, idx == 13 ? 16 : 0, offset);
+			new_dump_text::dump_buffer_txt(new_filename, &map, 4096, idx == 6 ? 't' : 'c', idx, idx == 13 ? 16 : 0, offset);
+			snprintf(what, sizeof(what), "cb%i offset %u", idx, offset);
+			compare_files(what);
+		}
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(40);
+	std::vector<uint8_t> data = make_data(64 * 1024, rng);
+
+	test_vertex_buffers(data);
+	test_index_buffers(data);
+	test_constant_buffers(data);
+
+	remove("DumpTextTest-old.txt");
+	remove("DumpTextTest-new.txt");
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,7 @@
+#include "DumpTextHarness.h"
+
+namespace new_dump_text_impl {
+#include "NewDumpText.inc"
+}
+
+DUMP_TEXT_WRAP_ENTRY_POINTS(new_dump_text, new_dump_text_impl)
@@ -0,0 +1,7 @@
+#include "DumpTextHarness.h"
+
+namespace old_dump_text_impl {
+#include "OldDumpText.inc"
+}
+
+DUMP_TEXT_WRAP_ENTRY_POINTS(old_dump_text, old_dump_text_impl)
@@ -0,0 +1,326 @@
+// Fills in synthetic shader usage statistics and resource contamination info,
+// writes ShaderUsage.txt from them with both the old writer (OldDumpUsage.inc)
+// and the current one taken from Hunting.cpp (NewDumpUsage.inc, generated by
+// CMakeLists.txt), and checks that the two reports are identical.
+//
+// The types below are cut down stand-ins for those in globals.h and
+// ResourceHash.h with just the fields the writers use.
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+typedef unsigned UINT;
+typedef uint64_t UINT64;
+typedef unsigned long DWORD;
+struct ID3D11Resource;
+
+struct D3D11_BOX
+{
+	UINT left, top, front, right, bottom, back;
+};
+
+// The old writer's output is collected in memory too, so the two can be
+// compared directly:
+struct ReportFile
+{
+	std::string data;
+};
+typedef ReportFile* HANDLE;
+
+static int WriteFile(HANDLE f, const void *buf, DWORD len, DWORD *written, void*)
+{
+	f->data.append((const char*)buf, len);
+	*written = len;
+	return 1;
+}
+
+static int _snprintf_s(char *buf, size_t size, size_t count, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+struct CopySubresourceRegionContamination
+{
+	bool partial;
+	UINT DstX;
+	UINT DstY;
+	UINT DstZ;
+	D3D11_BOX SrcBox;
+};
+typedef std::tuple<uint32_t, UINT, UINT, UINT, UINT> CopySubresourceRegionContaminationMapKey;
+typedef std::map<CopySubresourceRegionContaminationMapKey, CopySubresourceRegionContamination>
+	CopySubresourceRegionContaminationMap;
+
+struct ResourceHashInfo
+{
+	int type;
+	UINT width;
+	bool hash_contaminated;
+	std::set<UINT> update_contamination;
+	std::set<UINT> map_contamination;
+	std::set<uint32_t> copy_contamination;
+	CopySubresourceRegionContaminationMap region_contamination;
+};
+
+static int StrResourceDesc(char *buf, size_t size, struct ResourceHashInfo &info)
+{
+	return snprintf(buf, size, "type=%i Width=%u", info.type, info.width);
+}
+
+struct ResourceSnapshot
+{
+	ID3D11Resource *handle;
+	uint32_t hash;
+	uint32_t orig_hash;
+};
+static inline bool operator<(const ResourceSnapshot &lhs, const ResourceSnapshot &rhs)
+{
+	if (lhs.orig_hash != rhs.orig_hash)
+		return (lhs.orig_hash < rhs.orig_hash);
+	if (lhs.hash != rhs.hash)
+		return (lhs.hash < rhs.hash);
+	return (lhs.handle < rhs.handle);
+}
+
+struct ShaderInfoData
+{
+	std::map<int, std::set<ResourceSnapshot>> ResourceRegisters;
+	std::set<UINT64> PeerShaders;
+	std::vector<std::set<ResourceSnapshot>> RenderTargets;
+	std::map<int, std::set<ResourceSnapshot>> UAVs;
+	std::set<ResourceSnapshot> DepthTargets;
+};
+
+struct Globals
+{
+	std::map<uint32_t, ResourceHashInfo> mResourceInfo;
+
+	std::map<UINT64, ShaderInfoData> mVertexShaderInfo;
+	std::map<UINT64, ShaderInfoData> mHullShaderInfo;
+	std::map<UINT64, ShaderInfoData> mDomainShaderInfo;
+	std::map<UINT64, ShaderInfoData> mGeometryShaderInfo;
+	std::map<UINT64, ShaderInfoData> mPixelShaderInfo;
+	std::map<UINT64, ShaderInfoData> mComputeShaderInfo;
+
+	std::set<uint32_t> mRenderTargetInfo;
+	std::set<uint32_t> mDepthTargetInfo;
+	std::set<uint32_t> mUnorderedAccessInfo;
+	std::set<uint32_t> mShaderResourceInfo;
+	std::set<uint32_t> mCopiedResourceInfo;
+};
+
+static Globals globals;
+static Globals *G = &globals;
+
+namespace old_writer {
+#include "OldDumpUsage.inc"
+}
+
+namespace new_writer {
+#include "NewDumpUsage.inc"
+}
+
+static const int NUM_HASHES = 4000;
+
+static UINT64 random_shader_hash(std::mt19937 &rng)
+{
+	return ((UINT64)rng() << 32) | rng();
+}
+
+static ResourceSnapshot random_snapshot(std::mt19937 &rng)
+{
+	ResourceSnapshot snapshot;
+
+	snapshot.handle = (ID3D11Resource*)(uintptr_t)((rng() % 100000) * 16);
+	snapshot.hash = rng() % NUM_HASHES;
+	// Most resources keep their original hash, some have been replaced,
+	// and some have a hash that was never seen (no ResourceHashInfo):
+	switch (rng() % 4) {
+		case 0:
+			snapshot.orig_hash = rng() % NUM_HASHES;
+			break;
+		case 1:
+			snapshot.orig_hash = NUM_HASHES + rng() % 100;
+			break;
+		default:
+			snapshot.orig_hash = snapshot.hash;
+			break;
+	}
+
+	return snapshot;
+}
+
+static void fill_resource_info(std::mt19937 &rng)
+{
+	CopySubresourceRegionContamination region;
+	CopySubresourceRegionContaminationMapKey key;
+	int i, j;
+
+	for (i = 0; i < 3000; i++) {
+		ResourceHashInfo &info = G->mResourceInfo[rng() % NUM_HASHES];
+
+		info.type = rng() % 5;
+		info.width = rng();
+		info.hash_contaminated = rng() % 2;
+		for (j = rng() % 3; j; j--)
+			info.update_contamination.insert(rng() % 8);
+		for (j = rng() % 3; j; j--)
+			info.map_contamination.insert(rng() % 8);
+		for (j = rng() % 3; j; j--)
+			info.copy_contamination.insert(rng());
+		for (j = rng() % 3; j; j--) {
+			region.partial = rng() % 2;
+			region.DstX = rng() % 3;
+			region.DstY = 0;
+			region.DstZ = rng() % 2;
+			region.SrcBox = {0, (UINT)(rng() % 2), 0, UINT_MAX, UINT_MAX, rng() % 2 ? UINT_MAX : 5u};
+			key = std::make_tuple((uint32_t)rng(), rng() % 2, rng() % 2, rng() % 2, rng() % 2);
+			info.region_contamination[key] = region;
+		}
+	}
+
+	// Include hashes with no ResourceHashInfo, which are skipped:
+	for (i = 0; i < 1000; i++) {
+		G->mRenderTargetInfo.insert(rng() % (NUM_HASHES + 500));
+		G->mDepthTargetInfo.insert(rng() % (NUM_HASHES + 500));
+		G->mUnorderedAccessInfo.insert(rng() % (NUM_HASHES + 500));
+		G->mShaderResourceInfo.insert(rng() % (NUM_HASHES + 500));
+		G->mCopiedResourceInfo.insert(rng() % (NUM_HASHES + 500));
+	}
+}
+
+static void fill_shader_info(std::mt19937 &rng, std::map<UINT64, ShaderInfoData> *info_map, int shaders)
+{
+	unsigned slot;
+	int i, j;
+
+	for (i = 0; i < shaders; i++) {
+		ShaderInfoData &info = (*info_map)[random_shader_hash(rng)];
+
+		for (j = 0; j < 12; j++) {
+			switch (rng() % 5) {
+				case 0:
+					info.ResourceRegisters[rng() % 16].insert(random_snapshot(rng));
+					break;
+				case 1:
+					info.PeerShaders.insert(random_shader_hash(rng));
+					break;
+				case 2:
+					slot = rng() % 8;
+					if (info.RenderTargets.size() <= slot)
+						info.RenderTargets.resize(slot + 1);
+					info.RenderTargets[slot].insert(random_snapshot(rng));
+					break;
+				case 3:
+					info.DepthTargets.insert(random_snapshot(rng));
+					break;
+				case 4:
+					info.UAVs[rng() % 8].insert(random_snapshot(rng));
+					break;
+			}
+		}
+	}
+}
+
+// Same sections in the same order as DumpUsage():
+static std::string old_report()
+{
+	ReportFile f;
+
+	old_writer::DumpShaderUsageInfo(&f, &G->mVertexShaderInfo, (char*)"VertexShader");
+	old_writer::DumpShaderUsageInfo(&f, &G->mHullShaderInfo, (char*)"HullShader");
+	old_writer::DumpShaderUsageInfo(&f, &G->mDomainShaderInfo, (char*)"DomainShader");
+	old_writer::DumpShaderUsageInfo(&f, &G->mGeometryShaderInfo, (char*)"GeometryShader");
+	old_writer::DumpShaderUsageInfo(&f, &G->mPixelShaderInfo, (char*)"PixelShader");
+	old_writer::DumpShaderUsageInfo(&f, &G->mComputeShaderInfo, (char*)"ComputeShader");
+
+	old_writer::DumpUsageResourceInfo(&f, &G->mRenderTargetInfo, (char*)"RenderTarget");
+	old_writer::DumpUsageResourceInfo(&f, &G->mDepthTargetInfo, (char*)"DepthTarget");
+	old_writer::DumpUsageResourceInfo(&f, &G->mUnorderedAccessInfo, (char*)"UAV");
+	old_writer::DumpUsageResourceInfo(&f, &G->mShaderResourceInfo, (char*)"Register");
+	old_writer::DumpUsageResourceInfo(&f, &G->mCopiedResourceInfo, (char*)"CopySource");
+
+	return f.data;
+}
+
+static std::string new_report()
+{
+	std::string report;
+
+	new_writer::DumpShaderUsageInfo(&report, &G->mVertexShaderInfo, (char*)"VertexShader");
+	new_writer::DumpShaderUsageInfo(&report, &G->mHullShaderInfo, (char*)"HullShader");
+	new_writer::DumpShaderUsageInfo(&report, &G->mDomainShaderInfo, (char*)"DomainShader");
+	new_writer::DumpShaderUsageInfo(&report, &G->mGeometryShaderInfo, (char*)"GeometryShader");
+	new_writer::DumpShaderUsageInfo(&report, &G->mPixelShaderInfo, (char*)"PixelShader");
+	new_writer::DumpShaderUsageInfo(&report, &G->mComputeShaderInfo, (char*)"ComputeShader");
+
+	new_writer::DumpUsageResourceInfo(&report, &G->mRenderTargetInfo, (char*)"RenderTarget");
+	new_writer::DumpUsageResourceInfo(&report, &G->mDepthTargetInfo, (char*)"DepthTarget");
+	new_writer::DumpUsageResourceInfo(&report, &G->mUnorderedAccessInfo, (char*)"UAV");
+	new_writer::DumpUsageResourceInfo(&report, &G->mShaderResourceInfo, (char*)"Register");
+	new_writer::DumpUsageResourceInfo(&report, &G->mCopiedResourceInfo, (char*)"CopySource");
+
+	return report;
+}
+
+static int compare_reports(const char *what)
+{
+	std::string expected = old_report();
+	std::string actual = new_report();
+	size_t pos;
+
+	if (expected == actual) {
+		printf("ok: %s, %zu bytes\n", what, actual.size());
+		return 0;
+	}
+
+	for (pos = 0; pos < expected.size() && pos < actual.size(); pos++) {
+		if (expected[pos] != actual[pos])
+			break;
+	}
+	printf("FAIL: %s, %zu bytes expected, %zu written, first difference at offset %zu:\n",
+			what, expected.size(), actual.size(), pos);
+	pos -= std::min(pos, (size_t)40);
+	printf("  expected: \"%s\"\n", expected.substr(pos, 80).c_str());
+	printf("  written:  \"%s\"\n", actual.substr(pos, 80).c_str());
+	return 1;
+}
+
+int main()
+{
+	std::mt19937 rng(1);
+	int failures = 0;
+
+	failures += compare_reports("empty");
+
+	fill_resource_info(rng);
+	failures += compare_reports("resources only");
+
+	fill_shader_info(rng, &G->mVertexShaderInfo, 1000);
+	fill_shader_info(rng, &G->mHullShaderInfo, 50);
+	fill_shader_info(rng, &G->mDomainShaderInfo, 50);
+	fill_shader_info(rng, &G->mGeometryShaderInfo, 100);
+	fill_shader_info(rng, &G->mPixelShaderInfo, 1000);
+	fill_shader_info(rng, &G->mComputeShaderInfo, 200);
+	failures += compare_reports("shaders and resources");
+
+	return failures;
+}
@@ -0,0 +1,131 @@
+// Compares FlatHashMap against the std::unordered_map it replaced, for the
+// lookups done on every draw call, at table sizes from a handful of
+// ShaderOverrides up to the tens of thousands of resource handles a large
+// game creates:
+//
+//   - hash lookups that find a value (a shader with a ShaderOverride)
+//   - hash lookups that find nothing (the common case in BeforeDraw, where
+//     most shaders have no ShaderOverride)
+//   - handle lookups, with keys allocated sequentially like resource handles
+//   - a resource being created and another destroyed (insert + erase) at a
+//     constant table size
+//
+// Lookups are in a random order over a large enough set of keys that the
+// tables don't simply stay in L1 when they are large.
+//
+// This is Linux only and not run by ctest. Run it from the build directory:
+//
+//   FlatHashMapBench [lookups]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "FlatHashMap.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// About the size of a ShaderOverride:
+struct Override
+{
+	uint64_t data[24];
+};
+
+struct HandleInfo
+{
+	uint32_t hash, orig_hash;
+	uint64_t data[6];
+};
+
+// Resource handles, which are only ever compared:
+struct ID;
+
+static uint64_t sink;
+
+template <class Map, class Key>
+static double bench_lookups(Map &map, const std::vector<Key> &keys, int lookups)
+{
+	Clock::time_point start = Clock::now();
+	uint64_t found = 0;
+	size_t n = keys.size();
+	int i;
+
+	for (i = 0; i < lookups; i++) {
+		auto j = map.find(keys[(size_t)i * 2654435761u % n]);
+		if (j != map.end())
+			found += j->second.data[0];
+	}
+	sink += found;
+
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / lookups;
+}
+
+template <class Map>
+static double bench_churn(Map &map, size_t size, int ops)
+{
+	Clock::time_point start;
+	uint64_t oldest = 1, next = 1;
+	int i;
+
+	while (map.size() < size)
+		map[(ID*)(uintptr_t)(next++ * 64)].hash = 0;
+
+	start = Clock::now();
+	for (i = 0; i < ops; i++) {
+		map.erase((ID*)(uintptr_t)(oldest++ * 64));
+		map[(ID*)(uintptr_t)(next++ * 64)].hash = i;
+	}
+
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ops;
+}
+
+static void bench_size(size_t size, int lookups)
+{
+	std::mt19937_64 rng(size);
+	std::unordered_map<uint64_t, Override> std_overrides;
+	FlatHashMap<uint64_t, Override> flat_overrides;
+	std::unordered_map<ID*, HandleInfo> std_handles, std_churn;
+	FlatHashMap<ID*, HandleInfo> flat_handles, flat_churn;
+	std::vector<uint64_t> hits, misses;
+	std::vector<ID*> handles;
+	uint64_t hash;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash = rng();
+		std_overrides[hash].data[0] = i;
+		flat_overrides[hash].data[0] = i;
+		hits.push_back(hash);
+		misses.push_back(rng());
+
+		handles.push_back((ID*)(uintptr_t)(0x100000 + i * 64));
+		std_handles[handles.back()].data[0] = i;
+		flat_handles[handles.back()].data[0] = i;
+	}
+	// As is done once the ini file has been loaded:
+	flat_overrides.compact(64);
+
+	printf("%6zu elements: hit %6.2fns vs %6.2fns, miss %6.2fns vs %6.2fns, handle %6.2fns vs %6.2fns, churn %6.2fns vs %6.2fns\n",
+			size,
+			bench_lookups(flat_overrides, hits, lookups), bench_lookups(std_overrides, hits, lookups),
+			bench_lookups(flat_overrides, misses, lookups), bench_lookups(std_overrides, misses, lookups),
+			bench_lookups(flat_handles, handles, lookups), bench_lookups(std_handles, handles, lookups),
+			bench_churn(flat_churn, size, lookups / 4), bench_churn(std_churn, size, lookups / 4));
+}
+
+int main(int argc, char **argv)
+{
+	int lookups = argc > 1 ? atoi(argv[1]) : 10000000;
+	size_t size;
+
+	printf("FlatHashMap vs std::unordered_map, time per operation:\n");
+	for (size = 16; size <= 65536; size *= 4)
+		bench_size(size, lookups);
+
+	return sink == 42;
+}
@@ -0,0 +1,295 @@
+// Runs random sequences of inserts, erases (by key and by iterator),
+// lookups, reserve(), compact() and clear() on FlatHashMap and on a
+// std::unordered_map alongside it, and checks:
+//
+//   - find(), count(), at() and operator[] agree with the unordered_map, and
+//     at() throws for a missing key
+//   - iterating (const or not) visits every element exactly once
+//   - values never move once inserted, however many times the table is
+//     rehashed, as the pointers taken to ShaderOverrides and
+//     ResourceHandleInfos rely on
+//   - every value is destroyed exactly once, by erase(), clear() or the
+//     destructor
+//   - this holds for the handle, hash and texture hash key types, and with
+//     hash functions bad enough that every key shares its 7 bit hash and a
+//     handful of groups, which exercises the probing and tombstones
+//   - a table that has elements inserted and erased forever at a constant
+//     size keeps working, so tombstones are cleaned out rather than filling
+//     every empty slot
+//
+// Best also run with -fsanitize=address.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <random>
+#include <unordered_map>
+
+#include "FlatHashMap.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static long live_values;
+
+struct Value
+{
+	int id;
+
+	Value() : id(-1) { live_values++; }
+	~Value() { live_values--; }
+
+	Value(const Value&) = delete;
+	Value& operator=(const Value&) = delete;
+};
+
+// What we expect to find for each key: the last id stored in it, and where
+// its value was first constructed:
+struct Expected
+{
+	int id;
+	const Value *addr;
+};
+
+// Every key has the same 7 bit hash and lands in one of three groups:
+template <class Key>
+struct CollidingHash
+{
+	uint64_t operator()(const Key &key) const
+	{
+		return (uint64_t)(uintptr_t)key % 3;
+	}
+};
+
+// Only the top bits vary, so every key starts probing from the first group:
+template <class Key>
+struct HighBitsHash
+{
+	uint64_t operator()(const Key &key) const
+	{
+		return flat_hash_mix((uint64_t)(uintptr_t)key) & 0xfe00000000000000ull;
+	}
+};
+
+template <class Map, class Key>
+static void check_contents(const Map &map, const std::unordered_map<Key, Expected> &expected, const char *what)
+{
+	std::unordered_map<Key, int> seen;
+
+	CHECK(map.size() == expected.size() && map.empty() == expected.empty(),
+			"%s: size %zu, expected %zu", what, map.size(), expected.size());
+
+	for (typename Map::const_iterator i = map.begin(); i != map.end(); ++i) {
+		auto e = expected.find(i->first);
+		if (e == expected.end()) {
+			CHECK(false, "%s: unexpected key %llx", what, (unsigned long long)(uintptr_t)i->first);
+			return;
+		}
+		CHECK(i->second.id == e->second.id && &i->second == e->second.addr,
+				"%s: key %llx has %i at %p, expected %i at %p", what, (unsigned long long)(uintptr_t)i->first,
+				i->second.id, (const void*)&i->second, e->second.id, (const void*)e->second.addr);
+		CHECK(++seen[i->first] == 1, "%s: key %llx visited twice", what, (unsigned long long)(uintptr_t)i->first);
+	}
+	CHECK(seen.size() == expected.size(), "%s: %zu visited", what, seen.size());
+}
+
+// Draws keys from a pool, which may be small enough that the same keys are
+// inserted and erased over and over, and may be aligned and sequential like
+// resource handles:
+template <class Key>
+struct KeySource
+{
+	std::mt19937_64 &rng;
+	uint64_t pool, stride;
+
+	Key operator()()
+	{
+		return (Key)(uintptr_t)(0x10000 + (rng() % pool) * stride);
+	}
+};
+
+template <class Key, class Hash>
+static void random_trial(std::mt19937_64 &rng, int trial, uint64_t pool, uint64_t stride, int ops)
+{
+	std::unordered_map<Key, Expected> expected;
+	KeySource<Key> next_key{rng, pool, stride};
+	char what[128];
+	Key key;
+	int op, id = 0;
+
+	{
+		FlatHashMap<Key, Value, Hash> map;
+
+		for (op = 0; op < ops && failures < 10; op++) {
+			snprintf(what, sizeof(what), "trial %i (pool %llu, stride %llu), op %i", trial,
+					(unsigned long long)pool, (unsigned long long)stride, op);
+			key = next_key();
+
+			switch (rng() % 16) {
+			case 0: case 1: case 2: case 3: case 4: case 5: {
+				// Insert or overwrite:
+				bool existed = expected.count(key);
+				Value &val = map[key];
+
+				if (existed) {
+					CHECK(&val == expected[key].addr, "%s: value moved", what);
+					CHECK(val.id == expected[key].id, "%s: wrong value", what);
+				} else {
+					CHECK(val.id == -1, "%s: not default constructed", what);
+					expected[key].addr = &val;
+				}
+				val.id = expected[key].id = id++;
+				break;
+			}
+			case 6: case 7:
+				CHECK(map.erase(key) == expected.erase(key), "%s: erase(key) disagrees", what);
+				break;
+			case 8: {
+				auto i = map.find(key);
+
+				CHECK((i != map.end()) == (expected.count(key) != 0), "%s: find() disagrees", what);
+				if (i != map.end()) {
+					map.erase(i);
+					expected.erase(key);
+				}
+				break;
+			}
+			case 9: case 10: case 11: case 12: {
+				const FlatHashMap<Key, Value, Hash> &cmap = map;
+				auto i = cmap.find(key);
+				bool threw = false;
+
+				CHECK(map.count(key) == expected.count(key), "%s: count() disagrees", what);
+				CHECK((i != cmap.end()) == (expected.count(key) != 0), "%s: find() disagrees", what);
+				if (i != cmap.end())
+					CHECK(i->first == key && &i->second == expected[key].addr, "%s: found the wrong value", what);
+				try {
+					CHECK(&map.at(key) == expected.at(key).addr, "%s: at() returned the wrong value", what);
+				} catch (std::out_of_range&) {
+					threw = true;
+				}
+				CHECK(threw == !expected.count(key), "%s: at() %s", what, threw ? "threw" : "didn't throw");
+				break;
+			}
+			case 13:
+				if (rng() % 8 == 0)
+					map.reserve(map.size() + rng() % 200);
+				break;
+			case 14:
+				if (rng() % 16 == 0)
+					map.compact(rng() % 2 ? 0 : rng() % 100);
+				break;
+			case 15:
+				if (rng() % 256 == 0) {
+					map.clear();
+					expected.clear();
+				}
+				if (rng() % 16 == 0)
+					check_contents(map, expected, what);
+				break;
+			}
+
+			CHECK(live_values == (long)expected.size(), "%s: %li live values for %zu elements", what,
+					live_values, expected.size());
+		}
+
+		check_contents(map, expected, "end of trial");
+	}
+
+	CHECK(live_values == 0, "trial %i: %li values not destroyed", trial, live_values);
+}
+
+template <class Key, class Hash>
+static void random_trials(std::mt19937_64 &rng, int trials, int max_ops)
+{
+	static const uint64_t pools[] = {1, 17, 100, 1000, 100000, UINT32_MAX};
+	static const uint64_t strides[] = {1, 16, 0x10000};
+	int trial;
+
+	for (trial = 0; trial < trials && failures < 10; trial++) {
+		random_trial<Key, Hash>(rng, trial, pools[rng() % 6], sizeof(Key) > 4 ? strides[rng() % 3] : 1,
+				1 + rng() % max_ops);
+	}
+}
+
+// The per-draw lookups in the middle of a game: a constant number of
+// elements, with resources created and destroyed every frame:
+template <class Hash>
+static void test_churn(const char *what, int elements, int ops)
+{
+	FlatHashMap<uint64_t, Value, Hash> map;
+	uint64_t oldest = 0, newest = 0;
+	int i;
+
+	for (i = 0; i < elements; i++)
+		map[newest++].id = 0;
+
+	for (i = 0; i < ops; i++) {
+		CHECK(map.erase(oldest++) == 1, "%s: %llu missing", what, (unsigned long long)oldest - 1);
+		map[newest++].id = i;
+		if (i % 1000 == 0) {
+			CHECK(map.count(oldest) && map.count(newest - 1) && !map.count(oldest - 1) && !map.count(newest),
+					"%s: lookups wrong after %i", what, i);
+		}
+	}
+	CHECK(map.size() == (size_t)elements, "%s: size %zu", what, map.size());
+}
+
+static void test_basics()
+{
+	FlatHashMap<int*, Value> map;
+	FlatHashMap<int*, Value>::iterator i;
+	FlatHashMap<int*, Value>::const_iterator ci;
+	int dummy[2];
+
+	CHECK(map.empty() && map.size() == 0 && map.begin() == map.end(), "not empty");
+	CHECK(map.find(dummy) == map.end() && !map.count(dummy) && !map.erase(dummy), "found in an empty map");
+
+	// Emptied by compact(), and used again:
+	map[dummy].id = 1;
+	map.erase(dummy);
+	map.compact(0);
+	CHECK(map.begin() == map.end() && !map.count(dummy), "not empty after compact");
+	map.reserve(100);
+	map[dummy + 1].id = 2;
+	CHECK(map.size() == 1 && map.begin()->first == dummy + 1 && map[dummy + 1].id == 2, "wrong after reserve");
+
+	// iterator converts to const_iterator:
+	i = map.find(dummy + 1);
+	ci = i;
+	CHECK(ci == map.find(dummy + 1) && ci->second.id == 2 && (*ci).first == dummy + 1, "bad const_iterator");
+	CHECK(++ci == map.end(), "more than one element");
+
+	map.clear();
+	CHECK(map.empty() && live_values == 0, "not cleared");
+}
+
+int main()
+{
+	std::mt19937_64 rng(26);
+
+	test_basics();
+
+	random_trials<uint64_t, FlatHash<uint64_t>>(rng, 300, 20000);
+	random_trials<uint32_t, FlatHash<uint32_t>>(rng, 100, 20000);
+	random_trials<void*, FlatHash<void*>>(rng, 100, 20000);
+	random_trials<uint64_t, CollidingHash<uint64_t>>(rng, 100, 3000);
+	random_trials<void*, HighBitsHash<void*>>(rng, 100, 3000);
+
+	test_churn<FlatHash<uint64_t>>("churn", 1000, 1000000);
+	test_churn<FlatHash<uint64_t>>("small churn", 1, 100000);
+	test_churn<HighBitsHash<uint64_t>>("churn with bad hash", 100, 100000);
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
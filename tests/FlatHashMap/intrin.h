@@ -0,0 +1,12 @@
+#pragma once
+
+// The one MSVC intrinsic FlatHashMap.h uses, for building it with GCC and
+// Clang.
+
+static inline unsigned char _BitScanForward(unsigned long *index, unsigned long mask)
+{
+	if (!mask)
+		return 0;
+	*index = (unsigned long)__builtin_ctzl(mask);
+	return 1;
+}
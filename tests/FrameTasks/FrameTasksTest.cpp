@@ -0,0 +1,358 @@
+// Drives FrameTaskScheduler with a fake microsecond clock that only moves when
+// a frame is presented or a task "runs", and checks:
+//
+//   - the budget is the clamped percentage of the smoothed frame time
+//   - cheap tasks run on the frame they were requested
+//   - once a task doesn't fit, later requests wait behind it
+//   - no task waits longer than its maximum delay, even when every frame is
+//     oversubscribed and the task is requested again each frame
+//   - the hunting buffer timeout, which may run up to 30 frames after it was
+//     requested, does nothing if the user pressed a key or turned hunting off
+//     in the meantime
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+#include "FrameTasks.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static uint64_t fake_now_us;
+
+static uint64_t fake_clock()
+{
+	return fake_now_us;
+}
+
+static time_t fake_time(time_t *t)
+{
+	time_t now = (time_t)(fake_now_us / 1000000);
+
+	if (t)
+		*t = now;
+	return now;
+}
+
+// Stand-ins for what timeout_hunting_buffers uses from the wrapper:
+enum HuntingMode {
+	HUNTING_MODE_DISABLED = 0,
+	HUNTING_MODE_ENABLED = 1,
+	HUNTING_MODE_SOFT_DISABLED = 2,
+};
+
+struct Globals {
+	HuntingMode hunting;
+	time_t huntTime;
+	int mCriticalSection;
+};
+
+static Globals globals;
+static Globals *G = &globals;
+static int buffers_cleared;
+
+static void EnterCriticalSectionPretty(int *) {}
+static void LeaveCriticalSection(int *) {}
+
+static void TimeoutHuntingBuffers()
+{
+	buffers_cleared++;
+}
+
+#define time fake_time
+#include "TimeoutHuntingBuffers.inc"
+#undef time
+
+static const FrameTaskStats* find_stats(const std::vector<FrameTaskStats> &stats, const char *name)
+{
+	for (const FrameTaskStats &s : stats) {
+		if (s.name == name)
+			return &s;
+	}
+	return NULL;
+}
+
+static void test_budget()
+{
+	FrameTaskScheduler scheduler(fake_clock);
+	int i;
+
+	struct {
+		uint64_t frame_us;
+		uint64_t expected_budget;
+	} rates[] = {
+		{ 33333, 1666 },  // 30fps, 5%
+		{ 16666, 833 },   // 60fps
+		{ 4166, 208 },    // 240fps
+		{ 1000, 100 },    // Clamped to the minimum
+		{ 100000, 2000 }, // Clamped to the maximum
+	};
+
+	fake_now_us = 1000000;
+	for (auto &rate : rates) {
+		// Long enough for the smoothing to settle:
+		for (i = 0; i < 200; i++) {
+			fake_now_us += rate.frame_us;
+			scheduler.run_frame();
+		}
+		CHECK(scheduler.budget_us() >= rate.expected_budget - 2 && scheduler.budget_us() <= rate.expected_budget + 2,
+				"%llu us frames: budget %llu, expected %llu", (unsigned long long)rate.frame_us,
+				(unsigned long long)scheduler.budget_us(), (unsigned long long)rate.expected_budget);
+	}
+
+	// One long frame (a config reload, say) moves the budget by an eighth
+	// of the difference, not all the way to 5% of 1s:
+	scheduler.set_budget(5, 100, 1000000);
+	for (i = 0; i < 200; i++) {
+		fake_now_us += 33333;
+		scheduler.run_frame();
+	}
+	fake_now_us += 1000000;
+	scheduler.run_frame();
+	CHECK(scheduler.budget_us() >= 7700 && scheduler.budget_us() <= 7720, "budget %llu after one long frame",
+			(unsigned long long)scheduler.budget_us());
+
+	scheduler.set_budget(10, 500, 400);
+	CHECK(scheduler.budget_us() == 500, "budget %llu with max below min",
+			(unsigned long long)scheduler.budget_us());
+}
+
+static void test_cheap_tasks_run_immediately()
+{
+	FrameTaskScheduler scheduler(fake_clock);
+	std::vector<FrameTaskStats> stats;
+	size_t tasks[5];
+	int runs[5] = {};
+	int i, j, frame;
+
+	for (i = 0; i < 5; i++) {
+		tasks[i] = scheduler.add("cheap", [&runs, i]() {
+			fake_now_us += 50;
+			runs[i]++;
+		}, 4);
+	}
+
+	fake_now_us = 0;
+	for (frame = 0; frame < 100; frame++) {
+		fake_now_us += 33333;
+		for (j = 0; j < 5; j++)
+			scheduler.request(tasks[j]);
+		scheduler.run_frame();
+		for (j = 0; j < 5; j++)
+			CHECK(runs[j] == frame + 1, "frame %i: task %i ran %i times", frame, j, runs[j]);
+	}
+
+	scheduler.stats(&stats);
+	for (FrameTaskStats &s : stats) {
+		CHECK(s.deferrals == 0 && s.forced == 0, "%llu deferrals, %llu forced",
+				(unsigned long long)s.deferrals, (unsigned long long)s.forced);
+		CHECK(s.average_us == 50, "average %llu us", (unsigned long long)s.average_us);
+	}
+}
+
+static void test_no_jumping_ahead()
+{
+	FrameTaskScheduler scheduler(fake_clock);
+	size_t big, small;
+	int big_runs = 0, small_runs = 0;
+	int frame;
+
+	big = scheduler.add("big", [&]() { fake_now_us += 1500; big_runs++; }, 10);
+	small = scheduler.add("small", [&]() { fake_now_us += 10; small_runs++; }, 10);
+
+	// Settle the 30fps budget (1666us) and measure both tasks:
+	fake_now_us = 0;
+	for (frame = 0; frame < 100; frame++)
+		fake_now_us += 33333, scheduler.run_frame();
+	scheduler.request(big);
+	scheduler.request(small);
+	fake_now_us += 33333, scheduler.run_frame();
+	CHECK(big_runs == 1 && small_runs == 1, "%i %i", big_runs, small_runs);
+
+	// With the budget capped below big's cost, big has to wait:
+	scheduler.set_budget(5, 100, 1000);
+	scheduler.request(big);
+	fake_now_us += 33333, scheduler.run_frame();
+	CHECK(big_runs == 1, "big ran over the budget");
+
+	// Requested after big, so it has to wait behind it even though it
+	// would fit on its own:
+	scheduler.request(small);
+	fake_now_us += 33333, scheduler.run_frame();
+	CHECK(small_runs == 1, "small jumped ahead of big");
+
+	// Until big is overdue. Small then no longer fits behind it that
+	// frame, and runs on the next:
+	for (frame = 0; frame < 10 && big_runs == 1; frame++)
+		fake_now_us += 33333, scheduler.run_frame();
+	CHECK(big_runs == 2 && small_runs == 1, "big %i small %i after big was overdue", big_runs, small_runs);
+	CHECK(frame == 9, "big ran after %i more frames", frame);
+	for (frame = 0; frame < 10 && small_runs == 1; frame++)
+		fake_now_us += 33333, scheduler.run_frame();
+	CHECK(small_runs == 2, "small did not run");
+}
+
+// The same maximum delays as the wrapper's housekeeping, every task over the
+// budget on its own, and every task requested again on every frame:
+static void test_max_delays()
+{
+	FrameTaskScheduler scheduler(fake_clock);
+	std::vector<FrameTaskStats> stats;
+	const unsigned delays[] = { 4, 8, 16, 30, 60 };
+	const int n = sizeof(delays) / sizeof(delays[0]);
+	size_t tasks[n];
+	bool pending[n] = {};
+	int requested_frame[n] = {};
+	int runs[n] = {};
+	int i, frame = 0, worst[n] = {};
+
+	for (i = 0; i < n; i++) {
+		tasks[i] = scheduler.add("slow", [&, i]() {
+			int waited = frame - requested_frame[i];
+
+			CHECK(pending[i], "task %i ran without being requested", i);
+			CHECK(waited <= (int)delays[i], "task %i waited %i frames, limit %u", i, waited, delays[i]);
+			if (waited > worst[i])
+				worst[i] = waited;
+			pending[i] = false;
+			runs[i]++;
+			fake_now_us += 3000;
+		}, delays[i]);
+	}
+
+	fake_now_us = 0;
+	for (frame = 0; frame < 2000; frame++) {
+		fake_now_us += 33333;
+		for (i = 0; i < n; i++) {
+			if (!pending[i]) {
+				pending[i] = true;
+				requested_frame[i] = frame;
+			}
+			scheduler.request(tasks[i]);
+		}
+		scheduler.run_frame();
+	}
+
+	scheduler.stats(&stats);
+	for (i = 0; i < n; i++) {
+		// Re-requesting a waiting task must not reset its wait, so
+		// once measured, every run is forced at exactly the limit:
+		CHECK(worst[i] == (int)delays[i], "task %i waited at most %i frames, limit %u", i, worst[i], delays[i]);
+		CHECK(runs[i] >= 2000 / (int)(delays[i] + 1) - 1, "task %i ran %i times", i, runs[i]);
+		CHECK(stats[i].runs == (uint64_t)runs[i], "task %i: stats say %llu runs", i,
+				(unsigned long long)stats[i].runs);
+		CHECK(stats[i].forced >= stats[i].runs - 2, "task %i: %llu of %llu runs forced", i,
+				(unsigned long long)stats[i].forced, (unsigned long long)stats[i].runs);
+	}
+}
+
+// RunFrameActions in HackerDXGI.cpp, as far as the hunting buffers go, with
+// a second task that keeps the budget full so that the timeout always waits
+// its full 30 frames:
+static FrameTaskScheduler *hunting_scheduler;
+static size_t busy_task, hunting_task;
+
+static void present(bool key_pressed)
+{
+	fake_now_us += 33333;
+
+	hunting_scheduler->request(busy_task);
+	hunting_scheduler->run_frame();
+
+	if (G->hunting != HUNTING_MODE_ENABLED)
+		return;
+
+	if (key_pressed)
+		G->huntTime = fake_time(NULL);
+
+	if (difftime(fake_time(NULL), G->huntTime) > 60)
+		hunting_scheduler->request(hunting_task);
+}
+
+static uint64_t hunting_task_runs()
+{
+	std::vector<FrameTaskStats> stats;
+
+	hunting_scheduler->stats(&stats);
+	return find_stats(stats, "hunting buffers")->runs;
+}
+
+static void test_hunting_timeout()
+{
+	FrameTaskScheduler scheduler(fake_clock);
+	uint64_t runs;
+	int cleared, frame;
+
+	hunting_scheduler = &scheduler;
+	busy_task = scheduler.add("busy", []() { fake_now_us += 5000; }, 1000000);
+	hunting_task = scheduler.add("hunting buffers", timeout_hunting_buffers, 30);
+
+	fake_now_us = 0;
+	G->hunting = HUNTING_MODE_ENABLED;
+	G->huntTime = fake_time(NULL);
+
+	// A minute and a bit of idle clears the buffers, about every 31
+	// frames from then on:
+	for (frame = 0; frame < 63 * 30; frame++)
+		present(false);
+	CHECK(buffers_cleared >= 1, "buffers not cleared after 63s idle");
+	cleared = buffers_cleared;
+	for (frame = 0; frame < 31 * 3; frame++)
+		present(false);
+	CHECK(buffers_cleared == cleared + 3, "cleared %i times in 93 idle frames", buffers_cleared - cleared);
+
+	// Step to the frame right after a clear, which requests the next one:
+	cleared = buffers_cleared;
+	for (frame = 0; frame < 31 && buffers_cleared == cleared; frame++)
+		present(false);
+	CHECK(buffers_cleared == cleared + 1, "buffers not cleared in 31 idle frames");
+	present(false);
+
+	// A key press while that request waits must keep the buffers:
+	cleared = buffers_cleared;
+	runs = hunting_task_runs();
+	present(false);
+	present(true);
+	for (frame = 0; frame < 40; frame++)
+		present(false);
+	CHECK(hunting_task_runs() == runs + 1, "timeout ran %llu times", (unsigned long long)(hunting_task_runs() - runs));
+	CHECK(buffers_cleared == cleared, "buffers cleared after a key press");
+
+	// As must turning hunting off:
+	for (frame = 0; frame < 62 * 30 && difftime(fake_time(NULL), G->huntTime) <= 60; frame++)
+		present(false);
+	present(false);
+	cleared = buffers_cleared;
+	runs = hunting_task_runs();
+	G->hunting = HUNTING_MODE_SOFT_DISABLED;
+	for (frame = 0; frame < 40; frame++)
+		present(false);
+	CHECK(hunting_task_runs() == runs + 1, "timeout ran %llu times", (unsigned long long)(hunting_task_runs() - runs));
+	CHECK(buffers_cleared == cleared, "buffers cleared after hunting was turned off");
+
+	hunting_scheduler = NULL;
+}
+
+int main()
+{
+	test_budget();
+	test_cheap_tasks_run_immediately();
+	test_no_jumping_ahead();
+	test_max_delays();
+	test_hunting_timeout();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
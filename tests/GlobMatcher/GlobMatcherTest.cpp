@@ -0,0 +1,235 @@
+// Matches filenames against exclude_recursive style globs with GlobMatcher,
+// JIT compiled and interpreted, and checks both against a copy of the old
+// matching in IniHandler.cpp (matches_globbing_vector), which converted and
+// compiled each glob the same way but created match data for every match and
+// never JIT compiled:
+//
+//   - "*" and "?", including runs of them and at either end
+//   - character classes
+//   - case folding, including of the filename's non-ASCII UTF-8 bytes
+//   - a filename matching any of several globs is excluded, including when
+//     an earlier glob converts to a pattern that commits and then fails
+//   - globs that can't be converted are left out the same way, and no globs
+//     match nothing
+//
+// Most pairs are random, from a small alphabet so that plenty of them match.
+
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "GlobMatcher.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// glob_to_regex() and matches_globbing_vector() as they were, with the
+// logging and wide string conversions left out:
+static pcre2_code* old_glob_to_regex(const std::string &apattern)
+{
+	PCRE2_UCHAR *converted = NULL;
+	PCRE2_SIZE blength = 0;
+	pcre2_code *regex = NULL;
+	PCRE2_SIZE err_off;
+	int err;
+
+	if (pcre2_pattern_convert((PCRE2_SPTR)apattern.c_str(),
+				apattern.length(), PCRE2_CONVERT_GLOB,
+				&converted, &blength, NULL)) {
+		return NULL;
+	}
+
+	regex = pcre2_compile(converted, blength, PCRE2_CASELESS, &err, &err_off, NULL);
+
+	pcre2_converted_pattern_free(converted);
+	return regex;
+}
+
+static bool old_matches_globbing_vector(const std::string &afilename, std::vector<pcre2_code*> &patterns)
+{
+	pcre2_match_data *md;
+	int rc;
+
+	for (pcre2_code *regex : patterns) {
+		md = pcre2_match_data_create_from_pattern(regex, NULL);
+		rc = pcre2_match(regex, (PCRE2_SPTR)afilename.c_str(), PCRE2_ZERO_TERMINATED, 0, 0, md, NULL);
+		pcre2_match_data_free(md);
+		if (rc > 0)
+			return true;
+	}
+
+	return false;
+}
+
+class Globs
+{
+public:
+	std::vector<std::string> globs;
+	std::vector<pcre2_code*> old;
+	GlobMatcher jit;
+	GlobMatcher interpreted;
+
+	Globs(const std::vector<std::string> &globs) : globs(globs), jit(true), interpreted(false)
+	{
+		pcre2_code *regex;
+
+		for (const std::string &glob : globs) {
+			regex = old_glob_to_regex(glob);
+			if (regex)
+				old.push_back(regex);
+			CHECK((jit.add(glob) == GlobError::NONE) == !!regex, "\"%s\" added differently", glob.c_str());
+			interpreted.add(glob);
+		}
+	}
+
+	~Globs()
+	{
+		for (pcre2_code *regex : old)
+			pcre2_code_free(regex);
+	}
+
+	std::string describe()
+	{
+		std::string ret;
+
+		for (const std::string &glob : globs)
+			ret += " \"" + glob + "\"";
+		return ret;
+	}
+
+	// Checks both matchers against the old code, returning what they
+	// matched:
+	bool check(const std::string &filename)
+	{
+		bool expected = old_matches_globbing_vector(filename, old);
+		bool j = jit.match(filename.c_str(), filename.size());
+		bool i = interpreted.match(filename.c_str(), filename.size());
+
+		CHECK(j == expected && i == expected, "\"%s\" against%s: JIT %i, interpreted %i, old %i",
+				filename.c_str(), describe().c_str(), j, i, expected);
+		return expected;
+	}
+};
+
+static void test_examples()
+{
+	Globs txt({"*.txt"});
+	Globs one({"?.ini"});
+	Globs disabled({"DISABLED*"});
+	Globs classes({"[ab]*[!x].ini"});
+	Globs stars({"**x*?"});
+	Globs several({"*.bak", "old?", "*backup*"});
+	// Converts to \A[^/]*?x(*COMMIT)[^/]*?[^/]\z, which fails for "x"
+	// after committing, and the next glob still has to be tried:
+	Globs commit({"*x*?", "x"});
+	Globs none({});
+
+	CHECK(txt.check("readme.txt") && txt.check("README.TXT") && txt.check(".txt"), "*.txt");
+	CHECK(!txt.check("readme.txt.bak") && !txt.check("readme_txt") && !txt.check(""), "*.txt");
+	CHECK(one.check("a.ini") && one.check("Z.INI") && one.check("..ini"), "?.ini");
+	CHECK(!one.check(".ini") && !one.check("ab.ini"), "?.ini");
+	CHECK(disabled.check("DISABLED") && disabled.check("disabled old mod") && disabled.check("Disabled_x.ini"), "DISABLED*");
+	CHECK(!disabled.check("mod DISABLED") && !disabled.check("DISABLE"), "DISABLED*");
+	CHECK(classes.check("Bcd.ini") && !classes.check("c.ini") && !classes.check("bx.ini"), "[ab]*[!x].ini");
+	CHECK(stars.check("xy") && stars.check("axbc") && !stars.check("x") && !stars.check("abc"), "**x*?");
+	CHECK(several.check("mod.BAK") && several.check("OLD1") && several.check("my backup copy"), "several");
+	CHECK(!several.check("old") && !several.check("mod.bak.ini"), "several");
+	CHECK(commit.check("x") && commit.check("xx") && !commit.check("y"), "*x*? then x");
+	CHECK(!none.check("anything") && none.jit.empty(), "no globs");
+
+	// Non-ASCII UTF-8 is matched byte by byte with PCRE2_CASELESS but no
+	// PCRE2_UTF, whatever that makes of it:
+	Globs utf8({"caf\xc3\xa9*", "*\xc3\x89T\xc3\x89"});
+	utf8.check("caf\xc3\xa9.ini");
+	utf8.check("CAF\xc3\xa9.ini");
+	utf8.check("CAF\xc3\x89.ini");
+	utf8.check("\xc3\xa9t\xc3\xa9");
+}
+
+// Some globs don't convert at all, and the rest of the globs still have to
+// work:
+static void test_bad_globs()
+{
+	Globs bad({"[", "*.bak", "[z-a]", "x[", "*.txt"});
+
+	CHECK(bad.check("a.txt") && bad.check("a.bak") && !bad.check("["), "%s", bad.describe().c_str());
+}
+
+static std::string random_glob(std::mt19937 &rng)
+{
+	static const char *pieces[] = {
+		"*", "*", "*", "?", "?", "a", "A", "b", "B", ".", ".ini", "x", "[ab]", "[!a]", "[A-C]",
+		"\xc3\xa9", "\xc3\x89", "\\*", "**", "[", "]", "-",
+	};
+	std::string glob;
+	int i, n = 1 + rng() % 6;
+
+	for (i = 0; i < n; i++)
+		glob += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+	return glob;
+}
+
+static std::string random_filename(std::mt19937 &rng)
+{
+	static const char *pieces[] = {
+		"a", "A", "b", "B", "c", "x", "X", ".", ".ini", ".INI", "*", "?", "[", "]", " ",
+		"\xc3\xa9", "\xc3\x89", "-",
+	};
+	std::string filename;
+	int i, n = rng() % 8;
+
+	for (i = 0; i < n; i++)
+		filename += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+	return filename;
+}
+
+static void test_random()
+{
+	std::mt19937 rng(45);
+	std::vector<std::string> globs;
+	int trial, i, n, pairs = 0, matched = 0;
+
+	for (trial = 0; trial < 5000 && failures < 10; trial++) {
+		globs.clear();
+		n = 1 + rng() % 4;
+		for (i = 0; i < n; i++)
+			globs.push_back(random_glob(rng));
+
+		Globs matcher(globs);
+		for (i = 0; i < 30; i++) {
+			matched += matcher.check(random_filename(rng));
+			pairs++;
+		}
+	}
+
+	printf("%i of %i random filenames matched\n", matched, pairs);
+	CHECK(matched > pairs / 20 && matched < pairs - pairs / 20, "too few or too many matched to be useful");
+}
+
+int main()
+{
+	uint32_t jit = 0;
+
+	pcre2_config(PCRE2_CONFIG_JIT, &jit);
+	printf("PCRE2 JIT %s\n", jit ? "available" : "not available, so both use the interpreter");
+
+	test_examples();
+	test_bad_globs();
+	test_random();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
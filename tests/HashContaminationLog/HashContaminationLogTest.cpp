@@ -0,0 +1,249 @@
+// Hammers HashContaminationLog from several writer threads while two drainer
+// threads take turns emptying it, as MergeResourceHashContamination does
+// from the present thread and whichever thread next reads the records, and
+// checks that the events that come out are exactly the serial log:
+//
+//   - every event comes out once, with nothing made up or corrupted
+//   - all the batches put together are in sequence order with no gaps, so a
+//     drain never returns an event while missing one numbered before it
+//   - each writer's events come out in the order it added them
+//
+// The serial log is built from what each writer saw - its events along with
+// the sequence numbers add() gave them - merged by sequence number.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "HashContaminationLog.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static const int WRITERS = 8;
+static const int EVENTS_PER_WRITER = 50000;
+// Each round starts from an empty log. A drain that misses an event tends to
+// need a thread to be preempted at just the wrong point, so try a few times:
+static const int ROUNDS = 5;
+
+static uint32_t mix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+// Deterministic events for each writer. A few hot destinations keep some
+// shards busy with every writer at once, and the rest spread across them all.
+// The writer and index are stashed where a copy would put its coordinates so
+// that any event can be traced back to where it came from:
+static void make_event(int writer, int i, HashContaminationEvent *event)
+{
+	uint32_t r = mix(writer * 1000003u + i);
+
+	memset(event, 0, sizeof(*event));
+	event->sequence = ~0ull;
+	event->type = "UMCS"[r % 4];
+	event->dst_hash = r & 0x100 ? 0x1000 + (r >> 24) % 4 : mix(r) | 1;
+	event->dst_subresource = r % 7;
+	event->dst_x = writer;
+	event->dst_y = i;
+	event->dst_z = r >> 28;
+	event->track_texture_updates_off = !!(r & 0x200);
+	if (event->type == 'C' || event->type == 'S') {
+		event->has_src = true;
+		event->src_hash = mix(r + 1);
+		event->src_subresource = r % 5;
+	}
+	if (event->type == 'S' && (r & 0x400)) {
+		event->has_src_box = true;
+		for (int j = 0; j < 6; j++)
+			event->src_box[j] = mix(r + 2 + j) % 4096;
+	}
+}
+
+static bool same_event(const HashContaminationEvent &x, const HashContaminationEvent &y)
+{
+	return x.sequence == y.sequence
+	    && x.type == y.type
+	    && x.has_src == y.has_src
+	    && x.has_src_box == y.has_src_box
+	    && x.track_texture_updates_off == y.track_texture_updates_off
+	    && x.dst_hash == y.dst_hash
+	    && x.src_hash == y.src_hash
+	    && x.dst_subresource == y.dst_subresource
+	    && x.src_subresource == y.src_subresource
+	    && x.dst_x == y.dst_x && x.dst_y == y.dst_y && x.dst_z == y.dst_z
+	    && !memcmp(x.src_box, y.src_box, sizeof(x.src_box));
+}
+
+static void check_against_serial_log(const std::vector<HashContaminationEvent> &merged,
+		std::vector<std::vector<HashContaminationEvent>> &written)
+{
+	std::vector<HashContaminationEvent> serial;
+	std::vector<int> next(written.size());
+	size_t i, mismatches = 0;
+
+	for (auto &events : written)
+		serial.insert(serial.end(), events.begin(), events.end());
+	std::sort(serial.begin(), serial.end(),
+		[](const HashContaminationEvent &x, const HashContaminationEvent &y) {
+			return x.sequence < y.sequence;
+		});
+
+	CHECK(merged.size() == serial.size(), "%zu events drained, %zu written", merged.size(), serial.size());
+	for (i = 0; i < serial.size(); i++)
+		CHECK(serial[i].sequence == i, "sequence %llu given out at position %zu",
+				(unsigned long long)serial[i].sequence, i);
+
+	for (i = 0; i < merged.size() && i < serial.size(); i++) {
+		if (!same_event(merged[i], serial[i]) && mismatches++ < 10) {
+			CHECK(false, "event %zu: drained writer %u #%u seq %llu, serial log has writer %u #%u seq %llu", i,
+					merged[i].dst_x, merged[i].dst_y, (unsigned long long)merged[i].sequence,
+					serial[i].dst_x, serial[i].dst_y, (unsigned long long)serial[i].sequence);
+		}
+	}
+	CHECK(mismatches == 0, "%zu events differ from the serial log", mismatches);
+
+	// Implied by the above, but a clearer message if it goes wrong:
+	for (i = 0; i < merged.size(); i++) {
+		unsigned writer = merged[i].dst_x;
+		if (writer >= written.size()) {
+			CHECK(false, "event %zu from unknown writer %u", i, writer);
+			break;
+		}
+		if ((int)merged[i].dst_y != next[writer]) {
+			CHECK(false, "writer %u: event %u drained when %i was next", writer, merged[i].dst_y, next[writer]);
+			break;
+		}
+		next[writer]++;
+	}
+}
+
+static void test_serial()
+{
+	HashContaminationLog log;
+	std::vector<std::vector<HashContaminationEvent>> written(3);
+	std::vector<HashContaminationEvent> merged;
+	HashContaminationEvent event;
+	int i, writer;
+
+	CHECK(log.empty(), "new log not empty");
+	log.drain(&merged);
+	CHECK(merged.empty(), "%zu events drained from a new log", merged.size());
+
+	for (i = 0; i < 1000; i++) {
+		writer = mix(i) % 3;
+		make_event(writer, (int)written[writer].size(), &event);
+		log.add(&event);
+		written[writer].push_back(event);
+		if (i % 97 == 0)
+			log.drain(&merged);
+	}
+	CHECK(!log.empty(), "log empty with events in it");
+	log.drain(&merged);
+	CHECK(log.empty(), "log not empty after draining");
+
+	check_against_serial_log(merged, written);
+}
+
+static void test_concurrent()
+{
+	HashContaminationLog log;
+	std::vector<std::vector<HashContaminationEvent>> written(WRITERS);
+	std::vector<HashContaminationEvent> merged;
+	std::vector<std::thread> threads;
+	std::atomic<int> writers_running(WRITERS);
+	std::atomic<int> start(0);
+	std::mutex drain_lock;
+	uint64_t batches[2] = {}, last_sequence = ~0ull;
+	bool out_of_order = false;
+	int i;
+
+	for (i = 0; i < WRITERS; i++) {
+		written[i].reserve(EVENTS_PER_WRITER);
+		threads.emplace_back([&, i]() {
+			HashContaminationEvent event;
+
+			while (!start)
+				std::this_thread::yield();
+			for (int j = 0; j < EVENTS_PER_WRITER; j++) {
+				make_event(i, j, &event);
+				log.add(&event);
+				written[i].push_back(event);
+				// Give the drainers a look in:
+				if (j % 64 == 63)
+					std::this_thread::yield();
+			}
+			writers_running--;
+		});
+	}
+
+	// Two drainers that serialise with each other the way the critical
+	// section does in MergeResourceHashContamination, including the
+	// unlocked empty() check:
+	for (i = 0; i < 2; i++) {
+		threads.emplace_back([&, i]() {
+			std::vector<HashContaminationEvent> batch;
+
+			while (!start)
+				std::this_thread::yield();
+			while (writers_running) {
+				if (log.empty()) {
+					std::this_thread::yield();
+					continue;
+				}
+				std::lock_guard<std::mutex> guard(drain_lock);
+				batch.clear();
+				log.drain(&batch);
+				for (HashContaminationEvent &event : batch) {
+					if (event.sequence != last_sequence + 1)
+						out_of_order = true;
+					last_sequence = event.sequence;
+				}
+				merged.insert(merged.end(), batch.begin(), batch.end());
+				batches[i]++;
+			}
+		});
+	}
+
+	start = 1;
+	for (std::thread &thread : threads)
+		thread.join();
+	log.drain(&merged);
+	CHECK(log.empty(), "log not empty after the final drain");
+
+	CHECK(!out_of_order, "a drain skipped ahead of an event that had not been drained yet");
+	printf("%d writers x %d events drained in %llu + %llu batches\n", WRITERS, EVENTS_PER_WRITER,
+			(unsigned long long)batches[0], (unsigned long long)batches[1]);
+
+	check_against_serial_log(merged, written);
+}
+
+int main()
+{
+	test_serial();
+	for (int round = 0; round < ROUNDS && !failures; round++)
+		test_concurrent();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,428 @@
+// Drives IncludeCache with an in-memory filesystem and checks:
+//
+//   - a file is read once and shared until its size or last write time
+//     changes, and stat()ed at most once per pass however many times it is
+//     opened or checked
+//   - files that are missing, appear, disappear or can't be read are
+//     handled, and a file changed while a compile is using it stays intact
+//     for that compile
+//   - for a random library of headers including each other, whether each
+//     shader needs recompiling is exactly whether any file it includes,
+//     directly or through other headers, was modified, created or deleted
+//     since it was last compiled
+//   - many threads compiling at once get the right contents
+//
+// Compiling is simulated by following the #include lines through the cache,
+// as MigotoIncludeHandler does, and recording every file opened.
+//
+// Best also run with -fsanitize=thread.
+
+#include <stdio.h>
+#include <map>
+#include <random>
+#include <set>
+#include <thread>
+
+#include "IncludeCache.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+class FakeFileSystem : public IncludeFileSystem
+{
+	struct File
+	{
+		std::string data;
+		uint64_t last_write_time;
+		bool unreadable;
+	};
+
+	std::mutex lock;
+	std::map<std::wstring, File> files;
+	uint64_t clock;
+
+public:
+	std::map<std::wstring, int> stats, reads;
+
+	FakeFileSystem() : clock(1) {}
+
+	void write(const std::wstring &path, const std::string &data)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		files[path] = File{data, clock++, false};
+	}
+
+	// Like some editors, changes the file without changing its size and
+	// with the same last write time:
+	void write_sneakily(const std::wstring &path, const std::string &data)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		files[path].data = data;
+	}
+
+	void make_unreadable(const std::wstring &path, bool unreadable)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		files[path].unreadable = unreadable;
+	}
+
+	void remove(const std::wstring &path)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		files.erase(path);
+	}
+
+	bool exists(const std::wstring &path)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		return files.count(path) != 0;
+	}
+
+	std::string contents(const std::wstring &path)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		return files.count(path) ? files[path].data : std::string();
+	}
+
+	void reset_counts()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		stats.clear();
+		reads.clear();
+	}
+
+	int stat_count(const std::wstring &path)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		return stats.count(path) ? stats[path] : 0;
+	}
+
+	int read_count(const std::wstring &path)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		return reads.count(path) ? reads[path] : 0;
+	}
+
+	bool stat(const std::wstring &path, IncludeFileStat *stat) override
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		stats[path]++;
+		auto i = files.find(path);
+		if (i == files.end())
+			return false;
+		stat->last_write_time = i->second.last_write_time;
+		stat->size = i->second.data.size();
+		return true;
+	}
+
+	bool read(const std::wstring &path, std::vector<char> *data, IncludeFileStat *stat) override
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		reads[path]++;
+		auto i = files.find(path);
+		if (i == files.end() || i->second.unreadable)
+			return false;
+		data->assign(i->second.data.begin(), i->second.data.end());
+		stat->last_write_time = i->second.last_write_time;
+		stat->size = i->second.data.size();
+		return true;
+	}
+};
+
+static std::string contents(const IncludeFilePtr &file)
+{
+	return file ? std::string(file->data.begin(), file->data.end()) : "(null)";
+}
+
+static std::wstring widen(const std::string &str)
+{
+	return std::wstring(str.begin(), str.end());
+}
+
+// Follows the #include "..." lines of a file through the cache, adding every
+// file it tried to open to *opened. Like MigotoIncludeHandler, a file that
+// can't be opened is still a dependency, since creating it changes the
+// result:
+static void compile_includes(IncludeCache *cache, const std::string &source,
+		std::vector<std::wstring> *opened, int depth = 0)
+{
+	size_t pos = 0, end;
+	std::wstring path;
+	IncludeFilePtr file;
+
+	while ((pos = source.find("#include \"", pos)) != std::string::npos) {
+		pos += 10;
+		end = source.find('"', pos);
+		path = widen(source.substr(pos, end - pos));
+		opened->push_back(path);
+
+		file = cache->open(path);
+		if (file && depth < 16)
+			compile_includes(cache, contents(file), opened, depth + 1);
+	}
+}
+
+static void compile(IncludeCache *cache, FakeFileSystem *fs, const std::wstring &shader)
+{
+	std::vector<std::wstring> opened;
+
+	compile_includes(cache, fs->contents(shader), &opened);
+	cache->record_dependencies(shader, opened);
+}
+
+static void test_cache()
+{
+	FakeFileSystem fs;
+	IncludeCache cache(&fs);
+	IncludeFilePtr held;
+	int i;
+
+	fs.write(L"common.hlsl", "float4 common;");
+
+	// Once per pass, however many compiles use it:
+	for (i = 0; i < 10; i++)
+		CHECK(contents(cache.open(L"common.hlsl")) == "float4 common;", "wrong contents");
+	CHECK(fs.stat_count(L"common.hlsl") == 1 && fs.read_count(L"common.hlsl") == 1,
+			"%i stats, %i reads", fs.stat_count(L"common.hlsl"), fs.read_count(L"common.hlsl"));
+
+	// Checked again in the next pass, but not re-read:
+	cache.begin_pass();
+	held = cache.open(L"common.hlsl");
+	cache.open(L"common.hlsl");
+	CHECK(fs.stat_count(L"common.hlsl") == 2 && fs.read_count(L"common.hlsl") == 1,
+			"%i stats, %i reads", fs.stat_count(L"common.hlsl"), fs.read_count(L"common.hlsl"));
+
+	// Not noticed until the next pass:
+	fs.write(L"common.hlsl", "float4 changed;");
+	CHECK(contents(cache.open(L"common.hlsl")) == "float4 common;", "changed mid pass");
+	cache.begin_pass();
+	CHECK(contents(cache.open(L"common.hlsl")) == "float4 changed;", "change not noticed");
+	CHECK(contents(held) == "float4 common;", "contents changed under a compile using them");
+	CHECK(fs.read_count(L"common.hlsl") == 2, "%i reads", fs.read_count(L"common.hlsl"));
+
+	// A change of size alone is noticed too:
+	fs.write_sneakily(L"common.hlsl", "float4 changed; ");
+	cache.begin_pass();
+	CHECK(contents(cache.open(L"common.hlsl")) == "float4 changed; ", "size change not noticed");
+
+	// Missing, then created, then deleted:
+	CHECK(!cache.open(L"new.hlsl"), "opened a missing file");
+	fs.write(L"new.hlsl", "new");
+	CHECK(!cache.open(L"new.hlsl"), "new file noticed mid pass");
+	cache.begin_pass();
+	CHECK(contents(cache.open(L"new.hlsl")) == "new", "new file not noticed");
+	fs.remove(L"new.hlsl");
+	cache.begin_pass();
+	CHECK(!cache.open(L"new.hlsl"), "deleted file still opened");
+
+	// Exists but can't be read, e.g. locked by an editor. Tried again on
+	// the next open:
+	fs.write(L"locked.hlsl", "locked");
+	fs.make_unreadable(L"locked.hlsl", true);
+	CHECK(!cache.open(L"locked.hlsl"), "opened an unreadable file");
+	fs.make_unreadable(L"locked.hlsl", false);
+	CHECK(contents(cache.open(L"locked.hlsl")) == "locked", "not retried");
+
+	CHECK(cache.num_files() == 3, "%zu files", cache.num_files());
+	cache.clear();
+	CHECK(cache.num_files() == 0, "%zu files after clear()", cache.num_files());
+}
+
+static void test_dependencies()
+{
+	FakeFileSystem fs;
+	IncludeCache cache(&fs);
+	std::wstring changed;
+	int i;
+
+	fs.write(L"a.hlsl", "#include \"b.hlsl\"\n#include \"common.hlsl\"");
+	fs.write(L"b.hlsl", "#include \"common.hlsl\"\n#include \"optional.hlsl\"");
+	fs.write(L"common.hlsl", "float4 common;");
+	for (i = 0; i < 100; i++)
+		fs.write(L"shader" + std::to_wstring(i), "#include \"a.hlsl\"");
+
+	for (i = 0; i < 100; i++)
+		compile(&cache, &fs, L"shader" + std::to_wstring(i));
+	CHECK(fs.read_count(L"common.hlsl") == 1, "%i reads", fs.read_count(L"common.hlsl"));
+
+	// Checking every shader stats each include once:
+	cache.begin_pass();
+	fs.reset_counts();
+	for (i = 0; i < 100; i++)
+		CHECK(!cache.dependencies_changed(L"shader" + std::to_wstring(i), &changed), "%ls changed", changed.c_str());
+	CHECK(fs.stat_count(L"common.hlsl") == 1 && fs.stat_count(L"optional.hlsl") == 1,
+			"%i and %i stats", fs.stat_count(L"common.hlsl"), fs.stat_count(L"optional.hlsl"));
+
+	// Through two levels of includes:
+	fs.write(L"common.hlsl", "float4 common2;");
+	cache.begin_pass();
+	CHECK(cache.dependencies_changed(L"shader5", &changed) && changed == L"common.hlsl", "change not noticed");
+	compile(&cache, &fs, L"shader5");
+	CHECK(!cache.dependencies_changed(L"shader5", NULL), "still changed after recompiling");
+	CHECK(cache.dependencies_changed(L"shader6", NULL), "others not changed");
+
+	// A file that didn't exist when it was included is created:
+	fs.write(L"optional.hlsl", "");
+	cache.begin_pass();
+	CHECK(cache.dependencies_changed(L"shader5", &changed) && changed == L"optional.hlsl", "creation not noticed");
+	compile(&cache, &fs, L"shader5");
+
+	// And deleted again:
+	fs.remove(L"optional.hlsl");
+	cache.begin_pass();
+	CHECK(cache.dependencies_changed(L"shader5", &changed) && changed == L"optional.hlsl", "deletion not noticed");
+
+	// Nothing recorded, or forgotten:
+	CHECK(!cache.dependencies_changed(L"unknown", NULL), "unknown shader changed");
+	cache.forget_dependencies(L"shader6");
+	CHECK(!cache.dependencies_changed(L"shader6", NULL), "forgotten shader changed");
+	CHECK(cache.dependencies_changed(L"shader7", NULL), "shader7 not changed");
+	cache.clear();
+	CHECK(!cache.dependencies_changed(L"shader7", NULL), "dependencies not cleared");
+}
+
+// A random library of headers, most of which include others, and shaders
+// including a few of them. Random files are edited, created and deleted, and
+// after each round every shader that needs it is recompiled:
+static void test_random()
+{
+	std::mt19937 rng(32);
+	static const int HEADERS = 30, SHADERS = 60;
+	std::map<std::wstring, std::set<std::wstring>> compiled_with;
+	std::map<std::wstring, std::string> compiled_state;
+	std::vector<std::wstring> opened;
+	std::wstring shader, changed;
+	std::string source;
+	bool expected, got;
+	int round, i, j, n, recompiled = 0;
+
+	for (round = 0; round < 200 && failures < 10; round++) {
+		FakeFileSystem fs;
+		IncludeCache cache(&fs);
+
+		auto random_source = [&](int max) {
+			std::string src = "// " + std::to_string(rng()) + "\n";
+			int k, includes = rng() % 4;
+
+			for (k = 0; k < includes && max > 0; k++)
+				src += "#include \"h" + std::to_string(rng() % max) + ".hlsl\"\n";
+			return src;
+		};
+
+		// Headers only include lower numbered ones (and a few that don't
+		// exist yet):
+		for (i = 0; i < HEADERS; i++) {
+			if (rng() % 8)
+				fs.write(L"h" + std::to_wstring(i) + L".hlsl", random_source(i));
+		}
+		for (i = 0; i < SHADERS; i++)
+			fs.write(L"s" + std::to_wstring(i), random_source(HEADERS));
+
+		// What each shader saw when it was compiled, to compare
+		// against later:
+		auto compile_and_remember = [&](const std::wstring &s) {
+			opened.clear();
+			compile_includes(&cache, fs.contents(s), &opened);
+			cache.record_dependencies(s, opened);
+			compiled_with[s] = std::set<std::wstring>(opened.begin(), opened.end());
+			compiled_state[s].clear();
+			for (const std::wstring &path : compiled_with[s])
+				compiled_state[s] += (fs.exists(path) ? fs.contents(path) : "(missing)") + "\x01";
+		};
+
+		for (i = 0; i < SHADERS; i++)
+			compile_and_remember(L"s" + std::to_wstring(i));
+
+		for (j = 0; j < 5; j++) {
+			n = rng() % 4;
+			for (i = 0; i < n; i++) {
+				std::wstring path = L"h" + std::to_wstring(rng() % HEADERS) + L".hlsl";
+				if (fs.exists(path) && rng() % 4 == 0)
+					fs.remove(path);
+				else
+					fs.write(path, random_source(std::stoi(std::string(path.begin() + 1, path.end()))));
+			}
+			cache.begin_pass();
+
+			for (i = 0; i < SHADERS; i++) {
+				shader = L"s" + std::to_wstring(i);
+				source.clear();
+				for (const std::wstring &path : compiled_with[shader])
+					source += (fs.exists(path) ? fs.contents(path) : "(missing)") + "\x01";
+				expected = source != compiled_state[shader];
+				got = cache.dependencies_changed(shader, &changed);
+				CHECK(got == expected, "round %i.%i: %ls %s changed", round, j, shader.c_str(),
+						expected ? "should have" : "shouldn't have");
+				if (got) {
+					compile_and_remember(shader);
+					recompiled++;
+				}
+			}
+		}
+	}
+
+	printf("%i recompiles in random rounds\n", recompiled);
+	CHECK(recompiled > 1000, "too few recompiles to be useful");
+}
+
+static void test_threads()
+{
+	FakeFileSystem fs;
+	IncludeCache cache(&fs);
+	std::vector<std::thread> threads;
+	int i, t;
+
+	for (i = 0; i < 20; i++)
+		fs.write(L"h" + std::to_wstring(i), "header " + std::to_string(i));
+
+	for (t = 0; t < 8; t++) {
+		threads.emplace_back([&cache, t]() {
+			int k, h;
+
+			for (k = 0; k < 2000; k++) {
+				h = (k * 7 + t) % 20;
+				if (contents(cache.open(L"h" + std::to_wstring(h))) != "header " + std::to_string(h)) {
+					CHECK(false, "thread %i: h%i wrong", t, h);
+					return;
+				}
+				if (k % 100 == t)
+					cache.begin_pass();
+			}
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+}
+
+int main()
+{
+	test_cache();
+	test_dependencies();
+	test_random();
+	test_threads();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,381 @@
+#pragma once
+
+// Stand-ins for everything the reload code pulled out of IniHandler.cpp
+// (IniHandler.inc, generated by CMakeLists.txt) uses. The "ini files" are
+// the FakeIniSections in fake_ini_files. The ShaderOverride and
+// TextureOverride section parsers are cut down to the parts that matter to
+// a reload: which entry a section goes into, how duplicates are merged and
+// which command lists get registered. The command lists keep their lines as
+// text, and the optimiser only removes checktextureoverride lines when no
+// TextureOverride has a command list, which is the one optimisation an
+// incremental reload has to watch out for.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "IniDiff.h"
+
+using std::wstring;
+using std::vector;
+
+typedef unsigned UINT;
+typedef unsigned long long UINT64;
+typedef unsigned long DWORD;
+
+#define MAX_PATH 260
+#define INI_FILENAME L"d3dx.ini"
+#define _wcsicmp wcscasecmp
+#define _wcsnicmp wcsncasecmp
+#define sscanf_s sscanf
+#define LogInfo(...) do {} while (0)
+#define EnterCriticalSectionPretty(lock) do {} while (0)
+#define LeaveCriticalSection(lock) do {} while (0)
+
+class HackerDevice;
+static void *migoto_handle;
+
+static DWORD GetModuleFileName(void*, wchar_t *filename, DWORD size)
+{
+	wcsncpy(filename, L"C:\\Game\\d3d11.dll", size);
+	return (DWORD)wcslen(filename);
+}
+
+// Bitwise CRC-32C, the same function as the SSE 4.2 one:
+static uint32_t crc32c_hw(uint32_t seed, const void *data, size_t length)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	uint32_t crc = ~seed;
+	int k;
+
+	while (length--) {
+		crc ^= *p++;
+		for (k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+	}
+	return ~crc;
+}
+
+struct IniLine {
+	wstring first;
+	wstring second;
+	wstring raw_line;
+	wstring ini_namespace;
+
+	IniLine(const wstring &key, const wstring &val, const wstring &line, const wstring &ini_namespace) :
+		first(key),
+		second(val),
+		raw_line(line),
+		ini_namespace(ini_namespace)
+	{}
+};
+typedef std::vector<IniLine> IniSectionVector;
+
+struct CommandList {
+	vector<wstring> commands;
+	bool post;
+
+	CommandList() : post(false) {}
+};
+
+struct ShaderOverride {
+	wstring first_ini_section;
+	CommandList command_list;
+	CommandList post_command_list;
+
+	ShaderOverride() { post_command_list.post = true; }
+};
+
+struct TextureOverride {
+	wstring ini_section;
+	bool has_match_priority;
+	int priority;
+	CommandList command_list;
+	CommandList post_command_list;
+
+	TextureOverride() : has_match_priority(false), priority(0) { post_command_list.post = true; }
+};
+
+static bool TextureOverrideLess(const TextureOverride &lhs, const TextureOverride &rhs)
+{
+	if (lhs.priority != rhs.priority)
+		return lhs.priority < rhs.priority;
+	return lhs.ini_section < rhs.ini_section;
+}
+
+// FlatHashMap also keeps its values in nodes that don't move:
+template <class Key, class T>
+class FakeFlatHashMap : public std::unordered_map<Key, T>
+{
+public:
+	void compact(size_t) {}
+};
+
+typedef FakeFlatHashMap<UINT64, ShaderOverride> ShaderOverrideMap;
+typedef std::vector<TextureOverride> TextureOverrideList;
+typedef FakeFlatHashMap<uint32_t, TextureOverrideList> TextureOverrideMap;
+
+struct Globals {
+	ShaderOverrideMap mShaderOverrideMap;
+	TextureOverrideMap mTextureOverrideMap;
+	vector<std::shared_ptr<TextureOverride>> mFuzzyTextureOverrides;
+	unsigned shader_override_generation;
+	int recursive_include;
+	int mCriticalSection;
+
+	Globals() : shader_override_generation(0), recursive_include(0), mCriticalSection(0) {}
+};
+static Globals globals;
+static Globals *G = &globals;
+
+static std::map<int, int> shader_regex_groups;
+static vector<CommandList*> registered_command_lists;
+static bool cto_pre_optimised_out;
+static bool cto_post_optimised_out;
+
+struct FakeIncludeCache {
+	bool changed;
+
+	FakeIncludeCache() : changed(false) {}
+	void begin_pass() {}
+	bool dependencies_changed(const wstring&, wstring *file)
+	{
+		if (changed)
+			*file = L"ShaderFixes\\custom.hlsl";
+		return changed;
+	}
+};
+static FakeIncludeCache include_cache;
+
+class DeferredLog
+{
+public:
+	void flush() {}
+};
+static DeferredLog *ini_deferred_log;
+static void emit_ini_warning_tone() {}
+
+// The ini files as they are on disk. Sections with no namespace are in
+// d3dx.ini, the rest in included files:
+struct FakeIniSection {
+	wstring name;
+	wstring ini_namespace;
+	vector<std::pair<wstring, wstring>> lines;
+};
+static vector<FakeIniSection> fake_ini_files;
+
+// Filled in by optimise_command_lists() with everything it was given:
+static vector<CommandList*> optimised_command_lists;
+
+// Defined after IniHandler.inc, which they need:
+static void GetIniSection(IniSectionVector **key_vals, const wchar_t *section);
+static bool GetIniString(const wchar_t *section, const wchar_t *key, const wchar_t *def, std::string *ret);
+static void ParseIniFile(const wchar_t *ini);
+static void InsertBuiltInIniSections() {}
+static void ParseIncludedIniFiles();
+static void ParseShaderOverrideSection(const wchar_t *id);
+static void ParseTextureOverrideSection(const wchar_t *id);
+static void optimise_command_lists(HackerDevice *device);
+
+#include "IniHandler.inc"
+
+static void add_fake_sections(bool included)
+{
+	for (FakeIniSection &fake : fake_ini_files) {
+		if (fake.ini_namespace.empty() == included)
+			continue;
+
+		IniSection &section = ini_sections[fake.name];
+		section.ini_namespace = fake.ini_namespace;
+		for (auto &line : fake.lines) {
+			section.kv_vec.emplace_back(line.first, line.second, line.first + L" = " + line.second, fake.ini_namespace);
+			section.kv_map.emplace(line.first, line.second);
+		}
+	}
+}
+
+static void ParseIniFile(const wchar_t*)
+{
+	ini_sections.clear();
+	add_fake_sections(false);
+}
+
+static void ParseIncludedIniFiles()
+{
+	add_fake_sections(true);
+}
+
+static void GetIniSection(IniSectionVector **key_vals, const wchar_t *section)
+{
+	*key_vals = &ini_sections[section].kv_vec;
+}
+
+static bool GetIniString(const wchar_t *section, const wchar_t *key, const wchar_t *def, std::string *ret)
+{
+	IniSections::iterator i = ini_sections.find(section);
+	wstring val = def ? def : L"";
+	bool found = false;
+
+	if (i != ini_sections.end()) {
+		IniSectionMap::iterator kv = i->second.kv_map.find(key);
+		if (kv != i->second.kv_map.end()) {
+			val = kv->second;
+			found = true;
+		}
+	}
+
+	*ret = std::string(val.begin(), val.end());
+	return found;
+}
+
+static UINT64 GetIniHash(const wchar_t *section, const wchar_t *key, UINT64 def, bool *found)
+{
+	std::string val;
+	UINT64 ret = def;
+	int len;
+
+	*found = false;
+	if (GetIniString(section, key, NULL, &val)) {
+		if (sscanf(val.c_str(), "%16llx%n", &ret, &len) != 1 || len != val.length())
+			ret = def;
+		else
+			*found = true;
+	}
+	return ret;
+}
+
+static bool is_match_key(const wstring &key)
+{
+	return !_wcsnicmp(key.c_str(), L"match_", 6);
+}
+
+// Everything but hash= and the match options is a command. "post" commands
+// go in the post command list:
+static void ParseCommandList(const wchar_t *id, CommandList *pre, CommandList *post, bool register_lists)
+{
+	IniSectionVector *section;
+
+	GetIniSection(&section, id);
+	for (IniLine &line : *section) {
+		if (!_wcsicmp(line.first.c_str(), L"hash") || is_match_key(line.first))
+			continue;
+		if (!_wcsnicmp(line.first.c_str(), L"post ", 5))
+			post->commands.push_back(wstring(id) + L": " + line.raw_line);
+		else
+			pre->commands.push_back(wstring(id) + L": " + line.raw_line);
+	}
+
+	if (register_lists) {
+		registered_command_lists.push_back(pre);
+		registered_command_lists.push_back(post);
+	}
+}
+
+static void ParseShaderOverrideSection(const wchar_t *id)
+{
+	ShaderOverride *override;
+	UINT64 hash;
+	bool duplicate, found;
+
+	hash = GetIniHash(id, L"Hash", 0, &found);
+	if (!found)
+		return;
+	shader_override_section_hashes[id] = hash;
+
+	duplicate = !!G->mShaderOverrideMap.count(hash);
+	override = &G->mShaderOverrideMap[hash];
+	if (!duplicate)
+		override->first_ini_section = id;
+
+	ParseCommandList(id, &override->command_list, &override->post_command_list, true);
+}
+
+static void parse_texture_override_common(const wchar_t *id, TextureOverride *override, bool register_lists)
+{
+	std::string val;
+
+	override->has_match_priority = GetIniString(id, L"match_priority", NULL, &val);
+	if (override->has_match_priority)
+		override->priority = atoi(val.c_str());
+
+	ParseCommandList(id, &override->command_list, &override->post_command_list, register_lists);
+}
+
+static void ParseTextureOverrideSection(const wchar_t *id)
+{
+	TextureOverride *override;
+	IniSectionVector *section;
+	uint32_t hash;
+	bool found;
+
+	hash = (uint32_t)GetIniHash(id, L"Hash", 0, &found);
+	if (!found) {
+		GetIniSection(&section, id);
+		for (IniLine &line : *section) {
+			if (is_match_key(line.first) && _wcsicmp(line.first.c_str(), L"match_priority")) {
+				G->mFuzzyTextureOverrides.push_back(std::make_shared<TextureOverride>());
+				override = G->mFuzzyTextureOverrides.back().get();
+				override->ini_section = id;
+				parse_texture_override_common(id, override, true);
+				return;
+			}
+		}
+		return;
+	}
+	texture_override_section_hashes[id] = hash;
+
+	G->mTextureOverrideMap[hash].emplace_back();
+	override = &G->mTextureOverrideMap[hash].back();
+	override->ini_section = id;
+
+	// Registered by FinaliseTextureOverrideList():
+	parse_texture_override_common(id, override, false);
+}
+
+static bool noop(const wstring &command, bool post, bool ignore_cto_pre, bool ignore_cto_post)
+{
+	if (command.find(L"checktextureoverride") == wstring::npos)
+		return false;
+	return post ? ignore_cto_post : ignore_cto_pre;
+}
+
+static void optimise_command_lists(HackerDevice*)
+{
+	bool ignore_cto_pre = true, ignore_cto_post = true;
+	vector<wstring>::iterator new_end;
+
+	for (auto &tolkv : G->mTextureOverrideMap) {
+		for (TextureOverride &to : tolkv.second) {
+			ignore_cto_pre = ignore_cto_pre && to.command_list.commands.empty();
+			ignore_cto_post = ignore_cto_post && to.post_command_list.commands.empty();
+		}
+	}
+	for (auto &tof : G->mFuzzyTextureOverrides) {
+		ignore_cto_pre = ignore_cto_pre && tof->command_list.commands.empty();
+		ignore_cto_post = ignore_cto_post && tof->post_command_list.commands.empty();
+	}
+
+	for (CommandList *command_list : registered_command_lists) {
+		new_end = std::remove_if(command_list->commands.begin(), command_list->commands.end(),
+			[&](const wstring &command) {
+				return noop(command, command_list->post, ignore_cto_pre, ignore_cto_post);
+			});
+		command_list->commands.erase(new_end, command_list->commands.end());
+	}
+
+	cto_pre_optimised_out = ignore_cto_pre;
+	cto_post_optimised_out = ignore_cto_post;
+
+	optimised_command_lists = registered_command_lists;
+	registered_command_lists.clear();
+}
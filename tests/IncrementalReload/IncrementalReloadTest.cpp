@@ -0,0 +1,541 @@
+// Loads a config in full, changes the ini files, and reloads them with the
+// incremental reload from IniHandler.cpp (ReloadChangedIniSections). When it
+// reloads incrementally, checks that it ends up exactly where a full reload
+// of the new files would:
+//
+//   - the same ShaderOverride entries, each with the same first section and
+//     the same commands from its sections merged in the same order
+//   - the same TextureOverride lists, in the same order, with the same
+//     priorities and commands, and the same fuzzy TextureOverrides
+//   - the same Hash= recorded for each section, and the same section hashes
+//     to compare against on the next reload
+//   - the same checktextureoverride commands optimised out
+//
+// and that the command lists it gave the optimiser are all still alive and
+// include every entry it rebuilt. It also checks that it falls back to a
+// full reload exactly when it has to: anything other than ShaderOverride and
+// hash based TextureOverride sections changed, the checktextureoverride
+// commands the optimiser can remove changed, nothing in the ini files
+// changed, a file outside them changed or ShaderRegex is in use.
+//
+// Most of the configs are random, with a small pool of hashes so that many
+// sections share an entry.
+
+#include <random>
+
+#include "IncrementalReloadHarness.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+struct ConfigState {
+	std::map<UINT64, wstring> shader_overrides;
+	std::map<uint32_t, wstring> texture_overrides;
+	vector<wstring> fuzzy_texture_overrides;
+	std::map<wstring, UINT64> shader_override_sections;
+	std::map<wstring, UINT64> texture_override_sections;
+	IniSectionHashes section_hashes;
+	bool cto_pre, cto_post;
+};
+
+static wstring describe(const CommandList &command_list)
+{
+	wstring ret;
+
+	for (const wstring &command : command_list.commands)
+		ret += L"  " + command + L"\n";
+	return ret;
+}
+
+static wstring describe(const TextureOverride &to)
+{
+	return L"[" + to.ini_section + L"] priority " + std::to_wstring(to.priority) + L"\n"
+		+ describe(to.command_list) + L" post\n" + describe(to.post_command_list);
+}
+
+static ConfigState snapshot()
+{
+	ConfigState state;
+
+	for (auto &so : G->mShaderOverrideMap) {
+		state.shader_overrides[so.first] = L"[" + so.second.first_ini_section + L"]\n"
+			+ describe(so.second.command_list) + L" post\n" + describe(so.second.post_command_list);
+	}
+	for (auto &tolkv : G->mTextureOverrideMap) {
+		for (TextureOverride &to : tolkv.second)
+			state.texture_overrides[tolkv.first] += describe(to);
+	}
+	for (auto &tof : G->mFuzzyTextureOverrides)
+		state.fuzzy_texture_overrides.push_back(describe(*tof));
+	std::sort(state.fuzzy_texture_overrides.begin(), state.fuzzy_texture_overrides.end());
+
+	state.shader_override_sections.insert(shader_override_section_hashes.begin(), shader_override_section_hashes.end());
+	state.texture_override_sections.insert(texture_override_section_hashes.begin(), texture_override_section_hashes.end());
+	state.section_hashes = ini_section_hashes;
+	state.cto_pre = cto_pre_optimised_out;
+	state.cto_post = cto_post_optimised_out;
+
+	return state;
+}
+
+template <class Map>
+static void compare_maps(const char *what, const Map &incremental, const Map &full, int trial)
+{
+	typename Map::const_iterator i;
+	typename Map::const_iterator j;
+
+	for (i = incremental.begin(); i != incremental.end(); i++) {
+		j = full.find(i->first);
+		if (j == full.end()) {
+			CHECK(false, "trial %i: %s entry only in incremental reload", trial, what);
+			return;
+		}
+		if (i->second != j->second) {
+			CHECK(false, "trial %i: %s entry differs:\n%ls\nvs full reload:\n%ls", trial, what,
+					std::wstring(i->second.begin(), i->second.end()).c_str(),
+					std::wstring(j->second.begin(), j->second.end()).c_str());
+			return;
+		}
+	}
+	CHECK(incremental.size() == full.size(), "trial %i: %zu %s entries, %zu after a full reload",
+			trial, incremental.size(), what, full.size());
+}
+
+static void compare_states(const ConfigState &incremental, const ConfigState &full, int trial)
+{
+	compare_maps("ShaderOverride", incremental.shader_overrides, full.shader_overrides, trial);
+	compare_maps("TextureOverride", incremental.texture_overrides, full.texture_overrides, trial);
+	CHECK(incremental.fuzzy_texture_overrides == full.fuzzy_texture_overrides,
+			"trial %i: fuzzy TextureOverrides differ", trial);
+	CHECK(incremental.shader_override_sections == full.shader_override_sections,
+			"trial %i: ShaderOverride section hashes differ", trial);
+	CHECK(incremental.texture_override_sections == full.texture_override_sections,
+			"trial %i: TextureOverride section hashes differ", trial);
+	CHECK(incremental.section_hashes.diff(full.section_hashes).empty()
+			&& incremental.section_hashes.size() == full.section_hashes.size(),
+			"trial %i: %zu section hashes differ", trial, incremental.section_hashes.diff(full.section_hashes).size());
+	CHECK(incremental.cto_pre == full.cto_pre && incremental.cto_post == full.cto_post,
+			"trial %i: checktextureoverride optimised out %i/%i, %i/%i after a full reload", trial,
+			incremental.cto_pre, incremental.cto_post, full.cto_pre, full.cto_post);
+}
+
+// Every command list given to the optimiser must still be alive, and every
+// entry that changed must have had its command lists optimised:
+static void check_optimised_lists(const ConfigState &before, int trial)
+{
+	std::unordered_set<CommandList*> live, optimised(optimised_command_lists.begin(), optimised_command_lists.end());
+	std::map<UINT64, wstring>::const_iterator so;
+	std::map<uint32_t, wstring>::const_iterator to;
+	CommandList *command_list;
+	size_t dangling = 0;
+
+	for (auto &sokv : G->mShaderOverrideMap) {
+		live.insert(&sokv.second.command_list);
+		live.insert(&sokv.second.post_command_list);
+	}
+	for (auto &tolkv : G->mTextureOverrideMap) {
+		for (TextureOverride &to : tolkv.second) {
+			live.insert(&to.command_list);
+			live.insert(&to.post_command_list);
+		}
+	}
+	for (auto &tof : G->mFuzzyTextureOverrides) {
+		live.insert(&tof->command_list);
+		live.insert(&tof->post_command_list);
+	}
+	for (CommandList *command_list : optimised_command_lists)
+		dangling += !live.count(command_list);
+	CHECK(!dangling, "trial %i: %zu command lists given to the optimiser are gone", trial, dangling);
+
+	for (auto &sokv : G->mShaderOverrideMap) {
+		so = before.shader_overrides.find(sokv.first);
+		if (so != before.shader_overrides.end() && snapshot().shader_overrides[sokv.first] == so->second)
+			continue;
+		command_list = &sokv.second.command_list;
+		CHECK(optimised.count(command_list) && optimised.count(&sokv.second.post_command_list),
+				"trial %i: rebuilt ShaderOverride %016llx not optimised", trial, sokv.first);
+	}
+	for (auto &tolkv : G->mTextureOverrideMap) {
+		to = before.texture_overrides.find(tolkv.first);
+		if (to != before.texture_overrides.end() && snapshot().texture_overrides[tolkv.first] == to->second)
+			continue;
+		for (TextureOverride &to : tolkv.second) {
+			CHECK(optimised.count(&to.command_list) && optimised.count(&to.post_command_list),
+					"trial %i: rebuilt TextureOverride %08x [%ls] not optimised", trial, tolkv.first, to.ini_section.c_str());
+		}
+	}
+}
+
+// Mirrors the full reload in LoadConfigFile() and ReloadConfig():
+static void full_load()
+{
+	ParseIniFile(L"d3dx.ini");
+	InsertBuiltInIniSections();
+	ParseIncludedIniFiles();
+
+	HashIniSections(&ini_section_hashes);
+	incremental_reload_possible = true;
+
+	registered_command_lists.clear();
+	ParseShaderOverrideSections();
+	ParseTextureOverrideSections();
+	optimise_command_lists(NULL);
+}
+
+static const UINT64 shader_hashes[] = {
+	0x0123456789abcdefull, 0x00000000deadbeefull, 0xfedcba9876543210ull,
+	0x1000000000000001ull, 0x8badf00d8badf00dull,
+};
+static const uint32_t texture_hashes[] = {
+	0x12345678, 0x0badf00d, 0xcafebabe, 0x00000001, 0x9e3779b9,
+};
+static const wchar_t *namespaces[] = {
+	L"", L"Mods\\A\\a.ini", L"Mods\\B\\b.ini",
+};
+static const wchar_t *commands[] = {
+	L"x", L"y", L"run", L"ps-t100", L"handling", L"checktextureoverride",
+	L"post x", L"post run", L"post checktextureoverride",
+};
+
+static wstring hex(uint64_t val, int width)
+{
+	wchar_t buf[32];
+
+	swprintf(buf, 32, L"%0*llx", width, (unsigned long long)val);
+	return buf;
+}
+
+class ConfigGenerator
+{
+	std::mt19937 rng;
+	int next_name;
+
+	template <class T, size_t N>
+	const T& pick(const T (&array)[N]) { return array[rng() % N]; }
+
+	void add_commands(FakeIniSection *section, int max)
+	{
+		int i, n = rng() % (max + 1);
+
+		for (i = 0; i < n; i++)
+			section->lines.emplace_back(pick(commands), std::to_wstring(rng() % 4));
+	}
+
+public:
+	ConfigGenerator(unsigned seed) : rng(seed), next_name(0) {}
+
+	FakeIniSection shader_override()
+	{
+		FakeIniSection section;
+
+		// Mixed case, since the section name prefixes are matched
+		// case insensitively:
+		section.name = (rng() % 5 ? L"ShaderOverride" : L"shaderoverride") + std::to_wstring(next_name++);
+		section.ini_namespace = pick(namespaces);
+		add_commands(&section, 3);
+		// Usually with a hash, not always first:
+		if (rng() % 8) {
+			section.lines.insert(section.lines.begin() + rng() % (section.lines.size() + 1),
+					std::make_pair(wstring(L"hash"), hex(pick(shader_hashes), 16)));
+		}
+		return section;
+	}
+
+	FakeIniSection texture_override(bool fuzzy)
+	{
+		FakeIniSection section;
+
+		section.name = (rng() % 5 ? L"TextureOverride" : L"textureoverride") + std::to_wstring(next_name++);
+		section.ini_namespace = pick(namespaces);
+		if (fuzzy)
+			section.lines.emplace_back(L"match_width", std::to_wstring(64 << (rng() % 4)));
+		else
+			section.lines.emplace_back(L"hash", hex(pick(texture_hashes), 8));
+		if (rng() % 3 == 0)
+			section.lines.emplace_back(L"match_priority", std::to_wstring((int)(rng() % 5) - 2));
+		// Often with empty command lists, so checktextureoverride
+		// gets optimised out:
+		if (rng() % 3 == 0)
+			add_commands(&section, 2);
+		return section;
+	}
+
+	FakeIniSection global(const wchar_t *name)
+	{
+		FakeIniSection section;
+
+		section.name = name;
+		add_commands(&section, 3);
+		return section;
+	}
+
+	vector<FakeIniSection> config()
+	{
+		vector<FakeIniSection> config;
+		int i, n;
+
+		config.push_back(global(L"Constants"));
+		config.push_back(global(L"Present"));
+		n = 4 + rng() % 12;
+		for (i = 0; i < n; i++)
+			config.push_back(shader_override());
+		n = rng() % 10;
+		for (i = 0; i < n; i++)
+			config.push_back(texture_override(false));
+		n = rng() % 3;
+		for (i = 0; i < n; i++)
+			config.push_back(texture_override(true));
+		return config;
+	}
+
+	// Changes the config in a few random ways:
+	void change(vector<FakeIniSection> *config)
+	{
+		int changes = 1 + rng() % 3;
+		FakeIniSection *section;
+		size_t i;
+
+		while (changes--) {
+			i = rng() % config->size();
+			section = &(*config)[i];
+			bool shader = section_has_prefix(section->name, L"ShaderOverride");
+			bool texture = section_has_prefix(section->name, L"TextureOverride");
+
+			switch (rng() % 9) {
+			case 0: // Add a section
+				if (rng() % 2)
+					config->push_back(shader_override());
+				else
+					config->push_back(texture_override(rng() % 4 == 0));
+				break;
+			case 1: // Remove a section
+				if (shader || texture)
+					config->erase(config->begin() + i);
+				break;
+			case 2: // Change a hash to one that may already be in use
+				for (auto &line : section->lines) {
+					if (line.first == L"hash")
+						line.second = shader ? hex(pick(shader_hashes), 16) : hex(pick(texture_hashes), 8);
+				}
+				break;
+			case 3: // Change or add a command
+				if (!section->lines.empty() && rng() % 2)
+					section->lines[rng() % section->lines.size()].second += L"0";
+				else
+					add_commands(section, 1);
+				break;
+			case 4: // Remove the last line
+				if (!section->lines.empty())
+					section->lines.pop_back();
+				break;
+			case 5: // Move to another file
+				section->ini_namespace = pick(namespaces);
+				break;
+			case 6: // Change the priority
+				section->lines.emplace_back(L"match_priority", std::to_wstring((int)(rng() % 5) - 2));
+				break;
+			case 7: // Change a global setting
+				(*config)[0].lines.emplace_back(L"x" + std::to_wstring(rng() % 4), L"1");
+				break;
+			case 8: // Give a TextureOverride a command
+				if (texture)
+					section->lines.emplace_back(rng() % 2 ? L"x" : L"post x", L"1");
+				break;
+			}
+		}
+	}
+};
+
+static bool has_hash(const FakeIniSection &section)
+{
+	for (auto &line : section.lines) {
+		if (line.first == L"hash")
+			return true;
+	}
+	return false;
+}
+
+static bool same_section(const FakeIniSection &a, const FakeIniSection &b)
+{
+	return a.ini_namespace == b.ini_namespace && a.lines == b.lines;
+}
+
+// Whether the changes from old to config can be reloaded incrementally,
+// going by what kind of sections changed, both before and after:
+static bool expect_incremental(const vector<FakeIniSection> &old, const vector<FakeIniSection> &config)
+{
+	std::map<wstring, const FakeIniSection*> before, after;
+	std::map<wstring, const FakeIniSection*>::iterator j;
+
+	for (auto &section : old)
+		before[section.name] = &section;
+	for (auto &section : config)
+		after[section.name] = &section;
+
+	auto reloadable = [](const FakeIniSection &section) {
+		return section_has_prefix(section.name, L"ShaderOverride")
+			|| (section_has_prefix(section.name, L"TextureOverride") && has_hash(section));
+	};
+
+	for (auto &i : before) {
+		j = after.find(i.first);
+		if (j != after.end() && same_section(*i.second, *j->second))
+			continue;
+		if (!reloadable(*i.second) || (j != after.end() && !reloadable(*j->second)))
+			return false;
+	}
+	for (auto &j : after) {
+		if (!before.count(j.first) && !reloadable(*j.second))
+			return false;
+	}
+	return true;
+}
+
+static void test_random_changes()
+{
+	ConfigGenerator gen(34);
+	vector<FakeIniSection> old;
+	ConfigState before, incremental, full;
+	IniSectionHashes new_hashes;
+	int trial, reloaded = 0, fell_back = 0;
+	bool reloaded_incrementally, ini_changed, cto_changed;
+
+	for (trial = 0; trial < 3000 && failures < 10; trial++) {
+		fake_ini_files = gen.config();
+		full_load();
+		before = snapshot();
+
+		old = fake_ini_files;
+		gen.change(&fake_ini_files);
+		reloaded_incrementally = ReloadChangedIniSections(NULL);
+		incremental = snapshot();
+		if (reloaded_incrementally)
+			check_optimised_lists(before, trial);
+
+		HashIniSections(&new_hashes);
+		ini_changed = !before.section_hashes.diff(new_hashes).empty();
+
+		full_load();
+		full = snapshot();
+		cto_changed = before.cto_pre != full.cto_pre || before.cto_post != full.cto_post;
+
+		if (reloaded_incrementally) {
+			reloaded++;
+			compare_states(incremental, full, trial);
+		} else {
+			fell_back++;
+		}
+
+		if (ini_changed && !cto_changed) {
+			CHECK(reloaded_incrementally == expect_incremental(old, fake_ini_files), "trial %i: %s reload", trial,
+					reloaded_incrementally ? "incremental" : "full");
+		} else {
+			CHECK(!reloaded_incrementally, "trial %i: incremental reload with %s", trial,
+					ini_changed ? "the checktextureoverride optimisation changed" : "no sections changed");
+		}
+	}
+
+	printf("%i incremental reloads, %i full\n", reloaded, fell_back);
+	CHECK(reloaded > trial / 3, "only %i of %i reloads were incremental", reloaded, trial);
+}
+
+static FakeIniSection section(const wchar_t *name, const wchar_t *ini_namespace,
+		std::initializer_list<std::pair<wstring, wstring>> lines)
+{
+	FakeIniSection ret;
+
+	ret.name = name;
+	ret.ini_namespace = ini_namespace;
+	ret.lines = lines;
+	return ret;
+}
+
+// Sections merged into one entry have to be merged in the same order, with
+// the same one first, no matter which of them changed:
+static void test_merged_sections()
+{
+	ConfigState incremental, full;
+
+	fake_ini_files = {
+		section(L"ShaderOverrideA", L"", {{L"hash", L"0123456789abcdef"}, {L"x", L"1"}}),
+		section(L"ShaderOverrideB", L"Mods\\B\\b.ini", {{L"hash", L"0123456789abcdef"}, {L"y", L"2"}}),
+		section(L"ShaderOverrideC", L"", {{L"hash", L"0123456789abcdef"}, {L"post x", L"3"}}),
+		section(L"TextureOverrideA", L"", {{L"hash", L"12345678"}, {L"match_priority", L"1"}, {L"x", L"1"}}),
+		section(L"TextureOverrideB", L"", {{L"hash", L"12345678"}, {L"y", L"1"}}),
+	};
+	full_load();
+
+	// Drop the first section, change the middle one and reorder the
+	// TextureOverrides:
+	fake_ini_files.erase(fake_ini_files.begin());
+	fake_ini_files[0].lines[1].second = L"20";
+	fake_ini_files[3].lines.emplace_back(L"match_priority", L"5");
+
+	CHECK(ReloadChangedIniSections(NULL), "not reloaded incrementally");
+	incremental = snapshot();
+	full_load();
+	full = snapshot();
+	compare_states(incremental, full, -1);
+	CHECK(G->mShaderOverrideMap[0x0123456789abcdefull].first_ini_section == L"ShaderOverrideB",
+			"first section %ls", G->mShaderOverrideMap[0x0123456789abcdefull].first_ini_section.c_str());
+	CHECK(G->mTextureOverrideMap[0x12345678].size() == 2
+			&& G->mTextureOverrideMap[0x12345678][0].ini_section == L"TextureOverrideA",
+			"TextureOverrides out of order");
+}
+
+static void test_fallbacks()
+{
+	fake_ini_files = {
+		section(L"Present", L"", {{L"run", L"CommandListX"}}),
+		section(L"ShaderOverrideA", L"", {{L"hash", L"0123456789abcdef"}, {L"checktextureoverride", L"ps-t0"}}),
+		section(L"TextureOverrideA", L"", {{L"hash", L"12345678"}}),
+	};
+
+	full_load();
+	CHECK(!ReloadChangedIniSections(NULL), "incremental reload with nothing changed");
+
+	full_load();
+	fake_ini_files[1].lines.emplace_back(L"x", L"1");
+	include_cache.changed = true;
+	CHECK(!ReloadChangedIniSections(NULL), "incremental reload with a custom shader changed");
+	include_cache.changed = false;
+	fake_ini_files[1].lines.pop_back();
+
+	full_load();
+	shader_regex_groups[0] = 0;
+	CHECK(!ReloadChangedIniSections(NULL), "incremental reload with ShaderRegex in use");
+	shader_regex_groups.clear();
+
+	// The TextureOverrides had no commands, so the optimiser removed
+	// the checktextureoverride, which only a full reload puts back:
+	full_load();
+	CHECK(G->mShaderOverrideMap[0x0123456789abcdefull].command_list.commands.empty(),
+			"checktextureoverride not optimised out");
+	fake_ini_files[2].lines.emplace_back(L"x", L"1");
+	CHECK(!ReloadChangedIniSections(NULL), "incremental reload needing a checktextureoverride back");
+
+	incremental_reload_possible = false;
+	fake_ini_files[1].lines.emplace_back(L"y", L"1");
+	CHECK(!ReloadChangedIniSections(NULL), "incremental reload before the config was loaded in full");
+}
+
+int main()
+{
+	test_merged_sections();
+	test_fallbacks();
+	test_random_changes();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+// Stands in for windows.h and lock.h, so that IniParamsDirtyRange.h can be
+// built on any platform. The critical section is a std::mutex, which has the
+// same exclusion but is not recursive - nothing in IniParamsDirtyRange takes
+// its lock twice.
+
+#pragma once
+
+#include <limits.h>
+#include <mutex>
+
+typedef unsigned UINT;
+
+struct CRITICAL_SECTION
+{
+	std::mutex mutex;
+};
+
+static inline void InitializeCriticalSectionPretty(CRITICAL_SECTION*)
+{
+}
+
+static inline void EnterCriticalSectionPretty(CRITICAL_SECTION *lock)
+{
+	lock->mutex.lock();
+}
+
+static inline void LeaveCriticalSection(CRITICAL_SECTION *lock)
+{
+	lock->mutex.unlock();
+}
@@ -0,0 +1,65 @@
+// Times the IniParamsDirtyRange operations that run while the game is
+// running: marking an IniParam from a command list, and taking the range
+// after every command list on the immediate context, both when nothing has
+// changed (the common case) and when something has. Also times marking from
+// several threads at once. This is not run by ctest - run
+// IniParamsDirtyRangeBench from the build directory.
+
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "FakeLock.h"
+#include "IniParamsDirtyRange.h"
+
+static const int ITERATIONS = 10000000;
+
+typedef std::chrono::steady_clock Clock;
+
+static double ns_per_op(Clock::time_point start, int ops)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ops;
+}
+
+int main()
+{
+	IniParamsDirtyRange range;
+	std::vector<std::thread> threads;
+	Clock::time_point start;
+	UINT first, last, taken = 0;
+	int i, t, num_threads;
+
+	InitializeCriticalSectionPretty(&range.lock);
+
+	start = Clock::now();
+	for (i = 0; i < ITERATIONS; i++)
+		taken += range.take(256, &first, &last);
+	printf("take, nothing dirty:      %6.1fns\n", ns_per_op(start, ITERATIONS));
+
+	start = Clock::now();
+	for (i = 0; i < ITERATIONS; i++) {
+		range.mark(i & 255);
+		taken += range.take(256, &first, &last);
+	}
+	printf("mark + take:              %6.1fns\n", ns_per_op(start, ITERATIONS));
+
+	for (num_threads = 1; num_threads <= 4; num_threads *= 2) {
+		threads.clear();
+		start = Clock::now();
+		for (t = 0; t < num_threads; t++) {
+			threads.emplace_back([&range, t]() {
+				int n;
+
+				for (n = 0; n < ITERATIONS / 4; n++)
+					range.mark((n + t) & 255);
+			});
+		}
+		for (std::thread &thread : threads)
+			thread.join();
+		printf("mark, %i thread(s):        %6.1fns\n", num_threads,
+				ns_per_op(start, ITERATIONS / 4 * num_threads));
+	}
+
+	return taken ? 0 : 1;
+}
@@ -0,0 +1,427 @@
+// Scans in-memory directory trees with IniDirectoryScanner and checks:
+//
+//   - directories come back in the order the old depth first walk visited
+//     them, each followed by its subdirectories sorted case insensitively
+//   - ini files are sorted case insensitively, names that only differ by
+//     case are listed once (the first listed wins, as with the old
+//     std::set), and only names ending in ".ini" count
+//   - everything else is skipped in the order it was listed, marked as
+//     excluded or not, and "." and ".." are ignored
+//   - excluded directories are never listed, and the exclude filter is never
+//     called on two threads at once
+//   - a directory that can't be listed comes back with found set to false
+//   - random trees give exactly what a copy of the old serial walk gives,
+//     with one thread and with several, and several threads really are
+//     used when allowed
+//
+// Best also run with -fsanitize=thread.
+
+#include <stdio.h>
+#include <wchar.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+
+#include "IniScanner.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static const wchar_t *BASE = L"C:\\Game";
+
+// The in-memory file system, keyed by full path, with each directory's
+// entries in the order the "file system" lists them. Directories missing
+// from it can't be opened:
+static std::map<std::wstring, std::vector<IniScanEntry>> tree;
+
+static std::mutex listed_lock;
+static std::vector<std::wstring> listed;
+static std::set<std::thread::id> lister_threads;
+static int list_delay_us;
+
+static bool fake_list(const std::wstring &path, std::vector<IniScanEntry> *entries)
+{
+	auto i = tree.find(path);
+
+	{
+		std::lock_guard<std::mutex> guard(listed_lock);
+		listed.push_back(path);
+		lister_threads.insert(std::this_thread::get_id());
+	}
+
+	// Gives the other threads a chance to pick up work, as waiting on a
+	// real file system would:
+	if (list_delay_us)
+		std::this_thread::sleep_for(std::chrono::microseconds(list_delay_us));
+
+	if (i == tree.end())
+		return false;
+	*entries = i->second;
+	return true;
+}
+
+static bool name_less(const std::wstring &x, const std::wstring &y)
+{
+	return wcscasecmp(x.c_str(), y.c_str()) < 0;
+}
+
+struct NameLess {
+	bool operator() (const std::wstring &x, const std::wstring &y) const
+	{
+		return name_less(x, y);
+	}
+};
+
+static void reset_fs()
+{
+	tree.clear();
+	listed.clear();
+	lister_threads.clear();
+	list_delay_us = 0;
+}
+
+static void add_dir(const std::wstring &rel_path, std::initializer_list<IniScanEntry> entries)
+{
+	tree[BASE + rel_path] = entries;
+}
+
+// ParseIniFilesRecursive() as it was before the scanner, collecting what it
+// found instead of parsing it:
+static void old_walk(const std::wstring &base, const std::wstring &rel_path,
+		const IniScanExclude &exclude, std::vector<IniScanDirectory> *directories)
+{
+	std::set<std::wstring, NameLess> ini_files, subdirs;
+	std::vector<IniScanEntry> entries;
+	IniScanDirectory dir;
+
+	dir.rel_path = rel_path;
+	dir.found = fake_list(base + rel_path, &entries);
+
+	for (IniScanEntry &entry : entries) {
+		if (exclude(entry.name)) {
+			dir.skipped.push_back({entry.name, true});
+			continue;
+		}
+
+		if (entry.directory) {
+			if (entry.name != L"." && entry.name != L"..")
+				subdirs.insert(entry.name);
+		} else if (entry.name.size() >= 4 && !wcscmp(entry.name.c_str() + entry.name.size() - 4, L".ini")) {
+			ini_files.insert(entry.name);
+		} else {
+			dir.skipped.push_back({entry.name, false});
+		}
+	}
+
+	dir.ini_files.assign(ini_files.begin(), ini_files.end());
+	directories->push_back(dir);
+
+	for (const std::wstring &subdir : subdirs)
+		old_walk(base, rel_path + L"\\" + subdir, exclude, directories);
+}
+
+static std::wstring describe(const std::vector<IniScanDirectory> &directories)
+{
+	std::wstring ret;
+
+	for (const IniScanDirectory &dir : directories) {
+		ret += dir.rel_path + (dir.found ? L"\n" : L" (not found)\n");
+		for (const std::wstring &ini : dir.ini_files)
+			ret += L"  " + ini + L"\n";
+		for (const IniScanSkipped &skipped : dir.skipped)
+			ret += (skipped.excluded ? L"  excluded " : L"  skipped ") + skipped.name + L"\n";
+	}
+	return ret;
+}
+
+static std::vector<IniScanDirectory> scan(const std::wstring &rel_path, const IniScanExclude &exclude, unsigned threads)
+{
+	IniDirectoryScanner scanner(fake_list, name_less);
+	std::vector<IniScanDirectory> directories;
+
+	scanner.scan(BASE, rel_path, exclude, threads, &directories);
+	return directories;
+}
+
+static bool exclude_nothing(const std::wstring&)
+{
+	return false;
+}
+
+static void test_order()
+{
+	std::vector<IniScanDirectory> dirs;
+	std::wstring expected;
+	unsigned threads;
+
+	reset_fs();
+	add_dir(L"\\Mods", {
+		{L".", true}, {L"..", true},
+		{L"zeta", true}, {L"b.ini", false}, {L"Alpha", true},
+		{L"readme.txt", false}, {L"A.ini", false}, {L"B.INI", false},
+		{L"ini", false}, {L"c.ini", false}, {L"C.ini", false},
+	});
+	add_dir(L"\\Mods\\Alpha", {{L"mod.ini", false}, {L"Textures", true}});
+	add_dir(L"\\Mods\\Alpha\\Textures", {{L"x.dds", false}});
+	add_dir(L"\\Mods\\zeta", {{L"z.ini", false}});
+
+	expected =
+		L"\\Mods\n"
+		L"  A.ini\n"
+		L"  b.ini\n"
+		L"  c.ini\n"
+		L"  skipped readme.txt\n"
+		L"  skipped B.INI\n"
+		L"  skipped ini\n"
+		L"\\Mods\\Alpha\n"
+		L"  mod.ini\n"
+		L"\\Mods\\Alpha\\Textures\n"
+		L"  skipped x.dds\n"
+		L"\\Mods\\zeta\n"
+		L"  z.ini\n";
+
+	for (threads = 0; threads <= 4; threads++) {
+		dirs = scan(L"\\Mods", exclude_nothing, threads);
+		CHECK(describe(dirs) == expected, "%u threads:\n%ls", threads, describe(dirs).c_str());
+	}
+}
+
+static void test_case_insensitive_directories()
+{
+	std::vector<IniScanDirectory> dirs;
+	unsigned threads;
+
+	// Two directories whose names only differ by case can't both exist
+	// on Windows, but if they are listed the first wins, as before:
+	reset_fs();
+	add_dir(L"\\Mods", {{L"mod", true}, {L"Mod", true}, {L"B", true}, {L"a", true}});
+	add_dir(L"\\Mods\\mod", {});
+	add_dir(L"\\Mods\\Mod", {});
+	add_dir(L"\\Mods\\a", {});
+	add_dir(L"\\Mods\\B", {});
+
+	for (threads = 1; threads <= 4; threads *= 2) {
+		dirs = scan(L"\\Mods", exclude_nothing, threads);
+		CHECK(dirs.size() == 4 && dirs[1].rel_path == L"\\Mods\\a" && dirs[2].rel_path == L"\\Mods\\B"
+				&& dirs[3].rel_path == L"\\Mods\\mod",
+				"%u threads:\n%ls", threads, describe(dirs).c_str());
+	}
+}
+
+// Large enough that an unstable sort would shuffle the names that only differ
+// by case, so which of them is kept would depend on the sort:
+static void test_case_insensitive_files()
+{
+	std::vector<IniScanDirectory> expected, dirs;
+	std::vector<IniScanEntry> entries;
+	std::mt19937 rng(460);
+	unsigned threads;
+	int i;
+
+	for (i = 0; i < 20; i++) {
+		entries.push_back({L"mod" + std::to_wstring(i) + L".ini", false});
+		entries.push_back({L"MOD" + std::to_wstring(i) + L".ini", false});
+		entries.push_back({L"Mod" + std::to_wstring(i) + L".ini", false});
+	}
+	std::shuffle(entries.begin(), entries.end(), rng);
+	reset_fs();
+	tree[BASE + std::wstring(L"\\Mods")] = entries;
+
+	old_walk(BASE, L"\\Mods", exclude_nothing, &expected);
+	for (threads = 1; threads <= 4; threads *= 2) {
+		dirs = scan(L"\\Mods", exclude_nothing, threads);
+		CHECK(dirs.size() == 1 && dirs[0].ini_files.size() == 20 && describe(dirs) == describe(expected),
+				"%u threads:\n%ls\nvs the old walk:\n%ls", threads, describe(dirs).c_str(), describe(expected).c_str());
+	}
+}
+
+static void test_exclusions()
+{
+	std::atomic<int> in_exclude(0);
+	std::atomic<bool> overlapped(false);
+	std::vector<IniScanDirectory> dirs;
+	unsigned threads;
+	int i;
+
+	IniScanExclude exclude = [&](const std::wstring &name) {
+		if (in_exclude++)
+			overlapped = true;
+		std::this_thread::yield();
+		in_exclude--;
+		return name.find(L"DISABLED") == 0;
+	};
+
+	reset_fs();
+	add_dir(L"\\Mods", {{L"DISABLED old", true}, {L"DISABLED.ini", false}, {L"live", true}});
+	add_dir(L"\\Mods\\DISABLED old", {{L"old.ini", false}});
+	add_dir(L"\\Mods\\live", {{L"DISABLED x.ini", false}, {L"y.ini", false}});
+	// A wide level so that several threads run the filter at once:
+	for (i = 0; i < 32; i++) {
+		tree[BASE + std::wstring(L"\\Mods\\live")].push_back({L"sub" + std::to_wstring(i), true});
+		add_dir(L"\\Mods\\live\\sub" + std::to_wstring(i), {{L"DISABLED", true}, {L"a.ini", false}, {L"b.txt", false}});
+	}
+
+	for (threads = 1; threads <= 8; threads *= 2) {
+		listed.clear();
+		list_delay_us = 200;
+		dirs = scan(L"\\Mods", exclude, threads);
+
+		CHECK(dirs.size() == 34, "%u threads: %zu directories", threads, dirs.size());
+		CHECK(dirs[0].skipped.size() == 2 && dirs[0].skipped[0].excluded && dirs[0].skipped[1].excluded
+				&& dirs[0].skipped[0].name == L"DISABLED old", "%u threads:\n%ls", threads, describe(dirs).c_str());
+		CHECK(dirs[1].ini_files.size() == 1 && dirs[1].skipped.size() == 1 && dirs[1].skipped[0].excluded,
+				"%u threads:\n%ls", threads, describe(dirs).c_str());
+		for (const std::wstring &path : listed)
+			CHECK(path.find(L"DISABLED") == std::wstring::npos, "%u threads: listed %ls", threads, path.c_str());
+		CHECK(!overlapped, "%u threads: exclude filter called on two threads at once", threads);
+	}
+}
+
+static void test_not_found()
+{
+	std::vector<IniScanDirectory> dirs;
+	unsigned threads;
+
+	reset_fs();
+	add_dir(L"\\Mods", {{L"gone", true}, {L"here", true}});
+	add_dir(L"\\Mods\\here", {{L"a.ini", false}});
+
+	for (threads = 1; threads <= 4; threads *= 3) {
+		dirs = scan(L"\\Missing", exclude_nothing, threads);
+		CHECK(dirs.size() == 1 && !dirs[0].found && dirs[0].rel_path == L"\\Missing"
+				&& dirs[0].ini_files.empty() && dirs[0].skipped.empty(),
+				"%u threads:\n%ls", threads, describe(dirs).c_str());
+
+		dirs = scan(L"\\Mods", exclude_nothing, threads);
+		CHECK(dirs.size() == 3 && dirs[0].found && !dirs[1].found && dirs[2].found
+				&& dirs[2].ini_files.size() == 1, "%u threads:\n%ls", threads, describe(dirs).c_str());
+	}
+}
+
+static const wchar_t *file_names[] = {
+	L"a.ini", L"A.ini", L"b.ini", L"mod.ini", L"Mod.ini", L"MOD.INI", L"zz.ini",
+	L"readme.txt", L"x.dds", L"ini", L"skip.ini", L"merged.ini",
+};
+static const wchar_t *dir_names[] = {
+	L"Mods", L"mods", L"Sub", L"sub", L"x", L"Y", L"skipped", L"ShaderFixes", L"gone",
+};
+
+static void random_dir(std::mt19937 &rng, const std::wstring &rel_path, int depth)
+{
+	std::vector<IniScanEntry> entries;
+	std::set<std::wstring> used;
+	std::wstring name;
+	int i, n;
+
+	if (rng() % 3 == 0) {
+		entries.push_back({L".", true});
+		entries.push_back({L"..", true});
+	}
+
+	n = rng() % 8;
+	for (i = 0; i < n; i++) {
+		if (depth < 4 && rng() % 3 == 0) {
+			name = dir_names[rng() % (sizeof(dir_names) / sizeof(dir_names[0]))];
+			if (!used.insert(name).second)
+				continue;
+			entries.push_back({name, true});
+			// Left out of the tree, so it can't be opened:
+			if (name != L"gone")
+				random_dir(rng, rel_path + L"\\" + name, depth + 1);
+		} else {
+			name = file_names[rng() % (sizeof(file_names) / sizeof(file_names[0]))];
+			if (!used.insert(name).second)
+				continue;
+			entries.push_back({name, false});
+		}
+	}
+
+	std::shuffle(entries.begin(), entries.end(), rng);
+	tree[BASE + rel_path] = entries;
+}
+
+static void test_random_trees()
+{
+	std::mt19937 rng(46);
+	std::vector<IniScanDirectory> expected, dirs;
+	static const unsigned thread_counts[] = {1, 2, 3, 8};
+	int trial;
+
+	IniScanExclude exclude = [](const std::wstring &name) {
+		return name.find(L"skip") == 0;
+	};
+
+	for (trial = 0; trial < 400 && failures < 10; trial++) {
+		reset_fs();
+		random_dir(rng, L"\\Mods", 0);
+
+		expected.clear();
+		old_walk(BASE, L"\\Mods", exclude, &expected);
+
+		for (unsigned threads : thread_counts) {
+			dirs = scan(L"\\Mods", exclude, threads);
+			CHECK(describe(dirs) == describe(expected), "trial %i, %u threads:\n%ls\nvs the old walk:\n%ls",
+					trial, threads, describe(dirs).c_str(), describe(expected).c_str());
+		}
+	}
+}
+
+static void test_threads_used()
+{
+	std::vector<IniScanDirectory> dirs;
+	int i;
+
+	reset_fs();
+	for (i = 0; i < 32; i++) {
+		tree[BASE + std::wstring(L"\\Mods")].push_back({L"mod" + std::to_wstring(i), true});
+		add_dir(L"\\Mods\\mod" + std::to_wstring(i), {{L"mod.ini", false}});
+	}
+	list_delay_us = 1000;
+
+	dirs = scan(L"\\Mods", exclude_nothing, 1);
+	CHECK(dirs.size() == 33, "%zu directories", dirs.size());
+	CHECK(lister_threads.size() == 1, "%zu threads used with a limit of 1", lister_threads.size());
+
+	lister_threads.clear();
+	dirs = scan(L"\\Mods", exclude_nothing, 4);
+	CHECK(dirs.size() == 33, "%zu directories", dirs.size());
+	CHECK(lister_threads.size() > 1 && lister_threads.size() <= 4, "%zu threads used with a limit of 4",
+			lister_threads.size());
+
+	// Nothing to share, so no threads are started:
+	tree[BASE + std::wstring(L"\\Mods")].clear();
+	lister_threads.clear();
+	dirs = scan(L"\\Mods", exclude_nothing, 4);
+	CHECK(lister_threads.size() == 1 && *lister_threads.begin() == std::this_thread::get_id(),
+			"threads started for a directory with no subdirectories");
+}
+
+int main()
+{
+	test_order();
+	test_case_insensitive_directories();
+	test_case_insensitive_files();
+	test_exclusions();
+	test_not_found();
+	test_random_trees();
+	test_threads_used();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
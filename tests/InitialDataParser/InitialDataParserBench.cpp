@@ -0,0 +1,68 @@
+// Times parsing large data lines with the old sscanf based initial data
+// parser (OldInitialDataParser.inc) and InitialDataParser.h. This is not run
+// by ctest - run InitialDataParserBench from the build directory.
+
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "InitialDataParser.h"
+
+#define sscanf_s sscanf
+#define IniWarningW(fmt, token) ((void)(token))
+
+namespace old_parser {
+#include "OldInitialDataParser.inc"
+}
+
+static const int NUM_VALUES = 1000000;
+
+template <typename T>
+static void bench(const char *type, const std::string &data)
+{
+	std::chrono::steady_clock::time_point start, mid, end;
+	std::vector<T> old_vals, new_vals;
+	size_t count;
+
+	start = std::chrono::steady_clock::now();
+	{
+		std::istringstream tokens(data);
+		old_vals = old_parser::string_to_typed_array<T>(&tokens);
+	}
+	mid = std::chrono::steady_clock::now();
+	// Same as ConstructInitialData(): count, allocate once, parse in place
+	new_vals.resize(count_initial_data_tokens(data, 0));
+	count = parse_initial_data<T>(data, 0, [&](size_t i, T val) {
+		new_vals[i] = val;
+	}, [](const char*, const char*) {});
+	new_vals.resize(count);
+	end = std::chrono::steady_clock::now();
+
+	printf("%-16s %8zu values: sscanf %6.1fms, strto* %6.1fms%s\n", type, count,
+			std::chrono::duration<double, std::milli>(mid - start).count(),
+			std::chrono::duration<double, std::milli>(end - mid).count(),
+			old_vals == new_vals ? "" : " (MISMATCH)");
+}
+
+int main()
+{
+	std::mt19937 rng(44);
+	std::string floats, ints, hex;
+	int i;
+
+	for (i = 0; i < NUM_VALUES; i++) {
+		floats += std::to_string((float)(int)rng() / 65536.0f) + ' ';
+		ints += std::to_string(rng() % 65536) + ' ';
+		hex += "0x" + std::to_string(rng() % 100000) + ' ';
+	}
+
+	bench<float>("float", floats);
+	bench<unsigned short>("unsigned short", ints);
+	bench<unsigned int>("unsigned int", ints);
+	bench<unsigned int>("0x unsigned int", hex);
+
+	return 0;
+}
@@ -0,0 +1,221 @@
+// Parses random data lines for every element type with both the old sscanf
+// based parser (OldInitialDataParser.inc) and InitialDataParser.h, and checks
+// that they produce bit-identical values and reject the same tokens.
+//
+// A few malformed tokens were accepted by glibc's sscanf, but are rejected by
+// strto*, which requires the whole token to be a number. These are checked to
+// be rejected by the new parser:
+//
+//   floats: an exponent with no digits ("1e", "1e+", "0x1p")
+//   integers: a bare "0x" prefix
+
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "InitialDataParser.h"
+
+static std::vector<std::string> old_bad_tokens;
+
+#define sscanf_s sscanf
+#define IniWarningW(fmt, token) old_bad_tokens.push_back(token)
+
+namespace old_parser {
+#include "OldInitialDataParser.inc"
+}
+
+#undef sscanf_s
+#undef IniWarningW
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+template <typename T>
+static std::vector<T> new_parse(const std::string &data, std::vector<std::string> *bad_tokens)
+{
+	std::vector<T> vals(count_initial_data_tokens(data, 0));
+	size_t count;
+
+	count = parse_initial_data<T>(data, 0, [&](size_t i, T val) {
+		vals[i] = val;
+	}, [&](const char *token, const char *end) {
+		bad_tokens->push_back(std::string(token, end));
+	});
+	vals.resize(count);
+
+	return vals;
+}
+
+template <typename T>
+static std::vector<T> old_parse(const std::string &data, std::vector<std::string> *bad_tokens)
+{
+	std::istringstream tokens(data);
+	std::vector<T> vals;
+
+	old_bad_tokens.clear();
+	vals = old_parser::string_to_typed_array<T>(&tokens);
+	*bad_tokens = old_bad_tokens;
+
+	return vals;
+}
+
+// glibc's sscanf backs off an incomplete exponent or hex prefix and still
+// counts it as consumed:
+static bool known_difference(const std::string &token, bool is_float)
+{
+	size_t len = token.size();
+	size_t e;
+
+	if (!is_float)
+		return token == "0x" || token == "+0x" || token == "-0x";
+
+	if (token.find("0x") != std::string::npos)
+		e = token.find_last_of("pP");
+	else
+		e = token.find_last_of("eE");
+	if (e == std::string::npos)
+		return false;
+	if (e == len - 1)
+		return true;
+	return e == len - 2 && (token[len - 1] == '+' || token[len - 1] == '-');
+}
+
+static std::string random_token(std::mt19937 &rng, bool is_float)
+{
+	static const char *specials[] = {
+		"0", "-0", "1", "-1", "0x", "0x0", "0xffffffff", "0x80000000",
+		"0x7fc00000", "0x3f800000", "inf", "-inf", "nan", "1e", "1e+",
+		"1e-3", "0x1p", "0x1p3", ".5", "5.", "-.5e2", "127", "128", "-128",
+		"-129", "255", "256", "32767", "32768", "65535", "65536",
+		"2147483647", "2147483648", "4294967295", "4294967296", "010",
+		"-010", "08", "1.5.2", "abc", "--1", "+1", "1-", "0x-5", "0xg",
+	};
+	static const char alphabet[] = "0123456789abcdefx.-+eE";
+	std::string token;
+	int i, n;
+
+	switch (rng() % 4) {
+		case 0:
+			return specials[rng() % (sizeof(specials) / sizeof(specials[0]))];
+		case 1:
+			n = 1 + rng() % 10;
+			for (i = 0; i < n; i++)
+				token += alphabet[rng() % (sizeof(alphabet) - 1)];
+			return token;
+		default:
+			if (is_float)
+				return std::to_string((float)(int)rng() / (float)(1 + rng() % 100000));
+			return std::to_string((int)rng() >> (rng() % 32));
+	}
+}
+
+static std::string random_line(std::mt19937 &rng, bool is_float, int tokens)
+{
+	std::string line;
+	int i;
+
+	for (i = 0; i < tokens; i++) {
+		// Runs of spaces, and leading and trailing spaces, are skipped:
+		line.append(rng() % 8 ? 1 : 1 + rng() % 3, ' ');
+		line += random_token(rng, is_float);
+	}
+	if (rng() % 2)
+		line += ' ';
+
+	return line;
+}
+
+template <typename T>
+static void compare_line(const char *type, const std::string &line, bool is_float)
+{
+	std::vector<std::string> old_bad, new_bad;
+	std::vector<T> old_vals, new_vals;
+	std::string filtered;
+	std::istringstream tokens(line);
+	std::string token;
+
+	// Drop the tokens sscanf is known to get wrong, after checking that
+	// the new parser rejects them:
+	while (std::getline(tokens, token, ' ')) {
+		if (token.empty())
+			continue;
+		if (known_difference(token, is_float)) {
+			new_parse<T>(token, &new_bad);
+			CHECK(new_bad.size() == 1, "%s: \"%s\" accepted", type, token.c_str());
+			new_bad.clear();
+			continue;
+		}
+		filtered += token + ' ';
+	}
+
+	old_vals = old_parse<T>(filtered, &old_bad);
+	new_vals = new_parse<T>(filtered, &new_bad);
+
+	CHECK(old_vals.size() == new_vals.size(), "%s: %zu values, expected %zu: \"%s\"",
+			type, new_vals.size(), old_vals.size(), filtered.c_str());
+	CHECK(old_vals.size() != new_vals.size() || old_vals.empty() || !memcmp(old_vals.data(), new_vals.data(), sizeof(T) * old_vals.size()),
+			"%s: values differ: \"%s\"", type, filtered.c_str());
+	CHECK(old_bad == new_bad, "%s: rejected tokens differ: \"%s\"", type, filtered.c_str());
+}
+
+template <typename T>
+static void compare_type(const char *type, bool is_float, std::mt19937 &rng)
+{
+	int i;
+
+	compare_line<T>(type, "", is_float);
+	compare_line<T>(type, "   ", is_float);
+	for (i = 0; i < 20000; i++)
+		compare_line<T>(type, random_line(rng, is_float, rng() % 12), is_float);
+}
+
+static void test_data_from_pos()
+{
+	std::vector<float> vals;
+	std::vector<std::string> bad;
+	std::string data = "R32_FLOAT 1 2.5 0x40400000";
+	size_t count;
+
+	// The format name at the start of the line is skipped by pos, which
+	// counting and parsing must agree on:
+	vals.resize(count_initial_data_tokens(data, 10));
+	CHECK(vals.size() == 3, "%zu tokens after pos", vals.size());
+	count = parse_initial_data<float>(data, 10, [&](size_t i, float val) {
+		vals[i] = val;
+	}, [&](const char *token, const char *end) {
+		bad.push_back(std::string(token, end));
+	});
+	CHECK(count == 3 && bad.empty(), "%zu values parsed after pos", count);
+	CHECK(vals.size() == 3 && vals[0] == 1 && vals[1] == 2.5 && vals[2] == 3, "values after pos");
+}
+
+int main()
+{
+	std::mt19937 rng(44);
+
+	compare_type<float>("float", true, rng);
+	compare_type<unsigned int>("unsigned int", false, rng);
+	compare_type<signed int>("signed int", false, rng);
+	compare_type<unsigned short>("unsigned short", false, rng);
+	compare_type<signed short>("signed short", false, rng);
+	compare_type<unsigned char>("unsigned char", false, rng);
+	compare_type<signed char>("signed char", false, rng);
+	test_data_from_pos();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
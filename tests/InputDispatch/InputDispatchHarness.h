@@ -0,0 +1,383 @@
+#pragma once
+
+// Scripted key bindings for testing and benchmarking InputDispatcher.
+//
+// The key binding classes in input.cpp can't be built here, since they need
+// windows.h for the key names and xinput, so TestAction and its subclasses
+// copy the Dispatch() and NeedsPolling() of InputAction, RepeatingInputAction
+// and DelayedInputAction, and TestButton combines keys and controller buttons
+// the way an InputButtonList of VKInputButtons and XInputButtons does. Every
+// event is recorded in an EventLog instead of going to a listener.
+//
+// dispatch_every_action() is how DispatchInputEvents() used to work, calling
+// every action every frame, and is the reference for what InputDispatcher
+// should dispatch.
+
+#include <stdint.h>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "InputDispatch.h"
+
+struct InputEvent {
+	uint32_t frame;
+	int binding;
+	bool down;
+
+	bool operator==(const InputEvent &other) const
+	{
+		return frame == other.frame && binding == other.binding && down == other.down;
+	}
+};
+
+struct EventLog {
+	std::vector<InputEvent> events;
+	uint32_t frame;
+	uint64_t dispatches; // Calls to Dispatch(), whether or not they did anything
+
+	EventLog() : frame(0), dispatches(0) {}
+};
+
+// A key (vkey >= 0) or a controller button or trigger, as parsed by
+// VKInputButton and XInputButton:
+struct TestInput {
+	int vkey;
+	int controller; // -1 for any controller
+	uint16_t button;
+	uint8_t left_trigger;
+	bool invert;
+};
+
+static TestInput test_key(int vkey, bool invert = false)
+{
+	return TestInput{vkey, -1, 0, 0, invert};
+}
+
+static TestInput test_gamepad(int controller, uint16_t button, uint8_t left_trigger, bool invert = false)
+{
+	return TestInput{-1, controller, button, left_trigger, invert};
+}
+
+class TestButton {
+	static bool check_gamepad(const TestInput &in, const InputGamepadState *gamepad)
+	{
+		if (!gamepad->connected)
+			return false; // Don't invert if it's not connected
+
+		if (in.button && (gamepad->buttons & in.button))
+			return true ^ in.invert;
+		if (in.left_trigger && (gamepad->left_trigger >= in.left_trigger))
+			return true ^ in.invert;
+
+		return false ^ in.invert;
+	}
+
+	static bool check(const TestInput &in, const InputSnapshot &input)
+	{
+		int i;
+
+		if (in.vkey >= 0)
+			return (input.KeyDown(in.vkey) ^ in.invert);
+
+		if (in.controller != -1)
+			return check_gamepad(in, &input.gamepads[in.controller]);
+
+		for (i = 0; i < 4; i++) {
+			if (check_gamepad(in, &input.gamepads[i]))
+				return true;
+		}
+
+		return false;
+	}
+
+public:
+	std::vector<TestInput> inputs;
+
+	bool CheckState(const InputSnapshot &input) const
+	{
+		for (const TestInput &in : inputs) {
+			if (!check(in, input))
+				return false;
+		}
+
+		return true;
+	}
+
+	void GetWatchedInputs(InputWatch *watch) const
+	{
+		for (const TestInput &in : inputs) {
+			if (in.vkey >= 0)
+				watch->keys.push_back(in.vkey);
+			else if (in.controller != -1)
+				watch->gamepads |= 1 << in.controller;
+			else
+				watch->gamepads |= 0xf;
+		}
+	}
+};
+
+enum class TestActionType {
+	PLAIN,
+	REPEATING,
+	DELAYED,
+};
+
+struct BindingSpec {
+	TestButton button;
+	TestActionType type;
+	int repeat;                 // Repeats per second
+	int delay_down, delay_up;   // Milliseconds
+};
+
+// InputAction:
+class TestAction : public InputActionBase {
+protected:
+	int id;
+	EventLog *log;
+
+	void event(bool down)
+	{
+		log->events.push_back(InputEvent{log->frame, id, down});
+	}
+
+public:
+	bool last_state;
+	TestButton button;
+
+	TestAction(const TestButton &button, int id, EventLog *log) :
+		id(id),
+		log(log),
+		last_state(false),
+		button(button)
+	{}
+
+	void GetWatchedInputs(InputWatch *watch) override
+	{
+		button.GetWatchedInputs(watch);
+	}
+
+	bool Dispatch(HackerDevice*, const InputSnapshot &input, uint64_t) override
+	{
+		bool state = button.CheckState(input);
+
+		log->dispatches++;
+
+		if (state == last_state)
+			return false;
+
+		event(state);
+
+		last_state = state;
+
+		return true;
+	}
+};
+
+// RepeatingInputAction:
+class TestRepeatingAction : public TestAction {
+	int repeatRate;
+	uint64_t lastTick;
+
+public:
+	TestRepeatingAction(const TestButton &button, int id, EventLog *log, int repeat) :
+		TestAction(button, id, log),
+		repeatRate(repeat),
+		lastTick(0)
+	{}
+
+	bool Dispatch(HackerDevice*, const InputSnapshot &input, uint64_t now) override
+	{
+		int ms = (1000 / repeatRate);
+
+		log->dispatches++;
+
+		if (now < (lastTick + ms))
+			return false;
+
+		bool state = button.CheckState(input);
+
+		// Only allow auto-repeat for down events.
+		if (state || (state != last_state))
+		{
+			event(state);
+
+			lastTick = now;
+			last_state = state;
+
+			return true;
+		}
+
+		return false;
+	}
+
+	bool NeedsPolling(const InputSnapshot &input) override
+	{
+		return last_state || button.CheckState(input);
+	}
+};
+
+// DelayedInputAction:
+class TestDelayedAction : public TestAction {
+	int delay_down, delay_up;
+	bool effective_state;
+	uint64_t state_change_time;
+
+public:
+	TestDelayedAction(const TestButton &button, int id, EventLog *log, int delay_down, int delay_up) :
+		TestAction(button, id, log),
+		delay_down(delay_down),
+		delay_up(delay_up),
+		effective_state(false),
+		state_change_time(0)
+	{}
+
+	bool Dispatch(HackerDevice*, const InputSnapshot &input, uint64_t now) override
+	{
+		bool state = button.CheckState(input);
+
+		log->dispatches++;
+
+		if (state != last_state)
+			state_change_time = now;
+		last_state = state;
+
+		if (state != effective_state) {
+			if (state && ((now - state_change_time) >= (uint64_t)delay_down)) {
+				effective_state = state;
+				event(true);
+				return true;
+			} else if (!state && ((now - state_change_time) >= (uint64_t)delay_up)) {
+				effective_state = state;
+				event(false);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool NeedsPolling(const InputSnapshot &input) override
+	{
+		return button.CheckState(input) != effective_state;
+	}
+};
+
+static std::unique_ptr<TestAction> make_action(const BindingSpec &spec, int id, EventLog *log)
+{
+	switch (spec.type) {
+	case TestActionType::REPEATING:
+		return std::unique_ptr<TestAction>(new TestRepeatingAction(spec.button, id, log, spec.repeat));
+	case TestActionType::DELAYED:
+		return std::unique_ptr<TestAction>(new TestDelayedAction(spec.button, id, log, spec.delay_down, spec.delay_up));
+	default:
+		return std::unique_ptr<TestAction>(new TestAction(spec.button, id, log));
+	}
+}
+
+// The keyboard and controllers, as changed by the script. Poll() copies only
+// what it is asked for into the snapshot, as Win32InputSource does:
+class ScriptedSource : public InputSource {
+public:
+	InputSnapshot world;
+	uint64_t now;
+	uint64_t keys_polled;
+	uint64_t gamepads_polled;
+
+	ScriptedSource() : now(0), keys_polled(0), gamepads_polled(0) {}
+
+	void Poll(InputSnapshot *snapshot, const std::vector<int> &keys, unsigned gamepads) override
+	{
+		int j;
+
+		for (int vkey : keys)
+			snapshot->keys[vkey] = world.keys[vkey];
+		keys_polled += keys.size();
+
+		for (j = 0; j < INPUT_NUM_GAMEPADS; j++) {
+			if (gamepads & (1 << j)) {
+				snapshot->gamepads[j] = world.gamepads[j];
+				gamepads_polled++;
+			}
+		}
+	}
+
+	uint64_t GetTickCount() override
+	{
+		return now;
+	}
+};
+
+// The same bindings twice, once dispatched by an InputDispatcher and once by
+// calling every action every frame, each with its own log:
+class BindingSet {
+public:
+	std::vector<std::unique_ptr<TestAction>> dispatched, reference;
+	EventLog dispatched_log, reference_log;
+	InputDispatcher dispatcher;
+
+	void add(const BindingSpec &spec)
+	{
+		int id = (int)dispatched.size();
+
+		dispatched.push_back(make_action(spec, id, &dispatched_log));
+		reference.push_back(make_action(spec, id, &reference_log));
+		dispatcher.Add(dispatched.back().get());
+	}
+
+	void clear()
+	{
+		dispatcher.Clear();
+		dispatched.clear();
+		reference.clear();
+	}
+
+	bool dispatch(ScriptedSource *source)
+	{
+		dispatched_log.frame++;
+		return dispatcher.Dispatch(nullptr, source);
+	}
+
+	bool dispatch_every_action(ScriptedSource *source)
+	{
+		bool input_processed = false;
+
+		reference_log.frame++;
+		for (std::unique_ptr<TestAction> &action : reference)
+			input_processed |= action->Dispatch(nullptr, source->world, source->now);
+
+		return input_processed;
+	}
+};
+
+static TestButton random_button(std::mt19937 &rng, int num_keys, bool gamepads)
+{
+	TestButton button;
+	int i, n = 1 + rng() % 3;
+
+	for (i = 0; i < n; i++) {
+		if (gamepads && rng() % 5 == 0) {
+			button.inputs.push_back(test_gamepad((int)(rng() % 5) - 1,
+					(uint16_t)(rng() % 2 ? 1 << (rng() % 4) : 0),
+					(uint8_t)(rng() % 2 ? 1 + rng() % 255 : 0),
+					rng() % 8 == 0));
+		} else {
+			button.inputs.push_back(test_key(1 + rng() % num_keys, rng() % 8 == 0));
+		}
+	}
+
+	return button;
+}
+
+static BindingSpec random_binding(std::mt19937 &rng, int num_keys, bool gamepads)
+{
+	BindingSpec spec;
+
+	spec.button = random_button(rng, num_keys, gamepads);
+	spec.type = (TestActionType)(rng() % 3);
+	spec.repeat = 1 + rng() % 30;
+	spec.delay_down = rng() % 200;
+	spec.delay_up = rng() % 200;
+
+	return spec;
+}
@@ -0,0 +1,314 @@
+// Drives InputDispatcher with scripted key and controller sequences and
+// checks:
+//
+//   - it dispatches exactly the events that calling every key binding every
+//     frame did, in the same order, for random bindings (combinations of
+//     keys, inverted keys and controller buttons and triggers, some of them
+//     auto-repeating or delayed) and random input, including bindings added
+//     part way through and cleared
+//   - bindings whose inputs didn't change aren't evaluated at all, unless
+//     they have a repeat or delayed event pending
+//   - only the keys and controllers some binding watches are polled, each
+//     once per frame however many bindings watch it
+//   - newly added bindings see the current state of their inputs on the
+//     next frame, e.g. an inverted key fires straight away
+//
+// The bindings are copies of the ones in input.cpp - see
+// InputDispatchHarness.h.
+
+#include <stdio.h>
+
+#include "InputDispatchHarness.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// Runs a frame through both the dispatcher and the reference and checks they
+// dispatched the same events:
+static void frame(BindingSet *set, ScriptedSource *source, const char *what)
+{
+	size_t first = set->dispatched_log.events.size();
+	bool dispatched = set->dispatch(source);
+	bool expected = set->dispatch_every_action(source);
+	const std::vector<InputEvent> &got = set->dispatched_log.events;
+	const std::vector<InputEvent> &want = set->reference_log.events;
+	size_t i;
+
+	CHECK(dispatched == expected, "%s: frame %u returned %i, expected %i",
+			what, set->dispatched_log.frame, dispatched, expected);
+
+	if (got.size() != want.size()) {
+		CHECK(false, "%s: frame %u dispatched %zu events, expected %zu", what,
+				set->dispatched_log.frame, got.size() - first, want.size() - first);
+		// Don't report every event after this one as well:
+		set->dispatched_log.events = want;
+		return;
+	}
+	for (i = first; i < got.size(); i++) {
+		CHECK(got[i] == want[i], "%s: frame %u event %zu is binding %i %s, expected binding %i %s",
+				what, got[i].frame, i - first, got[i].binding, got[i].down ? "down" : "up",
+				want[i].binding, want[i].down ? "down" : "up");
+	}
+}
+
+static BindingSpec plain(std::vector<TestInput> inputs)
+{
+	BindingSpec spec;
+
+	spec.button.inputs = inputs;
+	spec.type = TestActionType::PLAIN;
+	spec.repeat = 1;
+	spec.delay_down = spec.delay_up = 0;
+
+	return spec;
+}
+
+static BindingSpec repeating(std::vector<TestInput> inputs, int repeat)
+{
+	BindingSpec spec = plain(inputs);
+
+	spec.type = TestActionType::REPEATING;
+	spec.repeat = repeat;
+
+	return spec;
+}
+
+static BindingSpec delayed(std::vector<TestInput> inputs, int delay_down, int delay_up)
+{
+	BindingSpec spec = plain(inputs);
+
+	spec.type = TestActionType::DELAYED;
+	spec.delay_down = delay_down;
+	spec.delay_up = delay_up;
+
+	return spec;
+}
+
+static const int VK_SHIFT = 0x10, VK_CONTROL = 0x11, VK_A = 0x41, VK_B = 0x42, VK_F10 = 0x79;
+
+static void test_examples()
+{
+	BindingSet set;
+	ScriptedSource source;
+	size_t events;
+	int i;
+
+	set.add(plain({test_key(VK_F10)}));                                          // 0
+	set.add(plain({test_key(VK_CONTROL), test_key(VK_A), test_key(VK_SHIFT, true)})); // 1
+	set.add(plain({test_key(VK_B, true)}));                                      // 2
+	set.add(repeating({test_key(VK_B)}, 10));                                    // 3
+	set.add(delayed({test_key(VK_A)}, 50, 0));                                   // 4
+	set.add(plain({test_gamepad(1, 0x1000, 0)}));                                // 5
+
+	source.now = 1000;
+	frame(&set, &source, "first frame");
+	CHECK(set.dispatched_log.events.size() == 1 && set.dispatched_log.events[0].binding == 2,
+			"only no_b should fire on the first frame");
+
+	// Nothing changes, nothing is evaluated:
+	source.now += 16;
+	set.dispatched_log.dispatches = 0;
+	frame(&set, &source, "idle");
+	CHECK(set.dispatched_log.dispatches == 0, "%llu bindings evaluated when idle",
+			(unsigned long long)set.dispatched_log.dispatches);
+
+	// ctrl, then a: the combination fires, and a starts its delay:
+	source.world.keys[VK_CONTROL] = true;
+	source.now += 16;
+	frame(&set, &source, "ctrl");
+	source.world.keys[VK_A] = true;
+	source.now += 16;
+	events = set.dispatched_log.events.size();
+	frame(&set, &source, "ctrl a");
+	CHECK(set.dispatched_log.events.size() == events + 1 && set.dispatched_log.events.back().binding == 1,
+			"ctrl a didn't fire");
+	for (i = 0; i < 3; i++) {
+		source.now += 20;
+		frame(&set, &source, "a delay");
+	}
+	CHECK(set.dispatched_log.events.back().binding == 4 && set.dispatched_log.events.back().down,
+			"delayed a didn't fire");
+	source.world.keys[VK_SHIFT] = true;
+	source.now += 16;
+	frame(&set, &source, "shift");
+	CHECK(set.dispatched_log.events.back().binding == 1 && !set.dispatched_log.events.back().down,
+			"no_shift didn't release ctrl a");
+
+	// b held auto-repeats ten times a second with nothing else changing,
+	// which at 16ms a frame is every seventh frame, and releases no_b:
+	source.world.keys[VK_B] = true;
+	events = set.dispatched_log.events.size();
+	for (i = 0; i < 63; i++) {
+		source.now += 16;
+		frame(&set, &source, "b held");
+	}
+	CHECK(set.dispatched_log.events.size() - events == 9 + 1, "%zu events while b held",
+			set.dispatched_log.events.size() - events);
+
+	// And stops being evaluated once it has been released:
+	source.world.keys[VK_B] = false;
+	for (i = 0; i < 20; i++) {
+		source.now += 16;
+		frame(&set, &source, "b released");
+	}
+	set.dispatched_log.dispatches = 0;
+	source.now += 16;
+	frame(&set, &source, "idle");
+	CHECK(set.dispatched_log.dispatches == 0, "%llu bindings evaluated after the repeat stopped",
+			(unsigned long long)set.dispatched_log.dispatches);
+
+	// A controller connecting with the button already held:
+	source.world.gamepads[1].connected = true;
+	source.world.gamepads[1].buttons = 0x1000;
+	source.now += 16;
+	frame(&set, &source, "controller");
+	CHECK(set.dispatched_log.events.back().binding == 5 && set.dispatched_log.events.back().down,
+			"controller button didn't fire");
+}
+
+// Two bindings changing in the same frame fire in the order they were added,
+// not the order of their keys, and a binding that listens to several keys
+// that change together is evaluated once:
+static void test_order()
+{
+	BindingSet set;
+	ScriptedSource source;
+
+	set.add(plain({test_key(VK_B)}));
+	set.add(plain({test_key(VK_A)}));
+	set.add(plain({test_key(VK_CONTROL, true), test_key(VK_A, true), test_key(VK_B, true)}));
+	frame(&set, &source, "first frame");
+
+	source.world.keys[VK_A] = source.world.keys[VK_B] = true;
+	set.dispatched_log.dispatches = 0;
+	frame(&set, &source, "a b");
+	CHECK(set.dispatched_log.events.size() == 4, "%zu events", set.dispatched_log.events.size());
+	CHECK(set.dispatched_log.dispatches == 3, "%llu bindings evaluated",
+			(unsigned long long)set.dispatched_log.dispatches);
+}
+
+// Only what is watched is polled, once per frame:
+static void test_polling()
+{
+	BindingSet set;
+	ScriptedSource source;
+	int i;
+
+	for (i = 0; i < 480; i++)
+		set.add(plain({test_key(VK_CONTROL, i & 1), test_key(0x30 + i % 40)}));
+
+	frame(&set, &source, "first frame");
+	source.keys_polled = 0;
+	for (i = 0; i < 10; i++)
+		frame(&set, &source, "idle");
+	CHECK(source.keys_polled == 10 * 41, "%llu keys polled", (unsigned long long)source.keys_polled);
+	CHECK(source.gamepads_polled == 0, "controllers polled with no controller bindings");
+
+	// Only the bindings using the key are evaluated:
+	set.dispatched_log.dispatches = 0;
+	source.world.keys[0x30 + 7] = true;
+	frame(&set, &source, "one key");
+	CHECK(set.dispatched_log.dispatches == 480 / 40, "%llu bindings evaluated",
+			(unsigned long long)set.dispatched_log.dispatches);
+
+	set.add(plain({test_gamepad(2, 1, 0)}));
+	source.gamepads_polled = 0;
+	frame(&set, &source, "controller added");
+	CHECK(source.gamepads_polled == 1, "%llu controllers polled", (unsigned long long)source.gamepads_polled);
+
+	set.clear();
+	source.keys_polled = source.gamepads_polled = 0;
+	CHECK(!set.dispatch(&source), "dispatched with no bindings");
+	CHECK(source.keys_polled == 0 && source.gamepads_polled == 0, "polled with no bindings");
+}
+
+// Presses or releases a few keys and moves the controllers a little:
+static void random_input(std::mt19937 &rng, ScriptedSource *source, int num_keys, bool gamepads)
+{
+	InputGamepadState *gamepad;
+	int vkey;
+
+	while (rng() % 3 == 0) {
+		vkey = 1 + rng() % num_keys;
+		source->world.keys[vkey] = !source->world.keys[vkey];
+	}
+
+	if (gamepads && rng() % 4 == 0) {
+		gamepad = &source->world.gamepads[rng() % INPUT_NUM_GAMEPADS];
+		switch (rng() % 3) {
+		case 0:
+			gamepad->connected = !gamepad->connected;
+			break;
+		case 1:
+			gamepad->buttons ^= 1 << (rng() % 4);
+			break;
+		default:
+			gamepad->left_trigger = (uint8_t)rng();
+		}
+	}
+}
+
+static void test_random()
+{
+	std::mt19937 rng(37);
+	int trial, i, n, events = 0;
+	char what[64];
+
+	for (trial = 0; trial < 200 && failures < 10; trial++) {
+		BindingSet set;
+		ScriptedSource source;
+		int num_keys = 4 + rng() % 12;
+		bool gamepads = rng() % 2;
+
+		snprintf(what, sizeof(what), "trial %i", trial);
+		source.now = rng() % 100000;
+
+		n = rng() % 50;
+		for (i = 0; i < n; i++)
+			set.add(random_binding(rng, num_keys, gamepads));
+
+		for (i = 0; i < 500; i++) {
+			random_input(rng, &source, num_keys, gamepads);
+			source.now += rng() % 3 ? rng() % 40 : 0;
+
+			// Config reloads:
+			if (rng() % 200 == 0) {
+				set.add(random_binding(rng, num_keys, gamepads));
+			} else if (rng() % 400 == 0) {
+				set.clear();
+				n = rng() % 50;
+				for (int j = 0; j < n; j++)
+					set.add(random_binding(rng, num_keys, gamepads));
+			}
+
+			frame(&set, &source, what);
+		}
+
+		events += (int)set.reference_log.events.size();
+	}
+
+	printf("%i events in random trials\n", events);
+	CHECK(events > 10000, "too few events to be useful");
+}
+
+int main()
+{
+	test_examples();
+	test_order();
+	test_polling();
+	test_random();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
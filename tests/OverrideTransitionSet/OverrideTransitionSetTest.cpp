@@ -0,0 +1,390 @@
+// Compares the transitions in OverrideTransitionSet.h with the old
+// per-override implementation (OldOverrideTransition.inc), and checks
+// SortedVectorMap.h against std::map:
+//
+//   - EvaluateTransition gives bit identical values to _UpdateTransition for
+//     linear and cosine curves, over every millisecond of transitions from 0
+//     to 1000ms long, and sampled across longer ones, including a clock that
+//     is behind the activation time
+//   - a transition set and a std::map of transitions that are scheduled,
+//     rescheduled mid-transition, updated at random intervals and stopped the
+//     same way apply the same values to the same keys in the same order, and
+//     agree on which keys are still transitioning and to what
+//   - random insertions, lookups and erasures on a SortedVectorMap and a
+//     std::map leave the same contents in the same order
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "OverrideTransitionSet.h"
+#include "SortedVectorMap.h"
+
+typedef uint64_t ULONGLONG;
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace old_override {
+#include "OldOverrideTransition.inc"
+}
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static uint32_t bits(float val)
+{
+	uint32_t ret;
+
+	memcpy(&ret, &val, sizeof(ret));
+	return ret;
+}
+
+// Stands in for OverrideParam, which needs DirectXMath for its pointer to
+// member, with the same ordering by index and then component:
+struct TestParam
+{
+	int idx;
+	int component;
+};
+static inline bool operator<(const TestParam &lhs, const TestParam &rhs)
+{
+	if (lhs.idx != rhs.idx)
+		return (lhs.idx < rhs.idx);
+	return lhs.component < rhs.component;
+}
+
+static const char *curve_name(TransitionType type)
+{
+	return type == TransitionType::COSINE ? "cosine" : "linear";
+}
+
+static void compare_one(float start, float target, uint64_t activation, int duration,
+		TransitionType type, uint64_t now)
+{
+	old_override::OverrideTransitionParam old_transition;
+	OverrideTransitionParam new_transition;
+	float old_val, new_val, raw_val;
+	int raw_time = duration;
+
+	old_override::_ScheduleTransition(&old_transition, start, target, activation, duration, type);
+	new_transition.start = start;
+	new_transition.target = target;
+	new_transition.activation_time = activation;
+	new_transition.time = duration;
+	new_transition.transition_type = type;
+
+	old_val = old_override::_UpdateTransition(&old_transition, now);
+	new_val = EvaluateTransition(&new_transition, now);
+	raw_val = EvaluateTransition(start, target, activation, &raw_time, type, now);
+
+	CHECK(bits(old_val) == bits(new_val) && bits(old_val) == bits(raw_val),
+			"%s %g -> %g over %ims at +%lldms: old %.9g, new %.9g / %.9g",
+			curve_name(type), start, target, duration, (long long)(now - activation),
+			old_val, new_val, raw_val);
+	CHECK(old_transition.time == new_transition.time && old_transition.time == raw_time,
+			"%s %g -> %g over %ims at +%lldms: time old %i, new %i / %i",
+			curve_name(type), start, target, duration, (long long)(now - activation),
+			old_transition.time, new_transition.time, raw_time);
+
+	// Once finished, both return FLT_MAX from then on:
+	if (old_transition.time == -1) {
+		old_val = old_override::_UpdateTransition(&old_transition, now + 1);
+		new_val = EvaluateTransition(&new_transition, now + 1);
+		CHECK(old_val == FLT_MAX && new_val == FLT_MAX, "finished transition returned %g / %g", old_val, new_val);
+	}
+}
+
+static void test_curves(std::mt19937 &rng)
+{
+	// Including negative durations from a transition = -1 or so in the
+	// d3dx.ini, which the old code didn't reject either:
+	static const int durations[] = { -5, -1, 0, 1, 2, 3, 7, 16, 100, 250, 333, 999, 1000, 1500, 5000, 60000, 0x7fffffff };
+	static const float pairs[][2] = {
+		{ 0, 1 }, { 1, 0 }, { -5, 5 }, { 0.5f, 0.5f }, { 0.1f, 0.3f },
+		{ 1e-30f, -1e-30f }, { -1e6f, 3e7f }, { 100, 20.5f },
+	};
+	static const TransitionType types[] = { TransitionType::LINEAR, TransitionType::COSINE };
+	std::uniform_real_distribution<float> random_val(-100, 100);
+	uint64_t activation = 123456789;
+	float start, target;
+	int d, p, i;
+	int64_t ms;
+
+	for (TransitionType type : types) {
+		for (d = 0; d < (int)(sizeof(durations) / sizeof(durations[0])); d++) {
+			for (p = 0; p < (int)(sizeof(pairs) / sizeof(pairs[0])) + 4; p++) {
+				if (p < (int)(sizeof(pairs) / sizeof(pairs[0]))) {
+					start = pairs[p][0];
+					target = pairs[p][1];
+				} else {
+					start = random_val(rng);
+					target = random_val(rng);
+				}
+
+				// The clock two ms behind the activation time
+				// wraps around to a huge elapsed time:
+				if (durations[d] <= 1000) {
+					for (ms = -2; ms <= durations[d] + 3; ms++)
+						compare_one(start, target, activation, durations[d], type, activation + ms);
+				} else {
+					for (i = 0; i < 2000; i++) {
+						ms = rng() % ((uint64_t)durations[d] * 2001 / 2000 + 1);
+						compare_one(start, target, activation, durations[d], type, activation + ms);
+					}
+					compare_one(start, target, activation, durations[d], type, activation + durations[d] - 1);
+					compare_one(start, target, activation, durations[d], type, activation + durations[d]);
+				}
+			}
+		}
+	}
+}
+
+template <class Key>
+struct Applied
+{
+	Key key;
+	uint32_t val;
+};
+
+template <class Key>
+static bool same_key(const Key &x, const Key &y)
+{
+	return !(x < y) && !(y < x);
+}
+
+// The old lookup of a transition's target in MatchesCurrent and the global
+// save against GetTarget:
+template <class Key>
+static void compare_targets(const char *what, int step,
+		std::map<Key, old_override::OverrideTransitionParam> &old_set,
+		OverrideTransitionSet<Key> &new_set, const std::vector<Key> &keys)
+{
+	float old_target, new_target;
+	bool old_found, new_found;
+
+	for (const Key &key : keys) {
+		auto transition = old_set.find(key);
+		old_found = transition != old_set.end() && transition->second.time != -1;
+		old_target = old_found ? transition->second.target : 0;
+		new_target = 0;
+		new_found = new_set.GetTarget(key, &new_target);
+		CHECK(old_found == new_found && bits(old_target) == bits(new_target),
+				"%s: step %i: target %i %g, expected %i %g", what, step,
+				new_found, new_target, old_found, old_target);
+	}
+}
+
+template <class Key>
+static void compare_sets(const char *what, const std::vector<Key> &keys, std::mt19937 &rng)
+{
+	static const int durations[] = { -1, 0, 1, 16, 100, 333, 1000, 2500 };
+	std::map<Key, old_override::OverrideTransitionParam> old_set;
+	OverrideTransitionSet<Key> new_set;
+	std::map<Key, float> current;
+	std::vector<Applied<Key>> old_applied, new_applied;
+	std::uniform_real_distribution<float> random_val(-10, 10);
+	uint64_t now = 5000000;
+	TransitionType type;
+	float target;
+	int step, n, i, duration, mismatched_steps = 0;
+	size_t j;
+
+	for (const Key &key : keys)
+		current[key] = 0;
+
+	for (step = 0; step < 20000; step++) {
+		// Sometimes several updates happen in the same millisecond:
+		now += rng() % 40;
+
+		if (rng() % 10 == 0) {
+			n = 1 + rng() % 10;
+			duration = durations[rng() % (sizeof(durations) / sizeof(durations[0]))];
+			type = rng() % 2 ? TransitionType::COSINE : TransitionType::LINEAR;
+			for (i = 0; i < n; i++) {
+				const Key &key = keys[rng() % keys.size()];
+				target = random_val(rng);
+				old_override::_ScheduleTransition(&old_set[key], current[key], target, now, duration, type);
+				new_set.Schedule(key, current[key], target, now, duration, type);
+			}
+		}
+
+		if (rng() % 500 == 0) {
+			old_set.clear();
+			new_set.clear();
+		}
+
+		// Overrides look up the targets when they are activated, which
+		// can be before the next update, the only time a finished
+		// transition (with a negative duration) can be seen:
+		compare_targets(what, step, old_set, new_set, keys);
+
+		old_applied.clear();
+		new_applied.clear();
+		if (!old_set.empty()) {
+			old_override::update_transitions(&old_set, now, [&](const Key &key, float val) {
+				old_applied.push_back({key, bits(val)});
+				current[key] = val;
+			});
+		}
+		new_set.Update(now, [&](const Key &key, float val) {
+			new_applied.push_back({key, bits(val)});
+		});
+
+		bool same = old_applied.size() == new_applied.size();
+		for (j = 0; same && j < old_applied.size(); j++) {
+			same = same_key(old_applied[j].key, new_applied[j].key)
+			    && old_applied[j].val == new_applied[j].val;
+		}
+		if (!same && mismatched_steps++ < 5)
+			CHECK(false, "%s: step %i at %llu: old applied %zu values, new %zu, or they differ",
+					what, step, (unsigned long long)now, old_applied.size(), new_applied.size());
+
+		CHECK(old_set.size() == new_set.size(), "%s: step %i: %zu transitions left, expected %zu",
+				what, step, new_set.size(), old_set.size());
+		CHECK(old_set.empty() == new_set.empty(), "%s: step %i: empty() wrong", what, step);
+
+		compare_targets(what, step, old_set, new_set, keys);
+	}
+	CHECK(mismatched_steps == 0, "%s: %i steps applied different values", what, mismatched_steps);
+}
+
+static void test_sets(std::mt19937 &rng)
+{
+	std::vector<TestParam> params;
+	std::vector<float*> vars;
+	static float var_storage[16];
+	int idx, component;
+
+	for (idx = 0; idx < 8; idx++) {
+		for (component = 0; component < 4; component++)
+			params.push_back({ idx, component });
+	}
+	for (float &var : var_storage)
+		vars.push_back(&var);
+
+	compare_sets("params", params, rng);
+	compare_sets("vars", vars, rng);
+}
+
+template <class Key, class T>
+static bool same_contents(const SortedVectorMap<Key, T> &sorted, const std::map<Key, T> &map)
+{
+	auto i = sorted.begin();
+	auto j = map.begin();
+
+	if (sorted.size() != map.size() || sorted.empty() != map.empty())
+		return false;
+	for (; i != sorted.end() && j != map.end(); i++, j++) {
+		if (!same_key(i->first, j->first) || !(i->second == j->second))
+			return false;
+	}
+	return i == sorted.end() && j == map.end();
+}
+
+template <class Key>
+static void compare_maps(const char *what, Key (*make_key)(std::mt19937 &rng), std::mt19937 &rng)
+{
+	SortedVectorMap<Key, unsigned> sorted;
+	std::map<Key, unsigned> map;
+	const SortedVectorMap<Key, unsigned> &const_sorted = sorted;
+	int step, mismatched_steps = 0;
+	unsigned val;
+
+	for (step = 0; step < 20000; step++) {
+		Key key = make_key(rng);
+		val = rng();
+
+		switch (rng() % 8) {
+			case 0:
+			case 1:
+			case 2:
+				sorted[key] = val;
+				map[key] = val;
+				break;
+			case 3:
+				sorted[key] += val;
+				map[key] += val;
+				break;
+			case 4:
+			case 5: {
+				auto i = sorted.find(key);
+				auto j = map.find(key);
+				CHECK((i == sorted.end()) == (j == map.end()), "%s: step %i: find disagrees", what, step);
+				if (i != sorted.end() && j != map.end()) {
+					i = sorted.erase(i);
+					j = map.erase(j);
+					CHECK((i == sorted.end()) == (j == map.end()) &&
+						(i == sorted.end() || same_key(i->first, j->first)),
+						"%s: step %i: erase returned the wrong position", what, step);
+				}
+				break;
+			}
+			case 6: {
+				auto i = const_sorted.find(key);
+				auto j = map.find(key);
+				CHECK((i == const_sorted.end()) == (j == map.end()) &&
+					(i == const_sorted.end() || i->second == j->second),
+					"%s: step %i: const find disagrees", what, step);
+				break;
+			}
+			case 7:
+				if (rng() % 200 == 0) {
+					sorted.clear();
+					map.clear();
+				}
+				break;
+		}
+
+		if (!same_contents(sorted, map) && mismatched_steps++ < 5)
+			CHECK(false, "%s: step %i: %zu entries, expected %zu, or they differ",
+					what, step, sorted.size(), map.size());
+	}
+	CHECK(mismatched_steps == 0, "%s: %i steps left different contents", what, mismatched_steps);
+}
+
+static int make_int_key(std::mt19937 &rng)
+{
+	return (int)(rng() % 300) - 150;
+}
+
+static TestParam make_param_key(std::mt19937 &rng)
+{
+	return { (int)(rng() % 64), (int)(rng() % 4) };
+}
+
+static std::string make_string_key(std::mt19937 &rng)
+{
+	return std::string("$var") + std::to_string(rng() % 100);
+}
+
+int main()
+{
+	std::mt19937 rng(38);
+
+	test_curves(rng);
+	test_sets(rng);
+	compare_maps("int", make_int_key, rng);
+	compare_maps("param", make_param_key, rng);
+	compare_maps("string", make_string_key, rng);
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
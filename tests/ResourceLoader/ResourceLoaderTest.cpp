@@ -0,0 +1,509 @@
+// Drives ResourceFileLoader with a mock file system and checks:
+//
+//   - every take() gets the right contents, or the reader's error, with any
+//     number of workers (including none) and with a small memory budget
+//   - a file prefetched by several resources is read once, and each take()
+//     gets its own copy
+//   - a file that was never prefetched is read by take() on the caller
+//   - one worker reads the files in the order they were prefetched, and
+//     what has been read but not taken is counted against the budget
+//   - the workers stop at the memory budget and resume as files are taken
+//   - take() reads a file that is still queued itself instead of waiting
+//     behind the queue, and waits for one a worker is part way through
+//     rather than reading it again
+//   - clear() throws away what was read, including a read in progress, but a
+//     take() already waiting on that read still gets it
+//   - destroying the loader while a worker is part way through a read, with
+//     more files queued, leaves the worker to finish that read safely and
+//     read nothing more
+//
+// Best also run with -fsanitize=address and -fsanitize=thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+
+#include "ResourceLoader.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// Lets a read be held until the test is ready for it to finish:
+class Gate
+{
+	std::mutex lock;
+	std::condition_variable cv;
+	bool open;
+
+public:
+	Gate() : open(false) {}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		cv.wait(guard, [&]() { return open; });
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		open = true;
+		cv.notify_all();
+	}
+};
+
+// The mock file system. Every path is a file whose size and contents depend
+// on the path, except those containing "missing", which can't be opened.
+// Reads of held_path wait at read_gate. Never destroyed, since workers left
+// behind by test_destroy_while_busy() may still be using them at exit:
+static std::mutex fs_lock;
+static std::map<std::wstring, int> &reads = *new std::map<std::wstring, int>;
+static std::vector<std::wstring> &read_order = *new std::vector<std::wstring>;
+static std::map<std::wstring, std::thread::id> &read_on = *new std::map<std::wstring, std::thread::id>;
+static std::wstring &held_path = *new std::wstring;
+static Gate *read_gate;
+static std::atomic<int> reads_started, reads_finished;
+
+static size_t file_size(const std::wstring &path)
+{
+	return 1000 + path.size() * 10;
+}
+
+static unsigned char file_byte(const std::wstring &path, size_t i)
+{
+	return (unsigned char)(path.size() * 7 + path.back() + i);
+}
+
+static void mock_reader(const std::wstring &path, ResourceFile *file)
+{
+	Gate *gate = NULL;
+	size_t i, size;
+
+	reads_started++;
+	{
+		std::lock_guard<std::mutex> guard(fs_lock);
+		reads[path]++;
+		read_order.push_back(path);
+		read_on[path] = std::this_thread::get_id();
+		if (path == held_path)
+			gate = read_gate;
+	}
+
+	if (gate)
+		gate->wait();
+
+	if (path.find(L"missing") != std::wstring::npos) {
+		file->status = ResourceFileStatus::OPEN_FAILED;
+		file->error = 2;
+	} else {
+		size = file_size(path);
+		file->buf = malloc(size);
+		for (i = 0; i < size; i++)
+			((unsigned char*)file->buf)[i] = file_byte(path, i);
+		file->size = size;
+	}
+
+	reads_finished++;
+}
+
+static void reset_fs()
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+
+	reads.clear();
+	read_order.clear();
+	read_on.clear();
+	held_path.clear();
+	read_gate = NULL;
+	reads_started = reads_finished = 0;
+}
+
+static void hold_read(const std::wstring &path, Gate *gate)
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+
+	held_path = path;
+	read_gate = gate;
+}
+
+static int read_count(const std::wstring &path)
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+	return reads.count(path) ? reads[path] : 0;
+}
+
+static std::thread::id reader_thread(const std::wstring &path)
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+	return read_on[path];
+}
+
+// A worker or take() is stuck for good, so the test can't go on:
+static void give_up(const char *what)
+{
+	CHECK(false, "%s", what);
+	printf("%d failures\n", failures);
+	fflush(stdout);
+	_Exit(1);
+}
+
+static void wait_for(std::atomic<int> &count, int n, const char *what)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+	while (count < n) {
+		if (std::chrono::steady_clock::now() > deadline)
+			give_up(what);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+// Gives the workers time to do whatever they are going to do:
+static void settle()
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+static bool intact(const std::wstring &path, const ResourceFile &file)
+{
+	size_t i;
+
+	if (file.status != ResourceFileStatus::OK || !file.buf || file.size != file_size(path))
+		return false;
+	for (i = 0; i < file.size; i++) {
+		if (((unsigned char*)file.buf)[i] != file_byte(path, i))
+			return false;
+	}
+	return true;
+}
+
+static std::wstring file_name(int i)
+{
+	return L"Mods\\mod\\f" + std::to_wstring(i) + (i % 17 == 3 ? L"missing.dds" : L".buf");
+}
+
+static void take_all(ResourceFileLoader *loader, int n, const char *config)
+{
+	ResourceFile file;
+	std::wstring path;
+	int i;
+
+	// Backwards, so the later files are often taken before a worker has
+	// got to them:
+	for (i = n - 1; i >= 0; i--) {
+		path = file_name(i);
+		if (i == 5)
+			continue; // Already taken by both its users
+		loader->take(path, &file);
+		if (path.find(L"missing") != std::wstring::npos) {
+			CHECK(file.status == ResourceFileStatus::OPEN_FAILED && file.error == 2 && !file.buf,
+					"%s: %ls didn't fail", config, path.c_str());
+		} else {
+			CHECK(intact(path, file), "%s: %ls wrong", config, path.c_str());
+		}
+		free(file.buf);
+		CHECK(read_count(path) == 1, "%s: %ls read %i times", config, path.c_str(), read_count(path));
+	}
+}
+
+static void test_contents()
+{
+	static const size_t budgets[] = {1 << 30, 10000};
+	ResourceFile file, copy;
+	unsigned threads;
+	char config[64];
+	int i;
+
+	for (threads = 0; threads <= 4; threads++) {
+		for (size_t budget : budgets) {
+			ResourceFileLoader loader(mock_reader);
+
+			snprintf(config, sizeof(config), "%u workers, %zu budget", threads, budget);
+			reset_fs();
+			loader.configure(threads, budget);
+
+			for (i = 0; i < 100; i++)
+				loader.prefetch(file_name(i));
+			// Used by two resources:
+			loader.prefetch(file_name(5));
+
+			loader.take(file_name(5), &file);
+			loader.take(file_name(5), &copy);
+			CHECK(intact(file_name(5), file) && intact(file_name(5), copy) && file.buf != copy.buf,
+					"%s: shared file not copied", config);
+			free(file.buf);
+			free(copy.buf);
+
+			take_all(&loader, 100, config);
+			CHECK(loader.memory_in_use() == 0, "%s: %zu bytes left", config, loader.memory_in_use());
+		}
+	}
+}
+
+static void test_not_prefetched()
+{
+	ResourceFileLoader loader(mock_reader);
+	ResourceFile file;
+
+	reset_fs();
+	loader.configure(2, 1 << 30);
+	loader.take(L"never.dds", &file);
+	CHECK(intact(L"never.dds", file), "wrong contents");
+	CHECK(reader_thread(L"never.dds") == std::this_thread::get_id(), "not read on the caller");
+	free(file.buf);
+	CHECK(loader.memory_in_use() == 0, "%zu bytes in use", loader.memory_in_use());
+}
+
+static void test_order()
+{
+	ResourceFileLoader loader(mock_reader);
+	size_t expected = 0;
+	int i;
+
+	reset_fs();
+	loader.configure(1, 1 << 30);
+	for (i = 0; i < 20; i++) {
+		loader.prefetch(L"o" + std::to_wstring(i));
+		expected += file_size(L"o" + std::to_wstring(i));
+	}
+	wait_for(reads_finished, 20, "the prefetched reads");
+	settle();
+
+	{
+		std::lock_guard<std::mutex> guard(fs_lock);
+		CHECK(read_order.size() == 20, "%zu reads", read_order.size());
+		for (i = 0; i < (int)read_order.size(); i++)
+			CHECK(read_order[i] == L"o" + std::to_wstring(i), "read %i was %ls", i, read_order[i].c_str());
+	}
+	CHECK(loader.memory_in_use() == expected, "%zu bytes in use, expected %zu", loader.memory_in_use(), expected);
+
+	loader.clear();
+	CHECK(loader.memory_in_use() == 0, "%zu bytes in use after clear()", loader.memory_in_use());
+}
+
+static void test_budget()
+{
+	static const size_t BUDGET = 5000;
+	ResourceFileLoader loader(mock_reader);
+	ResourceFile file;
+	int i, before;
+
+	reset_fs();
+	loader.configure(2, BUDGET);
+	for (i = 0; i < 100; i++)
+		loader.prefetch(L"b" + std::to_wstring(i));
+	settle();
+
+	// Each worker stops once it sees the budget has been reached, so
+	// each can go over by the one file it was reading:
+	before = reads_finished;
+	CHECK(loader.memory_in_use() >= BUDGET && loader.memory_in_use() < BUDGET + 2 * file_size(L"b00"),
+			"%zu bytes read with a budget of %zu", loader.memory_in_use(), BUDGET);
+	CHECK(before < 10, "%i files read with a budget of %zu", before, BUDGET);
+
+	// Taking files frees up budget for the workers to carry on:
+	for (i = 0; i < before; i++) {
+		loader.take(L"b" + std::to_wstring(i), &file);
+		free(file.buf);
+	}
+	settle();
+	CHECK(reads_finished > before, "workers didn't resume");
+
+	for (i = before; i < 100; i++) {
+		loader.take(L"b" + std::to_wstring(i), &file);
+		CHECK(intact(L"b" + std::to_wstring(i), file), "b%i wrong", i);
+		free(file.buf);
+	}
+	CHECK(reads_finished == 100, "%i reads", (int)reads_finished);
+	CHECK(loader.memory_in_use() == 0, "%zu bytes in use", loader.memory_in_use());
+}
+
+static void test_jump_queue()
+{
+	ResourceFileLoader loader(mock_reader);
+	ResourceFile file;
+	Gate gate;
+	int i;
+
+	reset_fs();
+	hold_read(L"q0", &gate);
+	loader.configure(1, 1 << 30);
+	for (i = 0; i < 50; i++)
+		loader.prefetch(L"q" + std::to_wstring(i));
+	wait_for(reads_started, 1, "the first read");
+
+	// The only worker is stuck on q0, so q40 has to be read here:
+	loader.take(L"q40", &file);
+	CHECK(intact(L"q40", file), "wrong contents");
+	CHECK(reader_thread(L"q40") == std::this_thread::get_id(), "not read on the caller");
+	free(file.buf);
+
+	gate.release();
+	for (i = 0; i < 50; i++) {
+		if (i == 40)
+			continue;
+		loader.take(L"q" + std::to_wstring(i), &file);
+		CHECK(intact(L"q" + std::to_wstring(i), file), "q%i wrong", i);
+		CHECK(read_count(L"q" + std::to_wstring(i)) == 1, "q%i read %i times", i, read_count(L"q" + std::to_wstring(i)));
+		free(file.buf);
+	}
+}
+
+static void test_wait_for_worker()
+{
+	ResourceFileLoader loader(mock_reader);
+	std::atomic<int> taken(0);
+	std::thread taker;
+	ResourceFile file;
+	Gate gate;
+
+	reset_fs();
+	hold_read(L"w", &gate);
+	loader.configure(1, 1 << 30);
+	loader.prefetch(L"w");
+	wait_for(reads_started, 1, "the worker's read");
+
+	taker = std::thread([&]() {
+		loader.take(L"w", &file);
+		taken++;
+	});
+	settle();
+	CHECK(!taken, "take() returned before the read finished");
+
+	gate.release();
+	wait_for(taken, 1, "take() of a file being read");
+	taker.join();
+	CHECK(intact(L"w", file), "wrong contents");
+	CHECK(read_count(L"w") == 1, "read %i times", read_count(L"w"));
+	free(file.buf);
+}
+
+static void test_clear()
+{
+	ResourceFileLoader loader(mock_reader);
+	ResourceFile file;
+	Gate gate;
+	int i;
+
+	reset_fs();
+	hold_read(L"c0", &gate);
+	loader.configure(1, 1 << 30);
+	for (i = 0; i < 10; i++)
+		loader.prefetch(L"c" + std::to_wstring(i));
+	wait_for(reads_started, 1, "the first read");
+
+	// c0 is part way through being read, the rest are still queued:
+	loader.clear();
+	gate.release();
+	wait_for(reads_finished, 1, "the read in progress");
+	settle();
+	CHECK(reads_finished == 1, "%i files read after clear()", (int)reads_finished);
+	CHECK(loader.memory_in_use() == 0, "%zu bytes of a cancelled read counted", loader.memory_in_use());
+
+	// Read again from scratch afterwards, e.g. after a config reload:
+	loader.prefetch(L"c0");
+	loader.take(L"c0", &file);
+	CHECK(intact(L"c0", file), "wrong contents");
+	CHECK(read_count(L"c0") == 2, "read %i times", read_count(L"c0"));
+	free(file.buf);
+	loader.take(L"c5", &file);
+	CHECK(intact(L"c5", file), "wrong contents");
+	free(file.buf);
+	CHECK(loader.memory_in_use() == 0, "%zu bytes in use", loader.memory_in_use());
+}
+
+static void test_clear_while_waiting()
+{
+	ResourceFileLoader loader(mock_reader);
+	std::atomic<int> taken(0);
+	std::thread taker;
+	ResourceFile file;
+	Gate gate;
+
+	reset_fs();
+	hold_read(L"cw", &gate);
+	loader.configure(1, 1 << 30);
+	loader.prefetch(L"cw");
+	wait_for(reads_started, 1, "the worker's read");
+
+	taker = std::thread([&]() {
+		loader.take(L"cw", &file);
+		taken++;
+	});
+	settle();
+	loader.clear();
+	gate.release();
+	wait_for(taken, 1, "take() of a cleared file being read");
+	taker.join();
+	CHECK(intact(L"cw", file), "wrong contents");
+	CHECK(read_count(L"cw") == 1, "read %i times", read_count(L"cw"));
+	CHECK(loader.memory_in_use() == 0, "%zu bytes in use", loader.memory_in_use());
+	free(file.buf);
+}
+
+static void test_destroy_while_busy()
+{
+	ResourceFileLoader *loader;
+	Gate gate;
+	int i;
+
+	reset_fs();
+	hold_read(L"d0", &gate);
+	loader = new ResourceFileLoader(mock_reader);
+	loader->configure(1, 1 << 30);
+	for (i = 0; i < 20; i++)
+		loader->prefetch(L"d" + std::to_wstring(i));
+	wait_for(reads_started, 1, "the first read");
+
+	// As at DLL unload, where the workers are detached rather than
+	// joined. The worker still has to store what it read and count it:
+	delete loader;
+	gate.release();
+	wait_for(reads_finished, 1, "the read in progress");
+	settle();
+	CHECK(reads_started == 1, "%i files read after the loader was destroyed", (int)reads_started);
+
+	// Several workers, some part way through a read and some between
+	// reads, each time:
+	for (i = 0; i < 20; i++) {
+		reset_fs();
+		loader = new ResourceFileLoader(mock_reader);
+		loader->configure(4, 1 << 30);
+		for (int j = 0; j < 50; j++)
+			loader->prefetch(L"e" + std::to_wstring(j));
+		if (i & 1)
+			std::this_thread::yield();
+		delete loader;
+	}
+	settle();
+}
+
+int main()
+{
+	test_contents();
+	test_not_prefetched();
+	test_order();
+	test_budget();
+	test_jump_queue();
+	test_wait_for_worker();
+	test_clear();
+	test_clear_while_waiting();
+	test_destroy_while_busy();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
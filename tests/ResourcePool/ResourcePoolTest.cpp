@@ -0,0 +1,523 @@
+// Runs the resource pool from CommandList.cpp (ResourcePool.cpp.inc,
+// generated by CMakeLists.txt) against a mock D3D11 device, and checks the
+// LRU eviction, the per-pool and global budgets, expiry of idle resources,
+// device mismatches, failed creations and the reference counts. The mock
+// device and LogInfo() also check that resource_pools_lock is not held while
+// creating a resource or logging, and several threads share the pools with
+// the present thread expiring them to check the locking.
+//
+// The types below are cut down stand-ins for the D3D11 and 3DMigoto types
+// with just the parts the pool uses.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+typedef unsigned UINT;
+typedef long HRESULT;
+#define S_OK ((HRESULT)0)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000e)
+#define FAILED(hr) ((HRESULT)(hr) < 0)
+#define __stdcall
+#define THIS_
+
+// As in windows.h:
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+
+// ----------------------------------------------------------------------------
+// Locks. CRITICAL_SECTIONs are recursive, and we track the owner so the mock
+// device and LogInfo() can check that the pool lock is not held.
+
+struct CRITICAL_SECTION
+{
+	std::recursive_mutex mutex;
+	std::atomic<std::thread::id> owner;
+	int depth;
+};
+
+static void EnterCriticalSectionPretty(CRITICAL_SECTION *lock)
+{
+	lock->mutex.lock();
+	lock->owner = std::this_thread::get_id();
+	lock->depth++;
+}
+
+static void LeaveCriticalSection(CRITICAL_SECTION *lock)
+{
+	if (!--lock->depth)
+		lock->owner = std::thread::id();
+	lock->mutex.unlock();
+}
+
+static bool held_by_this_thread(CRITICAL_SECTION *lock)
+{
+	return lock->owner == std::this_thread::get_id();
+}
+
+extern CRITICAL_SECTION resource_pools_lock;
+static std::atomic<int> called_with_lock_held(0);
+
+// ----------------------------------------------------------------------------
+// Logging. LogDebug() is allowed under the lock, as the pool only uses it for
+// evictions, which are rare and off by default.
+
+#define LogDebug(fmt, ...) do {} while (0)
+#define LogInfo(fmt, ...) do { \
+	if (held_by_this_thread(&resource_pools_lock)) \
+		called_with_lock_held++; \
+} while (0)
+
+// ----------------------------------------------------------------------------
+// D3D11
+
+enum DXGI_FORMAT {
+	DXGI_FORMAT_UNKNOWN = 0,
+	DXGI_FORMAT_R8G8B8A8_UNORM = 28,
+	DXGI_FORMAT_R32_FLOAT = 41,
+	DXGI_FORMAT_BC1_UNORM = 71,
+};
+
+static UINT dxgi_format_size(DXGI_FORMAT format)
+{
+	switch (format) {
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R32_FLOAT:
+			return 4;
+		default:
+			return 0;
+	}
+}
+
+struct DXGI_SAMPLE_DESC { UINT Count, Quality; };
+struct D3D11_SUBRESOURCE_DATA;
+
+struct D3D11_BUFFER_DESC {
+	UINT ByteWidth, Usage, BindFlags, CPUAccessFlags, MiscFlags, StructureByteStride;
+};
+struct D3D11_TEXTURE1D_DESC {
+	UINT Width, MipLevels, ArraySize;
+	DXGI_FORMAT Format;
+	UINT Usage, BindFlags, CPUAccessFlags, MiscFlags;
+};
+struct D3D11_TEXTURE2D_DESC {
+	UINT Width, Height, MipLevels, ArraySize;
+	DXGI_FORMAT Format;
+	DXGI_SAMPLE_DESC SampleDesc;
+	UINT Usage, BindFlags, CPUAccessFlags, MiscFlags;
+};
+struct D3D11_TEXTURE3D_DESC {
+	UINT Width, Height, Depth, MipLevels;
+	DXGI_FORMAT Format;
+	UINT Usage, BindFlags, CPUAccessFlags, MiscFlags;
+};
+
+static std::atomic<int> live_resources(0);
+
+class ID3D11Resource
+{
+	std::atomic<unsigned long> refs;
+public:
+	ID3D11Resource() : refs(1) { live_resources++; }
+	virtual ~ID3D11Resource() { live_resources--; }
+
+	unsigned long AddRef() { return ++refs; }
+	unsigned long Release()
+	{
+		unsigned long ret = --refs;
+		if (!ret)
+			delete this;
+		return ret;
+	}
+	unsigned long refcount() { return refs; }
+};
+
+template <typename DescType>
+class MockResource : public ID3D11Resource
+{
+public:
+	DescType desc;
+	void GetDesc(DescType *desc) { *desc = this->desc; }
+};
+typedef MockResource<D3D11_BUFFER_DESC> ID3D11Buffer;
+typedef MockResource<D3D11_TEXTURE2D_DESC> ID3D11Texture2D;
+
+class ID3D11Device
+{
+	template <typename ResourceType, typename DescType>
+	HRESULT create(const DescType *desc, ResourceType **resource)
+	{
+		creates++;
+		if (held_by_this_thread(&resource_pools_lock))
+			called_with_lock_held++;
+		if (fail) {
+			*resource = NULL;
+			return E_OUTOFMEMORY;
+		}
+		*resource = new ResourceType();
+		(*resource)->desc = *desc;
+		return S_OK;
+	}
+
+public:
+	std::atomic<int> creates;
+	bool fail;
+
+	ID3D11Device() : creates(0), fail(false) {}
+
+	HRESULT CreateBuffer(const D3D11_BUFFER_DESC *desc, const D3D11_SUBRESOURCE_DATA*, ID3D11Buffer **buffer)
+	{
+		return create(desc, buffer);
+	}
+	HRESULT CreateTexture2D(const D3D11_TEXTURE2D_DESC *desc, const D3D11_SUBRESOURCE_DATA*, ID3D11Texture2D **tex)
+	{
+		return create(desc, tex);
+	}
+};
+
+template <typename DescType>
+static void LogResourceDesc(const DescType*) {}
+template <typename DescType>
+static void LogDebugResourceDesc(const DescType*) {}
+
+// ----------------------------------------------------------------------------
+// 3DMigoto
+
+namespace Profiling {
+	struct Overhead {};
+	static Overhead resource_pool_lookup_overhead;
+	static unsigned resources_created;
+	static unsigned resource_pool_swaps;
+	static unsigned resource_pool_evictions;
+
+	template <typename T>
+	static typename T::iterator lookup_map(T &map, typename T::key_type key, Overhead*)
+	{
+		return map.find(key);
+	}
+}
+
+static uint32_t crc32c_hw(uint32_t seed, const void *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char*)buf;
+	uint32_t hash = seed ^ 2166136261u;
+
+	while (len--)
+		hash = (hash ^ *p++) * 16777619u;
+	return hash;
+}
+
+struct Globals
+{
+	unsigned frame_no;
+	unsigned resource_pool_expire_frames;
+	size_t resource_pool_budget;
+	size_t resource_pool_global_budget;
+};
+static Globals globals;
+static Globals *G = &globals;
+
+struct CommandListState
+{
+	ID3D11Device *mOrigDevice1;
+};
+
+#include "ResourcePool.h.inc"
+
+CRITICAL_SECTION resource_pools_lock;
+ResourcePool *resource_pools;
+size_t resource_pools_count;
+size_t resource_pools_size;
+
+#include "ResourcePool.cpp.inc"
+
+// ----------------------------------------------------------------------------
+
+static std::wstring ini_line = L"[ResourceTest]";
+
+static D3D11_BUFFER_DESC buffer_desc(UINT size)
+{
+	D3D11_BUFFER_DESC desc;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.ByteWidth = size;
+	return desc;
+}
+
+// Gets a buffer of the given size from the pool, as a copy operation would,
+// and returns it with the reference the caller would own:
+static ID3D11Buffer* get_buffer(ResourcePool *pool, ID3D11Device *device, UINT size, ID3D11Buffer *dst = NULL)
+{
+	CommandListState state;
+	D3D11_BUFFER_DESC desc = buffer_desc(size);
+	ID3D11Buffer src;
+
+	state.mOrigDevice1 = device;
+	return GetResourceFromPool<ID3D11Buffer, D3D11_BUFFER_DESC, &ID3D11Device::CreateBuffer>
+		(&ini_line, &src, dst, pool, &state, &desc);
+}
+
+static bool pool_has(ResourcePool *pool, UINT size)
+{
+	D3D11_BUFFER_DESC desc = buffer_desc(size);
+
+	return pool->cache.count(crc32c_hw(0, &desc, sizeof(desc))) != 0;
+}
+
+static void reset_globals()
+{
+	G->frame_no = 1;
+	G->resource_pool_expire_frames = 0;
+	G->resource_pool_budget = 0;
+	G->resource_pool_global_budget = 0;
+	Profiling::resource_pool_evictions = 0;
+}
+
+static void test_cache_hits()
+{
+	ResourcePool pool;
+	ID3D11Device device;
+	ID3D11Buffer *a, *b, *c;
+
+	reset_globals();
+
+	a = get_buffer(&pool, &device, 100);
+	CHECK(a && device.creates == 1, "first buffer");
+	CHECK(pool.size == 100 && resource_pools_size == 100, "pool size %zu, total %zu", pool.size, resource_pools_size);
+
+	// Already the destination, so nothing to switch to:
+	CHECK(!get_buffer(&pool, &device, 100, a), "switched to the current buffer");
+
+	b = get_buffer(&pool, &device, 200);
+	CHECK(b && b != a && device.creates == 2, "second buffer");
+
+	// Switching back comes from the pool, with its own reference:
+	c = get_buffer(&pool, &device, 100, b);
+	CHECK(c == a && device.creates == 2, "switching back created a new buffer");
+	CHECK(a->refcount() == 3, "refcount %lu", a->refcount());
+
+	a->Release();
+	b->Release();
+	c->Release();
+}
+
+static void test_device_mismatch_and_failures()
+{
+	ResourcePool pool;
+	ID3D11Device device1, device2;
+	ID3D11Buffer *a, *b;
+
+	reset_globals();
+
+	a = get_buffer(&pool, &device1, 100);
+	b = get_buffer(&pool, &device2, 100);
+	CHECK(b && b != a && device2.creates == 1, "device mismatch reused the old buffer");
+	CHECK(pool.cache.size() == 1 && pool.size == 100, "%zu entries, %zu bytes", pool.cache.size(), pool.size);
+	CHECK(a->refcount() == 1, "old buffer still referenced by the pool");
+	a->Release();
+	b->Release();
+
+	// A failed creation is not retried:
+	device1.fail = true;
+	CHECK(!get_buffer(&pool, &device1, 300), "failed creation returned a buffer");
+	CHECK(!get_buffer(&pool, &device1, 300), "failed creation returned a buffer");
+	CHECK(device1.creates == 2, "failed creation retried, %i creates", (int)device1.creates);
+	CHECK(pool.size == 100, "failed creation counted towards the pool size");
+}
+
+static void test_pool_budget()
+{
+	ResourcePool pool;
+	ID3D11Device device;
+	ID3D11Buffer *buf;
+	UINT i;
+
+	reset_globals();
+	G->resource_pool_budget = 1000;
+
+	// Each on its own frame, so each is older than the next:
+	for (i = 1; i <= 4; i++) {
+		G->frame_no++;
+		buf = get_buffer(&pool, &device, i * 100);
+		buf->Release();
+	}
+	CHECK(pool.size == 1000, "pool size %zu", pool.size);
+
+	// Touching the oldest makes the 200 byte buffer the LRU:
+	G->frame_no++;
+	get_buffer(&pool, &device, 100)->Release();
+
+	G->frame_no++;
+	get_buffer(&pool, &device, 150)->Release();
+	CHECK(!pool_has(&pool, 200) && pool_has(&pool, 100) && pool_has(&pool, 150), "wrong buffer evicted");
+	CHECK(pool.size == 950 && resource_pools_size == 950, "pool size %zu, total %zu", pool.size, resource_pools_size);
+
+	// Resources used this frame may still be bound, so the pool is
+	// allowed to go over budget rather than evict them, and the one just
+	// added is never evicted even if it alone is over budget:
+	G->frame_no++;
+	get_buffer(&pool, &device, 100)->Release();
+	get_buffer(&pool, &device, 150)->Release();
+	get_buffer(&pool, &device, 300)->Release();
+	get_buffer(&pool, &device, 400)->Release();
+	get_buffer(&pool, &device, 5000)->Release();
+	CHECK(pool.cache.size() == 5 && pool.size == 5950, "%zu entries, %zu bytes", pool.cache.size(), pool.size);
+	CHECK(Profiling::resource_pool_evictions == 1, "%u evictions", Profiling::resource_pool_evictions);
+
+	// On the next frame they can be evicted again:
+	G->frame_no++;
+	get_buffer(&pool, &device, 50)->Release();
+	CHECK(pool_has(&pool, 50) && !pool_has(&pool, 5000) && pool.size <= 1000,
+			"%zu entries, %zu bytes after a new frame", pool.cache.size(), pool.size);
+}
+
+static void test_global_budget_and_expiry()
+{
+	ResourcePool pool1, pool2;
+	ID3D11Device device;
+
+	reset_globals();
+	G->resource_pool_global_budget = 1000;
+
+	G->frame_no = 10;
+	get_buffer(&pool1, &device, 400)->Release();
+	G->frame_no = 11;
+	get_buffer(&pool2, &device, 400)->Release();
+	G->frame_no = 12;
+	get_buffer(&pool1, &device, 300)->Release();
+	CHECK(resource_pools_size == 1100, "total %zu", resource_pools_size);
+
+	// The oldest across all pools goes first:
+	ExpireResourcePools();
+	CHECK(!pool_has(&pool1, 400) && pool_has(&pool2, 400) && pool_has(&pool1, 300), "wrong buffer evicted");
+	CHECK(resource_pools_size == 700 && pool1.size == 300, "total %zu, pool %zu", resource_pools_size, pool1.size);
+
+	// Expiry checks every 64 frames, counting from the last check:
+	G->resource_pool_global_budget = 0;
+	G->resource_pool_expire_frames = 100;
+	G->frame_no = 60;
+	get_buffer(&pool2, &device, 50)->Release();
+	ExpireResourcePools();
+	CHECK(resource_pools_size == 750, "expired early, total %zu", resource_pools_size);
+
+	G->frame_no = 112;
+	ExpireResourcePools();
+	CHECK(!pool_has(&pool2, 400) && pool_has(&pool1, 300) && pool_has(&pool2, 50), "wrong buffers expired");
+	CHECK(resource_pools_size == 350, "total %zu", resource_pools_size);
+
+	G->frame_no = 170;
+	get_buffer(&pool2, &device, 50)->Release();
+	ExpireResourcePools();
+	CHECK(resource_pools_size == 350, "expired early, total %zu", resource_pools_size);
+
+	G->frame_no = 176;
+	ExpireResourcePools();
+	CHECK(pool1.cache.empty() && pool2.cache.size() == 1 && pool_has(&pool2, 50),
+			"%zu and %zu entries left", pool1.cache.size(), pool2.cache.size());
+	CHECK(resource_pools_size == 50, "total %zu", resource_pools_size);
+}
+
+// Copy operations on deferred contexts using their own pools and a shared
+// pool, while the present thread enforces the global budget and expires
+// them. Afterwards the accounting must add up and every resource must have
+// been released:
+static void test_threads()
+{
+	static const int NUM_THREADS = 4;
+	static const int ITERATIONS = 20000;
+	ResourcePool shared;
+	std::vector<ResourcePool> pools(NUM_THREADS);
+	std::vector<std::thread> threads;
+	std::atomic<int> running(NUM_THREADS);
+	ID3D11Device device;
+	ResourcePool *pool;
+	size_t total;
+	int t;
+
+	reset_globals();
+	G->resource_pool_budget = 2000;
+	G->resource_pool_global_budget = 10000;
+	G->resource_pool_expire_frames = 32;
+
+	for (t = 0; t < NUM_THREADS; t++) {
+		threads.emplace_back([&, t]() {
+			ID3D11Buffer *buf, *current = NULL;
+			int i;
+
+			for (i = 0; i < ITERATIONS; i++) {
+				buf = get_buffer(i % 3 ? &pools[t] : &shared, &device, 100 * (1 + (i * 7 + t) % 13), current);
+				if (buf) {
+					if (current)
+						current->Release();
+					current = buf;
+				}
+			}
+			if (current)
+				current->Release();
+			running--;
+		});
+	}
+
+	while (running) {
+		// The game reads frame_no racily, which is harmless, but would
+		// drown out anything else ThreadSanitizer finds here:
+		EnterCriticalSectionPretty(&resource_pools_lock);
+		G->frame_no++;
+		LeaveCriticalSection(&resource_pools_lock);
+		ExpireResourcePools();
+		std::this_thread::yield();
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+
+	EnterCriticalSectionPretty(&resource_pools_lock);
+	total = 0;
+	for (pool = resource_pools; pool; pool = pool->next) {
+		size_t size = 0;
+		for (auto &entry : pool->cache)
+			size += entry.second.size;
+		CHECK(size == pool->size, "pool size %zu, entries add up to %zu", pool->size, size);
+		total += pool->size;
+	}
+	CHECK(total == resource_pools_size, "total %zu, pools add up to %zu", resource_pools_size, total);
+	LeaveCriticalSection(&resource_pools_lock);
+}
+
+int main()
+{
+	test_cache_hits();
+	test_device_mismatch_and_failures();
+	test_pool_budget();
+	test_global_budget_and_expiry();
+	test_threads();
+
+	CHECK(live_resources == 0, "%i resources leaked", (int)live_resources);
+	CHECK(!resource_pools && !resource_pools_count && !resource_pools_size,
+			"%zu pools, %zu bytes left", resource_pools_count, resource_pools_size);
+	CHECK(called_with_lock_held == 0, "device or LogInfo called %i times with resource_pools_lock held",
+			(int)called_with_lock_held);
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,401 @@
+// Drives PersistentSettingsWriter with a fake file system and checks:
+//
+//   - the user config ends up holding format() of the settings, written to a
+//     temporary file that then replaces it, and nothing else is left behind
+//   - settings the same as the last saved are skipped unless forced,
+//     compared bit for bit, so NaN is unchanged and -0 vs 0 is a change
+//   - saves made while a write is in progress are coalesced, so only the
+//     newest is written after it
+//   - save_now() drops a queued save, waits for the write in progress and
+//     writes on the calling thread, even when it has the same settings as
+//     the save it dropped
+//   - discard() drops a queued save, waits for the write in progress and
+//     forgets what was saved
+//   - a failed write or replace is reported and makes the next save write
+//     the same settings again, unless a newer save is already queued
+//
+// The writer has no clock of its own - how often it is asked to save is up
+// to the caller - so the timing is controlled by holding the fake writes.
+// Best also run with -fsanitize=thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+
+#include "SettingsWriter.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static const wchar_t *USER_CONFIG = L"d3dx_user.ini";
+
+// Lets a write be held until the test is ready for it to finish:
+class Gate
+{
+	std::mutex lock;
+	std::condition_variable cv;
+	bool open;
+
+public:
+	Gate() : open(false) {}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		cv.wait(guard, [&]() { return open; });
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		open = true;
+		cv.notify_all();
+	}
+};
+
+// The fake file system. The next write is held at write_gate if set, and
+// the next fail_writes writes and fail_replaces replaces fail:
+static std::mutex fs_lock;
+static std::map<std::wstring, std::string> files;
+static std::vector<std::string> written;
+static Gate *write_gate;
+static std::atomic<bool> in_write;
+static int fail_writes, fail_replaces;
+
+static bool fake_write(const std::wstring &path, const std::string &data)
+{
+	std::unique_lock<std::mutex> guard(fs_lock);
+	Gate *gate = write_gate;
+
+	write_gate = NULL;
+	if (gate) {
+		guard.unlock();
+		in_write = true;
+		gate->wait();
+		guard.lock();
+	}
+
+	written.push_back(data);
+	if (fail_writes) {
+		fail_writes--;
+		return false;
+	}
+	files[path] = data;
+	return true;
+}
+
+static bool fake_replace(const std::wstring &src, const std::wstring &dest)
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+
+	if (!files.count(src))
+		return false;
+	if (fail_replaces) {
+		fail_replaces--;
+		files.erase(src);
+		return false;
+	}
+	files[dest] = files[src];
+	files.erase(src);
+	return true;
+}
+
+static void reset_fs()
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+
+	files.clear();
+	written.clear();
+	write_gate = NULL;
+	in_write = false;
+	fail_writes = fail_replaces = 0;
+}
+
+static std::vector<std::string> writes()
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+	return written;
+}
+
+static std::string user_config()
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+	return files.count(USER_CONFIG) ? files[USER_CONFIG] : "<missing>";
+}
+
+static size_t file_count()
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+	return files.size();
+}
+
+static void hold_next_write(Gate *gate)
+{
+	std::lock_guard<std::mutex> guard(fs_lock);
+	in_write = false;
+	write_gate = gate;
+}
+
+// The writer is stuck for good, so the test can't go on:
+static void give_up(const char *what)
+{
+	CHECK(false, "%s", what);
+	printf("%d failures\n", failures);
+	fflush(stdout);
+	_Exit(1);
+}
+
+static void wait_until_writing()
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+	while (!in_write) {
+		if (std::chrono::steady_clock::now() > deadline)
+			give_up("the background write never started");
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+// Waits for the background thread to finish n writes:
+static std::vector<SettingsWriteResult> wait_for_results(PersistentSettingsWriter *writer, size_t n)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	std::vector<SettingsWriteResult> results;
+
+	while (true) {
+		writer->take_results(&results);
+		if (results.size() >= n)
+			return results;
+		if (std::chrono::steady_clock::now() > deadline)
+			give_up("the background writes never finished");
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+// Releases a held write once whatever the calling thread does next has had
+// plenty of time to start waiting for it:
+static std::thread release_later(Gate *gate)
+{
+	return std::thread([gate]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		gate->release();
+	});
+}
+
+static std::vector<PersistentSetting> settings(float a, float b)
+{
+	return {{L"$a", a}, {L"$b", b}};
+}
+
+static void test_format()
+{
+	std::wstring long_name(600, L'x');
+	std::string text;
+
+	text = PersistentSettingsWriter::format(settings(1, 0.1f));
+	CHECK(text.find("[Constants]\n$a = 1\n$b = 0.100000001\n") != std::string::npos, "%s", text.c_str());
+	CHECK(text[0] == ';', "no header comment");
+
+	text = PersistentSettingsWriter::format({{long_name, 2}});
+	CHECK(text.find(std::string(long_name.begin(), long_name.end()) + " = 2\n") != std::string::npos,
+			"long name cut short");
+}
+
+static void test_save()
+{
+	PersistentSettingsWriter writer(fake_write, fake_replace);
+	std::vector<SettingsWriteResult> results;
+
+	reset_fs();
+	CHECK(writer.save(USER_CONFIG, settings(1, 2), false), "first save skipped");
+	results = wait_for_results(&writer, 1);
+	CHECK(results.size() == 1 && results[0].status == SettingsWriteStatus::OK
+			&& results[0].path == USER_CONFIG && results[0].settings == 2, "bad result");
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(1, 2)), "%s", user_config().c_str());
+	CHECK(file_count() == 1, "temporary file left behind");
+
+	CHECK(!writer.save(USER_CONFIG, settings(1, 2), false), "unchanged settings saved");
+	CHECK(writer.save(L"other.ini", settings(1, 2), false), "unchanged settings to another file skipped");
+	wait_for_results(&writer, 1);
+	CHECK(writer.save(USER_CONFIG, settings(1, 2), true), "forced save skipped");
+	wait_for_results(&writer, 1);
+	CHECK(writes().size() == 3, "%zu writes", writes().size());
+
+	CHECK(writer.save(USER_CONFIG, settings(NAN, 0), false), "changed settings skipped");
+	wait_for_results(&writer, 1);
+	CHECK(!writer.save(USER_CONFIG, settings(NAN, 0), false), "NaN counted as a change");
+	CHECK(writer.save(USER_CONFIG, settings(NAN, -0.0f), false), "-0 not counted as a change");
+	wait_for_results(&writer, 1);
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(NAN, -0.0f)), "%s", user_config().c_str());
+}
+
+static void test_coalescing()
+{
+	PersistentSettingsWriter writer(fake_write, fake_replace);
+	std::vector<SettingsWriteResult> results;
+	std::vector<std::string> w;
+	Gate gate;
+	float i;
+
+	reset_fs();
+	hold_next_write(&gate);
+	writer.save(USER_CONFIG, settings(1, 0), false);
+	wait_until_writing();
+
+	for (i = 2; i <= 10; i++)
+		CHECK(writer.save(USER_CONFIG, settings(i, 0), false), "save %g skipped", i);
+	gate.release();
+
+	results = wait_for_results(&writer, 2);
+	w = writes();
+	CHECK(w.size() == 2 && w[0] == PersistentSettingsWriter::format(settings(1, 0))
+			&& w[1] == PersistentSettingsWriter::format(settings(10, 0)),
+			"%zu writes, not the first and the newest", w.size());
+	CHECK(results.size() == 2, "%zu results", results.size());
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(10, 0)), "%s", user_config().c_str());
+
+	// What was queued last counts as saved:
+	CHECK(!writer.save(USER_CONFIG, settings(10, 0), false), "newest settings saved again");
+}
+
+static void test_save_now()
+{
+	PersistentSettingsWriter writer(fake_write, fake_replace);
+	std::vector<SettingsWriteResult> results;
+	std::thread releaser;
+	std::vector<std::string> w;
+	Gate gate;
+
+	reset_fs();
+	hold_next_write(&gate);
+	writer.save(USER_CONFIG, settings(1, 0), false);
+	wait_until_writing();
+	writer.save(USER_CONFIG, settings(2, 0), false);
+
+	// The same settings as the queued save, which save_now() drops, so
+	// they have still never been written:
+	releaser = release_later(&gate);
+	CHECK(writer.save_now(USER_CONFIG, settings(2, 0), false), "save_now() skipped the dropped settings");
+	releaser.join();
+
+	w = writes();
+	CHECK(w.size() == 2 && w[1] == PersistentSettingsWriter::format(settings(2, 0)),
+			"%zu writes, not the held one then save_now()", w.size());
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(2, 0)), "%s", user_config().c_str());
+
+	// Nothing queued is left to write afterwards:
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	writer.take_results(&results);
+	CHECK(results.size() == 2, "%zu results", results.size());
+	CHECK(writes().size() == 2, "the dropped save was written");
+
+	CHECK(!writer.save_now(USER_CONFIG, settings(2, 0), false), "unchanged settings saved");
+	CHECK(writer.save_now(USER_CONFIG, settings(2, 0), true), "forced save skipped");
+	CHECK(writes().size() == 3, "%zu writes", writes().size());
+}
+
+static void test_discard()
+{
+	PersistentSettingsWriter writer(fake_write, fake_replace);
+	std::vector<SettingsWriteResult> results;
+	std::thread releaser;
+	Gate gate;
+
+	reset_fs();
+	hold_next_write(&gate);
+	writer.save(USER_CONFIG, settings(1, 0), false);
+	wait_until_writing();
+	writer.save(USER_CONFIG, settings(2, 0), false);
+
+	releaser = release_later(&gate);
+	writer.discard();
+
+	// The write in progress has finished, so deleting the file now can't
+	// be undone by it:
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(1, 0)), "%s", user_config().c_str());
+	releaser.join();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	CHECK(writes().size() == 1, "the discarded save was written");
+
+	// Forgotten, so the same settings are saved again after the file
+	// is deleted:
+	reset_fs();
+	CHECK(writer.save(USER_CONFIG, settings(1, 0), false), "settings skipped after discard()");
+	wait_for_results(&writer, 2);
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(1, 0)), "%s", user_config().c_str());
+}
+
+static void test_failures()
+{
+	PersistentSettingsWriter writer(fake_write, fake_replace);
+	std::vector<SettingsWriteResult> results;
+	Gate gate;
+
+	reset_fs();
+	fail_writes = 1;
+	writer.save(USER_CONFIG, settings(1, 0), false);
+	results = wait_for_results(&writer, 1);
+	CHECK(results[0].status == SettingsWriteStatus::WRITE_FAILED, "write failure not reported");
+	CHECK(file_count() == 0, "failed write left a file");
+	CHECK(writer.save(USER_CONFIG, settings(1, 0), false), "not retried after a failed write");
+	results = wait_for_results(&writer, 1);
+	CHECK(results[0].status == SettingsWriteStatus::OK, "retry failed");
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(1, 0)), "%s", user_config().c_str());
+
+	fail_replaces = 1;
+	writer.save(USER_CONFIG, settings(2, 0), false);
+	results = wait_for_results(&writer, 1);
+	CHECK(results[0].status == SettingsWriteStatus::REPLACE_FAILED, "replace failure not reported");
+	CHECK(file_count() == 1, "temporary file left behind");
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(1, 0)), "old settings lost");
+	CHECK(writer.save(USER_CONFIG, settings(2, 0), false), "not retried after a failed replace");
+	wait_for_results(&writer, 1);
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(2, 0)), "%s", user_config().c_str());
+
+	fail_writes = 1;
+	CHECK(writer.save_now(USER_CONFIG, settings(3, 0), false), "save_now() skipped");
+	writer.take_results(&results);
+	CHECK(results.back().status == SettingsWriteStatus::WRITE_FAILED, "save_now() failure not reported");
+	CHECK(writer.save_now(USER_CONFIG, settings(3, 0), false), "not retried after save_now() failed");
+	CHECK(user_config() == PersistentSettingsWriter::format(settings(3, 0)), "%s", user_config().c_str());
+	writer.take_results(&results);
+
+	// A newer save queued behind the failed one is still what counts:
+	fail_writes = 1;
+	hold_next_write(&gate);
+	writer.save(USER_CONFIG, settings(4, 0), false);
+	wait_until_writing();
+	writer.save(USER_CONFIG, settings(5, 0), false);
+	gate.release();
+	results = wait_for_results(&writer, 2);
+	CHECK(results.size() == 2 && results[0].status == SettingsWriteStatus::WRITE_FAILED
+			&& results[1].status == SettingsWriteStatus::OK, "wrong results");
+	CHECK(!writer.save(USER_CONFIG, settings(5, 0), false), "newer save written again");
+}
+
+int main()
+{
+	test_format();
+	test_save();
+	test_coalescing();
+	test_save_now();
+	test_discard();
+	test_failures();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
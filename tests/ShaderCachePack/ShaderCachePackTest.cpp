@@ -0,0 +1,258 @@
+// Builds shader cache packs in memory, truncates and corrupts them in various
+// ways, and checks that indexing them only ever picks up records that lie
+// entirely within the pack - a corrupt record must be a cache miss, never a
+// read past the end of the mapped file. Each pack is copied into a buffer of
+// exactly its size before indexing, so building this with
+// -fsanitize=address catches any such read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ShaderCachePack.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+struct TestShader
+{
+	ShaderCacheKey key;
+	ShaderCacheIncludes includes;
+	std::vector<char> code;
+	size_t offset;          // Of its record in the pack
+	size_t size;
+};
+
+static ShaderCacheKey make_key(uint64_t n)
+{
+	ShaderCacheKey key;
+
+	key.fnv = n * 0x9e3779b97f4a7c15ULL;
+	key.crc = (uint32_t)n;
+	key.length = (uint32_t)(n * 3);
+	return key;
+}
+
+static std::vector<char> build_pack(std::vector<TestShader> *shaders, std::mt19937 &rng, int count)
+{
+	ShaderCachePackHeader header;
+	std::vector<char> pack, record;
+	TestShader shader;
+	int i, j, n;
+
+	shader_cache_init_pack_header(&header);
+	pack.insert(pack.end(), (char*)&header, (char*)(&header + 1));
+
+	for (i = 0; i < count; i++) {
+		shader.key = make_key(i + 1);
+		shader.includes.clear();
+		n = rng() % 4;
+		for (j = 0; j < n; j++)
+			shader.includes.push_back({L"ShaderFixes\\include" + std::to_wstring(rng() % 1000) + L".hlsl", make_key(rng())});
+		shader.code.resize(rng() % 200);
+		for (j = 0; j < (int)shader.code.size(); j++)
+			shader.code[j] = (char)rng();
+
+		shader_cache_build_record(shader.key, &shader.includes, shader.code.data(), shader.code.size(), &record);
+		shader.offset = pack.size();
+		shader.size = record.size();
+		pack.insert(pack.end(), record.begin(), record.end());
+		shaders->push_back(shader);
+	}
+
+	return pack;
+}
+
+// What lookup_shader_cache() does, minus checking the includes on disk:
+static bool lookup(const ShaderCachePackIndex &index, const ShaderCacheKey &key,
+		std::vector<char> *code, ShaderCacheIncludes *includes)
+{
+	auto entry = index.find(key);
+	if (entry == index.end())
+		return false;
+
+	shader_cache_record_includes(entry->second, includes);
+	shader_cache_record_code(entry->second, code);
+	return true;
+}
+
+static bool same_includes(const ShaderCacheIncludes &a, const ShaderCacheIncludes &b)
+{
+	size_t i;
+
+	if (a.size() != b.size())
+		return false;
+	for (i = 0; i < a.size(); i++) {
+		if (a[i].path != b[i].path || a[i].key != b[i].key)
+			return false;
+	}
+	return true;
+}
+
+// Indexes a copy of the first size bytes of the pack in a buffer of exactly
+// that size, and checks that exactly the shaders whose records end before
+// first_bad are found, intact:
+static void check_pack(const char *what, const std::vector<char> &pack, size_t size,
+		const std::vector<TestShader> &shaders, size_t first_bad)
+{
+	ShaderCachePackIndex index;
+	ShaderCacheIncludes includes;
+	std::vector<char> code;
+	uint64_t valid_size, wasted;
+	char *buf;
+	bool found;
+
+	buf = (char*)malloc(size ? size : 1);
+	memcpy(buf, pack.data(), size);
+
+	if (!shader_cache_index_pack(buf, size, &index, &valid_size, &wasted)) {
+		CHECK(size < sizeof(ShaderCachePackHeader), "%s: rejected pack of %zu bytes", what, size);
+		free(buf);
+		return;
+	}
+
+	CHECK(valid_size <= size, "%s: valid_size %llu > %zu", what, (unsigned long long)valid_size, size);
+	CHECK(wasted == 0, "%s: wasted %llu", what, (unsigned long long)wasted);
+
+	for (const TestShader &shader : shaders) {
+		found = lookup(index, shader.key, &code, &includes);
+		if (shader.offset + shader.size <= first_bad) {
+			CHECK(found, "%s: record at %zu missing", what, shader.offset);
+			if (found) {
+				CHECK(code == shader.code, "%s: record at %zu code differs", what, shader.offset);
+				CHECK(same_includes(includes, shader.includes), "%s: record at %zu includes differ", what, shader.offset);
+			}
+		} else {
+			CHECK(!found, "%s: corrupt record at %zu was indexed", what, shader.offset);
+		}
+	}
+
+	free(buf);
+}
+
+static void patch_u32(std::vector<char> *pack, size_t offset, uint32_t val)
+{
+	memcpy(pack->data() + offset, &val, sizeof(val));
+}
+
+static size_t include_offset(const TestShader &shader, size_t n)
+{
+	size_t pos = shader.offset + sizeof(ShaderCachePackRecord);
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		pos += sizeof(ShaderCachePackInclude) + shader.includes[i].path.size() * sizeof(wchar_t);
+	return pos;
+}
+
+int main()
+{
+	std::vector<TestShader> shaders;
+	std::mt19937 rng(31);
+	std::vector<char> pack, corrupt;
+	const TestShader *victim;
+	uint32_t bad_values[] = {1, 0x7fffffff, 0xffffffff};
+	size_t size, i;
+
+	pack = build_pack(&shaders, rng, 40);
+
+	check_pack("intact", pack, pack.size(), shaders, pack.size());
+
+	// A crash while appending leaves a truncated record at the end:
+	for (size = 0; size < pack.size(); size++)
+		check_pack("truncated", pack, size, shaders, size);
+
+	// Pick a record with includes to corrupt, so the ones after it are
+	// dropped too:
+	for (i = shaders.size() / 2; shaders[i].includes.empty(); i++);
+	victim = &shaders[i];
+
+	for (uint32_t bad : bad_values) {
+		// An include path running past the end of the record, and
+		// past the end of the pack:
+		corrupt = pack;
+		patch_u32(&corrupt, include_offset(*victim, 0) + offsetof(ShaderCachePackInclude, path_len),
+				(uint32_t)victim->includes[0].path.size() + bad);
+		check_pack("path_len", corrupt, corrupt.size(), shaders, victim->offset);
+
+		corrupt = pack;
+		patch_u32(&corrupt, victim->offset + offsetof(ShaderCachePackRecord, num_includes),
+				(uint32_t)victim->includes.size() + bad);
+		check_pack("num_includes", corrupt, corrupt.size(), shaders, victim->offset);
+
+		corrupt = pack;
+		patch_u32(&corrupt, victim->offset + offsetof(ShaderCachePackRecord, code_size),
+				(uint32_t)victim->code.size() + bad);
+		check_pack("code_size", corrupt, corrupt.size(), shaders, victim->offset);
+
+		corrupt = pack;
+		patch_u32(&corrupt, victim->offset + offsetof(ShaderCachePackRecord, record_size),
+				(uint32_t)victim->size + bad);
+		check_pack("record_size", corrupt, corrupt.size(), shaders, victim->offset);
+	}
+
+	// A record_size too small to hold its own header would otherwise
+	// never advance:
+	corrupt = pack;
+	patch_u32(&corrupt, victim->offset + offsetof(ShaderCachePackRecord, record_size), 0);
+	check_pack("zero record_size", corrupt, corrupt.size(), shaders, victim->offset);
+
+	// The last record for a key wins, and the older one counts as wasted:
+	{
+		ShaderCachePackIndex index;
+		std::vector<char> record, code;
+		ShaderCacheIncludes includes;
+		uint64_t valid_size, wasted;
+		char new_code[] = "replacement";
+
+		corrupt = pack;
+		shader_cache_build_record(shaders[3].key, NULL, new_code, sizeof(new_code), &record);
+		corrupt.insert(corrupt.end(), record.begin(), record.end());
+
+		CHECK(shader_cache_index_pack(corrupt.data(), corrupt.size(), &index, &valid_size, &wasted), "superseded");
+		CHECK(valid_size == corrupt.size(), "superseded: valid_size %llu", (unsigned long long)valid_size);
+		CHECK(wasted == shaders[3].size, "superseded: wasted %llu", (unsigned long long)wasted);
+		CHECK(lookup(index, shaders[3].key, &code, &includes) && includes.empty()
+				&& code == std::vector<char>(new_code, new_code + sizeof(new_code)), "superseded: old record used");
+	}
+
+	// Random damage anywhere in the pack must never be read past the end:
+	for (i = 0; i < 2000; i++) {
+		ShaderCachePackIndex index;
+		uint64_t valid_size, wasted;
+		std::vector<char> code;
+		ShaderCacheIncludes includes;
+		char *buf;
+
+		corrupt = pack;
+		corrupt[sizeof(ShaderCachePackHeader) + rng() % (pack.size() - sizeof(ShaderCachePackHeader))] = (char)rng();
+		size = rng() % 4 ? corrupt.size() : rng() % corrupt.size();
+		buf = (char*)malloc(size ? size : 1);
+		memcpy(buf, corrupt.data(), size);
+
+		if (shader_cache_index_pack(buf, size, &index, &valid_size, &wasted)) {
+			for (auto &entry : index) {
+				CHECK(shader_cache_record_valid(entry.second, buf + size - entry.second), "random damage");
+				lookup(index, entry.first, &code, &includes);
+			}
+		}
+		free(buf);
+	}
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,443 @@
+// Replays synthetic draw streams through both the old way of gathering the
+// statistics for ShaderUsage.txt (inserting straight into the ShaderInfoData
+// maps under the global lock on every draw call) and ShaderUsageRecorder +
+// MergeShaderUsage(), and checks that both end up with identical maps.
+//
+// ShaderInfoData, ResourceSnapshot and the parts of Globals used here are
+// cut down copies of those in globals.h without the D3D types. The merge of
+// each record is the real merge_shader_usage_record() from
+// ShaderUsageRecorder.h, and MergeShaderUsage() below mirrors the one in
+// Hunting.cpp with a std::mutex in place of the critical section.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "ShaderUsageRecorder.h"
+
+typedef uint64_t UINT64;
+struct ID3D11Resource;
+
+struct ResourceSnapshot
+{
+	ID3D11Resource *handle;
+	uint32_t hash;
+	uint32_t orig_hash;
+
+	ResourceSnapshot(ID3D11Resource *handle, uint32_t hash, uint32_t orig_hash):
+		handle(handle), hash(hash), orig_hash(orig_hash)
+	{}
+};
+static inline bool operator<(const ResourceSnapshot &lhs, const ResourceSnapshot &rhs)
+{
+	if (lhs.orig_hash != rhs.orig_hash)
+		return (lhs.orig_hash < rhs.orig_hash);
+	if (lhs.hash != rhs.hash)
+		return (lhs.hash < rhs.hash);
+	return (lhs.handle < rhs.handle);
+}
+static inline bool operator==(const ResourceSnapshot &lhs, const ResourceSnapshot &rhs)
+{
+	return !(lhs < rhs) && !(rhs < lhs);
+}
+
+struct ShaderInfoData
+{
+	std::map<int, std::set<ResourceSnapshot>> ResourceRegisters;
+	std::set<UINT64> PeerShaders;
+	std::vector<std::set<ResourceSnapshot>> RenderTargets;
+	std::map<int, std::set<ResourceSnapshot>> UAVs;
+	std::set<ResourceSnapshot> DepthTargets;
+
+	bool operator==(const ShaderInfoData &other) const
+	{
+		return ResourceRegisters == other.ResourceRegisters &&
+			PeerShaders == other.PeerShaders &&
+			RenderTargets == other.RenderTargets &&
+			UAVs == other.UAVs &&
+			DepthTargets == other.DepthTargets;
+	}
+};
+
+struct Globals
+{
+	std::mutex mCriticalSection;
+	std::map<UINT64, ShaderInfoData> mVertexShaderInfo;
+	std::map<UINT64, ShaderInfoData> mHullShaderInfo;
+	std::map<UINT64, ShaderInfoData> mDomainShaderInfo;
+	std::map<UINT64, ShaderInfoData> mGeometryShaderInfo;
+	std::map<UINT64, ShaderInfoData> mPixelShaderInfo;
+	std::map<UINT64, ShaderInfoData> mComputeShaderInfo;
+	std::set<uint32_t> mShaderResourceInfo;
+	std::set<uint32_t> mUnorderedAccessInfo;
+	ShaderUsageInbox mShaderUsageInbox;
+
+	bool operator==(const Globals &other) const
+	{
+		return mVertexShaderInfo == other.mVertexShaderInfo &&
+			mHullShaderInfo == other.mHullShaderInfo &&
+			mDomainShaderInfo == other.mDomainShaderInfo &&
+			mGeometryShaderInfo == other.mGeometryShaderInfo &&
+			mPixelShaderInfo == other.mPixelShaderInfo &&
+			mComputeShaderInfo == other.mComputeShaderInfo &&
+			mShaderResourceInfo == other.mShaderResourceInfo &&
+			mUnorderedAccessInfo == other.mUnorderedAccessInfo;
+	}
+};
+
+static Globals *G;
+
+static std::map<UINT64, ShaderInfoData>* shader_usage_info_map(Globals *g, ShaderUsageStage stage)
+{
+	switch (stage) {
+		case ShaderUsageStage::VS: return &g->mVertexShaderInfo;
+		case ShaderUsageStage::HS: return &g->mHullShaderInfo;
+		case ShaderUsageStage::DS: return &g->mDomainShaderInfo;
+		case ShaderUsageStage::GS: return &g->mGeometryShaderInfo;
+		case ShaderUsageStage::PS: return &g->mPixelShaderInfo;
+		case ShaderUsageStage::CS: break;
+	}
+	return &g->mComputeShaderInfo;
+}
+
+static void MergeShaderUsage()
+{
+	ShaderUsageChunk *chunks, *chunk;
+	ShaderUsageRecord *record;
+	size_t i;
+
+	chunks = G->mShaderUsageInbox.take_all();
+	if (!chunks)
+		return;
+
+	G->mCriticalSection.lock();
+
+	for (chunk = chunks; chunk; chunk = chunk->next) {
+		for (i = 0; i < chunk->count; i++) {
+			record = &chunk->records[i];
+			merge_shader_usage_record(&(*shader_usage_info_map(G, record->stage))[record->shader],
+					&G->mShaderResourceInfo, &G->mUnorderedAccessInfo, *record);
+		}
+	}
+
+	G->mCriticalSection.unlock();
+
+	ShaderUsageInbox::free_chunks(chunks);
+}
+
+// Resources are numbered 1..NUM_RESOURCES, and their hashes change from time
+// to time to check that snapshots taken at different times are kept apart:
+static const int NUM_RESOURCES = 200;
+static const int NUM_SHADERS = 40;
+static const int NUM_REGISTERS = 4;
+static std::mutex resources_lock;
+static uint32_t resource_hash[NUM_RESOURCES + 1];
+static uint32_t resource_orig_hash[NUM_RESOURCES + 1];
+
+static ResourceSnapshot snapshot_resource(int resource)
+{
+	std::lock_guard<std::mutex> guard(resources_lock);
+
+	return ResourceSnapshot((ID3D11Resource*)(uintptr_t)(resource * 16),
+			resource_hash[resource], resource_orig_hash[resource]);
+}
+
+// Stages are indexed by ShaderUsageStage. A 0 shader or resource is unbound:
+struct Draw
+{
+	bool compute;
+	UINT64 shaders[6];
+	int registers[6][NUM_REGISTERS];
+	std::vector<int> render_targets;
+	int depth_target;
+	std::vector<int> uavs;
+	int uav_start;
+};
+
+static Draw random_draw(std::mt19937 &rng)
+{
+	Draw draw = {};
+	int i, stage, count;
+
+	draw.compute = rng() % 8 == 0;
+	for (stage = 0; stage < 6; stage++) {
+		if (stage == (int)ShaderUsageStage::VS || stage == (int)ShaderUsageStage::PS || rng() % 4 == 0)
+			draw.shaders[stage] = (rng() % NUM_SHADERS) * 0x1000000001ull * (stage + 1);
+		for (i = 0; i < NUM_REGISTERS; i++)
+			draw.registers[stage][i] = rng() % 3 ? rng() % NUM_RESOURCES + 1 : 0;
+	}
+
+	count = rng() % 4;
+	for (i = 0; i < count; i++)
+		draw.render_targets.push_back(rng() % NUM_RESOURCES + 1);
+	draw.depth_target = rng() % 2 ? rng() % NUM_RESOURCES + 1 : 0;
+
+	// Pixel shader UAVs come after the render targets:
+	draw.uav_start = count;
+	count = rng() % 3;
+	for (i = 0; i < count; i++)
+		draw.uavs.push_back(rng() % 3 ? rng() % NUM_RESOURCES + 1 : 0);
+
+	return draw;
+}
+
+// What RecordGraphicsShaderStats and RecordComputeShaderStats used to do,
+// straight into the ShaderInfoData maps:
+static void old_record_register(Globals *g, ShaderInfoData *info, int slot, int resource)
+{
+	ResourceSnapshot snapshot = snapshot_resource(resource);
+
+	if (snapshot.orig_hash)
+		g->mShaderResourceInfo.insert(snapshot.orig_hash);
+	info->ResourceRegisters[slot].insert(snapshot);
+}
+
+static void old_record_uav(Globals *g, ShaderInfoData *info, int slot, int resource)
+{
+	ResourceSnapshot snapshot = snapshot_resource(resource);
+
+	if (snapshot.orig_hash)
+		g->mUnorderedAccessInfo.insert(snapshot.orig_hash);
+	info->UAVs[slot].insert(snapshot);
+}
+
+static void old_record(Globals *g, const Draw &draw)
+{
+	std::lock_guard<std::mutex> guard(g->mCriticalSection);
+	ShaderInfoData *info;
+	size_t i;
+	int stage, peer;
+
+	if (draw.compute) {
+		info = &g->mComputeShaderInfo[draw.shaders[(int)ShaderUsageStage::CS]];
+		for (i = 0; i < NUM_REGISTERS; i++) {
+			if (draw.registers[(int)ShaderUsageStage::CS][i])
+				old_record_register(g, info, (int)i, draw.registers[(int)ShaderUsageStage::CS][i]);
+		}
+		for (i = 0; i < draw.uavs.size(); i++) {
+			if (draw.uavs[i])
+				old_record_uav(g, info, (int)i, draw.uavs[i]);
+		}
+		return;
+	}
+
+	for (stage = 0; stage < (int)ShaderUsageStage::CS; stage++) {
+		if (!draw.shaders[stage])
+			continue;
+		info = &(*shader_usage_info_map(g, (ShaderUsageStage)stage))[draw.shaders[stage]];
+		for (i = 0; i < NUM_REGISTERS; i++) {
+			if (draw.registers[stage][i])
+				old_record_register(g, info, (int)i, draw.registers[stage][i]);
+		}
+		for (peer = 0; peer < (int)ShaderUsageStage::CS; peer++) {
+			if (draw.shaders[peer] && draw.shaders[peer] != draw.shaders[stage])
+				info->PeerShaders.insert(draw.shaders[peer]);
+		}
+	}
+
+	if (!draw.shaders[(int)ShaderUsageStage::PS])
+		return;
+
+	info = &g->mPixelShaderInfo[draw.shaders[(int)ShaderUsageStage::PS]];
+	for (i = 0; i < draw.render_targets.size(); i++) {
+		if (i >= info->RenderTargets.size())
+			info->RenderTargets.push_back(std::set<ResourceSnapshot>());
+		info->RenderTargets[i].insert(snapshot_resource(draw.render_targets[i]));
+	}
+	if (draw.depth_target)
+		info->DepthTargets.insert(snapshot_resource(draw.depth_target));
+	for (i = 0; i < draw.uavs.size(); i++) {
+		if (draw.uavs[i])
+			old_record_uav(g, info, (int)(i + draw.uav_start), draw.uavs[i]);
+	}
+}
+
+// What HackerContext::RecordGraphicsShaderStats and RecordComputeShaderStats
+// now do with the context's ShaderUsageRecorder:
+static void new_record_resource(ShaderUsageRecorder *recorder, ShaderUsageStage stage,
+		UINT64 shader, ShaderUsageKind kind, int slot, int resource)
+{
+	ResourceSnapshot snapshot = snapshot_resource(resource);
+
+	recorder->record(ShaderUsageRecord(stage, kind, shader, slot,
+			(uintptr_t)snapshot.handle, snapshot.hash, snapshot.orig_hash));
+}
+
+static void new_record_stage(ShaderUsageRecorder *recorder, const Draw &draw, ShaderUsageStage stage)
+{
+	UINT64 shader = draw.shaders[(int)stage];
+	int i;
+
+	recorder->record(ShaderUsageRecord(stage, ShaderUsageKind::SHADER, shader, -1, 0, 0, 0));
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		if (draw.registers[(int)stage][i])
+			new_record_resource(recorder, stage, shader, ShaderUsageKind::REGISTER, i, draw.registers[(int)stage][i]);
+	}
+}
+
+static void new_record(ShaderUsageRecorder *recorder, const Draw &draw)
+{
+	UINT64 shader;
+	size_t i;
+	int stage, peer;
+
+	if (draw.compute) {
+		shader = draw.shaders[(int)ShaderUsageStage::CS];
+		new_record_stage(recorder, draw, ShaderUsageStage::CS);
+		for (i = 0; i < draw.uavs.size(); i++) {
+			if (draw.uavs[i])
+				new_record_resource(recorder, ShaderUsageStage::CS, shader, ShaderUsageKind::UAV, (int)i, draw.uavs[i]);
+		}
+		return;
+	}
+
+	for (stage = 0; stage < (int)ShaderUsageStage::CS; stage++) {
+		if (!draw.shaders[stage])
+			continue;
+		new_record_stage(recorder, draw, (ShaderUsageStage)stage);
+		for (peer = 0; peer < (int)ShaderUsageStage::CS; peer++) {
+			if (draw.shaders[peer] && draw.shaders[peer] != draw.shaders[stage]) {
+				recorder->record(ShaderUsageRecord((ShaderUsageStage)stage, ShaderUsageKind::PEER,
+						draw.shaders[stage], -1, draw.shaders[peer], 0, 0));
+			}
+		}
+	}
+
+	shader = draw.shaders[(int)ShaderUsageStage::PS];
+	if (!shader)
+		return;
+
+	for (i = 0; i < draw.render_targets.size(); i++)
+		new_record_resource(recorder, ShaderUsageStage::PS, shader, ShaderUsageKind::RENDER_TARGET, (int)i, draw.render_targets[i]);
+	if (draw.depth_target)
+		new_record_resource(recorder, ShaderUsageStage::PS, shader, ShaderUsageKind::DEPTH_TARGET, -1, draw.depth_target);
+	for (i = 0; i < draw.uavs.size(); i++) {
+		if (draw.uavs[i])
+			new_record_resource(recorder, ShaderUsageStage::PS, shader, ShaderUsageKind::UAV, (int)(i + draw.uav_start), draw.uavs[i]);
+	}
+}
+
+// The immediate context and a deferred context on the same thread, with the
+// immediate context publishing every frame and the deferred context less
+// often, while resource hashes occasionally change:
+static int test_single_threaded()
+{
+	Globals expected, actual;
+	std::mt19937 rng(42);
+	int frame, i, resource;
+
+	G = &actual;
+
+	{
+		ShaderUsageRecorder immediate(&actual.mShaderUsageInbox);
+		ShaderUsageRecorder deferred(&actual.mShaderUsageInbox);
+
+		for (frame = 0; frame < 50; frame++) {
+			for (i = 0; i < 400; i++) {
+				Draw draw = random_draw(rng);
+				old_record(&expected, draw);
+				new_record(i % 3 ? &immediate : &deferred, draw);
+
+				if (rng() % 500 == 0) {
+					resource = rng() % NUM_RESOURCES + 1;
+					resource_hash[resource] ^= 0x55;
+				}
+			}
+			if (frame % 3 == 0)
+				deferred.publish();
+			immediate.publish();
+			MergeShaderUsage();
+		}
+
+		deferred.publish();
+		MergeShaderUsage();
+	}
+
+	if (!(expected == actual)) {
+		printf("FAIL: single threaded statistics differ\n");
+		return 1;
+	}
+
+	printf("ok: single threaded, %zu pixel shaders, %zu shader resource hashes\n",
+			actual.mPixelShaderInfo.size(), actual.mShaderResourceInfo.size());
+	return 0;
+}
+
+// Deferred contexts recording on their own threads while another thread
+// merges whatever has been published so far:
+static int test_multi_threaded()
+{
+	static const int NUM_THREADS = 4;
+	Globals expected, actual;
+	std::vector<std::vector<Draw>> streams(NUM_THREADS);
+	std::vector<std::thread> threads;
+	std::atomic<bool> done(false);
+	std::mt19937 rng(7);
+	int i;
+
+	G = &actual;
+
+	for (auto &stream : streams) {
+		for (i = 0; i < 20000; i++)
+			stream.push_back(random_draw(rng));
+	}
+	for (auto &stream : streams) {
+		for (auto &draw : stream)
+			old_record(&expected, draw);
+	}
+
+	std::thread merger([&done]() {
+		while (!done)
+			MergeShaderUsage();
+	});
+
+	for (auto &stream : streams) {
+		threads.emplace_back([&stream, &actual]() {
+			ShaderUsageRecorder recorder(&actual.mShaderUsageInbox);
+			int n = 0;
+
+			for (auto &draw : stream) {
+				new_record(&recorder, draw);
+				if (++n % 500 == 0)
+					recorder.publish();
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+	done = true;
+	merger.join();
+	MergeShaderUsage();
+
+	if (!(expected == actual)) {
+		printf("FAIL: multi threaded statistics differ\n");
+		return 1;
+	}
+
+	printf("ok: multi threaded, %zu pixel shaders, %zu shader resource hashes\n",
+			actual.mPixelShaderInfo.size(), actual.mShaderResourceInfo.size());
+	return 0;
+}
+
+int main()
+{
+	int failures = 0;
+	int i;
+
+	for (i = 1; i <= NUM_RESOURCES; i++) {
+		resource_hash[i] = i * 7919;
+		resource_orig_hash[i] = i % 5 ? i * 7919 : 0;
+	}
+
+	failures += test_single_threaded();
+	failures += test_multi_threaded();
+
+	return failures;
+}
@@ -0,0 +1,128 @@
+// Times what tracing adds to the hot paths it is compiled into: a Scope and
+// an instant event with tracing disabled (as it is unless trace_buffer_size
+// is set), the same with it enabled, from one and several threads, and
+// exporting the buffers once they are full. For comparison it also times an
+// empty loop and a Scope-like pair of timestamps added to a shared atomic
+// counter, which is roughly what the profiling.h overhead counters do.
+//
+// This is Linux only and not run by ctest. Run it from the build directory:
+//
+//   TracingBench [events per thread]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tracing.h"
+
+using namespace Tracing;
+
+typedef std::chrono::steady_clock Clock;
+
+enum class Mode {
+	EMPTY,
+	COUNTER,
+	SCOPE,
+	INSTANT,
+};
+
+static const char *mode_names[] = {"empty loop", "shared counter", "scope", "instant"};
+
+static std::atomic<uint64_t> shared_counter;
+static volatile uint64_t sink;
+
+static void emit(Mode mode, int events)
+{
+	uint64_t start;
+	int i;
+
+	for (i = 0; i < events; i++) {
+		switch (mode) {
+			case Mode::EMPTY:
+				sink = i;
+				break;
+			case Mode::COUNTER:
+				start = timestamp();
+				sink = i;
+				shared_counter += timestamp() - start;
+				break;
+			case Mode::SCOPE:
+			{
+				Scope scope(Event::DRAW, i);
+				sink = i;
+				break;
+			}
+			case Mode::INSTANT:
+				instant(Event::MAP, i);
+				sink = i;
+				break;
+		}
+	}
+}
+
+static void bench(Mode mode, bool tracing, int threads, int events)
+{
+	std::vector<std::thread> workers;
+	Clock::time_point start;
+	double ns;
+	int t;
+
+	configure(tracing ? 65536 : 0);
+
+	start = Clock::now();
+	for (t = 0; t < threads; t++)
+		workers.emplace_back(emit, mode, events);
+	for (std::thread &worker : workers)
+		worker.join();
+	ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+	printf("%-14s %-8s %i thread(s): %6.2fns per event\n", mode_names[(int)mode],
+			mode == Mode::SCOPE || mode == Mode::INSTANT ? (tracing ? "enabled" : "disabled") : "",
+			threads, ns / ((double)threads * events));
+}
+
+static void bench_export()
+{
+	Clock::time_point start;
+	size_t written;
+	double ms;
+	FILE *fp;
+
+	fp = tmpfile();
+	if (!fp) {
+		perror("tmpfile");
+		exit(1);
+	}
+
+	start = Clock::now();
+	written = export_chrome_trace(fp);
+	fflush(fp);
+	ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	printf("export: %zu events in %.1fms, %.0f bytes per event\n", written, ms, (double)ftell(fp) / written);
+
+	fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+	int events = argc > 1 ? atoi(argv[1]) : 10000000;
+	int threads, mode;
+
+	printf("%d events per thread, %u hardware threads\n", events, std::thread::hardware_concurrency());
+
+	for (threads = 1; threads <= 4; threads *= 4) {
+		bench(Mode::EMPTY, false, threads, events);
+		bench(Mode::COUNTER, false, threads, events);
+		for (mode = (int)Mode::SCOPE; mode <= (int)Mode::INSTANT; mode++) {
+			bench((Mode)mode, false, threads, events);
+			bench((Mode)mode, true, threads, events);
+		}
+	}
+
+	bench_export();
+	return 0;
+}
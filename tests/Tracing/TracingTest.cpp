@@ -0,0 +1,380 @@
+// Checks the tracing ring buffers and the Chrome trace exporter:
+//
+//   - capacities are rounded up to a power of two, and every field of a
+//     record comes back out of a snapshot as it went in
+//   - a snapshot holds the newest events in the order they were recorded,
+//     less the oldest one once the buffer has wrapped (whose slot the owner
+//     could have been overwriting), and is appended to what was already in
+//     the vector
+//   - snapshots taken while the owner is recording as fast as it can only
+//     ever hold whole records, consecutive and recent
+//   - nothing is recorded while tracing is disabled, scopes and instant
+//     events are recorded on the thread that emitted them with the right
+//     times, and each thread's buffer keeps the size it was created with
+//   - the export is one event per line, in the format chrome://tracing and
+//     Perfetto expect, sorted by start time within each thread, and can be
+//     taken while other threads are recording
+//
+// Best also run with -fsanitize=thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tracing.h"
+
+using namespace Tracing;
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// Every field is derived from the sequence number, so a record put together
+// from parts of two different ones can be spotted:
+static Record make_record(uint64_t seq)
+{
+	Record record;
+
+	record.start = seq;
+	record.arg = seq * 0x9e3779b97f4a7c15ull;
+	record.duration = (uint32_t)(seq * 7 + 0xfff00000);
+	record.event = (uint16_t)(seq * 3);
+	record.flags = (uint16_t)(0xffff - seq);
+
+	return record;
+}
+
+static bool is_record(const Record &record, uint64_t seq)
+{
+	Record expected = make_record(seq);
+
+	return record.start == expected.start && record.arg == expected.arg &&
+		record.duration == expected.duration && record.event == expected.event &&
+		record.flags == expected.flags;
+}
+
+static void test_ring_buffer()
+{
+	static const size_t capacities[] = {1, 2, 3, 5, 16, 100};
+	std::vector<Record> out;
+	size_t capacity, expected, got, n, i;
+	uint64_t first;
+
+	for (size_t requested : capacities) {
+		RingBuffer buf(requested, 42);
+
+		capacity = buf.capacity();
+		CHECK(capacity >= requested && capacity < requested * 2 && !(capacity & (capacity - 1)),
+				"capacity %zu for %zu", capacity, requested);
+		CHECK(buf.thread_id == 42, "thread %llu", (unsigned long long)buf.thread_id);
+
+		for (n = 0; n <= capacity * 3; n++) {
+			if (n)
+				buf.push(make_record(n - 1));
+			CHECK(buf.total_recorded() == n, "%llu recorded", (unsigned long long)buf.total_recorded());
+
+			// Appended after what is already there:
+			out.assign(1, make_record(12345));
+			got = buf.snapshot(&out);
+			expected = n < capacity ? n : capacity - 1;
+			first = n - expected;
+			CHECK(got == expected && out.size() == expected + 1, "capacity %zu, %zu pushed: %zu in snapshot",
+					capacity, n, got);
+			CHECK(is_record(out[0], 12345), "existing contents changed");
+			for (i = 1; i < out.size(); i++) {
+				if (!is_record(out[i], first + i - 1)) {
+					CHECK(false, "capacity %zu, %zu pushed: record %zu is %llu", capacity, n, i - 1,
+							(unsigned long long)out[i].start);
+					break;
+				}
+			}
+		}
+	}
+}
+
+static void test_concurrent_snapshots()
+{
+	static const uint64_t RECORDS = 2000000;
+	RingBuffer buf(1024, 1);
+	std::vector<Record> out;
+	uint64_t before, after, i;
+	int snapshots = 0, wrapped = 0;
+
+	std::thread producer([&buf]() {
+		for (uint64_t seq = 0; seq < RECORDS; seq++)
+			buf.push(make_record(seq));
+	});
+
+	do {
+		out.clear();
+		before = buf.total_recorded();
+		buf.snapshot(&out);
+		after = buf.total_recorded();
+		snapshots++;
+
+		for (i = 0; i < out.size(); i++) {
+			if (!is_record(out[i], out[0].start + i)) {
+				CHECK(false, "snapshot %i: torn or out of order record at %llu", snapshots, (unsigned long long)i);
+				break;
+			}
+		}
+		if (!out.empty()) {
+			CHECK(out[0].start + buf.capacity() >= before, "snapshot %i starts at %llu with %llu recorded",
+					snapshots, (unsigned long long)out[0].start, (unsigned long long)before);
+			CHECK(out.back().start < after, "snapshot %i ends at %llu with %llu recorded",
+					snapshots, (unsigned long long)out.back().start, (unsigned long long)after);
+			wrapped += out[0].start > 0;
+		}
+	} while (after < RECORDS && failures < 10);
+
+	producer.join();
+	printf("%i snapshots during recording, %i after wrapping\n", snapshots, wrapped);
+}
+
+// An event as exported, one per line:
+struct ExportedEvent
+{
+	std::string name, ph;
+	double ts, dur;
+	unsigned long long tid, arg;
+};
+
+static bool parse_field(const char *line, const char *key, const char *format, void *val)
+{
+	const char *pos = strstr(line, key);
+
+	return pos && sscanf(pos + strlen(key), format, val) == 1;
+}
+
+static std::vector<ExportedEvent> export_events(size_t *written)
+{
+	std::vector<ExportedEvent> events;
+	ExportedEvent event;
+	FILE *fp = tmpfile();
+	char *line = NULL, name[64], ph[8];
+	size_t size = 0, line_num = 0;
+	ssize_t len;
+	bool last = false;
+
+	*written = export_chrome_trace(fp);
+	rewind(fp);
+
+	while ((len = getline(&line, &size, fp)) != -1) {
+		if (len && line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (line_num++ == 0) {
+			CHECK(!strcmp(line, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":["), "bad header: %s", line);
+			continue;
+		}
+		if (!strcmp(line, "]}")) {
+			CHECK(getline(&line, &size, fp) == -1, "more after the end");
+			break;
+		}
+
+		// Every event but the last is followed by a comma:
+		CHECK(!last, "comma missing before %s", line);
+		if (line[len - 1] == ',')
+			line[--len] = '\0';
+		else
+			last = true;
+		CHECK(line[0] == '{' && line[len - 1] == '}', "bad event: %s", line);
+
+		event.dur = -1;
+		if (!parse_field(line, "\"name\":\"", "%63[^\"]", name) ||
+				!parse_field(line, "\"ph\":\"", "%7[^\"]", ph) ||
+				!parse_field(line, "\"ts\":", "%lf", &event.ts) ||
+				!parse_field(line, "\"tid\":", "%llu", &event.tid) ||
+				!parse_field(line, "\"args\":{\"arg\":\"", "%llx", &event.arg)) {
+			CHECK(false, "bad event: %s", line);
+			continue;
+		}
+		CHECK(strstr(line, "\"pid\":1,"), "no pid: %s", line);
+		event.name = name;
+		event.ph = ph;
+		if (event.ph == "X")
+			CHECK(parse_field(line, "\"dur\":", "%lf", &event.dur), "no duration: %s", line);
+		else
+			CHECK(event.ph == "i" && strstr(line, "\"s\":\"t\"") && !strstr(line, "\"dur\""), "bad instant: %s", line);
+
+		events.push_back(event);
+	}
+	CHECK(last || events.empty(), "unterminated export");
+
+	free(line);
+	fclose(fp);
+
+	CHECK(events.size() == *written, "%zu events exported, %zu returned", events.size(), *written);
+
+	// Sorted by start time within each thread:
+	std::map<unsigned long long, double> last_ts;
+	for (const ExportedEvent &e : events) {
+		CHECK(!last_ts.count(e.tid) || e.ts >= last_ts[e.tid], "%s at %.3f after %.3f", e.name.c_str(), e.ts, last_ts[e.tid]);
+		last_ts[e.tid] = e.ts;
+	}
+
+	return events;
+}
+
+// The events with an arg in [first, first + count):
+static std::vector<ExportedEvent> events_in(const std::vector<ExportedEvent> &events,
+		unsigned long long first, unsigned long long count)
+{
+	std::vector<ExportedEvent> ret;
+
+	for (const ExportedEvent &event : events) {
+		if (event.arg >= first && event.arg < first + count)
+			ret.push_back(event);
+	}
+
+	return ret;
+}
+
+static void test_recording()
+{
+	std::vector<ExportedEvent> events, found;
+	size_t written;
+	int t, i;
+
+	// Disabled until configured:
+	instant(Event::PRESENT, 1);
+	{
+		Scope scope(Event::DRAW, 1);
+	}
+	events = export_events(&written);
+	CHECK(written == 0, "%zu events recorded while disabled", written);
+
+	configure(64);
+	{
+		Scope outer(Event::COMMAND_LIST, 0x100);
+		{
+			Scope inner(Event::DRAW, 0);
+			inner.set_arg(0x101);
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		instant(Event::PRESENT, 0x102);
+	}
+	events = export_events(&written);
+	CHECK(written == 3, "%zu events", written);
+	if (written == 3) {
+		// Sorted by start time, although the inner scope ended first:
+		CHECK(events[0].name == "CommandList" && events[0].ph == "X" && events[0].arg == 0x100, "%s", events[0].name.c_str());
+		CHECK(events[1].name == "Draw" && events[1].ph == "X" && events[1].arg == 0x101, "%s", events[1].name.c_str());
+		CHECK(events[2].name == "Present" && events[2].ph == "i" && events[2].arg == 0x102, "%s", events[2].name.c_str());
+		CHECK(events[1].dur >= 5000 && events[1].dur < 5000000, "slept for %.3fus", events[1].dur);
+		CHECK(events[0].ts <= events[1].ts && events[1].ts + events[1].dur <= events[0].ts + events[0].dur &&
+				events[2].ts >= events[1].ts + events[1].dur && events[2].ts <= events[0].ts + events[0].dur,
+				"events not nested");
+		CHECK(events[0].ts == 0, "first event at %.3f", events[0].ts);
+	}
+
+	// Each thread records into its own buffer:
+	std::vector<std::thread> threads;
+	for (t = 0; t < 4; t++) {
+		threads.emplace_back([t]() {
+			for (int i = 0; i < 10; i++)
+				instant(Event::MAP, 0x1000 * (t + 1) + i);
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+	threads.clear();
+
+	events = export_events(&written);
+	CHECK(written == 43, "%zu events", written);
+	for (t = 0; t < 4; t++) {
+		found = events_in(events, 0x1000 * (t + 1), 10);
+		CHECK(found.size() == 10, "thread %i: %zu events", t, found.size());
+		for (i = 0; i < (int)found.size(); i++) {
+			CHECK(found[i].tid == found[0].tid && found[i].tid != events[0].tid, "thread %i: wrong tid", t);
+			CHECK(found[i].arg == 0x1000ull * (t + 1) + i && found[i].name == "Map", "thread %i: event %i wrong", t, i);
+		}
+	}
+
+	// New buffers get the new size, while existing ones keep theirs:
+	configure(16);
+	std::thread([]() {
+		for (int i = 0; i < 100; i++)
+			instant(Event::SHADER_REGEX, 0x10000 + i);
+	}).join();
+	for (i = 0; i < 100; i++)
+		instant(Event::CREATE_SHADER, 0x20000 + i);
+
+	events = export_events(&written);
+	found = events_in(events, 0x10000, 100);
+	CHECK(found.size() == 15 && found[0].arg == 0x10000 + 85, "%zu events from the new thread", found.size());
+	found = events_in(events, 0x20000, 100);
+	CHECK(found.size() == 63 && found[0].arg == 0x20000 + 37, "%zu events from the main thread", found.size());
+
+	// And nothing more once disabled again:
+	configure(0);
+	instant(Event::PRESENT, 0x30000);
+	std::thread([]() {
+		Scope scope(Event::DRAW, 0x30001);
+		instant(Event::PRESENT, 0x30002);
+	}).join();
+	events = export_events(&written);
+	CHECK(events_in(events, 0x30000, 3).empty(), "recorded while disabled");
+
+	CHECK(!strcmp(event_name(Event::INVALID), "Unknown") && !strcmp(event_name((Event)1000), "Unknown") &&
+			!strcmp(event_name(Event::SHADER_REGEX), "ShaderRegex"), "bad names");
+}
+
+// Exporting while other threads record, and new threads register:
+static void test_export_while_recording()
+{
+	std::vector<std::thread> threads;
+	std::atomic<bool> stop(false);
+	size_t written;
+	int t, i;
+
+	configure(256);
+	for (t = 0; t < 3; t++) {
+		threads.emplace_back([&stop]() {
+			uint64_t n = 0;
+
+			while (!stop) {
+				Scope scope(Event::DRAW, n++);
+				if (n % 1000 == 0)
+					std::thread([]() { instant(Event::MAP, 0); }).join();
+			}
+		});
+	}
+
+	for (i = 0; i < 20 && failures < 10; i++) {
+		export_events(&written);
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+
+	stop = true;
+	for (std::thread &thread : threads)
+		thread.join();
+	configure(0);
+}
+
+int main()
+{
+	test_ring_buffer();
+	test_concurrent_snapshots();
+	test_recording();
+	test_export_while_recording();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("ok\n");
+	return failures ? 1 : 0;
+}
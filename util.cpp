@@ -583,6 +583,11 @@ static LONG WINAPI migoto_exception_filter(_In_ struct _EXCEPTION_POINTERS *Exce
 
 	// Before anything else, flush the log file and log exception info
 
+#ifdef MIGOTO_ASYNC_LOG
+	// Write out anything still queued and log synchronously from here on:
+	AsyncLog::flush_for_crash();
+#endif
+
 	if (LogFile) {
 		fflush(LogFile);
 